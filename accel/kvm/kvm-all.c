@@ -45,6 +45,9 @@
 #include "qapi/qapi-visit-common.h"
 #include "sysemu/reset.h"
 #include "qemu/guest-random.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
+#include "qapi/qapi-commands-machine.h"
 #include "sysemu/hw_accel.h"
 #include "kvm-cpus.h"
 
@@ -104,6 +107,12 @@ struct KVMState
     OnOffAuto kernel_irqchip_split;
     bool sync_mmu;
     uint64_t manual_dirty_log_protect;
+    /* Number of dirty GFNs per vCPU ring, 0 when using the dirty bitmap */
+    uint32_t kvm_dirty_ring_size;
+    uint32_t kvm_dirty_ring_bytes;
+    QemuThread kvm_dirty_ring_reaper;
+    /* Upper bound of the userspace halt polling window, 0 to disable */
+    uint32_t halt_poll_max_ns;
     /* The man page (and posix) say ioctl numbers are signed int, but
      * they're not.  Linux, glibc and *BSD all treat ioctl numbers as
      * unsigned, and treating them as signed here can break things */
@@ -115,6 +124,14 @@ struct KVMState
     int nr_allocated_irq_routes;
     unsigned long *used_gsi_bitmap;
     unsigned int gsi_count;
+    /* Index of each GSI below gsi_count in irq_routes->entries, or -1 */
+    int *irq_route_index;
+    /* Set when irq_routes differs from what was last passed to KVM */
+    bool irq_routes_dirty;
+    uint64_t irq_route_updates;
+    uint64_t irq_route_updates_unchanged;
+    uint64_t irq_route_commits;
+    uint64_t irq_route_commits_skipped;
     QTAILQ_HEAD(, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
 #endif
     KVMMemoryListener memory_listener;
@@ -215,6 +232,220 @@ void kvm_resample_fd_notify(int gsi)
     }
 }
 
+int64_t kvm_halt_poll_max_ns(void)
+{
+    return kvm_state->halt_poll_max_ns;
+}
+
+#define KVM_EXIT_STATS_NR 64
+
+typedef struct KVMExitRegionStats {
+    char *name;
+    uint64_t mmio;
+    uint64_t pio;
+} KVMExitRegionStats;
+
+typedef struct KVMExitStats {
+    Stat64 count[KVM_EXIT_STATS_NR];
+    Stat64 time_ns[KVM_EXIT_STATS_NR];
+    /* Protects regions, which maps MemoryRegion pointers to their stats */
+    QemuMutex lock;
+    GHashTable *regions;
+} KVMExitStats;
+
+static const char *const kvm_exit_reason_names[KVM_EXIT_STATS_NR] = {
+    [KVM_EXIT_UNKNOWN] = "unknown",
+    [KVM_EXIT_EXCEPTION] = "exception",
+    [KVM_EXIT_IO] = "io",
+    [KVM_EXIT_HYPERCALL] = "hypercall",
+    [KVM_EXIT_DEBUG] = "debug",
+    [KVM_EXIT_HLT] = "hlt",
+    [KVM_EXIT_MMIO] = "mmio",
+    [KVM_EXIT_IRQ_WINDOW_OPEN] = "irq-window-open",
+    [KVM_EXIT_SHUTDOWN] = "shutdown",
+    [KVM_EXIT_FAIL_ENTRY] = "fail-entry",
+    [KVM_EXIT_INTR] = "intr",
+    [KVM_EXIT_SET_TPR] = "set-tpr",
+    [KVM_EXIT_TPR_ACCESS] = "tpr-access",
+    [KVM_EXIT_S390_SIEIC] = "s390-sieic",
+    [KVM_EXIT_S390_RESET] = "s390-reset",
+    [KVM_EXIT_DCR] = "dcr",
+    [KVM_EXIT_NMI] = "nmi",
+    [KVM_EXIT_INTERNAL_ERROR] = "internal-error",
+    [KVM_EXIT_OSI] = "osi",
+    [KVM_EXIT_PAPR_HCALL] = "papr-hcall",
+    [KVM_EXIT_S390_UCONTROL] = "s390-ucontrol",
+    [KVM_EXIT_WATCHDOG] = "watchdog",
+    [KVM_EXIT_S390_TSCH] = "s390-tsch",
+    [KVM_EXIT_EPR] = "epr",
+    [KVM_EXIT_SYSTEM_EVENT] = "system-event",
+    [KVM_EXIT_S390_STSI] = "s390-stsi",
+    [KVM_EXIT_IOAPIC_EOI] = "ioapic-eoi",
+    [KVM_EXIT_HYPERV] = "hyperv",
+    [KVM_EXIT_ARM_NISV] = "arm-nisv",
+    [KVM_EXIT_X86_RDMSR] = "x86-rdmsr",
+    [KVM_EXIT_X86_WRMSR] = "x86-wrmsr",
+    [KVM_EXIT_DIRTY_RING_FULL] = "dirty-ring-full",
+};
+
+static void kvm_exit_region_stats_free(gpointer data)
+{
+    KVMExitRegionStats *r = data;
+
+    g_free(r->name);
+    g_free(r);
+}
+
+static void kvm_exit_stats_init(CPUState *cpu)
+{
+    KVMExitStats *st = g_new0(KVMExitStats, 1);
+
+    qemu_mutex_init(&st->lock);
+    st->regions = g_hash_table_new_full(NULL, NULL, NULL,
+                                        kvm_exit_region_stats_free);
+    cpu->kvm_exit_stats = st;
+}
+
+static void kvm_exit_stats_destroy(CPUState *cpu)
+{
+    KVMExitStats *st = cpu->kvm_exit_stats;
+
+    if (st) {
+        g_hash_table_destroy(st->regions);
+        qemu_mutex_destroy(&st->lock);
+        g_free(st);
+        cpu->kvm_exit_stats = NULL;
+    }
+}
+
+static void kvm_exit_stats_account(CPUState *cpu, uint32_t reason,
+                                   int64_t ns)
+{
+    KVMExitStats *st = cpu->kvm_exit_stats;
+
+    if (reason < KVM_EXIT_STATS_NR) {
+        stat64_add(&st->count[reason], 1);
+        stat64_add(&st->time_ns[reason], ns);
+    }
+}
+
+/*
+ * Attribute an MMIO or PIO exit to the region it hit.  Regions are only
+ * used as keys, their name is copied when they are first seen.
+ */
+static void kvm_exit_stats_region(CPUState *cpu, AddressSpace *as,
+                                  hwaddr addr, bool pio)
+{
+    KVMExitStats *st = cpu->kvm_exit_stats;
+    KVMExitRegionStats *r;
+    MemoryRegion *mr;
+    hwaddr xlat, len = 1;
+
+    RCU_READ_LOCK_GUARD();
+    mr = address_space_translate(as, addr, &xlat, &len, false,
+                                 MEMTXATTRS_UNSPECIFIED);
+
+    qemu_mutex_lock(&st->lock);
+    r = g_hash_table_lookup(st->regions, mr);
+    if (!r) {
+        r = g_new0(KVMExitRegionStats, 1);
+        r->name = g_strdup(memory_region_name(mr));
+        g_hash_table_insert(st->regions, mr, r);
+    }
+    if (pio) {
+        r->pio++;
+    } else {
+        r->mmio++;
+    }
+    qemu_mutex_unlock(&st->lock);
+}
+
+KvmVcpuExitStatsList *qmp_query_kvm_exits(Error **errp)
+{
+    KvmVcpuExitStatsList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    if (!kvm_enabled()) {
+        error_setg(errp, "KVM is not enabled");
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        KVMExitStats *st = cpu->kvm_exit_stats;
+        KvmVcpuExitStats *info;
+        KvmVcpuExitStatsList *entry;
+        GHashTableIter iter;
+        gpointer value;
+        int i;
+
+        if (!st) {
+            continue;
+        }
+
+        info = g_new0(KvmVcpuExitStats, 1);
+        info->cpu_index = cpu->cpu_index;
+        for (i = KVM_EXIT_STATS_NR - 1; i >= 0; i--) {
+            uint64_t count = stat64_get(&st->count[i]);
+            KvmExitReasonStats *e;
+
+            if (!count) {
+                continue;
+            }
+            e = g_new0(KvmExitReasonStats, 1);
+            e->reason = kvm_exit_reason_names[i] ?
+                        g_strdup(kvm_exit_reason_names[i]) :
+                        g_strdup_printf("exit-%d", i);
+            e->count = count;
+            e->time_ns = stat64_get(&st->time_ns[i]);
+            QAPI_LIST_PREPEND(info->exits, e);
+        }
+
+        qemu_mutex_lock(&st->lock);
+        g_hash_table_iter_init(&iter, st->regions);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            KVMExitRegionStats *r = value;
+            KvmExitRegionStats *e = g_new0(KvmExitRegionStats, 1);
+
+            e->region = g_strdup(r->name);
+            e->mmio = r->mmio;
+            e->pio = r->pio;
+            QAPI_LIST_PREPEND(info->regions, e);
+        }
+        qemu_mutex_unlock(&st->lock);
+
+        entry = g_new0(KvmVcpuExitStatsList, 1);
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return head;
+}
+
+KvmIrqRouteStats *qmp_query_kvm_irq_routes(Error **errp)
+{
+    KvmIrqRouteStats *info;
+
+    if (!kvm_enabled()) {
+        error_setg(errp, "KVM is not enabled");
+        return NULL;
+    }
+
+    info = g_new0(KvmIrqRouteStats, 1);
+#ifdef KVM_CAP_IRQ_ROUTING
+    {
+        KVMState *s = kvm_state;
+
+        info->routes = s->irq_routes ? s->irq_routes->nr : 0;
+        info->updates = s->irq_route_updates;
+        info->updates_unchanged = s->irq_route_updates_unchanged;
+        info->commits = s->irq_route_commits;
+        info->commits_skipped = s->irq_route_commits_skipped;
+    }
+#endif
+    return info;
+}
+
 int kvm_get_max_memslots(void)
 {
     KVMState *s = KVM_STATE(current_accel());
@@ -246,17 +477,100 @@ int kvm_memcrypt_encrypt_data(uint8_t *ptr, uint64_t len)
 static KVMSlot *kvm_get_free_slot(KVMMemoryListener *kml)
 {
     KVMState *s = kvm_state;
-    int i;
+    unsigned long i = find_first_zero_bit(kml->used_slots, s->nr_slots);
 
-    for (i = 0; i < s->nr_slots; i++) {
-        if (kml->slots[i].memory_size == 0) {
-            return &kml->slots[i];
-        }
+    if (i < s->nr_slots) {
+        return &kml->slots[i];
     }
 
     return NULL;
 }
 
+/*
+ * Index in slots_by_addr of the first slot that ends after @addr.
+ * Called with KVMMemoryListener.slots_lock held.
+ */
+static int kvm_slot_index(KVMMemoryListener *kml, hwaddr addr)
+{
+    int lo = 0, hi = kml->nr_used_slots;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        KVMSlot *mem = kml->slots_by_addr[mid];
+
+        if (mem->start_addr + mem->memory_size - 1 < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Called with KVMMemoryListener.slots_lock held */
+static void kvm_slot_insert(KVMMemoryListener *kml, KVMSlot *mem)
+{
+    int i = kvm_slot_index(kml, mem->start_addr);
+
+    memmove(&kml->slots_by_addr[i + 1], &kml->slots_by_addr[i],
+            (kml->nr_used_slots - i) * sizeof(KVMSlot *));
+    kml->slots_by_addr[i] = mem;
+    kml->nr_used_slots++;
+    set_bit(mem->slot, kml->used_slots);
+}
+
+/* Called with KVMMemoryListener.slots_lock held */
+static void kvm_slot_remove(KVMMemoryListener *kml, KVMSlot *mem)
+{
+    int i = kvm_slot_index(kml, mem->start_addr);
+
+    assert(i < kml->nr_used_slots && kml->slots_by_addr[i] == mem);
+    kml->nr_used_slots--;
+    memmove(&kml->slots_by_addr[i], &kml->slots_by_addr[i + 1],
+            (kml->nr_used_slots - i) * sizeof(KVMSlot *));
+    clear_bit(mem->slot, kml->used_slots);
+}
+
+static int kvm_set_user_memory_region(KVMMemoryListener *kml, KVMSlot *slot,
+                                      bool new);
+
+/*
+ * Unregister a slot whose removal was deferred by kvm_set_phys_mem().
+ * Called with KVMMemoryListener.slots_lock held.
+ */
+static void kvm_slot_flush_del(KVMMemoryListener *kml, KVMSlot *mem)
+{
+    int err;
+
+    kvm_slot_remove(kml, mem);
+    mem->memory_size = 0;
+    mem->flags = 0;
+    err = kvm_set_user_memory_region(kml, mem, false);
+    if (err) {
+        fprintf(stderr, "%s: error unregistering slot: %s\n",
+                __func__, strerror(-err));
+        abort();
+    }
+    memory_region_unref(mem->del_pending);
+    mem->del_pending = NULL;
+}
+
+/* Called with KVMMemoryListener.slots_lock held */
+static void kvm_slots_flush_del(KVMMemoryListener *kml)
+{
+    int i = 0;
+
+    while (i < kml->nr_used_slots) {
+        KVMSlot *mem = kml->slots_by_addr[i];
+
+        if (mem->del_pending) {
+            kvm_slot_flush_del(kml, mem);
+        } else {
+            i++;
+        }
+    }
+}
+
 bool kvm_has_free_slot(MachineState *ms)
 {
     KVMState *s = KVM_STATE(ms->accelerator);
@@ -275,6 +589,11 @@ static KVMSlot *kvm_alloc_slot(KVMMemoryListener *kml)
 {
     KVMSlot *slot = kvm_get_free_slot(kml);
 
+    if (!slot) {
+        /* Slots that are going away anyway can make room */
+        kvm_slots_flush_del(kml);
+        slot = kvm_get_free_slot(kml);
+    }
     if (slot) {
         return slot;
     }
@@ -287,13 +606,13 @@ static KVMSlot *kvm_lookup_matching_slot(KVMMemoryListener *kml,
                                          hwaddr start_addr,
                                          hwaddr size)
 {
-    KVMState *s = kvm_state;
-    int i;
+    int i = kvm_slot_index(kml, start_addr);
 
-    for (i = 0; i < s->nr_slots; i++) {
-        KVMSlot *mem = &kml->slots[i];
+    if (i < kml->nr_used_slots) {
+        KVMSlot *mem = kml->slots_by_addr[i];
 
-        if (start_addr == mem->start_addr && size == mem->memory_size) {
+        if (start_addr == mem->start_addr && size == mem->memory_size &&
+            !mem->del_pending) {
             return mem;
         }
     }
@@ -381,6 +700,9 @@ err:
     return ret;
 }
 
+static uint64_t kvm_dirty_ring_reap_locked(KVMState *s,
+                                           KVMMemoryListener *locked);
+
 static int do_kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -406,6 +728,18 @@ static int do_kvm_destroy_vcpu(CPUState *cpu)
     if (ret < 0) {
         goto err;
     }
+    kvm_exit_stats_destroy(cpu);
+
+    if (cpu->kvm_dirty_gfns) {
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap_locked(s, NULL);
+        qemu_mutex_unlock_iothread();
+        ret = munmap(cpu->kvm_dirty_gfns, s->kvm_dirty_ring_bytes);
+        if (ret < 0) {
+            goto err;
+        }
+        cpu->kvm_dirty_gfns = NULL;
+    }
 
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
@@ -468,6 +802,8 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
         goto err;
     }
 
+    kvm_exit_stats_init(cpu);
+
     cpu->kvm_run = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED,
                         cpu->kvm_fd, 0);
     if (cpu->kvm_run == MAP_FAILED) {
@@ -483,6 +819,21 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
             (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
     }
 
+    if (s->kvm_dirty_ring_size) {
+        cpu->kvm_dirty_gfns = mmap(NULL, s->kvm_dirty_ring_bytes,
+                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                   cpu->kvm_fd,
+                                   PAGE_SIZE * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            ret = -errno;
+            cpu->kvm_dirty_gfns = NULL;
+            error_setg_errno(errp, -ret,
+                             "kvm_init_vcpu: mmap'ing dirty ring failed (%lu)",
+                             kvm_arch_vcpu_id(cpu));
+            goto err;
+        }
+    }
+
     ret = kvm_arch_init_vcpu(cpu);
     if (ret < 0) {
         error_setg_errno(errp, -ret,
@@ -626,6 +977,126 @@ static void kvm_memslot_init_dirty_bitmap(KVMSlot *mem)
     mem->dirty_bmap = g_malloc0(bitmap_size);
 }
 
+static KVMMemoryListener *kvm_dirty_ring_find_kml(KVMState *s, int as_id)
+{
+    int i;
+
+    for (i = 0; i < s->nr_as; i++) {
+        if (s->as[i].ml && s->as[i].ml->as_id == as_id) {
+            return s->as[i].ml;
+        }
+    }
+    return NULL;
+}
+
+/* Called with the slots_lock of every KVMMemoryListener held */
+static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
+                                     uint32_t slot_id, uint64_t offset)
+{
+    KVMMemoryListener *kml = kvm_dirty_ring_find_kml(s, as_id);
+    uint8_t clients = DIRTY_CLIENTS_NOCODE;
+    KVMSlot *mem;
+
+    if (!kml || slot_id >= s->nr_slots) {
+        return;
+    }
+    mem = &kml->slots[slot_id];
+    if (!mem->memory_size ||
+        offset >= mem->memory_size / qemu_real_host_page_size) {
+        return;
+    }
+    if (!global_dirty_log) {
+        clients &= ~(1 << DIRTY_MEMORY_MIGRATION);
+    }
+    if (mem->ram_block) {
+        qatomic_set_u64(&mem->ram_block->dirty_ring_pages,
+                        mem->ram_block->dirty_ring_pages + 1);
+    }
+    cpu_physical_memory_set_dirty_range(mem->ram_start_offset +
+                                        offset * qemu_real_host_page_size,
+                                        qemu_real_host_page_size, clients);
+}
+
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+{
+    struct kvm_dirty_gfn *cur;
+    uint32_t ring_size = s->kvm_dirty_ring_size;
+    uint32_t count = 0;
+
+    for (;;) {
+        cur = &cpu->kvm_dirty_gfns[cpu->kvm_fetch_index & (ring_size - 1)];
+        /* Pairs with the release in the kernel when publishing the entry */
+        if (!(qatomic_load_acquire(&cur->flags) & KVM_DIRTY_GFN_F_DIRTY)) {
+            break;
+        }
+        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
+                                 cur->offset);
+        /* Hand the entry back to the kernel for KVM_RESET_DIRTY_RINGS */
+        qatomic_store_release(&cur->flags, KVM_DIRTY_GFN_F_RESET);
+        cpu->kvm_fetch_index++;
+        count++;
+    }
+    qatomic_set_u64(&cpu->dirty_pages, cpu->dirty_pages + count);
+    return count;
+}
+
+/*
+ * kvm_dirty_ring_reap_locked - Collect the dirty GFNs of all vCPU rings
+ *
+ * Must be called with the BQL held, which serializes the harvesting of
+ * the rings.  The slots_lock of every memory listener is taken, except
+ * for @locked which the caller already holds.
+ */
+static uint64_t kvm_dirty_ring_reap_locked(KVMState *s,
+                                           KVMMemoryListener *locked)
+{
+    CPUState *cpu;
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < s->nr_as; i++) {
+        if (s->as[i].ml && s->as[i].ml != locked) {
+            kvm_slots_lock(s->as[i].ml);
+        }
+    }
+
+    CPU_FOREACH(cpu) {
+        if (cpu->kvm_dirty_gfns) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+    }
+
+    if (total) {
+        int ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        assert(ret == (int)total);
+    }
+
+    for (i = 0; i < s->nr_as; i++) {
+        if (s->as[i].ml && s->as[i].ml != locked) {
+            kvm_slots_unlock(s->as[i].ml);
+        }
+    }
+    return total;
+}
+
+static void *kvm_dirty_ring_reaper_thread(void *data)
+{
+    KVMState *s = data;
+
+    rcu_register_thread();
+
+    for (;;) {
+        /* A full ring also kicks a reap from the vCPU thread */
+        g_usleep(G_USEC_PER_SEC);
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap_locked(s, NULL);
+        qemu_mutex_unlock_iothread();
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
 /**
  * kvm_physical_sync_dirty_bitmap - Sync dirty bitmap from kernel space
  *
@@ -647,6 +1118,12 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
     hwaddr slot_size, slot_offset = 0;
     int ret = 0;
 
+    if (s->kvm_dirty_ring_size) {
+        /* The rings are not per slot, reaping them covers every section */
+        kvm_dirty_ring_reap_locked(s, kml);
+        return 0;
+    }
+
     size = kvm_align_section(section, &start_addr);
     while (size) {
         MemoryRegionSection subsection = *section;
@@ -826,12 +1303,13 @@ static int kvm_physical_log_clear(KVMMemoryListener *kml,
 
     kvm_slots_lock(kml);
 
-    for (i = 0; i < s->nr_slots; i++) {
-        mem = &kml->slots[i];
-        /* Discard slots that are empty or do not overlap the section */
-        if (!mem->memory_size ||
-            mem->start_addr > start + size - 1 ||
-            start > mem->start_addr + mem->memory_size - 1) {
+    for (i = kvm_slot_index(kml, start); i < kml->nr_used_slots; i++) {
+        mem = kml->slots_by_addr[i];
+        /* Stop at the first slot past the section */
+        if (mem->start_addr > start + size - 1) {
+            break;
+        }
+        if (mem->del_pending) {
             continue;
         }
 
@@ -1134,6 +1612,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     MemoryRegion *mr = section->mr;
     bool writeable = !mr->readonly && !mr->rom_device;
     hwaddr start_addr, size, slot_size;
+    ram_addr_t ram_start_offset;
     void *ram;
 
     if (!memory_region_is_ram(mr)) {
@@ -1154,6 +1633,9 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     /* use aligned delta to align the ram address */
     ram = memory_region_get_ram_ptr(mr) + section->offset_within_region +
           (start_addr - section->offset_within_address_space);
+    ram_start_offset = memory_region_get_ram_addr(mr) +
+                       section->offset_within_region +
+                       (start_addr - section->offset_within_address_space);
 
     kvm_slots_lock(kml);
 
@@ -1168,17 +1650,14 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                 kvm_physical_sync_dirty_bitmap(kml, section);
             }
 
-            /* unregister the slot */
+            /*
+             * Unregister the slot at commit time unless the same memory
+             * is added back in the meantime, as BAR and ROM toggling do.
+             */
             g_free(mem->dirty_bmap);
             mem->dirty_bmap = NULL;
-            mem->memory_size = 0;
-            mem->flags = 0;
-            err = kvm_set_user_memory_region(kml, mem, false);
-            if (err) {
-                fprintf(stderr, "%s: error unregistering slot: %s\n",
-                        __func__, strerror(-err));
-                abort();
-            }
+            memory_region_ref(mr);
+            mem->del_pending = mr;
             start_addr += slot_size;
             size -= slot_size;
         } while (size);
@@ -1187,11 +1666,41 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
 
     /* register the new slot */
     do {
+        KVMSlot *old = NULL;
+        int i;
+
         slot_size = MIN(kvm_max_slot_size, size);
-        mem = kvm_alloc_slot(kml);
-        mem->memory_size = slot_size;
-        mem->start_addr = start_addr;
-        mem->ram = ram;
+
+        /* Drop the pending removals in the way, but keep an exact match */
+        i = kvm_slot_index(kml, start_addr);
+        while (i < kml->nr_used_slots) {
+            mem = kml->slots_by_addr[i];
+            if (mem->start_addr > start_addr + slot_size - 1) {
+                break;
+            }
+            if (mem->del_pending && mem->start_addr == start_addr &&
+                mem->memory_size == slot_size && mem->ram == ram) {
+                old = mem;
+                i++;
+            } else if (mem->del_pending) {
+                kvm_slot_flush_del(kml, mem);
+            } else {
+                i++;
+            }
+        }
+
+        if (old) {
+            mem = old;
+            memory_region_unref(mem->del_pending);
+            mem->del_pending = NULL;
+        } else {
+            mem = kvm_alloc_slot(kml);
+            mem->memory_size = slot_size;
+            mem->start_addr = start_addr;
+            mem->ram = ram;
+        }
+        mem->ram_start_offset = ram_start_offset;
+        mem->ram_block = mr->ram_block;
         mem->flags = kvm_mem_flags(mr);
 
         if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
@@ -1201,13 +1710,24 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
              */
             kvm_memslot_init_dirty_bitmap(mem);
         }
-        err = kvm_set_user_memory_region(kml, mem, true);
+        if (old) {
+            err = 0;
+            if (mem->flags != mem->old_flags) {
+                err = kvm_set_user_memory_region(kml, mem, false);
+            }
+        } else {
+            err = kvm_set_user_memory_region(kml, mem, true);
+            if (!err) {
+                kvm_slot_insert(kml, mem);
+            }
+        }
         if (err) {
             fprintf(stderr, "%s: error registering slot: %s\n", __func__,
                     strerror(-err));
             abort();
         }
         start_addr += slot_size;
+        ram_start_offset += slot_size;
         ram += slot_size;
         size -= slot_size;
     } while (size);
@@ -1234,6 +1754,15 @@ static void kvm_region_del(MemoryListener *listener,
     memory_region_unref(section->mr);
 }
 
+static void kvm_commit(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+
+    kvm_slots_lock(kml);
+    kvm_slots_flush_del(kml);
+    kvm_slots_unlock(kml);
+}
+
 static void kvm_log_sync(MemoryListener *listener,
                          MemoryRegionSection *section)
 {
@@ -1344,6 +1873,8 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 
     qemu_mutex_init(&kml->slots_lock);
     kml->slots = g_malloc0(s->nr_slots * sizeof(KVMSlot));
+    kml->slots_by_addr = g_new0(KVMSlot *, s->nr_slots);
+    kml->used_slots = bitmap_new(s->nr_slots);
     kml->as_id = as_id;
 
     for (i = 0; i < s->nr_slots; i++) {
@@ -1352,6 +1883,7 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 
     kml->listener.region_add = kvm_region_add;
     kml->listener.region_del = kvm_region_del;
+    kml->listener.commit = kvm_commit;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
     kml->listener.log_sync = kvm_log_sync;
@@ -1418,6 +1950,10 @@ void kvm_init_irq_routing(KVMState *s)
         /* Round up so we can search ints using ffs */
         s->used_gsi_bitmap = bitmap_new(gsi_count);
         s->gsi_count = gsi_count;
+        s->irq_route_index = g_new(int, gsi_count);
+        for (i = 0; i < gsi_count; i++) {
+            s->irq_route_index[i] = -1;
+        }
     }
 
     s->irq_routes = g_malloc0(sizeof(*s->irq_routes));
@@ -1444,10 +1980,48 @@ void kvm_irqchip_commit_routes(KVMState *s)
         return;
     }
 
+    /*
+     * Callers commit after every change they might have made, e.g. on each
+     * MSI-X vector unmask, but most of the time the guest rewrote the same
+     * message.  Replacing the whole routing table is expensive in KVM, so
+     * skip it when nothing changed.
+     */
+    if (!s->irq_routes_dirty) {
+        s->irq_route_commits_skipped++;
+        return;
+    }
+
     s->irq_routes->flags = 0;
     trace_kvm_irqchip_commit_routes();
     ret = kvm_vm_ioctl(s, KVM_SET_GSI_ROUTING, s->irq_routes);
     assert(ret == 0);
+    s->irq_routes_dirty = false;
+    s->irq_route_commits++;
+}
+
+static void kvm_set_routing_index(KVMState *s, unsigned int gsi, int n)
+{
+    if (gsi < s->gsi_count) {
+        s->irq_route_index[gsi] = n;
+    }
+}
+
+static struct kvm_irq_routing_entry *kvm_find_routing_entry(KVMState *s,
+                                                            unsigned int gsi)
+{
+    int n;
+
+    if (gsi < s->gsi_count) {
+        n = s->irq_route_index[gsi];
+        return n < 0 ? NULL : &s->irq_routes->entries[n];
+    }
+
+    for (n = 0; n < s->irq_routes->nr; n++) {
+        if (s->irq_routes->entries[n].gsi == gsi) {
+            return &s->irq_routes->entries[n];
+        }
+    }
+    return NULL;
 }
 
 static void kvm_add_routing_entry(KVMState *s,
@@ -1471,6 +2045,8 @@ static void kvm_add_routing_entry(KVMState *s,
 
     *new = *entry;
 
+    kvm_set_routing_index(s, entry->gsi, n);
+    s->irq_routes_dirty = true;
     set_gsi(s, entry->gsi);
 }
 
@@ -1478,24 +2054,22 @@ static int kvm_update_routing_entry(KVMState *s,
                                     struct kvm_irq_routing_entry *new_entry)
 {
     struct kvm_irq_routing_entry *entry;
-    int n;
-
-    for (n = 0; n < s->irq_routes->nr; n++) {
-        entry = &s->irq_routes->entries[n];
-        if (entry->gsi != new_entry->gsi) {
-            continue;
-        }
 
-        if(!memcmp(entry, new_entry, sizeof *entry)) {
-            return 0;
-        }
-
-        *entry = *new_entry;
+    entry = kvm_find_routing_entry(s, new_entry->gsi);
+    if (!entry) {
+        return -ESRCH;
+    }
 
+    s->irq_route_updates++;
+    if (!memcmp(entry, new_entry, sizeof *entry)) {
+        s->irq_route_updates_unchanged++;
         return 0;
     }
 
-    return -ESRCH;
+    *entry = *new_entry;
+    s->irq_routes_dirty = true;
+
+    return 0;
 }
 
 void kvm_irqchip_add_irq_route(KVMState *s, int irq, int irqchip, int pin)
@@ -1526,8 +2100,13 @@ void kvm_irqchip_release_virq(KVMState *s, int virq)
         if (e->gsi == virq) {
             s->irq_routes->nr--;
             *e = s->irq_routes->entries[s->irq_routes->nr];
+            if (i < s->irq_routes->nr) {
+                kvm_set_routing_index(s, e->gsi, i);
+            }
+            s->irq_routes_dirty = true;
         }
     }
+    kvm_set_routing_index(s, virq, -1);
     clear_gsi(s, virq);
     kvm_arch_release_virq_post(virq);
     trace_kvm_irqchip_release_virq(virq);
@@ -2140,7 +2719,35 @@ static int kvm_init(MachineState *ms)
     s->coalesced_pio = s->coalesced_mmio &&
                        kvm_check_extension(s, KVM_CAP_COALESCED_PIO);
 
-    dirty_log_manual_caps =
+    if (s->kvm_dirty_ring_size) {
+        uint64_t ring_bytes = (uint64_t)s->kvm_dirty_ring_size *
+                              sizeof(struct kvm_dirty_gfn);
+        int max_bytes = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+
+        if (max_bytes <= 0) {
+            warn_report("KVM dirty ring not available, "
+                        "falling back to the dirty bitmap");
+            s->kvm_dirty_ring_size = 0;
+        } else if (ring_bytes > max_bytes) {
+            error_report("KVM dirty ring size %" PRIu32 " too big "
+                         "(maximum is %zu), try a smaller value",
+                         s->kvm_dirty_ring_size,
+                         max_bytes / sizeof(struct kvm_dirty_gfn));
+            ret = -EINVAL;
+            goto err;
+        } else {
+            ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+            if (ret) {
+                error_report("Enabling of KVM dirty ring failed: %s",
+                             strerror(-ret));
+                goto err;
+            }
+            s->kvm_dirty_ring_bytes = ring_bytes;
+        }
+    }
+
+    /* The dirty ring does not use KVM_GET_DIRTY_LOG nor its clearing */
+    dirty_log_manual_caps = s->kvm_dirty_ring_size ? 0 :
         kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2);
     dirty_log_manual_caps &= (KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE |
                               KVM_DIRTY_LOG_INITIALLY_SET);
@@ -2254,6 +2861,12 @@ static int kvm_init(MachineState *ms)
         assert(!ret);
     }
 
+    if (s->kvm_dirty_ring_size) {
+        qemu_thread_create(&s->kvm_dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+
     cpus_register_accel(&kvm_cpus);
     return 0;
 
@@ -2453,6 +3066,7 @@ int kvm_cpu_exec(CPUState *cpu)
 {
     struct kvm_run *run = cpu->kvm_run;
     int ret, run_ret;
+    int64_t exit_start;
 
     DPRINTF("kvm_cpu_exec()\n");
 
@@ -2523,10 +3137,12 @@ int kvm_cpu_exec(CPUState *cpu)
             break;
         }
 
+        exit_start = get_clock();
         trace_kvm_run_exit(cpu->cpu_index, run->exit_reason);
         switch (run->exit_reason) {
         case KVM_EXIT_IO:
             DPRINTF("handle_io\n");
+            kvm_exit_stats_region(cpu, &address_space_io, run->io.port, true);
             /* Called outside BQL */
             kvm_handle_io(run->io.port, attrs,
                           (uint8_t *)run + run->io.data_offset,
@@ -2537,6 +3153,8 @@ int kvm_cpu_exec(CPUState *cpu)
             break;
         case KVM_EXIT_MMIO:
             DPRINTF("handle_mmio\n");
+            kvm_exit_stats_region(cpu, &address_space_memory,
+                                  run->mmio.phys_addr, false);
             /* Called outside BQL */
             address_space_rw(&address_space_memory,
                              run->mmio.phys_addr, attrs,
@@ -2549,6 +3167,14 @@ int kvm_cpu_exec(CPUState *cpu)
             DPRINTF("irq_window_open\n");
             ret = EXCP_INTERRUPT;
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            /* Called outside BQL */
+            trace_kvm_dirty_ring_full(cpu->cpu_index);
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_reap_locked(kvm_state, NULL);
+            qemu_mutex_unlock_iothread();
+            ret = 0;
+            break;
         case KVM_EXIT_SHUTDOWN:
             DPRINTF("shutdown\n");
             qemu_system_reset_request(SHUTDOWN_CAUSE_GUEST_RESET);
@@ -2590,6 +3216,8 @@ int kvm_cpu_exec(CPUState *cpu)
             ret = kvm_arch_handle_exit(cpu, run);
             break;
         }
+        kvm_exit_stats_account(cpu, run->exit_reason,
+                               get_clock() - exit_start);
     } while (ret == 0);
 
     cpu_exec_end(cpu);
@@ -2732,6 +3360,11 @@ bool kvm_has_sync_mmu(void)
     return kvm_state->sync_mmu;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return kvm_state && kvm_state->kvm_dirty_ring_size;
+}
+
 int kvm_has_vcpu_events(void)
 {
     return kvm_state->vcpu_events;
@@ -3145,6 +3778,58 @@ static void kvm_set_kvm_shadow_mem(Object *obj, Visitor *v,
     s->kvm_shadow_mem = value;
 }
 
+static void kvm_get_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value & (value - 1)) {
+        error_setg(errp, "dirty-ring-size must be a power of 2");
+        return;
+    }
+
+    s->kvm_dirty_ring_size = value;
+}
+
+static void kvm_get_halt_poll_max_ns(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->halt_poll_max_ns;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_halt_poll_max_ns(Object *obj, Visitor *v,
+                                     const char *name, void *opaque,
+                                     Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->halt_poll_max_ns = value;
+}
+
 static void kvm_set_kernel_irqchip(Object *obj, Visitor *v,
                                    const char *name, void *opaque,
                                    Error **errp)
@@ -3222,6 +3907,19 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "kvm-shadow-mem",
         "KVM shadow MMU size");
+
+    object_class_property_add(oc, "dirty-ring-size", "uint32",
+        kvm_get_dirty_ring_size, kvm_set_dirty_ring_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-size",
+        "KVM dirty ring size per vCPU, in entries (0 to use the bitmap)");
+
+    object_class_property_add(oc, "halt-poll-max-ns", "uint32",
+        kvm_get_halt_poll_max_ns, kvm_set_halt_poll_max_ns,
+        NULL, NULL);
+    object_class_property_set_description(oc, "halt-poll-max-ns",
+        "Maximum time to poll in userspace for a halted vCPU without "
+        "in-kernel irqchip (0 = disabled)");
 }
 
 static const TypeInfo kvm_accel_type = {
@@ -20,9 +20,71 @@
 #include "sysemu/runstate.h"
 #include "sysemu/cpus.h"
 #include "qemu/guest-random.h"
+#include "qemu/timer.h"
 #include "qapi/error.h"
 
 #include "kvm-cpus.h"
+#include "trace.h"
+
+static bool kvm_halt_poll_done(CPUState *cpu)
+{
+    return qatomic_read(&cpu->interrupt_request) ||
+           qatomic_read(&cpu->thread_kicked);
+}
+
+/*
+ * Without an in-kernel irqchip, HLT exits to userspace and the vCPU
+ * thread sleeps on halt_cond.  Spin for a while first, without the BQL,
+ * and adjust the window to the wakeup latency like aio_poll() does.
+ */
+static void kvm_wait_io_event(CPUState *cpu)
+{
+    int64_t max_ns = kvm_halt_poll_max_ns();
+    int64_t poll_ns = cpu->kvm_halt_poll_ns;
+    int64_t start, block_ns;
+    bool hit;
+
+    if (!max_ns || kvm_halt_in_kernel() || !cpu->halted ||
+        !cpu_thread_is_idle(cpu)) {
+        qemu_wait_io_event(cpu);
+        return;
+    }
+
+    start = get_clock();
+    if (poll_ns) {
+        qemu_mutex_unlock_iothread();
+        while (!kvm_halt_poll_done(cpu) && get_clock() - start < poll_ns) {
+            /* spin */
+        }
+        qemu_mutex_lock_iothread();
+    }
+    hit = !cpu_thread_is_idle(cpu);
+    if (poll_ns) {
+        cpu->kvm_halt_poll_total_ns += get_clock() - start;
+        cpu->kvm_halt_polls++;
+        cpu->kvm_halt_poll_hits += hit;
+    }
+
+    qemu_wait_io_event(cpu);
+    block_ns = get_clock() - start;
+    trace_kvm_halt_poll(cpu->cpu_index, poll_ns, block_ns,
+                        cpu->kvm_halt_poll_hits, cpu->kvm_halt_polls);
+
+    if (block_ns <= poll_ns) {
+        /* This is the sweet spot, no adjustment needed */
+    } else if (block_ns > max_ns) {
+        /* We'd have to poll for too long, poll less */
+        cpu->kvm_halt_poll_ns /= 2;
+        trace_kvm_halt_poll_shrink(cpu->cpu_index, poll_ns,
+                                   cpu->kvm_halt_poll_ns);
+    } else if (poll_ns < max_ns) {
+        /* There is room to grow, poll longer */
+        cpu->kvm_halt_poll_ns = poll_ns ? MIN(poll_ns * 2, max_ns) :
+                                          MIN(4000, max_ns);
+        trace_kvm_halt_poll_grow(cpu->cpu_index, poll_ns,
+                                 cpu->kvm_halt_poll_ns);
+    }
+}
 
 static void *kvm_vcpu_thread_fn(void *arg)
 {
@@ -51,7 +113,7 @@ static void *kvm_vcpu_thread_fn(void *arg)
                 cpu_handle_guest_debug(cpu);
             }
         }
-        qemu_wait_io_event(cpu);
+        kvm_wait_io_event(cpu);
     } while (!cpu->unplug || cpu_can_run(cpu));
 
     kvm_destroy_vcpu(cpu);
@@ -16,6 +16,8 @@
 
 #ifndef CONFIG_USER_ONLY
 #include "hw/pci/msi.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
 #endif
 
 KVMState *kvm_state;
@@ -45,6 +47,11 @@ bool kvm_has_sync_mmu(void)
     return false;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return false;
+}
+
 int kvm_has_many_ioeventfds(void)
 {
     return 0;
@@ -158,4 +165,16 @@ bool kvm_arm_supports_user_irq(void)
 {
     return false;
 }
+
+KvmVcpuExitStatsList *qmp_query_kvm_exits(Error **errp)
+{
+    error_setg(errp, "KVM is not enabled");
+    return NULL;
+}
+
+KvmIrqRouteStats *qmp_query_kvm_irq_routes(Error **errp)
+{
+    error_setg(errp, "KVM is not enabled");
+    return NULL;
+}
 #endif
@@ -31,6 +31,7 @@
 #include "qemu/rcu.h"
 #include "exec/tb-hash.h"
 #include "exec/tb-lookup.h"
+#include "exec/tb-stats.h"
 #include "exec/log.h"
 #include "qemu/main-loop.h"
 #if defined(TARGET_I386) && !defined(CONFIG_USER_ONLY)
@@ -145,8 +146,6 @@ static void init_delay_params(SyncClocks *sc, const CPUState *cpu)
 }
 #endif /* CONFIG USER ONLY */
 
-static int hit_once = 0;
-
 /* Execute a TB, and fix up the CPU state afterwards if necessary */
 static inline tcg_target_ulong cpu_tb_exec(CPUState *cpu, TranslationBlock *itb)
 {
@@ -156,28 +155,10 @@ static inline tcg_target_ulong cpu_tb_exec(CPUState *cpu, TranslationBlock *itb)
     int tb_exit;
     uint8_t *tb_ptr = itb->tc.ptr;
 
-    if(unlikely((itb->pc == afl_start_code) && !hit_once)){
-        printf("[+] hit start code!\n");
-        // TODO: At first, fork a copy of qemu,
-        // then, set start_trace = true
-        // AFL_QEMU_CPU_SNIPPET2;
-        afl_setup();
-        afl_forkserver(cpu);
-        start_trace = true;
-        hit_once+=1;
-    }
-    if(start_trace)
-    {
-        afl_maybe_log(itb->pc);
-        // printf("[+] log addr: %#x\n", itb->pc);
-    }
-
-    qemu_log_mask_and_addr(CPU_LOG_EXEC, itb->pc,
-                           "Trace %d: %p ["
-                           TARGET_FMT_lx "/" TARGET_FMT_lx "/%#x] %s\n",
-                           cpu->cpu_index, itb->tc.ptr,
-                           itb->cs_base, itb->pc, itb->flags,
-                           lookup_symbol(itb->pc));
+    qemu_log_mask_and_addr_buffered(CPU_LOG_EXEC, itb->pc,
+        "Trace %d: %p [" TARGET_FMT_lx "/" TARGET_FMT_lx "/%#x] %s\n",
+        cpu->cpu_index, itb->tc.ptr, itb->cs_base, itb->pc, itb->flags,
+        lookup_symbol(itb->pc));
 
 #if defined(DEBUG_DISAS)
     if (qemu_loglevel_mask(CPU_LOG_TB_CPU)
@@ -200,6 +181,7 @@ static inline tcg_target_ulong cpu_tb_exec(CPUState *cpu, TranslationBlock *itb)
     last_tb = (TranslationBlock *)(ret & ~TB_EXIT_MASK);
     tb_exit = ret & TB_EXIT_MASK;
     trace_exec_tb_exit(last_tb, tb_exit);
+    tb_stats_record_exit(last_tb, tb_exit);
 
     if (tb_exit > TB_EXIT_IDX1) {
         /* We didn't start executing this TB (eg because the instruction
@@ -207,11 +189,9 @@ static inline tcg_target_ulong cpu_tb_exec(CPUState *cpu, TranslationBlock *itb)
          * of the start of the TB.
          */
         CPUClass *cc = CPU_GET_CLASS(cpu);
-        qemu_log_mask_and_addr(CPU_LOG_EXEC, last_tb->pc,
-                               "Stopped execution of TB chain before %p ["
-                               TARGET_FMT_lx "] %s\n",
-                               last_tb->tc.ptr, last_tb->pc,
-                               lookup_symbol(last_tb->pc));
+        qemu_log_mask_and_addr_buffered(CPU_LOG_EXEC, last_tb->pc,
+            "Stopped execution of TB chain before %p [" TARGET_FMT_lx "] %s\n",
+            last_tb->tc.ptr, last_tb->pc, lookup_symbol(last_tb->pc));
         if (cc->synchronize_from_tb) {
             cc->synchronize_from_tb(cpu, last_tb);
         } else {
@@ -408,11 +388,9 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
 
     qemu_spin_unlock(&tb_next->jmp_lock);
 
-    qemu_log_mask_and_addr(CPU_LOG_EXEC, tb->pc,
-                           "Linking TBs %p [" TARGET_FMT_lx
-                           "] index %d -> %p [" TARGET_FMT_lx "]\n",
-                           tb->tc.ptr, tb->pc, n,
-                           tb_next->tc.ptr, tb_next->pc);
+    qemu_log_mask_and_addr_buffered(CPU_LOG_EXEC, tb->pc,
+        "Linking TBs %p [" TARGET_FMT_lx "] index %d -> %p [" TARGET_FMT_lx
+        "]\n", tb->tc.ptr, tb->pc, n, tb_next->tc.ptr, tb_next->pc);
     return;
 
  out_unlock_next:
@@ -430,9 +408,25 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
 
     tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
     if (tb == NULL) {
-        mmap_lock();
-        tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
-        mmap_unlock();
+        int slot;
+
+        cf_mask = tb_io_cflags(pc, cf_mask);
+        slot = tb_inflight_begin(pc, cs_base, flags, cf_mask);
+
+        if (slot < 0) {
+            /* Another vCPU may just have translated it */
+            tb = tb_htable_lookup(cpu, pc, cs_base, flags, cf_mask);
+        }
+        if (tb == NULL) {
+            AFL_QEMU_CPU_SNIPPET0;
+            mmap_lock();
+            tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
+            mmap_unlock();
+            AFL_QEMU_CPU_SNIPPET1;
+        }
+        if (slot >= 0) {
+            tb_inflight_end(slot);
+        }
         /* We add the TB in the virtual pc hash table for the fast lookup */
         qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
     }
@@ -445,16 +439,10 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
         last_tb = NULL;
     }
 #endif
-/*
- * chaining complicates AFL's instrumentation so we disable it
- * by Triforce AFL
- */
-#ifdef NOPE_NOT_NEVER
     /* See if we can patch the calling TB. */
     if (last_tb) {
         tb_add_jump(last_tb, tb_exit, tb);
     }
-#endif
     return tb;
 }
 
@@ -218,8 +218,10 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->hindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->htable, -1, sizeof(desc->htable));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
@@ -254,6 +256,68 @@ static inline void tlb_n_used_entries_dec(CPUArchState *env, uintptr_t mmu_idx)
     env_tlb(env)->d[mmu_idx].n_used_entries--;
 }
 
+/*
+ * Address space banks.
+ *
+ * When a target switches to another address space id, the entries of the
+ * one being left are moved into a bank, and the bank of the one being
+ * entered, if any, is moved back into the tlb.  Moving is done by swapping
+ * the descriptors, so the tables themselves are never copied.  Banks get
+ * the same page flushes as the tlb, and are dropped by any full flush of
+ * their mmu_idx.  tlb_reset_dirty also applies to them, so that writes
+ * to pages with code or under dirty tracking still take the slow path
+ * once the bank is back.
+ */
+#define CPU_TLB_ASID_BANKS 4
+
+typedef struct CPUTLBBank {
+    uint64_t asid;
+    /* mmu_idx that hold entries of @asid, 0 if the bank is free */
+    uint16_t idxmap;
+    /* mmu_idx whose d and f have been allocated */
+    uint16_t alloc;
+    /* value of tlb_c.bank_stamp when the bank was last filled */
+    uint64_t stamp;
+    CPUTLBDesc d[NB_MMU_MODES];
+    CPUTLBDescFast f[NB_MMU_MODES];
+} CPUTLBBank;
+
+/* Called with tlb_c.lock held */
+static void tlb_bank_swap_locked(CPUArchState *env, CPUTLBBank *bank,
+                                 int mmu_idx)
+{
+    CPUTLB *tlb = env_tlb(env);
+    CPUTLBDesc desc = tlb->d[mmu_idx];
+    CPUTLBDescFast fast = tlb->f[mmu_idx];
+
+    tlb->d[mmu_idx] = bank->d[mmu_idx];
+    tlb->f[mmu_idx] = bank->f[mmu_idx];
+    bank->d[mmu_idx] = desc;
+    bank->f[mmu_idx] = fast;
+}
+
+/*
+ * Called with tlb_c.lock held.
+ * Drop the banks that hold entries for any of @idxmap.  The address space
+ * of the current entries is then unknown, because the target may have
+ * changed it together with the flush.
+ */
+static void tlb_banks_drop_locked(CPUArchState *env, uint16_t idxmap)
+{
+    CPUTLBCommon *c = &env_tlb(env)->c;
+    int i;
+
+    if (!(idxmap & c->asid_idxmap)) {
+        return;
+    }
+    c->asid_valid = false;
+    if (c->banks) {
+        for (i = 0; i < CPU_TLB_ASID_BANKS; i++) {
+            c->banks[i].idxmap = 0;
+        }
+    }
+}
+
 void tlb_init(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -264,6 +328,12 @@ void tlb_init(CPUState *cpu)
 
     /* All tlbs are initialized flushed. */
     env_tlb(env)->c.dirty = 0;
+    env_tlb(env)->c.n_pending = 0;
+    env_tlb(env)->c.pending_full = 0;
+    env_tlb(env)->c.pending_queued = false;
+    env_tlb(env)->c.asid_valid = false;
+    env_tlb(env)->c.asid_idxmap = 0;
+    env_tlb(env)->c.banks = NULL;
 
     for (i = 0; i < NB_MMU_MODES; i++) {
         tlb_mmu_init(&env_tlb(env)->d[i], &env_tlb(env)->f[i], now);
@@ -273,7 +343,8 @@ void tlb_init(CPUState *cpu)
 void tlb_destroy(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i;
+    CPUTLBBank *banks = env_tlb(env)->c.banks;
+    int i, j;
 
     qemu_spin_destroy(&env_tlb(env)->c.lock);
     for (i = 0; i < NB_MMU_MODES; i++) {
@@ -283,27 +354,35 @@ void tlb_destroy(CPUState *cpu)
         g_free(fast->table);
         g_free(desc->iotlb);
     }
-}
-
-/* flush_all_helper: run fn across all cpus
- *
- * If the wait flag is set then the src cpu's helper will be queued as
- * "safe" work and the loop exited creating a synchronisation point
- * where all queued work will be finished before execution starts
- * again.
- */
-static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
-                             run_on_cpu_data d)
-{
-    CPUState *cpu;
 
-    CPU_FOREACH(cpu) {
-        if (cpu != src) {
-            async_run_on_cpu(cpu, fn, d);
+    if (banks) {
+        for (j = 0; j < CPU_TLB_ASID_BANKS; j++) {
+            for (i = 0; i < NB_MMU_MODES; i++) {
+                if (banks[j].alloc & (1 << i)) {
+                    g_free(banks[j].f[i].table);
+                    g_free(banks[j].d[i].iotlb);
+                }
+            }
         }
+        g_free(banks);
+        env_tlb(env)->c.banks = NULL;
     }
 }
 
+/*
+ * tlb_flush_queue, tlb_flush_queue_all: queue a flush on another cpu,
+ * or on all cpus but src, merged with whatever they already have
+ * pending.  Defined below, next to the worker that does the flushes.
+ *
+ * The _synced callers queue the src cpu's own flush as "safe" work,
+ * and the loop exited creates a synchronisation point where all queued
+ * work will be finished before execution starts again.
+ */
+static void tlb_flush_queue(CPUState *cpu, target_ulong addr,
+                            uint16_t idxmap, unsigned bits);
+static void tlb_flush_queue_all(CPUState *src, target_ulong addr,
+                                uint16_t idxmap, unsigned bits);
+
 void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
 {
     CPUState *cpu;
@@ -334,6 +413,8 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 
     qemu_spin_lock(&env_tlb(env)->c.lock);
 
+    tlb_banks_drop_locked(env, asked);
+
     all_dirty = env_tlb(env)->c.dirty;
     to_clean = asked & all_dirty;
     all_dirty &= ~to_clean;
@@ -367,8 +448,7 @@ void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
     tlb_debug("mmu_idx: 0x%" PRIx16 "\n", idxmap);
 
     if (cpu->created && !qemu_cpu_is_self(cpu)) {
-        async_run_on_cpu(cpu, tlb_flush_by_mmuidx_async_work,
-                         RUN_ON_CPU_HOST_INT(idxmap));
+        tlb_flush_queue(cpu, 0, idxmap, 0);
     } else {
         tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(idxmap));
     }
@@ -385,7 +465,7 @@ void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, uint16_t idxmap)
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    tlb_flush_queue_all(src_cpu, 0, idxmap, 0);
     fn(src_cpu, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
@@ -400,7 +480,7 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    tlb_flush_queue_all(src_cpu, 0, idxmap, 0);
     async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
@@ -409,6 +489,95 @@ void tlb_flush_all_cpus_synced(CPUState *src_cpu)
     tlb_flush_by_mmuidx_all_cpus_synced(src_cpu, ALL_MMUIDX_BITS);
 }
 
+void tlb_switch_asid_by_mmuidx(CPUState *cpu, uint16_t idxmap,
+                               uint64_t asid, bool flush)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBCommon *c = &env_tlb(env)->c;
+    int64_t now = get_clock_realtime();
+    CPUTLBBank *bank = NULL;
+    bool restore;
+    uint16_t work;
+    int i;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("asid:0x%" PRIx64 " mmu_idx:0x%" PRIx16 " flush:%d\n",
+              asid, idxmap, flush);
+
+    qemu_spin_lock(&c->lock);
+
+    if (c->asid_valid && c->asid == asid && c->asid_idxmap == idxmap) {
+        if (flush) {
+            for (work = idxmap & c->dirty; work != 0; work &= work - 1) {
+                tlb_flush_one_mmuidx_locked(env, ctz32(work), now);
+            }
+            c->dirty &= ~idxmap;
+        }
+        qemu_spin_unlock(&c->lock);
+        if (flush) {
+            cpu_tb_jmp_cache_clear(cpu);
+        }
+        return;
+    }
+
+    if (!c->banks) {
+        c->banks = g_new0(CPUTLBBank, CPU_TLB_ASID_BANKS);
+    }
+    if (c->asid_idxmap != idxmap) {
+        tlb_banks_drop_locked(env, ALL_MMUIDX_BITS);
+    }
+
+    /* Use the bank of @asid if there is one, else the least recently used */
+    for (i = 0; i < CPU_TLB_ASID_BANKS; i++) {
+        CPUTLBBank *b = &c->banks[i];
+
+        if (b->idxmap == idxmap && b->asid == asid) {
+            bank = b;
+            break;
+        }
+        if (!bank || (bank->idxmap && (!b->idxmap || b->stamp < bank->stamp))) {
+            bank = b;
+        }
+    }
+    restore = !flush && bank->idxmap == idxmap && bank->asid == asid;
+
+    for (work = idxmap; work != 0; work &= work - 1) {
+        int mmu_idx = ctz32(work);
+
+        if (!(bank->alloc & (1 << mmu_idx))) {
+            tlb_mmu_init(&bank->d[mmu_idx], &bank->f[mmu_idx], now);
+            bank->alloc |= 1 << mmu_idx;
+        }
+        tlb_bank_swap_locked(env, bank, mmu_idx);
+        if (!restore) {
+            tlb_flush_one_mmuidx_locked(env, mmu_idx, now);
+        }
+    }
+
+    /* The bank now holds the entries of the address space being left */
+    if (c->asid_valid && c->asid_idxmap == idxmap) {
+        bank->asid = c->asid;
+        bank->idxmap = idxmap;
+        bank->stamp = ++c->bank_stamp;
+    } else {
+        bank->idxmap = 0;
+    }
+
+    if (restore) {
+        c->dirty |= idxmap;
+    } else {
+        c->dirty &= ~idxmap;
+    }
+    c->asid = asid;
+    c->asid_valid = true;
+    c->asid_idxmap = idxmap;
+
+    qemu_spin_unlock(&c->lock);
+
+    cpu_tb_jmp_cache_clear(cpu);
+}
+
 static bool tlb_hit_page_mask_anyprot(CPUTLBEntry *tlb_entry,
                                       target_ulong page, target_ulong mask)
 {
@@ -475,12 +644,62 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(env, mmu_idx, page, -1);
 }
 
+/*
+ * Called with tlb_c.lock held.
+ * Flush every piece of the large pages in htable that match @page
+ * under @mask, and forget about those large pages.
+ */
+static void tlb_flush_huge_page_locked(CPUArchState *env, int midx,
+                                       target_ulong page, target_ulong mask)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    int k;
+
+    for (k = 0; k < CPU_HTLB_SIZE; k++) {
+        CPUTLBHugeEntry *he = &d->htable[k];
+        target_ulong he_mask = mask & ~(he->size - 1);
+        size_t n_pages, i;
+
+        if (he->vaddr == (target_ulong)-1 ||
+            ((page ^ he->vaddr) & he_mask) != 0) {
+            continue;
+        }
+
+        tlb_debug("flush large page midx %d (" TARGET_FMT_lx
+                  "/" TARGET_FMT_lx ")\n", midx, he->vaddr, he->size);
+
+        n_pages = he->size >> TARGET_PAGE_BITS;
+        if (n_pages < tlb_n_entries(f)) {
+            for (i = 0; i < n_pages; i++) {
+                target_ulong sub = he->vaddr + (i << TARGET_PAGE_BITS);
+
+                if (tlb_flush_entry_mask_locked(tlb_entry(env, midx, sub),
+                                                sub, mask)) {
+                    tlb_n_used_entries_dec(env, midx);
+                }
+            }
+        } else {
+            for (i = 0; i < tlb_n_entries(f); i++) {
+                if (tlb_flush_entry_mask_locked(&f->table[i],
+                                                he->vaddr, he_mask)) {
+                    tlb_n_used_entries_dec(env, midx);
+                }
+            }
+        }
+        tlb_flush_vtlb_page_mask_locked(env, midx, he->vaddr, he_mask);
+        memset(he, -1, sizeof(*he));
+    }
+}
+
 static void tlb_flush_page_locked(CPUArchState *env, int midx,
                                   target_ulong page)
 {
     target_ulong lp_addr = env_tlb(env)->d[midx].large_page_addr;
     target_ulong lp_mask = env_tlb(env)->d[midx].large_page_mask;
 
+    tlb_flush_huge_page_locked(env, midx, page, -1);
+
     /* Check if we need to flush due to large pages.  */
     if ((page & lp_mask) == lp_addr) {
         tlb_debug("forcing full flush midx %d ("
@@ -495,6 +714,38 @@ static void tlb_flush_page_locked(CPUArchState *env, int midx,
     }
 }
 
+static void tlb_flush_page_bits_locked(CPUArchState *env, int midx,
+                                       target_ulong page, unsigned bits);
+
+/*
+ * Called with tlb_c.lock held.
+ * Flush @page, with @bits significant bits, from the banks of @idxmap.
+ */
+static void tlb_banks_flush_page_locked(CPUArchState *env, target_ulong page,
+                                        uint16_t idxmap, unsigned bits)
+{
+    CPUTLBBank *banks = env_tlb(env)->c.banks;
+    uint16_t work;
+    int i;
+
+    if (!banks) {
+        return;
+    }
+    for (i = 0; i < CPU_TLB_ASID_BANKS; i++) {
+        for (work = banks[i].idxmap & idxmap; work != 0; work &= work - 1) {
+            int mmu_idx = ctz32(work);
+
+            tlb_bank_swap_locked(env, &banks[i], mmu_idx);
+            if (bits >= TARGET_LONG_BITS) {
+                tlb_flush_page_locked(env, mmu_idx, page);
+            } else {
+                tlb_flush_page_bits_locked(env, mmu_idx, page, bits);
+            }
+            tlb_bank_swap_locked(env, &banks[i], mmu_idx);
+        }
+    }
+}
+
 /**
  * tlb_flush_page_by_mmuidx_async_0:
  * @cpu: cpu on which to flush
@@ -521,6 +772,7 @@ static void tlb_flush_page_by_mmuidx_async_0(CPUState *cpu,
             tlb_flush_page_locked(env, mmu_idx, addr);
         }
     }
+    tlb_banks_flush_page_locked(env, addr, idxmap, TARGET_LONG_BITS);
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 
     tb_flush_jmp_cache(cpu, addr);
@@ -579,22 +831,8 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-    } else if (idxmap < TARGET_PAGE_SIZE) {
-        /*
-         * Most targets have only a few mmu_idx.  In the case where
-         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
-         * allocating memory for this operation.
-         */
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
-
-        /* Otherwise allocate a structure, freed by the worker.  */
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(d));
+        tlb_flush_queue(cpu, addr, idxmap, TARGET_LONG_BITS);
     }
 }
 
@@ -611,30 +849,7 @@ void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                TLBFlushPageByMMUIdxData *d
-                    = g_new(TLBFlushPageByMMUIdxData, 1);
-
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
-    }
-
+    tlb_flush_queue_all(src_cpu, addr, idxmap, TARGET_LONG_BITS);
     tlb_flush_page_by_mmuidx_async_0(src_cpu, addr, idxmap);
 }
 
@@ -652,31 +867,20 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    tlb_flush_queue_all(src_cpu, addr, idxmap, TARGET_LONG_BITS);
+
     /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
+     * Most targets have only a few mmu_idx.  In the case where
+     * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
+     * allocating memory for this operation.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                               RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+        /* Otherwise allocate a structure, freed by the worker.  */
+        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
@@ -712,6 +916,8 @@ static void tlb_flush_page_bits_locked(CPUArchState *env, int midx,
         return;
     }
 
+    tlb_flush_huge_page_locked(env, midx, page, mask);
+
     /* Check if we need to flush due to large pages.  */
     if ((page & d->large_page_mask) == d->large_page_addr) {
         tlb_debug("forcing full flush midx %d ("
@@ -751,11 +957,124 @@ tlb_flush_page_bits_by_mmuidx_async_0(CPUState *cpu,
             tlb_flush_page_bits_locked(env, mmu_idx, d.addr, d.bits);
         }
     }
+    tlb_banks_flush_page_locked(env, d.addr, d.idxmap, d.bits);
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 
     tb_flush_jmp_cache(cpu, d.addr);
 }
 
+/*
+ * tlb_flush_pending_async_work:
+ * @cpu: cpu on which to flush
+ *
+ * Do all of the flushes that other cpus have queued on @cpu since
+ * the last time, the full flushes first.
+ */
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBCommon *c = &env_tlb(env)->c;
+    CPUTLBPendingFlush pending[CPU_TLB_PENDING_SIZE];
+    uint16_t full;
+    size_t i, n;
+
+    qemu_spin_lock(&c->lock);
+    full = c->pending_full;
+    n = c->n_pending;
+    memcpy(pending, c->pending, n * sizeof(pending[0]));
+    c->pending_full = 0;
+    c->n_pending = 0;
+    c->pending_queued = false;
+    qemu_spin_unlock(&c->lock);
+
+    if (full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full));
+    }
+    for (i = 0; i < n; i++) {
+        uint16_t idxmap = pending[i].idxmap & ~full;
+
+        if (!idxmap) {
+            continue;
+        }
+        if (pending[i].bits >= TARGET_LONG_BITS) {
+            tlb_flush_page_by_mmuidx_async_0(cpu, pending[i].addr, idxmap);
+        } else {
+            TLBFlushPageBitsByMMUIdxData d = {
+                .addr = pending[i].addr,
+                .idxmap = idxmap,
+                .bits = pending[i].bits,
+            };
+            tlb_flush_page_bits_by_mmuidx_async_0(cpu, d);
+        }
+    }
+}
+
+/*
+ * tlb_flush_queue:
+ * @cpu: cpu on which to flush, not the current one
+ * @addr: page of virtual address to flush
+ * @idxmap: set of mmu_idx to flush
+ * @bits: number of significant bits in @addr, or 0 for a full flush
+ *
+ * Rather than one work item per page, which a guest shooting down a
+ * range of pages across many cpus turns into a flood, add the page to
+ * @cpu's pending flushes and make sure one work item is queued to do
+ * them all.  Repeated flushes of the same page are merged; when there
+ * are too many different pages, flush the mmu_idx entirely instead.
+ */
+static void tlb_flush_queue(CPUState *cpu, target_ulong addr,
+                            uint16_t idxmap, unsigned bits)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBCommon *c = &env_tlb(env)->c;
+    bool queue;
+    size_t i;
+
+    qemu_spin_lock(&c->lock);
+    idxmap &= ~c->pending_full;
+    if (idxmap == 0) {
+        /* Already covered by a pending full flush.  */
+    } else if (bits == 0) {
+        c->pending_full |= idxmap;
+    } else {
+        for (i = 0; i < c->n_pending; i++) {
+            if (c->pending[i].addr == addr && c->pending[i].bits == bits) {
+                c->pending[i].idxmap |= idxmap;
+                break;
+            }
+        }
+        if (i == c->n_pending) {
+            if (i < CPU_TLB_PENDING_SIZE) {
+                c->pending[i].addr = addr;
+                c->pending[i].idxmap = idxmap;
+                c->pending[i].bits = bits;
+                c->n_pending++;
+            } else {
+                c->pending_full |= idxmap;
+            }
+        }
+    }
+    queue = !c->pending_queued;
+    c->pending_queued = true;
+    qemu_spin_unlock(&c->lock);
+
+    if (queue) {
+        async_run_on_cpu(cpu, tlb_flush_pending_async_work, RUN_ON_CPU_NULL);
+    }
+}
+
+static void tlb_flush_queue_all(CPUState *src, target_ulong addr,
+                                uint16_t idxmap, unsigned bits)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src) {
+            tlb_flush_queue(cpu, addr, idxmap, bits);
+        }
+    }
+}
+
 static bool encode_pbm_to_runon(run_on_cpu_data *out,
                                 TLBFlushPageBitsByMMUIdxData d)
 {
@@ -796,7 +1115,6 @@ void tlb_flush_page_bits_by_mmuidx(CPUState *cpu, target_ulong addr,
                                    uint16_t idxmap, unsigned bits)
 {
     TLBFlushPageBitsByMMUIdxData d;
-    run_on_cpu_data runon;
 
     /* If all bits are significant, this devolves to tlb_flush_page. */
     if (bits >= TARGET_LONG_BITS) {
@@ -816,16 +1134,8 @@ void tlb_flush_page_bits_by_mmuidx(CPUState *cpu, target_ulong addr,
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_bits_by_mmuidx_async_0(cpu, d);
-    } else if (encode_pbm_to_runon(&runon, d)) {
-        async_run_on_cpu(cpu, tlb_flush_page_bits_by_mmuidx_async_1, runon);
     } else {
-        TLBFlushPageBitsByMMUIdxData *p
-            = g_new(TLBFlushPageBitsByMMUIdxData, 1);
-
-        /* Otherwise allocate a structure, freed by the worker.  */
-        *p = d;
-        async_run_on_cpu(cpu, tlb_flush_page_bits_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(p));
+        tlb_flush_queue(cpu, d.addr, idxmap, bits);
     }
 }
 
@@ -835,7 +1145,6 @@ void tlb_flush_page_bits_by_mmuidx_all_cpus(CPUState *src_cpu,
                                             unsigned bits)
 {
     TLBFlushPageBitsByMMUIdxData d;
-    run_on_cpu_data runon;
 
     /* If all bits are significant, this devolves to tlb_flush_page. */
     if (bits >= TARGET_LONG_BITS) {
@@ -853,24 +1162,7 @@ void tlb_flush_page_bits_by_mmuidx_all_cpus(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    if (encode_pbm_to_runon(&runon, d)) {
-        flush_all_helper(src_cpu, tlb_flush_page_bits_by_mmuidx_async_1, runon);
-    } else {
-        CPUState *dst_cpu;
-        TLBFlushPageBitsByMMUIdxData *p;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                p = g_new(TLBFlushPageBitsByMMUIdxData, 1);
-                *p = d;
-                async_run_on_cpu(dst_cpu,
-                                 tlb_flush_page_bits_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(p));
-            }
-        }
-    }
-
+    tlb_flush_queue_all(src_cpu, d.addr, idxmap, bits);
     tlb_flush_page_bits_by_mmuidx_async_0(src_cpu, d);
 }
 
@@ -898,25 +1190,15 @@ void tlb_flush_page_bits_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
+    tlb_flush_queue_all(src_cpu, d.addr, idxmap, bits);
+
     if (encode_pbm_to_runon(&runon, d)) {
-        flush_all_helper(src_cpu, tlb_flush_page_bits_by_mmuidx_async_1, runon);
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_bits_by_mmuidx_async_1,
                               runon);
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageBitsByMMUIdxData *p;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                p = g_new(TLBFlushPageBitsByMMUIdxData, 1);
-                *p = d;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_bits_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(p));
-            }
-        }
+        TLBFlushPageBitsByMMUIdxData *p
+            = g_new(TLBFlushPageBitsByMMUIdxData, 1);
 
-        p = g_new(TLBFlushPageBitsByMMUIdxData, 1);
         *p = d;
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_bits_by_mmuidx_async_2,
                               RUN_ON_CPU_HOST_PTR(p));
@@ -989,26 +1271,43 @@ static inline void copy_tlb_helper_locked(CPUTLBEntry *d, const CPUTLBEntry *s)
  * We must take tlb_c.lock to avoid racing with another vCPU update. The only
  * thing actually updated is the target TLB entry ->addr_write flags.
  */
+static void tlb_reset_dirty_mmu_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
+                                       ram_addr_t start1, ram_addr_t length)
+{
+    unsigned int i;
+    unsigned int n = tlb_n_entries(fast);
+
+    for (i = 0; i < n; i++) {
+        tlb_reset_dirty_range_locked(&fast->table[i], start1, length);
+    }
+
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        tlb_reset_dirty_range_locked(&desc->vtable[i], start1, length);
+    }
+}
+
 void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
 {
     CPUArchState *env;
+    CPUTLBBank *banks;
 
-    int mmu_idx;
+    int mmu_idx, i;
 
     env = cpu->env_ptr;
     qemu_spin_lock(&env_tlb(env)->c.lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        unsigned int i;
-        unsigned int n = tlb_n_entries(&env_tlb(env)->f[mmu_idx]);
-
-        for (i = 0; i < n; i++) {
-            tlb_reset_dirty_range_locked(&env_tlb(env)->f[mmu_idx].table[i],
-                                         start1, length);
-        }
+        tlb_reset_dirty_mmu_locked(&env_tlb(env)->d[mmu_idx],
+                                   &env_tlb(env)->f[mmu_idx], start1, length);
+    }
 
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
-            tlb_reset_dirty_range_locked(&env_tlb(env)->d[mmu_idx].vtable[i],
-                                         start1, length);
+    banks = env_tlb(env)->c.banks;
+    for (i = 0; banks && i < CPU_TLB_ASID_BANKS; i++) {
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            if (banks[i].idxmap & (1 << mmu_idx)) {
+                tlb_reset_dirty_mmu_locked(&banks[i].d[mmu_idx],
+                                           &banks[i].f[mmu_idx],
+                                           start1, length);
+            }
         }
     }
     qemu_spin_unlock(&env_tlb(env)->c.lock);
@@ -1071,9 +1370,94 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
 }
 
+/*
+ * Remember the most recent large pages exactly, so that they can be
+ * flushed page by page and refilled without a page table walk.  A
+ * large page that is pushed out of htable may still have entries in
+ * the tlb; fall back to the region above for it.
+ */
+static void tlb_add_huge_page(CPUArchState *env, int mmu_idx,
+                              target_ulong vaddr, hwaddr paddr,
+                              MemTxAttrs attrs, int prot, target_ulong size)
+{
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    target_ulong base = vaddr & ~(size - 1);
+    CPUTLBHugeEntry *he;
+    int k;
+
+    for (k = 0; k < CPU_HTLB_SIZE; k++) {
+        he = &desc->htable[k];
+        if (he->vaddr == base && he->size == size) {
+            goto found;
+        }
+    }
+
+    he = &desc->htable[desc->hindex++ % CPU_HTLB_SIZE];
+    if (he->vaddr != (target_ulong)-1) {
+        tlb_add_large_page(env, mmu_idx, he->vaddr, he->size);
+    }
+
+ found:
+    he->vaddr = base;
+    he->size = size;
+    he->paddr = paddr - (vaddr - base);
+    he->attrs = attrs;
+    he->prot = prot;
+}
+
+/*
+ * Refill the tlb for @addr from a large page in htable, if one covers
+ * @addr with the permissions needed for @access_type.
+ */
+static bool tlb_fill_huge_page(CPUState *cpu, target_ulong addr,
+                               MMUAccessType access_type, int mmu_idx)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    int need;
+    int k;
+
+    switch (access_type) {
+    case MMU_DATA_LOAD:
+        need = PAGE_READ;
+        break;
+    case MMU_DATA_STORE:
+        need = PAGE_WRITE;
+        break;
+    default:
+        need = PAGE_EXEC;
+        break;
+    }
+
+    for (k = 0; k < CPU_HTLB_SIZE; k++) {
+        CPUTLBHugeEntry *he = &desc->htable[k];
+        target_ulong page;
+
+        if (he->vaddr == (target_ulong)-1 ||
+            ((addr ^ he->vaddr) & ~(he->size - 1)) != 0) {
+            continue;
+        }
+        /*
+         * PAGE_WRITE_INV asks for a fresh fill on every store, and a
+         * fill is also the only place where the target can set up
+         * permissions it did not grant the first time.
+         */
+        if ((he->prot & need) != need || (he->prot & PAGE_WRITE_INV)) {
+            return false;
+        }
+
+        page = addr & TARGET_PAGE_MASK;
+        tlb_set_page_with_attrs(cpu, page, he->paddr + (page - he->vaddr),
+                                he->attrs, he->prot, mmu_idx, he->size);
+        return true;
+    }
+    return false;
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
- * supplied size is only used by tlb_flush_page.
+ * supplied size is used by tlb_flush_page and to refill the rest of
+ * a large page.
  *
  * Called from TCG-generated code, which is under an RCU read-side
  * critical section.
@@ -1102,7 +1486,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     if (size <= TARGET_PAGE_SIZE) {
         sz = TARGET_PAGE_SIZE;
     } else {
-        tlb_add_large_page(env, mmu_idx, vaddr, size);
+        tlb_add_huge_page(env, mmu_idx, vaddr, paddr, attrs, prot, size);
         sz = size;
     }
     vaddr_page = vaddr & TARGET_PAGE_MASK;
@@ -1282,6 +1666,10 @@ static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
     CPUClass *cc = CPU_GET_CLASS(cpu);
     bool ok;
 
+    if (tlb_fill_huge_page(cpu, addr, access_type, mmu_idx)) {
+        return;
+    }
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1299,7 +1687,7 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
     MemoryRegionSection *section;
     MemoryRegion *mr;
     uint64_t val;
-    bool locked = false;
+    bool locked;
     MemTxResult r;
 
     section = iotlb_to_section(cpu, iotlbentry->addr, iotlbentry->attrs);
@@ -1310,10 +1698,7 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         cpu_io_recompile(cpu, retaddr);
     }
 
-    if (!qemu_mutex_iothread_locked()) {
-        qemu_mutex_lock_iothread();
-        locked = true;
-    }
+    locked = memory_region_lock_for_access(mr);
     r = memory_region_dispatch_read(mr, mr_offset, &val, op, iotlbentry->attrs);
     if (r != MEMTX_OK) {
         hwaddr physaddr = mr_offset +
@@ -1354,7 +1739,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
     hwaddr mr_offset;
     MemoryRegionSection *section;
     MemoryRegion *mr;
-    bool locked = false;
+    bool locked;
     MemTxResult r;
 
     section = iotlb_to_section(cpu, iotlbentry->addr, iotlbentry->attrs);
@@ -1371,10 +1756,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
      */
     save_iotlb_data(cpu, iotlbentry->addr, section, mr_offset);
 
-    if (!qemu_mutex_iothread_locked()) {
-        qemu_mutex_lock_iothread();
-        locked = true;
-    }
+    locked = memory_region_lock_for_access(mr);
     r = memory_region_dispatch_write(mr, mr_offset, val, op, iotlbentry->attrs);
     if (r != MEMTX_OK) {
         hwaddr physaddr = mr_offset +
@@ -1557,7 +1939,8 @@ static int probe_access_internal(CPUArchState *env, target_ulong addr,
             CPUState *cs = env_cpu(env);
             CPUClass *cc = CPU_GET_CLASS(cs);
 
-            if (!cc->tlb_fill(cs, addr, fault_size, access_type,
+            if (!tlb_fill_huge_page(cs, addr, access_type, mmu_idx) &&
+                !cc->tlb_fill(cs, addr, fault_size, access_type,
                               mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
                 *phost = NULL;
@@ -2647,10 +3030,8 @@ void cpu_stq_le_data(CPUArchState *env, target_ulong ptr, uint64_t val)
 #include "atomic_template.h"
 #endif
 
-#if HAVE_CMPXCHG128 || HAVE_ATOMIC128
 #define DATA_SIZE 16
 #include "atomic_template.h"
-#endif
 
 /* Second set of helpers are directly callable from TCG as helpers.  */
 
@@ -76,6 +76,7 @@ enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
     PLUGIN_GEN_CB_MEM,
+    PLUGIN_GEN_CB_MEM_BUF,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
     PLUGIN_GEN_N_CBS,
@@ -126,20 +127,36 @@ static void gen_empty_udata_cb(void)
 }
 
 /*
- * For now we only support addi_i64.
+ * For now we only support addi_i64; a store is injected as an add to 0.
  * When we support more ops, we can generate one empty inline cb for each.
+ *
+ * The op works on ptr + cpu_index * stride, so that per-vCPU counters
+ * need no atomics.  The address computation is left out when injecting
+ * an op on a single location.
  */
 static void gen_empty_inline_cb(void)
 {
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    TCGv_i32 stride = tcg_const_i32(1); /* overwritten later */
+    TCGv_ptr cpu_offset = tcg_temp_new_ptr();
     TCGv_i64 val = tcg_temp_new_i64();
     TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
 
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_mul_i32(cpu_index, cpu_index, stride);
+    tcg_gen_ext_i32_ptr(cpu_offset, cpu_index);
+    tcg_gen_add_ptr(ptr, ptr, cpu_offset);
+
     tcg_gen_ld_i64(val, ptr, 0);
     /* pass an immediate != 0 so that it doesn't get optimized away */
     tcg_gen_addi_i64(val, val, 0xdeadface);
     tcg_gen_st_i64(val, ptr, 0);
     tcg_temp_free_ptr(ptr);
     tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(cpu_offset);
+    tcg_temp_free_i32(stride);
+    tcg_temp_free_i32(cpu_index);
 }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
@@ -147,6 +164,33 @@ static void gen_empty_mem_cb(TCGv addr, uint32_t info)
     do_gen_mem_cb(addr, info);
 }
 
+/*
+ * Append {addr, info} to the vCPU's memory trace buffer.  Unlike the other
+ * templates, this one is kept as is when used, since it has nothing to
+ * fill in.
+ */
+static void gen_empty_mem_buf(TCGv addr, uint32_t info)
+{
+    TCGv_i32 meminfo = tcg_const_i32(info);
+    TCGv_i64 vaddr64 = tcg_temp_new_i64();
+    TCGv_ptr pos = tcg_temp_new_ptr();
+    int pos_offset = offsetof(CPUState, plugin_mem_buf_pos) -
+                     offsetof(ArchCPU, env);
+
+    tcg_gen_ld_ptr(pos, cpu_env, pos_offset);
+    tcg_gen_extu_tl_i64(vaddr64, addr);
+    tcg_gen_st_i64(vaddr64, pos,
+                   offsetof(struct qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i32(meminfo, pos,
+                   offsetof(struct qemu_plugin_mem_record, info));
+    tcg_gen_addi_ptr(pos, pos, sizeof(struct qemu_plugin_mem_record));
+    tcg_gen_st_ptr(pos, cpu_env, pos_offset);
+
+    tcg_temp_free_ptr(pos);
+    tcg_temp_free_i64(vaddr64);
+    tcg_temp_free_i32(meminfo);
+}
+
 /*
  * Share the same function for enable/disable. When enabling, the NULL
  * pointer will be overwritten later.
@@ -231,6 +275,9 @@ void plugin_gen_empty_mem_callback(TCGv addr, uint32_t info)
     fn.mem_fn = gen_empty_mem_cb;
     gen_mem_wrapped(PLUGIN_GEN_CB_MEM, &fn, addr, info, true);
 
+    fn.mem_fn = gen_empty_mem_buf;
+    gen_mem_wrapped(PLUGIN_GEN_CB_MEM_BUF, &fn, addr, info, true);
+
     fn.inline_fn = gen_empty_inline_cb;
     gen_mem_wrapped(PLUGIN_GEN_CB_INLINE, &fn, 0, info, false);
 }
@@ -279,6 +326,12 @@ static TCGOp *copy_op(TCGOp **begin_op, TCGOp *op, TCGOpcode opc)
     return op;
 }
 
+static void skip_op(TCGOp **begin_op, TCGOpcode opc)
+{
+    *begin_op = QTAILQ_NEXT(*begin_op, link);
+    tcg_debug_assert(*begin_op && (*begin_op)->opc == opc);
+}
+
 static TCGOp *copy_extu_i32_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -366,6 +419,26 @@ static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
+/* copy an ld_i64 as a movi of 0 in its destination */
+static TCGOp *copy_ld_i64_as_zero(TCGOp **begin_op, TCGOp *op)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        /* 2x ld_i32 */
+        op = copy_op(begin_op, op, INDEX_op_ld_i32);
+        op->opc = INDEX_op_movi_i32;
+        op->args[1] = 0;
+        op = copy_op(begin_op, op, INDEX_op_ld_i32);
+        op->opc = INDEX_op_movi_i32;
+        op->args[1] = 0;
+    } else {
+        /* ld_i64 */
+        op = copy_op(begin_op, op, INDEX_op_ld_i64);
+        op->opc = INDEX_op_movi_i64;
+        op->args[1] = 0;
+    }
+    return op;
+}
+
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -391,6 +464,26 @@ static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
+static TCGOp *copy_ext_i32_ptr(TCGOp **begin_op, TCGOp *op)
+{
+    if (UINTPTR_MAX == UINT32_MAX) {
+        op = copy_op(begin_op, op, INDEX_op_mov_i32);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_ext_i32_i64);
+    }
+    return op;
+}
+
+static TCGOp *copy_add_ptr(TCGOp **begin_op, TCGOp *op)
+{
+    if (UINTPTR_MAX == UINT32_MAX) {
+        op = copy_op(begin_op, op, INDEX_op_add_i32);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_add_i64);
+    }
+    return op;
+}
+
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -461,11 +554,38 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                TCGOp *begin_op, TCGOp *op,
                                int *unused)
 {
+    /* const_i32 stride */
+    if (cb->inline_insn.stride) {
+        op = copy_op(&begin_op, op, INDEX_op_movi_i32);
+        op->args[1] = cb->inline_insn.stride;
+    } else {
+        skip_op(&begin_op, INDEX_op_movi_i32);
+    }
+
     /* const_ptr */
     op = copy_const_ptr(&begin_op, op, cb->userp);
 
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
+    /* ld_i32 cpu_index, mul_i32, ext_i32_ptr and add_ptr to the vCPU's entry */
+    if (cb->inline_insn.stride) {
+        op = copy_op(&begin_op, op, INDEX_op_ld_i32);
+        op = copy_op(&begin_op, op, INDEX_op_mul_i32);
+        op = copy_ext_i32_ptr(&begin_op, op);
+        op = copy_add_ptr(&begin_op, op);
+    } else {
+        skip_op(&begin_op, INDEX_op_ld_i32);
+        skip_op(&begin_op, INDEX_op_mul_i32);
+        skip_op(&begin_op, UINTPTR_MAX == UINT32_MAX ?
+                           INDEX_op_mov_i32 : INDEX_op_ext_i32_i64);
+        skip_op(&begin_op, UINTPTR_MAX == UINT32_MAX ?
+                           INDEX_op_add_i32 : INDEX_op_add_i64);
+    }
+
+    /* ld_i64, or 0 for a store */
+    if (cb->inline_insn.op == QEMU_PLUGIN_INLINE_STORE_U64) {
+        op = copy_ld_i64_as_zero(&begin_op, op);
+    } else {
+        op = copy_ld_i64(&begin_op, op);
+    }
 
     /* const_i64 */
     op = copy_const_i64(&begin_op, op, cb->inline_insn.imm);
@@ -611,12 +731,13 @@ static void inject_mem_helper(TCGOp *begin_op, GArray *arr)
 static void inject_mem_enable_helper(struct qemu_plugin_insn *plugin_insn,
                                      TCGOp *begin_op)
 {
-    GArray *cbs[2];
+    GArray *cbs[3];
     GArray *arr;
     size_t n_cbs, i;
 
     cbs[0] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR];
     cbs[1] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
+    cbs[2] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_BUF];
 
     n_cbs = 0;
     for (i = 0; i < ARRAY_SIZE(cbs); i++) {
@@ -711,6 +832,38 @@ static void plugin_gen_mem_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(cbs, begin_op, op_rw);
 }
 
+static bool mem_buf_wanted(const GArray *cbs, const TCGOp *begin_op)
+{
+    int i;
+
+    for (i = 0; i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (op_rw(begin_op, cb)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void plugin_gen_mem_buf(const struct qemu_plugin_tb *ptb,
+                               TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+    TCGOp *end_op;
+
+    if (!mem_buf_wanted(insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_BUF], begin_op)) {
+        rm_ops(begin_op);
+        return;
+    }
+    /* keep the template, dropping only its markers */
+    end_op = find_op(begin_op, INDEX_op_plugin_cb_end);
+    tcg_debug_assert(end_op);
+    rm_ops_range(begin_op, begin_op);
+    rm_ops_range(end_op, end_op);
+}
+
 static void plugin_gen_enable_mem_helper(const struct qemu_plugin_tb *ptb,
                                          TCGOp *begin_op, int insn_idx)
 {
@@ -765,6 +918,9 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
         case PLUGIN_GEN_CB_INLINE:
             plugin_gen_mem_inline(ptb, begin_op, insn_idx);
             return;
+        case PLUGIN_GEN_CB_MEM_BUF:
+            plugin_gen_mem_buf(ptb, begin_op, insn_idx);
+            return;
         default:
             g_assert_not_reached();
         }
@@ -819,6 +975,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
+            case PLUGIN_GEN_CB_MEM_BUF:
+                type = "mem buf";
+                break;
             case PLUGIN_GEN_ENABLE_MEM_HELPER:
                 type = "enable mem helper";
                 break;
@@ -835,6 +994,39 @@ static void pr_ops(void)
 #endif
 }
 
+/*
+ * If the TB traces memory accesses into the buffer, have it start by
+ * making room for all the records it stores inline.
+ */
+static void plugin_gen_mem_buf_reserve(struct qemu_plugin_tb *plugin_tb)
+{
+    struct qemu_plugin_insn *insn = NULL;
+    bool used = false;
+    size_t n = 0;
+    TCGOp *op;
+    int insn_idx;
+
+    insn_idx = -1;
+    QSIMPLEQ_FOREACH(op, &tcg_ctx->plugin_ops, plugin_link) {
+        enum plugin_gen_from from = op->args[0];
+        enum plugin_gen_cb type = op->args[1];
+
+        if (from == PLUGIN_GEN_FROM_INSN &&
+            type == PLUGIN_GEN_ENABLE_MEM_HELPER) {
+            insn = g_ptr_array_index(plugin_tb->insns, ++insn_idx);
+            used |= insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_BUF]->len != 0;
+        } else if (from == PLUGIN_GEN_FROM_MEM &&
+                   type == PLUGIN_GEN_CB_MEM_BUF &&
+                   mem_buf_wanted(insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_BUF],
+                                  op)) {
+            n++;
+        }
+    }
+    if (used) {
+        qemu_plugin_tb_mem_buf_reserve(plugin_tb, n);
+    }
+}
+
 static void plugin_gen_inject(const struct qemu_plugin_tb *plugin_tb)
 {
     TCGOp *op;
@@ -917,6 +1109,7 @@ void plugin_gen_tb_end(CPUState *cpu)
 
     /* collect instrumentation requests */
     qemu_plugin_tb_trans_cb(cpu, ptb);
+    plugin_gen_mem_buf_reserve(ptb);
 
     /* inject the instrumentation at the appropriate places */
     plugin_gen_inject(ptb);
@@ -0,0 +1,247 @@
+/*
+ * Translation block statistics
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "qemu/thread.h"
+#include "qemu/xxhash.h"
+#include "exec/tb-stats.h"
+#ifndef CONFIG_USER_ONLY
+#include "qapi/error.h"
+#include "qapi/qapi-commands-misc-target.h"
+#endif
+
+bool tb_stats_enabled;
+
+/*
+ * Entries are never freed: TBs point to them until the next flush, and
+ * there is at most one of them for each distinct block of guest code.
+ */
+static struct {
+    QemuMutex lock;
+    GHashTable *table;
+} tb_stats;
+
+const char * const tb_stats_sort_names[] = {
+    [TB_STATS_SORT_EXEC] = "exec",
+    [TB_STATS_SORT_TRANSLATIONS] = "translations",
+    [TB_STATS_SORT_TIME] = "time",
+    [TB_STATS_SORT_EXITS] = "exits",
+};
+
+static guint tb_stats_hash(gconstpointer p)
+{
+    const TBStatistics *s = p;
+
+    return qemu_xxhash7(s->phys_pc, s->pc, s->flags, s->cs_base, 0);
+}
+
+static gboolean tb_stats_equal(gconstpointer a, gconstpointer b)
+{
+    const TBStatistics *sa = a, *sb = b;
+
+    return sa->phys_pc == sb->phys_pc && sa->pc == sb->pc &&
+           sa->cs_base == sb->cs_base && sa->flags == sb->flags;
+}
+
+static void __attribute__((constructor)) tb_stats_init(void)
+{
+    qemu_mutex_init(&tb_stats.lock);
+    tb_stats.table = g_hash_table_new_full(tb_stats_hash, tb_stats_equal,
+                                           NULL, g_free);
+}
+
+static void do_tb_stats_flush(CPUState *cpu, run_on_cpu_data data)
+{
+    tb_flush(cpu);
+}
+
+void tb_stats_enable(bool enable)
+{
+    if (qatomic_read(&tb_stats_enabled) == enable) {
+        return;
+    }
+    qatomic_set(&tb_stats_enabled, enable);
+    if (first_cpu) {
+        async_safe_run_on_cpu(first_cpu, do_tb_stats_flush, RUN_ON_CPU_NULL);
+    }
+}
+
+static void tb_stats_reset_one(gpointer key, gpointer value, gpointer opaque)
+{
+    TBStatistics *s = value;
+
+    s->exec_count = 0;
+    memset(s->exits, 0, sizeof(s->exits));
+    s->translations = 0;
+    s->translate_ns = 0;
+}
+
+void tb_stats_reset(void)
+{
+    qemu_mutex_lock(&tb_stats.lock);
+    g_hash_table_foreach(tb_stats.table, tb_stats_reset_one, NULL);
+    qemu_mutex_unlock(&tb_stats.lock);
+}
+
+TBStatistics *tb_stats_get(tb_page_addr_t phys_pc, target_ulong pc,
+                           target_ulong cs_base, uint32_t flags)
+{
+    TBStatistics key = {
+        .phys_pc = phys_pc,
+        .pc = pc,
+        .cs_base = cs_base,
+        .flags = flags,
+    };
+    TBStatistics *s;
+
+    qemu_mutex_lock(&tb_stats.lock);
+    s = g_hash_table_lookup(tb_stats.table, &key);
+    if (!s) {
+        s = g_memdup(&key, sizeof(key));
+        g_hash_table_add(tb_stats.table, s);
+    }
+    qemu_mutex_unlock(&tb_stats.lock);
+    return s;
+}
+
+void tb_stats_record_translation(TranslationBlock *tb, int64_t ns)
+{
+    TBStatistics *s = tb->tb_stats;
+
+    qemu_mutex_lock(&tb_stats.lock);
+    s->translations++;
+    s->translate_ns += ns;
+    s->guest_insns = tb->icount;
+    s->guest_bytes = tb->size;
+    s->host_bytes = tb->tc.size;
+    qemu_mutex_unlock(&tb_stats.lock);
+}
+
+static uint64_t tb_stats_exits(const TBStatistics *s)
+{
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < TB_STATS_EXITS; i++) {
+        sum += s->exits[i];
+    }
+    return sum;
+}
+
+static uint64_t tb_stats_key(const TBStatistics *s, TBStatsSort sort)
+{
+    switch (sort) {
+    case TB_STATS_SORT_EXEC:
+        return s->exec_count;
+    case TB_STATS_SORT_TRANSLATIONS:
+        return s->translations;
+    case TB_STATS_SORT_TIME:
+        return s->translate_ns;
+    case TB_STATS_SORT_EXITS:
+        return tb_stats_exits(s);
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static gint tb_stats_cmp(gconstpointer a, gconstpointer b, gpointer opaque)
+{
+    TBStatsSort sort = GPOINTER_TO_INT(opaque);
+    uint64_t ka = tb_stats_key(a, sort);
+    uint64_t kb = tb_stats_key(b, sort);
+
+    /* descending */
+    return ka < kb ? 1 : ka > kb ? -1 : 0;
+}
+
+static void tb_stats_copy_one(gpointer key, gpointer value, gpointer opaque)
+{
+    GArray *arr = opaque;
+    TBStatistics *s = value;
+
+    if (s->exec_count || s->translations || tb_stats_exits(s)) {
+        g_array_append_val(arr, *s);
+    }
+}
+
+GArray *tb_stats_top(TBStatsSort sort, unsigned int max)
+{
+    GArray *arr = g_array_new(FALSE, FALSE, sizeof(TBStatistics));
+
+    qemu_mutex_lock(&tb_stats.lock);
+    g_hash_table_foreach(tb_stats.table, tb_stats_copy_one, arr);
+    qemu_mutex_unlock(&tb_stats.lock);
+
+    g_array_sort_with_data(arr, tb_stats_cmp, GINT_TO_POINTER(sort));
+    if (arr->len > max) {
+        g_array_set_size(arr, max);
+    }
+    return arr;
+}
+
+int tb_stats_sort_parse(const char *name)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(tb_stats_sort_names); i++) {
+        if (!strcmp(name, tb_stats_sort_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#ifndef CONFIG_USER_ONLY
+TbStatsEntryList *qmp_x_query_tb_stats(bool has_max, int64_t max,
+                                       bool has_sort_by, TbStatsSortBy sort_by,
+                                       Error **errp)
+{
+    static const TBStatsSort sorts[TB_STATS_SORT_BY__MAX] = {
+        [TB_STATS_SORT_BY_EXEC] = TB_STATS_SORT_EXEC,
+        [TB_STATS_SORT_BY_TRANSLATIONS] = TB_STATS_SORT_TRANSLATIONS,
+        [TB_STATS_SORT_BY_TIME] = TB_STATS_SORT_TIME,
+        [TB_STATS_SORT_BY_EXITS] = TB_STATS_SORT_EXITS,
+    };
+    TbStatsEntryList *head = NULL, **tail = &head;
+    g_autoptr(GArray) arr = NULL;
+    guint i;
+
+    if (!tb_stats_enabled) {
+        error_setg(errp, "TB statistics are disabled");
+        return NULL;
+    }
+    if (has_max && max <= 0) {
+        error_setg(errp, "Parameter 'max' must be positive");
+        return NULL;
+    }
+
+    arr = tb_stats_top(has_sort_by ? sorts[sort_by] : TB_STATS_SORT_EXEC,
+                       has_max ? MIN(max, UINT_MAX) : 20);
+    for (i = 0; i < arr->len; i++) {
+        TBStatistics *s = &g_array_index(arr, TBStatistics, i);
+        TbStatsEntryList *elem = g_new0(TbStatsEntryList, 1);
+        TbStatsEntry *e = g_new0(TbStatsEntry, 1);
+
+        e->pc = s->pc;
+        e->cs_base = s->cs_base;
+        e->flags = s->flags;
+        e->exec_count = s->exec_count;
+        e->exits = s->exits[0] + s->exits[1];
+        e->exits_requested = s->exits[2];
+        e->translations = s->translations;
+        e->translate_ns = s->translate_ns;
+        e->guest_insns = s->guest_insns;
+        e->guest_bytes = s->guest_bytes;
+        e->host_bytes = s->host_bytes;
+        elem->value = e;
+        *tail = elem;
+        tail = &elem->next;
+    }
+    return head;
+}
+#endif
@@ -25,6 +25,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu-common.h"
+#include "qemu/atomic128.h"
 #include "sysemu/tcg.h"
 #include "sysemu/cpu-timers.h"
 #include "tcg/tcg.h"
@@ -32,6 +33,8 @@
 #include "qemu/error-report.h"
 #include "hw/boards.h"
 #include "qapi/qapi-builtin-visit.h"
+#include "exec/exec-all.h"
+#include "exec/tb-stats.h"
 #include "tcg-cpus.h"
 
 struct TCGState {
@@ -39,6 +42,9 @@ struct TCGState {
 
     bool mttcg_enabled;
     unsigned long tb_size;
+    uint32_t hot_threshold;
+    bool tb_stats;
+    bool atomic128_lock;
 };
 typedef struct TCGState TCGState;
 
@@ -104,6 +110,11 @@ static int tcg_init(MachineState *ms)
 
     tcg_exec_init(s->tb_size * 1024 * 1024);
     mttcg_enabled = s->mttcg_enabled;
+    tcg_hot_threshold = s->hot_threshold;
+    tb_stats_enabled = s->tb_stats;
+#if !HAVE_CMPXCHG128
+    atomic16_lock_enabled = s->atomic128_lock;
+#endif
     cpus_register_accel(&tcg_cpus);
 
     return 0;
@@ -168,6 +179,58 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_hot_threshold(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->hot_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_hot_threshold(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->hot_threshold = value;
+}
+
+static bool tcg_get_tb_stats(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->tb_stats;
+}
+
+static void tcg_set_tb_stats(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->tb_stats = value;
+}
+
+static bool tcg_get_atomic128_lock(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->atomic128_lock;
+}
+
+static void tcg_set_atomic128_lock(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->atomic128_lock = value;
+}
+
 static void tcg_accel_class_init(ObjectClass *oc, void *data)
 {
     AccelClass *ac = ACCEL_CLASS(oc);
@@ -185,6 +248,22 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "hot-threshold", "int",
+        tcg_get_hot_threshold, tcg_set_hot_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "hot-threshold",
+        "Executions after which a TB is retranslated as a superblock");
+
+    object_class_property_add_bool(oc, "tb-stats",
+        tcg_get_tb_stats, tcg_set_tb_stats);
+    object_class_property_set_description(oc, "tb-stats",
+        "Gather execution and translation statistics of each TB");
+
+    object_class_property_add_bool(oc, "atomic128-lock",
+        tcg_get_atomic128_lock, tcg_set_atomic128_lock);
+    object_class_property_set_description(oc, "atomic128-lock",
+        "Emulate 128-bit guest atomics with locks if the host lacks them");
+
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -145,7 +145,7 @@ uint64_t HELPER(ctpop_i64)(uint64_t arg)
     return ctpop64(arg);
 }
 
-void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+static TranslationBlock *lookup_tb(CPUArchState *env)
 {
     CPUState *cpu = env_cpu(env);
     TranslationBlock *tb;
@@ -153,17 +153,39 @@ void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     uint32_t flags;
 
     tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, curr_cflags());
+    if (tb == NULL) {
+        return NULL;
+    }
+    qemu_log_mask_and_addr_buffered(CPU_LOG_EXEC, pc,
+        "Chain %d: %p [" TARGET_FMT_lx "/" TARGET_FMT_lx "/%#x] %s\n",
+        cpu->cpu_index, tb->tc.ptr, cs_base, pc, flags, lookup_symbol(pc));
+    return tb;
+}
+
+void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    TranslationBlock *tb = lookup_tb(env);
+
+    return tb ? tb->tc.ptr : tcg_ctx->code_gen_epilogue;
+}
+
+/* Miss path of tcg_gen_lookup_and_goto_ptr_cached: refill @slot */
+void *HELPER(lookup_tb_ptr_cached)(CPUArchState *env, void *slot)
+{
+    TranslationBlock *tb = lookup_tb(env);
+
     if (tb == NULL) {
         return tcg_ctx->code_gen_epilogue;
     }
-    qemu_log_mask_and_addr(CPU_LOG_EXEC, pc,
-                           "Chain %d: %p ["
-                           TARGET_FMT_lx "/" TARGET_FMT_lx "/%#x] %s\n",
-                           cpu->cpu_index, tb->tc.ptr, cs_base, pc, flags,
-                           lookup_symbol(pc));
+    qatomic_set((TranslationBlock **)slot, tb);
     return tb->tc.ptr;
 }
 
+void HELPER(tb_hot)(CPUArchState *env, void *tb)
+{
+    cpu_tb_tier_up(env_cpu(env), tb);
+}
+
 void HELPER(exit_atomic)(CPUArchState *env)
 {
     cpu_loop_exit_atomic(env_cpu(env), GETPC());
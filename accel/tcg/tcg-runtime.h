@@ -25,8 +25,14 @@ DEF_HELPER_FLAGS_1(ctpop_i32, TCG_CALL_NO_RWG_SE, i32, i32)
 DEF_HELPER_FLAGS_1(ctpop_i64, TCG_CALL_NO_RWG_SE, i64, i64)
 
 DEF_HELPER_FLAGS_1(lookup_tb_ptr, TCG_CALL_NO_WG_SE, ptr, env)
+DEF_HELPER_FLAGS_2(lookup_tb_ptr_cached, TCG_CALL_NO_WG, ptr, env, ptr)
 
 DEF_HELPER_FLAGS_1(exit_atomic, TCG_CALL_NO_WG, noreturn, env)
+DEF_HELPER_2(tb_hot, noreturn, env, ptr)
+
+DEF_HELPER_1(afl_entry, void, env)
+DEF_HELPER_1(afl_crash, noreturn, env)
+DEF_HELPER_FLAGS_4(afl_cmplog, TCG_CALL_NO_RWG, void, i32, i32, i64, i64)
 
 #ifdef CONFIG_SOFTMMU
 
@@ -49,6 +49,7 @@
 
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
+#include "exec/tb-stats.h"
 #include "translate-all.h"
 #include "qemu/bitmap.h"
 #include "qemu/error-report.h"
@@ -216,12 +217,35 @@ static int v_l2_levels;
 
 static void *l1_map[V_L1_MAX_SIZE];
 
+/*
+ * Bottom level of l1_map where this thread found a PageDesc last.  The
+ * PageDesc arrays are never freed, so the pointer never goes stale.
+ */
+static __thread struct {
+    tb_page_addr_t leaf;
+    PageDesc *pd;
+} page_find_last;
+
 /* code generation context */
 TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
 
+/* Entries after which a TB is retranslated as a superblock, 0 for never */
+uint32_t tcg_hot_threshold;
+
+/* Insns that trapped for I/O in icount mode, see tb_io_cflags() */
+target_ulong tb_io_pc[TB_IO_PC_SIZE];
+
+/* Target of the empty tb_ibtc slots; no lookup can match it */
+static TranslationBlock tb_ibtc_empty = { .cflags = CF_INVALID };
+
+TranslationBlock *tb_ibtc[TB_IBTC_SIZE] = {
+    [0 ... TB_IBTC_SIZE - 1] = &tb_ibtc_empty
+};
+static uint32_t tb_ibtc_next;
+
 static void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -390,6 +414,60 @@ void tb_destroy(TranslationBlock *tb)
     qemu_spin_destroy(&tb->jmp_lock);
 }
 
+/*
+ * Drop the jump cache entries that point into [start, end).  Used once
+ * the TBs there have been invalidated and every vCPU went through an RCU
+ * grace period, so that no lookup can still write one back.
+ */
+void tb_jmp_cache_clear_range(void *start, void *end)
+{
+    CPUState *cpu;
+    unsigned int i;
+
+    CPU_FOREACH(cpu) {
+        for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+            TranslationBlock *tb = qatomic_read(&cpu->tb_jmp_cache[i]);
+
+            if ((void *)tb >= start && (void *)tb < end) {
+                qatomic_cmpxchg(&cpu->tb_jmp_cache[i], tb, NULL);
+            }
+        }
+    }
+}
+
+/*
+ * Hand out a tb_ibtc slot to a new jump site.  Once they have all been
+ * used, slots are shared between sites; that only costs hit rate, since
+ * generated code checks the whole lookup key of the cached TB.
+ */
+uint32_t tb_ibtc_alloc(void)
+{
+    return qatomic_fetch_inc(&tb_ibtc_next) & (TB_IBTC_SIZE - 1);
+}
+
+void tb_ibtc_clear(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < TB_IBTC_SIZE; i++) {
+        qatomic_set(&tb_ibtc[i], &tb_ibtc_empty);
+    }
+}
+
+/* Like tb_jmp_cache_clear_range, for the inline target cache */
+void tb_ibtc_clear_range(void *start, void *end)
+{
+    unsigned int i;
+
+    for (i = 0; i < TB_IBTC_SIZE; i++) {
+        TranslationBlock *tb = qatomic_read(&tb_ibtc[i]);
+
+        if ((void *)tb >= start && (void *)tb < end) {
+            qatomic_cmpxchg(&tb_ibtc[i], tb, &tb_ibtc_empty);
+        }
+    }
+}
+
 bool cpu_restore_state(CPUState *cpu, uintptr_t host_pc, bool will_exit)
 {
     TranslationBlock *tb;
@@ -499,7 +577,7 @@ static void page_init(void)
 #endif
 }
 
-static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
+static PageDesc *page_find_alloc_leaf(tb_page_addr_t index, int alloc)
 {
     PageDesc *pd;
     void **lp;
@@ -561,7 +639,22 @@ static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
             pd = existing;
         }
     }
+    return pd;
+}
+
+static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
+{
+    tb_page_addr_t leaf = index >> V_L2_BITS;
+    PageDesc *pd = page_find_last.pd;
 
+    if (unlikely(!pd || page_find_last.leaf != leaf)) {
+        pd = page_find_alloc_leaf(index, alloc);
+        if (pd == NULL) {
+            return NULL;
+        }
+        page_find_last.leaf = leaf;
+        page_find_last.pd = pd;
+    }
     return pd + (index & (V_L2_SIZE - 1));
 }
 
@@ -1149,6 +1242,104 @@ static void tb_htable_init(void)
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
 }
 
+/*
+ * Translations in progress.  With several vCPUs running the same code,
+ * as when secondary CPUs come up or after a tb_flush, they tend to miss
+ * on the same block at the same time; all but one would translate it
+ * only to have tb_link_page throw the result away.  Instead, a vCPU
+ * that finds the block already being translated waits for it.
+ *
+ * The wait is bounded: the translating vCPU may leave tb_gen_code by
+ * longjmp (e.g. to flush a full buffer) and never clear its slot, and
+ * a vCPU waiting here also holds up exclusive work.  A slot left busy
+ * for longer than the wait goes to the next vCPU that asks for it.
+ */
+#define TB_INFLIGHT_BITS    6
+#define TB_INFLIGHT_WAIT_MS 2
+
+typedef struct TBInFlight {
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+    uint32_t cf_mask;
+    int64_t start;
+    bool busy;
+} TBInFlight;
+
+static struct {
+    QemuMutex lock;
+    QemuCond done;
+    TBInFlight slot[1 << TB_INFLIGHT_BITS];
+} tb_inflight;
+
+static void tb_inflight_init(void)
+{
+    qemu_mutex_init(&tb_inflight.lock);
+    qemu_cond_init(&tb_inflight.done);
+}
+
+static bool tb_inflight_match(TBInFlight *f, target_ulong pc,
+                              target_ulong cs_base, uint32_t flags,
+                              uint32_t cf_mask)
+{
+    return f->busy && f->pc == pc && f->cs_base == cs_base &&
+           f->flags == flags && f->cf_mask == cf_mask;
+}
+
+/*
+ * Called by a vCPU that missed on a block and is about to translate it.
+ * Returns a slot to pass to tb_inflight_end() once the TB is linked, or
+ * -1 if the caller should look the TB up again first: either another
+ * vCPU was translating it, or the slot is taken by some other block.
+ */
+int tb_inflight_begin(target_ulong pc, target_ulong cs_base,
+                      uint32_t flags, uint32_t cf_mask)
+{
+    int i = tb_hash_func(0, pc, flags, cf_mask, 0) &
+            ((1 << TB_INFLIGHT_BITS) - 1);
+    TBInFlight *f = &tb_inflight.slot[i];
+    int64_t now = get_clock();
+
+    if (!parallel_cpus) {
+        return -1;
+    }
+
+    qemu_mutex_lock(&tb_inflight.lock);
+    if (tb_inflight_match(f, pc, cs_base, flags, cf_mask)) {
+        qatomic_inc(&tb_ctx.tb_inflight_wait_count);
+        while (tb_inflight_match(f, pc, cs_base, flags, cf_mask) &&
+               now - f->start < TB_INFLIGHT_WAIT_MS * SCALE_MS) {
+            qemu_cond_timedwait(&tb_inflight.done, &tb_inflight.lock,
+                                TB_INFLIGHT_WAIT_MS);
+            now = get_clock();
+        }
+        /* Unless it timed out, let the caller find the new TB */
+        if (!tb_inflight_match(f, pc, cs_base, flags, cf_mask)) {
+            i = -1;
+        }
+    } else if (f->busy && now - f->start < TB_INFLIGHT_WAIT_MS * SCALE_MS) {
+        i = -1;
+    }
+    if (i >= 0) {
+        f->pc = pc;
+        f->cs_base = cs_base;
+        f->flags = flags;
+        f->cf_mask = cf_mask;
+        f->start = now;
+        f->busy = true;
+    }
+    qemu_mutex_unlock(&tb_inflight.lock);
+    return i;
+}
+
+void tb_inflight_end(int slot)
+{
+    qemu_mutex_lock(&tb_inflight.lock);
+    tb_inflight.slot[slot].busy = false;
+    qemu_cond_broadcast(&tb_inflight.done);
+    qemu_mutex_unlock(&tb_inflight.lock);
+}
+
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
    (in bytes) allocated to the translation buffer. Zero means default
    size. */
@@ -1158,6 +1349,8 @@ void tcg_exec_init(unsigned long tb_size)
     cpu_gen_init();
     page_init();
     tb_htable_init();
+    tb_inflight_init();
+    memset(tb_io_pc, -1, sizeof(tb_io_pc));
     code_gen_alloc(tb_size);
 #if defined(CONFIG_SOFTMMU)
     /* There's no guest base to take into account, so go ahead and
@@ -1247,6 +1440,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     CPU_FOREACH(cpu) {
         cpu_tb_jmp_cache_clear(cpu);
     }
+    tb_ibtc_clear();
 
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_flush_tb();
@@ -1277,6 +1471,46 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+/*
+ * Make room in a full code buffer by emptying only its oldest region,
+ * so that the rest of the cache stays warm.  Fall back to a flush if
+ * the buffer is a single region, or every region is in use by a vCPU.
+ */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_evict_count)
+{
+    bool evicted;
+
+    mmap_lock();
+    /* If it is already been done on request of another CPU,
+     * just retry.
+     */
+    if (tb_ctx.tb_evict_count != tb_evict_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+    qatomic_mb_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    evicted = tcg_region_evict();
+    mmap_unlock();
+
+    if (!evicted) {
+        unsigned tb_flush_count = qatomic_mb_read(&tb_ctx.tb_flush_count);
+
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+    }
+}
+
+static void tb_evict(CPUState *cpu)
+{
+    unsigned tb_evict_count = qatomic_mb_read(&tb_ctx.tb_evict_count);
+
+    if (cpu_in_exclusive_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(tb_evict_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(tb_evict_count));
+    }
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1681,6 +1915,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size, max_insns;
+    int64_t ts = 0;
 #ifdef CONFIG_PROFILER
     TCGProfile *prof = &tcg_ctx->prof;
     int64_t ti;
@@ -1711,10 +1946,17 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
 
  buffer_overflow:
+    /*
+     * Free up a region ahead of time, while the other vCPUs keep running,
+     * so that tb_evict's stop-the-world fallback is seldom needed.
+     */
+    if (unlikely(tcg_region_evict_wanted()) && tcg_region_evict_async()) {
+        qatomic_inc(&tb_ctx.tb_evict_count);
+    }
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* eviction or flush must be done */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1729,6 +1971,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cflags = cflags;
     tb->orig_tb = NULL;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->hot_count = tcg_hot_threshold;
+    tb->tb_stats = NULL;
+    if (qatomic_read(&tb_stats_enabled) && !(cflags & CF_NOCACHE)) {
+        tb->tb_stats = tb_stats_get(phys_pc, pc, cs_base, flags);
+        ts = get_clock();
+    }
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -1804,6 +2052,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         goto buffer_overflow;
     }
     tb->tc.size = gen_code_size;
+    if (tb->tb_stats) {
+        tb_stats_record_translation(tb, get_clock() - ts);
+    }
 
 #ifdef CONFIG_PROFILER
     qatomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
@@ -1921,6 +2172,29 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+/*
+ * Called from the code of @tb, before it has executed any guest
+ * instruction, once it has been entered tcg_hot_threshold times.
+ * Drop the TB and have the vCPU restart at the same pc, where it
+ * will be translated again as a superblock.
+ */
+void cpu_tb_tier_up(CPUState *cpu, TranslationBlock *tb)
+{
+    mmap_lock();
+    if (!(tb_cflags(tb) & CF_INVALID)) {
+        tb_phys_invalidate(tb, -1);
+        qatomic_inc(&tb_ctx.tb_tier_up_count);
+    }
+    mmap_unlock();
+
+    qemu_log_mask_and_addr(CPU_LOG_EXEC, tb->pc,
+                           "cpu_tb_tier_up: retranslating hot TB at "
+                           TARGET_FMT_lx "\n", tb->pc);
+
+    cpu->cflags_next_tb = curr_cflags() | CF_HOT;
+    cpu_loop_exit_noexc(cpu);
+}
+
 /*
  * @p must be non-NULL.
  * user-mode: call with mmap_lock held.
@@ -2218,11 +2492,10 @@ void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
  */
 void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
 {
-#if defined(TARGET_MIPS) || defined(TARGET_SH4)
     CPUArchState *env = cpu->env_ptr;
-#endif
     TranslationBlock *tb;
-    uint32_t n;
+    target_ulong pc, cs_base;
+    uint32_t flags, n;
 
     tb = tcg_tb_lookup(retaddr);
     if (!tb) {
@@ -2265,18 +2538,25 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
         }
         tcg_tb_remove(tb);
         tb_destroy(tb);
+    } else if (n == 1) {
+        /*
+         * Remember the I/O insn, and retranslate the TB so that it ends
+         * right before it instead of trapping here on every execution.
+         * A branch with its delay slot (n == 2) keeps the slow path.
+         */
+        cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+        if (!tb_io_pc_known(pc)) {
+            tb_io_pc[tb_io_pc_hash(pc)] = pc;
+            if (pc != tb->pc) {
+                tb_phys_invalidate(tb, -1);
+            }
+        }
     }
 
     qemu_log_mask_and_addr(CPU_LOG_EXEC, tb->pc,
                            "cpu_io_recompile: rewound execution of TB to "
                            TARGET_FMT_lx "\n", tb->pc);
 
-    /* TODO: If env->pc != tb->pc (i.e. the faulting instruction was not
-     * the first in the TB) then we end up generating a whole new TB and
-     *  repeating the fault, which is horribly inefficient.
-     *  Better would be to execute just this insn uncached, or generate a
-     *  second new TB.
-     */
     cpu_loop_exit_noexc(cpu);
 }
 
@@ -2406,8 +2686,14 @@ void dump_exec_info(void)
     qemu_printf("\nStatistics:\n");
     qemu_printf("TB flush count      %u\n",
                 qatomic_read(&tb_ctx.tb_flush_count));
+    qemu_printf("TB evict count      %u\n",
+                qatomic_read(&tb_ctx.tb_evict_count));
     qemu_printf("TB invalidate count %zu\n",
                 tcg_tb_phys_invalidate_count());
+    qemu_printf("TB tier-up count    %u\n",
+                qatomic_read(&tb_ctx.tb_tier_up_count));
+    qemu_printf("TB translate waits  %u\n",
+                qatomic_read(&tb_ctx.tb_inflight_wait_count));
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
@@ -2574,19 +2860,24 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
         flags |= PAGE_WRITE_ORG;
     }
 
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        PageDesc *p = page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
-
-        /* If the write protection bit is set, then we invalidate
-           the code inside.  */
-        if (!(p->flags & PAGE_WRITE) &&
-            (flags & PAGE_WRITE) &&
-            p->first_tb) {
-            tb_invalidate_phys_page(addr, 0);
+    /* Look up one bottom level of l1_map at a time, not every page */
+    for (addr = start, len = end - start; len != 0; ) {
+        tb_page_addr_t index = addr >> TARGET_PAGE_BITS;
+        PageDesc *p = page_find_alloc(index, 1);
+        target_ulong n = MIN(len >> TARGET_PAGE_BITS,
+                             V_L2_SIZE - (index & (V_L2_SIZE - 1)));
+
+        for (; n != 0; n--, p++,
+             len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
+            /* If the write protection bit is set, then we invalidate
+               the code inside.  */
+            if (!(p->flags & PAGE_WRITE) &&
+                (flags & PAGE_WRITE) &&
+                p->first_tb) {
+                tb_invalidate_phys_page(addr, 0);
+            }
+            p->flags = flags;
         }
-        p->flags = flags;
     }
 }
 
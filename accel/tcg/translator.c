@@ -13,11 +13,14 @@
 #include "tcg/tcg.h"
 #include "tcg/tcg-op.h"
 #include "exec/exec-all.h"
+#include "exec/helper-gen.h"
 #include "exec/gen-icount.h"
 #include "exec/log.h"
 #include "exec/translator.h"
 #include "exec/plugin-gen.h"
+#include "exec/tb-stats.h"
 #include "sysemu/replay.h"
+#include "afl.h"
 
 /* Pairs with tcg_clear_temp_count.
    To be called by #TranslatorOps.{translate_insn,tb_stop} if
@@ -32,6 +35,77 @@ void translator_loop_temp_check(DisasContextBase *db)
     }
 }
 
+bool translator_follow_branch(DisasContextBase *db, target_ulong insn_end,
+                              target_ulong dest)
+{
+    target_ulong page = db->pc_first & TARGET_PAGE_MASK;
+
+    if (!(tb_cflags(db->tb) & CF_HOT) ||
+        db->num_insns >= db->max_insns ||
+        dest < db->pc_first ||
+        (dest & TARGET_PAGE_MASK) != page ||
+        ((insn_end - 1) & TARGET_PAGE_MASK) != page) {
+        return false;
+    }
+    /* The AFL fork server has to start at the beginning of a TB */
+    if (afl_need_start && dest == afl_start_code) {
+        return false;
+    }
+
+    db->pc_max = MAX(db->pc_max, insn_end);
+    afl_gen_trace(dest);
+    return true;
+}
+
+int translator_goto_tb_slot(DisasContextBase *db, int n)
+{
+    if (db->goto_tb_used & (1 << n)) {
+        n ^= 1;
+        if (db->goto_tb_used & (1 << n)) {
+            return -1;
+        }
+    }
+    db->goto_tb_used |= 1 << n;
+    return n;
+}
+
+/*
+ * Count down the entries into a TB that may be retranslated hot.  The
+ * count is not atomic: under MTTCG a lost update at worst delays the
+ * retranslation a little.
+ */
+static void gen_tb_hot_count(TranslationBlock *tb)
+{
+    TCGv_ptr ptr = tcg_const_ptr(tb);
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel *cold = gen_new_label();
+
+    tcg_gen_ld_i32(count, ptr, offsetof(TranslationBlock, hot_count));
+    tcg_gen_subi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, offsetof(TranslationBlock, hot_count));
+    tcg_gen_brcondi_i32(TCG_COND_NE, count, 0, cold);
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(ptr);
+
+    ptr = tcg_const_ptr(tb);
+    gen_helper_tb_hot(cpu_env, ptr);
+    tcg_temp_free_ptr(ptr);
+    gen_set_label(cold);
+}
+
+/* Count the executions of a TB whose statistics are gathered */
+static void gen_tb_exec_count(TranslationBlock *tb)
+{
+    TCGv_ptr ptr = tcg_const_ptr(tb->tb_stats);
+    TCGv_i64 count = tcg_temp_new_i64();
+
+    tcg_gen_ld_i64(count, ptr, offsetof(TBStatistics, exec_count));
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, ptr, offsetof(TBStatistics, exec_count));
+    tcg_temp_free_i64(count);
+    tcg_temp_free_ptr(ptr);
+}
+
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb, int max_insns)
 {
@@ -46,6 +120,8 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     db->num_insns = 0;
     db->max_insns = max_insns;
     db->singlestep_enabled = cpu->singlestep_enabled;
+    db->pc_max = db->pc_first;
+    db->goto_tb_used = 0;
 
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
@@ -60,6 +136,18 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
     plugin_enabled = plugin_gen_tb_start(cpu, tb);
 
+    if (tb->tb_stats) {
+        gen_tb_exec_count(tb);
+    }
+
+    /* Superblocks would hide insns from plugins and break icount */
+    if (tcg_hot_threshold && !plugin_enabled &&
+        !(tb_cflags(tb) & (CF_HOT | CF_NOCACHE | CF_USE_ICOUNT))) {
+        gen_tb_hot_count(tb);
+    }
+
+    afl_gen_trace(db->pc_first);
+
     while (true) {
         db->num_insns++;
         ops->insn_start(db, cpu);
@@ -90,6 +178,15 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
             }
         }
 
+        /* AFL panic and dmesg addresses end the run right here.  Like a
+           breakpoint, count the insn as one byte so that the TB has a
+           non-zero size.  */
+        if (afl_gen_crash_check(db->pc_next)) {
+            db->pc_next += 1;
+            db->is_jmp = DISAS_NORETURN;
+            break;
+        }
+
         /* Disassemble one instruction.  The translate_insn hook should
            update db->pc_next and db->is_jmp to indicate what should be
            done next -- either exiting this loop or locate the start of
@@ -116,6 +213,16 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
             plugin_gen_insn_end();
         }
 
+        /*
+         * In icount mode, end the TB before an insn known to do I/O,
+         * which then runs as a CF_LAST_IO TB of its own.
+         */
+        if ((tb_cflags(db->tb) & CF_USE_ICOUNT) &&
+            tb_io_pc_known(db->pc_next)) {
+            db->is_jmp = DISAS_TOO_MANY;
+            break;
+        }
+
         /* Stop translation if the output buffer is full,
            or we have executed all of the allowed instructions.  */
         if (tcg_op_buf_full() || db->num_insns >= db->max_insns) {
@@ -133,7 +240,7 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     }
 
     /* The disas_log hook may use these values rather than recompute.  */
-    db->tb->size = db->pc_next - db->pc_first;
+    db->tb->size = MAX(db->pc_next, db->pc_max) - db->pc_first;
     db->tb->icount = db->num_insns;
 
 #ifdef DEBUG_DISAS
@@ -12,12 +12,14 @@
 #include "qemu/error-report.h"
 #include "qemu/module.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "hw/xen/xen-legacy-backend.h"
 #include "hw/xen/xen_pt.h"
 #include "chardev/char.h"
 #include "sysemu/accel.h"
 #include "sysemu/cpus.h"
 #include "sysemu/xen.h"
+#include "sysemu/xen-mapcache.h"
 #include "sysemu/runstate.h"
 #include "migration/misc.h"
 #include "migration/global_state.h"
@@ -141,6 +143,27 @@ static void xen_set_igd_gfx_passthru(Object *obj, bool value, Error **errp)
     xen_igd_gfx_pt_set(value, errp);
 }
 
+static void xen_get_mapcache_bucket_size(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    uint64_t value = xen_map_cache_get_bucket_size();
+
+    visit_type_size(v, name, &value, errp);
+}
+
+static void xen_set_mapcache_bucket_size(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    uint64_t value;
+
+    if (!visit_type_size(v, name, &value, errp)) {
+        return;
+    }
+    xen_map_cache_set_bucket_size(value, errp);
+}
+
 static void xen_setup_post(MachineState *ms, AccelState *accel)
 {
     int rc;
@@ -212,6 +235,12 @@ static void xen_accel_class_init(ObjectClass *oc, void *data)
         xen_get_igd_gfx_passthru, xen_set_igd_gfx_passthru);
     object_class_property_set_description(oc, "igd-passthru",
         "Set on/off to enable/disable igd passthrou");
+
+    object_class_property_add(oc, "mapcache-bucket-size", "size",
+        xen_get_mapcache_bucket_size, xen_set_mapcache_bucket_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "mapcache-bucket-size",
+        "Size of the guest memory mappings kept by the mapcache");
 }
 
 #define TYPE_XEN_ACCEL ACCEL_CLASS_NAME("xen")
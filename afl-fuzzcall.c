@@ -0,0 +1,258 @@
+/*
+ * The AFL fuzzCall hypercall ABI
+ *
+ * A guest harness talks to the fuzzer through four calls:
+ * startForkServer (1), getWork (2), startWork (3) and doneWork (4).  Each
+ * target decodes its own fuzzCall instruction and ends up here with the
+ * call number and two arguments; the result goes back in the target's
+ * first argument/return register.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
+#include "sysemu/tcg.h"
+#include "afl.h"
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * Set the fuzzCall result in the guest register, for when startWork
+ * returns through a snapshot rather than through the translator.
+ */
+static void fuzz_set_ret(CPUArchState *env, target_ulong val)
+{
+#if defined(TARGET_I386)
+    env->regs[R_EAX] = val;
+#elif defined(TARGET_AARCH64)
+    env->xregs[0] = val;
+#endif
+}
+#endif
+
+/*
+ * @enableTicks keeps the guest clock running during test cases; without
+ * it the clock is stopped at startWork unless -icount drives it.
+ * @persistent is the number of test cases a forked child runs, looping
+ * from doneWork back to getWork, before it is recycled; 0 or 1 disables
+ * persistent mode.
+ */
+static target_ulong startForkServer(CPUArchState *env, target_ulong enableTicks,
+                                    target_ulong persistent)
+{
+    aflEnableTicks = enableTicks;
+    aflPersistentCnt = persistent;
+
+    // TODO: If we are in a fork server, return.
+    if(false){
+        // TODO: Do nothing now.
+    }
+
+    return -1;
+}
+
+/* copy work into ptr[0..sz].  Assumes memory range is locked. */
+static target_ulong copyWork(CPUArchState *env, target_ulong ptr,
+                             target_ulong sz)
+{
+    const char fuzzTestFile[] = "/fuzzer/gen_input/fuzz_test";
+    CPUState *cs = env_cpu(env);
+    target_ulong ret_sz;
+    uint8_t *buf;
+    FILE *fp;
+
+    afl_setup();
+    if (afl_fuzz_len) {
+        /* The fuzzer passed the test case through shared memory */
+        ret_sz = MIN(*afl_fuzz_len, sz);
+        if (cpu_memory_rw_debug(cs, ptr, afl_fuzz_buf, ret_sz, true) < 0) {
+            return -1;
+        }
+        return ret_sz;
+    }
+
+    fp = fopen(fuzzTestFile, "rb");
+    if (!fp) {
+        perror("getWork open·File error!");
+        return -1;
+    }
+    buf = g_malloc(sz);
+    ret_sz = fread(buf, 1, sz, fp);
+    fclose(fp);
+    if (cpu_memory_rw_debug(cs, ptr, buf, ret_sz, true) < 0) {
+        ret_sz = -1;
+    }
+    g_free(buf);
+    return ret_sz;
+}
+
+static target_ulong getWork(CPUArchState *env, target_ulong ptr, target_ulong sz)
+{
+    int64_t start = get_clock();
+    target_ulong ret_sz = copyWork(env, ptr, sz);
+
+    afl_stats->getwork_ns += get_clock() - start;
+    return ret_sz;
+}
+
+/*
+ * Read a guest qword for fuzzCall.  The softmmu TLB is only there under
+ * TCG; under KVM go through the guest page tables instead.
+ */
+static uint64_t fuzz_ldq(CPUArchState *env, target_ulong addr)
+{
+#ifndef CONFIG_USER_ONLY
+    uint8_t buf[8];
+
+    if (!tcg_enabled()) {
+        if (cpu_memory_rw_debug(env_cpu(env), addr, buf, sizeof(buf),
+                                false) < 0) {
+            return 0;
+        }
+        return ldq_p(buf);
+    }
+#endif
+    return cpu_ldq_data(env, addr);
+}
+
+/*
+ * @ptr holds the coverage range start, end and the pc to start the fork
+ * server at.  With @nranges > 0, coverage is instead limited to the
+ * @nranges [start, end) pairs that follow, so that e.g. a few kernel
+ * modules can be instrumented and nothing else.
+ */
+static target_ulong startWork(CPUArchState *env, target_ulong ptr,
+                              target_ulong nranges)
+{
+    target_ulong ranges[AFL_MAX_RANGES * 2];
+    target_ulong start, end;
+    target_ulong catch_pc;
+    int i;
+
+    afl_setup();
+    printf("pid %d: ptr %x\n", getpid(), ptr);
+    fflush(stdout);
+    start = fuzz_ldq(env, ptr);
+    end = fuzz_ldq(env, ptr + sizeof(start) * 2);
+    catch_pc = fuzz_ldq(env, ptr + sizeof(start) * 4);
+    printf("pid %d: startWork %x - %x\n", getpid(), start, end);
+    printf("pc: %x\n", catch_pc);
+    afl_start_code = catch_pc;
+    fflush(stdout);
+    if(start >= end){
+        perror(" False range: start_addr < end_addr!\n");
+        exit(0);
+    }
+    if (nranges) {
+        for (i = 0; i < MIN(nranges, AFL_MAX_RANGES) * 2; i++) {
+            ranges[i] = fuzz_ldq(env, ptr + sizeof(start) * (6 + i));
+        }
+    } else {
+        nranges = 1;
+        ranges[0] = start;
+        ranges[1] = end;
+    }
+    if (!afl_set_ranges(ranges, nranges)) {
+        error_report("fuzzCall: bad coverage ranges");
+        exit(1);
+    }
+    // 每次只会判断一次？
+    afl_need_start = 1;
+#ifndef CONFIG_USER_ONLY
+    afl_clock_setup();
+    if (!tcg_enabled()) {
+        /*
+         * A forked child cannot use its parent's KVM VM, so only the
+         * reset mode works here.  There is no coverage either: harnesses
+         * run under KVM for crash detection.
+         */
+        if (!aflSnapshot) {
+            error_report("fuzzCall: KVM requires AFL_QEMU_SNAPSHOT");
+            exit(1);
+        }
+        if (!afl_snapshot_handshake()) {
+            return 1;
+        }
+        afl_snapshot_take(env_cpu(env));
+        return 1;
+    }
+#endif
+    /*
+     * Retranslate everything: the block at catch_pc must enter the fork
+     * server, and compares must pick up the CmpLog map attached above.
+     */
+    tb_flush(env_cpu(env));
+#ifndef CONFIG_USER_ONLY
+    if (aflSnapshot && afl_snapshot_handshake()) {
+        /*
+         * The snapshot resumes right after this fuzzCall, with startWork
+         * returning 1.  In reset mode the guest must fetch its input with
+         * getWork from here on.
+         */
+        fuzz_set_ret(env, 1);
+        afl_snapshot_take(env_cpu(env));
+        start_trace = true;
+        return 1;
+    }
+#endif
+    return 1;
+}
+
+static target_ulong doneWork(CPUArchState *env, target_ulong val)
+{
+    afl_classify_map();
+    afl_stats_run_end(0);
+    if (afl_persistent_iterate()) {
+        return 0;
+    }
+    start_trace = false;
+#ifndef CONFIG_USER_ONLY
+    if (aflSnapshot) {
+        CPUState *cs = env_cpu(env);
+
+        afl_snapshot_report(0);
+        afl_snapshot_restore(cs);
+        afl_snapshot_wait();
+        start_trace = true;
+        if (!tcg_enabled()) {
+            /*
+             * The restored PC is still on the startWork hypercall; KVM
+             * completes it with our return value as startWork's.
+             */
+            return 1;
+        }
+        cpu_loop_exit(cs);
+    }
+#endif
+    exit(0);
+    return -1;
+}
+
+target_ulong afl_fuzz_call(CPUArchState *env, target_ulong code,
+                           target_ulong a0, target_ulong a1)
+{
+    switch (code)
+    {
+    case 1:
+        return startForkServer(env, a0, a1);
+
+    case 2:
+        return getWork(env, a0, a1);
+
+    case 3:
+        return startWork(env, a0, a1);
+
+    case 4:
+        return doneWork(env, a0);
+
+    default:
+        printf("[!] Not implement!\n");
+        break;
+    }
+    return -1;
+}
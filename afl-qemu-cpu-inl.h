@@ -37,6 +37,14 @@
 #include "../../../config.h"
 #include "exec/user/abitypes.h"
 #include "exec/exec-all.h"
+#include "exec/helper-proto.h"
+#include "tcg/tcg-op.h"
+#include "exec/memory.h"
+#include "qemu/crc32c.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
+#include "qemu/qemu-print.h"
+#include "exec/tb-context.h"
 
 /***************************
  * VARIOUS AUXILIARY STUFF *
@@ -47,8 +55,14 @@
    it to translate within its own context, too (this avoids translation
    overhead in the next forked-off copy). */
 
+#define AFL_QEMU_CPU_SNIPPET0 do { \
+    afl_tb_gen_start = get_clock(); \
+  } while (0)
+
 #define AFL_QEMU_CPU_SNIPPET1 do { \
-    afl_request_tsl(pc, cs_base, flags); \
+    afl_stats->translate_ns += get_clock() - afl_tb_gen_start; \
+    afl_stats->tb_translated++; \
+    afl_request_tsl(tb, cf_mask); \
   } while (0)
 
 /* This snippet kicks in when the instruction pointer is positioned at
@@ -60,7 +74,6 @@
       afl_setup(); \
       afl_forkserver(cpu); \
     } \
-    afl_maybe_log(itb->pc); \
   } while (0)
 
 /* We use one additional file descriptor to relay "needs translation"
@@ -68,6 +81,56 @@
 
 #define TSL_FD (FORKSRV_FD - 1)
 
+/* AFL++ fork server options, for fuzzers whose config.h predates them: */
+
+#ifndef SHM_FUZZ_ENV_VAR
+#define SHM_FUZZ_ENV_VAR "__AFL_SHM_FUZZ_ID"
+#endif
+#ifndef FS_OPT_ENABLED
+#define FS_OPT_ENABLED 0x80000001
+#endif
+#ifndef FS_OPT_SHDMEM_FUZZ
+#define FS_OPT_SHDMEM_FUZZ 0x01000000
+#endif
+#ifndef FS_OPT_MAPSIZE
+#define FS_OPT_MAPSIZE 0x40000000
+#define FS_OPT_SET_MAPSIZE(x) ((x) <= 1 ? 0 : (((x) - 1) << 1) & 0x00fffffe)
+#endif
+
+/* Largest coverage map AFL_MAP_SIZE can ask for: */
+
+#define AFL_MAP_SIZE_MAX (8 << 20)
+
+/* CmpLog map, in the AFL++ cmplog.h layout: */
+
+#ifndef CMPLOG_SHM_ENV_VAR
+#define CMPLOG_SHM_ENV_VAR "__AFL_CMPLOG_SHM_ID"
+#endif
+
+#ifndef CMP_MAP_W
+#define CMP_MAP_W 65536
+#define CMP_MAP_H 32
+#define CMP_TYPE_INS 0
+
+struct cmp_header {
+  unsigned hits : 20;
+  unsigned cnt : 20;
+  unsigned id : 16;
+  unsigned shape : 5;
+  unsigned type : 1;
+} __attribute__((packed));
+
+struct cmp_operands {
+  uint64_t v0;
+  uint64_t v1;
+};
+
+struct cmp_map {
+  struct cmp_header headers[CMP_MAP_W];
+  struct cmp_operands log[CMP_MAP_W][CMP_MAP_H];
+};
+#endif
+
 /* This is equivalent to afl-as.h: */
 
 static unsigned char *afl_area_ptr;
@@ -83,6 +146,8 @@ int afl_need_start = 0, afl_need_stop = 0;
 int aflStart = 0;               /* we've started fuzzing */
 int aflEnableTicks = 0;         /* re-enable ticks for each test */
 int aflGotLog = 0;              /* we've seen dmesg logging */
+int aflSnapshot = 0;            /* reset in place instead of forking */
+unsigned int aflPersistentCnt = 0; /* test cases per child, 0 = one */
 bool start_trace = false;       /* start strace when we hit the bb */
 
 /* from command line options */
@@ -95,31 +160,113 @@ unsigned long aflDmesgAddr = (unsigned long)-1;
 static unsigned char afl_fork_child;
 unsigned int afl_forksrv_pid;
 
+/* Coverage map size, a power of two. MAP_SIZE unless AFL_MAP_SIZE asks
+   for a bigger one and the fuzzer gave us a map to match. */
+
+static unsigned int afl_map_size = MAP_SIZE;
+
 /* Instrumentation ratio: */
 
 static unsigned int afl_inst_rms = MAP_SIZE;
 
+/* Set by AFL_QEMU_CLASSIFY: bucket the hit counts ourselves at the end of
+   each run, for fuzzers told that the map comes classified. */
+
+static int afl_classify;
+
+/* Guest ranges to instrument, set by startWork. Blocks and compares
+   outside them are translated without instrumentation. With no ranges,
+   or with AFL_INST_LIBS, everything is instrumented. */
+
+static struct afl_range {
+  target_ulong start, end;      /* [start, end) */
+} afl_ranges[AFL_MAX_RANGES];
+
+static unsigned int afl_range_cnt;
+static int afl_inst_libs;
+
+/* Test case buffer shared with the fuzzer, in the AFL++ layout: a 32-bit
+   length followed by the data. NULL if the fuzzer did not give us one. */
+
+uint32_t *afl_fuzz_len;
+uint8_t *afl_fuzz_buf;
+
+/* Comparison operand log, only set up when the fuzzer runs us as its
+   CmpLog binary. Compares are instrumented only while it is attached, so
+   the normal runs pay nothing. */
+
+static struct cmp_map *afl_cmp_map;
+
+/* Coverage map written by the inline instrumentation. This points to a
+   scratch area until afl_setup() has attached the shared memory. */
+
+static unsigned char afl_dummy_map[MAP_SIZE];
+static unsigned char *afl_trace_map = afl_dummy_map;
+
+/* Fuzz loop counters. These live in a shared mapping once afl_setup()
+   has run, so the fork server sees what its children did. */
+
+static AFLStats afl_stats_local;
+AFLStats *afl_stats = &afl_stats_local;
+
+static int64_t afl_stats_start;     /* when afl_setup() ran */
+static int64_t afl_stats_written;   /* last write to AFL_QEMU_STATS_FILE */
+static int64_t afl_run_start;
+static unsigned int afl_run_flushes;
+static int64_t afl_tb_gen_start;
+
+/* Set once the fork server has been entered: */
+
+static int afl_entry_done;
+
 /* Function declarations. */
 
-static void afl_setup(void);
-static void afl_forkserver(CPUState*);
-static inline void afl_maybe_log(abi_ulong);
+void afl_setup(void);
+void afl_forkserver(CPUState*);
+void afl_gen_trace(target_ulong);
 
-static void afl_wait_tsl(CPUState*, int);
-static void afl_request_tsl(target_ulong, target_ulong, uint64_t);
+static int afl_in_ranges(target_ulong);
+static int afl_wait_tsl(CPUState*, int);
+static void afl_request_tsl(TranslationBlock*, uint32_t);
+static void afl_park_tsl(void);
+
+#ifndef CONFIG_USER_ONLY
+static uint32_t afl_page_crc(tb_page_addr_t);
+#endif
+static void afl_tb_cache_save(void);
+static void afl_tb_cache_load(CPUState*);
 
 /* Data structure passed around by the translate handlers: */
 
 struct afl_tsl {
   target_ulong pc;
   target_ulong cs_base;
-  uint64_t flags;
+  uint32_t flags;
+  uint32_t cf_mask;
+  tb_page_addr_t page_addr;
+};
+
+/* Sent instead of a block by a persistent-mode child that is about to stop
+   itself: it keeps the channel open, but won't ask for anything until it
+   is resumed. */
+
+#define AFL_TSL_PARK ((target_ulong)-1)
+
+/* A child of the fork server: the one running a test case, or one forked
+   ahead of time that is blocked reading go_fd until a request comes in. */
+
+struct afl_child {
+  pid_t pid;
+  int tsl_fd;
+  int go_fd;
 };
 
-/* Some forward decls: */
+#define AFL_MAX_PREFORK 16
 
-// TranslationBlock *tb_htable_lookup(CPUState*, target_ulong, target_ulong, uint32_t);
-// static inline TranslationBlock *tb_find(CPUState*, TranslationBlock*, int);
+static struct afl_child afl_child = { .tsl_fd = -1, .go_fd = -1 };
+static struct afl_child afl_pool[AFL_MAX_PREFORK];
+static unsigned int afl_pool_cnt;
+static unsigned int afl_prefork; /* AFL_QEMU_PREFORK, children kept ready */
 
 /*************************
  * ACTUAL IMPLEMENTATION *
@@ -127,7 +274,10 @@ struct afl_tsl {
 
 /* Set up SHM region and initialize other stuff. */
 
-static void afl_setup(void) {
+void afl_setup(void) {
+
+  static bool afl_setup_done;
+  void *stats;
 
   // id_str 是提取放入环境变量的共享内存 id
   char *id_str = getenv(SHM_ENV_VAR),
@@ -135,6 +285,44 @@ static void afl_setup(void) {
 
   int shm_id;
 
+  if (afl_setup_done) return;
+  afl_setup_done = true;
+
+  /* AFL_QEMU_SNAPSHOT selects the reset mode: the forkserver protocol is
+     spoken by startWork/doneWork and the guest is restored in place. */
+
+  if (getenv("AFL_QEMU_SNAPSHOT")) aflSnapshot = 1;
+
+  stats = mmap(NULL, sizeof(AFLStats), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (stats != MAP_FAILED) afl_stats = stats;
+  afl_stats_start = get_clock();
+
+  /* AFL_QEMU_PREFORK=n keeps n children forked and waiting, so that fork
+     latency is off the critical path of every request. */
+
+  if (getenv("AFL_QEMU_PREFORK")) {
+
+    afl_prefork = atoi(getenv("AFL_QEMU_PREFORK"));
+    if (afl_prefork > AFL_MAX_PREFORK) afl_prefork = AFL_MAX_PREFORK;
+
+  }
+
+  /* A larger map only makes sense with the fuzzer's map to write into;
+     the scratch map is MAP_SIZE bytes. */
+
+  if (id_str && getenv("AFL_MAP_SIZE")) {
+
+    unsigned long sz = strtoul(getenv("AFL_MAP_SIZE"), NULL, 0);
+
+    if (sz > AFL_MAP_SIZE_MAX) sz = AFL_MAP_SIZE_MAX;
+    if (sz > MAP_SIZE) afl_map_size = pow2ceil(sz);
+    afl_inst_rms = afl_map_size;
+
+  }
+
+  if (getenv("AFL_QEMU_CLASSIFY")) afl_classify = 1;
+
   // 这一部分决定了插桩的密度？意思是说有一部分不会记录的意思吗
   if (inst_r) {
 
@@ -145,7 +333,7 @@ static void afl_setup(void) {
     if (r > 100) r = 100;
     if (!r) r = 1;
 
-    afl_inst_rms = MAP_SIZE * r / 100;
+    afl_inst_rms = afl_map_size * r / 100;
 
   }
 
@@ -162,17 +350,48 @@ static void afl_setup(void) {
 
     if (inst_r) afl_area_ptr[0] = 1;
 
+    afl_trace_map = afl_area_ptr;
 
   }
 
-  // 内核中会有动态链接库的问题吗
-  if (getenv("AFL_INST_LIBS")) {
+  /* Shared-memory test case delivery, so that getWork does not have to
+     go through the file system for every input. */
+
+  id_str = getenv(SHM_FUZZ_ENV_VAR);
+
+  if (id_str) {
+
+    uint8_t *map = shmat(atoi(id_str), NULL, 0);
+
+    if (map == (void*)-1) exit(1);
+
+    afl_fuzz_len = (uint32_t *)map;
+    afl_fuzz_buf = map + sizeof(uint32_t);
+
+  }
+
+  id_str = getenv(CMPLOG_SHM_ENV_VAR);
+
+  if (id_str) {
 
-    afl_start_code = 0;
-    afl_end_code   = (abi_ulong)-1;
+    afl_cmp_map = shmat(atoi(id_str), NULL, 0);
+
+    if (afl_cmp_map == (void*)-1) exit(1);
 
   }
 
+  // 内核中会有动态链接库的问题吗
+  if (getenv("AFL_INST_LIBS")) afl_inst_libs = 1;
+
+  /* Guest addresses that mean the run is over: the kernel's panic() and
+     whatever it logs oopses and warnings through. */
+
+  if (getenv("AFL_QEMU_PANIC_ADDR"))
+    aflPanicAddr = strtoul(getenv("AFL_QEMU_PANIC_ADDR"), NULL, 0);
+
+  if (getenv("AFL_QEMU_DMESG_ADDR"))
+    aflDmesgAddr = strtoul(getenv("AFL_QEMU_DMESG_ADDR"), NULL, 0);
+
   /* pthread_atfork() seems somewhat broken in util/rcu.c, and I'm
      not entirely sure what is the cause. This disables that
      behaviour, and seems to work alright? */
@@ -182,9 +401,192 @@ static void afl_setup(void) {
 }
 
 
+/* Tell the fuzzer that we're alive. When it handed us a test case buffer
+   or we use a non-default map size, say so in the AFL++ option format,
+   and read back its acknowledgement of the test case buffer. Returns 0 if
+   the parent doesn't want to talk. */
+
+static int afl_hello(void) {
+
+  static unsigned char tmp[4] = "1234";
+  uint32_t opts = FS_OPT_ENABLED;
+
+  if (afl_fuzz_len) opts |= FS_OPT_SHDMEM_FUZZ;
+  if (afl_map_size != MAP_SIZE)
+    opts |= FS_OPT_MAPSIZE | FS_OPT_SET_MAPSIZE(afl_map_size);
+
+  if (opts == FS_OPT_ENABLED) return write(FORKSRV_FD + 1, tmp, 4) == 4;
+
+  if (write(FORKSRV_FD + 1, &opts, 4) != 4) return 0;
+  if (afl_fuzz_len && read(FORKSRV_FD, &opts, 4) != 4) return 0;
+  return 1;
+
+}
+
+
+/* Start and end of a run, in whichever process runs it. */
+
+static void afl_stats_run_begin(void) {
+
+  afl_stats->execs++;
+  afl_run_flushes = qatomic_read(&tb_ctx.tb_flush_count);
+  afl_run_start   = get_clock();
+
+}
+
+void afl_stats_run_end(int crashed) {
+
+  afl_stats->exec_ns    += get_clock() - afl_run_start;
+  afl_stats->tb_flushes += qatomic_read(&tb_ctx.tb_flush_count) -
+                           afl_run_flushes;
+  afl_stats->crashes    += crashed;
+
+}
+
+
+/* Print the counters, to the monitor if f is NULL. */
+
+void afl_stats_dump(FILE *f) {
+
+  AFLStats s = *afl_stats;
+  int64_t up = get_clock() - afl_stats_start;
+  uint64_t n = s.execs ? s.execs : 1;
+
+  qemu_fprintf(f, "execs           : %" PRIu64 "\n", s.execs);
+  qemu_fprintf(f, "execs_per_sec   : %.2f\n",
+               up > 0 ? s.execs * 1e9 / up : 0.0);
+  qemu_fprintf(f, "crashes         : %" PRIu64 "\n", s.crashes);
+  qemu_fprintf(f, "tb_translated   : %" PRIu64 "\n", s.tb_translated);
+  qemu_fprintf(f, "tb_instrumented : %" PRIu64 "\n", s.tb_instrumented);
+  qemu_fprintf(f, "tb_mirrored     : %" PRIu64 "\n", s.tb_mirrored);
+  qemu_fprintf(f, "tb_flushes      : %" PRIu64 "\n", s.tb_flushes);
+
+  /* Average cost of each phase per test case: */
+
+  qemu_fprintf(f, "fork_us         : %" PRId64 "\n", s.fork_ns / n / 1000);
+  qemu_fprintf(f, "getwork_us      : %" PRId64 "\n", s.getwork_ns / n / 1000);
+  qemu_fprintf(f, "exec_us         : %" PRId64 "\n", s.exec_ns / n / 1000);
+  qemu_fprintf(f, "translate_us    : %" PRId64 "\n",
+               s.translate_ns / n / 1000);
+  qemu_fprintf(f, "reset_us        : %" PRId64 "\n", s.reset_ns / n / 1000);
+
+}
+
+
+/* Rewrite AFL_QEMU_STATS_FILE, at most once a second. Called by the fork
+   server between test cases. */
+
+static void afl_stats_maybe_write(void) {
+
+  const char *path = getenv("AFL_QEMU_STATS_FILE");
+  int64_t now = get_clock();
+  char *tmp;
+  FILE *f;
+
+  if (!path || now - afl_stats_written < NANOSECONDS_PER_SECOND) return;
+  afl_stats_written = now;
+
+  tmp = g_strdup_printf("%s.tmp", path);
+  f = fopen(tmp, "w");
+
+  if (f) {
+
+    afl_stats_dump(f);
+    fclose(f);
+    rename(tmp, path);
+
+  }
+
+  g_free(tmp);
+
+}
+
+
+/* Fork a child with its own translation channel on TSL_FD. A prefork
+   child first waits for the parent to hand it a test case, and goes away
+   quietly if the parent does without. Returns 0 in the child. */
+
+static int afl_spawn(struct afl_child *c, int prefork) {
+
+  int t_fd[2], g_fd[2];
+  unsigned int i;
+  char go;
+
+  /* Establish a channel with child to grab translation commands. We'll
+     read from t_fd[0], child will write to TSL_FD. */
+
+  if (pipe(t_fd) || dup2(t_fd[1], TSL_FD) < 0) exit(3);
+  close(t_fd[1]);
+
+  if (prefork && pipe(g_fd)) exit(3);
+
+  c->pid = fork();
+  if (c->pid < 0) exit(4);
+
+  if (!c->pid) {
+
+    /* Child process. Close descriptors and run free. */
+
+    afl_fork_child = 1;
+    close(FORKSRV_FD);
+    close(FORKSRV_FD + 1);
+    close(t_fd[0]);
+
+    if (afl_child.tsl_fd >= 0) close(afl_child.tsl_fd);
+
+    for (i = 0; i < afl_pool_cnt; i++) {
+      close(afl_pool[i].tsl_fd);
+      close(afl_pool[i].go_fd);
+    }
+
+    if (prefork) {
+      close(g_fd[1]);
+      if (read(g_fd[0], &go, 1) != 1) _exit(0);
+      close(g_fd[0]);
+    }
+
+    afl_stats_run_begin();
+    return 0;
+
+  }
+
+  /* Parent. */
+
+  close(TSL_FD);
+  c->tsl_fd = t_fd[0];
+  c->go_fd  = -1;
+
+  if (prefork) {
+    close(g_fd[0]);
+    c->go_fd = g_fd[1];
+  }
+
+  return 1;
+
+}
+
+
+/* Top the prefork pool back up. Returns 0 in a child. */
+
+static int afl_refill_pool(void) {
+
+  struct afl_child c;
+
+  while (afl_pool_cnt < afl_prefork) {
+
+    if (!afl_spawn(&c, 1)) return 0;
+    afl_pool[afl_pool_cnt++] = c;
+
+  }
+
+  return 1;
+
+}
+
+
 /* Fork server logic, invoked once we hit _start. */
 
-static void afl_forkserver(CPUState *cpu) {
+void afl_forkserver(CPUState *cpu) {
 
   static unsigned char tmp[4] = "1234";
 
@@ -194,108 +596,454 @@ static void afl_forkserver(CPUState *cpu) {
      to talk, assume that we're not running in forkserver mode. */
   // 写给 Fuzzer 告诉自己运行了
   printf("[Qemu] write %x to AFL\n", *(unsigned int*)tmp);
-  if (write(FORKSRV_FD + 1, tmp, 4) != 4) return;
+  if (!afl_hello()) return;
 
   afl_forksrv_pid = getpid();
   printf("[+] afl_forksrv_pid: %d\n", afl_forksrv_pid);
-  
-  // TODO: OK, Let's do it once
+
+  afl_tb_cache_load(cpu);
+
+  if (!afl_refill_pool()) return;
+
   while (1) {
-    pid_t child_pid;
-    int status, t_fd[2];
+    static int child_stopped;
+    unsigned int was_killed;
+    int64_t t;
+    int status;
 
     /* Whoops, parent dead? */
     // 判断Fuzzer进程是否存活
-    // sleep(1);
-    int failed_len = read(FORKSRV_FD, tmp, 4);
+    int failed_len = read(FORKSRV_FD, &was_killed, 4);
     if (failed_len != 4)
     {
       puts("[!] Parent dead!");
+      afl_tb_cache_save();
       exit(2);
     }
-    /* Establish a channel with child to grab translation commands. We'll
-       read from t_fd[0], child will write to TSL_FD. */
 
-    // if (pipe(t_fd) || dup2(t_fd[1], TSL_FD) < 0) exit(3);
-    // close(t_fd[1]);
+    /* If we stopped the child in persistent mode, but there was a race
+       condition and afl-fuzz already issued SIGKILL, write off the old
+       process. */
+
+    if (child_stopped && was_killed) {
+      child_stopped = 0;
+      if (waitpid(afl_child.pid, &status, 0) < 0) exit(8);
+      close(afl_child.tsl_fd);
+      afl_child.tsl_fd = -1;
+    }
+
+    t = get_clock();
+
+    if (child_stopped) {
+
+      /* Persistent mode: the child is parked in doneWork, wake it up for
+         the next iteration instead of forking. */
+
+      kill(afl_child.pid, SIGCONT);
+      child_stopped = 0;
 
-    child_pid = fork();
-    if (child_pid < 0) exit(4);
+    } else if (afl_pool_cnt) {
 
-    if (!child_pid) {
+      /* Release the most recently forked child, it has the most of our
+         translations. */
 
-      /* Child process. Close descriptors and run free. */
+      afl_child = afl_pool[--afl_pool_cnt];
+      if (write(afl_child.go_fd, tmp, 1) != 1) exit(4);
+      close(afl_child.go_fd);
+      afl_child.go_fd = -1;
+
+    } else if (!afl_spawn(&afl_child, 0)) {
 
-      afl_fork_child = 1;
-      close(FORKSRV_FD);
-      close(FORKSRV_FD + 1);
-      // close(t_fd[0]);
       return;
 
     }
 
-    /* Parent. */
-    printf("[Qemu] Parent will wait until child exit\n");
-    // close(TSL_FD);
+    if (write(FORKSRV_FD + 1, &afl_child.pid, 4) != 4) exit(5);
+
+    /* Fork the next children while this one runs. */
 
-    if (write(FORKSRV_FD + 1, &child_pid, 4) != 4) exit(5);
+    if (!afl_refill_pool()) return;
+    afl_stats->fork_ns += get_clock() - t;
 
-    /* Collect translation requests until child dies and closes the pipe. */
+    /* Collect translation requests until child dies and closes the pipe,
+       or parks itself in persistent mode. */
 
-    // afl_wait_tsl(cpu, t_fd[0]);
+    if (!afl_wait_tsl(cpu, afl_child.tsl_fd)) {
+      close(afl_child.tsl_fd);
+      afl_child.tsl_fd = -1;
+    }
 
     /* Get and relay exit status to parent. */
 
-    if (waitpid(child_pid, &status, 0) < 0) exit(6);
+    if (waitpid(afl_child.pid, &status, aflPersistentCnt ? WUNTRACED : 0) < 0)
+      exit(6);
+    if (WIFSTOPPED(status)) child_stopped = 1;
     if (write(FORKSRV_FD + 1, &status, 4) != 4) exit(7);
 
-    // // TODO: Now we do't need Qemu run, exit
-    // ! Bug: exit maybe cause error
-    // ! exit(0);
-    // TODO: 每5s运行一次
-    sleep(5);
+    afl_stats_maybe_write();
+
   }
 
 }
 
 
-/* The equivalent of the tuple logging routine from afl-as.h. */
+/* Replace the instrumented ranges. Returns 0 if there are too many or one
+   of them is empty. */
 
-static inline void afl_maybe_log(abi_ulong cur_loc) {
+int afl_set_ranges(const target_ulong *ranges, unsigned int cnt) {
 
-  static __thread abi_ulong prev_loc;
+  unsigned int i;
 
-  /* Optimize for cur_loc > afl_end_code, which is the most likely case on
-     Linux systems. */
-  /*
-   * 我这里不需要判断起始地址和结束地址，因为执行完相应序列之后就会主动关闭 kernel
-   * 不过还是需要判断一下 afl_area_ptr 是否为空，为空则退出，避免意外
-  */
-  // if (cur_loc > afl_end_code || cur_loc < afl_start_code || !afl_area_ptr)
-  //   return;
-  if (!afl_area_ptr) return;
+  if (cnt > AFL_MAX_RANGES) return 0;
+
+  for (i = 0; i < cnt; i++) {
+
+    if (ranges[2 * i] >= ranges[2 * i + 1]) return 0;
+
+    afl_ranges[i].start = ranges[2 * i];
+    afl_ranges[i].end   = ranges[2 * i + 1];
+
+  }
+
+  afl_range_cnt = cnt;
+  return 1;
+
+}
+
+
+/* Decided at translation time, so the lookup costs nothing at run time. */
+
+static int afl_in_ranges(target_ulong pc) {
+
+  unsigned int i;
+
+  if (!afl_range_cnt || afl_inst_libs) return 1;
+
+  for (i = 0; i < afl_range_cnt; i++)
+    if (pc >= afl_ranges[i].start && pc < afl_ranges[i].end) return 1;
+
+  return 0;
+
+}
+
+
+/* The equivalent of the tuple logging routine from afl-as.h, emitted as
+   TCG ops at the start of every TB so that blocks can be chained. The
+   location hash is a translation-time constant and the previous location
+   lives in CPUState::afl_prev_loc. */
+
+void afl_gen_trace(target_ulong pc) {
+
+  const intptr_t prev_loc_ofs =
+    offsetof(ArchCPU, parent_obj.afl_prev_loc) - offsetof(ArchCPU, env);
+  abi_ulong cur_loc;
+  TCGLabel *skip;
+  TCGv_ptr ptr, map;
+  TCGv_i32 t;
+
+  /* The fork server starts at the block that startWork pointed us at.
+     startWork flushes the TB cache, so this block is always retranslated
+     after afl_start_code is set. */
+
+  if (afl_need_start && !afl_entry_done && !aflSnapshot &&
+      pc == afl_start_code)
+    gen_helper_afl_entry(cpu_env);
 
   /* Looks like QEMU always maps to fixed locations, so ASAN is not a
      concern. Phew. But instruction addresses may be aligned. Let's mangle
      the value to get something quasi-uniform. */
 
-  cur_loc  = (cur_loc >> 4) ^ (cur_loc << 8);
-  cur_loc &= MAP_SIZE - 1;
+  cur_loc  = (pc >> 4) ^ (pc << 8);
+  cur_loc &= afl_map_size - 1;
 
   /* Implement probabilistic instrumentation by looking at scrambled block
      address. This keeps the instrumented locations stable across runs. */
-  /*
-   * 当前位置有 AFL_INST_RATIO 的概率不会被插桩，避免分析复杂度过高出现性能问题
-   * 而我们会执行多次，理论上都会执行到的。
-  */
+
+  if (cur_loc >= afl_inst_rms || !afl_in_ranges(pc)) return;
+
+  afl_stats->tb_instrumented++;
+
+  t    = tcg_temp_new_i32();
+  skip = gen_new_label();
+
+  ptr = tcg_const_ptr(&start_trace);
+  tcg_gen_ld8u_i32(t, ptr, 0);
+  tcg_temp_free_ptr(ptr);
+  tcg_gen_brcondi_i32(TCG_COND_EQ, t, 0, skip);
+
+  /* afl_trace_map[cur_loc ^ prev_loc]++; prev_loc = cur_loc >> 1; */
+
+  map = tcg_temp_new_ptr();
+  ptr = tcg_const_ptr(&afl_trace_map);
+  tcg_gen_ld_ptr(map, ptr, 0);
+  tcg_gen_ld_i32(t, cpu_env, prev_loc_ofs);
+  tcg_gen_xori_i32(t, t, cur_loc);
+  tcg_gen_ext_i32_ptr(ptr, t);
+  tcg_gen_add_ptr(ptr, ptr, map);
+  tcg_gen_ld8u_i32(t, ptr, 0);
+  tcg_gen_addi_i32(t, t, 1);
+  tcg_gen_st8_i32(t, ptr, 0);
+  tcg_gen_movi_i32(t, cur_loc >> 1);
+  tcg_gen_st_i32(t, cpu_env, prev_loc_ofs);
+
+  gen_set_label(skip);
+
+  tcg_temp_free_ptr(map);
+  tcg_temp_free_ptr(ptr);
+  tcg_temp_free_i32(t);
+
+}
+
+
+/* Log the operands of a comparison at pc. ot gives the operand size; the
+   values are zero-extended. */
+
+void afl_gen_cmplog(target_ulong pc, MemOp ot, TCGv a, TCGv b) {
+
+  target_ulong cur_loc;
+  TCGv_i32 loc, shape;
+  TCGv_i64 v0, v1;
+
+  if (!afl_cmp_map || !afl_in_ranges(pc)) return;
+
+  cur_loc  = (pc >> 4) ^ (pc << 8);
+  cur_loc &= CMP_MAP_W - 1;
+
   if (cur_loc >= afl_inst_rms) return;
 
-  /*
-   * 这里正式给 afl_area_ptr 也就是 bitmap 赋值
-   * TODO: 我应该没理解错吧，验证一下
-  */
-  afl_area_ptr[cur_loc ^ prev_loc]++;
-  prev_loc = cur_loc >> 1;
+  loc   = tcg_const_i32(cur_loc);
+  shape = tcg_const_i32((1 << (ot & MO_SIZE)) - 1);
+  v0    = tcg_temp_new_i64();
+  v1    = tcg_temp_new_i64();
+
+  tcg_gen_extu_tl_i64(v0, a);
+  tcg_gen_extu_tl_i64(v1, b);
+  gen_helper_afl_cmplog(loc, shape, v0, v1);
+
+  tcg_temp_free_i64(v1);
+  tcg_temp_free_i64(v0);
+  tcg_temp_free_i32(shape);
+  tcg_temp_free_i32(loc);
+
+}
+
+void HELPER(afl_cmplog)(uint32_t cur_loc, uint32_t shape, uint64_t v0,
+                        uint64_t v1) {
+
+  struct cmp_header *h = &afl_cmp_map->headers[cur_loc];
+  uint32_t hits;
+
+  if (!start_trace) return;
+
+  hits = h->hits;
+  h->type  = CMP_TYPE_INS;
+  h->hits  = hits + 1;
+  h->shape = shape;
+
+  /* Registers of a narrow compare may carry stale high bits. */
+  if (shape < 7) {
+    v0 &= (1ULL << ((shape + 1) * 8)) - 1;
+    v1 &= (1ULL << ((shape + 1) * 8)) - 1;
+  }
+
+  hits &= CMP_MAP_H - 1;
+  afl_cmp_map->log[cur_loc][hits].v0 = v0;
+  afl_cmp_map->log[cur_loc][hits].v1 = v1;
+
+}
+
+
+/* Called from the start of the block at afl_start_code: start the fork
+   server and begin tracing in the children. */
+
+void HELPER(afl_entry)(CPUArchState *env) {
+
+  afl_entry_done = 1;
+  afl_setup();
+  afl_forkserver(env_cpu(env));
+  start_trace = true;
+
+}
+
+
+/* AFL's hit count buckets. Classification looks up two bytes at a time
+   in a table built from these on first use. */
+
+static const uint8_t afl_count_class8[256] = {
+
+  [0]           = 0,
+  [1]           = 1,
+  [2]           = 2,
+  [3]           = 4,
+  [4 ... 7]     = 8,
+  [8 ... 15]    = 16,
+  [16 ... 31]   = 32,
+  [32 ... 127]  = 64,
+  [128 ... 255] = 128
+
+};
+
+static uint16_t afl_count_class16[65536];
+
+/* Bucket the hit counts in place, as the fuzzer would after the run.
+   Most of the map is zero, so whole chunks are skipped with the
+   vectorized buffer_is_zero(), and within the rest any zero word. */
+
+#define AFL_CLASSIFY_CHUNK 256
+
+void afl_classify_map(void) {
+
+  uint64_t *p, *e;
+  unsigned int i;
+
+  if (!afl_classify || afl_trace_map == afl_dummy_map) return;
+
+  if (!afl_count_class16[1]) {
+
+    for (i = 0; i < 65536; i++)
+      afl_count_class16[i] = (afl_count_class8[i >> 8] << 8) |
+                             afl_count_class8[i & 0xff];
+
+  }
+
+  for (i = 0; i < afl_map_size; i += AFL_CLASSIFY_CHUNK) {
+
+    if (buffer_is_zero(afl_trace_map + i, AFL_CLASSIFY_CHUNK)) continue;
+
+    p = (uint64_t *)(afl_trace_map + i);
+    e = p + AFL_CLASSIFY_CHUNK / sizeof(*p);
+
+    for (; p < e; p++) {
+
+      uint16_t *w = (uint16_t *)p;
+
+      if (!*p) continue;
+
+      w[0] = afl_count_class16[w[0]];
+      w[1] = afl_count_class16[w[1]];
+      w[2] = afl_count_class16[w[2]];
+      w[3] = afl_count_class16[w[3]];
+
+    }
+
+  }
+
+}
+
+
+/* Called instead of translating the instruction at aflPanicAddr or
+   aflDmesgAddr. Returns 1 if it emitted the crash exit, which ends the
+   TB. Only once startWork has run, so that a boot-time message doesn't
+   take the emulator down; startWork flushes the TB cache. */
+
+int afl_gen_crash_check(target_ulong pc) {
+
+  if (!afl_need_start) return 0;
+  if (pc != aflPanicAddr && pc != aflDmesgAddr) return 0;
+
+  gen_helper_afl_crash(cpu_env);
+  return 1;
+
+}
+
+
+/* Report the run as a crash right away instead of waiting for the guest
+   to fault or for the fuzzer's timeout. */
+
+void HELPER(afl_crash)(CPUArchState *env) {
+
+  start_trace = false;
+  afl_classify_map();
+  afl_stats_run_end(1);
+
+#ifndef CONFIG_USER_ONLY
+  if (aflSnapshot && afl_forksrv_pid) {
+
+    CPUState *cpu = env_cpu(env);
+
+    afl_snapshot_report(SIGABRT);
+    afl_snapshot_restore(cpu);
+    afl_snapshot_wait();
+    start_trace = true;
+    cpu_loop_exit(cpu);
+
+  }
+#endif
+
+  abort();
+
+}
+
+
+/* Persistent mode, called by doneWork in a forked child. Instead of
+   exiting, the child stops itself; the fork server relays the stop as the
+   status of this test case and sends SIGCONT when the next one is due.
+   Returns 0 once the child has run aflPersistentCnt test cases and should
+   be recycled, 1 when the guest should loop back to getWork. */
+
+int afl_persistent_iterate(void) {
+
+  static unsigned int cycle_cnt;
+
+  if (!afl_fork_child || aflPersistentCnt < 2) return 0;
+  if (++cycle_cnt >= aflPersistentCnt) return 0;
+
+  start_trace = false;
+  afl_park_tsl();
+  raise(SIGSTOP);
+
+  afl_stats_run_begin();
+  current_cpu->afl_prev_loc = 0;
+  start_trace = true;
+  return 1;
+
+}
+
+
+/* Reset mode. The fuzzer sees the same protocol as with the fork server,
+   but every "child" is this process, restored to the startWork snapshot
+   between test cases. Returns 0 if nobody is listening. A timeout still
+   makes afl-fuzz kill the reported pid, so it ends the whole session. */
+
+int afl_snapshot_handshake(void) {
+
+  if (!afl_area_ptr) return 0;
+
+  if (!afl_hello()) return 0;
+
+  afl_forksrv_pid = getpid();
+  afl_tb_cache_load(current_cpu);
+  afl_snapshot_wait();
+  return 1;
+
+}
+
+/* Block until the fuzzer asks for the next run, then hand it our pid. */
+
+void afl_snapshot_wait(void) {
+
+  unsigned char tmp[4];
+
+  afl_stats_maybe_write();
+
+  if (read(FORKSRV_FD, tmp, 4) != 4) {
+    puts("[!] Parent dead!");
+    afl_tb_cache_save();
+    exit(2);
+  }
+
+  current_cpu->afl_prev_loc = 0;
+  afl_stats_run_begin();
+
+  if (write(FORKSRV_FD + 1, &afl_forksrv_pid, 4) != 4) exit(5);
+
+}
+
+/* Relay the waitpid()-style status of the run that just finished. */
+
+void afl_snapshot_report(int status) {
+
+  if (write(FORKSRV_FD + 1, &status, 4) != 4) exit(7);
 
 }
 
@@ -303,30 +1051,95 @@ static inline void afl_maybe_log(abi_ulong cur_loc) {
 /* This code is invoked whenever QEMU decides that it doesn't have a
    translation of a particular block and needs to compute it. When this happens,
    we tell the parent to mirror the operation, so that the next fork() has a
-   cached copy. */
+   cached copy. Blocks that span two pages are not worth the trouble. */
 
-static void afl_request_tsl(target_ulong pc, target_ulong cb, uint64_t flags) {
+static void afl_request_tsl(TranslationBlock *tb, uint32_t cf_mask) {
 
   struct afl_tsl t;
 
-  if (!afl_fork_child) return;
+  if (!afl_fork_child || tb->page_addr[1] != -1) return;
+
+  t.pc        = tb->pc;
+  t.cs_base   = tb->cs_base;
+  t.flags     = tb->flags;
+  t.cf_mask   = cf_mask;
+  t.page_addr = tb->page_addr[0];
+
+  if (write(TSL_FD, &t, sizeof(struct afl_tsl)) != sizeof(struct afl_tsl))
+    return;
+
+}
+
+static void afl_park_tsl(void) {
 
-  t.pc      = pc;
-  t.cs_base = cb;
-  t.flags   = flags;
+  struct afl_tsl t = { .pc = AFL_TSL_PARK };
 
   if (write(TSL_FD, &t, sizeof(struct afl_tsl)) != sizeof(struct afl_tsl))
     return;
 
 }
 
+/* Translate the block described by t in the parent.
+
+   The parent is stopped in the middle of a TB at afl_start_code, so it only
+   mirrors blocks it would translate identically: same TB flags as its own
+   state (checked by the callers) and pc mapping to the same page under its
+   own page tables. Should translation still fault, or the code buffer fill
+   up, tb_gen_code() leaves through cpu->jmp_env; we catch that and put the
+   guest state back from saved_env. The callers own cpu->jmp_env meanwhile.
+   Returns 0 when the caller should stop mirroring. */
+
+static int afl_mirror_tb(CPUState *cpu, const struct afl_tsl *t,
+                         const uint32_t *page_crc, const void *saved_env) {
+
+  CPUArchState *env = cpu->env_ptr;
+
+  /* Leave plenty of room; running out mid-translation flushes the lot. */
+
+  if (tcg_code_size() > tcg_code_capacity() / 2) return 0;
+
+  if (sigsetjmp(cpu->jmp_env, 0)) {
+    memcpy(env, saved_env, offsetof(CPUArchState, end_reset_fields));
+    cpu->exception_index = -1;
+    return 0;
+  }
+
+  if (get_page_addr_code(env, t->pc) != t->page_addr) return 1;
+
+#ifndef CONFIG_USER_ONLY
+  if (page_crc && afl_page_crc(t->page_addr) != *page_crc) return 1;
+#endif
+
+  if (!tb_htable_lookup(cpu, t->pc, t->cs_base, t->flags, t->cf_mask)) {
+    mmap_lock();
+    tb_gen_code(cpu, t->pc, t->cs_base, t->flags, t->cf_mask);
+    mmap_unlock();
+    afl_stats->tb_mirrored++;
+  }
+
+  return 1;
+
+}
+
 /* This is the other side of the same channel. Since timeouts are handled by
-   afl-fuzz simply killing the child, we can just wait until the pipe breaks. */
+   afl-fuzz simply killing the child, we can just wait until the pipe breaks.
+   Returns 1 if the child parked itself instead, 0 once the pipe is gone. */
 
-static void afl_wait_tsl(CPUState *cpu, int fd) {
+static int afl_wait_tsl(CPUState *cpu, int fd) {
 
+  CPUArchState *env = cpu->env_ptr;
   struct afl_tsl t;
-  TranslationBlock *tb;
+  target_ulong pc, cs_base;
+  uint32_t flags;
+  sigjmp_buf jmp_env;
+  void *saved_env;
+  int mirror = 1;
+  int parked = 0;
+
+  cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+
+  memcpy(jmp_env, cpu->jmp_env, sizeof(jmp_env));
+  saved_env = g_memdup(env, offsetof(CPUArchState, end_reset_fields));
 
   while (1) {
 
@@ -335,23 +1148,161 @@ static void afl_wait_tsl(CPUState *cpu, int fd) {
     if (read(fd, &t, sizeof(struct afl_tsl)) != sizeof(struct afl_tsl))
       break;
 
-    /*
-     * 这一块可能不是必要的，关掉这个功能也不会导致 crash，只会降低速度
-     * 先将其注释掉
-    */
+    if (t.pc == AFL_TSL_PARK) {
+      parked = 1;
+      break;
+    }
+
+    if (mirror && t.flags == flags)
+      mirror = afl_mirror_tb(cpu, &t, NULL, saved_env);
+
+  }
+
+  memcpy(cpu->jmp_env, jmp_env, sizeof(jmp_env));
+  g_free(saved_env);
+  return parked;
+
+}
+
 
-    // tb = tb_htable_lookup(cpu, t.pc, t.cs_base, t.flags);
+#ifndef CONFIG_USER_ONLY
 
-    // if(!tb) {
-    //   mmap_lock();
-    //   tb_lock();
-    //   tb_gen_code(cpu, t.pc, t.cs_base, t.flags, 0);
-    //   mmap_unlock();
-    //   tb_unlock();
-    // }
+/* Persistent translation cache (AFL_QEMU_TB_CACHE=<file>).
 
+   Host code is full of absolute helper addresses and patched goto_tb
+   jumps, so rather than the code itself we keep the list of blocks this
+   process ended up translating, keyed by {pc, cs_base, flags, cf_mask} and
+   by the CRC of the guest page they came from. The next campaign
+   retranslates the blocks whose page is unchanged before the first fork,
+   so the children start with a warm cache. */
+
+#define AFL_TB_CACHE_MAGIC 0x43425451 /* "QTBC" */
+
+struct afl_tb_cache_entry {
+  struct afl_tsl tsl;
+  uint32_t page_crc;
+};
+
+struct afl_tb_cache_header {
+  uint32_t magic;
+  uint32_t entry_size;
+};
+
+static uint32_t afl_page_crc(tb_page_addr_t page_addr) {
+
+  uint8_t *host = qemu_map_ram_ptr(NULL, page_addr & TARGET_PAGE_MASK);
+
+  return crc32c(0xffffffff, host, TARGET_PAGE_SIZE);
+
+}
+
+struct afl_tb_cache_save {
+  FILE *fp;
+  GHashTable *crcs;
+};
+
+static gboolean afl_tb_cache_save_one(gpointer key, gpointer value,
+                                      gpointer data) {
+
+  const TranslationBlock *tb = value;
+  struct afl_tb_cache_save *save = data;
+  struct afl_tb_cache_entry e;
+  gpointer page = GSIZE_TO_POINTER(tb->page_addr[0] >> TARGET_PAGE_BITS);
+  gpointer crc;
+
+  if (tb->page_addr[1] != -1 || (tb_cflags(tb) & CF_INVALID)) return FALSE;
+
+  if (!g_hash_table_lookup_extended(save->crcs, page, NULL, &crc)) {
+    crc = GUINT_TO_POINTER(afl_page_crc(tb->page_addr[0]));
+    g_hash_table_insert(save->crcs, page, crc);
   }
 
-  close(fd);
+  memset(&e, 0, sizeof(e));
+  e.tsl.pc        = tb->pc;
+  e.tsl.cs_base   = tb->cs_base;
+  e.tsl.flags     = tb->flags;
+  e.tsl.cf_mask   = tb_cflags(tb) & CF_HASH_MASK;
+  e.tsl.page_addr = tb->page_addr[0];
+  e.page_crc      = GPOINTER_TO_UINT(crc);
+
+  return fwrite(&e, sizeof(e), 1, save->fp) != 1;
 
 }
+
+/* Written when the fuzzer goes away; a temporary file keeps concurrent
+   instances sharing the same cache from seeing each other's halves. */
+
+static void afl_tb_cache_save(void) {
+
+  const char *path = getenv("AFL_QEMU_TB_CACHE");
+  struct afl_tb_cache_header h = {
+    .magic = AFL_TB_CACHE_MAGIC,
+    .entry_size = sizeof(struct afl_tb_cache_entry),
+  };
+  struct afl_tb_cache_save save;
+  g_autofree char *tmp = NULL;
+
+  if (!path) return;
+
+  tmp = g_strdup_printf("%s.%d", path, getpid());
+  save.fp = fopen(tmp, "wb");
+  if (!save.fp) return;
+
+  save.crcs = g_hash_table_new(NULL, NULL);
+
+  if (fwrite(&h, sizeof(h), 1, save.fp) == 1)
+    tcg_tb_foreach(afl_tb_cache_save_one, &save);
+
+  g_hash_table_destroy(save.crcs);
+
+  if (fclose(save.fp) || rename(tmp, path)) unlink(tmp);
+
+}
+
+static void afl_tb_cache_load(CPUState *cpu) {
+
+  const char *path = getenv("AFL_QEMU_TB_CACHE");
+  CPUArchState *env = cpu->env_ptr;
+  struct afl_tb_cache_header h;
+  struct afl_tb_cache_entry e;
+  target_ulong pc, cs_base;
+  uint32_t flags;
+  sigjmp_buf jmp_env;
+  void *saved_env;
+  FILE *fp;
+
+  if (!path) return;
+
+  fp = fopen(path, "rb");
+  if (!fp) return;
+
+  if (fread(&h, sizeof(h), 1, fp) != 1 || h.magic != AFL_TB_CACHE_MAGIC ||
+      h.entry_size != sizeof(struct afl_tb_cache_entry)) {
+    fclose(fp);
+    return;
+  }
+
+  cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+
+  memcpy(jmp_env, cpu->jmp_env, sizeof(jmp_env));
+  saved_env = g_memdup(env, offsetof(CPUArchState, end_reset_fields));
+
+  while (fread(&e, sizeof(e), 1, fp) == 1) {
+
+    if (e.tsl.flags != flags) continue;
+    if (!afl_mirror_tb(cpu, &e.tsl, &e.page_crc, saved_env)) break;
+
+  }
+
+  memcpy(cpu->jmp_env, jmp_env, sizeof(jmp_env));
+  g_free(saved_env);
+  fclose(fp);
+
+}
+
+#else
+
+static void afl_tb_cache_save(void) {}
+static void afl_tb_cache_load(CPUState *cpu) {}
+
+#endif /* !CONFIG_USER_ONLY */
@@ -0,0 +1,178 @@
+/*
+ * In-process snapshot and restore for the AFL reset mode
+ *
+ * Instead of forking the whole emulator for every test case, the vCPU
+ * state, guest RAM and device state are captured once when the guest
+ * calls startWork and put back in place after doneWork.  Only the RAM
+ * pages written during a run are copied back; they are found through the
+ * migration dirty bitmap, which TCG and KVM both keep up to date once
+ * global dirty logging is enabled.  Likewise only the devices that were
+ * accessed during a run have their state reloaded.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "migration/snapshot.h"
+#include "sysemu/cpu-timers.h"
+#include "sysemu/hw_accel.h"
+#include "sysemu/tcg.h"
+#include "afl.h"
+
+#define AFL_SNAPSHOT_DEVICE_BUF_SIZE (1 * MiB)
+
+typedef struct AFLRAMSnapshot {
+    RAMBlock *rb;
+    void *saved;
+} AFLRAMSnapshot;
+
+static struct {
+    CPUArchState *env;
+    GArray *ram;
+    DeviceSnapshot *devices;
+    bool all_devices;
+    CPUTimersSnapshot timers;
+} afl_snapshot;
+
+static int afl_snapshot_save_ram(RAMBlock *rb, void *opaque)
+{
+    AFLRAMSnapshot r = {
+        .rb = rb,
+        .saved = g_memdup(qemu_ram_get_host_addr(rb),
+                          qemu_ram_get_used_length(rb)),
+    };
+
+    /* Start tracking writes from the state we just copied. */
+    qemu_ram_restore_dirty_pages(rb, NULL);
+    g_array_append_val(afl_snapshot.ram, r);
+    return 0;
+}
+
+void afl_snapshot_take(CPUState *cpu)
+{
+    bool locked = qemu_mutex_iothread_locked();
+
+    if (afl_snapshot.env) {
+        return;
+    }
+    if (CPU_NEXT(first_cpu)) {
+        error_report("AFL snapshot mode only supports a single vCPU");
+        exit(1);
+    }
+
+    if (!locked) {
+        qemu_mutex_lock_iothread();
+    }
+
+    cpu_synchronize_state(cpu);
+    afl_snapshot.env = g_memdup(cpu->env_ptr,
+                                offsetof(CPUArchState, end_reset_fields));
+    if (icount_enabled()) {
+        icount_update(cpu);
+    }
+    cpu_timers_save(&afl_snapshot.timers);
+
+    afl_snapshot.ram = g_array_new(false, false, sizeof(AFLRAMSnapshot));
+    memory_global_dirty_log_start();
+    qemu_ram_foreach_block(afl_snapshot_save_ram, NULL);
+
+    /*
+     * Only devices that ran are reloaded after a test case.  Timers are
+     * not tracked, so with a running guest clock, or on request, reload
+     * them all.
+     */
+    afl_snapshot.all_devices = aflEnableTicks || icount_enabled() ||
+                               getenv("AFL_QEMU_SNAPSHOT_ALL_DEVICES");
+    afl_snapshot.devices = device_snapshot_new(AFL_SNAPSHOT_DEVICE_BUF_SIZE);
+    if (device_snapshot_save(afl_snapshot.devices) < 0) {
+        error_report("AFL snapshot: failed to save device state");
+        exit(1);
+    }
+
+    if (!locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+void afl_snapshot_restore(CPUState *cpu)
+{
+    bool locked = qemu_mutex_iothread_locked();
+    int64_t start = get_clock();
+    int i;
+
+    if (!afl_snapshot.env) {
+        return;
+    }
+
+    if (!locked) {
+        qemu_mutex_lock_iothread();
+    }
+
+    memory_global_dirty_log_sync();
+    for (i = 0; i < afl_snapshot.ram->len; i++) {
+        AFLRAMSnapshot *r = &g_array_index(afl_snapshot.ram,
+                                           AFLRAMSnapshot, i);
+
+        qemu_ram_restore_dirty_pages(r->rb, r->saved);
+    }
+
+    /* Devices' timers are relative to the virtual clock, do that first */
+    if (icount_enabled()) {
+        icount_update(cpu);
+    }
+    cpu_timers_restore(&afl_snapshot.timers);
+
+    if ((afl_snapshot.all_devices ?
+         device_snapshot_load(afl_snapshot.devices) :
+         device_snapshot_load_dirty(afl_snapshot.devices)) < 0) {
+        error_report("AFL snapshot: failed to restore device state");
+        exit(1);
+    }
+
+    memcpy(cpu->env_ptr, afl_snapshot.env,
+           offsetof(CPUArchState, end_reset_fields));
+    cpu_synchronize_post_init(cpu);
+    if (tcg_enabled()) {
+        tlb_flush(cpu);
+    }
+
+    if (!locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    afl_stats->reset_ns += get_clock() - start;
+}
+
+/*
+ * Called by startWork.  Unless the harness asked for ticks, the guest
+ * clock is stopped for the runs, so no timer interrupt can land at a
+ * different point from one run to the next.  Under -icount with a fixed
+ * shift the clock follows the instruction count instead, which is just
+ * as repeatable, and is left running.
+ */
+void afl_clock_setup(void)
+{
+    bool locked = qemu_mutex_iothread_locked();
+
+    if (icount_enabled() == 2) {
+        warn_report("AFL: adaptive icount is not deterministic, "
+                    "use -icount with a fixed shift");
+    }
+    if (aflEnableTicks || icount_enabled()) {
+        return;
+    }
+
+    if (!locked) {
+        qemu_mutex_lock_iothread();
+    }
+    cpu_disable_ticks();
+    if (!locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
@@ -12,9 +12,65 @@ extern target_ulong afl_start_code, afl_end_code;
 extern int afl_need_start, afl_need_stop;
 extern unsigned char afl_fork_child;
 extern int afl_wants_cpu_to_stop;
-extern int start_trace;
+extern bool start_trace;
+extern int aflSnapshot;
+extern unsigned int aflPersistentCnt;
+extern uint32_t *afl_fuzz_len;
+extern uint8_t *afl_fuzz_buf;
+
+/* Fuzz loop counters, in memory shared by the fork server and its
+   children. Times are in ns. */
+typedef struct AFLStats {
+    uint64_t execs;
+    uint64_t crashes;
+    uint64_t tb_translated;     /* by the runs */
+    uint64_t tb_instrumented;   /* with a coverage update */
+    uint64_t tb_mirrored;       /* by the fork server for its children */
+    uint64_t tb_flushes;        /* during the runs */
+    int64_t fork_ns;
+    int64_t getwork_ns;
+    int64_t exec_ns;
+    int64_t translate_ns;
+    int64_t reset_ns;
+} AFLStats;
+
+extern AFLStats *afl_stats;
+
+/* Hypercall numbers for fuzzCall under KVM ("AFL" in the top bytes). */
+#define AFL_HYPERCALL_NR(code)  (0x41464c00 | (code))
+#define AFL_HYPERCALL_CODE_MASK 0xff
+
+/* Most guest address ranges startWork can ask to instrument. */
+#define AFL_MAX_RANGES 16
+
+/* The fuzzCall ABI, for the targets' fuzzCall instructions. */
+target_ulong afl_fuzz_call(CPUArchState *env, target_ulong code,
+                           target_ulong a0, target_ulong a1);
 
 void afl_setup(void);
-void afl_forkserver(CPUArchState*);
+void afl_forkserver(CPUState*);
+void afl_gen_trace(target_ulong pc);
+int afl_gen_crash_check(target_ulong pc);
+void afl_classify_map(void);
+void afl_stats_run_end(int crashed);
+void afl_stats_dump(FILE *f);
+int afl_set_ranges(const target_ulong *ranges, unsigned int cnt);
+
+/* For the translators: log the operands of a comparison for CmpLog. */
+#ifdef TCG_TCG_OP_H
+void afl_gen_cmplog(target_ulong pc, MemOp ot, TCGv a, TCGv b);
+#endif
+int afl_persistent_iterate(void);
+
+/* Reset mode: the fork server protocol without the fork. */
+int afl_snapshot_handshake(void);
+void afl_snapshot_wait(void);
+void afl_snapshot_report(int status);
+
+#ifndef CONFIG_USER_ONLY
+void afl_snapshot_take(CPUState *cpu);
+void afl_snapshot_restore(CPUState *cpu);
+void afl_clock_setup(void);
+#endif
 
 #endif
\ No newline at end of file
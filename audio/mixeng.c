@@ -452,19 +452,25 @@ void mixeng_clear (struct st_sample *buf, int len)
 
 void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
 {
+    int i;
+
     if (vol->mute) {
         mixeng_clear (buf, len);
         return;
     }
 
-    while (len--) {
+    /* Full volume, the common case, leaves the samples unchanged */
+    if (vol->l == nominal_volume.l && vol->r == nominal_volume.r) {
+        return;
+    }
+
+    for (i = 0; i < len; i++) {
 #ifdef FLOAT_MIXENG
-        buf->l = buf->l * vol->l;
-        buf->r = buf->r * vol->r;
+        buf[i].l = buf[i].l * vol->l;
+        buf[i].r = buf[i].r * vol->r;
 #else
-        buf->l = (buf->l * vol->l) >> 32;
-        buf->r = (buf->r * vol->r) >> 32;
+        buf[i].l = (buf[i].l * vol->l) >> 32;
+        buf[i].r = (buf[i].r * vol->r) >> 32;
 #endif
-        buf += 1;
     }
 }
@@ -81,6 +81,17 @@ static inline int64_t glue (conv_, ET) (IN_T v)
 #endif
 }
 
+#ifdef SIGNED
+/*
+ * Saturate instead of branching, so that the clip loops below can be
+ * vectorized.  The bounds map exactly to IN_MIN and IN_MAX.
+ */
+static inline IN_T glue(clip_, ET)(int64_t v)
+{
+    v = MIN(MAX(v, -2147483648LL), 0x7fffffffLL);
+    return ENDIAN_CONVERT((IN_T)(v >> (32 - SHIFT)));
+}
+#else
 static inline IN_T glue (clip_, ET) (int64_t v)
 {
     if (v >= 0x7fffffffLL) {
@@ -89,61 +100,58 @@ static inline IN_T glue (clip_, ET) (int64_t v)
         return IN_MIN;
     }
 
-#ifdef SIGNED
-    return ENDIAN_CONVERT ((IN_T) (v >> (32 - SHIFT)));
-#else
     return ENDIAN_CONVERT ((IN_T) ((v >> (32 - SHIFT)) + HALF));
-#endif
 }
 #endif
+#endif
 
+/*
+ * The loops below use indices rather than walking pointers, and read
+ * each input only once, so that the compiler can vectorize them.
+ */
 static void glue (glue (conv_, ET), _to_stereo)
     (struct st_sample *dst, const void *src, int samples)
 {
-    struct st_sample *out = dst;
-    IN_T *in = (IN_T *) src;
+    const IN_T *in = src;
+    int i;
 
-    while (samples--) {
-        out->l = glue (conv_, ET) (*in++);
-        out->r = glue (conv_, ET) (*in++);
-        out += 1;
+    for (i = 0; i < samples; i++) {
+        dst[i].l = glue(conv_, ET)(in[2 * i]);
+        dst[i].r = glue(conv_, ET)(in[2 * i + 1]);
     }
 }
 
 static void glue (glue (conv_, ET), _to_mono)
     (struct st_sample *dst, const void *src, int samples)
 {
-    struct st_sample *out = dst;
-    IN_T *in = (IN_T *) src;
-
-    while (samples--) {
-        out->l = glue (conv_, ET) (in[0]);
-        out->r = out->l;
-        out += 1;
-        in += 1;
+    const IN_T *in = src;
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        dst[i].l = dst[i].r = glue(conv_, ET)(in[i]);
     }
 }
 
 static void glue (glue (clip_, ET), _from_stereo)
     (void *dst, const struct st_sample *src, int samples)
 {
-    const struct st_sample *in = src;
-    IN_T *out = (IN_T *) dst;
-    while (samples--) {
-        *out++ = glue (clip_, ET) (in->l);
-        *out++ = glue (clip_, ET) (in->r);
-        in += 1;
+    IN_T *out = dst;
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        out[2 * i] = glue(clip_, ET)(src[i].l);
+        out[2 * i + 1] = glue(clip_, ET)(src[i].r);
     }
 }
 
 static void glue (glue (clip_, ET), _from_mono)
     (void *dst, const struct st_sample *src, int samples)
 {
-    const struct st_sample *in = src;
-    IN_T *out = (IN_T *) dst;
-    while (samples--) {
-        *out++ = glue (clip_, ET) (in->l + in->r);
-        in += 1;
+    IN_T *out = dst;
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        out[i] = glue(clip_, ET)(src[i].l + src[i].r);
     }
 }
 
@@ -207,6 +207,27 @@ static void host_memory_backend_set_dump(Object *obj, bool value, Error **errp)
     }
 }
 
+/*
+ * Preallocate with threads running on the host nodes the memory is
+ * bound to, so that each node's share is faulted in locally.
+ */
+static void host_memory_backend_prealloc(HostMemoryBackend *backend,
+                                         bool async, Error **errp)
+{
+    int fd = memory_region_get_fd(&backend->mr);
+    void *ptr = memory_region_get_ram_ptr(&backend->mr);
+    uint64_t sz = memory_region_size(&backend->mr);
+    const unsigned long *host_nodes = NULL;
+    unsigned long maxnode = 0;
+
+    if (backend->policy != HOST_MEM_POLICY_DEFAULT) {
+        host_nodes = backend->host_nodes;
+        maxnode = MAX_NODES;
+    }
+    os_mem_prealloc_nodes(fd, ptr, sz, backend->prealloc_threads,
+                          host_nodes, maxnode, async, errp);
+}
+
 static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -226,11 +247,7 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 
     if (value && !backend->prealloc) {
-        int fd = memory_region_get_fd(&backend->mr);
-        void *ptr = memory_region_get_ram_ptr(&backend->mr);
-        uint64_t sz = memory_region_size(&backend->mr);
-
-        os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads, &local_err);
+        host_memory_backend_prealloc(backend, false, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -239,6 +256,27 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 }
 
+static bool host_memory_backend_get_prealloc_async(Object *obj,
+                                                   Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->prealloc_async;
+}
+
+static void host_memory_backend_set_prealloc_async(Object *obj, bool value,
+                                                   Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property 'prealloc-async' of %s",
+                   object_get_typename(obj));
+        return;
+    }
+    backend->prealloc_async = value;
+}
+
 static void host_memory_backend_get_prealloc_threads(Object *obj, Visitor *v,
     const char *name, void *opaque, Error **errp)
 {
@@ -390,8 +428,11 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * specified NUMA policy in place.
          */
         if (backend->prealloc) {
-            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
-                            backend->prealloc_threads, &local_err);
+            /* Nobody waits for a hotplugged backend, see qemu_init() */
+            host_memory_backend_prealloc(backend,
+                                         backend->prealloc_async &&
+                                         !qdev_hotplug,
+                                         &local_err);
             if (local_err) {
                 goto out;
             }
@@ -475,6 +516,11 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "prealloc-threads",
         "Number of CPU threads to use for prealloc");
+    object_class_property_add_bool(oc, "prealloc-async",
+        host_memory_backend_get_prealloc_async,
+        host_memory_backend_set_prealloc_async);
+    object_class_property_set_description(oc, "prealloc-async",
+        "Let machine initialization run while preallocating memory");
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
@@ -380,8 +380,9 @@ BlockDriverState *bdrv_new(void)
         QLIST_INIT(&bs->op_blockers[i]);
     }
     notifier_with_return_list_init(&bs->before_write_notifiers);
-    qemu_co_mutex_init(&bs->reqs_lock);
+    qemu_mutex_init(&bs->reqs_lock);
     qemu_mutex_init(&bs->dirty_bitmap_mutex);
+    qemu_mutex_init(&bs->block_status_cache_lock);
     bs->refcnt = 1;
     bs->aio_context = qemu_get_aio_context();
 
@@ -1319,6 +1320,9 @@ static void bdrv_child_cb_detach(BdrvChild *child)
         bdrv_backing_detach(child);
     }
 
+    /* Cached block status may point into the child going away */
+    bdrv_block_status_cache_clear(bs);
+
     bdrv_unapply_subtree_drain(child, bs);
 }
 
@@ -4351,6 +4355,7 @@ void bdrv_reopen_commit(BDRVReopenState *reopen_state)
     if (drv->bdrv_reopen_commit) {
         drv->bdrv_reopen_commit(reopen_state);
     }
+    bdrv_block_status_cache_clear(bs);
 
     /* set BDS specific flags now */
     qobject_unref(bs->explicit_options);
@@ -4428,6 +4433,7 @@ static void bdrv_close(BlockDriverState *bs)
         }
         bs->drv = NULL;
     }
+    bdrv_block_status_cache_clear(bs);
 
     QLIST_FOREACH_SAFE(child, &bs->children, next, next) {
         bdrv_unref_child(bs, child);
@@ -4695,6 +4701,7 @@ static void bdrv_delete(BlockDriverState *bs)
 
     bdrv_close(bs);
 
+    qemu_mutex_destroy(&bs->block_status_cache_lock);
     g_free(bs);
 }
 
@@ -4708,6 +4715,8 @@ static void bdrv_delete(BlockDriverState *bs)
 int coroutine_fn bdrv_co_check(BlockDriverState *bs,
                                BdrvCheckResult *res, BdrvCheckMode fix)
 {
+    int ret;
+
     if (bs->drv == NULL) {
         return -ENOMEDIUM;
     }
@@ -4716,7 +4725,12 @@ int coroutine_fn bdrv_co_check(BlockDriverState *bs,
     }
 
     memset(res, 0, sizeof(*res));
-    return bs->drv->bdrv_co_check(bs, res, fix);
+    ret = bs->drv->bdrv_co_check(bs, res, fix);
+    if (fix) {
+        /* Repairs rewrite metadata without going through the I/O path */
+        bdrv_block_status_cache_clear(bs);
+    }
+    return ret;
 }
 
 /*
@@ -5806,6 +5820,7 @@ int coroutine_fn bdrv_co_invalidate_cache(BlockDriverState *bs, Error **errp)
         }
         bdrv_set_perm(bs, perm, shared_perm);
 
+        bdrv_block_status_cache_clear(bs);
         if (bs->drv->bdrv_co_invalidate_cache) {
             bs->drv->bdrv_co_invalidate_cache(bs, &local_err);
             if (local_err) {
@@ -6641,6 +6656,8 @@ int bdrv_amend_options(BlockDriverState *bs, QemuOpts *opts,
                        bool force,
                        Error **errp)
 {
+    int ret;
+
     if (!bs->drv) {
         error_setg(errp, "Node is ejected");
         return -ENOMEDIUM;
@@ -6650,8 +6667,10 @@ int bdrv_amend_options(BlockDriverState *bs, QemuOpts *opts,
                    bs->drv->format_name);
         return -ENOTSUP;
     }
-    return bs->drv->bdrv_amend_options(bs, opts, status_cb,
-                                       cb_opaque, force, errp);
+    ret = bs->drv->bdrv_amend_options(bs, opts, status_cb,
+                                      cb_opaque, force, errp);
+    bdrv_block_status_cache_clear(bs);
+    return ret;
 }
 
 /*
@@ -7081,6 +7100,7 @@ int bdrv_make_empty(BdrvChild *c, Error **errp)
     }
 
     ret = drv->bdrv_make_empty(c->bs);
+    bdrv_block_status_cache_clear(c->bs);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Failed to empty %s",
                          c->bs->filename);
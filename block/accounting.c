@@ -32,6 +32,9 @@
 static QEMUClockType clock_type = QEMU_CLOCK_REALTIME;
 static const int qtest_latency_ns = NANOSECONDS_PER_SECOND / 1000;
 
+static unsigned int latency_shard_next;
+static __thread int latency_shard = -1;
+
 void block_acct_init(BlockAcctStats *stats)
 {
     qemu_mutex_init(&stats->lock);
@@ -50,9 +53,15 @@ void block_acct_setup(BlockAcctStats *stats, bool account_invalid,
 void block_acct_cleanup(BlockAcctStats *stats)
 {
     BlockAcctTimedStats *s, *next;
+    int i;
+
     QSLIST_FOREACH_SAFE(s, &stats->intervals, entries, next) {
         g_free(s);
     }
+    for (i = 0; i < BLOCK_ACCT_LAT_SHARDS; i++) {
+        g_free(stats->latency_shards[i]);
+        stats->latency_shards[i] = NULL;
+    }
     qemu_mutex_destroy(&stats->lock);
 }
 
@@ -182,6 +191,116 @@ void block_latency_histograms_clear(BlockAcctStats *stats)
     }
 }
 
+/* Index of the log-linear histogram bucket for @latency_ns */
+static int block_acct_latency_bucket(uint64_t latency_ns)
+{
+    int shift;
+
+    latency_ns = MIN(latency_ns, (1ULL << BLOCK_ACCT_LAT_MAX_BITS) - 1);
+    if (latency_ns < BLOCK_ACCT_LAT_SUB_BUCKETS) {
+        return latency_ns;
+    }
+
+    shift = 63 - clz64(latency_ns) - BLOCK_ACCT_LAT_SUB_BITS;
+    return (shift + 1) * BLOCK_ACCT_LAT_SUB_BUCKETS +
+           (latency_ns >> shift) - BLOCK_ACCT_LAT_SUB_BUCKETS;
+}
+
+/* Largest latency that falls in bucket @idx */
+static uint64_t block_acct_latency_bucket_max(int idx)
+{
+    int shift;
+
+    if (idx < BLOCK_ACCT_LAT_SUB_BUCKETS) {
+        return idx;
+    }
+
+    shift = idx / BLOCK_ACCT_LAT_SUB_BUCKETS - 1;
+    return ((uint64_t)(idx % BLOCK_ACCT_LAT_SUB_BUCKETS +
+                       BLOCK_ACCT_LAT_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+static BlockAcctLatencyShard *block_acct_latency_shard(BlockAcctStats *stats)
+{
+    BlockAcctLatencyShard *shard, *new_shard;
+
+    if (latency_shard < 0) {
+        latency_shard = qatomic_fetch_inc(&latency_shard_next) %
+                        BLOCK_ACCT_LAT_SHARDS;
+    }
+
+    shard = qatomic_rcu_read(&stats->latency_shards[latency_shard]);
+    if (shard) {
+        return shard;
+    }
+
+    /* Another thread on the same shard may race with us */
+    new_shard = g_new0(BlockAcctLatencyShard, 1);
+    shard = qatomic_cmpxchg(&stats->latency_shards[latency_shard], NULL,
+                            new_shard);
+    if (shard) {
+        g_free(new_shard);
+        return shard;
+    }
+    return new_shard;
+}
+
+/*
+ * Compute the latencies below which the fractions @quantiles[] of the
+ * accounted @type requests completed, rounded up to the end of their
+ * histogram bucket.  Returns the number of requests in the histogram; if it
+ * is zero, @latency_ns is left untouched.
+ */
+uint64_t block_acct_latency_percentiles(BlockAcctStats *stats,
+                                        enum BlockAcctType type,
+                                        const double *quantiles,
+                                        uint64_t *latency_ns, int n)
+{
+    g_autofree uint64_t *buckets = g_new0(uint64_t, BLOCK_ACCT_LAT_BUCKETS);
+    uint64_t total = 0, sum;
+    int i, j, k;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    for (i = 0; i < BLOCK_ACCT_LAT_SHARDS; i++) {
+        BlockAcctLatencyShard *shard =
+            qatomic_rcu_read(&stats->latency_shards[i]);
+
+        if (!shard) {
+            continue;
+        }
+        for (j = 0; j < BLOCK_ACCT_LAT_BUCKETS; j++) {
+            uint64_t count = stat64_get(&shard->buckets[type][j]);
+
+            buckets[j] += count;
+            total += count;
+        }
+    }
+
+    if (!total) {
+        return 0;
+    }
+
+    for (k = 0; k < n; k++) {
+        double exact_rank = quantiles[k] * total;
+        uint64_t rank = exact_rank;
+
+        if (rank < exact_rank || !rank) {
+            rank++;
+        }
+
+        for (j = 0, sum = 0; j < BLOCK_ACCT_LAT_BUCKETS - 1; j++) {
+            sum += buckets[j];
+            if (sum >= rank) {
+                break;
+            }
+        }
+        latency_ns[k] = block_acct_latency_bucket_max(j);
+    }
+
+    return total;
+}
+
 static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                  bool failed)
 {
@@ -199,6 +318,13 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
         return;
     }
 
+    if (!failed || stats->account_failed) {
+        BlockAcctLatencyShard *shard = block_acct_latency_shard(stats);
+        int idx = block_acct_latency_bucket(MAX(latency_ns, 0));
+
+        stat64_add(&shard->buckets[cookie->type][idx], 1);
+    }
+
     qemu_mutex_lock(&stats->lock);
 
     if (failed) {
@@ -189,11 +189,20 @@ static int coroutine_fn backup_loop(BackupBlockJob *job)
 
     bdbi = bdrv_dirty_iter_new(block_copy_dirty_bitmap(job->bcs));
     while ((offset = bdrv_dirty_iter_next(bdbi)) != -1) {
+        /*
+         * Without a rate limit, hand block-copy enough work to keep all of
+         * its workers busy.  With one, stick to a cluster at a time so that
+         * throttling stays fine-grained.
+         */
+        int64_t bytes = job->common.speed ? job->cluster_size :
+                        MIN(block_copy_batch_size(job->bcs),
+                            job->len - offset);
+
         do {
             if (yield_and_check(job)) {
                 goto out;
             }
-            ret = backup_do_cow(job, offset, job->cluster_size, &error_is_read);
+            ret = backup_do_cow(job, offset, bytes, &error_is_read);
             if (ret < 0 && backup_error_action(job, error_is_read, -ret) ==
                            BLOCK_ERROR_ACTION_REPORT)
             {
@@ -279,6 +288,14 @@ static int coroutine_fn backup_run(Job *job, Error **errp)
     return ret;
 }
 
+static void backup_query(BlockJob *job, BlockJobInfo *info)
+{
+    BackupBlockJob *s = container_of(job, BackupBlockJob, common);
+
+    info->has_copy_stats = true;
+    info->copy_stats = block_copy_get_stats(s->bcs);
+}
+
 static const BlockJobDriver backup_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(BackupBlockJob),
@@ -289,7 +306,8 @@ static const BlockJobDriver backup_job_driver = {
         .commit                 = backup_commit,
         .abort                  = backup_abort,
         .clean                  = backup_clean,
-    }
+    },
+    .query                      = backup_query,
 };
 
 static int64_t backup_calculate_cluster_size(BlockDriverState *target,
@@ -20,6 +20,7 @@
 #include "sysemu/block-backend.h"
 #include "qemu/units.h"
 #include "qemu/coroutine.h"
+#include "qemu/timer.h"
 #include "block/aio_task.h"
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
@@ -27,6 +28,22 @@
 #define BLOCK_COPY_MAX_MEM (128 * MiB)
 #define BLOCK_COPY_MAX_WORKERS 64
 
+/*
+ * Bounds for the online tuning of the buffered chunk size and the number of
+ * parallel workers.  BLOCK_COPY_MAX_BUFFER and BLOCK_COPY_MAX_WORKERS are the
+ * starting point.
+ */
+#define BLOCK_COPY_MIN_CHUNK (64 * KiB)
+#define BLOCK_COPY_MAX_CHUNK (16 * MiB)
+#define BLOCK_COPY_MIN_WORKERS 1
+#define BLOCK_COPY_WORKERS_LIMIT 256
+
+/* Length of a measurement window, and what counts as a significant change */
+#define BLOCK_COPY_TUNE_INTERVAL_NS (1 * NANOSECONDS_PER_SECOND)
+#define BLOCK_COPY_TUNE_THRESHOLD_PCT 5
+/* Tasks faster than this are dominated by per-request overhead */
+#define BLOCK_COPY_TUNE_LOW_LATENCY_NS (1 * SCALE_MS)
+
 static coroutine_fn int block_copy_task_entry(AioTask *task);
 
 typedef struct BlockCopyCallState {
@@ -91,6 +108,29 @@ typedef struct BlockCopyState {
     void *progress_opaque;
 
     SharedResource *mem;
+
+    /*
+     * Online tuning, see block_copy_tune().  max_workers limits the tasks of
+     * each block_copy() call, max_buffer is the chunk size for buffered
+     * copying.  Every window one of them is moved one step, and the step is
+     * kept if throughput improved or reverted if it dropped.
+     */
+    int max_workers;
+    int64_t max_buffer;
+    int64_t max_chunk;
+    bool tune_chunk;        /* knob changed at the start of this window */
+    int worker_step;        /* +1 to grow, -1 to shrink */
+    int chunk_step;
+    int64_t window_start_ns;
+    int64_t window_last_ns; /* end of the last task accounted */
+    uint64_t window_bytes;
+    uint64_t window_tasks;
+    int64_t window_latency_ns;
+    uint64_t last_throughput;
+
+    /* Results of the last complete window, for block_copy_get_stats() */
+    uint64_t throughput;
+    uint64_t latency_ns;
 } BlockCopyState;
 
 static BlockCopyTask *find_conflicting_task(BlockCopyState *s,
@@ -240,6 +280,15 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
         .len = bdrv_dirty_bitmap_size(copy_bitmap),
         .write_flags = write_flags,
         .mem = shres_create(BLOCK_COPY_MAX_MEM),
+        .max_workers = BLOCK_COPY_MAX_WORKERS,
+        .max_buffer = MAX(cluster_size, BLOCK_COPY_MAX_BUFFER),
+        .max_chunk = MAX(cluster_size,
+                         MIN(BLOCK_COPY_MAX_CHUNK,
+                             QEMU_ALIGN_DOWN(block_copy_max_transfer(source,
+                                                                     target),
+                                             cluster_size))),
+        .worker_step = 1,
+        .chunk_step = 1,
     };
 
     if (block_copy_max_transfer(source, target) < cluster_size) {
@@ -261,7 +310,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
          * successful copy_range (look at block_copy_do_copy).
          */
         s->use_copy_range = true;
-        s->copy_size = MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER);
+        s->copy_size = s->max_buffer;
     }
 
     QLIST_INIT(&s->tasks);
@@ -302,6 +351,7 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
         return ret;
     }
 
+    aio_task_pool_set_max_busy_tasks(pool, task->s->max_workers);
     aio_task_pool_wait_slot(pool);
     if (aio_task_pool_status(pool) < 0) {
         co_put_to_shres(task->s->mem, task->bytes);
@@ -357,7 +407,7 @@ static int coroutine_fn block_copy_do_copy(BlockCopyState *s,
         if (ret < 0) {
             trace_block_copy_copy_range_fail(s, offset, ret);
             s->use_copy_range = false;
-            s->copy_size = MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER);
+            s->copy_size = s->max_buffer;
             /* Fallback to read+write with allocated buffer */
         } else {
             if (s->use_copy_range) {
@@ -382,7 +432,7 @@ static int coroutine_fn block_copy_do_copy(BlockCopyState *s,
 
     /*
      * In case of failed copy_range request above, we may proceed with buffered
-     * request larger than BLOCK_COPY_MAX_BUFFER. Still, further requests will
+     * request larger than s->max_buffer. Still, further requests will
      * be properly limited, so don't care too much. Moreover the most likely
      * case (copy_range is unsupported for the configuration, so the very first
      * copy_range request fails) is handled by setting large copy_size only
@@ -412,10 +462,115 @@ out:
     return ret;
 }
 
+/*
+ * Move the chunk size or the worker count one step, alternating between the
+ * two.  Steps double or halve the value; the total stays within the memory
+ * budget shared by all tasks.
+ */
+static void block_copy_tune_step(BlockCopyState *s)
+{
+    bool can_tune_chunk = !s->use_copy_range &&
+                          !(s->write_flags & BDRV_REQ_WRITE_COMPRESSED);
+
+    s->tune_chunk = can_tune_chunk && !s->tune_chunk;
+
+    if (s->tune_chunk) {
+        int64_t min = MAX(s->cluster_size, BLOCK_COPY_MIN_CHUNK);
+        int64_t chunk = s->chunk_step > 0 ? s->max_buffer * 2 :
+                                            s->max_buffer / 2;
+
+        chunk = QEMU_ALIGN_DOWN(MIN(MAX(chunk, min), s->max_chunk),
+                                s->cluster_size);
+        while (chunk > min && chunk * s->max_workers > BLOCK_COPY_MAX_MEM) {
+            chunk = MAX(QEMU_ALIGN_DOWN(chunk / 2, s->cluster_size), min);
+        }
+        s->max_buffer = chunk;
+        s->copy_size = chunk;
+    } else {
+        int workers = s->worker_step > 0 ? s->max_workers * 2 :
+                                           s->max_workers / 2;
+
+        workers = MIN(MAX(workers, BLOCK_COPY_MIN_WORKERS),
+                      BLOCK_COPY_WORKERS_LIMIT);
+        while (workers > BLOCK_COPY_MIN_WORKERS &&
+               (int64_t)workers * s->copy_size > BLOCK_COPY_MAX_MEM) {
+            workers /= 2;
+        }
+        s->max_workers = workers;
+    }
+
+    trace_block_copy_tune(s, s->max_buffer, s->max_workers, s->throughput,
+                          s->latency_ns);
+}
+
+/*
+ * Account a finished data copy and, at the end of a measurement window,
+ * compare the throughput with the previous window to decide on the next
+ * tuning step.
+ */
+static void block_copy_tune(BlockCopyState *s, int64_t bytes,
+                            int64_t start_ns, int64_t end_ns)
+{
+    uint64_t throughput, latency;
+    int *step;
+
+    if (!s->window_start_ns ||
+        start_ns - s->window_last_ns > BLOCK_COPY_TUNE_INTERVAL_NS)
+    {
+        /* First copy, or the copy was idle: measurements are meaningless */
+        s->window_start_ns = start_ns;
+        s->window_bytes = 0;
+        s->window_tasks = 0;
+        s->window_latency_ns = 0;
+        s->last_throughput = 0;
+    }
+
+    s->window_last_ns = end_ns;
+    s->window_bytes += bytes;
+    s->window_tasks++;
+    s->window_latency_ns += end_ns - start_ns;
+
+    if (end_ns - s->window_start_ns < BLOCK_COPY_TUNE_INTERVAL_NS) {
+        return;
+    }
+
+    throughput = s->window_bytes * NANOSECONDS_PER_SECOND /
+                 (end_ns - s->window_start_ns);
+    latency = s->window_latency_ns / s->window_tasks;
+    s->throughput = throughput;
+    s->latency_ns = latency;
+
+    step = s->tune_chunk ? &s->chunk_step : &s->worker_step;
+    if (s->last_throughput) {
+        if (throughput * 100 <
+            s->last_throughput * (100 - BLOCK_COPY_TUNE_THRESHOLD_PCT)) {
+            /* The last step hurt, go back the other way */
+            *step = -*step;
+        } else if (throughput * 100 <=
+                   s->last_throughput * (100 + BLOCK_COPY_TUNE_THRESHOLD_PCT)) {
+            /*
+             * No significant change: prefer fewer resources, except for tiny
+             * chunks that are dominated by per-request overhead.
+             */
+            *step = s->tune_chunk && latency < BLOCK_COPY_TUNE_LOW_LATENCY_NS ?
+                    1 : -1;
+        }
+    }
+
+    s->last_throughput = throughput;
+    s->window_start_ns = end_ns;
+    s->window_bytes = 0;
+    s->window_tasks = 0;
+    s->window_latency_ns = 0;
+
+    block_copy_tune_step(s);
+}
+
 static coroutine_fn int block_copy_task_entry(AioTask *task)
 {
     BlockCopyTask *t = container_of(task, BlockCopyTask, task);
     bool error_is_read = false;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int ret;
 
     ret = block_copy_do_copy(t->s, t->offset, t->bytes, t->zeroes,
@@ -424,6 +579,10 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
         t->call_state->failed = true;
         t->call_state->error_is_read = error_is_read;
     } else {
+        if (ret >= 0 && !t->zeroes) {
+            block_copy_tune(t->s, t->bytes, start_ns,
+                            qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+        }
         progress_work_done(t->s->progress, t->bytes);
         t->s->progress_bytes_callback(t->bytes, t->s->progress_opaque);
     }
@@ -607,7 +766,7 @@ static int coroutine_fn block_copy_dirty_clusters(BlockCopyState *s,
         bytes = end - offset;
 
         if (!aio && bytes) {
-            aio = aio_task_pool_new(BLOCK_COPY_MAX_WORKERS);
+            aio = aio_task_pool_new(s->max_workers);
         }
 
         ret = block_copy_task_run(aio, task);
@@ -684,3 +843,26 @@ void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
 {
     s->skip_unallocated = skip;
 }
+
+/*
+ * Amount of data worth passing to a single block_copy() call so that all
+ * workers can be kept busy.
+ */
+int64_t block_copy_batch_size(BlockCopyState *s)
+{
+    return s->copy_size * s->max_workers;
+}
+
+BlockCopyStats *block_copy_get_stats(BlockCopyState *s)
+{
+    BlockCopyStats *stats = g_new0(BlockCopyStats, 1);
+
+    *stats = (BlockCopyStats) {
+        .throughput = s->throughput,
+        .latency_ns = s->latency_ns,
+        .chunk_size = s->copy_size,
+        .workers = s->max_workers,
+    };
+
+    return stats;
+}
@@ -28,6 +28,7 @@
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "block/block_int.h"
+#include "block/readahead-cache.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qstring.h"
 #include "crypto/secret.h"
@@ -66,6 +67,7 @@ static CURLMcode __curl_multi_socket_action(CURLM *multi_handle,
 
 #define CURL_BLOCK_OPT_URL       "url"
 #define CURL_BLOCK_OPT_READAHEAD "readahead"
+#define CURL_BLOCK_OPT_CACHE_SIZE "cache-size"
 #define CURL_BLOCK_OPT_SSLVERIFY "sslverify"
 #define CURL_BLOCK_OPT_TIMEOUT "timeout"
 #define CURL_BLOCK_OPT_COOKIE    "cookie"
@@ -76,6 +78,7 @@ static CURLMcode __curl_multi_socket_action(CURLM *multi_handle,
 #define CURL_BLOCK_OPT_PROXY_PASSWORD_SECRET "proxy-password-secret"
 
 #define CURL_BLOCK_OPT_READAHEAD_DEFAULT (256 * 1024)
+#define CURL_BLOCK_OPT_CACHE_SIZE_DEFAULT (16 * MiB)
 #define CURL_BLOCK_OPT_SSLVERIFY_DEFAULT true
 #define CURL_BLOCK_OPT_TIMEOUT_DEFAULT 5
 
@@ -124,6 +127,8 @@ typedef struct BDRVCURLState {
     CURLState states[CURL_NUM_STATES];
     char *url;
     size_t readahead_size;
+    ReadaheadCache *cache;
+    uint64_t cache_size;
     bool sslverify;
     uint64_t timeout;
     char *cookie;
@@ -138,6 +143,8 @@ typedef struct BDRVCURLState {
 } BDRVCURLState;
 
 static void curl_clean_state(CURLState *s);
+static int coroutine_fn curl_co_fetch(void *opaque, uint64_t offset,
+                                      uint64_t bytes, QEMUIOVector *qiov);
 static void curl_multi_do(void *arg);
 
 #ifdef NEED_CURL_TIMER_CALLBACK
@@ -618,6 +625,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_SIZE,
             .help = "Readahead size",
         },
+        {
+            .name = CURL_BLOCK_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum size of the read cache (0 to disable)",
+        },
         {
             .name = CURL_BLOCK_OPT_SSLVERIFY,
             .type = QEMU_OPT_BOOL,
@@ -706,6 +718,9 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
         goto out_noclean;
     }
 
+    s->cache_size = qemu_opt_get_size(opts, CURL_BLOCK_OPT_CACHE_SIZE,
+                                      CURL_BLOCK_OPT_CACHE_SIZE_DEFAULT);
+
     s->timeout = qemu_opt_get_number(opts, CURL_BLOCK_OPT_TIMEOUT,
                                      CURL_BLOCK_OPT_TIMEOUT_DEFAULT);
     if (s->timeout > CURL_TIMEOUT_MAX) {
@@ -832,6 +847,11 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
 
     curl_attach_aio_context(bs, bdrv_get_aio_context(bs));
 
+    if (s->cache_size) {
+        s->cache = readahead_cache_new(bs, s->len, s->cache_size,
+                                       s->readahead_size, curl_co_fetch, bs);
+    }
+
     qemu_opts_del(opts);
     return 0;
 
@@ -889,7 +909,9 @@ static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
     state->buf_off = 0;
     g_free(state->orig_buf);
     state->buf_start = start;
-    state->buf_len = MIN(acb->end + s->readahead_size, s->len - start);
+    /* With the cache enabled, readahead is its business */
+    state->buf_len = MIN(acb->end + (s->cache ? 0 : s->readahead_size),
+                         s->len - start);
     end = start + state->buf_len - 1;
     state->orig_buf = g_try_malloc(state->buf_len);
     if (state->buf_len && state->orig_buf == NULL) {
@@ -918,9 +940,10 @@ out:
     qemu_mutex_unlock(&s->mutex);
 }
 
-static int coroutine_fn curl_co_preadv(BlockDriverState *bs,
-        uint64_t offset, uint64_t bytes, QEMUIOVector *qiov, int flags)
+static int coroutine_fn curl_co_fetch(void *opaque, uint64_t offset,
+                                      uint64_t bytes, QEMUIOVector *qiov)
 {
+    BlockDriverState *bs = opaque;
     CURLAIOCB acb = {
         .co = qemu_coroutine_self(),
         .ret = -EINPROGRESS,
@@ -936,11 +959,26 @@ static int coroutine_fn curl_co_preadv(BlockDriverState *bs,
     return acb.ret;
 }
 
+static int coroutine_fn curl_co_preadv(BlockDriverState *bs,
+        uint64_t offset, uint64_t bytes, QEMUIOVector *qiov, int flags)
+{
+    BDRVCURLState *s = bs->opaque;
+
+    if (s->cache) {
+        return readahead_cache_co_preadv(s->cache, offset, bytes, qiov);
+    }
+    return curl_co_fetch(bs, offset, bytes, qiov);
+}
+
 static void curl_close(BlockDriverState *bs)
 {
     BDRVCURLState *s = bs->opaque;
 
     trace_curl_close();
+    if (s->cache) {
+        readahead_cache_free(s->cache);
+        s->cache = NULL;
+    }
     curl_detach_aio_context(bs);
     qemu_mutex_destroy(&s->mutex);
 
@@ -961,8 +999,8 @@ static void curl_refresh_filename(BlockDriverState *bs)
 {
     BDRVCURLState *s = bs->opaque;
 
-    /* "readahead" and "timeout" do not change the guest-visible data,
-     * so ignore them */
+    /* "readahead", "cache-size" and "timeout" do not change the
+     * guest-visible data, so ignore them */
     if (s->sslverify != CURL_BLOCK_OPT_SSLVERIFY_DEFAULT ||
         s->cookie || s->username || s->password || s->proxyusername ||
         s->proxypassword)
@@ -902,6 +902,14 @@ bool bdrv_dirty_bitmap_next_dirty_area(BdrvDirtyBitmap *bitmap,
                                    dirty_start, dirty_count);
 }
 
+int bdrv_dirty_bitmap_next_dirty_areas(BdrvDirtyBitmap *bitmap,
+        int64_t start, int64_t end, int64_t max_dirty_count,
+        HBitmapArea *areas, int nb_areas)
+{
+    return hbitmap_next_dirty_areas(bitmap->bitmap, start, end,
+                                    max_dirty_count, areas, nb_areas);
+}
+
 /**
  * bdrv_merge_dirty_bitmap: merge src into dest.
  * Ensures permissions on bitmaps are reasonable; use for public API.
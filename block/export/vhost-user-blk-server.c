@@ -18,10 +18,13 @@
 #include "qapi/error.h"
 #include "qom/object_interfaces.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 #include "util/block-helpers.h"
 
 enum {
     VHOST_USER_BLK_NUM_QUEUES_DEFAULT = 1,
+    /* Requests popped from a virtqueue at once */
+    VU_BLK_POP_BATCH = 32,
 };
 struct virtio_blk_inhdr {
     unsigned char status;
@@ -45,15 +48,24 @@ typedef struct {
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
     bool writable;
+
+    /* Distinct AioContexts of the IOThreads that process the virtqueues */
+    AioContext **queue_ctx;
+    int nb_queue_ctx;
+    int quiesce_counter;
 } VuBlkExport;
 
 static void vu_blk_req_complete(VuBlkReq *req)
 {
     VuDev *vu_dev = &req->server->vu_dev;
+    int idx = req->vq - vu_dev->vq;
 
+    /* Other virtqueues and vhost-user messages are handled concurrently */
+    vhost_user_server_lock_queue(req->server, idx);
     /* IO size with 1 extra status byte */
     vu_queue_push(vu_dev, req->vq, &req->elem, req->size + 1);
     vu_queue_notify(vu_dev, req->vq);
+    vhost_user_server_unlock_queue(req->server, idx);
 
     free(req);
 }
@@ -203,19 +215,25 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
     VuVirtq *vq = vu_get_queue(vu_dev, idx);
 
     while (1) {
-        VuBlkReq *req;
+        VuBlkReq *reqs[VU_BLK_POP_BATCH];
+        unsigned int i, n;
 
-        req = vu_queue_pop(vu_dev, vq, sizeof(VuBlkReq));
-        if (!req) {
+        n = vu_queue_pop_batch(vu_dev, vq, sizeof(VuBlkReq), (void **)reqs,
+                               ARRAY_SIZE(reqs));
+        if (!n) {
             break;
         }
 
-        req->server = server;
-        req->vq = vq;
+        for (i = 0; i < n; i++) {
+            VuBlkReq *req = reqs[i];
+
+            req->server = server;
+            req->vq = vq;
 
-        Coroutine *co =
-            qemu_coroutine_create(vu_blk_virtio_process_req, req);
-        qemu_coroutine_enter(co);
+            Coroutine *co =
+                qemu_coroutine_create(vu_blk_virtio_process_req, req);
+            qemu_coroutine_enter(co);
+        }
     }
 }
 
@@ -339,6 +357,94 @@ static void blk_aio_detach(void *opaque)
     vexp->export.ctx = NULL;
 }
 
+/*
+ * Draining only quiesces the export's AioContext; also stop picking up
+ * kicks in the IOThreads that handle the virtqueues.
+ */
+static void vu_blk_drained_begin(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+    int i;
+
+    vexp->quiesce_counter++;
+    for (i = 0; i < vexp->nb_queue_ctx; i++) {
+        aio_disable_external(vexp->queue_ctx[i]);
+    }
+}
+
+static void vu_blk_drained_end(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+    int i;
+
+    assert(vexp->quiesce_counter > 0);
+    vexp->quiesce_counter--;
+    for (i = 0; i < vexp->nb_queue_ctx; i++) {
+        aio_enable_external(vexp->queue_ctx[i]);
+    }
+}
+
+static const BlockDevOps vu_blk_dev_ops = {
+    .drained_begin = vu_blk_drained_begin,
+    .drained_end   = vu_blk_drained_end,
+};
+
+/*
+ * Look up the IOThreads in @iothreads and assign the virtqueues to their
+ * AioContexts round-robin.
+ */
+static int vu_blk_setup_queue_ctx(VuBlkExport *vexp, strList *iothreads,
+                                  uint16_t num_queues, Error **errp)
+{
+    g_autofree AioContext **ctxs = NULL;
+    strList *e;
+    int nb_ctxs = 0;
+    int i;
+
+    for (e = iothreads; e; e = e->next) {
+        nb_ctxs++;
+    }
+    if (!nb_ctxs) {
+        error_setg(errp, "iothreads must not be empty");
+        return -EINVAL;
+    }
+
+    ctxs = g_new(AioContext *, nb_ctxs);
+    for (e = iothreads, i = 0; e; e = e->next, i++) {
+        IOThread *iothread = iothread_by_id(e->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", e->value);
+            return -EINVAL;
+        }
+        ctxs[i] = iothread_get_aio_context(iothread);
+    }
+
+    /* Every IOThread gets at least one virtqueue */
+    if (nb_ctxs > num_queues) {
+        nb_ctxs = num_queues;
+    }
+
+    vhost_user_server_set_queue_aio_contexts(&vexp->vu_server, ctxs, nb_ctxs);
+
+    vexp->queue_ctx = g_new(AioContext *, nb_ctxs);
+    for (i = 0; i < nb_ctxs; i++) {
+        int j;
+
+        for (j = 0; j < vexp->nb_queue_ctx; j++) {
+            if (vexp->queue_ctx[j] == ctxs[i]) {
+                break;
+            }
+        }
+        if (j == vexp->nb_queue_ctx) {
+            vexp->queue_ctx[vexp->nb_queue_ctx++] = ctxs[i];
+        }
+    }
+
+    blk_set_dev_ops(vexp->export.blk, &vu_blk_dev_ops, vexp);
+    return 0;
+}
+
 static void
 vu_blk_initialize_config(BlockDriverState *bs,
                          struct virtio_blk_config *config,
@@ -413,6 +519,17 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         return -EADDRNOTAVAIL;
     }
 
+    if (vu_opts->has_iothreads) {
+        int ret = vu_blk_setup_queue_ctx(vexp, vu_opts->iothreads, num_queues,
+                                         errp);
+        if (ret < 0) {
+            vhost_user_server_stop(&vexp->vu_server);
+            blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
+                                            blk_aio_detach, vexp);
+            return ret;
+        }
+    }
+
     return 0;
 }
 
@@ -420,6 +537,13 @@ static void vu_blk_exp_delete(BlockExport *exp)
 {
     VuBlkExport *vexp = container_of(exp, VuBlkExport, export);
 
+    if (vexp->nb_queue_ctx) {
+        blk_set_dev_ops(exp->blk, NULL, NULL);
+        while (vexp->quiesce_counter) {
+            vu_blk_drained_end(vexp);
+        }
+    }
+    g_free(vexp->queue_ctx);
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
 }
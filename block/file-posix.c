@@ -69,6 +69,9 @@
 #include <linux/hdreg.h>
 #include <linux/magic.h>
 #include <scsi/sg.h>
+#ifndef SG_MAX_QUEUE
+#define SG_MAX_QUEUE 16
+#endif
 #ifdef __s390__
 #include <asm/dasd.h>
 #endif
@@ -132,6 +135,18 @@
 #define RAW_LOCK_PERM_BASE             100
 #define RAW_LOCK_SHARED_BASE           200
 
+typedef struct RawDiscardReq {
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+    bool done;
+    bool submit;
+    Coroutine *co;
+    QSIMPLEQ_ENTRY(RawDiscardReq) next;
+} RawDiscardReq;
+
+typedef QSIMPLEQ_HEAD(, RawDiscardReq) RawDiscardQueue;
+
 typedef struct BDRVRawState {
     int fd;
     bool use_lock;
@@ -162,6 +177,7 @@ typedef struct BDRVRawState {
     bool use_linux_io_uring:1;
     bool page_cache_inconsistent:1;
     bool has_fallocate;
+    bool has_reflink;
     bool needs_alignment;
     bool drop_cache;
     bool check_cache_dropped;
@@ -171,7 +187,22 @@ typedef struct BDRVRawState {
         uint64_t discard_bytes_ok;
     } stats;
 
+    /*
+     * Discard requests waiting for the one in flight; adjacent and
+     * overlapping ones are merged when it completes.
+     */
+    bool discard_busy;
+    RawDiscardQueue discard_queue;
+
     PRManager *pr_mgr;
+
+#ifdef __linux__
+    /* SG_IO requests submitted with write() on an sg character device */
+    bool sg_async;
+    int sg_inflight;
+    struct RawSgRequest *sg_reqs[SG_MAX_QUEUE];
+    CoQueue sg_queue;
+#endif
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -547,6 +578,8 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     struct stat st;
     OnOffAuto locking;
 
+    QSIMPLEQ_INIT(&s->discard_queue);
+
     opts = qemu_opts_create(&raw_runtime_opts, NULL, 0, &error_abort);
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
         ret = -EINVAL;
@@ -694,6 +727,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->has_discard = true;
     s->has_write_zeroes = true;
+    s->has_reflink = true;
     if ((bs->open_flags & BDRV_O_NOCACHE) != 0 && !dio_byte_aligned(s->fd)) {
         s->needs_alignment = true;
     }
@@ -1119,6 +1153,19 @@ out:
     return ret;
 }
 
+/* Drop @fd from the io_uring fixed file table before it is closed */
+static void raw_unregister_fd(BlockDriverState *bs, int fd)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_linux_io_uring && fd >= 0) {
+        luring_unregister_fd(aio_get_linux_io_uring(bdrv_get_aio_context(bs)),
+                             fd);
+    }
+#endif
+}
+
 static void raw_reopen_commit(BDRVReopenState *state)
 {
     BDRVRawReopenState *rs = state->opaque;
@@ -1128,6 +1175,7 @@ static void raw_reopen_commit(BDRVReopenState *state)
     s->check_cache_dropped = rs->check_cache_dropped;
     s->open_flags = rs->open_flags;
 
+    raw_unregister_fd(state->bs, s->fd);
     qemu_close(s->fd);
     s->fd = rs->fd;
 
@@ -1724,6 +1772,45 @@ static off_t copy_file_range(int in_fd, off_t *in_off, int out_fd,
 }
 #endif
 
+/*
+ * Share the extents of the source with the destination if the file system
+ * supports reflinks.  Returns false if the range has to be copied; ranges
+ * that are not aligned to the file system block size, or that cross file
+ * systems, fail without disabling reflinks for later requests.
+ */
+static bool raw_clone_range(RawPosixAIOData *aiocb)
+{
+#ifdef FICLONERANGE
+    BDRVRawState *s = aiocb->bs->opaque;
+    struct file_clone_range range = {
+        .src_fd         = aiocb->aio_fildes,
+        .src_offset     = aiocb->aio_offset,
+        .src_length     = aiocb->aio_nbytes,
+        .dest_offset    = aiocb->copy_range.aio_offset2,
+    };
+    int ret;
+
+    if (!s->has_reflink) {
+        return false;
+    }
+
+    do {
+        ret = ioctl(aiocb->copy_range.aio_fd2, FICLONERANGE, &range);
+    } while (ret < 0 && errno == EINTR);
+    trace_file_clone_range(aiocb->bs, aiocb->aio_fildes, aiocb->aio_offset,
+                           aiocb->copy_range.aio_fd2,
+                           aiocb->copy_range.aio_offset2, aiocb->aio_nbytes,
+                           ret < 0 ? -errno : 0);
+    if (ret == 0) {
+        return true;
+    }
+    if (errno == EOPNOTSUPP || errno == ENOTTY || errno == ENOSYS) {
+        s->has_reflink = false;
+    }
+#endif
+    return false;
+}
+
 static int handle_aiocb_copy_range(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -1731,6 +1818,10 @@ static int handle_aiocb_copy_range(void *opaque)
     off_t in_off = aiocb->aio_offset;
     off_t out_off = aiocb->copy_range.aio_offset2;
 
+    if (raw_clone_range(aiocb)) {
+        return 0;
+    }
+
     while (bytes) {
         ssize_t ret = copy_file_range(aiocb->aio_fildes, &in_off,
                                       aiocb->copy_range.aio_fd2, &out_off,
@@ -1968,11 +2059,31 @@ out:
 static int coroutine_fn raw_thread_pool_submit(BlockDriverState *bs,
                                                ThreadPoolFunc func, void *arg)
 {
-    /* @bs can be NULL, bdrv_get_aio_context() returns the main context then */
-    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    /* Complete in the submitter's AioContext, which need not be bs's */
+    ThreadPool *pool = aio_get_thread_pool(qemu_get_current_aio_context());
     return thread_pool_submit_co(pool, func, arg);
 }
 
+/*
+ * Requests can be submitted from any AioContext, not only the one @bs is
+ * attached to, so each context gets its own queue.  The ring of the home
+ * context is set up at open time; others are set up on first use.  NULL
+ * means the thread pool has to be used instead.
+ */
+#ifdef CONFIG_LINUX_IO_URING
+static LuringState *raw_get_luring(void)
+{
+    return aio_setup_linux_io_uring(qemu_get_current_aio_context(), NULL);
+}
+#endif
+
+#ifdef CONFIG_LINUX_AIO
+static LinuxAioState *raw_get_laio(void)
+{
+    return aio_setup_linux_aio(qemu_get_current_aio_context(), NULL);
+}
+#endif
+
 static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
                                    uint64_t bytes, QEMUIOVector *qiov, int type)
 {
@@ -1991,16 +2102,15 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
     if (s->needs_alignment && !bdrv_qiov_is_aligned(bs, qiov)) {
         type |= QEMU_AIO_MISALIGNED;
 #ifdef CONFIG_LINUX_IO_URING
-    } else if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+    } else if (s->use_linux_io_uring && raw_get_luring()) {
         assert(qiov->size == bytes);
-        return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
+        return luring_co_submit(bs, raw_get_luring(), s->fd, offset, qiov,
+                                type);
 #endif
 #ifdef CONFIG_LINUX_AIO
-    } else if (s->use_linux_aio) {
-        LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
+    } else if (s->use_linux_aio && raw_get_laio()) {
         assert(qiov->size == bytes);
-        return laio_co_submit(bs, aio, s->fd, offset, qiov, type);
+        return laio_co_submit(bs, raw_get_laio(), s->fd, offset, qiov, type);
 #endif
     }
 
@@ -2040,14 +2150,18 @@ static void raw_aio_plug(BlockDriverState *bs)
     BDRVRawState __attribute__((unused)) *s = bs->opaque;
 #ifdef CONFIG_LINUX_AIO
     if (s->use_linux_aio) {
-        LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
-        laio_io_plug(bs, aio);
+        LinuxAioState *aio = raw_get_laio();
+        if (aio) {
+            laio_io_plug(bs, aio);
+        }
     }
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        luring_io_plug(bs, aio);
+        LuringState *aio = raw_get_luring();
+        if (aio) {
+            luring_io_plug(bs, aio);
+        }
     }
 #endif
 }
@@ -2057,14 +2171,18 @@ static void raw_aio_unplug(BlockDriverState *bs)
     BDRVRawState __attribute__((unused)) *s = bs->opaque;
 #ifdef CONFIG_LINUX_AIO
     if (s->use_linux_aio) {
-        LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
-        laio_io_unplug(bs, aio);
+        LinuxAioState *aio = raw_get_laio();
+        if (aio) {
+            laio_io_unplug(bs, aio);
+        }
     }
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        luring_io_unplug(bs, aio);
+        LuringState *aio = raw_get_luring();
+        if (aio) {
+            luring_io_unplug(bs, aio);
+        }
     }
 #endif
 }
@@ -2087,14 +2205,21 @@ static int raw_co_flush_to_disk(BlockDriverState *bs)
     };
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+    if (s->use_linux_io_uring && raw_get_luring()) {
+        return luring_co_submit(bs, raw_get_luring(), s->fd, 0, NULL,
+                                QEMU_AIO_FLUSH);
     }
 #endif
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
 }
 
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    raw_unregister_fd(bs, s->fd);
+}
+
 static void raw_aio_attach_aio_context(BlockDriverState *bs,
                                        AioContext *new_context)
 {
@@ -2126,6 +2251,7 @@ static void raw_close(BlockDriverState *bs)
     BDRVRawState *s = bs->opaque;
 
     if (s->fd >= 0) {
+        raw_unregister_fd(bs, s->fd);
         qemu_close(s->fd);
         s->fd = -1;
     }
@@ -2885,19 +3011,86 @@ static void raw_account_discard(BDRVRawState *s, uint64_t nbytes, int ret)
     }
 }
 
+/*
+ * Moves the first queued discard request and all those that are adjacent to
+ * or overlap with it to @batch, and returns the range they cover.
+ */
+static void raw_discard_merge(BDRVRawState *s,
+                              RawDiscardQueue *batch,
+                              int64_t *offset, int64_t *bytes)
+{
+    RawDiscardReq *req = QSIMPLEQ_FIRST(&s->discard_queue);
+    int64_t start = req->offset;
+    int64_t end = req->offset + req->bytes;
+    bool merged;
+
+    QSIMPLEQ_REMOVE_HEAD(&s->discard_queue, next);
+    QSIMPLEQ_INSERT_TAIL(batch, req, next);
+
+    do {
+        RawDiscardReq *next_req;
+
+        merged = false;
+        QSIMPLEQ_FOREACH_SAFE(req, &s->discard_queue, next, next_req) {
+            if (req->offset > end || req->offset + req->bytes < start) {
+                continue;
+            }
+            start = MIN(start, req->offset);
+            end = MAX(end, req->offset + req->bytes);
+            QSIMPLEQ_REMOVE(&s->discard_queue, req, RawDiscardReq, next);
+            QSIMPLEQ_INSERT_TAIL(batch, req, next);
+            merged = true;
+        }
+    } while (merged);
+
+    *offset = start;
+    *bytes = end - start;
+}
+
 static coroutine_fn int
 raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
 {
     BDRVRawState *s = bs->opaque;
+    RawDiscardReq req = {
+        .offset = offset,
+        .bytes = bytes,
+        .co = qemu_coroutine_self(),
+    };
+    RawDiscardQueue batch;
     RawPosixAIOData acb;
+    RawDiscardReq *r, *next_r;
+    int64_t merged_bytes;
+    int nb_reqs = 0;
     int ret;
 
+    /*
+     * Only one discard is in flight per file, so that a flood of small
+     * discards neither ties up the thread pool nor starves other I/O.
+     * Requests that arrive meanwhile are queued; when the discard in flight
+     * completes, the owner of the first queued request submits it merged
+     * with all the queued requests it touches.
+     */
+    QSIMPLEQ_INSERT_TAIL(&s->discard_queue, &req, next);
+    if (s->discard_busy) {
+        while (!req.done && !req.submit) {
+            qemu_coroutine_yield();
+        }
+        if (req.done) {
+            return req.ret;
+        }
+    }
+    assert(QSIMPLEQ_FIRST(&s->discard_queue) == &req);
+    s->discard_busy = true;
+
+    QSIMPLEQ_INIT(&batch);
+    raw_discard_merge(s, &batch, &offset, &merged_bytes);
+
     acb = (RawPosixAIOData) {
         .bs             = bs,
         .aio_fildes     = s->fd,
         .aio_type       = QEMU_AIO_DISCARD,
         .aio_offset     = offset,
-        .aio_nbytes     = bytes,
+        .aio_nbytes     = merged_bytes,
     };
 
     if (blkdev) {
@@ -2905,7 +3098,25 @@ raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
     }
 
     ret = raw_thread_pool_submit(bs, handle_aiocb_discard, &acb);
-    raw_account_discard(s, bytes, ret);
+
+    QSIMPLEQ_FOREACH_SAFE(r, &batch, next, next_r) {
+        raw_account_discard(s, r->bytes, ret);
+        r->ret = ret;
+        r->done = true;
+        if (r != &req) {
+            aio_co_wake(r->co);
+        }
+        nb_reqs++;
+    }
+    trace_file_discard_merged(bs, offset, merged_bytes, nb_reqs);
+
+    r = QSIMPLEQ_FIRST(&s->discard_queue);
+    if (r) {
+        r->submit = true;
+        aio_co_wake(r->co);
+    } else {
+        s->discard_busy = false;
+    }
     return ret;
 }
 
@@ -3129,6 +3340,7 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+        raw_unregister_fd(bs, s->fd);
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3230,6 +3442,7 @@ BlockDriver bdrv_file = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate = raw_co_truncate,
@@ -3499,11 +3712,124 @@ hdev_open_Mac_error:
 
     /* Since this does ioctl the device must be already opened */
     bs->sg = hdev_is_sg(bs);
+#if defined(__linux__)
+    s->sg_async = bs->sg;
+    qemu_co_queue_init(&s->sg_queue);
+#endif
 
     return ret;
 }
 
 #if defined(__linux__)
+typedef struct RawSgRequest {
+    Coroutine *co;
+    struct sg_io_hdr hdr;
+    int ret;
+    bool done;
+} RawSgRequest;
+
+/*
+ * Called when the sg device has a completed request that was submitted
+ * with write().  The requests are tagged with their slot as pack_id, and
+ * SG_SET_FORCE_PACK_ID makes read() return exactly that request.
+ */
+static void hdev_sg_read(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVRawState *s = bs->opaque;
+    RawSgRequest *req;
+    int pack_id = -1;
+    ssize_t len;
+
+    if (ioctl(s->fd, SG_GET_PACK_ID, &pack_id) < 0 ||
+        pack_id < 0 || pack_id >= SG_MAX_QUEUE || !s->sg_reqs[pack_id]) {
+        return;
+    }
+
+    req = s->sg_reqs[pack_id];
+    do {
+        len = read(s->fd, &req->hdr, sizeof(req->hdr));
+    } while (len < 0 && errno == EINTR);
+    if (len < 0 && errno == EAGAIN) {
+        return;
+    }
+
+    req->ret = len == sizeof(req->hdr) ? 0 : len < 0 ? -errno : -EIO;
+    req->done = true;
+    trace_file_hdev_sg_complete(bs, pack_id, req->ret);
+    aio_co_wake(req->co);
+}
+
+/*
+ * Run SG_IO without going through the thread pool: the header is written
+ * to the sg device, and the coroutine is woken up from the AioContext
+ * once the completion can be read back.  The sg driver accepts at most
+ * SG_MAX_QUEUE such requests per file descriptor.
+ *
+ * Returns -ENOTSUP, -EDOM or -EAGAIN if the request must be submitted
+ * with ioctl() instead.
+ */
+static int coroutine_fn hdev_co_sg_io(BlockDriverState *bs,
+                                      struct sg_io_hdr *io_hdr)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = bdrv_get_aio_context(bs);
+    RawSgRequest req = {
+        .co = qemu_coroutine_self(),
+        .hdr = *io_hdr,
+    };
+    ssize_t len;
+    int slot;
+
+    for (;;) {
+        for (slot = 0; slot < SG_MAX_QUEUE && s->sg_reqs[slot]; slot++) {
+            /* nothing */
+        }
+        if (slot < SG_MAX_QUEUE) {
+            break;
+        }
+        qemu_co_queue_wait(&s->sg_queue, NULL);
+    }
+
+    if (!s->sg_inflight) {
+        int one = 1;
+
+        /* The fd may have been reopened since the last request */
+        if (ioctl(s->fd, SG_SET_FORCE_PACK_ID, &one) < 0) {
+            return -ENOTSUP;
+        }
+        aio_set_fd_handler(ctx, s->fd, false, hdev_sg_read, NULL, NULL, bs);
+    }
+    s->sg_reqs[slot] = &req;
+    s->sg_inflight++;
+
+    req.hdr.pack_id = slot;
+    trace_file_hdev_sg_submit(bs, slot, io_hdr->cmdp[0]);
+    do {
+        len = write(s->fd, &req.hdr, sizeof(req.hdr));
+    } while (len < 0 && errno == EINTR);
+
+    if (len == sizeof(req.hdr)) {
+        while (!req.done) {
+            qemu_coroutine_yield();
+        }
+    } else {
+        req.ret = len < 0 ? -errno : -EIO;
+    }
+
+    s->sg_reqs[slot] = NULL;
+    if (!--s->sg_inflight) {
+        aio_set_fd_handler(ctx, s->fd, false, NULL, NULL, NULL, NULL);
+    }
+    qemu_co_queue_next(&s->sg_queue);
+
+    if (req.ret == 0) {
+        req.hdr.pack_id = io_hdr->pack_id;
+        *io_hdr = req.hdr;
+    }
+    return req.ret;
+}
+
 static int coroutine_fn
 hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
 {
@@ -3525,6 +3851,15 @@ hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
         }
     }
 
+    if (req == SG_IO && s->sg_async) {
+        ret = hdev_co_sg_io(bs, buf);
+        if (ret == -ENOTSUP) {
+            s->sg_async = false;
+        } else if (ret != -EDOM && ret != -EAGAIN) {
+            return ret;
+        }
+    }
+
     acb = (RawPosixAIOData) {
         .bs         = bs,
         .aio_type   = QEMU_AIO_IOCTL,
@@ -3604,6 +3939,7 @@ static BlockDriver bdrv_host_device = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate       = raw_co_truncate,
@@ -3728,6 +4064,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
@@ -3858,6 +4195,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
@@ -692,10 +692,10 @@ static void tracked_request_end(BdrvTrackedRequest *req)
         qatomic_dec(&req->bs->serialising_in_flight);
     }
 
-    qemu_co_mutex_lock(&req->bs->reqs_lock);
+    qemu_mutex_lock(&req->bs->reqs_lock);
     QLIST_REMOVE(req, list);
     qemu_co_queue_restart_all(&req->wait_queue);
-    qemu_co_mutex_unlock(&req->bs->reqs_lock);
+    qemu_mutex_unlock(&req->bs->reqs_lock);
 }
 
 /**
@@ -722,9 +722,9 @@ static void tracked_request_begin(BdrvTrackedRequest *req,
 
     qemu_co_queue_init(&req->wait_queue);
 
-    qemu_co_mutex_lock(&bs->reqs_lock);
+    qemu_mutex_lock(&bs->reqs_lock);
     QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
-    qemu_co_mutex_unlock(&bs->reqs_lock);
+    qemu_mutex_unlock(&bs->reqs_lock);
 }
 
 static bool tracked_request_overlaps(BdrvTrackedRequest *req,
@@ -789,7 +789,7 @@ bool bdrv_mark_request_serialising(BdrvTrackedRequest *req, uint64_t align)
                                - overlap_offset;
     bool waited;
 
-    qemu_co_mutex_lock(&bs->reqs_lock);
+    qemu_mutex_lock(&bs->reqs_lock);
     if (!req->serialising) {
         qatomic_inc(&req->bs->serialising_in_flight);
         req->serialising = true;
@@ -798,7 +798,7 @@ bool bdrv_mark_request_serialising(BdrvTrackedRequest *req, uint64_t align)
     req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
     req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
     waited = bdrv_wait_serialising_requests_locked(bs, req);
-    qemu_co_mutex_unlock(&bs->reqs_lock);
+    qemu_mutex_unlock(&bs->reqs_lock);
     return waited;
 }
 
@@ -811,6 +811,7 @@ BdrvTrackedRequest *coroutine_fn bdrv_co_get_self_request(BlockDriverState *bs)
     BdrvTrackedRequest *req;
     Coroutine *self = qemu_coroutine_self();
 
+    QEMU_LOCK_GUARD(&bs->reqs_lock);
     QLIST_FOREACH(req, &bs->tracked_requests, list) {
         if (req->co == self) {
             return req;
@@ -878,9 +879,9 @@ static bool coroutine_fn bdrv_wait_serialising_requests(BdrvTrackedRequest *self
         return false;
     }
 
-    qemu_co_mutex_lock(&bs->reqs_lock);
+    qemu_mutex_lock(&bs->reqs_lock);
     waited = bdrv_wait_serialising_requests_locked(bs, self);
-    qemu_co_mutex_unlock(&bs->reqs_lock);
+    qemu_mutex_unlock(&bs->reqs_lock);
 
     return waited;
 }
@@ -1852,6 +1853,7 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, uint64_t bytes,
     BlockDriverState *bs = child->bs;
 
     qatomic_inc(&bs->write_gen);
+    bdrv_block_status_cache_invalidate(bs, offset, bytes);
 
     /*
      * Discard cannot extend the image, but in error handling cases, such as
@@ -2159,6 +2161,102 @@ int bdrv_flush_all(void)
     return result;
 }
 
+/*
+ * Only format drivers are cached: their metadata changes only through
+ * requests that pass this node (or through operations that explicitly
+ * clear the cache), whereas a protocol's view can be changed behind our
+ * back.  Inactive nodes may be written by a migration source.
+ */
+static bool bdrv_block_status_cache_usable(BlockDriverState *bs)
+{
+    return bs->drv->bdrv_co_block_status && !bs->drv->protocol_name &&
+           !(bs->open_flags & BDRV_O_INACTIVE);
+}
+
+static int bdrv_block_status_cache_lookup(BlockDriverState *bs,
+                                          bool want_zero,
+                                          int64_t offset, int64_t bytes,
+                                          int64_t *pnum, int64_t *map,
+                                          BlockDriverState **file)
+{
+    int i;
+    int ret = -ENOENT;
+
+    qemu_mutex_lock(&bs->block_status_cache_lock);
+    for (i = 0; i < BDRV_BLOCK_STATUS_CACHE_SIZE; i++) {
+        BdrvBlockStatusCacheEntry *e = &bs->block_status_cache[i];
+
+        if (!e->bytes || offset < e->offset ||
+            offset >= e->offset + e->bytes ||
+            (want_zero && !e->want_zero)) {
+            continue;
+        }
+
+        ret = e->ret;
+        *pnum = MIN(e->offset + e->bytes - offset, bytes);
+        *map = (ret & BDRV_BLOCK_OFFSET_VALID) ? e->map + offset - e->offset
+                                               : 0;
+        *file = e->file;
+        break;
+    }
+    qemu_mutex_unlock(&bs->block_status_cache_lock);
+
+    return ret;
+}
+
+static void bdrv_block_status_cache_insert(BlockDriverState *bs,
+                                           unsigned int gen, bool want_zero,
+                                           int64_t offset, int64_t bytes,
+                                           int ret, int64_t map,
+                                           BlockDriverState *file)
+{
+    BdrvBlockStatusCacheEntry *e;
+
+    qemu_mutex_lock(&bs->block_status_cache_lock);
+    /* An invalidation while the driver was busy may have made this stale */
+    if (gen == bs->block_status_cache_gen) {
+        e = &bs->block_status_cache[bs->block_status_cache_next];
+        bs->block_status_cache_next = (bs->block_status_cache_next + 1) %
+                                      BDRV_BLOCK_STATUS_CACHE_SIZE;
+        *e = (BdrvBlockStatusCacheEntry) {
+            .offset     = offset,
+            .bytes      = bytes,
+            .map        = map,
+            .file       = file,
+            .ret        = ret & ~BDRV_BLOCK_EOF,
+            .want_zero  = want_zero,
+        };
+    }
+    qemu_mutex_unlock(&bs->block_status_cache_lock);
+}
+
+/*
+ * Drop all cached block status overlapping [offset, offset + bytes).
+ * Must be called whenever the driver's answer for that range may change.
+ */
+void bdrv_block_status_cache_invalidate(BlockDriverState *bs,
+                                        int64_t offset, int64_t bytes)
+{
+    int i;
+
+    qemu_mutex_lock(&bs->block_status_cache_lock);
+    qatomic_inc(&bs->block_status_cache_gen);
+    for (i = 0; i < BDRV_BLOCK_STATUS_CACHE_SIZE; i++) {
+        BdrvBlockStatusCacheEntry *e = &bs->block_status_cache[i];
+
+        if (e->bytes && offset < e->offset + e->bytes &&
+            e->offset < offset + bytes) {
+            e->bytes = 0;
+        }
+    }
+    qemu_mutex_unlock(&bs->block_status_cache_lock);
+}
+
+void bdrv_block_status_cache_clear(BlockDriverState *bs)
+{
+    bdrv_block_status_cache_invalidate(bs, 0, INT64_MAX);
+}
+
 /*
  * Returns the allocation status of the specified sectors.
  * Drivers not implementing the functionality are assumed to not support
@@ -2247,7 +2345,25 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
     aligned_offset = QEMU_ALIGN_DOWN(offset, align);
     aligned_bytes = ROUND_UP(offset + bytes, align) - aligned_offset;
 
-    if (bs->drv->bdrv_co_block_status) {
+    if (bdrv_block_status_cache_usable(bs)) {
+        ret = bdrv_block_status_cache_lookup(bs, want_zero, aligned_offset,
+                                             aligned_bytes, pnum, &local_map,
+                                             &local_file);
+        if (ret == -ENOENT) {
+            unsigned int gen = qatomic_read(&bs->block_status_cache_gen);
+
+            ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
+                                                aligned_bytes, pnum,
+                                                &local_map, &local_file);
+            if (ret >= 0 && *pnum) {
+                bdrv_block_status_cache_insert(bs, gen, want_zero,
+                                               aligned_offset, *pnum, ret,
+                                               local_map, local_file);
+            }
+        } else {
+            trace_bdrv_block_status_cache_hit(bs, aligned_offset, *pnum, ret);
+        }
+    } else if (bs->drv->bdrv_co_block_status) {
         ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
                                             aligned_bytes, pnum, &local_map,
                                             &local_file);
@@ -2664,7 +2780,7 @@ int coroutine_fn bdrv_co_flush(BlockDriverState *bs)
         goto early_exit;
     }
 
-    qemu_co_mutex_lock(&bs->reqs_lock);
+    qemu_mutex_lock(&bs->reqs_lock);
     current_gen = qatomic_read(&bs->write_gen);
 
     /* Wait until any previous flushes are completed */
@@ -2674,7 +2790,7 @@ int coroutine_fn bdrv_co_flush(BlockDriverState *bs)
 
     /* Flushes reach this point in nondecreasing current_gen order.  */
     bs->active_flush_req = true;
-    qemu_co_mutex_unlock(&bs->reqs_lock);
+    qemu_mutex_unlock(&bs->reqs_lock);
 
     /* Write back all layers by calling one driver function */
     if (bs->drv->bdrv_co_flush) {
@@ -2762,11 +2878,11 @@ out:
         bs->flushed_gen = current_gen;
     }
 
-    qemu_co_mutex_lock(&bs->reqs_lock);
+    qemu_mutex_lock(&bs->reqs_lock);
     bs->active_flush_req = false;
     /* Return value is ignored - it's ok if wait queue is empty */
     qemu_co_queue_next(&bs->flush_queue);
-    qemu_co_mutex_unlock(&bs->reqs_lock);
+    qemu_mutex_unlock(&bs->reqs_lock);
 
 early_exit:
     bdrv_dec_in_flight(bs);
@@ -3267,6 +3383,8 @@ int coroutine_fn bdrv_co_truncate(BdrvChild *child, int64_t offset, bool exact,
         ret = -ENOTSUP;
         goto out;
     }
+    /* Preallocation and shrinking both rewrite metadata outside the range */
+    bdrv_block_status_cache_clear(bs);
     if (ret < 0) {
         goto out;
     }
@@ -16,14 +16,27 @@
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
+#include "exec/memory.h"
+#include "exec/ramlist.h"
 #include "trace.h"
 
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Size of the registered file table */
+#define MAX_FIXED_FILES 64
+
+/* The kernel refuses to register buffers larger than this */
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+
 typedef struct LuringAIOCB {
     Coroutine *co;
+    struct LuringState *s;
     struct io_uring_sqe sqeq;
     ssize_t ret;
     QEMUIOVector *qiov;
@@ -36,6 +49,9 @@ typedef struct LuringAIOCB {
      */
     int total_read;
     QEMUIOVector resubmit_qiov;
+
+    /* Used instead of sqeq when the AioContext's ring is shared */
+    CqeHandler cqe_handler;
 } LuringAIOCB;
 
 typedef struct LuringQueue {
@@ -49,6 +65,13 @@ typedef struct LuringQueue {
 typedef struct LuringState {
     AioContext *aio_context;
 
+    /*
+     * Requests go through the io_uring that the AioContext uses for file
+     * descriptor monitoring, and @ring is not used.  Submission and
+     * completion then share the io_uring_enter(2) of the event loop.
+     */
+    bool shared;
+
     struct io_uring ring;
 
     /* io queue for submit at batch.  Protected by AioContext lock. */
@@ -56,6 +79,27 @@ typedef struct LuringState {
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /*
+     * Registered file table, -1 marks a free slot.  Protected by AioContext
+     * lock.
+     */
+    bool fixed_files;
+    int files[MAX_FIXED_FILES];
+
+    /*
+     * Registered buffers covering guest RAM.  The RAMBlock notifiers run in
+     * the main loop and only edit @pending_bufs; the ring itself is
+     * re-registered from the I/O thread once no request is in flight.
+     * Until then @bufs_dirty keeps requests away from the old table.
+     */
+    bool fixed_bufs;
+    RAMBlockNotifier ram_notifier;
+    QemuMutex bufs_lock;
+    GArray *pending_bufs;       /* struct iovec sorted by iov_base */
+    bool bufs_dirty;
+    struct iovec *bufs;
+    unsigned int nr_bufs;
 } LuringState;
 
 /**
@@ -63,9 +107,17 @@ typedef struct LuringState {
  *
  * Resubmit a request by appending it to submit_queue.  The caller must ensure
  * that ioq_submit() is called later so that submit_queue requests are started.
+ * A shared ring takes the request right away instead.
  */
 static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
 {
+    if (s->shared) {
+        luringcb->cqe_handler.sqe = luringcb->sqeq;
+        aio_add_sqe(s->aio_context, &luringcb->cqe_handler);
+        s->io_q.in_flight++;
+        return;
+    }
+
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
 }
@@ -104,12 +156,78 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update sqe */
     luringcb->sqeq.off = nread;
-    luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
-    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* Still a single range inside the same registered buffer */
+        luringcb->sqeq.addr =
+            (__u64)(uintptr_t)luringcb->resubmit_qiov.iov[0].iov_base;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.iov[0].iov_len;
+    } else {
+        luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    }
 
     luring_resubmit(s, luringcb);
 }
 
+/**
+ * luring_complete:
+ * @s: AIO state
+ * @luringcb: AIO control block
+ * @ret: result from the cqe
+ *
+ * Completes a request, or resubmits what is left of it.  The caller must
+ * have decremented s->io_q.in_flight.
+ */
+static void luring_complete(LuringState *s, LuringAIOCB *luringcb, int ret)
+{
+    int total_bytes;
+
+    trace_luring_process_completion(s, luringcb, ret);
+
+    /* total_read is non-zero only for resubmitted read requests */
+    total_bytes = ret + luringcb->total_read;
+
+    if (ret < 0) {
+        if (ret == -EINTR) {
+            luring_resubmit(s, luringcb);
+            return;
+        }
+    } else if (!luringcb->qiov) {
+        goto end;
+    } else if (total_bytes == luringcb->qiov->size) {
+        ret = 0;
+    /* Only read/write */
+    } else {
+        /* Short Read/Write */
+        if (luringcb->is_read) {
+            if (ret > 0) {
+                luring_resubmit_short_read(s, luringcb, ret);
+                return;
+            } else {
+                /* Pad with zeroes */
+                qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
+                                  luringcb->qiov->size - total_bytes);
+                ret = 0;
+            }
+        } else {
+            ret = -ENOSPC;
+        }
+    }
+end:
+    luringcb->ret = ret;
+    qemu_iovec_destroy(&luringcb->resubmit_qiov);
+
+    /*
+     * If the coroutine is already entered it must be in ioq_submit()
+     * and will notice luringcb->ret has been filled in when it
+     * eventually runs later. Coroutines cannot be entered recursively
+     * so avoid doing that!
+     */
+    if (!qemu_coroutine_entered(luringcb->co)) {
+        aio_co_wake(luringcb->co);
+    }
+}
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -126,7 +244,6 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 static void luring_process_completions(LuringState *s)
 {
     struct io_uring_cqe *cqes;
-    int total_bytes;
     /*
      * Request completion callbacks can run the nested event loop.
      * Schedule ourselves so the nested event loop will "see" remaining
@@ -159,50 +276,7 @@ static void luring_process_completions(LuringState *s)
 
         /* Change counters one-by-one because we can be nested. */
         s->io_q.in_flight--;
-        trace_luring_process_completion(s, luringcb, ret);
-
-        /* total_read is non-zero only for resubmitted read requests */
-        total_bytes = ret + luringcb->total_read;
-
-        if (ret < 0) {
-            if (ret == -EINTR) {
-                luring_resubmit(s, luringcb);
-                continue;
-            }
-        } else if (!luringcb->qiov) {
-            goto end;
-        } else if (total_bytes == luringcb->qiov->size) {
-            ret = 0;
-        /* Only read/write */
-        } else {
-            /* Short Read/Write */
-            if (luringcb->is_read) {
-                if (ret > 0) {
-                    luring_resubmit_short_read(s, luringcb, ret);
-                    continue;
-                } else {
-                    /* Pad with zeroes */
-                    qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
-                                      luringcb->qiov->size - total_bytes);
-                    ret = 0;
-                }
-            } else {
-                ret = -ENOSPC;
-            }
-        }
-end:
-        luringcb->ret = ret;
-        qemu_iovec_destroy(&luringcb->resubmit_qiov);
-
-        /*
-         * If the coroutine is already entered it must be in ioq_submit()
-         * and will notice luringcb->ret has been filled in when it
-         * eventually runs later. Coroutines cannot be entered recursively
-         * so avoid doing that!
-         */
-        if (!qemu_coroutine_entered(luringcb->co)) {
-            aio_co_wake(luringcb->co);
-        }
+        luring_complete(s, luringcb, ret);
     }
     qemu_bh_cancel(s->completion_bh);
 }
@@ -286,6 +360,19 @@ static bool qemu_luring_poll_cb(void *opaque)
     return false;
 }
 
+/* Completion of a request on the shared ring, called from aio_poll() */
+static void qemu_luring_cqe_handler(CqeHandler *cqe_handler)
+{
+    LuringAIOCB *luringcb = container_of(cqe_handler, LuringAIOCB,
+                                         cqe_handler);
+    LuringState *s = luringcb->s;
+
+    aio_context_acquire(s->aio_context);
+    s->io_q.in_flight--;
+    luring_complete(s, luringcb, cqe_handler->res);
+    aio_context_release(s->aio_context);
+}
+
 static void ioq_init(LuringQueue *io_q)
 {
     QSIMPLEQ_INIT(&io_q->submit_queue);
@@ -312,8 +399,115 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+/**
+ * luring_fixed_file:
+ *
+ * Returns the registered file table index of @fd, registering it on first
+ * use, or -1 if the table cannot be used.  File-posix drops the entry with
+ * luring_unregister_fd() before it closes @fd or leaves this AioContext.
+ */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int i, free_slot = -1;
+
+    if (!s->fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->files[i] == fd) {
+            return i;
+        }
+        if (free_slot < 0 && s->files[i] == -1) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0 ||
+        io_uring_register_files_update(&s->ring, free_slot, &fd, 1) != 1) {
+        return -1;
+    }
+
+    s->files[free_slot] = fd;
+    trace_luring_register_file(s, fd, free_slot);
+    return free_slot;
+}
+
+void luring_unregister_fd(LuringState *s, int fd)
+{
+    int unused = -1;
+    int i;
+
+    for (i = 0; s->fixed_files && i < MAX_FIXED_FILES; i++) {
+        if (s->files[i] == fd) {
+            io_uring_register_files_update(&s->ring, i, &unused, 1);
+            s->files[i] = -1;
+            trace_luring_unregister_file(s, fd, i);
+            return;
+        }
+    }
+}
+
+/* Re-register the guest RAM buffers.  Must only be called when idle. */
+static void luring_update_fixed_bufs(LuringState *s)
+{
+    int ret = 0;
+
+    QEMU_LOCK_GUARD(&s->bufs_lock);
+    qatomic_set(&s->bufs_dirty, false);
+
+    if (s->nr_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+    }
+    g_free(s->bufs);
+    s->nr_bufs = s->pending_bufs->len;
+    s->bufs = g_memdup(s->pending_bufs->data,
+                       s->nr_bufs * sizeof(struct iovec));
+
+    if (s->nr_bufs) {
+        ret = io_uring_register_buffers(&s->ring, s->bufs, s->nr_bufs);
+        if (ret < 0) {
+            /* Typically RLIMIT_MEMLOCK; retried when the RAM layout changes */
+            warn_report_once("io_uring: failed to register guest RAM: %s",
+                             strerror(-ret));
+            s->nr_bufs = 0;
+        }
+    }
+    trace_luring_register_buffers(s, s->nr_bufs, ret);
+}
+
+/* Returns the registered buffer that covers @qiov, or -1 */
+static int luring_fixed_buf_index(LuringState *s, QEMUIOVector *qiov)
+{
+    uintptr_t base;
+    size_t len;
+    int lo = 0, hi = s->nr_bufs;
+
+    if (qiov->niov != 1 || !s->nr_bufs || qatomic_read(&s->bufs_dirty)) {
+        return -1;
+    }
+
+    base = (uintptr_t)qiov->iov[0].iov_base;
+    len = qiov->iov[0].iov_len;
+
+    /* Find the last buffer starting at or below @base */
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if ((uintptr_t)s->bufs[mid].iov_base <= base) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if ((uintptr_t)s->bufs[lo].iov_base <= base &&
+        base + len <= (uintptr_t)s->bufs[lo].iov_base + s->bufs[lo].iov_len) {
+        return lo;
+    }
+    return -1;
+}
+
 /**
  * luring_do_submit:
+ * @bs: block device state
  * @fd: file descriptor for I/O
  * @luringcb: AIO control block
  * @s: AIO state
@@ -323,20 +517,54 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
+static int luring_do_submit(BlockDriverState *bs, int fd,
+                            LuringAIOCB *luringcb, LuringState *s,
                             uint64_t offset, int type)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int file_index = -1;
+    int buf_index = -1;
+
+    /*
+     * @bs may submit from other AioContexts too, but it only unregisters
+     * its fd from the ring of its own one.
+     */
+    if (bdrv_get_aio_context(bs) == s->aio_context) {
+        file_index = luring_fixed_file(s, fd);
+    }
+
+    if (file_index >= 0) {
+        fd = file_index;
+    }
+    if (s->fixed_bufs && type != QEMU_AIO_FLUSH) {
+        if (qatomic_read(&s->bufs_dirty) &&
+            !s->io_q.in_flight && !s->io_q.in_queue) {
+            luring_update_fixed_bufs(s);
+        }
+        buf_index = luring_fixed_buf_index(s, luringcb->qiov);
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -346,6 +574,19 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (file_index >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
+
+    if (s->shared) {
+        /* Submitted by the event loop, together with its wait for events */
+        luringcb->cqe_handler.cb = qemu_luring_cqe_handler;
+        luring_resubmit(s, luringcb);
+        trace_luring_do_submit(s, s->io_q.blocked, s->io_q.plugged,
+                               s->io_q.in_queue, s->io_q.in_flight);
+        return 0;
+    }
+
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -368,13 +609,14 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
     int ret;
     LuringAIOCB luringcb = {
         .co         = qemu_coroutine_self(),
+        .s          = s,
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    ret = luring_do_submit(bs, fd, &luringcb, s, offset, type);
 
     if (ret < 0) {
         return ret;
@@ -388,6 +630,11 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
 
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
+    if (s->shared) {
+        assert(!s->io_q.in_flight);
+        s->aio_context = NULL;
+        return;
+    }
     aio_set_fd_handler(old_context, s->ring.ring_fd, false, NULL, NULL, NULL,
                        s);
     qemu_bh_delete(s->completion_bh);
@@ -397,34 +644,167 @@ void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 void luring_attach_aio_context(LuringState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
+    if (s->shared) {
+        assert(aio_has_io_uring(new_context));
+        return;
+    }
     s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
     aio_set_fd_handler(s->aio_context, s->ring.ring_fd, false,
                        qemu_luring_completion_cb, NULL, qemu_luring_poll_cb, s);
 }
 
-LuringState *luring_init(Error **errp)
+/* Called with the BQL held, like the rest of the RAMBlock code */
+static void luring_ram_block_added(RAMBlockNotifier *n, void *host,
+                                   size_t size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+    GArray *bufs = s->pending_bufs;
+    unsigned int i;
+
+    if (!host) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&s->bufs_lock);
+    for (i = 0; i < bufs->len; i++) {
+        if (g_array_index(bufs, struct iovec, i).iov_base > host) {
+            break;
+        }
+    }
+    while (size) {
+        struct iovec iov = {
+            .iov_base = host,
+            .iov_len = MIN(size, MAX_FIXED_BUF_SIZE),
+        };
+
+        g_array_insert_val(bufs, i++, iov);
+        host += iov.iov_len;
+        size -= iov.iov_len;
+    }
+    qatomic_set(&s->bufs_dirty, true);
+}
+
+static void luring_ram_block_removed(RAMBlockNotifier *n, void *host,
+                                     size_t size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+    GArray *bufs = s->pending_bufs;
+    unsigned int i;
+
+    if (!host) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&s->bufs_lock);
+    for (i = 0; i < bufs->len; ) {
+        void *base = g_array_index(bufs, struct iovec, i).iov_base;
+
+        if (base >= host && base < host + size) {
+            g_array_remove_index(bufs, i);
+        } else {
+            i++;
+        }
+    }
+    qatomic_set(&s->bufs_dirty, true);
+}
+
+static int luring_init_ramblock(RAMBlock *rb, void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_ram_block_added(&s->ram_notifier, qemu_ram_get_host_addr(rb),
+                           qemu_ram_get_used_length(rb));
+    return 0;
+}
+
+static void luring_init_fixed(LuringState *s)
+{
+    int i;
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        s->files[i] = -1;
+    }
+    if (io_uring_register_files(&s->ring, s->files, MAX_FIXED_FILES) == 0) {
+        s->fixed_files = true;
+    } else {
+        warn_report("io_uring: failed to register file table, "
+                    "not using fixed files");
+    }
+
+    /*
+     * RAMBlock notifiers need the BQL, which is not held when a ring is
+     * set up on first use by a request from an IOThread.
+     */
+    if (!qemu_mutex_iothread_locked()) {
+        return;
+    }
+
+    /* Registered buffers stay pinned, like VFIO DMA mappings */
+    if (ram_block_discard_disable(true)) {
+        warn_report("io_uring: RAM discard is in use, "
+                    "not registering guest RAM");
+        return;
+    }
+    qemu_mutex_init(&s->bufs_lock);
+    s->pending_bufs = g_array_new(false, false, sizeof(struct iovec));
+    s->ram_notifier.ram_block_added = luring_ram_block_added;
+    s->ram_notifier.ram_block_removed = luring_ram_block_removed;
+    ram_block_notifier_add(&s->ram_notifier);
+    qemu_ram_foreach_block(luring_init_ramblock, s);
+    s->fixed_bufs = true;
+}
+
+LuringState *luring_init(bool shared, bool register_fixed, bool sqpoll,
+                         uint32_t sqpoll_idle, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    /* Registered files and buffers, and SQPOLL, need a ring of our own */
+    if (shared) {
+        assert(!register_fixed && !sqpoll);
+        s->shared = true;
+        ioq_init(&s->io_q);
+        return s;
+    }
+
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = sqpoll_idle;
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring%s",
+                         sqpoll ? " with SQPOLL" : "");
         g_free(s);
         return NULL;
     }
 
     ioq_init(&s->io_q);
+    if (register_fixed) {
+        luring_init_fixed(s);
+    }
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
-    io_uring_queue_exit(&s->ring);
+    if (s->fixed_bufs) {
+        ram_block_notifier_remove(&s->ram_notifier);
+        ram_block_discard_disable(false);
+        g_array_free(s->pending_bufs, true);
+        g_free(s->bufs);
+        qemu_mutex_destroy(&s->bufs_lock);
+    }
+    if (!s->shared) {
+        io_uring_queue_exit(&s->ring);
+    }
     trace_luring_cleanup_state(s);
     g_free(s);
 }
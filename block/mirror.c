@@ -28,6 +28,18 @@
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/* Limits for automatic tuning while the job does not converge */
+#define MIRROR_MAX_AUTO_IN_FLIGHT 64
+#define MIRROR_MAX_AUTO_BUF_SIZE (4 * DEFAULT_MIRROR_BUF_SIZE)
+
+/* Dirty rate and copy throughput are measured over windows of this length */
+#define MIRROR_RATE_WINDOW_NS NANOSECONDS_PER_SECOND
+
+/* Granularity of write heat tracking in adaptive copy mode */
+#define MIRROR_HEAT_REGION_BITS 20 /* 1 Mb */
+/* Writes per region and window (with decay) that make a region hot */
+#define MIRROR_HOT_REGION_WRITES 8
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -63,6 +75,9 @@ typedef struct MirrorBlockJob {
     bool should_complete;
     int64_t granularity;
     size_t buf_size;
+    /* Buffers added by mirror_grow(), freed together with buf */
+    GSList *extra_bufs;
+    int max_in_flight;
     int64_t bdev_length;
     unsigned long *cow_bitmap;
     BdrvDirtyBitmap *dirty_bitmap;
@@ -78,12 +93,28 @@ typedef struct MirrorBlockJob {
     QTAILQ_HEAD(, MirrorOp) ops_in_flight;
     int ret;
     bool unmap;
+    /* Cleared after the first failed copy offload request */
+    bool use_copy_range;
     int target_cluster_size;
     int max_iov;
     bool initial_zeroing_ongoing;
     int in_active_write_counter;
     bool prepared;
     bool in_drain;
+
+    /* Convergence tracking, see mirror_update_rates() */
+    int64_t rate_window_start_ns;
+    uint64_t rate_window_progress;
+    int64_t rate_window_remaining;
+    uint64_t dirty_rate;
+    uint64_t copy_rate;
+    bool converging;
+    /* Set if copying waited for a free slot or buffer in this window */
+    bool limited;
+
+    /* Per-region write counters for MIRROR_COPY_MODE_ADAPTIVE */
+    uint8_t *region_heat;
+    int64_t nb_regions;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -320,6 +351,16 @@ mirror_wait_for_free_in_flight_slot(MirrorBlockJob *s)
  * or (new_end - op->offset) if the tail is rounded up or down due to
  * alignment or buffer limit.
  */
+/* copy_range does not respect max_transfer, see block-copy */
+static uint64_t mirror_copy_range_max(MirrorBlockJob *s)
+{
+    BlockDriverState *source = s->mirror_top_bs->backing->bs;
+
+    return MIN_NON_ZERO(BDRV_REQUEST_MAX_BYTES,
+                        MIN_NON_ZERO(blk_get_max_transfer(s->target),
+                                     source->bl.max_transfer));
+}
+
 static void coroutine_fn mirror_co_read(void *opaque)
 {
     MirrorOp *op = opaque;
@@ -351,6 +392,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
     nb_chunks = DIV_ROUND_UP(op->bytes, s->granularity);
 
     while (s->buf_free_count < nb_chunks) {
+        s->limited = true;
         trace_mirror_yield_in_flight(s, op->offset, s->in_flight);
         mirror_wait_for_free_in_flight_slot(s);
     }
@@ -374,6 +416,20 @@ static void coroutine_fn mirror_co_read(void *opaque)
     op->is_in_flight = true;
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
+    if (s->use_copy_range && op->bytes <= mirror_copy_range_max(s)) {
+        int copy_ret;
+
+        copy_ret = bdrv_co_copy_range(s->mirror_top_bs->backing, op->offset,
+                                      blk_root(s->target), op->offset,
+                                      op->bytes, 0, 0);
+        if (copy_ret == 0) {
+            mirror_write_complete(op, 0);
+            return;
+        }
+        trace_mirror_copy_range_fail(s, op->offset, copy_ret);
+        s->use_copy_range = false;
+    }
+
     ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
                          &op->qiov, 0);
     mirror_read_complete(op, ret);
@@ -463,7 +519,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = MAX(s->buf_size / s->max_in_flight, MAX_IO_BYTES);
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -560,7 +616,8 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
+            s->limited = true;
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -592,14 +649,11 @@ fail:
     return ret;
 }
 
-static void mirror_free_init(MirrorBlockJob *s)
+static void mirror_add_buffer(MirrorBlockJob *s, uint8_t *buf,
+                              size_t buf_size)
 {
     int granularity = s->granularity;
-    size_t buf_size = s->buf_size;
-    uint8_t *buf = s->buf;
 
-    assert(s->buf_free_count == 0);
-    QSIMPLEQ_INIT(&s->buf_free);
     while (buf_size != 0) {
         MirrorBuffer *cur = (MirrorBuffer *)buf;
         QSIMPLEQ_INSERT_TAIL(&s->buf_free, cur, next);
@@ -609,6 +663,126 @@ static void mirror_free_init(MirrorBlockJob *s)
     }
 }
 
+static void mirror_free_init(MirrorBlockJob *s)
+{
+    assert(s->buf_free_count == 0);
+    QSIMPLEQ_INIT(&s->buf_free);
+    mirror_add_buffer(s, s->buf, s->buf_size);
+}
+
+/*
+ * Called when the job did not converge although it used all of its
+ * in-flight slots or buffer space: allow twice as many parallel requests
+ * and double the buffer, within the limits for automatic tuning.
+ */
+static void mirror_grow(MirrorBlockJob *s)
+{
+    BlockDriverState *bs = s->mirror_top_bs->backing->bs;
+    bool grown = false;
+
+    if (s->max_in_flight < MIRROR_MAX_AUTO_IN_FLIGHT) {
+        s->max_in_flight = MIN(s->max_in_flight * 2,
+                               MIRROR_MAX_AUTO_IN_FLIGHT);
+        grown = true;
+    }
+
+    if (s->buf_size < MIRROR_MAX_AUTO_BUF_SIZE) {
+        uint8_t *buf = qemu_try_blockalign(bs, s->buf_size);
+
+        if (buf) {
+            s->extra_bufs = g_slist_prepend(s->extra_bufs, buf);
+            mirror_add_buffer(s, buf, s->buf_size);
+            s->buf_size *= 2;
+            grown = true;
+        }
+    }
+
+    if (grown) {
+        trace_mirror_grow(s, s->max_in_flight, s->buf_size);
+    }
+}
+
+static void mirror_start_rate_window(MirrorBlockJob *s, int64_t now,
+                                     int64_t remaining)
+{
+    s->rate_window_start_ns = now;
+    s->rate_window_progress = s->common.job.progress.current;
+    s->rate_window_remaining = remaining;
+    s->limited = false;
+}
+
+/*
+ * Update the dirty rate and copy throughput once per measurement window.
+ * @remaining is the number of dirty bytes plus the bytes in flight.
+ *
+ * Copied bytes are taken from the job progress.  Whatever the guest
+ * dirtied in the window is the growth of @remaining plus what was copied.
+ * Both rates are smoothed over the last few windows.
+ */
+static void mirror_update_rates(MirrorBlockJob *s, int64_t remaining)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - s->rate_window_start_ns;
+    int64_t elapsed_ms = elapsed / SCALE_MS;
+    uint64_t copied, copy_rate, dirty_rate;
+    int64_t dirtied;
+    int64_t i;
+
+    if (elapsed < MIRROR_RATE_WINDOW_NS) {
+        return;
+    }
+
+    copied = s->common.job.progress.current - s->rate_window_progress;
+    dirtied = remaining - s->rate_window_remaining + copied;
+    copy_rate = copied * 1000 / elapsed_ms;
+    dirty_rate = MAX(dirtied, 0) * 1000 / elapsed_ms;
+
+    if (s->copy_rate || s->dirty_rate) {
+        s->copy_rate = (s->copy_rate * 3 + copy_rate) / 4;
+        s->dirty_rate = (s->dirty_rate * 3 + dirty_rate) / 4;
+    } else {
+        s->copy_rate = copy_rate;
+        s->dirty_rate = dirty_rate;
+    }
+    s->converging = remaining == 0 ||
+                    s->copy_rate > s->dirty_rate + s->dirty_rate / 10;
+    trace_mirror_rates(s, s->dirty_rate, s->copy_rate, s->converging);
+
+    /* A rate limit set by the user takes precedence over tuning */
+    if (!s->converging && s->limited && !s->common.speed) {
+        mirror_grow(s);
+    }
+
+    /* Let the heat of regions that are no longer written decay */
+    for (i = 0; i < s->nb_regions; i++) {
+        s->region_heat[i] >>= 1;
+    }
+
+    mirror_start_rate_window(s, now, remaining);
+}
+
+static void mirror_query(BlockJob *job, BlockJobInfo *info)
+{
+    MirrorBlockJob *s = container_of(job, MirrorBlockJob, common);
+    BlockMirrorStats *stats = g_new0(BlockMirrorStats, 1);
+
+    stats->dirty_rate = s->dirty_rate;
+    stats->throughput = s->copy_rate;
+    stats->max_in_flight = s->max_in_flight;
+    stats->buf_size = s->buf_size;
+    stats->converging = s->converging;
+    if (s->converging && s->copy_rate > s->dirty_rate) {
+        uint64_t remaining = s->common.job.progress.total -
+                             s->common.job.progress.current;
+
+        stats->has_eta_ms = true;
+        stats->eta_ms = remaining * 1000 / (s->copy_rate - s->dirty_rate);
+    }
+
+    info->has_mirror_stats = true;
+    info->mirror_stats = stats;
+}
+
 /* This is also used for the .pause callback. There is no matching
  * mirror_resume() because mirror_run() will begin iterating again
  * when the job is resumed.
@@ -812,7 +986,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -964,6 +1138,15 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
 
     assert(!s->dbi);
     s->dbi = bdrv_dirty_iter_new(s->dirty_bitmap);
+
+    if (s->copy_mode == MIRROR_COPY_MODE_ADAPTIVE) {
+        s->nb_regions = DIV_ROUND_UP(s->bdev_length,
+                                     1ULL << MIRROR_HEAT_REGION_BITS);
+        s->region_heat = g_new0(uint8_t, s->nb_regions);
+    }
+    mirror_start_rate_window(s, qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
+                             s->bytes_in_flight +
+                             bdrv_get_dirty_count(s->dirty_bitmap));
     for (;;) {
         uint64_t delay_ns = 0;
         int64_t cnt, delta;
@@ -987,6 +1170,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
          * the number of bytes currently being processed; together those are
          * the current remaining operation length */
         job_progress_set_remaining(&s->common.job, s->bytes_in_flight + cnt);
+        mirror_update_rates(s, s->bytes_in_flight + cnt);
 
         /* Note that even when no rate limit is applied we need to yield
          * periodically with no pending I/O so that bdrv_drain_all() returns.
@@ -995,8 +1179,11 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         delta = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - s->last_pause_ns;
         if (delta < BLOCK_JOB_SLICE_TIME &&
             s->common.iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
+                if (cnt != 0) {
+                    s->limited = true;
+                }
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
                 continue;
@@ -1020,7 +1207,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
                  */
                 job_transition_to_ready(&s->common.job);
                 s->synced = true;
-                if (s->copy_mode != MIRROR_COPY_MODE_BACKGROUND) {
+                if (s->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING) {
                     s->actively_synced = true;
                 }
             }
@@ -1091,6 +1278,11 @@ immediate_exit:
 
     assert(s->in_flight == 0);
     qemu_vfree(s->buf);
+    g_slist_free_full(s->extra_bufs, (GDestroyNotify)qemu_vfree);
+    s->extra_bufs = NULL;
+    g_free(s->region_heat);
+    s->region_heat = NULL;
+    s->nb_regions = 0;
     g_free(s->cow_bitmap);
     g_free(s->in_flight_bitmap);
     bdrv_dirty_iter_free(s->dbi);
@@ -1192,6 +1384,7 @@ static const BlockJobDriver mirror_job_driver = {
         .complete               = mirror_complete,
     },
     .drained_poll           = mirror_drained_poll,
+    .query                  = mirror_query,
 };
 
 static const BlockJobDriver commit_active_job_driver = {
@@ -1207,6 +1400,7 @@ static const BlockJobDriver commit_active_job_driver = {
         .complete               = mirror_complete,
     },
     .drained_poll           = mirror_drained_poll,
+    .query                  = mirror_query,
 };
 
 static void coroutine_fn
@@ -1377,17 +1571,55 @@ static int coroutine_fn bdrv_mirror_top_preadv(BlockDriverState *bs,
     return bdrv_co_preadv(bs->backing, offset, bytes, qiov, flags);
 }
 
+/*
+ * Decide whether a guest write must be copied to the target synchronously.
+ * In adaptive mode this is the case for writes to hot regions, as long as
+ * the background copy does not converge on its own.
+ */
+static bool mirror_copy_to_target(MirrorBlockJob *s, uint64_t offset,
+                                  uint64_t bytes)
+{
+    int64_t first, last, i;
+    bool hot = false;
+
+    if (s->ret < 0) {
+        return false;
+    }
+
+    switch (s->copy_mode) {
+    case MIRROR_COPY_MODE_BACKGROUND:
+        return false;
+
+    case MIRROR_COPY_MODE_WRITE_BLOCKING:
+        return true;
+
+    case MIRROR_COPY_MODE_ADAPTIVE:
+        if (!s->region_heat || !bytes) {
+            return false;
+        }
+        first = offset >> MIRROR_HEAT_REGION_BITS;
+        last = MIN((offset + bytes - 1) >> MIRROR_HEAT_REGION_BITS,
+                   s->nb_regions - 1);
+        for (i = first; i <= last; i++) {
+            if (s->region_heat[i] < UINT8_MAX) {
+                s->region_heat[i]++;
+            }
+            hot |= s->region_heat[i] >= MIRROR_HOT_REGION_WRITES;
+        }
+        return hot && !s->converging;
+
+    default:
+        abort();
+    }
+}
+
 static int coroutine_fn bdrv_mirror_top_do_write(BlockDriverState *bs,
     MirrorMethod method, uint64_t offset, uint64_t bytes, QEMUIOVector *qiov,
-    int flags)
+    int flags, bool copy_to_target)
 {
     MirrorOp *op = NULL;
     MirrorBDSOpaque *s = bs->opaque;
     int ret = 0;
-    bool copy_to_target;
-
-    copy_to_target = s->job->ret >= 0 &&
-                     s->job->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING;
 
     if (copy_to_target) {
         op = active_write_prepare(s->job, offset, bytes);
@@ -1434,8 +1666,7 @@ static int coroutine_fn bdrv_mirror_top_pwritev(BlockDriverState *bs,
     int ret = 0;
     bool copy_to_target;
 
-    copy_to_target = s->job->ret >= 0 &&
-                     s->job->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING;
+    copy_to_target = mirror_copy_to_target(s->job, offset, bytes);
 
     if (copy_to_target) {
         /* The guest might concurrently modify the data to write; but
@@ -1451,7 +1682,7 @@ static int coroutine_fn bdrv_mirror_top_pwritev(BlockDriverState *bs,
     }
 
     ret = bdrv_mirror_top_do_write(bs, MIRROR_METHOD_COPY, offset, bytes, qiov,
-                                   flags);
+                                   flags, copy_to_target);
 
     if (copy_to_target) {
         qemu_iovec_destroy(&bounce_qiov);
@@ -1473,15 +1704,21 @@ static int coroutine_fn bdrv_mirror_top_flush(BlockDriverState *bs)
 static int coroutine_fn bdrv_mirror_top_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int bytes, BdrvRequestFlags flags)
 {
+    MirrorBDSOpaque *s = bs->opaque;
+    bool copy_to_target = mirror_copy_to_target(s->job, offset, bytes);
+
     return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_ZERO, offset, bytes, NULL,
-                                    flags);
+                                    flags, copy_to_target);
 }
 
 static int coroutine_fn bdrv_mirror_top_pdiscard(BlockDriverState *bs,
     int64_t offset, int bytes)
 {
+    MirrorBDSOpaque *s = bs->opaque;
+    bool copy_to_target = mirror_copy_to_target(s->job, offset, bytes);
+
     return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_DISCARD, offset, bytes,
-                                    NULL, 0);
+                                    NULL, 0, copy_to_target);
 }
 
 static void bdrv_mirror_top_refresh_filename(BlockDriverState *bs)
@@ -1713,7 +1950,9 @@ static BlockJob *mirror_start_job(
     s->base_overlay = bdrv_find_overlay(bs, base);
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
+    s->max_in_flight = MAX_IN_FLIGHT;
     s->unmap = unmap;
+    s->use_copy_range = true;
     if (auto_complete) {
         s->should_complete = true;
     }
@@ -46,6 +46,7 @@
 
 #define EN_OPTSTR ":exportname="
 #define MAX_NBD_REQUESTS    16
+#define MAX_NBD_CONNECTIONS 16
 
 #define HANDLE_TO_INDEX(bs, handle) ((handle) ^ (uint64_t)(intptr_t)(bs))
 #define INDEX_TO_HANDLE(bs, index)  ((index)  ^ (uint64_t)(intptr_t)(bs))
@@ -139,15 +140,25 @@ typedef struct BDRVNBDState {
 
     bool wait_connect;
     NBDConnectThread *connect_thread;
+
+    /*
+     * All connections to the export, conns[0] being this state itself.
+     * Only valid in the state at bs->opaque; the additional connections
+     * have their own BDRVNBDState sharing the same bs.
+     */
+    int multi_conn;
+    int nb_conns;
+    unsigned int next_conn;
+    struct BDRVNBDState *conns[MAX_NBD_CONNECTIONS];
 } BDRVNBDState;
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
                                                   Error **errp);
-static QIOChannelSocket *nbd_co_establish_connection(BlockDriverState *bs,
+static QIOChannelSocket *nbd_co_establish_connection(BDRVNBDState *s,
                                                      Error **errp);
-static void nbd_co_establish_connection_cancel(BlockDriverState *bs,
+static void nbd_co_establish_connection_cancel(BDRVNBDState *s,
                                                bool detach);
-static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
+static int nbd_client_handshake(BDRVNBDState *s, QIOChannelSocket *sioc,
                                 Error **errp);
 
 static void nbd_clear_bdrvstate(BDRVNBDState *s)
@@ -231,16 +242,21 @@ static void reconnect_delay_timer_init(BDRVNBDState *s, uint64_t expire_time_ns)
 static void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    /* Timer is deleted in nbd_client_co_drain_begin() */
-    assert(!s->reconnect_delay_timer);
-    qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
+    for (i = 0; i < s->nb_conns; i++) {
+        BDRVNBDState *conn = s->conns[i];
+
+        /* Timer is deleted in nbd_client_co_drain_begin() */
+        assert(!conn->reconnect_delay_timer);
+        qio_channel_detach_aio_context(QIO_CHANNEL(conn->ioc));
+    }
 }
 
 static void nbd_client_attach_aio_context_bh(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = opaque;
+    BlockDriverState *bs = s->bs;
 
     /*
      * The node is still drained, so we know the coroutine has yielded in
@@ -256,34 +272,38 @@ static void nbd_client_attach_aio_context(BlockDriverState *bs,
                                           AioContext *new_context)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    /*
-     * s->connection_co is either yielded from nbd_receive_reply or from
-     * nbd_co_reconnect_loop()
-     */
-    if (s->state == NBD_CLIENT_CONNECTED) {
-        qio_channel_attach_aio_context(QIO_CHANNEL(s->ioc), new_context);
-    }
+    for (i = 0; i < s->nb_conns; i++) {
+        BDRVNBDState *conn = s->conns[i];
 
-    bdrv_inc_in_flight(bs);
+        /*
+         * conn->connection_co is either yielded from nbd_receive_reply or
+         * from nbd_co_reconnect_loop()
+         */
+        if (conn->state == NBD_CLIENT_CONNECTED) {
+            qio_channel_attach_aio_context(QIO_CHANNEL(conn->ioc), new_context);
+        }
 
-    /*
-     * Need to wait here for the BH to run because the BH must run while the
-     * node is still drained.
-     */
-    aio_wait_bh_oneshot(new_context, nbd_client_attach_aio_context_bh, bs);
+        bdrv_inc_in_flight(bs);
+
+        /*
+         * Need to wait here for the BH to run because the BH must run while
+         * the node is still drained.
+         */
+        aio_wait_bh_oneshot(new_context, nbd_client_attach_aio_context_bh,
+                            conn);
+    }
 }
 
-static void coroutine_fn nbd_client_co_drain_begin(BlockDriverState *bs)
+static void coroutine_fn nbd_conn_drain_begin(BDRVNBDState *s)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-
     s->drained = true;
     if (s->connection_co_sleep_ns_state) {
         qemu_co_sleep_wake(s->connection_co_sleep_ns_state);
     }
 
-    nbd_co_establish_connection_cancel(bs, false);
+    nbd_co_establish_connection_cancel(s, false);
 
     reconnect_delay_timer_del(s);
 
@@ -293,10 +313,18 @@ static void coroutine_fn nbd_client_co_drain_begin(BlockDriverState *bs)
     }
 }
 
-static void coroutine_fn nbd_client_co_drain_end(BlockDriverState *bs)
+static void coroutine_fn nbd_client_co_drain_begin(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
+
+    for (i = 0; i < s->nb_conns; i++) {
+        nbd_conn_drain_begin(s->conns[i]);
+    }
+}
 
+static void coroutine_fn nbd_conn_drain_end(BDRVNBDState *s)
+{
     s->drained = false;
     if (s->wait_drained_end) {
         s->wait_drained_end = false;
@@ -304,11 +332,19 @@ static void coroutine_fn nbd_client_co_drain_end(BlockDriverState *bs)
     }
 }
 
-
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void coroutine_fn nbd_client_co_drain_end(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
+    for (i = 0; i < s->nb_conns; i++) {
+        nbd_conn_drain_end(s->conns[i]);
+    }
+}
+
+
+static void nbd_teardown_connection(BDRVNBDState *s)
+{
     if (s->ioc) {
         /* finish any pending coroutines */
         qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
@@ -323,7 +359,7 @@ static void nbd_teardown_connection(BlockDriverState *bs)
         if (s->connection_co_sleep_ns_state) {
             qemu_co_sleep_wake(s->connection_co_sleep_ns_state);
         }
-        nbd_co_establish_connection_cancel(bs, true);
+        nbd_co_establish_connection_cancel(s, true);
     }
     if (qemu_in_coroutine()) {
         s->teardown_co = qemu_coroutine_self();
@@ -331,7 +367,7 @@ static void nbd_teardown_connection(BlockDriverState *bs)
         qemu_coroutine_yield();
         s->teardown_co = NULL;
     } else {
-        BDRV_POLL_WHILE(bs, s->connection_co);
+        BDRV_POLL_WHILE(s->bs, s->connection_co);
     }
     assert(!s->connection_co);
 }
@@ -425,10 +461,9 @@ static void *connect_thread_func(void *opaque)
 }
 
 static QIOChannelSocket *coroutine_fn
-nbd_co_establish_connection(BlockDriverState *bs, Error **errp)
+nbd_co_establish_connection(BDRVNBDState *s, Error **errp)
 {
     QemuThread thread;
-    BDRVNBDState *s = bs->opaque;
     QIOChannelSocket *res;
     NBDConnectThread *thr = s->connect_thread;
 
@@ -520,10 +555,9 @@ nbd_co_establish_connection(BlockDriverState *bs, Error **errp)
  * to CONNECT_THREAD_RUNNING_DETACHED state). s->connect_thread becomes NULL if
  * detach is true.
  */
-static void nbd_co_establish_connection_cancel(BlockDriverState *bs,
+static void nbd_co_establish_connection_cancel(BDRVNBDState *s,
                                                bool detach)
 {
-    BDRVNBDState *s = bs->opaque;
     NBDConnectThread *thr = s->connect_thread;
     bool wake = false;
     bool do_free = false;
@@ -600,7 +634,7 @@ static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
         s->ioc = NULL;
     }
 
-    sioc = nbd_co_establish_connection(s->bs, &local_err);
+    sioc = nbd_co_establish_connection(s, &local_err);
     if (!sioc) {
         ret = -ECONNREFUSED;
         goto out;
@@ -608,7 +642,7 @@ static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
 
     bdrv_dec_in_flight(s->bs);
 
-    ret = nbd_client_handshake(s->bs, sioc, &local_err);
+    ret = nbd_client_handshake(s, sioc, &local_err);
 
     if (s->drained) {
         s->wait_drained_end = true;
@@ -765,11 +799,10 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
     aio_wait_kick();
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+static int nbd_co_send_request(BDRVNBDState *s,
                                NBDRequest *request,
                                QEMUIOVector *qiov)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     int rc, i = -1;
 
     qemu_co_mutex_lock(&s->send_mutex);
@@ -1475,12 +1508,32 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
     return iter.ret;
 }
 
-static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
+/*
+ * Choose the connection for the next request.  Requests are spread
+ * round-robin over all connections; a connection that gave up reconnecting
+ * is skipped as long as another one is still usable.
+ */
+static BDRVNBDState *nbd_pick_conn(BlockDriverState *bs)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
+
+    for (i = 0; i < s->nb_conns; i++) {
+        BDRVNBDState *conn = s->conns[s->next_conn++ % s->nb_conns];
+
+        if (conn->state != NBD_CLIENT_QUIT) {
+            return conn;
+        }
+    }
+
+    return s;
+}
+
+static int nbd_co_request(BDRVNBDState *s, NBDRequest *request,
                           QEMUIOVector *write_qiov)
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -1491,7 +1544,7 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     }
 
     do {
-        ret = nbd_co_send_request(bs, request, write_qiov);
+        ret = nbd_co_send_request(s, request, write_qiov);
         if (ret < 0) {
             continue;
         }
@@ -1517,7 +1570,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_pick_conn(bs);
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -1550,7 +1603,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     }
 
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(s, &request, NULL);
         if (ret < 0) {
             continue;
         }
@@ -1573,7 +1626,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
 static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                  uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_pick_conn(bs);
     NBDRequest request = {
         .type = NBD_CMD_WRITE,
         .from = offset,
@@ -1591,13 +1644,13 @@ static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, qiov);
+    return nbd_co_request(s, &request, qiov);
 }
 
 static int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
                                        int bytes, BdrvRequestFlags flags)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_pick_conn(bs);
     NBDRequest request = {
         .type = NBD_CMD_WRITE_ZEROES,
         .from = offset,
@@ -1624,28 +1677,33 @@ static int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(s, &request, NULL);
 }
 
 static int nbd_client_co_flush(BlockDriverState *bs)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_pick_conn(bs);
     NBDRequest request = { .type = NBD_CMD_FLUSH };
 
     if (!(s->info.flags & NBD_FLAG_SEND_FLUSH)) {
         return 0;
     }
 
+    /*
+     * Additional connections are only opened if the server advertised
+     * NBD_FLAG_CAN_MULTI_CONN, which guarantees that a flush on any
+     * connection covers the writes completed on all of them.
+     */
     request.from = 0;
     request.len = 0;
 
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(s, &request, NULL);
 }
 
 static int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset,
                                   int bytes)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_pick_conn(bs);
     NBDRequest request = {
         .type = NBD_CMD_TRIM,
         .from = offset,
@@ -1657,7 +1715,7 @@ static int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset,
         return 0;
     }
 
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(s, &request, NULL);
 }
 
 static int coroutine_fn nbd_client_co_block_status(
@@ -1666,7 +1724,7 @@ static int coroutine_fn nbd_client_co_block_status(
 {
     int ret, request_ret;
     NBDExtent extent = { 0 };
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_pick_conn(bs);
     Error *local_err = NULL;
 
     NBDRequest request = {
@@ -1702,7 +1760,7 @@ static int coroutine_fn nbd_client_co_block_status(
         assert(QEMU_IS_ALIGNED(request.len, s->info.min_block));
     }
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(s, &request, NULL);
         if (ret < 0) {
             continue;
         }
@@ -1749,12 +1807,17 @@ static void nbd_client_close(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     NBDRequest request = { .type = NBD_CMD_DISC };
+    int i;
 
-    if (s->ioc) {
-        nbd_send_request(s->ioc, &request);
-    }
+    for (i = 0; i < s->nb_conns; i++) {
+        BDRVNBDState *conn = s->conns[i];
+
+        if (conn->ioc) {
+            nbd_send_request(conn->ioc, &request);
+        }
 
-    nbd_teardown_connection(bs);
+        nbd_teardown_connection(conn);
+    }
 }
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
@@ -1778,10 +1841,10 @@ static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
 }
 
 /* nbd_client_handshake takes ownership on sioc. On failure it is unref'ed. */
-static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
+static int nbd_client_handshake(BDRVNBDState *s, QIOChannelSocket *sioc,
                                 Error **errp)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BlockDriverState *bs = s->bs;
     AioContext *aio_context = bdrv_get_aio_context(bs);
     int ret;
 
@@ -2174,6 +2237,12 @@ static QemuOptsList nbd_runtime_opts = {
                     "future requests before a successful reconnect will "
                     "immediately fail. Default 0",
         },
+        {
+            .name = "multi-conn",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open to the export, if the "
+                    "server supports multiple connections. Default 1",
+        },
         { /* end of list */ }
     },
 };
@@ -2230,6 +2299,13 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
 
+    s->multi_conn = qemu_opt_get_number(opts, "multi-conn", 1);
+    if (s->multi_conn < 1 || s->multi_conn > MAX_NBD_CONNECTIONS) {
+        error_setg(errp, "multi-conn must be between 1 and %d",
+                   MAX_NBD_CONNECTIONS);
+        goto error;
+    }
+
     ret = 0;
 
  error:
@@ -2240,6 +2316,102 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
+static void nbd_conn_start(BDRVNBDState *s)
+{
+    s->state = NBD_CLIENT_CONNECTED;
+
+    nbd_init_connect_thread(s);
+
+    s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
+    bdrv_inc_in_flight(s->bs);
+    aio_co_schedule(bdrv_get_aio_context(s->bs), s->connection_co);
+}
+
+/*
+ * Open one more connection to the export of @primary.  The new connection
+ * negotiates on its own, but must see the same export as the primary one.
+ */
+static BDRVNBDState *nbd_conn_new(BDRVNBDState *primary, Error **errp)
+{
+    BDRVNBDState *s = g_new0(BDRVNBDState, 1);
+    QIOChannelSocket *sioc;
+
+    s->bs = primary->bs;
+    s->reconnect_delay = primary->reconnect_delay;
+    s->saddr = QAPI_CLONE(SocketAddress, primary->saddr);
+    s->export = g_strdup(primary->export);
+    s->tlscredsid = g_strdup(primary->tlscredsid);
+    if (primary->tlscreds) {
+        s->tlscreds = primary->tlscreds;
+        object_ref(OBJECT(s->tlscreds));
+        s->hostname = s->saddr->u.inet.host;
+    }
+    s->x_dirty_bitmap = g_strdup(primary->x_dirty_bitmap);
+    qemu_co_mutex_init(&s->send_mutex);
+    qemu_co_queue_init(&s->free_sema);
+
+    sioc = nbd_establish_connection(s->saddr, errp);
+    if (!sioc) {
+        goto fail;
+    }
+
+    if (nbd_client_handshake(s, sioc, errp) < 0) {
+        goto fail;
+    }
+
+    if (s->info.size != primary->info.size ||
+        s->info.flags != primary->info.flags ||
+        s->info.base_allocation != primary->info.base_allocation ||
+        s->info.min_block != primary->info.min_block ||
+        s->info.max_block != primary->info.max_block)
+    {
+        NBDRequest request = { .type = NBD_CMD_DISC };
+
+        error_setg(errp, "Server presented a different export on an "
+                   "additional connection");
+        nbd_send_request(s->ioc, &request);
+        qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
+        object_unref(OBJECT(s->sioc));
+        object_unref(OBJECT(s->ioc));
+        goto fail;
+    }
+
+    nbd_conn_start(s);
+    return s;
+
+fail:
+    nbd_clear_bdrvstate(s);
+    g_free(s);
+    return NULL;
+}
+
+/*
+ * Open the additional connections requested with multi-conn.  This is only
+ * safe if the server guarantees consistency between connections; failing to
+ * open more connections is not fatal, the node simply uses fewer of them.
+ */
+static void nbd_open_extra_conns(BDRVNBDState *s)
+{
+    Error *local_err = NULL;
+
+    if (!(s->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        trace_nbd_multi_conn_unsupported(s->export);
+        return;
+    }
+
+    while (s->nb_conns < s->multi_conn) {
+        BDRVNBDState *conn = nbd_conn_new(s, &local_err);
+
+        if (!conn) {
+            trace_nbd_multi_conn_open_fail(s->nb_conns,
+                                           error_get_pretty(local_err));
+            error_free(local_err);
+            return;
+        }
+        s->conns[s->nb_conns++] = conn;
+    }
+}
+
 static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
@@ -2265,19 +2437,19 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         return -ECONNREFUSED;
     }
 
-    ret = nbd_client_handshake(bs, sioc, errp);
+    ret = nbd_client_handshake(s, sioc, errp);
     if (ret < 0) {
         nbd_clear_bdrvstate(s);
         return ret;
     }
     /* successfully connected */
-    s->state = NBD_CLIENT_CONNECTED;
-
-    nbd_init_connect_thread(s);
+    nbd_conn_start(s);
+    s->conns[0] = s;
+    s->nb_conns = 1;
 
-    s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
-    bdrv_inc_in_flight(bs);
-    aio_co_schedule(bdrv_get_aio_context(bs), s->connection_co);
+    if (s->multi_conn > 1) {
+        nbd_open_extra_conns(s);
+    }
 
     return 0;
 }
@@ -2324,8 +2496,14 @@ static void nbd_refresh_limits(BlockDriverState *bs, Error **errp)
 static void nbd_close(BlockDriverState *bs)
 {
     BDRVNBDState *s = bs->opaque;
+    int i;
 
     nbd_client_close(bs);
+
+    for (i = 1; i < s->nb_conns; i++) {
+        nbd_clear_bdrvstate(s->conns[i]);
+        g_free(s->conns[i]);
+    }
     nbd_clear_bdrvstate(s);
 }
 
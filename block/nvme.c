@@ -45,7 +45,12 @@ typedef struct BDRVNVMeState BDRVNVMeState;
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
-/* This driver shares a single MSIX IRQ for the admin and I/O queues */
+/*
+ * The admin queue uses MSIX vector 0.  When the device has enough vectors
+ * each I/O queue gets its own, with the same index as the queue, so that
+ * its completions are handled in the AioContext the queue is bound to.
+ * Otherwise all queues share vector 0.
+ */
 enum {
     MSIX_SHARED_IRQ_IDX = 0,
     MSIX_IRQ_COUNT = 1
@@ -89,6 +94,15 @@ typedef struct {
 
     /* Thread-safe, no lock necessary */
     QEMUBH      *completion_bh;
+
+    /*
+     * AioContext whose requests go to this queue, NULL if unused.  Written
+     * under s->queue_lock, read locklessly on the submission path.
+     */
+    AioContext  *aio_context;
+
+    /* Dedicated MSIX vector, only used if s->irq_per_queue */
+    EventNotifier irq_notifier;
 } NVMeQueuePair;
 
 struct BDRVNVMeState {
@@ -111,6 +125,11 @@ struct BDRVNVMeState {
     size_t doorbell_scale;
     bool write_cache_supported;
     EventNotifier irq_notifier[MSIX_IRQ_COUNT];
+    bool irq_per_queue;
+
+    /* Binds I/O queues to AioContexts, see nvme_get_io_queue() */
+    QemuMutex queue_lock;
+    unsigned bound_io_queues;
 
     uint64_t nsze; /* Namespace size reported by identify command */
     int nsid;      /* The namespace id to read/write data. */
@@ -140,6 +159,12 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_NUM_QUEUES "num-queues"
+#define NVME_BLOCK_OPT_IRQ_COALESCE_TIME "irq-coalesce-time"
+#define NVME_BLOCK_OPT_IRQ_COALESCE_THRESHOLD "irq-coalesce-threshold"
+
+/* Upper bound for the num-queues option */
+#define NVME_MAX_IO_QUEUES 64
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -157,6 +182,23 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_NUM_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
+        {
+            .name = NVME_BLOCK_OPT_IRQ_COALESCE_TIME,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Interrupt coalescing time in microseconds, "
+                    "in steps of 100 (default: 0, disabled)",
+        },
+        {
+            .name = NVME_BLOCK_OPT_IRQ_COALESCE_THRESHOLD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Completions to coalesce per interrupt (default: 0, "
+                    "disabled)",
+        },
         { /* end of list */ }
     },
 };
@@ -184,12 +226,18 @@ static bool nvme_init_queue(BDRVNVMeState *s, NVMeQueue *q,
     return true;
 }
 
+static void nvme_unbind_queue(NVMeQueuePair *q);
+
 static void nvme_free_queue_pair(NVMeQueuePair *q)
 {
     trace_nvme_free_queue_pair(q->index, q);
+    nvme_unbind_queue(q);
     if (q->completion_bh) {
         qemu_bh_delete(q->completion_bh);
     }
+    if (q->index != INDEX_ADMIN && q->s->irq_per_queue) {
+        event_notifier_cleanup(&q->irq_notifier);
+    }
     qemu_vfree(q->prp_list_pages);
     qemu_vfree(q->sq.queue);
     qemu_vfree(q->cq.queue);
@@ -222,6 +270,14 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
     if (!q) {
         return NULL;
     }
+    q->s = s;
+    q->index = idx;
+    if (idx != INDEX_ADMIN && s->irq_per_queue &&
+        event_notifier_init(&q->irq_notifier, 0)) {
+        error_setg(errp, "Failed to init event notifier");
+        g_free(q);
+        return NULL;
+    }
     trace_nvme_create_queue_pair(idx, q, size, aio_context,
                                  event_notifier_get_fd(s->irq_notifier));
     bytes = QEMU_ALIGN_UP(s->page_size * NVME_NUM_REQS,
@@ -232,10 +288,12 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
     }
     memset(q->prp_list_pages, 0, bytes);
     qemu_mutex_init(&q->lock);
-    q->s = s;
-    q->index = idx;
     qemu_co_queue_init(&q->free_req_queue);
-    q->completion_bh = aio_bh_new(aio_context, nvme_process_completion_bh, q);
+    if (idx == INDEX_ADMIN) {
+        q->aio_context = aio_context;
+        q->completion_bh = aio_bh_new(aio_context,
+                                      nvme_process_completion_bh, q);
+    }
     r = qemu_vfio_dma_map(s->vfio, q->prp_list_pages, bytes,
                           false, &prp_list_iova);
     if (r) {
@@ -323,7 +381,7 @@ static void nvme_put_free_req_locked(NVMeQueuePair *q, NVMeRequest *req)
 static void nvme_wake_free_req_locked(NVMeQueuePair *q)
 {
     if (!qemu_co_queue_empty(&q->free_req_queue)) {
-        replay_bh_schedule_oneshot_event(q->s->aio_context,
+        replay_bh_schedule_oneshot_event(q->aio_context ?: q->s->aio_context,
                 nvme_free_req_queue_cb, q);
     }
 }
@@ -607,9 +665,9 @@ static bool nvme_poll_queue(NVMeQueuePair *q)
 
     trace_nvme_poll_queue(q->s, q->index);
     /*
-     * Do an early check for completions. q->lock isn't needed because
-     * nvme_process_completion() only runs in the event loop thread and
-     * cannot race with itself.
+     * Do an early check for completions.  q->lock isn't needed, a stale
+     * value only delays processing until the next poll or interrupt;
+     * nvme_process_completion() itself runs under q->lock.
      */
     if ((le16_to_cpu(cqe->status) & 0x1) == q->cq_phase) {
         return false;
@@ -630,7 +688,8 @@ static bool nvme_poll_queues(BDRVNVMeState *s)
     bool progress = false;
     int i;
 
-    for (i = 0; i < s->queue_count; i++) {
+    /* With dedicated vectors only the admin queue uses the shared one */
+    for (i = 0; i < (s->irq_per_queue ? 1 : s->queue_count); i++) {
         if (nvme_poll_queue(s->queues[i])) {
             progress = true;
         }
@@ -648,10 +707,101 @@ static void nvme_handle_event(EventNotifier *n)
     nvme_poll_queues(s);
 }
 
+static void nvme_handle_queue_event(EventNotifier *n)
+{
+    NVMeQueuePair *q = container_of(n, NVMeQueuePair, irq_notifier);
+
+    trace_nvme_handle_event(q->s);
+    event_notifier_test_and_clear(n);
+    nvme_poll_queue(q);
+}
+
+static bool nvme_poll_queue_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NVMeQueuePair *q = container_of(e, NVMeQueuePair, irq_notifier);
+
+    return nvme_poll_queue(q);
+}
+
+/* Route an I/O queue's requests and completions to @ctx */
+static void nvme_bind_queue(NVMeQueuePair *q, AioContext *ctx)
+{
+    BDRVNVMeState *s = q->s;
+
+    assert(q->index != INDEX_ADMIN && !q->aio_context);
+    trace_nvme_bind_queue(s, q->index, ctx);
+    q->completion_bh = aio_bh_new(ctx, nvme_process_completion_bh, q);
+    if (s->irq_per_queue) {
+        aio_set_event_notifier(ctx, &q->irq_notifier, false,
+                               nvme_handle_queue_event, nvme_poll_queue_cb);
+    }
+    qatomic_inc(&s->bound_io_queues);
+    qatomic_set(&q->aio_context, ctx);
+}
+
+static void nvme_unbind_queue(NVMeQueuePair *q)
+{
+    BDRVNVMeState *s = q->s;
+
+    if (q->index == INDEX_ADMIN || !q->aio_context) {
+        return;
+    }
+    if (s->irq_per_queue) {
+        aio_set_event_notifier(q->aio_context, &q->irq_notifier, false,
+                               NULL, NULL);
+    }
+    qemu_bh_delete(q->completion_bh);
+    q->completion_bh = NULL;
+    qatomic_dec(&s->bound_io_queues);
+    qatomic_set(&q->aio_context, NULL);
+}
+
+/*
+ * Pick the I/O queue for the AioContext submitting a request.  The first
+ * request from a context binds it to a free queue.  Once all queues are
+ * taken, further contexts share them.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    unsigned nr_io = s->queue_count - INDEX_IO(0);
+    unsigned i;
+
+    assert(nr_io);
+    if (nr_io == 1) {
+        return s->queues[INDEX_IO(0)];
+    }
+
+    for (i = INDEX_IO(0); i < s->queue_count; i++) {
+        if (qatomic_read(&s->queues[i]->aio_context) == ctx) {
+            return s->queues[i];
+        }
+    }
+
+    if (qatomic_read(&s->bound_io_queues) < nr_io) {
+        QEMU_LOCK_GUARD(&s->queue_lock);
+        for (i = INDEX_IO(0); i < s->queue_count; i++) {
+            NVMeQueuePair *q = s->queues[i];
+
+            if (q->aio_context == ctx) {
+                return q;
+            }
+            if (!q->aio_context) {
+                nvme_bind_queue(q, ctx);
+                return q;
+            }
+        }
+    }
+
+    return s->queues[INDEX_IO(g_direct_hash(ctx) % nr_io)];
+}
+
 static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     unsigned n = s->queue_count;
+    unsigned vector = s->irq_per_queue ? n : MSIX_SHARED_IRQ_IDX;
     NVMeQueuePair *q;
     NvmeCmd cmd;
     unsigned queue_size = NVME_QUEUE_SIZE;
@@ -662,11 +812,16 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     if (!q) {
         return false;
     }
+    if (s->irq_per_queue &&
+        qemu_vfio_pci_set_irq(s->vfio, &q->irq_notifier,
+                              VFIO_PCI_MSIX_IRQ_INDEX, vector, errp)) {
+        goto out_error;
+    }
     cmd = (NvmeCmd) {
         .opcode = NVME_ADM_CMD_CREATE_CQ,
         .dptr.prp1 = cpu_to_le64(q->cq.iova),
         .cdw10 = cpu_to_le32(((queue_size - 1) << 16) | n),
-        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC),
+        .cdw11 = cpu_to_le32((vector << 16) | NVME_CQ_IEN | NVME_CQ_PC),
     };
     if (nvme_admin_cmd_sync(bs, &cmd)) {
         error_setg(errp, "Failed to create CQ io queue [%u]", n);
@@ -685,6 +840,13 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     s->queues = g_renew(NVMeQueuePair *, s->queues, n + 1);
     s->queues[n] = q;
     s->queue_count++;
+
+    /* The first I/O queue always serves the BDS's own AioContext */
+    if (n == INDEX_IO(0)) {
+        qemu_mutex_lock(&s->queue_lock);
+        nvme_bind_queue(q, bdrv_get_aio_context(bs));
+        qemu_mutex_unlock(&s->queue_lock);
+    }
     return true;
 out_error:
     nvme_free_queue_pair(q);
@@ -700,12 +862,27 @@ static bool nvme_poll_cb(void *opaque)
     return nvme_poll_queues(s);
 }
 
+static int nvme_set_feature(BlockDriverState *bs, uint8_t fid, uint32_t value)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(fid),
+        .cdw11 = cpu_to_le32(value),
+    };
+
+    return nvme_admin_cmd_sync(bs, &cmd);
+}
+
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned num_queues, unsigned coalesce_time,
+                     unsigned coalesce_threshold, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
     AioContext *aio_context = bdrv_get_aio_context(bs);
+    Error *local_err = NULL;
+    unsigned nr_vectors = 1;
+    unsigned i;
     int ret;
     uint64_t cap;
     uint64_t timeout_ms;
@@ -714,6 +891,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
 
     qemu_co_mutex_init(&s->dma_map_lock);
     qemu_co_queue_init(&s->dma_flush_queue);
+    qemu_mutex_init(&s->queue_lock);
     s->device = g_strdup(device);
     s->nsid = namespace;
     s->aio_context = bdrv_get_aio_context(bs);
@@ -819,11 +997,16 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         }
     }
 
-    ret = qemu_vfio_pci_init_irq(s->vfio, s->irq_notifier,
-                                 VFIO_PCI_MSIX_IRQ_INDEX, errp);
+    /* Coalescing never applies to the admin queue's vector */
+    if (num_queues > 1 || coalesce_time || coalesce_threshold) {
+        nr_vectors = INDEX_IO(num_queues);
+    }
+    ret = qemu_vfio_pci_init_irqs(s->vfio, s->irq_notifier,
+                                  VFIO_PCI_MSIX_IRQ_INDEX, &nr_vectors, errp);
     if (ret) {
         goto out;
     }
+    s->irq_per_queue = nr_vectors > 1 && nr_vectors == INDEX_IO(num_queues);
     aio_set_event_notifier(bdrv_get_aio_context(bs),
                            &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
                            false, nvme_handle_event, nvme_poll_cb);
@@ -833,9 +1016,33 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         goto out;
     }
 
-    /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
-        ret = -EIO;
+    if (num_queues > 1 &&
+        nvme_set_feature(bs, NVME_NUMBER_OF_QUEUES,
+                         ((num_queues - 1) << 16) | (num_queues - 1))) {
+        warn_report("NVMe: controller refused %u I/O queues, using one",
+                    num_queues);
+        num_queues = 1;
+    }
+    if ((coalesce_time || coalesce_threshold) &&
+        nvme_set_feature(bs, NVME_INTERRUPT_COALESCING,
+                         ((coalesce_time / 100) << 8) |
+                         (coalesce_threshold ? coalesce_threshold - 1 : 0))) {
+        warn_report("NVMe: controller does not support interrupt coalescing");
+    }
+
+    /*
+     * Set up command queues.  The controller may grant fewer than asked
+     * for, in which case make do with those it created.
+     */
+    for (i = 0; i < num_queues; i++) {
+        if (!nvme_add_io_queue(bs, i ? &local_err : errp)) {
+            if (!i) {
+                ret = -EIO;
+            } else {
+                warn_reportf_err(local_err, "NVMe: using %u I/O queues: ", i);
+            }
+            break;
+        }
     }
 out:
     if (regs) {
@@ -913,6 +1120,7 @@ static void nvme_close(BlockDriverState *bs)
                            &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
                            false, NULL, NULL);
     event_notifier_cleanup(&s->irq_notifier[MSIX_SHARED_IRQ_IDX]);
+    qemu_mutex_destroy(&s->queue_lock);
     qemu_vfio_pci_unmap_bar(s->vfio, 0, s->bar0_wo_map,
                             0, sizeof(NvmeBar) + NVME_DOORBELL_SIZE);
     qemu_vfio_close(s->vfio);
@@ -926,6 +1134,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t num_queues, coalesce_time, coalesce_threshold;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -941,7 +1150,26 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    num_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NUM_QUEUES, 1);
+    coalesce_time = qemu_opt_get_number(opts,
+                                        NVME_BLOCK_OPT_IRQ_COALESCE_TIME, 0);
+    coalesce_threshold =
+        qemu_opt_get_number(opts, NVME_BLOCK_OPT_IRQ_COALESCE_THRESHOLD, 0);
+    if (num_queues < 1 || num_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_NUM_QUEUES "' must be between 1 "
+                   "and %d", NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    if (coalesce_time > 255 * 100 || coalesce_threshold > 256) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_IRQ_COALESCE_TIME "' must be at "
+                   "most 25500 and '" NVME_BLOCK_OPT_IRQ_COALESCE_THRESHOLD
+                   "' at most 256");
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, num_queues, coalesce_time,
+                    coalesce_threshold, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1113,7 +1341,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1126,7 +1354,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         .cdw12 = cpu_to_le32(cdw12),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1231,14 +1459,14 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
         .nsid = cpu_to_le32(s->nsid),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1262,7 +1490,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = ((bytes >> s->blkshift) - 1) & 0xFFFF;
@@ -1279,7 +1507,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1315,7 +1543,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeDsmRange *buf;
     QEMUIOVector local_qiov;
@@ -1329,7 +1557,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1416,13 +1644,17 @@ static void nvme_refresh_limits(BlockDriverState *bs, Error **errp)
 static void nvme_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
+    NVMeQueuePair *admin = s->queues[INDEX_ADMIN];
 
-    for (unsigned i = 0; i < s->queue_count; i++) {
-        NVMeQueuePair *q = s->queues[i];
-
-        qemu_bh_delete(q->completion_bh);
-        q->completion_bh = NULL;
+    /* I/O queues are bound again on demand once attached */
+    qemu_mutex_lock(&s->queue_lock);
+    for (unsigned i = INDEX_IO(0); i < s->queue_count; i++) {
+        nvme_unbind_queue(s->queues[i]);
     }
+    qemu_mutex_unlock(&s->queue_lock);
+
+    qemu_bh_delete(admin->completion_bh);
+    admin->completion_bh = NULL;
 
     aio_set_event_notifier(bdrv_get_aio_context(bs),
                            &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
@@ -1434,16 +1666,19 @@ static void nvme_attach_aio_context(BlockDriverState *bs,
 {
     BDRVNVMeState *s = bs->opaque;
 
+    NVMeQueuePair *admin = s->queues[INDEX_ADMIN];
+
     s->aio_context = new_context;
     aio_set_event_notifier(new_context, &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
                            false, nvme_handle_event, nvme_poll_cb);
 
-    for (unsigned i = 0; i < s->queue_count; i++) {
-        NVMeQueuePair *q = s->queues[i];
+    admin->aio_context = new_context;
+    admin->completion_bh =
+        aio_bh_new(new_context, nvme_process_completion_bh, admin);
 
-        q->completion_bh =
-            aio_bh_new(new_context, nvme_process_completion_bh, q);
-    }
+    qemu_mutex_lock(&s->queue_lock);
+    nvme_bind_queue(s->queues[INDEX_IO(0)], new_context);
+    qemu_mutex_unlock(&s->queue_lock);
 }
 
 static void nvme_aio_plug(BlockDriverState *bs)
@@ -445,6 +445,25 @@ static void bdrv_latency_histogram_stats(BlockLatencyHistogram *hist,
     }
 }
 
+static void bdrv_latency_percentiles_stats(BlockAcctStats *stats,
+                                           enum BlockAcctType type,
+                                           bool *not_null,
+                                           BlockLatencyPercentiles **info)
+{
+    static const double quantiles[] = { 0.5, 0.99, 0.999 };
+    uint64_t latency_ns[ARRAY_SIZE(quantiles)];
+
+    *not_null = block_acct_latency_percentiles(stats, type, quantiles,
+                                               latency_ns,
+                                               ARRAY_SIZE(quantiles)) > 0;
+    if (*not_null) {
+        *info = g_new0(BlockLatencyPercentiles, 1);
+        (*info)->p50 = latency_ns[0];
+        (*info)->p99 = latency_ns[1];
+        (*info)->p999 = latency_ns[2];
+    }
+}
+
 static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
 {
     BlockAcctStats *stats = blk_get_stats(blk);
@@ -526,6 +545,16 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
     bdrv_latency_histogram_stats(&stats->latency_histogram[BLOCK_ACCT_FLUSH],
                                  &ds->has_flush_latency_histogram,
                                  &ds->flush_latency_histogram);
+
+    bdrv_latency_percentiles_stats(stats, BLOCK_ACCT_READ,
+                                   &ds->has_rd_latency_percentiles,
+                                   &ds->rd_latency_percentiles);
+    bdrv_latency_percentiles_stats(stats, BLOCK_ACCT_WRITE,
+                                   &ds->has_wr_latency_percentiles,
+                                   &ds->wr_latency_percentiles);
+    bdrv_latency_percentiles_stats(stats, BLOCK_ACCT_FLUSH,
+                                   &ds->has_flush_latency_percentiles,
+                                   &ds->flush_latency_percentiles);
 }
 
 static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
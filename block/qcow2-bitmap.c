@@ -45,6 +45,9 @@
 /* Size of bitmap table entries */
 #define BME_TABLE_ENTRY_SIZE (sizeof(uint64_t))
 
+/* Contiguous bitmap data clusters are loaded with reads of up to this size */
+#define BME_MAX_READ_SIZE (1 * MiB)
+
 QEMU_BUILD_BUG_ON(BME_MAX_NAME_SIZE != BDRV_BITMAP_MAX_NAME_SIZE);
 
 #if BME_MAX_TABLE_SIZE * 8ULL > INT_MAX
@@ -303,37 +306,53 @@ static int load_bitmap_data(BlockDriverState *bs,
     uint64_t offset, limit;
     uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
     uint8_t *buf = NULL;
-    uint64_t i, tab_size =
+    uint64_t i, j, n, tab_size =
             size_to_clusters(s,
                 bdrv_dirty_bitmap_serialization_size(bitmap, 0, bm_size));
+    uint64_t max_clusters = MAX(BME_MAX_READ_SIZE / s->cluster_size, 1);
 
     if (tab_size != bitmap_table_size || tab_size > BME_MAX_TABLE_SIZE) {
         return -EINVAL;
     }
 
-    buf = g_malloc(s->cluster_size);
+    buf = g_malloc(MIN(max_clusters, tab_size) * s->cluster_size);
     limit = bytes_covered_by_bitmap_cluster(s, bitmap);
-    for (i = 0, offset = 0; i < tab_size; ++i, offset += limit) {
-        uint64_t count = MIN(bm_size - offset, limit);
+    for (i = 0, offset = 0; i < tab_size; i += n, offset += n * limit) {
         uint64_t entry = bitmap_table[i];
         uint64_t data_offset = entry & BME_TABLE_ENTRY_OFFSET_MASK;
 
         assert(check_table_entry(entry, s->cluster_size) == 0);
 
+        n = 1;
         if (data_offset == 0) {
             if (entry & BME_TABLE_ENTRY_FLAG_ALL_ONES) {
-                bdrv_dirty_bitmap_deserialize_ones(bitmap, offset, count,
+                bdrv_dirty_bitmap_deserialize_ones(bitmap, offset,
+                                                   MIN(bm_size - offset, limit),
                                                    false);
             } else {
                 /* No need to deserialize zeros because the dirty bitmap is
                  * already cleared */
             }
-        } else {
-            ret = bdrv_pread(bs->file, data_offset, buf, s->cluster_size);
-            if (ret < 0) {
-                goto finish;
-            }
-            bdrv_dirty_bitmap_deserialize_part(bitmap, buf, offset, count,
+            continue;
+        }
+
+        /* Clusters are usually allocated in order: read runs at once */
+        while (i + n < tab_size && n < max_clusters &&
+               (bitmap_table[i + n] & BME_TABLE_ENTRY_OFFSET_MASK) ==
+               data_offset + n * s->cluster_size) {
+            n++;
+        }
+
+        ret = bdrv_pread(bs->file, data_offset, buf, n * s->cluster_size);
+        if (ret < 0) {
+            goto finish;
+        }
+        for (j = 0; j < n; j++) {
+            uint64_t part = offset + j * limit;
+
+            bdrv_dirty_bitmap_deserialize_part(bitmap,
+                                               buf + j * s->cluster_size,
+                                               part, MIN(bm_size - part, limit),
                                                false);
         }
     }
@@ -204,15 +204,97 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
  * the cache is used; otherwise the L2 slice is loaded from the image
  * file.
  */
+/*
+ * Returns the image file offset of the L2 slice that maps guest @offset, or 0
+ * if there is no valid L2 table for it.
+ */
+static uint64_t l2_slice_offset(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l1_index = offset_to_l1_index(s, offset);
+    uint64_t l2_offset;
+
+    if (l1_index >= s->l1_size) {
+        return 0;
+    }
+    l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+    if (!l2_offset || offset_into_cluster(s, l2_offset)) {
+        return 0;
+    }
+
+    return l2_offset + l2_entry_size(s) *
+        (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
+}
+
+static void coroutine_fn l2_readahead_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_offset;
+    uint64_t *l2_slice;
+
+    qemu_co_mutex_lock(&s->lock);
+    /* The L1 table may have changed since the readahead was started */
+    slice_offset = l2_slice_offset(bs, s->l2_readahead_offset);
+    if (slice_offset &&
+        !qcow2_cache_is_table_offset(s->l2_table_cache, slice_offset) &&
+        qcow2_cache_get(bs, s->l2_table_cache, slice_offset,
+                        (void **)&l2_slice) == 0) {
+        trace_qcow2_l2_readahead(bs, s->l2_readahead_offset, slice_offset);
+        qcow2_cache_put(s->l2_table_cache, (void **)&l2_slice);
+    }
+    s->l2_readahead_offset = 0;
+    qemu_co_mutex_unlock(&s->lock);
+
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Called when guest @offset is looked up in the L2 table.  If the lookups
+ * move sequentially from one L2 slice to the next, start loading the slice
+ * after the one for @offset in the background.  The readahead takes s->lock
+ * once the caller has released it, so it overlaps with the caller's data I/O.
+ */
+static void l2_readahead(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes = (uint64_t) s->l2_slice_size << s->cluster_bits;
+    uint64_t slice_start = QEMU_ALIGN_DOWN(offset, slice_bytes);
+    uint64_t next_slice_offset;
+    bool sequential = slice_start == s->l2_next_slice;
+
+    s->l2_next_slice = slice_start + slice_bytes;
+
+    if (!sequential || s->l2_readahead_offset || !qemu_in_coroutine()) {
+        return;
+    }
+
+    next_slice_offset = l2_slice_offset(bs, s->l2_next_slice);
+    if (!next_slice_offset ||
+        qcow2_cache_is_table_offset(s->l2_table_cache, next_slice_offset)) {
+        return;
+    }
+
+    s->l2_readahead_offset = s->l2_next_slice;
+    bdrv_inc_in_flight(bs);
+    bdrv_coroutine_enter(bs, qemu_coroutine_create(l2_readahead_entry, bs));
+}
+
 static int l2_load(BlockDriverState *bs, uint64_t offset,
                    uint64_t l2_offset, uint64_t **l2_slice)
 {
     BDRVQcow2State *s = bs->opaque;
     int start_of_slice = l2_entry_size(s) *
         (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
+    int ret;
 
-    return qcow2_cache_get(bs, s->l2_table_cache, l2_offset + start_of_slice,
-                           (void **)l2_slice);
+    ret = qcow2_cache_get(bs, s->l2_table_cache, l2_offset + start_of_slice,
+                          (void **)l2_slice);
+    if (ret == 0) {
+        l2_readahead(bs, offset);
+    }
+
+    return ret;
 }
 
 /*
@@ -1581,6 +1663,10 @@ static int do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
+    if (s->alloc_reserve_clusters) {
+        return qcow2_alloc_reserved_clusters(bs, guest_offset, host_offset,
+                                             nb_clusters);
+    }
     if (*host_offset == INV_OFFSET) {
         int64_t cluster_offset =
             qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
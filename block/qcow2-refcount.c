@@ -25,6 +25,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qcow2.h"
+#include "block/aio_task.h"
 #include "qemu/range.h"
 #include "qemu/bswap.h"
 #include "qemu/cutils.h"
@@ -820,6 +821,9 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
             " addend=%s%" PRIu64 "\n", offset, length, decrease ? "-" : "",
             addend);
 #endif
+    if (decrease) {
+        reservations_invalidate(s, offset, length);
+    }
     if (length < 0) {
         return -EINVAL;
     } else if (length == 0) {
@@ -1063,6 +1067,161 @@ int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
     return i;
 }
 
+/*
+ * Allocating writes of sequential writers take their clusters from
+ * reservations.  A reservation is made with a single refcount update and a
+ * single overlap check, and the writes that use it afterwards need neither.
+ * Clusters that are still reserved when the image crashes are leaked, which
+ * 'qemu-img check -r leaks' repairs; the refcounts never fall below the
+ * number of references.
+ */
+
+static void reservation_release(BlockDriverState *bs, Qcow2Reservation *r)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (r->nb_clusters) {
+        qcow2_free_clusters(bs, r->host_offset,
+                            r->nb_clusters << s->cluster_bits,
+                            QCOW2_DISCARD_NEVER);
+    }
+    memset(r, 0, sizeof(*r));
+}
+
+void qcow2_release_reservations(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+
+    for (i = 0; i < QCOW2_MAX_RESERVATIONS; i++) {
+        reservation_release(bs, &s->reservations[i]);
+    }
+}
+
+/*
+ * Called when the refcount of [offset, offset + length) is decreased.  Such
+ * clusters may be reused for metadata, so reservations containing them
+ * cannot skip the overlap checks any more.
+ */
+static void reservations_invalidate(BDRVQcow2State *s, int64_t offset,
+                                    int64_t length)
+{
+    int i;
+
+    for (i = 0; i < QCOW2_MAX_RESERVATIONS; i++) {
+        Qcow2Reservation *r = &s->reservations[i];
+
+        if (r->checked && offset < r->end && offset + length > r->start) {
+            r->checked = false;
+        }
+    }
+}
+
+/*
+ * Returns true if [offset, offset + size) lies within a reservation that
+ * has been checked for overlaps with metadata as a whole.
+ */
+static bool reservations_checked(BDRVQcow2State *s, int64_t offset,
+                                 int64_t size)
+{
+    int i;
+
+    for (i = 0; i < QCOW2_MAX_RESERVATIONS; i++) {
+        Qcow2Reservation *r = &s->reservations[i];
+
+        if (r->checked && offset >= r->start && offset + size <= r->end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Allocates up to *nb_clusters clusters for a write to @guest_offset.  If
+ * *host_offset is not INV_OFFSET, the clusters must start there.
+ *
+ * On success, *host_offset is the first allocated cluster and *nb_clusters
+ * the number of clusters allocated, which may be less than requested and
+ * is 0 if nothing could be allocated at the given *host_offset.
+ *
+ * Returns 0 on success, -errno on error.
+ */
+int qcow2_alloc_reserved_clusters(BlockDriverState *bs, uint64_t guest_offset,
+                                  uint64_t *host_offset, uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t guest_cluster = start_of_cluster(s, guest_offset);
+    Qcow2Reservation *r = NULL, *victim = NULL;
+    uint64_t n;
+    int64_t offset;
+    int i, ret;
+
+    assert(s->alloc_reserve_clusters);
+
+    /* Find the writer this write continues, or the least recently used one */
+    for (i = 0; i < QCOW2_MAX_RESERVATIONS; i++) {
+        Qcow2Reservation *t = &s->reservations[i];
+
+        if (t->last_use && t->next_guest_offset == guest_cluster) {
+            r = t;
+            break;
+        }
+        if (!victim || t->last_use < victim->last_use) {
+            victim = t;
+        }
+    }
+
+    if (*host_offset != INV_OFFSET &&
+        !(r && r->nb_clusters && r->host_offset == *host_offset)) {
+        /* Continuing an allocation that was not made from this reservation */
+        int64_t allocated = qcow2_alloc_clusters_at(bs, *host_offset,
+                                                    *nb_clusters);
+        if (allocated < 0) {
+            return allocated;
+        }
+        *nb_clusters = allocated;
+        return 0;
+    }
+
+    if (!r || !r->nb_clusters) {
+        r = r ?: victim;
+        reservation_release(bs, r);
+
+        n = MAX(*nb_clusters, s->alloc_reserve_clusters);
+        offset = qcow2_alloc_clusters(bs, n << s->cluster_bits);
+        if (offset < 0) {
+            return offset;
+        }
+
+        ret = qcow2_pre_write_overlap_check(bs, 0, offset, n << s->cluster_bits,
+                                            true);
+        if (ret < 0) {
+            qcow2_free_clusters(bs, offset, n << s->cluster_bits,
+                                QCOW2_DISCARD_NEVER);
+            return ret;
+        }
+
+        *r = (Qcow2Reservation) {
+            .host_offset    = offset,
+            .nb_clusters    = n,
+            .start          = offset,
+            .end            = offset + (n << s->cluster_bits),
+            .checked        = true,
+        };
+    }
+
+    n = MIN(*nb_clusters, r->nb_clusters);
+    *host_offset = r->host_offset;
+    *nb_clusters = n;
+
+    r->host_offset += n << s->cluster_bits;
+    r->nb_clusters -= n;
+    r->next_guest_offset = guest_cluster + (n << s->cluster_bits);
+    r->last_use = ++s->reservation_counter;
+
+    return 0;
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -1589,8 +1748,8 @@ enum {
 
 /*
  * Increases the refcount in the given refcount table for the all clusters
- * referenced in the L2 table. While doing so, performs some checks on L2
- * entries.
+ * referenced in the L2 table, which the caller has read from @l2_offset into
+ * @l2_table. While doing so, performs some checks on L2 entries.
  *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
@@ -1598,23 +1757,13 @@ enum {
 static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                               void **refcount_table,
                               int64_t *refcount_table_size, int64_t l2_offset,
-                              int flags, BdrvCheckMode fix, bool active)
+                              uint64_t *l2_table, int flags, BdrvCheckMode fix,
+                              bool active)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l2_table, l2_entry;
+    uint64_t l2_entry;
     uint64_t next_contiguous_offset = 0;
-    int i, l2_size, nb_csectors, ret;
-
-    /* Read L2 table from disk */
-    l2_size = s->l2_size * l2_entry_size(s);
-    l2_table = g_malloc(l2_size);
-
-    ret = bdrv_pread(bs->file, l2_offset, l2_table, l2_size);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        goto fail;
-    }
+    int i, nb_csectors, ret;
 
     /* Do the actual checks */
     for(i = 0; i < s->l2_size; i++) {
@@ -1647,7 +1796,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                 l2_entry & QCOW2_COMPRESSED_SECTOR_MASK,
                 nb_csectors * QCOW2_COMPRESSED_SECTOR_SIZE);
             if (ret < 0) {
-                goto fail;
+                return ret;
             }
 
             if (flags & CHECK_FRAG_INFO) {
@@ -1702,7 +1851,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                             res->check_errors++;
                             /* Something is seriously wrong, so abort checking
                              * this L2 table */
-                            goto fail;
+                            return ret;
                         }
 
                         ret = bdrv_pwrite_sync(bs->file, l2e_offset,
@@ -1743,7 +1892,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                                                refcount_table_size,
                                                offset, s->cluster_size);
                 if (ret < 0) {
-                    goto fail;
+                    return ret;
                 }
             }
             break;
@@ -1758,12 +1907,75 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
-    g_free(l2_table);
     return 0;
+}
 
-fail:
-    g_free(l2_table);
-    return ret;
+typedef struct CheckL2ReadTask {
+    AioTask task;
+    BlockDriverState *bs;
+    int64_t l2_offset;
+    uint64_t *l2_table;
+    int *ret;
+} CheckL2ReadTask;
+
+static coroutine_fn int check_read_l2_task_entry(AioTask *task)
+{
+    CheckL2ReadTask *t = container_of(task, CheckL2ReadTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+
+    *t->ret = bdrv_co_pread(t->bs->file, t->l2_offset,
+                            s->l2_size * l2_entry_size(s), t->l2_table, 0);
+
+    /* Errors are reported by the caller, in L1 order */
+    return 0;
+}
+
+/*
+ * Reads the L2 tables referenced by @n L1 entries into @l2_tables, storing
+ * the result of each read in @ret.  When called from a coroutine the reads
+ * are submitted in parallel.
+ */
+static void check_read_l2_tables(BlockDriverState *bs,
+                                 const uint64_t *l1_entries, int n,
+                                 uint64_t **l2_tables, int *ret)
+{
+    BDRVQcow2State *s = bs->opaque;
+    AioTaskPool *pool = NULL;
+    int i;
+
+    if (qemu_in_coroutine()) {
+        pool = aio_task_pool_new(n);
+    }
+
+    for (i = 0; i < n; i++) {
+        int64_t l2_offset = l1_entries[i] & L1E_OFFSET_MASK;
+
+        ret[i] = 0;
+        if (!l1_entries[i]) {
+            continue;
+        }
+
+        if (pool) {
+            CheckL2ReadTask *task = g_new(CheckL2ReadTask, 1);
+
+            *task = (CheckL2ReadTask) {
+                .task.func = check_read_l2_task_entry,
+                .bs = bs,
+                .l2_offset = l2_offset,
+                .l2_table = l2_tables[i],
+                .ret = &ret[i],
+            };
+            aio_task_pool_start_task(pool, &task->task);
+        } else {
+            ret[i] = bdrv_pread(bs->file, l2_offset, l2_tables[i],
+                                s->l2_size * l2_entry_size(s));
+        }
+    }
+
+    if (pool) {
+        aio_task_pool_wait_all(pool);
+        aio_task_pool_free(pool);
+    }
 }
 
 /*
@@ -1783,7 +1995,9 @@ static int check_refcounts_l1(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t *l1_table = NULL, l2_offset, l1_size2;
-    int i, ret;
+    uint64_t *l2_tables[QCOW2_MAX_WORKERS] = { NULL };
+    int read_ret[QCOW2_MAX_WORKERS];
+    int i, j, n, ret;
 
     l1_size2 = l1_size * L1E_SIZE;
 
@@ -1812,10 +2026,24 @@ static int check_refcounts_l1(BlockDriverState *bs,
             be64_to_cpus(&l1_table[i]);
     }
 
-    /* Do the actual checks */
-    for(i = 0; i < l1_size; i++) {
-        l2_offset = l1_table[i];
-        if (l2_offset) {
+    for (j = 0; j < MIN(l1_size, QCOW2_MAX_WORKERS); j++) {
+        l2_tables[j] = g_malloc(s->l2_size * l2_entry_size(s));
+    }
+
+    /*
+     * Do the actual checks.  The L2 tables of up to QCOW2_MAX_WORKERS L1
+     * entries are read ahead in parallel, but always processed in order.
+     */
+    for (i = 0; i < l1_size; i += n) {
+        n = MIN(l1_size - i, QCOW2_MAX_WORKERS);
+        check_read_l2_tables(bs, &l1_table[i], n, l2_tables, read_ret);
+
+        for (j = 0; j < n; j++) {
+            l2_offset = l1_table[i + j];
+            if (!l2_offset) {
+                continue;
+            }
+
             /* Mark L2 table as used */
             l2_offset &= L1E_OFFSET_MASK;
             ret = qcow2_inc_refcounts_imrt(bs, res,
@@ -1832,19 +2060,28 @@ static int check_refcounts_l1(BlockDriverState *bs,
                 res->corruptions++;
             }
 
+            if (read_ret[j] < 0) {
+                fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+                res->check_errors++;
+                ret = read_ret[j];
+                goto fail;
+            }
+
             /* Process and check L2 entries */
             ret = check_refcounts_l2(bs, res, refcount_table,
-                                     refcount_table_size, l2_offset, flags,
-                                     fix, active);
+                                     refcount_table_size, l2_offset,
+                                     l2_tables[j], flags, fix, active);
             if (ret < 0) {
                 goto fail;
             }
         }
     }
-    g_free(l1_table);
-    return 0;
+    ret = 0;
 
 fail:
+    for (j = 0; j < QCOW2_MAX_WORKERS; j++) {
+        g_free(l2_tables[j]);
+    }
     g_free(l1_table);
     return ret;
 }
@@ -2830,6 +3067,11 @@ int qcow2_pre_write_overlap_check(BlockDriverState *bs, int ign, int64_t offset,
         return 0;
     }
 
+    /* Data writes to reserved clusters were checked with the reservation */
+    if (data_file && reservations_checked(bs->opaque, offset, size)) {
+        return 0;
+    }
+
     ret = qcow2_check_metadata_overlap(bs, ign, offset, size);
     if (ret < 0) {
         return ret;
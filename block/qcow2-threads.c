@@ -33,6 +33,8 @@
 #include <zstd_errors.h>
 #endif
 
+#include "qemu/notify.h"
+#include "qemu/thread.h"
 #include "qcow2.h"
 #include "block/thread-pool.h"
 #include "crypto.h"
@@ -42,16 +44,15 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
 {
     int ret;
     BDRVQcow2State *s = bs->opaque;
-    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= s->worker_threads) {
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
     }
     s->nb_threads++;
     qemu_co_mutex_unlock(&s->lock);
 
-    ret = thread_pool_submit_co(pool, func, arg);
+    ret = thread_pool_submit_co(s->thread_pool, func, arg);
 
     qemu_co_mutex_lock(&s->lock);
     s->nb_threads--;
@@ -67,12 +68,14 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
  */
 
 typedef ssize_t (*Qcow2CompressFunc)(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size);
+                                     const void *src, size_t src_size,
+                                     int level);
 typedef struct Qcow2CompressData {
     void *dest;
     size_t dest_size;
     const void *src;
     size_t src_size;
+    int level;
     ssize_t ret;
 
     Qcow2CompressFunc func;
@@ -85,20 +88,22 @@ typedef struct Qcow2CompressData {
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - compression level, 0 for the zlib default
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   int level)
 {
     ssize_t ret;
     z_stream strm;
 
     /* best compression, small window, no zlib header */
     memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+    ret = deflateInit2(&strm, level ?: Z_DEFAULT_COMPRESSION, Z_DEFLATED,
                        -12, 9, Z_DEFAULT_STRATEGY);
     if (ret != Z_OK) {
         return -EIO;
@@ -133,12 +138,14 @@ static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - ignored
  *
  * Returns: 0 on success
  *          -EIO on fail
  */
 static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     int level)
 {
     int ret;
     z_stream strm;
@@ -173,6 +180,54 @@ static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
 
 #ifdef CONFIG_ZSTD
 
+/*
+ * zstd contexts are costly to set up, more so at high compression levels,
+ * so every worker thread keeps one of each and reuses it for all clusters.
+ */
+static __thread ZSTD_CCtx *qcow2_zstd_cctx;
+static __thread ZSTD_DCtx *qcow2_zstd_dctx;
+static __thread Notifier qcow2_zstd_cleanup_notifier;
+
+static void qcow2_zstd_cleanup(Notifier *n, void *value)
+{
+    ZSTD_freeCCtx(qcow2_zstd_cctx);
+    qcow2_zstd_cctx = NULL;
+    ZSTD_freeDCtx(qcow2_zstd_dctx);
+    qcow2_zstd_dctx = NULL;
+}
+
+static void qcow2_zstd_register_cleanup(void)
+{
+    if (!qcow2_zstd_cleanup_notifier.notify) {
+        qcow2_zstd_cleanup_notifier.notify = qcow2_zstd_cleanup;
+        qemu_thread_atexit_add(&qcow2_zstd_cleanup_notifier);
+    }
+}
+
+/* Return this thread's compression context, reset to default parameters */
+static ZSTD_CCtx *qcow2_zstd_get_cctx(void)
+{
+    if (qcow2_zstd_cctx) {
+        ZSTD_CCtx_reset(qcow2_zstd_cctx, ZSTD_reset_session_and_parameters);
+    } else {
+        qcow2_zstd_cctx = ZSTD_createCCtx();
+        qcow2_zstd_register_cleanup();
+    }
+    return qcow2_zstd_cctx;
+}
+
+/* Return this thread's decompression context, ready for a new stream */
+static ZSTD_DCtx *qcow2_zstd_get_dctx(void)
+{
+    if (qcow2_zstd_dctx) {
+        ZSTD_DCtx_reset(qcow2_zstd_dctx, ZSTD_reset_session_only);
+    } else {
+        qcow2_zstd_dctx = ZSTD_createDCtx();
+        qcow2_zstd_register_cleanup();
+    }
+    return qcow2_zstd_dctx;
+}
+
 /*
  * qcow2_zstd_compress()
  *
@@ -180,15 +235,16 @@ static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - compression level, 0 for the zstd default
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   int level)
 {
-    ssize_t ret;
     size_t zstd_ret;
     ZSTD_outBuffer output = {
         .dst = dest,
@@ -200,11 +256,16 @@ static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
         .size = src_size,
         .pos = 0
     };
-    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZSTD_CCtx *cctx = qcow2_zstd_get_cctx();
 
     if (!cctx) {
         return -EIO;
     }
+    if (level &&
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                            level))) {
+        return -EIO;
+    }
     /*
      * Use the zstd streamed interface for symmetry with decompression,
      * where streaming is essential since we don't record the exact
@@ -226,19 +287,14 @@ static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
 
     if (zstd_ret) {
         if (zstd_ret > output.size - output.pos) {
-            ret = -ENOMEM;
-        } else {
-            ret = -EIO;
+            return -ENOMEM;
         }
-        goto out;
+        return -EIO;
     }
 
     /* make sure that zstd didn't overflow the dest buffer */
     assert(output.pos <= dest_size);
-    ret = output.pos;
-out:
-    ZSTD_freeCCtx(cctx);
-    return ret;
+    return output.pos;
 }
 
 /*
@@ -249,12 +305,14 @@ out:
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - ignored
  *
  * Returns: 0 on success
  *          -EIO on any error
  */
 static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     int level)
 {
     size_t zstd_ret = 0;
     ssize_t ret = 0;
@@ -268,7 +326,7 @@ static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
         .size = src_size,
         .pos = 0
     };
-    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    ZSTD_DCtx *dctx = qcow2_zstd_get_dctx();
 
     if (!dctx) {
         return -EIO;
@@ -319,7 +377,6 @@ static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
         ret = -EIO;
     }
 
-    ZSTD_freeDCtx(dctx);
     assert(ret == 0 || ret == -EIO);
     return ret;
 }
@@ -330,7 +387,7 @@ static int qcow2_compress_pool_func(void *opaque)
     Qcow2CompressData *data = opaque;
 
     data->ret = data->func(data->dest, data->dest_size,
-                           data->src, data->src_size);
+                           data->src, data->src_size, data->level);
 
     return 0;
 }
@@ -339,11 +396,13 @@ static ssize_t coroutine_fn
 qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
                      const void *src, size_t src_size, Qcow2CompressFunc func)
 {
+    BDRVQcow2State *s = bs->opaque;
     Qcow2CompressData arg = {
         .dest = dest,
         .dest_size = dest_size,
         .src = src,
         .src_size = src_size,
+        .level = s->compression_level,
         .func = func,
     };
 
@@ -425,6 +484,27 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
     return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
 }
 
+/*
+ * qcow2_compression_level_max()
+ *
+ * Returns: the highest compression level accepted for @type.  Level 0
+ * always selects the library default.
+ */
+int qcow2_compression_level_max(Qcow2CompressionType type)
+{
+    switch (type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        return Z_BEST_COMPRESSION;
+
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return ZSTD_maxCLevel();
+#endif
+    default:
+        abort();
+    }
+}
+
 
 /*
  * Cryptography
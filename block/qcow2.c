@@ -79,6 +79,8 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t bytes,
                            QEMUIOVector *qiov,
                            size_t qiov_offset);
+static void qcow2_decompress_cache_invalidate(BDRVQcow2State *s);
+static void qcow2_decompress_cache_free(BDRVQcow2State *s);
 
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -316,7 +318,8 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            qcow2_crypto_hdr_read_func,
-                                           bs, cflags, QCOW2_MAX_THREADS, errp);
+                                           bs, cflags, s->worker_threads,
+                                           errp);
             if (!s->crypto) {
                 return -EINVAL;
             }
@@ -611,6 +614,9 @@ static int coroutine_fn qcow2_co_check_locked(BlockDriverState *bs,
 
     memset(result, 0, sizeof(*result));
 
+    /* Reserved clusters would show up as leaks */
+    qcow2_release_reservations(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -697,6 +703,9 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_WORKER_THREADS,
+    QCOW2_OPT_COMPRESSION_LEVEL,
+    QCOW2_OPT_ALLOC_RESERVE_SIZE,
     NULL
 };
 
@@ -808,6 +817,24 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_WORKER_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of threads for compression and "
+                    "encryption",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESSION_LEVEL,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Compression level for compressed writes "
+                    "(0 = library default)",
+        },
+        {
+            .name = QCOW2_OPT_ALLOC_RESERVE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Clusters reserved at once for each sequential writer "
+                    "(in bytes, 0 = disabled)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -858,15 +885,33 @@ static void cache_clean_timer_del(BlockDriverState *bs)
     }
 }
 
+static void qcow2_thread_pool_init(BlockDriverState *bs, AioContext *context)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    s->thread_pool = thread_pool_new(context);
+    thread_pool_set_max_threads(s->thread_pool, s->worker_threads);
+}
+
+static void qcow2_thread_pool_del(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    thread_pool_free(s->thread_pool);
+    s->thread_pool = NULL;
+}
+
 static void qcow2_detach_aio_context(BlockDriverState *bs)
 {
     cache_clean_timer_del(bs);
+    qcow2_thread_pool_del(bs);
 }
 
 static void qcow2_attach_aio_context(BlockDriverState *bs,
                                      AioContext *new_context)
 {
     cache_clean_timer_init(bs, new_context);
+    qcow2_thread_pool_init(bs, new_context);
 }
 
 static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
@@ -967,6 +1012,9 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    int worker_threads;
+    int compression_level;
+    uint64_t alloc_reserve_clusters;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -980,6 +1028,7 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t worker_threads, compression_level, alloc_reserve_size;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1071,6 +1120,46 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    /* Compression and encryption workers */
+    worker_threads = qemu_opt_get_number(opts, QCOW2_OPT_WORKER_THREADS,
+                                         QCOW2_DEFAULT_THREADS);
+    if (worker_threads < 1 || worker_threads > QCOW2_MAX_THREADS) {
+        error_setg(errp, QCOW2_OPT_WORKER_THREADS " must be between 1 and %d",
+                   QCOW2_MAX_THREADS);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->worker_threads = worker_threads;
+    /* The crypto context only has enough ciphers for the threads at open */
+    if (s->crypto && r->worker_threads > s->worker_threads) {
+        error_setg(errp, "Cannot increase " QCOW2_OPT_WORKER_THREADS
+                   " of an open encrypted image");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    compression_level = qemu_opt_get_number(opts, QCOW2_OPT_COMPRESSION_LEVEL,
+                                            0);
+    if (compression_level > qcow2_compression_level_max(s->compression_type)) {
+        error_setg(errp, QCOW2_OPT_COMPRESSION_LEVEL " must be between 0 and "
+                   "%d for compression type '%s'",
+                   qcow2_compression_level_max(s->compression_type),
+                   Qcow2CompressionType_str(s->compression_type));
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->compression_level = compression_level;
+
+    alloc_reserve_size = qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_RESERVE_SIZE,
+                                           0);
+    if (alloc_reserve_size > QCOW2_MAX_ALLOC_RESERVE) {
+        error_setg(errp, QCOW2_OPT_ALLOC_RESERVE_SIZE " must not exceed %"
+                   PRIu64, (uint64_t) QCOW2_MAX_ALLOC_RESERVE);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->alloc_reserve_clusters = size_to_clusters(s, alloc_reserve_size);
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1221,6 +1310,19 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    s->worker_threads = r->worker_threads;
+    if (s->thread_pool) {
+        thread_pool_set_max_threads(s->thread_pool, s->worker_threads);
+    } else {
+        qcow2_thread_pool_init(bs, bdrv_get_aio_context(bs));
+    }
+    s->compression_level = r->compression_level;
+
+    if (s->alloc_reserve_clusters != r->alloc_reserve_clusters) {
+        qcow2_release_reservations(bs);
+        s->alloc_reserve_clusters = r->alloc_reserve_clusters;
+    }
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1669,7 +1771,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            NULL, NULL, cflags,
-                                           QCOW2_MAX_THREADS, errp);
+                                           s->worker_threads, errp);
             if (!s->crypto) {
                 ret = -EINVAL;
                 goto fail;
@@ -1849,6 +1951,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
     cache_clean_timer_del(bs);
+    qcow2_thread_pool_del(bs);
     if (s->l2_table_cache) {
         qcow2_cache_destroy(s->l2_table_cache);
     }
@@ -1939,6 +2042,8 @@ static int qcow2_reopen_prepare(BDRVReopenState *state,
 
     /* We need to write out any unwritten data if we reopen read-only. */
     if ((state->flags & BDRV_O_RDWR) == 0) {
+        qcow2_release_reservations(state->bs);
+
         ret = qcow2_reopen_bitmaps_ro(state->bs, errp);
         if (ret < 0) {
             goto fail;
@@ -2653,6 +2758,8 @@ static int qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    qcow2_release_reservations(bs);
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2694,8 +2801,10 @@ static void qcow2_close(BlockDriverState *bs)
     }
 
     cache_clean_timer_del(bs);
+    qcow2_thread_pool_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qcow2_decompress_cache_free(s);
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -4151,6 +4260,9 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* Shrinking must not find reserved clusters beyond the new end */
+    qcow2_release_reservations(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4548,6 +4660,8 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
 success:
     ret = 0;
 fail:
+    /* The new cluster may reuse the descriptor of a freed one */
+    qcow2_decompress_cache_invalidate(s);
     qemu_vfree(buf);
     g_free(out_buf);
     return ret;
@@ -4630,19 +4744,59 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
+/*
+ * Decompressed clusters are kept in a small LRU cache, so that reads
+ * smaller than a cluster do not decompress the same cluster again and
+ * again.  Compressed clusters are never modified in place; the cache is
+ * only invalidated when a new compressed cluster is written, because it
+ * may reuse the space, and thus the descriptor, of a freed one.
+ */
+static void qcow2_decompress_cache_init(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+
+    s->decompress_cache_size = MAX(2, QCOW2_DECOMPRESS_CACHE_SIZE >>
+                                      s->cluster_bits);
+    s->decompress_cache = g_new0(Qcow2DecompressEntry,
+                                 s->decompress_cache_size);
+    for (i = 0; i < s->decompress_cache_size; i++) {
+        qemu_co_queue_init(&s->decompress_cache[i].waiters);
+    }
+    s->decompress_last = UINT64_MAX;
+    s->decompress_readahead = UINT64_MAX;
+}
+
+static void qcow2_decompress_cache_free(BDRVQcow2State *s)
+{
+    int i;
+
+    for (i = 0; i < s->decompress_cache_size; i++) {
+        assert(!s->decompress_cache[i].ref);
+        qemu_vfree(s->decompress_cache[i].buf);
+    }
+    g_free(s->decompress_cache);
+    s->decompress_cache = NULL;
+    s->decompress_cache_size = 0;
+}
+
+static void qcow2_decompress_cache_invalidate(BDRVQcow2State *s)
+{
+    int i;
+
+    for (i = 0; i < s->decompress_cache_size; i++) {
+        s->decompress_cache[i].cluster_descriptor = 0;
+    }
+}
+
 static int coroutine_fn
-qcow2_co_preadv_compressed(BlockDriverState *bs,
-                           uint64_t cluster_descriptor,
-                           uint64_t offset,
-                           uint64_t bytes,
-                           QEMUIOVector *qiov,
-                           size_t qiov_offset)
+qcow2_co_read_compressed(BlockDriverState *bs, uint64_t cluster_descriptor,
+                         uint8_t *out_buf)
 {
     BDRVQcow2State *s = bs->opaque;
     int ret = 0, csize, nb_csectors;
     uint64_t coffset;
-    uint8_t *buf, *out_buf;
-    int offset_in_cluster = offset_into_cluster(s, offset);
+    uint8_t *buf;
 
     coffset = cluster_descriptor & s->cluster_offset_mask;
     nb_csectors = ((cluster_descriptor >> s->csize_shift) & s->csize_mask) + 1;
@@ -4654,8 +4808,6 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         return -ENOMEM;
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
-
     BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
     ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
     if (ret < 0) {
@@ -4667,15 +4819,165 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         goto fail;
     }
 
-    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
-
 fail:
-    qemu_vfree(out_buf);
     g_free(buf);
 
     return ret;
 }
 
+/*
+ * Look up @cluster_descriptor in the cache, decompressing it into a free
+ * entry if needed.  On success *@entry holds a reference that the caller
+ * must drop.  Returns -EBUSY if all entries are in use.
+ */
+static int coroutine_fn
+qcow2_decompress_cache_get(BlockDriverState *bs, uint64_t cluster_descriptor,
+                           Qcow2DecompressEntry **entry)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressEntry *e, *victim = NULL;
+    int i, ret;
+
+    for (i = 0; i < s->decompress_cache_size; i++) {
+        e = &s->decompress_cache[i];
+        if (e->cluster_descriptor == cluster_descriptor) {
+            e->ref++;
+            while (e->loading) {
+                qemu_co_queue_wait(&e->waiters, NULL);
+            }
+            if (e->ret < 0) {
+                e->ref--;
+                return e->ret;
+            }
+            e->lru_counter = ++s->decompress_lru_counter;
+            *entry = e;
+            return 0;
+        }
+        if (!e->ref && !e->loading &&
+            (!victim || e->lru_counter < victim->lru_counter)) {
+            victim = e;
+        }
+    }
+
+    if (!victim) {
+        return -EBUSY;
+    }
+
+    e = victim;
+    if (!e->buf) {
+        e->buf = qemu_blockalign(bs, s->cluster_size);
+    }
+    e->cluster_descriptor = cluster_descriptor;
+    e->ref = 1;
+    e->loading = true;
+
+    ret = qcow2_co_read_compressed(bs, cluster_descriptor, e->buf);
+
+    e->ret = ret;
+    e->loading = false;
+    e->lru_counter = ++s->decompress_lru_counter;
+    qemu_co_queue_restart_all(&e->waiters);
+    if (ret < 0) {
+        e->cluster_descriptor = 0;
+        e->lru_counter = 0;
+        e->ref--;
+        return ret;
+    }
+
+    *entry = e;
+    return 0;
+}
+
+static void coroutine_fn qcow2_decompress_readahead_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t offset = s->decompress_readahead;
+    unsigned int bytes = s->cluster_size;
+    QCow2SubclusterType type;
+    Qcow2DecompressEntry *e;
+    uint64_t host_offset;
+    int ret;
+
+    qemu_co_mutex_lock(&s->lock);
+    ret = qcow2_get_host_offset(bs, offset, &bytes, &host_offset, &type);
+    qemu_co_mutex_unlock(&s->lock);
+
+    if (ret == 0 && type == QCOW2_SUBCLUSTER_COMPRESSED &&
+        qcow2_decompress_cache_get(bs, host_offset, &e) == 0) {
+        trace_qcow2_decompress_readahead(bs, offset);
+        e->ref--;
+    }
+
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Called for each read of the compressed cluster at guest @offset.  If the
+ * reads move sequentially through compressed clusters, decompress the
+ * next cluster in the background.
+ */
+static void qcow2_decompress_readahead(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t cluster_start = start_of_cluster(s, offset);
+    uint64_t next = cluster_start + s->cluster_size;
+    bool sequential = cluster_start == s->decompress_last ||
+                      cluster_start == s->decompress_last + s->cluster_size;
+
+    s->decompress_last = cluster_start;
+
+    if (!sequential || next == s->decompress_readahead ||
+        next >= bs->total_sectors * BDRV_SECTOR_SIZE) {
+        return;
+    }
+
+    s->decompress_readahead = next;
+    bdrv_inc_in_flight(bs);
+    bdrv_coroutine_enter(bs, qemu_coroutine_create(
+                                 qcow2_decompress_readahead_entry, bs));
+}
+
+static int coroutine_fn
+qcow2_co_preadv_compressed(BlockDriverState *bs,
+                           uint64_t cluster_descriptor,
+                           uint64_t offset,
+                           uint64_t bytes,
+                           QEMUIOVector *qiov,
+                           size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int offset_in_cluster = offset_into_cluster(s, offset);
+    Qcow2DecompressEntry *e;
+    uint8_t *out_buf;
+    int ret;
+
+    if (!s->decompress_cache) {
+        qcow2_decompress_cache_init(bs);
+    }
+    qcow2_decompress_readahead(bs, offset);
+
+    ret = qcow2_decompress_cache_get(bs, cluster_descriptor, &e);
+    if (ret == 0) {
+        qemu_iovec_from_buf(qiov, qiov_offset, e->buf + offset_in_cluster,
+                            bytes);
+        e->ref--;
+        return 0;
+    } else if (ret != -EBUSY) {
+        return ret;
+    }
+
+    out_buf = qemu_blockalign(bs, s->cluster_size);
+    ret = qcow2_co_read_compressed(bs, cluster_descriptor, out_buf);
+    if (ret == 0) {
+        qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster,
+                            bytes);
+    }
+    qemu_vfree(out_buf);
+
+    return ret;
+}
+
 static int make_completely_empty(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -4834,6 +5136,8 @@ static int qcow2_make_empty(BlockDriverState *bs)
     int step = QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size);
     int l1_clusters, ret = 0;
 
+    qcow2_release_reservations(bs);
+
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
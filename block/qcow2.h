@@ -29,6 +29,7 @@
 #include "qemu/coroutine.h"
 #include "qemu/units.h"
 #include "block/block_int.h"
+#include "block/thread-pool.h"
 
 //#define DEBUG_ALLOC
 //#define DEBUG_ALLOC2
@@ -115,6 +116,9 @@
 /* Must be at least 2 to cover COW */
 #define MIN_L2_CACHE_SIZE 2 /* cache entries */
 
+/* Memory used to keep recently decompressed clusters */
+#define QCOW2_DECOMPRESS_CACHE_SIZE (2 * MiB)
+
 /* Must be at least 4 to cover all cases of refcount table growth */
 #define MIN_REFCOUNT_CACHE_SIZE 4 /* clusters */
 
@@ -150,6 +154,9 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_WORKER_THREADS "worker-threads"
+#define QCOW2_OPT_COMPRESSION_LEVEL "compression-level"
+#define QCOW2_OPT_ALLOC_RESERVE_SIZE "alloc-reserve-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -322,7 +329,43 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
-#define QCOW2_MAX_THREADS 4
+/* Compression and encryption workers per image */
+#define QCOW2_DEFAULT_THREADS 4
+#define QCOW2_MAX_THREADS 256
+
+/* Number of sequential writers that get a cluster reservation of their own */
+#define QCOW2_MAX_RESERVATIONS 32
+#define QCOW2_MAX_ALLOC_RESERVE (64 * MiB)
+
+/*
+ * A run of host clusters whose refcount has already been set to 1, handed
+ * out to the allocating writes of one sequential writer.
+ */
+typedef struct Qcow2Reservation {
+    /* Guest offset where the writer this reservation serves continues */
+    uint64_t next_guest_offset;
+    /* Reserved clusters not handed out yet */
+    uint64_t host_offset;
+    uint64_t nb_clusters;
+    /* Whole reserved range and whether it passed the overlap checks */
+    uint64_t start;
+    uint64_t end;
+    bool checked;
+    uint64_t last_use;
+} Qcow2Reservation;
+
+typedef struct Qcow2DecompressEntry {
+    /* Compressed cluster descriptor of the data in @buf, 0 if unused */
+    uint64_t cluster_descriptor;
+    uint8_t *buf;
+    uint64_t lru_counter;
+    /* Readers using @buf; the entry is only reused when this is 0 */
+    int ref;
+    /* Set while @buf is being filled, readers wait on @waiters */
+    bool loading;
+    int ret;
+    CoQueue waiters;
+} Qcow2DecompressEntry;
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -348,6 +391,19 @@ typedef struct BDRVQcow2State {
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
+    /* Guest offset of the L2 slice a sequential reader would load next */
+    uint64_t l2_next_slice;
+    /* Guest offset covered by the L2 slice being read ahead, or 0 */
+    uint64_t l2_readahead_offset;
+
+    /* Allocated on the first compressed read */
+    Qcow2DecompressEntry *decompress_cache;
+    int decompress_cache_size;
+    uint64_t decompress_lru_counter;
+    /* Guest offsets of the last compressed cluster read and read ahead */
+    uint64_t decompress_last;
+    uint64_t decompress_readahead;
+
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -355,6 +411,11 @@ typedef struct BDRVQcow2State {
     uint32_t refcount_table_size;
     uint32_t max_refcount_table_index; /* Last used entry in refcount_table */
     uint64_t free_cluster_index;
+
+    /* Clusters per reservation, 0 if writes allocate one at a time */
+    uint64_t alloc_reserve_clusters;
+    Qcow2Reservation reservations[QCOW2_MAX_RESERVATIONS];
+    uint64_t reservation_counter;
     uint64_t free_byte_offset;
 
     CoMutex lock;
@@ -406,8 +467,14 @@ typedef struct BDRVQcow2State {
     char *image_backing_format;
     char *image_data_file;
 
+    /*
+     * Dedicated pool for compression and encryption, running at most
+     * worker_threads tasks at once
+     */
+    ThreadPool *thread_pool;
     CoQueue thread_task_queue;
     int nb_threads;
+    int worker_threads;
 
     BdrvChild *data_file;
 
@@ -420,6 +487,8 @@ typedef struct BDRVQcow2State {
      * is to convert the image with the desired compression type set.
      */
     Qcow2CompressionType compression_type;
+    /* Compression level for writes, 0 means the library default */
+    int compression_level;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -863,6 +932,10 @@ int64_t qcow2_refcount_area(BlockDriverState *bs, uint64_t offset,
 int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size);
 int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                                 int64_t nb_clusters);
+int qcow2_alloc_reserved_clusters(BlockDriverState *bs, uint64_t guest_offset,
+                                  uint64_t *host_offset,
+                                  uint64_t *nb_clusters);
+void qcow2_release_reservations(BlockDriverState *bs);
 int64_t qcow2_alloc_bytes(BlockDriverState *bs, int size);
 void qcow2_free_clusters(BlockDriverState *bs,
                           int64_t offset, int64_t size,
@@ -1003,6 +1076,7 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
 ssize_t coroutine_fn
 qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
                     const void *src, size_t src_size);
+int qcow2_compression_level_max(Qcow2CompressionType type);
 int coroutine_fn
 qcow2_co_encrypt(BlockDriverState *bs, uint64_t host_offset,
                  uint64_t guest_offset, void *buf, size_t len);
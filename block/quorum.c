@@ -17,6 +17,7 @@
 #include "qemu/cutils.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
 #include "block/block_int.h"
 #include "block/qdict.h"
 #include "qapi/error.h"
@@ -35,6 +36,7 @@
 #define QUORUM_OPT_BLKVERIFY      "blkverify"
 #define QUORUM_OPT_REWRITE        "rewrite-corrupted"
 #define QUORUM_OPT_READ_PATTERN   "read-pattern"
+#define QUORUM_OPT_VERIFY_INTERVAL "verify-interval"
 
 /* This union holds a vote hash value */
 typedef union QuorumVoteValue {
@@ -90,6 +92,15 @@ typedef struct BDRVQuorumState {
                             */
 
     QuorumReadPattern read_pattern;
+
+    /*
+     * Moving average of the read latency of each child in nanoseconds, 0 if
+     * not measured yet and INT64_MAX after a failed read.
+     */
+    int64_t *latency_ns;
+    /* With read-pattern=fastest, vote on every Nth read; 0 if disabled */
+    uint32_t verify_interval;
+    uint32_t reads_since_verify;
 } BDRVQuorumState;
 
 typedef struct QuorumAIOCB QuorumAIOCB;
@@ -572,6 +583,21 @@ free_exit:
     quorum_free_vote_list(&acb->votes);
 }
 
+static void quorum_account_latency(BDRVQuorumState *s, int i,
+                                   int64_t start_ns, int ret)
+{
+    int64_t ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
+    int64_t avg = s->latency_ns[i];
+
+    if (ret < 0) {
+        s->latency_ns[i] = INT64_MAX;
+    } else if (avg == 0 || avg == INT64_MAX) {
+        s->latency_ns[i] = MAX(ns, 1);
+    } else {
+        s->latency_ns[i] = MAX(avg - avg / 8 + ns / 8, 1);
+    }
+}
+
 static void read_quorum_children_entry(void *opaque)
 {
     QuorumCo *co = opaque;
@@ -579,10 +605,16 @@ static void read_quorum_children_entry(void *opaque)
     BDRVQuorumState *s = acb->bs->opaque;
     int i = co->idx;
     QuorumChildRequest *sacb = &acb->qcrs[i];
+    BdrvChild *child = s->children[i];
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
     sacb->bs = s->children[i]->bs;
-    sacb->ret = bdrv_co_preadv(s->children[i], acb->offset, acb->bytes,
+    sacb->ret = bdrv_co_preadv(child, acb->offset, acb->bytes,
                                &acb->qcrs[i].qiov, 0);
+    /* The children may have changed while the read was in flight */
+    if (i < s->num_children && s->children[i] == child) {
+        quorum_account_latency(s, i, start_ns, sacb->ret);
+    }
 
     if (sacb->ret == 0) {
         acb->success_count++;
@@ -662,6 +694,49 @@ static int read_fifo_child(QuorumAIOCB *acb)
     return ret;
 }
 
+/* Returns the child with the lowest latency that has not been tried yet */
+static int quorum_fastest_untried_child(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    int i, best = -1;
+
+    for (i = 0; i < s->num_children; i++) {
+        if (acb->qcrs[i].bs) {
+            continue;
+        }
+        if (best < 0 || s->latency_ns[i] < s->latency_ns[best]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static int read_fastest_child(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    int n, ret;
+
+    /* On failure, try the next fastest child */
+    do {
+        int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        BdrvChild *child;
+
+        n = quorum_fastest_untried_child(acb);
+        child = s->children[n];
+        acb->children_read++;
+        acb->qcrs[n].bs = child->bs;
+        ret = bdrv_co_preadv(child, acb->offset, acb->bytes, acb->qiov, 0);
+        if (n < s->num_children && s->children[n] == child) {
+            quorum_account_latency(s, n, start_ns, ret);
+        }
+        if (ret < 0) {
+            quorum_report_bad_acb(&acb->qcrs[n], ret);
+        }
+    } while (ret < 0 && acb->children_read < s->num_children);
+
+    return ret;
+}
+
 static int quorum_co_preadv(BlockDriverState *bs, uint64_t offset,
                             uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
@@ -672,10 +747,22 @@ static int quorum_co_preadv(BlockDriverState *bs, uint64_t offset,
     acb->is_read = true;
     acb->children_read = 0;
 
-    if (s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
+    switch (s->read_pattern) {
+    case QUORUM_READ_PATTERN_QUORUM:
         ret = read_quorum_children(acb);
-    } else {
+        break;
+    case QUORUM_READ_PATTERN_FASTEST:
+        if (s->verify_interval &&
+            ++s->reads_since_verify >= s->verify_interval) {
+            s->reads_since_verify = 0;
+            ret = read_quorum_children(acb);
+        } else {
+            ret = read_fastest_child(acb);
+        }
+        break;
+    default:
         ret = read_fifo_child(acb);
+        break;
     }
     quorum_aio_finalize(acb);
 
@@ -890,7 +977,13 @@ static QemuOptsList quorum_runtime_opts = {
         {
             .name = QUORUM_OPT_READ_PATTERN,
             .type = QEMU_OPT_STRING,
-            .help = "Allowed pattern: quorum, fifo. Quorum is default",
+            .help = "Allowed pattern: quorum, fifo, fastest. "
+                    "Quorum is default",
+        },
+        {
+            .name = QUORUM_OPT_VERIFY_INTERVAL,
+            .type = QEMU_OPT_NUMBER,
+            .help = "With read-pattern=fastest, vote on every Nth read",
         },
         { /* end of list */ }
     },
@@ -903,6 +996,7 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
     Error *local_err = NULL;
     QemuOpts *opts = NULL;
     const char *pattern_str;
+    uint64_t verify_interval;
     bool *opened;
     int i;
     int ret = 0;
@@ -943,12 +1037,26 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
                               -EINVAL, NULL);
     }
     if (ret < 0) {
-        error_setg(errp, "Please set read-pattern as fifo or quorum");
+        error_setg(errp, "Please set read-pattern as fifo, fastest or quorum");
         goto exit;
     }
     s->read_pattern = ret;
 
-    if (s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
+    verify_interval = qemu_opt_get_number(opts, QUORUM_OPT_VERIFY_INTERVAL, 0);
+    if (verify_interval > UINT32_MAX) {
+        error_setg(errp, "verify-interval must be at most %" PRIu32,
+                   UINT32_MAX);
+        ret = -EINVAL;
+        goto exit;
+    }
+    if (verify_interval && s->read_pattern != QUORUM_READ_PATTERN_FASTEST) {
+        error_setg(errp, "verify-interval requires read-pattern=fastest");
+        ret = -EINVAL;
+        goto exit;
+    }
+    s->verify_interval = verify_interval;
+
+    if (s->read_pattern != QUORUM_READ_PATTERN_FIFO) {
         s->is_blkverify = qemu_opt_get_bool(opts, QUORUM_OPT_BLKVERIFY, false);
         if (s->is_blkverify && (s->num_children != 2 || s->threshold != 2)) {
             error_setg(errp, "blkverify=on can only be set if there are "
@@ -969,6 +1077,7 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
 
     /* allocate the children array */
     s->children = g_new0(BdrvChild *, s->num_children);
+    s->latency_ns = g_new0(int64_t, s->num_children);
     opened = g_new0(bool, s->num_children);
 
     for (i = 0; i < s->num_children; i++) {
@@ -1003,6 +1112,7 @@ close_exit:
         bdrv_unref_child(bs, s->children[i]);
     }
     g_free(s->children);
+    g_free(s->latency_ns);
     g_free(opened);
 exit:
     qemu_opts_del(opts);
@@ -1019,6 +1129,7 @@ static void quorum_close(BlockDriverState *bs)
     }
 
     g_free(s->children);
+    g_free(s->latency_ns);
 }
 
 static void quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs,
@@ -1060,6 +1171,8 @@ static void quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs,
         goto out;
     }
     s->children = g_renew(BdrvChild *, s->children, s->num_children + 1);
+    s->latency_ns = g_renew(int64_t, s->latency_ns, s->num_children + 1);
+    s->latency_ns[s->num_children] = 0;
     s->children[s->num_children++] = child;
 
 out:
@@ -1102,7 +1215,10 @@ static void quorum_del_child(BlockDriverState *bs, BdrvChild *child,
     /* We can safely remove this child now */
     memmove(&s->children[i], &s->children[i + 1],
             (s->num_children - i - 1) * sizeof(BdrvChild *));
+    memmove(&s->latency_ns[i], &s->latency_ns[i + 1],
+            (s->num_children - i - 1) * sizeof(int64_t));
     s->children = g_renew(BdrvChild *, s->children, --s->num_children);
+    s->latency_ns = g_renew(int64_t, s->latency_ns, s->num_children);
     bdrv_unref_child(bs, child);
 
     bdrv_drained_end(bs);
@@ -1184,6 +1300,7 @@ static const char *const quorum_strong_runtime_opts[] = {
     QUORUM_OPT_BLKVERIFY,
     QUORUM_OPT_REWRITE,
     QUORUM_OPT_READ_PATTERN,
+    QUORUM_OPT_VERIFY_INTERVAL,
 
     NULL
 };
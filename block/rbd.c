@@ -66,6 +66,17 @@
 
 #define RBD_MAX_SNAPS 100
 
+#define RBD_MAX_IMAGE_HANDLES 16
+
+/*
+ * While the node is plugged, writes up to this size are held back so that
+ * adjacent ones can be submitted as a single request.
+ */
+#define RBD_COALESCE_MAX_BYTES (64 * KiB)
+
+/* Submit held back writes early once this many are queued */
+#define RBD_COALESCE_MAX_REQS 32
+
 /* The LIBRBD_SUPPORTS_IOVEC is defined in librbd.h */
 #ifdef LIBRBD_SUPPORTS_IOVEC
 #define LIBRBD_USE_IOVEC 1
@@ -88,6 +99,12 @@ typedef struct RBDAIOCB {
     RBDAIOCmd cmd;
     int error;
     struct BDRVRBDState *s;
+
+    /* Only used for writes that are held back while plugged */
+    int64_t offset;
+    int64_t size;
+    QSIMPLEQ_ENTRY(RBDAIOCB) queue_next;
+    struct RBDAIOCB *merge_next;
 } RBDAIOCB;
 
 typedef struct RADOSCB {
@@ -96,6 +113,10 @@ typedef struct RADOSCB {
     int64_t size;
     char *buf;
     int64_t ret;
+
+    /* Set if acb is the first of several coalesced writes */
+    bool merged;
+    QEMUIOVector qiov;
 } RADOSCB;
 
 typedef struct BDRVRBDState {
@@ -106,6 +127,23 @@ typedef struct BDRVRBDState {
     char *snap;
     char *namespace;
     uint64_t image_size;
+
+    /*
+     * Additional read-only handles on the same image, so that reads are
+     * spread over several librbd completion threads.  images[0] is image,
+     * which serves all other requests.  Reads beyond shared_size, which
+     * the other handles may not know about yet, also use image.
+     */
+    rbd_image_t *images;
+    int nb_images;
+    unsigned int next_image;
+    uint64_t shared_size;
+
+    /* Write coalescing */
+    bool plugged;
+    QemuMutex queue_lock;
+    QSIMPLEQ_HEAD(, RBDAIOCB) write_queue;
+    int nb_queued;
 } BDRVRBDState;
 
 static int qemu_rbd_connect(rados_t *cluster, rados_ioctx_t *io_ctx,
@@ -465,10 +503,24 @@ exit:
 static void qemu_rbd_complete_aio(RADOSCB *rcb)
 {
     RBDAIOCB *acb = rcb->acb;
+    RBDAIOCB *next;
     int64_t r;
 
     r = rcb->ret;
 
+    if (rcb->merged) {
+        /* Each of the coalesced writes gets the result of the whole */
+        qemu_iovec_destroy(&rcb->qiov);
+        g_free(rcb);
+        for (; acb; acb = next) {
+            next = acb->merge_next;
+            acb->ret = r < 0 ? r : acb->size;
+            acb->common.cb(acb->common.opaque, (acb->ret > 0 ? 0 : acb->ret));
+            qemu_aio_unref(acb);
+        }
+        return;
+    }
+
     if (acb->cmd != RBD_AIO_READ) {
         if (r < 0) {
             acb->ret = r;
@@ -682,6 +734,18 @@ static int qemu_rbd_attempt_legacy_options(QDict *options,
     return r;
 }
 
+static void qemu_rbd_close_images(BDRVRBDState *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_images; i++) {
+        rbd_close(s->images[i]);
+    }
+    g_free(s->images);
+    s->images = NULL;
+    s->image = NULL;
+}
+
 static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
                          Error **errp)
 {
@@ -690,7 +754,7 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
     const QDictEntry *e;
     Error *local_err = NULL;
     char *keypairs, *secretid;
-    int r;
+    int i, r;
 
     keypairs = g_strdup(qdict_get_try_str(options, "=keyvalue-pairs"));
     if (keypairs) {
@@ -737,6 +801,20 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
         qdict_del(options, e->key);
     }
 
+    s->nb_images = opts->has_image_handles ? opts->image_handles : 1;
+    if (s->nb_images < 1 || s->nb_images > RBD_MAX_IMAGE_HANDLES) {
+        error_setg(errp, "image-handles must be between 1 and %d",
+                   RBD_MAX_IMAGE_HANDLES);
+        r = -EINVAL;
+        goto out;
+    }
+    if (s->nb_images > 1 && !(flags & BDRV_O_NOCACHE)) {
+        /* Each handle would have its own, incoherent, librbd cache */
+        error_setg(errp, "image-handles > 1 requires cache.direct=on");
+        r = -EINVAL;
+        goto out;
+    }
+
     r = qemu_rbd_connect(&s->cluster, &s->io_ctx, opts,
                          !(flags & BDRV_O_NOCACHE), keypairs, secretid, errp);
     if (r < 0) {
@@ -762,12 +840,33 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
         goto failed_open;
     }
 
+    /*
+     * The extra handles are opened read-only so that they never compete
+     * with the main one for the exclusive lock.
+     */
+    s->images = g_new0(rbd_image_t, s->nb_images);
+    s->images[0] = s->image;
+    s->shared_size = s->image_size;
+    for (i = 1; i < s->nb_images; i++) {
+        r = rbd_open_read_only(s->io_ctx, s->image_name, &s->images[i],
+                               s->snap);
+        if (r < 0) {
+            error_setg_errno(errp, -r, "error opening image handle %d of %s",
+                             i, s->image_name);
+            while (--i >= 0) {
+                rbd_close(s->images[i]);
+            }
+            g_free(s->images);
+            goto failed_open;
+        }
+    }
+
     /* If we are using an rbd snapshot, we must be r/o, otherwise
      * leave as-is */
     if (s->snap != NULL) {
         r = bdrv_apply_auto_read_only(bs, "rbd snapshots are read-only", errp);
         if (r < 0) {
-            rbd_close(s->image);
+            qemu_rbd_close_images(s);
             goto failed_open;
         }
     }
@@ -775,6 +874,9 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
     /* When extending regular files, we get zeros from the OS */
     bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
 
+    qemu_mutex_init(&s->queue_lock);
+    QSIMPLEQ_INIT(&s->write_queue);
+
     r = 0;
     goto out;
 
@@ -814,7 +916,9 @@ static void qemu_rbd_close(BlockDriverState *bs)
 {
     BDRVRBDState *s = bs->opaque;
 
-    rbd_close(s->image);
+    assert(QSIMPLEQ_EMPTY(&s->write_queue));
+    qemu_mutex_destroy(&s->queue_lock);
+    qemu_rbd_close_images(s);
     rados_ioctx_destroy(s->io_ctx);
     g_free(s->snap);
     g_free(s->image_name);
@@ -833,6 +937,7 @@ static int qemu_rbd_resize(BlockDriverState *bs, uint64_t size)
     }
 
     s->image_size = size;
+    s->shared_size = MIN(s->shared_size, size);
 
     return 0;
 }
@@ -888,6 +993,138 @@ static int rbd_aio_flush_wrapper(rbd_image_t image,
 #endif
 }
 
+/*
+ * Issue the librbd request for @rcb on @image.  On failure, nothing was
+ * submitted and the caller still owns @rcb.
+ */
+static int rbd_submit_rcb(BlockDriverState *bs, RADOSCB *rcb,
+                          rbd_image_t image, RBDAIOCmd cmd, int64_t off,
+                          QEMUIOVector *qiov)
+{
+    BDRVRBDState *s = bs->opaque;
+    int64_t size = rcb->size;
+    rbd_completion_t c;
+    int r;
+
+    r = rbd_aio_create_completion(rcb, (rbd_callback_t) rbd_finish_aiocb, &c);
+    if (r < 0) {
+        return r;
+    }
+
+    switch (cmd) {
+    case RBD_AIO_WRITE: {
+        /*
+         * RBD APIs don't allow us to write more than actual size, so in order
+         * to support growing images, we resize the image before write
+         * operations that exceed the current size.
+         */
+        if (off + size > s->image_size) {
+            r = qemu_rbd_resize(bs, off + size);
+            if (r < 0) {
+                break;
+            }
+        }
+#ifdef LIBRBD_SUPPORTS_IOVEC
+            r = rbd_aio_writev(image, qiov->iov, qiov->niov, off, c);
+#else
+            r = rbd_aio_write(image, off, size, rcb->buf, c);
+#endif
+        break;
+    }
+    case RBD_AIO_READ:
+#ifdef LIBRBD_SUPPORTS_IOVEC
+            r = rbd_aio_readv(image, qiov->iov, qiov->niov, off, c);
+#else
+            r = rbd_aio_read(image, off, size, rcb->buf, c);
+#endif
+        break;
+    case RBD_AIO_DISCARD:
+        r = rbd_aio_discard_wrapper(image, off, size, c);
+        break;
+    case RBD_AIO_FLUSH:
+        r = rbd_aio_flush_wrapper(image, c);
+        break;
+    default:
+        r = -EINVAL;
+    }
+
+    if (r < 0) {
+        rbd_aio_release(c);
+    }
+    return r;
+}
+
+/*
+ * Submit the writes held back while plugged, coalescing each run of
+ * writes where every one starts exactly where the previous one ended.
+ */
+static void qemu_rbd_submit_queue(BlockDriverState *bs)
+{
+    BDRVRBDState *s = bs->opaque;
+    QSIMPLEQ_HEAD(, RBDAIOCB) queue = QSIMPLEQ_HEAD_INITIALIZER(queue);
+    RBDAIOCB *acb, *last, *next;
+
+    qemu_mutex_lock(&s->queue_lock);
+    QSIMPLEQ_CONCAT(&queue, &s->write_queue);
+    s->nb_queued = 0;
+    qemu_mutex_unlock(&s->queue_lock);
+
+    while ((acb = QSIMPLEQ_FIRST(&queue))) {
+        RADOSCB *rcb = g_new0(RADOSCB, 1);
+        int niov = acb->qiov->niov;
+        int r;
+
+        QSIMPLEQ_REMOVE_HEAD(&queue, queue_next);
+        rcb->acb = acb;
+        rcb->s = s;
+        rcb->size = acb->size;
+
+        last = acb;
+        while ((next = QSIMPLEQ_FIRST(&queue)) &&
+               next->offset == acb->offset + rcb->size &&
+               niov + next->qiov->niov <= IOV_MAX) {
+            QSIMPLEQ_REMOVE_HEAD(&queue, queue_next);
+            last->merge_next = next;
+            last = next;
+            rcb->size += next->size;
+            niov += next->qiov->niov;
+        }
+        last->merge_next = NULL;
+
+        if (acb->merge_next) {
+            rcb->merged = true;
+            qemu_iovec_init(&rcb->qiov, niov);
+            for (next = acb; next; next = next->merge_next) {
+                qemu_iovec_concat(&rcb->qiov, next->qiov, 0, next->size);
+            }
+        }
+
+        r = rbd_submit_rcb(bs, rcb, s->image, RBD_AIO_WRITE, acb->offset,
+                           rcb->merged ? &rcb->qiov : acb->qiov);
+        if (r < 0) {
+            /* The requests were accepted already, fail them from a BH */
+            rcb->ret = r;
+            replay_bh_schedule_oneshot_event(bdrv_get_aio_context(bs),
+                                             rbd_finish_bh, rcb);
+        }
+    }
+}
+
+static void qemu_rbd_queue_write(BlockDriverState *bs, RBDAIOCB *acb)
+{
+    BDRVRBDState *s = bs->opaque;
+    bool submit;
+
+    qemu_mutex_lock(&s->queue_lock);
+    QSIMPLEQ_INSERT_TAIL(&s->write_queue, acb, queue_next);
+    submit = ++s->nb_queued >= RBD_COALESCE_MAX_REQS;
+    qemu_mutex_unlock(&s->queue_lock);
+
+    if (submit) {
+        qemu_rbd_submit_queue(bs);
+    }
+}
+
 static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
                                  int64_t off,
                                  QEMUIOVector *qiov,
@@ -898,7 +1135,7 @@ static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
 {
     RBDAIOCB *acb;
     RADOSCB *rcb = NULL;
-    rbd_completion_t c;
+    rbd_image_t image;
     int r;
 
     BDRVRBDState *s = bs->opaque;
@@ -906,9 +1143,24 @@ static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
     acb = qemu_aio_get(&rbd_aiocb_info, bs, cb, opaque);
     acb->cmd = cmd;
     acb->qiov = qiov;
+    acb->offset = off;
+    acb->size = size;
     assert(!qiov || qiov->size == size);
 
-    rcb = g_new(RADOSCB, 1);
+    acb->ret = 0;
+    acb->error = 0;
+    acb->s = s;
+
+    if (LIBRBD_USE_IOVEC && cmd == RBD_AIO_WRITE &&
+        size <= RBD_COALESCE_MAX_BYTES && qatomic_read(&s->plugged)) {
+        qemu_rbd_queue_write(bs, acb);
+        return &acb->common;
+    }
+    if (cmd == RBD_AIO_FLUSH) {
+        qemu_rbd_submit_queue(bs);
+    }
+
+    rcb = g_new0(RADOSCB, 1);
 
     if (!LIBRBD_USE_IOVEC) {
         if (cmd == RBD_AIO_DISCARD || cmd == RBD_AIO_FLUSH) {
@@ -925,62 +1177,22 @@ static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
         rcb->buf = acb->bounce;
     }
 
-    acb->ret = 0;
-    acb->error = 0;
-    acb->s = s;
-
     rcb->acb = acb;
     rcb->s = acb->s;
     rcb->size = size;
-    r = rbd_aio_create_completion(rcb, (rbd_callback_t) rbd_finish_aiocb, &c);
-    if (r < 0) {
-        goto failed;
-    }
 
-    switch (cmd) {
-    case RBD_AIO_WRITE: {
-        /*
-         * RBD APIs don't allow us to write more than actual size, so in order
-         * to support growing images, we resize the image before write
-         * operations that exceed the current size.
-         */
-        if (off + size > s->image_size) {
-            r = qemu_rbd_resize(bs, off + size);
-            if (r < 0) {
-                goto failed_completion;
-            }
-        }
-#ifdef LIBRBD_SUPPORTS_IOVEC
-            r = rbd_aio_writev(s->image, qiov->iov, qiov->niov, off, c);
-#else
-            r = rbd_aio_write(s->image, off, size, rcb->buf, c);
-#endif
-        break;
-    }
-    case RBD_AIO_READ:
-#ifdef LIBRBD_SUPPORTS_IOVEC
-            r = rbd_aio_readv(s->image, qiov->iov, qiov->niov, off, c);
-#else
-            r = rbd_aio_read(s->image, off, size, rcb->buf, c);
-#endif
-        break;
-    case RBD_AIO_DISCARD:
-        r = rbd_aio_discard_wrapper(s->image, off, size, c);
-        break;
-    case RBD_AIO_FLUSH:
-        r = rbd_aio_flush_wrapper(s->image, c);
-        break;
-    default:
-        r = -EINVAL;
+    image = s->image;
+    if (cmd == RBD_AIO_READ && s->nb_images > 1 &&
+        off + size <= s->shared_size) {
+        image = s->images[qatomic_fetch_inc(&s->next_image) % s->nb_images];
     }
 
+    r = rbd_submit_rcb(bs, rcb, image, cmd, off, qiov);
     if (r < 0) {
-        goto failed_completion;
+        goto failed;
     }
     return &acb->common;
 
-failed_completion:
-    rbd_aio_release(c);
 failed:
     g_free(rcb);
     if (!LIBRBD_USE_IOVEC) {
@@ -1026,6 +1238,7 @@ static int qemu_rbd_co_flush(BlockDriverState *bs)
 #if LIBRBD_VERSION_CODE >= LIBRBD_VERSION(0, 1, 1)
     /* rbd_flush added in 0.1.1 */
     BDRVRBDState *s = bs->opaque;
+    qemu_rbd_submit_queue(bs);
     return rbd_flush(s->image);
 #else
     return 0;
@@ -1215,13 +1428,39 @@ static void coroutine_fn qemu_rbd_co_invalidate_cache(BlockDriverState *bs,
                                                       Error **errp)
 {
     BDRVRBDState *s = bs->opaque;
-    int r = rbd_invalidate_cache(s->image);
-    if (r < 0) {
-        error_setg_errno(errp, -r, "Failed to invalidate the cache");
+    int i, r;
+
+    for (i = 0; i < s->nb_images; i++) {
+        r = rbd_invalidate_cache(s->images[i]);
+        if (r < 0) {
+            error_setg_errno(errp, -r, "Failed to invalidate the cache");
+            return;
+        }
     }
 }
 #endif
 
+static void qemu_rbd_io_plug(BlockDriverState *bs)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    qatomic_set(&s->plugged, true);
+}
+
+static void qemu_rbd_io_unplug(BlockDriverState *bs)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    qatomic_set(&s->plugged, false);
+    qemu_rbd_submit_queue(bs);
+}
+
+static void coroutine_fn qemu_rbd_co_drain_begin(BlockDriverState *bs)
+{
+    /* Held back writes would otherwise wait for an unplug forever */
+    qemu_rbd_submit_queue(bs);
+}
+
 static QemuOptsList qemu_rbd_create_opts = {
     .name = "rbd-create-opts",
     .head = QTAILQ_HEAD_INITIALIZER(qemu_rbd_create_opts.head),
@@ -1288,6 +1527,10 @@ static BlockDriver bdrv_rbd = {
     .bdrv_aio_pdiscard      = qemu_rbd_aio_pdiscard,
 #endif
 
+    .bdrv_io_plug           = qemu_rbd_io_plug,
+    .bdrv_io_unplug         = qemu_rbd_io_unplug,
+    .bdrv_co_drain_begin    = qemu_rbd_co_drain_begin,
+
     .bdrv_snapshot_create   = qemu_rbd_snap_create,
     .bdrv_snapshot_delete   = qemu_rbd_snap_remove,
     .bdrv_snapshot_list     = qemu_rbd_snap_list,
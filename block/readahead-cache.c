@@ -0,0 +1,368 @@
+/*
+ * Read cache with adaptive readahead for network protocol drivers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block_int.h"
+#include "block/readahead-cache.h"
+#include "qemu/coroutine.h"
+#include "trace.h"
+
+/* Granularity of cached data */
+#define READAHEAD_CACHE_CHUNK_SIZE      (64 * KiB)
+
+/* Upper limit for a single range request issued to the driver */
+#define READAHEAD_CACHE_MAX_REQUEST     (1 * MiB)
+#define READAHEAD_CACHE_MAX_REQ_CHUNKS \
+    (READAHEAD_CACHE_MAX_REQUEST / READAHEAD_CACHE_CHUNK_SIZE)
+
+typedef struct ReadaheadCacheChunk {
+    uint64_t index;
+    uint64_t bytes;
+    uint8_t *buf;
+
+    /*
+     * One reference is held by the hash table, one by the fetch that fills
+     * the chunk and one by each reader that waits for it.
+     */
+    int refcnt;
+    bool ready;
+    int ret;
+    CoQueue waitq;
+
+    /* Ready chunks that are in the hash table, least recently used first */
+    QTAILQ_ENTRY(ReadaheadCacheChunk) lru;
+} ReadaheadCacheChunk;
+
+typedef struct ReadaheadCacheFetch {
+    ReadaheadCache *c;
+    bool readahead;
+    int nb_chunks;
+    ReadaheadCacheChunk *chunks[READAHEAD_CACHE_MAX_REQ_CHUNKS];
+} ReadaheadCacheFetch;
+
+struct ReadaheadCache {
+    BlockDriverState *bs;
+    ReadaheadCacheFetchFunc *fetch;
+    void *opaque;
+
+    uint64_t length;
+    uint64_t size;
+    uint64_t min_window;
+    uint64_t max_window;
+
+    QemuMutex lock;
+    /* Protected by lock */
+    GHashTable *chunks;
+    QTAILQ_HEAD(, ReadaheadCacheChunk) lru;
+    uint64_t used;
+    uint64_t next_offset;
+    uint64_t window;
+};
+
+ReadaheadCache *readahead_cache_new(BlockDriverState *bs, uint64_t length,
+                                    uint64_t size, uint64_t min_readahead,
+                                    ReadaheadCacheFetchFunc *fetch,
+                                    void *opaque)
+{
+    ReadaheadCache *c = g_new0(ReadaheadCache, 1);
+
+    c->bs = bs;
+    c->fetch = fetch;
+    c->opaque = opaque;
+    c->length = length;
+    c->size = MAX(size, 2 * READAHEAD_CACHE_MAX_REQUEST);
+    c->min_window = min_readahead;
+    c->max_window = MAX(c->size / 4, min_readahead);
+
+    qemu_mutex_init(&c->lock);
+    c->chunks = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&c->lru);
+
+    return c;
+}
+
+static void readahead_cache_chunk_unref(ReadaheadCache *c,
+                                        ReadaheadCacheChunk *chunk)
+{
+    assert(chunk->refcnt > 0);
+    if (--chunk->refcnt == 0) {
+        c->used -= READAHEAD_CACHE_CHUNK_SIZE;
+        g_free(chunk->buf);
+        g_free(chunk);
+    }
+}
+
+/* Drop a ready chunk from the cache */
+static void readahead_cache_chunk_evict(ReadaheadCache *c,
+                                        ReadaheadCacheChunk *chunk)
+{
+    g_hash_table_remove(c->chunks, &chunk->index);
+    QTAILQ_REMOVE(&c->lru, chunk, lru);
+    readahead_cache_chunk_unref(c, chunk);
+}
+
+void readahead_cache_free(ReadaheadCache *c)
+{
+    GHashTableIter iter;
+    ReadaheadCacheChunk *chunk;
+
+    g_hash_table_iter_init(&iter, c->chunks);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&chunk)) {
+        /* Draining the node waited for all fetches */
+        assert(chunk->ready && chunk->refcnt == 1);
+        g_hash_table_iter_remove(&iter);
+        QTAILQ_REMOVE(&c->lru, chunk, lru);
+        readahead_cache_chunk_unref(c, chunk);
+    }
+    assert(c->used == 0);
+
+    g_hash_table_destroy(c->chunks);
+    qemu_mutex_destroy(&c->lock);
+    g_free(c);
+}
+
+/*
+ * Allocate an empty chunk for @index and insert it in the table, evicting
+ * unused chunks if the memory budget requires it.  Returns NULL if nothing
+ * can be evicted.  Called with c->lock held.
+ */
+static ReadaheadCacheChunk *readahead_cache_chunk_new(ReadaheadCache *c,
+                                                      uint64_t index)
+{
+    ReadaheadCacheChunk *chunk, *next;
+
+    QTAILQ_FOREACH_SAFE(chunk, &c->lru, lru, next) {
+        if (c->used + READAHEAD_CACHE_CHUNK_SIZE <= c->size) {
+            break;
+        }
+        if (chunk->refcnt == 1) {
+            readahead_cache_chunk_evict(c, chunk);
+        }
+    }
+    if (c->used + READAHEAD_CACHE_CHUNK_SIZE > c->size) {
+        return NULL;
+    }
+
+    chunk = g_new0(ReadaheadCacheChunk, 1);
+    chunk->index = index;
+    chunk->bytes = MIN(READAHEAD_CACHE_CHUNK_SIZE,
+                       c->length - index * READAHEAD_CACHE_CHUNK_SIZE);
+    chunk->buf = g_malloc(chunk->bytes);
+    chunk->refcnt = 1;
+    qemu_co_queue_init(&chunk->waitq);
+
+    c->used += READAHEAD_CACHE_CHUNK_SIZE;
+    g_hash_table_insert(c->chunks, &chunk->index, chunk);
+
+    return chunk;
+}
+
+static void coroutine_fn readahead_cache_fetch_entry(void *opaque)
+{
+    ReadaheadCacheFetch *f = opaque;
+    ReadaheadCache *c = f->c;
+    QEMUIOVector qiov;
+    uint64_t offset = f->chunks[0]->index * READAHEAD_CACHE_CHUNK_SIZE;
+    uint64_t bytes = 0;
+    int i, ret;
+
+    qemu_iovec_init(&qiov, f->nb_chunks);
+    for (i = 0; i < f->nb_chunks; i++) {
+        qemu_iovec_add(&qiov, f->chunks[i]->buf, f->chunks[i]->bytes);
+        bytes += f->chunks[i]->bytes;
+    }
+
+    trace_readahead_cache_fetch(c, offset, bytes, f->readahead);
+    ret = c->fetch(c->opaque, offset, bytes, &qiov);
+    qemu_iovec_destroy(&qiov);
+
+    qemu_mutex_lock(&c->lock);
+    for (i = 0; i < f->nb_chunks; i++) {
+        ReadaheadCacheChunk *chunk = f->chunks[i];
+
+        chunk->ret = ret;
+        chunk->ready = true;
+        if (ret < 0) {
+            /* Let the next reader retry */
+            g_hash_table_remove(c->chunks, &chunk->index);
+            readahead_cache_chunk_unref(c, chunk);
+        } else {
+            QTAILQ_INSERT_TAIL(&c->lru, chunk, lru);
+        }
+        qemu_co_queue_restart_all(&chunk->waitq);
+        readahead_cache_chunk_unref(c, chunk);
+    }
+    qemu_mutex_unlock(&c->lock);
+
+    bdrv_dec_in_flight(c->bs);
+    g_free(f);
+}
+
+/* Called with c->lock held.  Takes ownership of *pf.  */
+static void readahead_cache_fetch_start(ReadaheadCache *c,
+                                        ReadaheadCacheFetch **pf)
+{
+    ReadaheadCacheFetch *f = *pf;
+    Coroutine *co;
+
+    *pf = NULL;
+    if (!f || !f->nb_chunks) {
+        g_free(f);
+        return;
+    }
+
+    /* The fetch can outlive the request, make drain wait for it */
+    bdrv_inc_in_flight(c->bs);
+    co = qemu_coroutine_create(readahead_cache_fetch_entry, f);
+    aio_co_enter(bdrv_get_aio_context(c->bs), co);
+}
+
+/*
+ * Add a chunk that was just created to the current run of missing chunks,
+ * starting a new fetch when the run gets too long.  Called with c->lock
+ * held.
+ */
+static void readahead_cache_fetch_add(ReadaheadCache *c,
+                                      ReadaheadCacheFetch **pf,
+                                      ReadaheadCacheChunk *chunk,
+                                      bool readahead)
+{
+    if (*pf && (*pf)->nb_chunks == READAHEAD_CACHE_MAX_REQ_CHUNKS) {
+        readahead_cache_fetch_start(c, pf);
+    }
+    if (!*pf) {
+        *pf = g_new0(ReadaheadCacheFetch, 1);
+        (*pf)->c = c;
+        (*pf)->readahead = readahead;
+    }
+
+    chunk->refcnt++;
+    (*pf)->chunks[(*pf)->nb_chunks++] = chunk;
+}
+
+/* Called with c->lock held.  */
+static void readahead_cache_update_window(ReadaheadCache *c,
+                                          uint64_t offset, uint64_t bytes)
+{
+    if (offset == c->next_offset) {
+        c->window = MIN(MAX(c->window * 2, c->min_window), c->max_window);
+    } else {
+        c->window = c->min_window;
+    }
+    c->next_offset = offset + bytes;
+}
+
+int coroutine_fn readahead_cache_co_preadv(ReadaheadCache *c,
+                                           uint64_t offset, uint64_t bytes,
+                                           QEMUIOVector *qiov)
+{
+    ReadaheadCacheFetch *f = NULL;
+    ReadaheadCacheChunk **pinned;
+    uint64_t first, last, ra_last, nb_pinned, i;
+    uint64_t end = offset + bytes;
+    size_t qiov_offset;
+    int ret = 0;
+
+    /* The block layer may round the last request up to its alignment */
+    if (end > c->length) {
+        uint64_t tail = end - MAX(offset, c->length);
+
+        qemu_iovec_memset(qiov, bytes - tail, 0, tail);
+        bytes -= tail;
+        end = offset + bytes;
+        if (!bytes) {
+            return 0;
+        }
+    }
+
+    /* Streaming a large request through the cache would only thrash it */
+    if (bytes > c->size / 2) {
+        return c->fetch(c->opaque, offset, bytes, qiov);
+    }
+
+    first = offset / READAHEAD_CACHE_CHUNK_SIZE;
+    last = (end - 1) / READAHEAD_CACHE_CHUNK_SIZE;
+    nb_pinned = last - first + 1;
+    pinned = g_new0(ReadaheadCacheChunk *, nb_pinned);
+
+    qemu_mutex_lock(&c->lock);
+    readahead_cache_update_window(c, offset, bytes);
+    ra_last = (MIN(end + c->window, c->length) - 1) /
+              READAHEAD_CACHE_CHUNK_SIZE;
+
+    for (i = first; i <= ra_last; i++) {
+        ReadaheadCacheChunk *chunk = g_hash_table_lookup(c->chunks, &i);
+
+        if (chunk) {
+            /* Already cached or in flight, start a new run after it */
+            readahead_cache_fetch_start(c, &f);
+        } else {
+            chunk = readahead_cache_chunk_new(c, i);
+            if (!chunk && i > last) {
+                break;
+            }
+            if (chunk) {
+                readahead_cache_fetch_add(c, &f, chunk, i > last);
+            }
+        }
+        if (i == last) {
+            /* Requested data and readahead go in separate fetches */
+            readahead_cache_fetch_start(c, &f);
+        }
+        if (i <= last && chunk) {
+            chunk->refcnt++;
+            pinned[i - first] = chunk;
+        }
+    }
+    readahead_cache_fetch_start(c, &f);
+    qemu_mutex_unlock(&c->lock);
+
+    qiov_offset = 0;
+    for (i = 0; i < nb_pinned; i++) {
+        ReadaheadCacheChunk *chunk = pinned[i];
+        uint64_t chunk_start = (first + i) * READAHEAD_CACHE_CHUNK_SIZE;
+        uint64_t start = MAX(offset, chunk_start);
+        uint64_t n = MIN(end, chunk_start + READAHEAD_CACHE_CHUNK_SIZE) -
+                     start;
+
+        if (!chunk) {
+            /* No room in the cache, read this piece directly */
+            if (ret == 0) {
+                QEMUIOVector slice;
+
+                qemu_iovec_init_slice(&slice, qiov, qiov_offset, n);
+                ret = c->fetch(c->opaque, start, n, &slice);
+                qemu_iovec_destroy(&slice);
+            }
+            qiov_offset += n;
+            continue;
+        }
+
+        qemu_mutex_lock(&c->lock);
+        while (!chunk->ready) {
+            qemu_co_queue_wait(&chunk->waitq, &c->lock);
+        }
+        if (ret == 0) {
+            ret = chunk->ret;
+        }
+        if (ret == 0) {
+            trace_readahead_cache_read(c, start, n);
+            qemu_iovec_from_buf(qiov, qiov_offset,
+                                chunk->buf + (start - chunk_start), n);
+            if (g_hash_table_lookup(c->chunks, &chunk->index) == chunk) {
+                QTAILQ_REMOVE(&c->lru, chunk, lru);
+                QTAILQ_INSERT_TAIL(&c->lru, chunk, lru);
+            }
+        }
+        readahead_cache_chunk_unref(c, chunk);
+        qemu_mutex_unlock(&c->lock);
+        qiov_offset += n;
+    }
+
+    g_free(pinned);
+    return ret;
+}
@@ -28,6 +28,7 @@
 #include <libssh/sftp.h>
 
 #include "block/block_int.h"
+#include "block/readahead-cache.h"
 #include "block/qdict.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
@@ -52,6 +53,12 @@
  */
 #define TRACE_LIBSSH  0 /* see: SSH_LOG_* */
 
+/* Default size of the read cache for read-only images */
+#define SSH_CACHE_SIZE_DEFAULT (16 * MiB)
+
+/* Initial readahead window of the read cache */
+#define SSH_READAHEAD_DEFAULT (256 * KiB)
+
 typedef struct BDRVSSHState {
     /* Coroutine. */
     CoMutex lock;
@@ -73,6 +80,9 @@ typedef struct BDRVSSHState {
     /* Used to warn if 'flush' is not supported. */
     bool unsafe_flush_warning;
 
+    /* Read cache, only used for read-only images. */
+    ReadaheadCache *cache;
+
     /*
      * Store the user name for ssh_refresh_filename() because the
      * default depends on the system you are on -- therefore, when we
@@ -847,6 +857,9 @@ static int connect_to_ssh(BDRVSSHState *s, BlockdevOptionsSsh *opts,
     return ret;
 }
 
+static int coroutine_fn ssh_co_fetch(void *opaque, uint64_t offset,
+                                     uint64_t bytes, QEMUIOVector *qiov);
+
 static int ssh_file_open(BlockDriverState *bs, QDict *options, int bdrv_flags,
                          Error **errp)
 {
@@ -882,6 +895,21 @@ static int ssh_file_open(BlockDriverState *bs, QDict *options, int bdrv_flags,
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
 
+    /*
+     * The ssh driver cannot be reopened, so a read-only image stays
+     * read-only and cached data never needs to be invalidated.
+     */
+    if (!(bdrv_flags & BDRV_O_RDWR)) {
+        uint64_t cache_size = opts->has_cache_size ? opts->cache_size :
+                              SSH_CACHE_SIZE_DEFAULT;
+
+        if (cache_size) {
+            s->cache = readahead_cache_new(bs, s->attrs->size, cache_size,
+                                           SSH_READAHEAD_DEFAULT,
+                                           ssh_co_fetch, bs);
+        }
+    }
+
     qapi_free_BlockdevOptionsSsh(opts);
 
     return 0;
@@ -1005,6 +1033,10 @@ static void ssh_close(BlockDriverState *bs)
 {
     BDRVSSHState *s = bs->opaque;
 
+    if (s->cache) {
+        readahead_cache_free(s->cache);
+        s->cache = NULL;
+    }
     ssh_state_free(s);
 }
 
@@ -1130,21 +1162,35 @@ static coroutine_fn int ssh_read(BDRVSSHState *s, BlockDriverState *bs,
     return 0;
 }
 
-static coroutine_fn int ssh_co_readv(BlockDriverState *bs,
-                                     int64_t sector_num,
-                                     int nb_sectors, QEMUIOVector *qiov)
+static int coroutine_fn ssh_co_fetch(void *opaque, uint64_t offset,
+                                     uint64_t bytes, QEMUIOVector *qiov)
 {
+    BlockDriverState *bs = opaque;
     BDRVSSHState *s = bs->opaque;
     int ret;
 
     qemu_co_mutex_lock(&s->lock);
-    ret = ssh_read(s, bs, sector_num * BDRV_SECTOR_SIZE,
-                   nb_sectors * BDRV_SECTOR_SIZE, qiov);
+    ret = ssh_read(s, bs, offset, bytes, qiov);
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
 }
 
+static coroutine_fn int ssh_co_readv(BlockDriverState *bs,
+                                     int64_t sector_num,
+                                     int nb_sectors, QEMUIOVector *qiov)
+{
+    BDRVSSHState *s = bs->opaque;
+
+    if (s->cache) {
+        return readahead_cache_co_preadv(s->cache,
+                                         sector_num * BDRV_SECTOR_SIZE,
+                                         nb_sectors * BDRV_SECTOR_SIZE, qiov);
+    }
+    return ssh_co_fetch(bs, sector_num * BDRV_SECTOR_SIZE,
+                        nb_sectors * BDRV_SECTOR_SIZE, qiov);
+}
+
 static int ssh_write(BDRVSSHState *s, BlockDriverState *bs,
                      int64_t offset, size_t size,
                      QEMUIOVector *qiov)
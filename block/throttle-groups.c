@@ -29,12 +29,23 @@
 #include "qemu/main-loop.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
+#include "qemu/units.h"
 #include "sysemu/qtest.h"
 #include "qapi/error.h"
 #include "qapi/qapi-visit-block-core.h"
 #include "qom/object.h"
 #include "qom/object_interfaces.h"
 
+/* Fixed-point scale of ThrottleGroupMember.credit_units */
+#define THROTTLE_GROUP_UNIT_SCALE 1024
+
+/* A member is handed credit for this much time worth of the group's limits */
+#define THROTTLE_GROUP_CREDIT_NS (10 * SCALE_MS)
+
+/* Credit handed out when a limit is not set */
+#define THROTTLE_GROUP_CREDIT_MAX_BYTES (64 * MiB)
+#define THROTTLE_GROUP_CREDIT_MAX_OPS   1024
+
 static void throttle_group_obj_init(Object *obj);
 static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
 static void timer_cb(ThrottleGroupMember *tgm, bool is_write);
@@ -70,9 +81,10 @@ struct ThrottleGroup {
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    QemuMutex lock; /* This lock protects the following five fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
+    unsigned int nb_members;
     ThrottleGroupMember *tokens[2];
     bool any_timer_armed[2];
     QEMUClockType clock_type;
@@ -286,7 +298,7 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
     /* If a timer just got armed, set tgm as the current token */
     if (must_wait) {
         tg->tokens[is_write] = tgm;
-        tg->any_timer_armed[is_write] = true;
+        qatomic_set(&tg->any_timer_armed[is_write], true);
     }
 
     return must_wait;
@@ -343,16 +355,156 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
             ThrottleTimers *tt = &token->throttle_timers;
             int64_t now = qemu_clock_get_ns(tg->clock_type);
             timer_mod(tt->timers[is_write], now);
-            tg->any_timer_armed[is_write] = true;
+            qatomic_set(&tg->any_timer_armed[is_write], true);
         }
         tg->tokens[is_write] = token;
     }
 }
 
+/* Return the cost of a request in operations, scaled by
+ * THROTTLE_GROUP_UNIT_SCALE. This mirrors throttle_account().
+ *
+ * @ts:     the ThrottleState of the group
+ * @bytes:  the number of bytes for this I/O
+ */
+static int throttle_group_units(ThrottleState *ts, unsigned int bytes)
+{
+    uint64_t op_size = ts->cfg.op_size;
+
+    if (op_size && bytes > op_size) {
+        return MIN((uint64_t)bytes * THROTTLE_GROUP_UNIT_SCALE / op_size,
+                   INT_MAX);
+    }
+    return THROTTLE_GROUP_UNIT_SCALE;
+}
+
+static bool tgm_take_credit(int *credit, int amount)
+{
+    int old = qatomic_read(credit);
+
+    while (old >= amount) {
+        int prev = qatomic_cmpxchg(credit, old, old - amount);
+        if (prev == old) {
+            return true;
+        }
+        old = prev;
+    }
+    return false;
+}
+
+/* Let an I/O request through without taking the group lock if the group
+ * is not throttling this type of request and the member still has enough
+ * credit for it.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @is_write:  the type of operation (read/write)
+ * @ret:       whether the request was accounted for
+ */
+static bool throttle_group_take_credit(ThrottleGroupMember *tgm,
+                                       unsigned int bytes, bool is_write)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    int units;
+
+    /* Don't overtake throttled requests, ours or the other members' */
+    if (qatomic_read(&tg->any_timer_armed[is_write]) ||
+        qatomic_read(&tgm->pending_reqs[is_write]) ||
+        bytes > INT_MAX) {
+        return false;
+    }
+
+    units = throttle_group_units(ts, bytes);
+    if (!tgm_take_credit(&tgm->credit_bytes[is_write], bytes)) {
+        return false;
+    }
+    if (!tgm_take_credit(&tgm->credit_units[is_write], units)) {
+        qatomic_add(&tgm->credit_bytes[is_write], bytes);
+        return false;
+    }
+    return true;
+}
+
+/* Return how much credit a member may hold for one type of limit: its
+ * share of the tightest of the applicable limits over
+ * THROTTLE_GROUP_CREDIT_NS, so that idle members cannot hold back much of
+ * the group's budget.
+ *
+ * This assumes that tg->lock is held.
+ */
+static int64_t throttle_group_credit_size(ThrottleState *ts,
+                                          BucketType total, BucketType rw,
+                                          uint32_t scale, int64_t max)
+{
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    BucketType types[2] = { total, rw };
+    int64_t credit = max;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        uint64_t avg = ts->cfg.buckets[types[i]].avg;
+
+        if (avg) {
+            credit = MIN(credit, muldiv64(avg * scale,
+                                          THROTTLE_GROUP_CREDIT_NS,
+                                          NANOSECONDS_PER_SECOND));
+        }
+    }
+    return credit / MAX(tg->nb_members, 1);
+}
+
+/* Top up the credit of a member, accounting it to the group in advance, if
+ * the group is not close to its limits for this type of request.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @is_write:  the type of operation (read/write)
+ */
+static void throttle_group_refill_credit(ThrottleGroupMember *tgm,
+                                         bool is_write)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    int64_t bytes, units;
+
+    if (tg->any_timer_armed[is_write] || tgm->pending_reqs[is_write]) {
+        return;
+    }
+
+    bytes = throttle_group_credit_size(ts, THROTTLE_BPS_TOTAL,
+                                       is_write ? THROTTLE_BPS_WRITE
+                                                : THROTTLE_BPS_READ,
+                                       1, THROTTLE_GROUP_CREDIT_MAX_BYTES);
+    units = throttle_group_credit_size(ts, THROTTLE_OPS_TOTAL,
+                                       is_write ? THROTTLE_OPS_WRITE
+                                                : THROTTLE_OPS_READ,
+                                       THROTTLE_GROUP_UNIT_SCALE,
+                                       THROTTLE_GROUP_CREDIT_MAX_OPS *
+                                       THROTTLE_GROUP_UNIT_SCALE);
+
+    bytes = MAX(bytes - qatomic_read(&tgm->credit_bytes[is_write]), 0);
+    units = MAX(units - qatomic_read(&tgm->credit_units[is_write]), 0);
+    if (!bytes && !units) {
+        return;
+    }
+
+    if (throttle_reserve(ts, is_write, qemu_clock_get_ns(tg->clock_type),
+                         bytes, (double)units / THROTTLE_GROUP_UNIT_SCALE)) {
+        qatomic_add(&tgm->credit_bytes[is_write], bytes);
+        qatomic_add(&tgm->credit_units[is_write], units);
+    }
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
  *
+ * Requests that the member has credit for are let through without taking
+ * the group lock; credit is handed out in the slow path as long as the
+ * group is not throttling.
+ *
  * @tgm:       the current ThrottleGroupMember
  * @bytes:     the number of bytes for this I/O
  * @is_write:  the type of operation (read/write)
@@ -364,6 +516,11 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     bool must_wait;
     ThrottleGroupMember *token;
     ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    if (throttle_group_take_credit(tgm, bytes, is_write)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -388,6 +545,8 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
 
+    throttle_group_refill_credit(tgm, is_write);
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -470,8 +629,18 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleGroupMember *iter;
+    int i;
+
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    /* Credit was sized and accounted under the old limits */
+    QLIST_FOREACH(iter, &tg->head, round_robin) {
+        for (i = 0; i < 2; i++) {
+            qatomic_set(&iter->credit_bytes[i], 0);
+            qatomic_set(&iter->credit_units[i], 0);
+        }
+    }
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -506,7 +675,7 @@ static void timer_cb(ThrottleGroupMember *tgm, bool is_write)
 
     /* The timer has just been fired, so we can update the flag */
     qemu_mutex_lock(&tg->lock);
-    tg->any_timer_armed[is_write] = false;
+    qatomic_set(&tg->any_timer_armed[is_write], false);
     qemu_mutex_unlock(&tg->lock);
 
     /* Run the request that was waiting for this timer */
@@ -545,6 +714,10 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     tgm->throttle_state = ts;
     tgm->aio_context = ctx;
     qatomic_set(&tgm->restart_pending, 0);
+    for (i = 0; i < 2; i++) {
+        qatomic_set(&tgm->credit_bytes[i], 0);
+        qatomic_set(&tgm->credit_units[i], 0);
+    }
 
     qemu_mutex_lock(&tg->lock);
     /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
@@ -555,6 +728,7 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     }
 
     QLIST_INSERT_HEAD(&tg->head, tgm, round_robin);
+    tg->nb_members++;
 
     throttle_timers_init(&tgm->throttle_timers,
                          tgm->aio_context,
@@ -611,6 +785,7 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
 
     /* remove the current tgm from the list */
     QLIST_REMOVE(tgm, round_robin);
+    tg->nb_members--;
     throttle_timers_destroy(&tgm->throttle_timers);
     qemu_mutex_unlock(&tg->lock);
 
@@ -641,7 +816,7 @@ void throttle_group_detach_aio_context(ThrottleGroupMember *tgm)
     qemu_mutex_lock(&tg->lock);
     for (i = 0; i < 2; i++) {
         if (timer_pending(tt->timers[i])) {
-            tg->any_timer_armed[i] = false;
+            qatomic_set(&tg->any_timer_armed[i], false);
             schedule_next_request(tgm, i);
         }
     }
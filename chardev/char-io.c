@@ -22,6 +22,7 @@
  * THE SOFTWARE.
  */
 #include "qemu/osdep.h"
+#include "qemu/iov.h"
 #include "chardev/char-io.h"
 
 typedef struct IOWatchPoll {
@@ -109,36 +110,50 @@ void remove_fd_in_watch(Chardev *chr)
     }
 }
 
-int io_channel_send_full(QIOChannel *ioc,
-                         const void *buf, size_t len,
-                         int *fds, size_t nfds)
+int io_channel_sendv_full(QIOChannel *ioc,
+                          const struct iovec *iov, unsigned int niov,
+                          int *fds, size_t nfds)
 {
+    size_t len = iov_size(iov, niov);
     size_t offset = 0;
+    struct iovec *local = g_memdup(iov, niov * sizeof(*iov));
+    struct iovec *cur = local;
+    unsigned int cnt = niov;
+    int res = 0;
 
     while (offset < len) {
         ssize_t ret = 0;
-        struct iovec iov = { .iov_base = (char *)buf + offset,
-                             .iov_len = len - offset };
 
         ret = qio_channel_writev_full(
-            ioc, &iov, 1,
+            ioc, cur, cnt,
             fds, nfds, NULL);
         if (ret == QIO_CHANNEL_ERR_BLOCK) {
-            if (offset) {
-                return offset;
+            if (!offset) {
+                errno = EAGAIN;
+                res = -1;
             }
-
-            errno = EAGAIN;
-            return -1;
+            break;
         } else if (ret < 0) {
             errno = EINVAL;
-            return -1;
+            res = -1;
+            break;
         }
 
         offset += ret;
+        iov_discard_front(&cur, &cnt, ret);
     }
 
-    return offset;
+    g_free(local);
+    return res < 0 ? res : offset;
+}
+
+int io_channel_send_full(QIOChannel *ioc,
+                         const void *buf, size_t len,
+                         int *fds, size_t nfds)
+{
+    struct iovec iov = { .iov_base = (char *)buf, .iov_len = len };
+
+    return io_channel_sendv_full(ioc, &iov, 1, fds, nfds);
 }
 
 int io_channel_send(QIOChannel *ioc, const void *buf, size_t len)
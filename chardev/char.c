@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/iov.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
 #include "qemu/config-file.h"
@@ -182,6 +183,46 @@ int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
     return offset;
 }
 
+int qemu_chr_writev(Chardev *s, const struct iovec *iov, int iovcnt)
+{
+    ChardevClass *cc = CHARDEV_GET_CLASS(s);
+    int offset = 0;
+    int res = 0;
+    int i;
+
+    /*
+     * Backends without a vectored write, and replay, which records every
+     * write as one event, go through qemu_chr_write() buffer by buffer.
+     */
+    if (!cc->chr_writev || qemu_chr_replay(s)) {
+        for (i = 0; i < iovcnt; i++) {
+            res = qemu_chr_write(s, iov[i].iov_base, iov[i].iov_len, false);
+            if (res < 0) {
+                return offset ? offset : res;
+            }
+            offset += res;
+            if (res < iov[i].iov_len) {
+                break;
+            }
+        }
+        return offset;
+    }
+
+    qemu_mutex_lock(&s->chr_write_lock);
+    res = cc->chr_writev(s, iov, iovcnt);
+    /* As in qemu_chr_write_buffer(), log everything on fatal errors */
+    offset = res < 0 && errno != EAGAIN ? iov_size(iov, iovcnt) : res;
+    for (i = 0; i < iovcnt && offset > 0; i++) {
+        size_t len = MIN(iov[i].iov_len, offset);
+
+        qemu_chr_write_log(s, iov[i].iov_base, len);
+        offset -= len;
+    }
+    qemu_mutex_unlock(&s->chr_write_lock);
+
+    return res;
+}
+
 int qemu_chr_be_can_write(Chardev *s)
 {
     CharBackend *be = s->be;
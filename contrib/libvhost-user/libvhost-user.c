@@ -139,6 +139,7 @@ vu_request_to_string(unsigned int req)
         REQ(VHOST_USER_GET_MAX_MEM_SLOTS),
         REQ(VHOST_USER_ADD_MEM_REG),
         REQ(VHOST_USER_REM_MEM_REG),
+        REQ(VHOST_USER_GET_VRING_STATS),
         REQ(VHOST_USER_MAX),
     };
 #undef REQ
@@ -487,6 +488,8 @@ vu_kick_cb(VuDev *dev, int condition, void *data)
     } else {
         DPRINT("Got kick_data: %016"PRIx64" handler:%p idx:%d\n",
                kick_data, vq->handler, index);
+        /* The eventfd counter adds up kicks since the last read */
+        vq->kicks += kick_data;
         if (vq->handler) {
             vq->handler(dev, index);
         }
@@ -1108,6 +1111,9 @@ vu_set_vring_base_exec(VuDev *dev, VhostUserMsg *vmsg)
     DPRINT("State.index: %u\n", index);
     DPRINT("State.num:   %u\n", num);
     dev->vq[index].shadow_avail_idx = dev->vq[index].last_avail_idx = num;
+    dev->vq[index].kicks = 0;
+    dev->vq[index].calls = 0;
+    dev->vq[index].suppressed_calls = 0;
 
     return false;
 }
@@ -1412,7 +1418,8 @@ vu_get_protocol_features_exec(VuDev *dev, VhostUserMsg *vmsg)
                         1ULL << VHOST_USER_PROTOCOL_F_HOST_NOTIFIER |
                         1ULL << VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD |
                         1ULL << VHOST_USER_PROTOCOL_F_REPLY_ACK |
-                        1ULL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS;
+                        1ULL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS |
+                        1ULL << VHOST_USER_PROTOCOL_F_VRING_STATS;
 
     if (have_userfault()) {
         features |= 1ULL << VHOST_USER_PROTOCOL_F_PAGEFAULT;
@@ -1730,6 +1737,7 @@ vu_handle_vring_kick(VuDev *dev, VhostUserMsg *vmsg)
 
     DPRINT("Got kick message: handler:%p idx:%u\n",
            dev->vq[index].handler, index);
+    dev->vq[index].kicks++;
 
     if (!dev->vq[index].started) {
         dev->vq[index].started = true;
@@ -1746,6 +1754,26 @@ vu_handle_vring_kick(VuDev *dev, VhostUserMsg *vmsg)
     return false;
 }
 
+static bool
+vu_get_vring_stats(VuDev *dev, VhostUserMsg *vmsg)
+{
+    unsigned int index = vmsg->payload.vring_stats.index;
+    VuVirtq *vq;
+
+    if (index >= dev->max_queues) {
+        vu_panic(dev, "Invalid queue index: %u", index);
+        return false;
+    }
+
+    vq = &dev->vq[index];
+    vmsg->payload.vring_stats.kicks = vq->kicks;
+    vmsg->payload.vring_stats.calls = vq->calls;
+    vmsg->payload.vring_stats.suppressed_calls = vq->suppressed_calls;
+    vmsg->size = sizeof(vmsg->payload.vring_stats);
+
+    return true;
+}
+
 static bool vu_handle_get_max_memslots(VuDev *dev, VhostUserMsg *vmsg)
 {
     vmsg->flags = VHOST_USER_REPLY_MASK | VHOST_USER_VERSION;
@@ -1852,6 +1880,8 @@ vu_process_message(VuDev *dev, VhostUserMsg *vmsg)
         return vu_add_mem_reg(dev, vmsg);
     case VHOST_USER_REM_MEM_REG:
         return vu_rem_mem_reg(dev, vmsg);
+    case VHOST_USER_GET_VRING_STATS:
+        return vu_get_vring_stats(dev, vmsg);
     default:
         vmsg_close_fds(vmsg);
         vu_panic(dev, "Unhandled request: %d", vmsg->request);
@@ -2325,8 +2355,10 @@ static void _vu_queue_notify(VuDev *dev, VuVirtq *vq, bool sync)
 
     if (!vring_notify(dev, vq)) {
         DPRINT("skipped notify...\n");
+        vq->suppressed_calls++;
         return;
     }
+    vq->calls++;
 
     if (vq->call_fd < 0 &&
         vu_has_protocol_feature(dev,
@@ -2618,11 +2650,39 @@ vu_queue_inflight_post_put(VuDev *dev, VuVirtq *vq, int desc_idx)
     return 0;
 }
 
+/* Pops the element at last_avail_idx, which the caller knows is there. */
+static void *
+vu_queue_pop_avail(VuDev *dev, VuVirtq *vq, size_t sz)
+{
+    unsigned int head;
+    VuVirtqElement *elem;
+
+    if (vq->inuse >= vq->vring.num) {
+        vu_panic(dev, "Virtqueue size exceeded");
+        return NULL;
+    }
+
+    if (!virtqueue_get_head(dev, vq, vq->last_avail_idx++, &head)) {
+        return NULL;
+    }
+
+    elem = vu_queue_map_desc(dev, vq, head, sz);
+
+    if (!elem) {
+        return NULL;
+    }
+
+    vq->inuse++;
+
+    vu_queue_inflight_get(dev, vq, head);
+
+    return elem;
+}
+
 void *
 vu_queue_pop(VuDev *dev, VuVirtq *vq, size_t sz)
 {
     int i;
-    unsigned int head;
     VuVirtqElement *elem;
 
     if (unlikely(dev->broken) ||
@@ -2651,30 +2711,53 @@ vu_queue_pop(VuDev *dev, VuVirtq *vq, size_t sz)
      */
     smp_rmb();
 
-    if (vq->inuse >= vq->vring.num) {
-        vu_panic(dev, "Virtqueue size exceeded");
-        return NULL;
-    }
-
-    if (!virtqueue_get_head(dev, vq, vq->last_avail_idx++, &head)) {
-        return NULL;
-    }
+    elem = vu_queue_pop_avail(dev, vq, sz);
 
     if (vu_has_feature(dev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
-    elem = vu_queue_map_desc(dev, vq, head, sz);
+    return elem;
+}
 
-    if (!elem) {
-        return NULL;
+unsigned int
+vu_queue_pop_batch(VuDev *dev, VuVirtq *vq, size_t sz,
+                   void **elems, unsigned int max)
+{
+    unsigned int n = 0;
+    int num;
+
+    if (unlikely(dev->broken) ||
+        unlikely(!vq->vring.avail)) {
+        return 0;
     }
 
-    vq->inuse++;
+    if (unlikely(vq->resubmit_list && vq->resubmit_num > 0)) {
+        while (n < max && (elems[n] = vu_queue_pop(dev, vq, sz))) {
+            n++;
+        }
+        return n;
+    }
 
-    vu_queue_inflight_get(dev, vq, head);
+    /* One avail index read and one barrier for the whole batch */
+    num = virtqueue_num_heads(dev, vq, vq->last_avail_idx);
+    if (num <= 0) {
+        return 0;
+    }
 
-    return elem;
+    while (n < MIN((unsigned int)num, max)) {
+        elems[n] = vu_queue_pop_avail(dev, vq, sz);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+
+    if (vu_has_feature(dev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    return n;
 }
 
 static void
@@ -2839,3 +2922,27 @@ vu_queue_push(VuDev *dev, VuVirtq *vq,
     vu_queue_flush(dev, vq, 1);
     vu_queue_inflight_post_put(dev, vq, elem->index);
 }
+
+void
+vu_queue_push_batch(VuDev *dev, VuVirtq *vq,
+                    VuVirtqElement * const *elems, const unsigned int *lens,
+                    unsigned int num)
+{
+    unsigned int i;
+
+    /*
+     * The inflight region records a single in-progress used ring update,
+     * so with it the elements are completed one by one.
+     */
+    if (vu_has_protocol_feature(dev, VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD)) {
+        for (i = 0; i < num; i++) {
+            vu_queue_push(dev, vq, elems[i], lens[i]);
+        }
+        return;
+    }
+
+    for (i = 0; i < num; i++) {
+        vu_queue_fill(dev, vq, elems[i], lens[i], i);
+    }
+    vu_queue_flush(dev, vq, num);
+}
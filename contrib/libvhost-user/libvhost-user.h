@@ -64,6 +64,7 @@ enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD = 12,
     VHOST_USER_PROTOCOL_F_INBAND_NOTIFICATIONS = 14,
     VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 15,
+    VHOST_USER_PROTOCOL_F_VRING_STATS = 17,
 
     VHOST_USER_PROTOCOL_F_MAX
 };
@@ -109,6 +110,7 @@ typedef enum VhostUserRequest {
     VHOST_USER_GET_MAX_MEM_SLOTS = 36,
     VHOST_USER_ADD_MEM_REG = 37,
     VHOST_USER_REM_MEM_REG = 38,
+    VHOST_USER_GET_VRING_STATS = 41,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -170,6 +172,14 @@ typedef struct VhostUserInflight {
     uint16_t queue_size;
 } VhostUserInflight;
 
+typedef struct VhostUserVringStats {
+    uint32_t index;
+    uint32_t padding;
+    uint64_t kicks;
+    uint64_t calls;
+    uint64_t suppressed_calls;
+} VhostUserVringStats;
+
 #if defined(_WIN32) && (defined(__x86_64__) || defined(__i386__))
 # define VU_PACKED __attribute__((gcc_struct, packed))
 #else
@@ -197,6 +207,7 @@ typedef struct VhostUserMsg {
         VhostUserConfig config;
         VhostUserVringArea area;
         VhostUserInflight inflight;
+        VhostUserVringStats vring_stats;
     } payload;
 
     int fds[VHOST_MEMORY_BASELINE_NREGIONS];
@@ -353,6 +364,11 @@ typedef struct VuVirtq {
 
     /* Guest addresses of our ring */
     struct vhost_vring_addr vra;
+
+    /* Notification counters, reported by VHOST_USER_GET_VRING_STATS */
+    uint64_t kicks;
+    uint64_t calls;
+    uint64_t suppressed_calls;
 } VuVirtq;
 
 enum VuWatchCondtion {
@@ -595,6 +611,23 @@ void vu_queue_notify_sync(VuDev *dev, VuVirtq *vq);
  */
 void *vu_queue_pop(VuDev *dev, VuVirtq *vq, size_t sz);
 
+/**
+ * vu_queue_pop_batch:
+ * @dev: a VuDev context
+ * @vq: a VuVirtq queue
+ * @sz: the size of struct to return (must be >= VuVirtqElement)
+ * @elems: array receiving the popped elements
+ * @max: number of entries in @elems
+ *
+ * Like vu_queue_pop(), but pops up to @max elements at once, reading the
+ * available index and updating the avail event only once.
+ *
+ * Returns: the number of elements stored in @elems. Each of them must be
+ * free()-d by the caller.
+ */
+unsigned int vu_queue_pop_batch(VuDev *dev, VuVirtq *vq, size_t sz,
+                                void **elems, unsigned int max);
+
 
 /**
  * vu_queue_unpop:
@@ -649,6 +682,21 @@ void vu_queue_fill(VuDev *dev, VuVirtq *vq,
 void vu_queue_push(VuDev *dev, VuVirtq *vq,
                    const VuVirtqElement *elem, unsigned int len);
 
+/**
+ * vu_queue_push_batch:
+ * @dev: a VuDev context
+ * @vq: a VuVirtq queue
+ * @elems: the VuVirtqElements to complete
+ * @lens: length in bytes written to each element
+ * @num: number of elements
+ *
+ * Fills the used ring with @num elements and makes them visible with a
+ * single used index update.
+ */
+void vu_queue_push_batch(VuDev *dev, VuVirtq *vq,
+                         VuVirtqElement * const *elems,
+                         const unsigned int *lens, unsigned int num);
+
 /**
  * vu_queue_flush:
  * @dev: a VuDev context
@@ -18,6 +18,7 @@
 QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 
 static bool do_inline;
+static int n_vcpus;
 
 /* Plugins need to take care of their own locking */
 static GMutex lock;
@@ -37,8 +38,21 @@ typedef struct {
     uint64_t exec_count;
     int      trans_count;
     unsigned long insns;
+    uint64_t *vcpu_exec_count; /* inline counts, one per vCPU */
 } ExecCount;
 
+static void sum_exec_count(gpointer key, gpointer value, gpointer user_data)
+{
+    ExecCount *cnt = (ExecCount *) value;
+    int i;
+
+    if (cnt->vcpu_exec_count) {
+        for (i = 0; i < n_vcpus; i++) {
+            cnt->exec_count += cnt->vcpu_exec_count[i];
+        }
+    }
+}
+
 static gint cmp_exec_count(gconstpointer a, gconstpointer b)
 {
     ExecCount *ea = (ExecCount *) a;
@@ -53,6 +67,7 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
     int i;
 
     g_mutex_lock(&lock);
+    g_hash_table_foreach(hotblocks, sum_exec_count, NULL);
     g_string_append_printf(report, "%d entries in the hash table\n",
                            g_hash_table_size(hotblocks));
     counts = g_hash_table_get_values(hotblocks);
@@ -94,7 +109,8 @@ static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
 }
 
 /*
- * When do_inline we ask the plugin to increment the counter for us.
+ * When do_inline we ask the plugin to increment the counter for us,
+ * in a per-vCPU scoreboard when the number of vCPUs is known.
  * Otherwise a helper is inserted which calls the vcpu_tb_exec
  * callback.
  */
@@ -114,12 +130,19 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         cnt->start_addr = pc;
         cnt->trans_count = 1;
         cnt->insns = insns;
+        if (do_inline && n_vcpus > 0) {
+            cnt->vcpu_exec_count = g_new0(uint64_t, n_vcpus);
+        }
         g_hash_table_insert(hotblocks, (gpointer) hash, (gpointer) cnt);
     }
 
     g_mutex_unlock(&lock);
 
-    if (do_inline) {
+    if (do_inline && cnt->vcpu_exec_count) {
+        qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+            tb, QEMU_PLUGIN_INLINE_ADD_U64, cnt->vcpu_exec_count,
+            sizeof(uint64_t), 1);
+    } else if (do_inline) {
         qemu_plugin_register_vcpu_tb_exec_inline(tb, QEMU_PLUGIN_INLINE_ADD_U64,
                                                  &cnt->exec_count, 1);
     } else {
@@ -136,6 +159,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
     if (argc && strcmp(argv[0], "inline") == 0) {
         do_inline = true;
     }
+    /* user-mode has no fixed number of vCPUs, count in a single place */
+    if (info->system_emulation) {
+        n_vcpus = info->system.max_vcpus;
+    }
 
     plugin_init();
 
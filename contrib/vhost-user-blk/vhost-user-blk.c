@@ -27,6 +27,8 @@
 
 enum {
     VHOST_USER_BLK_MAX_QUEUES = 8,
+    /* Requests popped and completed at once */
+    VHOST_USER_BLK_POP_BATCH = 32,
 };
 
 struct virtio_blk_inhdr {
@@ -97,23 +99,6 @@ static void vub_panic_cb(VuDev *vu_dev, const char *buf)
     g_main_loop_quit(vdev_blk->loop);
 }
 
-static void vub_req_complete(VubReq *req)
-{
-    VugDev *gdev = &req->vdev_blk->parent;
-    VuDev *vu_dev = &gdev->parent;
-
-    /* IO size with 1 extra status byte */
-    vu_queue_push(vu_dev, req->vq, req->elem,
-                  req->size + 1);
-    vu_queue_notify(vu_dev, req->vq);
-
-    if (req->elem) {
-        free(req->elem);
-    }
-
-    g_free(req);
-}
-
 static int vub_open(const char *file_name, bool wce)
 {
     int fd;
@@ -225,26 +210,22 @@ vub_flush(VubReq *req)
     fdatasync(vdev_blk->blk_fd);
 }
 
-static int vub_virtio_process_req(VubDev *vdev_blk,
-                                     VuVirtq *vq)
+/*
+ * Serves the request in @elem and returns the number of bytes written to
+ * the guest, or -1 if the request is malformed.
+ */
+static ssize_t vub_virtio_process_req(VubDev *vdev_blk, VuVirtq *vq,
+                                      VuVirtqElement *elem)
 {
-    VugDev *gdev = &vdev_blk->parent;
-    VuDev *vu_dev = &gdev->parent;
-    VuVirtqElement *elem;
     uint32_t type;
     unsigned in_num;
     unsigned out_num;
+    ssize_t len;
     VubReq *req;
 
-    elem = vu_queue_pop(vu_dev, vq, sizeof(VuVirtqElement) + sizeof(VubReq));
-    if (!elem) {
-        return -1;
-    }
-
     /* refer to hw/block/virtio_blk.c */
     if (elem->out_num < 1 || elem->in_num < 1) {
         fprintf(stderr, "virtio-blk request missing headers\n");
-        free(elem);
         return -1;
     }
 
@@ -288,13 +269,11 @@ static int vub_virtio_process_req(VubDev *vdev_blk,
         } else {
             req->in->status = VIRTIO_BLK_S_IOERR;
         }
-        vub_req_complete(req);
         break;
     }
     case VIRTIO_BLK_T_FLUSH:
         vub_flush(req);
         req->in->status = VIRTIO_BLK_S_OK;
-        vub_req_complete(req);
         break;
     case VIRTIO_BLK_T_GET_ID: {
         size_t size = MIN(vub_iov_size(&elem->in_sg[0], in_num),
@@ -302,7 +281,6 @@ static int vub_virtio_process_req(VubDev *vdev_blk,
         snprintf(elem->in_sg[0].iov_base, size, "%s", "vhost_user_blk");
         req->in->status = VIRTIO_BLK_S_OK;
         req->size = elem->in_sg[0].iov_len;
-        vub_req_complete(req);
         break;
     }
     case VIRTIO_BLK_T_DISCARD:
@@ -314,19 +292,19 @@ static int vub_virtio_process_req(VubDev *vdev_blk,
         } else {
             req->in->status = VIRTIO_BLK_S_IOERR;
         }
-        vub_req_complete(req);
         break;
     }
     default:
         req->in->status = VIRTIO_BLK_S_UNSUPP;
-        vub_req_complete(req);
         break;
     }
 
-    return 0;
+    /* IO size with 1 extra status byte */
+    len = req->size + 1;
+    g_free(req);
+    return len;
 
 err:
-    free(elem);
     g_free(req);
     return -1;
 }
@@ -336,7 +314,6 @@ static void vub_process_vq(VuDev *vu_dev, int idx)
     VugDev *gdev;
     VubDev *vdev_blk;
     VuVirtq *vq;
-    int ret;
 
     gdev = container_of(vu_dev, VugDev, parent);
     vdev_blk = container_of(gdev, VubDev, parent);
@@ -345,11 +322,40 @@ static void vub_process_vq(VuDev *vu_dev, int idx)
     vq = vu_get_queue(vu_dev, idx);
     assert(vq);
 
+    /*
+     * Requests are served synchronously, so complete each batch with a
+     * single used ring update and notification.
+     */
     while (1) {
-        ret = vub_virtio_process_req(vdev_blk, vq);
-        if (ret) {
+        VuVirtqElement *elems[VHOST_USER_BLK_POP_BATCH];
+        unsigned int lens[VHOST_USER_BLK_POP_BATCH];
+        unsigned int i, n, done = 0;
+
+        n = vu_queue_pop_batch(vu_dev, vq,
+                               sizeof(VuVirtqElement) + sizeof(VubReq),
+                               (void **)elems, ARRAY_SIZE(elems));
+        if (!n) {
             break;
         }
+
+        for (i = 0; i < n; i++) {
+            ssize_t len = vub_virtio_process_req(vdev_blk, vq, elems[i]);
+
+            if (len < 0) {
+                free(elems[i]);
+                continue;
+            }
+            elems[done] = elems[i];
+            lens[done++] = len;
+        }
+
+        if (done) {
+            vu_queue_push_batch(vu_dev, vq, elems, lens, done);
+            vu_queue_notify(vu_dev, vq);
+        }
+        for (i = 0; i < done; i++) {
+            free(elems[i]);
+        }
     }
 }
 
@@ -387,6 +393,9 @@ vub_get_features(VuDev *dev)
     if (vdev_blk->enable_ro) {
         features |= 1ull << VIRTIO_BLK_F_RO;
     }
+    if (vdev_blk->blkcfg.num_queues > 1) {
+        features |= 1ull << VIRTIO_BLK_F_MQ;
+    }
 
     return features;
 }
@@ -581,6 +590,7 @@ static char *opt_socket_path;
 static char *opt_blk_file;
 static gboolean opt_print_caps;
 static gboolean opt_read_only;
+static int opt_num_queues = 1;
 
 static GOptionEntry entries[] = {
     { "print-capabilities", 'c', 0, G_OPTION_ARG_NONE, &opt_print_caps,
@@ -592,7 +602,10 @@ static GOptionEntry entries[] = {
     {"blk-file", 'b', 0, G_OPTION_ARG_FILENAME, &opt_blk_file,
      "block device or file path", "PATH"},
     { "read-only", 'r', 0, G_OPTION_ARG_NONE, &opt_read_only,
-      "Enable read-only", NULL }
+      "Enable read-only", NULL },
+    { "num-queues", 'n', 0, G_OPTION_ARG_INT, &opt_num_queues,
+      "Number of virtqueues (default 1)", "NUM" },
+    { NULL }
 };
 
 int main(int argc, char **argv)
@@ -624,6 +637,12 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    if (opt_num_queues < 1 || opt_num_queues > VHOST_USER_BLK_MAX_QUEUES) {
+        g_printerr("num-queues must be between 1 and %d\n",
+                   VHOST_USER_BLK_MAX_QUEUES);
+        exit(EXIT_FAILURE);
+    }
+
     if (opt_socket_path) {
         lsock = unix_sock_new(opt_socket_path);
         if (lsock < 0) {
@@ -649,6 +668,7 @@ int main(int argc, char **argv)
     if (opt_read_only) {
         vdev_blk->enable_ro = true;
     }
+    vdev_blk->blkcfg.num_queues = opt_num_queues;
 
     if (!vug_init(&vdev_blk->parent, VHOST_USER_BLK_MAX_QUEUES, csock,
                   vub_panic_cb, &vub_iface)) {
@@ -1599,3 +1599,98 @@ void AES_decrypt(const unsigned char *in, unsigned char *out,
 }
 
 #endif /* AES_ASM */
+
+#ifdef CONFIG_AESNI_OPT
+#pragma GCC push_options
+#pragma GCC target("aes")
+#include <wmmintrin.h>
+
+void aes_round_enc(void *d, const void *st, const void *rk)
+{
+    _mm_storeu_si128(d, _mm_aesenc_si128(_mm_loadu_si128(st),
+                                         _mm_loadu_si128(rk)));
+}
+
+void aes_round_enclast(void *d, const void *st, const void *rk)
+{
+    _mm_storeu_si128(d, _mm_aesenclast_si128(_mm_loadu_si128(st),
+                                             _mm_loadu_si128(rk)));
+}
+
+void aes_round_dec(void *d, const void *st, const void *rk)
+{
+    _mm_storeu_si128(d, _mm_aesdec_si128(_mm_loadu_si128(st),
+                                         _mm_loadu_si128(rk)));
+}
+
+void aes_round_declast(void *d, const void *st, const void *rk)
+{
+    _mm_storeu_si128(d, _mm_aesdeclast_si128(_mm_loadu_si128(st),
+                                             _mm_loadu_si128(rk)));
+}
+
+void aes_round_mc(void *d, const void *st)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i t;
+
+    /*
+     * There is no MixColumns instruction: undo the SubBytes and ShiftRows
+     * steps of AESENC with AESDECLAST.
+     */
+    t = _mm_aesdeclast_si128(_mm_loadu_si128(st), zero);
+    _mm_storeu_si128(d, _mm_aesenc_si128(t, zero));
+}
+
+void aes_round_imc(void *d, const void *st)
+{
+    _mm_storeu_si128(d, _mm_aesimc_si128(_mm_loadu_si128(st)));
+}
+#pragma GCC pop_options
+
+#include "qemu/cpuid.h"
+
+bool aes_round_accel;
+
+static void __attribute__((constructor)) aes_init_accel(void)
+{
+    int a, b, c, d;
+
+    if (__get_cpuid_max(0, NULL) >= 1) {
+        __cpuid(1, a, b, c, d);
+        aes_round_accel = (c & bit_AES) != 0;
+    }
+}
+#else
+bool aes_round_accel;
+
+void aes_round_enc(void *d, const void *st, const void *rk)
+{
+    g_assert_not_reached();
+}
+
+void aes_round_enclast(void *d, const void *st, const void *rk)
+{
+    g_assert_not_reached();
+}
+
+void aes_round_dec(void *d, const void *st, const void *rk)
+{
+    g_assert_not_reached();
+}
+
+void aes_round_declast(void *d, const void *st, const void *rk)
+{
+    g_assert_not_reached();
+}
+
+void aes_round_mc(void *d, const void *st)
+{
+    g_assert_not_reached();
+}
+
+void aes_round_imc(void *d, const void *st)
+{
+    g_assert_not_reached();
+}
+#endif /* CONFIG_AESNI_OPT */
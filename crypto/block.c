@@ -347,11 +347,12 @@ void qcrypto_block_free(QCryptoBlock *block)
 }
 
 
-typedef int (*QCryptoCipherEncDecFunc)(QCryptoCipher *cipher,
-                                        const void *in,
-                                        void *out,
-                                        size_t len,
-                                        Error **errp);
+/*
+ * Number of sectors whose IVs are generated together, under a single
+ * acquisition of the IV generator lock, and then passed to the cipher
+ * in one call.
+ */
+#define QCRYPTO_BLOCK_IV_BATCH 256
 
 static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
                                           size_t niv,
@@ -361,23 +362,35 @@ static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
                                           uint64_t offset,
                                           uint8_t *buf,
                                           size_t len,
-                                          QCryptoCipherEncDecFunc func,
+                                          bool encrypt,
                                           Error **errp)
 {
-    g_autofree uint8_t *iv = niv ? g_new0(uint8_t, niv) : NULL;
-    int ret = -1;
+    g_autofree uint8_t *ivs = NULL;
     uint64_t startsector = offset / sectorsize;
+    size_t batch = MIN(len / sectorsize, QCRYPTO_BLOCK_IV_BATCH);
 
     assert(QEMU_IS_ALIGNED(offset, sectorsize));
     assert(QEMU_IS_ALIGNED(len, sectorsize));
 
+    if (niv) {
+        ivs = g_new0(uint8_t, batch * niv);
+    }
+
     while (len > 0) {
-        size_t nbytes;
+        size_t nsectors = MIN(len / sectorsize, batch);
+        size_t nbytes = nsectors * sectorsize;
+        size_t i;
+
         if (niv) {
+            int ret = 0;
+
             if (ivgen_mutex) {
                 qemu_mutex_lock(ivgen_mutex);
             }
-            ret = qcrypto_ivgen_calculate(ivgen, startsector, iv, niv, errp);
+            for (i = 0; i < nsectors && ret == 0; i++) {
+                ret = qcrypto_ivgen_calculate(ivgen, startsector + i,
+                                              ivs + i * niv, niv, errp);
+            }
             if (ivgen_mutex) {
                 qemu_mutex_unlock(ivgen_mutex);
             }
@@ -386,19 +399,29 @@ static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
                 return -1;
             }
 
-            if (qcrypto_cipher_setiv(cipher,
-                                     iv, niv,
-                                     errp) < 0) {
+            if (encrypt) {
+                ret = qcrypto_cipher_encrypt_sectors(cipher, buf, buf, nbytes,
+                                                     sectorsize, ivs, niv,
+                                                     errp);
+            } else {
+                ret = qcrypto_cipher_decrypt_sectors(cipher, buf, buf, nbytes,
+                                                     sectorsize, ivs, niv,
+                                                     errp);
+            }
+            if (ret < 0) {
+                return -1;
+            }
+        } else if (encrypt) {
+            if (qcrypto_cipher_encrypt(cipher, buf, buf, nbytes, errp) < 0) {
+                return -1;
+            }
+        } else {
+            if (qcrypto_cipher_decrypt(cipher, buf, buf, nbytes, errp) < 0) {
                 return -1;
             }
         }
 
-        nbytes = len > sectorsize ? sectorsize : len;
-        if (func(cipher, buf, buf, nbytes, errp) < 0) {
-            return -1;
-        }
-
-        startsector++;
+        startsector += nsectors;
         buf += nbytes;
         len -= nbytes;
     }
@@ -418,7 +441,7 @@ int qcrypto_block_cipher_decrypt_helper(QCryptoCipher *cipher,
 {
     return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, NULL, sectorsize,
                                           offset, buf, len,
-                                          qcrypto_cipher_decrypt, errp);
+                                          false, errp);
 }
 
 
@@ -433,7 +456,7 @@ int qcrypto_block_cipher_encrypt_helper(QCryptoCipher *cipher,
 {
     return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, NULL, sectorsize,
                                           offset, buf, len,
-                                          qcrypto_cipher_encrypt, errp);
+                                          true, errp);
 }
 
 int qcrypto_block_decrypt_helper(QCryptoBlock *block,
@@ -448,7 +471,7 @@ int qcrypto_block_decrypt_helper(QCryptoBlock *block,
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
                                          &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_decrypt, errp);
+                                         len, false, errp);
 
     qcrypto_block_push_cipher(block, cipher);
 
@@ -467,7 +490,7 @@ int qcrypto_block_encrypt_helper(QCryptoBlock *block,
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
                                          &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_encrypt, errp);
+                                         len, true, errp);
 
     qcrypto_block_push_cipher(block, cipher);
 
@@ -214,6 +214,81 @@ int qcrypto_cipher_setiv(QCryptoCipher *cipher,
 }
 
 
+typedef int (*QCryptoCipherFunc)(QCryptoCipher *cipher,
+                                 const void *in,
+                                 void *out,
+                                 size_t len,
+                                 Error **errp);
+
+static int qcrypto_cipher_sectors_fallback(QCryptoCipher *cipher,
+                                           const uint8_t *in,
+                                           uint8_t *out,
+                                           size_t len,
+                                           size_t sector_size,
+                                           const uint8_t *ivs,
+                                           size_t niv,
+                                           QCryptoCipherFunc func,
+                                           Error **errp)
+{
+    const QCryptoCipherDriver *drv = cipher->driver;
+
+    assert(sector_size && len % sector_size == 0);
+    while (len > 0) {
+        if (drv->cipher_setiv(cipher, ivs, niv, errp) < 0 ||
+            func(cipher, in, out, sector_size, errp) < 0) {
+            return -1;
+        }
+        in += sector_size;
+        out += sector_size;
+        ivs += niv;
+        len -= sector_size;
+    }
+    return 0;
+}
+
+
+int qcrypto_cipher_encrypt_sectors(QCryptoCipher *cipher,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   size_t sector_size,
+                                   const uint8_t *ivs,
+                                   size_t niv,
+                                   Error **errp)
+{
+    const QCryptoCipherDriver *drv = cipher->driver;
+
+    if (drv->cipher_encrypt_sectors) {
+        return drv->cipher_encrypt_sectors(cipher, in, out, len,
+                                           sector_size, ivs, niv, errp);
+    }
+    return qcrypto_cipher_sectors_fallback(cipher, in, out, len,
+                                           sector_size, ivs, niv,
+                                           drv->cipher_encrypt, errp);
+}
+
+
+int qcrypto_cipher_decrypt_sectors(QCryptoCipher *cipher,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   size_t sector_size,
+                                   const uint8_t *ivs,
+                                   size_t niv,
+                                   Error **errp)
+{
+    const QCryptoCipherDriver *drv = cipher->driver;
+
+    if (drv->cipher_decrypt_sectors) {
+        return drv->cipher_decrypt_sectors(cipher, in, out, len,
+                                           sector_size, ivs, niv, errp);
+    }
+    return qcrypto_cipher_sectors_fallback(cipher, in, out, len,
+                                           sector_size, ivs, niv,
+                                           drv->cipher_decrypt, errp);
+}
+
+
 void qcrypto_cipher_free(QCryptoCipher *cipher)
 {
     if (cipher) {
@@ -34,6 +34,29 @@ struct QCryptoCipherDriver {
                         const uint8_t *iv, size_t niv,
                         Error **errp);
 
+    /*
+     * Optional; if absent, qcrypto_cipher_encrypt_sectors() and
+     * qcrypto_cipher_decrypt_sectors() set the IV and call the
+     * cipher_encrypt/cipher_decrypt hooks once per sector.
+     */
+    int (*cipher_encrypt_sectors)(QCryptoCipher *cipher,
+                                  const void *in,
+                                  void *out,
+                                  size_t len,
+                                  size_t sector_size,
+                                  const uint8_t *ivs,
+                                  size_t niv,
+                                  Error **errp);
+
+    int (*cipher_decrypt_sectors)(QCryptoCipher *cipher,
+                                  const void *in,
+                                  void *out,
+                                  size_t len,
+                                  size_t sector_size,
+                                  const uint8_t *ivs,
+                                  size_t niv,
+                                  Error **errp);
+
     void (*cipher_free)(QCryptoCipher *cipher);
 };
 
@@ -0,0 +1,68 @@
+/*
+ * Carry-less multiplication
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "crypto/clmul.h"
+
+static uint64_t clmul_64_int(uint64_t a, uint64_t b, uint64_t *hi)
+{
+    uint64_t rhi = 0, rlo = 0;
+    int i;
+
+    /* Bit 0 can only influence the low 64-bit result.  */
+    if (a & 1) {
+        rlo = b;
+    }
+    for (i = 1; i < 64; i++) {
+        uint64_t mask = -((a >> i) & 1);
+
+        rlo ^= (b << i) & mask;
+        rhi ^= (b >> (64 - i)) & mask;
+    }
+    *hi = rhi;
+    return rlo;
+}
+
+static uint64_t (*clmul_64_accel)(uint64_t, uint64_t, uint64_t *) =
+    clmul_64_int;
+
+#ifdef CONFIG_AESNI_OPT
+#pragma GCC push_options
+#pragma GCC target("pclmul")
+#include <wmmintrin.h>
+
+static uint64_t clmul_64_pclmul(uint64_t a, uint64_t b, uint64_t *hi)
+{
+    uint64_t r[2];
+
+    _mm_storeu_si128((__m128i *)r,
+                     _mm_clmulepi64_si128(_mm_set_epi64x(0, a),
+                                          _mm_set_epi64x(0, b), 0));
+    *hi = r[1];
+    return r[0];
+}
+#pragma GCC pop_options
+
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) clmul_init_accel(void)
+{
+    int a, b, c, d;
+
+    if (__get_cpuid_max(0, NULL) >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (c & bit_PCLMUL) {
+            clmul_64_accel = clmul_64_pclmul;
+        }
+    }
+}
+#endif /* CONFIG_AESNI_OPT */
+
+uint64_t clmul_64(uint64_t a, uint64_t b, uint64_t *hi)
+{
+    return clmul_64_accel(a, b, hi);
+}
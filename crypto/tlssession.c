@@ -32,6 +32,17 @@
 
 #include <gnutls/x509.h>
 
+#ifdef CONFIG_LINUX
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
 
 struct QCryptoTLSSession {
     QCryptoTLSCreds *creds;
@@ -548,6 +559,141 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 }
 
 
+#if defined(CONFIG_LINUX) && defined(TLS_TX)
+/*
+ * Both AES-GCM variants only differ by their key size: the salt is the
+ * implicit part of the nonce, and the explicit part is the record
+ * sequence number with TLS 1.2, the rest of the IV with TLS 1.3.
+ */
+static int
+qcrypto_tls_session_fill_ktls(gnutls_protocol_t version,
+                              const gnutls_datum_t *cipher_key,
+                              const gnutls_datum_t *iv,
+                              const unsigned char *seq,
+                              unsigned char *key, size_t key_size,
+                              unsigned char *salt, unsigned char *nonce,
+                              unsigned char *rec_seq,
+                              Error **errp)
+{
+    size_t iv_size = TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+
+    if (version == GNUTLS_TLS1_3) {
+        iv_size += TLS_CIPHER_AES_GCM_128_IV_SIZE;
+    }
+    if (cipher_key->size != key_size || iv->size < iv_size) {
+        error_setg(errp, "Unexpected TLS key material size");
+        return -1;
+    }
+
+    memcpy(key, cipher_key->data, key_size);
+    memcpy(salt, iv->data, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+    if (version == GNUTLS_TLS1_3) {
+        memcpy(nonce, iv->data + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+               TLS_CIPHER_AES_GCM_128_IV_SIZE);
+    } else {
+        memcpy(nonce, seq, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+    }
+    memcpy(rec_seq, seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+    return 0;
+}
+
+
+int
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *session,
+                                   int fd,
+                                   Error **errp)
+{
+    gnutls_protocol_t version = gnutls_protocol_get_version(session->handle);
+    gnutls_cipher_algorithm_t cipher = gnutls_cipher_get(session->handle);
+    gnutls_datum_t mac_key, iv, cipher_key;
+    unsigned char seq[8];
+    union {
+        struct tls_crypto_info info;
+        struct tls12_crypto_info_aes_gcm_128 aes128;
+        struct tls12_crypto_info_aes_gcm_256 aes256;
+    } crypto;
+    socklen_t crypto_size;
+    int ret;
+
+    if (!session->handshakeComplete) {
+        error_setg(errp, "TLS handshake is not complete");
+        return -1;
+    }
+    if (version != GNUTLS_TLS1_2 && version != GNUTLS_TLS1_3) {
+        error_setg(errp, "Kernel TLS needs TLS 1.2 or 1.3");
+        return -1;
+    }
+
+    ret = gnutls_record_get_state(session->handle, 0, &mac_key, &iv,
+                                  &cipher_key, seq);
+    if (ret < 0) {
+        error_setg(errp, "Cannot get TLS session state: %s",
+                   gnutls_strerror(ret));
+        return -1;
+    }
+
+    memset(&crypto, 0, sizeof(crypto));
+    crypto.info.version = version == GNUTLS_TLS1_3 ?
+        TLS_1_3_VERSION : TLS_1_2_VERSION;
+    switch (cipher) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        crypto.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        crypto_size = sizeof(crypto.aes128);
+        ret = qcrypto_tls_session_fill_ktls(version, &cipher_key, &iv, seq,
+                                            crypto.aes128.key,
+                                            sizeof(crypto.aes128.key),
+                                            crypto.aes128.salt,
+                                            crypto.aes128.iv,
+                                            crypto.aes128.rec_seq, errp);
+        break;
+    case GNUTLS_CIPHER_AES_256_GCM:
+        crypto.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        crypto_size = sizeof(crypto.aes256);
+        ret = qcrypto_tls_session_fill_ktls(version, &cipher_key, &iv, seq,
+                                            crypto.aes256.key,
+                                            sizeof(crypto.aes256.key),
+                                            crypto.aes256.salt,
+                                            crypto.aes256.iv,
+                                            crypto.aes256.rec_seq, errp);
+        break;
+    default:
+        error_setg(errp, "Kernel TLS does not support cipher %s",
+                   gnutls_cipher_get_name(cipher));
+        return -1;
+    }
+    if (ret < 0) {
+        goto cleanup;
+    }
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        error_setg_errno(errp, errno, "Cannot enable kernel TLS");
+        ret = -1;
+        goto cleanup;
+    }
+    if (setsockopt(fd, SOL_TLS, TLS_TX, &crypto, crypto_size) < 0) {
+        error_setg_errno(errp, errno, "Cannot set kernel TLS keys");
+        ret = -1;
+        goto cleanup;
+    }
+    trace_qcrypto_tls_session_enable_ktls_tx(session, fd);
+    ret = 0;
+
+ cleanup:
+    memset(&crypto, 0, sizeof(crypto));
+    return ret;
+}
+#else /* ! (CONFIG_LINUX && TLS_TX) */
+int
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *session,
+                                   int fd,
+                                   Error **errp)
+{
+    error_setg(errp, "Kernel TLS is not supported on this platform");
+    return -1;
+}
+#endif /* ! (CONFIG_LINUX && TLS_TX) */
+
+
 #else /* ! CONFIG_GNUTLS */
 
 
@@ -639,4 +785,14 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
     return NULL;
 }
 
+
+int
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *sess,
+                                   int fd,
+                                   Error **errp)
+{
+    error_setg(errp, "TLS requires GNUTLS support");
+    return -1;
+}
+
 #endif
@@ -14,6 +14,8 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
+#include "qemu/thread.h"
 #include "elf.h"
 #include "cpu.h"
 #include "exec/hwaddr.h"
@@ -42,6 +44,9 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
@@ -847,6 +852,11 @@ static void create_header32(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -959,6 +969,11 @@ static void create_header64(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1286,6 +1301,11 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
     }
     return 0;
 }
@@ -1298,20 +1318,154 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
+/* Guest memory compressed in parallel before it is written out in order */
+#define DUMP_COMPRESS_BATCH_SIZE    (16 * MiB)
+#define DUMP_MAX_COMPRESS_THREADS   8
+
+typedef struct DumpPageBatch {
+    DumpState *s;
+    int num;                /* number of pages in the batch */
+    uint8_t **pages;        /* guest pages */
+    uint8_t *buf_out;       /* len_buf_out bytes of output per page */
+    size_t len_buf_out;
+    size_t *size_out;       /* size of each output, 0 for a zero page */
+    uint32_t *flags;        /* compression of each output, 0 for none */
+} DumpPageBatch;
+
+typedef struct DumpCompressWorker {
+    QemuThread thread;
+    DumpPageBatch *batch;
+    int start;
+    int end;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+} DumpCompressWorker;
+
+#ifdef CONFIG_ZSTD
+static bool dump_zstd_compress(uint8_t *dst, size_t *dst_len,
+                               const uint8_t *src, size_t src_len)
+{
+    size_t ret = ZSTD_compress(dst, *dst_len, src, src_len, 1);
+
+    if (ZSTD_isError(ret)) {
+        return false;
+    }
+    *dst_len = ret;
+    return true;
+}
+#endif
+
+/*
+ * Compress page @i of @batch.  Only one compression format is used, for
+ * s->flag_compress is set. But when compression fails to work, we fall back
+ * to save in plaintext.
+ */
+static void dump_compress_page(DumpCompressWorker *w, int i)
+{
+    DumpPageBatch *batch = w->batch;
+    DumpState *s = batch->s;
+    size_t page_size = s->dump_info.page_size;
+    uint8_t *buf = batch->pages[i];
+    uint8_t *buf_out = batch->buf_out + i * batch->len_buf_out;
+    size_t size_out = batch->len_buf_out;
+
+    if (is_zero_page(buf, page_size)) {
+        batch->size_out[i] = 0;
+        return;
+    }
+
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+        (compress2(buf_out, (uLongf *)&size_out, buf, page_size,
+                   Z_BEST_SPEED) == Z_OK) &&
+        (size_out < page_size)) {
+        batch->flags[i] = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+               (lzo1x_1_compress(buf, page_size, buf_out,
+                                 (lzo_uint *)&size_out,
+                                 w->wrkmem) == LZO_E_OK) &&
+               (size_out < page_size)) {
+        batch->flags[i] = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+               (snappy_compress((char *)buf, page_size,
+                                (char *)buf_out, &size_out) == SNAPPY_OK) &&
+               (size_out < page_size)) {
+        batch->flags[i] = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+#ifdef CONFIG_ZSTD
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) &&
+               dump_zstd_compress(buf_out, &size_out, buf, page_size) &&
+               (size_out < page_size)) {
+        batch->flags[i] = DUMP_DH_COMPRESSED_ZSTD;
+#endif
+    } else {
+        /*
+         * fall back to save in plaintext, size_out should be
+         * assigned the target's page size
+         */
+        batch->flags[i] = 0;
+        size_out = page_size;
+    }
+    batch->size_out[i] = size_out;
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressWorker *w = opaque;
+    int i;
+
+    for (i = w->start; i < w->end; i++) {
+        dump_compress_page(w, i);
+    }
+    return NULL;
+}
+
+/* Compress the pages of @batch, splitting them among @nworkers threads */
+static void dump_compress_batch(DumpPageBatch *batch,
+                                DumpCompressWorker *workers, int nworkers)
+{
+    int per_worker = DIV_ROUND_UP(batch->num, nworkers);
+    int i;
+
+    for (i = 0; i < nworkers; i++) {
+        workers[i].batch = batch;
+        workers[i].start = MIN(i * per_worker, batch->num);
+        workers[i].end = MIN(workers[i].start + per_worker, batch->num);
+    }
+
+    if (nworkers == 1) {
+        dump_compress_thread(&workers[0]);
+        return;
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        qemu_thread_create(&workers[i].thread, "dump-compress",
+                           dump_compress_thread, &workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nworkers; i++) {
+        qemu_thread_join(&workers[i].thread);
+    }
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
     size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
     off_t offset_desc, offset_data;
     PageDescriptor pd, pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
+    DumpPageBatch batch = { .s = s };
+    DumpCompressWorker *workers;
+    int batch_pages, nworkers;
+    bool more = true;
+    int i;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1324,12 +1478,21 @@ static void write_dump_pages(DumpState *s, Error **errp)
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
+    batch_pages = MAX(DUMP_COMPRESS_BATCH_SIZE / s->dump_info.page_size, 1);
+    batch.pages = g_new(uint8_t *, batch_pages);
+    batch.len_buf_out = len_buf_out;
+    batch.buf_out = g_malloc(batch_pages * len_buf_out);
+    batch.size_out = g_new(size_t, batch_pages);
+    batch.flags = g_new(uint32_t, batch_pages);
+
+    nworkers = MIN(g_get_num_processors(), DUMP_MAX_COMPRESS_THREADS);
+    workers = g_new0(DumpCompressWorker, nworkers);
 #ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+    for (i = 0; i < nworkers; i++) {
+        workers[i].wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+    }
 #endif
 
-    buf_out = g_malloc(len_buf_out);
-
     /*
      * init zero page's page_desc and page_data, because every zero page
      * uses the same page_data
@@ -1349,89 +1512,45 @@ static void write_dump_pages(DumpState *s, Error **errp)
     offset_data += s->dump_info.page_size;
 
     /*
-     * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * dump memory to vmcore a batch of pages at a time: the pages of a batch
+     * are compressed in parallel, then written out in order.  zero page will
+     * all be resided in the first page of page section
      */
-    while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
-        /* check zero page */
-        if (is_zero_page(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+    while (more) {
+        for (batch.num = 0; batch.num < batch_pages; batch.num++) {
+            more = get_next_page(&block_iter, &pfn_iter,
+                                 &batch.pages[batch.num], s);
+            if (!more) {
+                break;
             }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
+        }
+
+        dump_compress_batch(&batch, workers, nworkers);
+
+        for (i = 0; i < batch.num; i++) {
+            size_out = batch.size_out[i];
+            if (!size_out) {
+                ret = write_cache(&page_desc, &pd_zero,
+                                  sizeof(PageDescriptor), false);
                 if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
+                    error_setg(errp, "dump: failed to write page desc");
                     goto out;
                 }
+                s->written_size += s->dump_info.page_size;
+                continue;
+            }
+
+            buf = batch.flags[i] ? batch.buf_out + i * len_buf_out
+                                 : batch.pages[i];
+            ret = write_cache(&page_data, buf, size_out, false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                goto out;
             }
 
             /* get and write page desc here */
+            pd.flags = cpu_to_dump32(s, batch.flags[i]);
+            pd.size = cpu_to_dump32(s, size_out);
             pd.page_flags = cpu_to_dump64(s, 0);
             pd.offset = cpu_to_dump64(s, offset_data);
             offset_data += size_out;
@@ -1441,8 +1560,8 @@ static void write_dump_pages(DumpState *s, Error **errp)
                 error_setg(errp, "dump: failed to write page desc");
                 goto out;
             }
+            s->written_size += s->dump_info.page_size;
         }
-        s->written_size += s->dump_info.page_size;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1461,10 +1580,16 @@ out:
     free_data_cache(&page_data);
 
 #ifdef CONFIG_LZO
-    g_free(wrkmem);
+    for (i = 0; i < nworkers; i++) {
+        g_free(workers[i].wrkmem);
+    }
 #endif
+    g_free(workers);
 
-    g_free(buf_out);
+    g_free(batch.pages);
+    g_free(batch.buf_out);
+    g_free(batch.size_out);
+    g_free(batch.flags);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1805,6 +1930,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -1962,7 +2091,7 @@ void qmp_dump_guest_memory(bool paging, const char *file,
         detach_p = detach;
     }
 
-    /* check whether lzo/snappy is supported */
+    /* check whether lzo/snappy/zstd is supported */
 #ifndef CONFIG_LZO
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_LZO) {
         error_setg(errp, "kdump-lzo is not available now");
@@ -1977,6 +2106,13 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
 #ifndef TARGET_X86_64
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP) {
         error_setg(errp, "Windows dump is only available for x86-64");
@@ -2058,6 +2194,13 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     item->value = DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY;
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    item->next = g_malloc0(sizeof(DumpGuestMemoryFormatList));
+    item = item->next;
+    item->value = DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD;
+#endif
+
     /* Windows dump is available only if target is x86_64 */
 #ifdef TARGET_X86_64
     item->next = g_malloc0(sizeof(DumpGuestMemoryFormatList));
@@ -0,0 +1,37 @@
+/*
+ * eBPF RSS steering stubs for hosts without eBPF
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "ebpf/ebpf_rss.h"
+
+void ebpf_rss_init(EBPFRSSContext *ctx)
+{
+}
+
+bool ebpf_rss_is_loaded(EBPFRSSContext *ctx)
+{
+    return false;
+}
+
+bool ebpf_rss_load_fds(EBPFRSSContext *ctx, int program_fd,
+                       int config_fd, int toeplitz_fd, int table_fd,
+                       Error **errp)
+{
+    error_setg(errp, "eBPF RSS is not supported on this host");
+    return false;
+}
+
+bool ebpf_rss_set_all(EBPFRSSContext *ctx, struct EBPFRSSConfig *config,
+                      uint16_t *indirections_table, uint8_t *toeplitz_key)
+{
+    return false;
+}
+
+void ebpf_rss_unload(EBPFRSSContext *ctx)
+{
+}
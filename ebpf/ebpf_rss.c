@@ -0,0 +1,132 @@
+/*
+ * eBPF RSS steering for tap-backed virtio-net
+ *
+ * The maps are updated with the bpf() system call directly, so that no
+ * eBPF library is needed at build time.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+
+#include "qapi/error.h"
+#include "qemu/bswap.h"
+#include "ebpf/ebpf_rss.h"
+
+static int ebpf_map_update(int map_fd, uint32_t key, const void *value)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)value;
+    attr.flags = BPF_ANY;
+
+    return syscall(__NR_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr));
+}
+
+void ebpf_rss_init(EBPFRSSContext *ctx)
+{
+    if (ctx != NULL) {
+        ctx->program_fd = -1;
+        ctx->map_configuration = -1;
+        ctx->map_toeplitz_key = -1;
+        ctx->map_indirections_table = -1;
+    }
+}
+
+bool ebpf_rss_is_loaded(EBPFRSSContext *ctx)
+{
+    return ctx != NULL && ctx->program_fd >= 0;
+}
+
+bool ebpf_rss_load_fds(EBPFRSSContext *ctx, int program_fd,
+                       int config_fd, int toeplitz_fd, int table_fd,
+                       Error **errp)
+{
+    if (ebpf_rss_is_loaded(ctx)) {
+        error_setg(errp, "eBPF RSS program is already loaded");
+        return false;
+    }
+
+    /*
+     * The program type is checked by the kernel when it is attached; the
+     * maps are checked the first time they are updated.
+     */
+    ctx->program_fd = program_fd;
+    ctx->map_configuration = config_fd;
+    ctx->map_toeplitz_key = toeplitz_fd;
+    ctx->map_indirections_table = table_fd;
+    return true;
+}
+
+static bool ebpf_rss_set_config(EBPFRSSContext *ctx,
+                                struct EBPFRSSConfig *config)
+{
+    return ebpf_map_update(ctx->map_configuration, 0, config) == 0;
+}
+
+static bool ebpf_rss_set_indirections_table(EBPFRSSContext *ctx,
+                                            uint16_t *indirections_table,
+                                            size_t len)
+{
+    uint32_t i;
+
+    if (len > EBPF_RSS_INDIRECTION_TABLE_SIZE) {
+        return false;
+    }
+
+    for (i = 0; i < len; i++) {
+        if (ebpf_map_update(ctx->map_indirections_table, i,
+                            &indirections_table[i]) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ebpf_rss_set_toeplitz_key(EBPFRSSContext *ctx,
+                                      uint8_t *toeplitz_key)
+{
+    uint8_t toe[EBPF_RSS_KEY_SIZE];
+    uint32_t leftmost;
+
+    /* The program shifts the first 32 bits as a host-endian word */
+    memcpy(toe, toeplitz_key, EBPF_RSS_KEY_SIZE);
+    leftmost = ldl_be_p(toe);
+    memcpy(toe, &leftmost, sizeof(leftmost));
+
+    return ebpf_map_update(ctx->map_toeplitz_key, 0, toe) == 0;
+}
+
+bool ebpf_rss_set_all(EBPFRSSContext *ctx, struct EBPFRSSConfig *config,
+                      uint16_t *indirections_table, uint8_t *toeplitz_key)
+{
+    if (!ebpf_rss_is_loaded(ctx) || config == NULL ||
+        indirections_table == NULL || toeplitz_key == NULL) {
+        return false;
+    }
+
+    /* Update the key and table first, the configuration enables them */
+    return ebpf_rss_set_toeplitz_key(ctx, toeplitz_key) &&
+           ebpf_rss_set_indirections_table(ctx, indirections_table,
+                                           config->indirections_len) &&
+           ebpf_rss_set_config(ctx, config);
+}
+
+void ebpf_rss_unload(EBPFRSSContext *ctx)
+{
+    if (!ebpf_rss_is_loaded(ctx)) {
+        return;
+    }
+
+    close(ctx->program_fd);
+    close(ctx->map_configuration);
+    close(ctx->map_toeplitz_key);
+    close(ctx->map_indirections_table);
+    ebpf_rss_init(ctx);
+}
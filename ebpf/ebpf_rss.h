@@ -0,0 +1,53 @@
+/*
+ * eBPF RSS steering for tap-backed virtio-net
+ *
+ * The steering program and its maps are loaded by the management layer and
+ * passed to QEMU as file descriptors; QEMU only programs the maps from the
+ * guest's RSS configuration and attaches the program to the tap device.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_EBPF_RSS_H
+#define QEMU_EBPF_RSS_H
+
+#define EBPF_RSS_INDIRECTION_TABLE_SIZE 128
+#define EBPF_RSS_KEY_SIZE 40
+
+/* Value of the configuration map, at key 0 */
+struct EBPFRSSConfig {
+    uint8_t redirect;
+    uint8_t populate_hash;
+    uint32_t hash_types;
+    uint16_t indirections_len;
+    uint16_t default_queue;
+} QEMU_PACKED;
+
+typedef struct EBPFRSSContext {
+    int program_fd;
+    int map_configuration;
+    int map_toeplitz_key;
+    int map_indirections_table;
+} EBPFRSSContext;
+
+void ebpf_rss_init(EBPFRSSContext *ctx);
+
+bool ebpf_rss_is_loaded(EBPFRSSContext *ctx);
+
+/*
+ * Takes ownership of a loaded program and its configuration, Toeplitz key
+ * (an array of one EBPF_RSS_KEY_SIZE-byte value whose first 32 bits are in
+ * host byte order) and indirection table (an array of
+ * EBPF_RSS_INDIRECTION_TABLE_SIZE uint16_t) maps.
+ */
+bool ebpf_rss_load_fds(EBPFRSSContext *ctx, int program_fd,
+                       int config_fd, int toeplitz_fd, int table_fd,
+                       Error **errp);
+
+bool ebpf_rss_set_all(EBPFRSSContext *ctx, struct EBPFRSSConfig *config,
+                      uint16_t *indirections_table, uint8_t *toeplitz_key);
+
+void ebpf_rss_unload(EBPFRSSContext *ctx);
+
+#endif /* QEMU_EBPF_RSS_H */
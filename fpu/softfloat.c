@@ -215,6 +215,18 @@ GEN_INPUT_FLUSH3(float64_input_flush3, float64)
 # define QEMU_HARDFLOAT_USE_ISINF   0
 #endif
 
+/*
+ * On x86 hosts long double is the x87 extended format, so floatx80 at full
+ * precision can use the host FPU too.  Windows runs the x87 in double
+ * precision, and m68k's floatx80 has its own encodings; exclude both.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && LDBL_MANT_DIG == 64 && \
+    !defined(_WIN32) && !defined(TARGET_M68K)
+# define QEMU_HARDFLOAT_FX80        1
+#else
+# define QEMU_HARDFLOAT_FX80        0
+#endif
+
 /*
  * Some targets clear the FP flags before most FP operations. This prevents
  * the use of hardfloat, since hardfloat relies on the inexact flag being
@@ -401,6 +413,59 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+typedef union {
+    floatx80 s;
+    long double h;
+} union_floatx80;
+
+typedef floatx80 (*soft_fx80_op2_fn)(floatx80 a, floatx80 b, float_status *s);
+typedef long double (*hard_fx80_op2_fn)(long double a, long double b);
+
+static inline bool can_use_fpu_fx80(const float_status *s)
+{
+    return QEMU_HARDFLOAT_FX80 && can_use_fpu(s) &&
+           s->floatx80_rounding_precision == 80;
+}
+
+/* Zero or normal, with the explicit integer bit where it belongs.  */
+static inline bool fx80_is_zon(floatx80 a)
+{
+    int exp = a.high & 0x7fff;
+
+    if (exp == 0) {
+        return a.low == 0;
+    }
+    return exp != 0x7fff && (a.low >> 63);
+}
+
+static inline floatx80
+floatx80_gen2(floatx80 xa, floatx80 xb, float_status *s,
+              hard_fx80_op2_fn hard, soft_fx80_op2_fn soft)
+{
+    union_floatx80 ua, ub, ur;
+
+    if (unlikely(!can_use_fpu_fx80(s) ||
+                 !fx80_is_zon(xa) || !fx80_is_zon(xb))) {
+        goto soft;
+    }
+
+    ua.s = xa;
+    ub.s = xb;
+    ur.h = hard(ua.h, ub.h);
+    if (unlikely(isinf(ur.h))) {
+        s->float_exception_flags |= float_flag_overflow;
+    } else if (unlikely(fabsl(ur.h) <= LDBL_MIN) &&
+               !(ur.h == 0 && (floatx80_is_zero(xa) ||
+                               floatx80_is_zero(xb)))) {
+        /* Tiny, or a zero that may have underflowed.  */
+        goto soft;
+    }
+    return ur.s;
+
+ soft:
+    return soft(xa, xb, s);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the fraction bits of the single-precision floating-point value `a'.
 *----------------------------------------------------------------------------*/
@@ -1560,10 +1625,20 @@ soft_f64_muladd(float64 a, float64 b, float64 c, int flags,
 
 static bool force_soft_fma;
 
+static inline bool f32_halve_is_exact(union_float32 a)
+{
+    return float32_is_zero(a.s) || fabsf(a.h) >= 2 * FLT_MIN;
+}
+
+static inline bool f64_halve_is_exact(union_float64 a)
+{
+    return float64_is_zero(a.s) || fabs(a.h) >= 2 * DBL_MIN;
+}
+
 float32 QEMU_FLATTEN
 float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
 {
-    union_float32 ua, ub, uc, ur;
+    union_float32 ua, ub, uc, ur, ua_orig, uc_orig;
 
     ua.s = xa;
     ub.s = xb;
@@ -1572,9 +1647,6 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
     if (unlikely(!can_use_fpu(s))) {
         goto soft;
     }
-    if (unlikely(flags & float_muladd_halve_result)) {
-        goto soft;
-    }
 
     float32_input_flush3(&ua.s, &ub.s, &uc.s, s);
     if (unlikely(!f32_is_zon3(ua, ub, uc))) {
@@ -1585,6 +1657,20 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
         goto soft;
     }
 
+    ua_orig = ua;
+    uc_orig = uc;
+    if (unlikely(flags & float_muladd_halve_result)) {
+        /*
+         * (a * b + c) / 2 == fma(a / 2, b, c / 2), with a single rounding,
+         * as long as halving the inputs is exact.
+         */
+        if (unlikely(!f32_halve_is_exact(ua) || !f32_halve_is_exact(uc))) {
+            goto soft;
+        }
+        ua.h *= 0.5f;
+        uc.h *= 0.5f;
+    }
+
     /*
      * When (a || b) == 0, there's no need to check for under/over flow,
      * since we know the addend is (normal || 0) and the product is 0.
@@ -1602,9 +1688,6 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
         }
         ur.h = up.h + uc.h;
     } else {
-        union_float32 ua_orig = ua;
-        union_float32 uc_orig = uc;
-
         if (flags & float_muladd_negate_product) {
             ua.h = -ua.h;
         }
@@ -1634,7 +1717,7 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
 float64 QEMU_FLATTEN
 float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
 {
-    union_float64 ua, ub, uc, ur;
+    union_float64 ua, ub, uc, ur, ua_orig, uc_orig;
 
     ua.s = xa;
     ub.s = xb;
@@ -1643,9 +1726,6 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
     if (unlikely(!can_use_fpu(s))) {
         goto soft;
     }
-    if (unlikely(flags & float_muladd_halve_result)) {
-        goto soft;
-    }
 
     float64_input_flush3(&ua.s, &ub.s, &uc.s, s);
     if (unlikely(!f64_is_zon3(ua, ub, uc))) {
@@ -1656,6 +1736,20 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
         goto soft;
     }
 
+    ua_orig = ua;
+    uc_orig = uc;
+    if (unlikely(flags & float_muladd_halve_result)) {
+        /*
+         * (a * b + c) / 2 == fma(a / 2, b, c / 2), with a single rounding,
+         * as long as halving the inputs is exact.
+         */
+        if (unlikely(!f64_halve_is_exact(ua) || !f64_halve_is_exact(uc))) {
+            goto soft;
+        }
+        ua.h *= 0.5;
+        uc.h *= 0.5;
+    }
+
     /*
      * When (a || b) == 0, there's no need to check for under/over flow,
      * since we know the addend is (normal || 0) and the product is 0.
@@ -1673,9 +1767,6 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
         }
         ur.h = up.h + uc.h;
     } else {
-        union_float64 ua_orig = ua;
-        union_float64 uc_orig = uc;
-
         if (flags & float_muladd_negate_product) {
             ua.h = -ua.h;
         }
@@ -1687,7 +1778,7 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
 
         if (unlikely(f64_is_inf(ur))) {
             s->float_exception_flags |= float_flag_overflow;
-        } else if (unlikely(fabs(ur.h) <= FLT_MIN)) {
+        } else if (unlikely(fabs(ur.h) <= DBL_MIN)) {
             ua = ua_orig;
             uc = uc_orig;
             goto soft;
@@ -2007,13 +2098,36 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(pr, s, fmt16);
 }
 
-float32 float64_to_float32(float64 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_float64_to_float32(float64 a, float_status *s)
 {
     FloatParts p = float64_unpack_canonical(a, s);
     FloatParts pr = float_to_float(p, &float32_params, s);
     return float32_round_pack_canonical(pr, s);
 }
 
+float32 float64_to_float32(float64 a, float_status *s)
+{
+    union_float64 ua;
+    union_float32 ur;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s) || !float64_is_zero_or_normal(a))) {
+        goto soft;
+    }
+
+    ur.h = ua.h;
+    if (unlikely(f32_is_inf(ur))) {
+        s->float_exception_flags |= float_flag_overflow;
+    } else if (unlikely(fabsf(ur.h) <= FLT_MIN) && !float64_is_zero(a)) {
+        goto soft;
+    }
+    return ur.s;
+
+ soft:
+    return soft_float64_to_float32(a, s);
+}
+
 float32 bfloat16_to_float32(bfloat16 a, float_status *s)
 {
     FloatParts p = bfloat16_unpack_canonical(a, s);
@@ -2275,9 +2389,46 @@ int16_t float32_to_int16_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                  rmode, scale, INT16_MIN, INT16_MAX, s);
 }
 
+/*
+ * Hardfloat conversion of a zero or normal value to an integer in
+ * [-lim, lim).  Eventual inexact results are fine as long as the flag is
+ * already set; anything out of range is left to softfloat, which knows
+ * what to saturate to.  Returns false if softfloat must be used.
+ */
+static inline bool hard_to_int(double a, FloatRoundMode rmode, double lim,
+                               const float_status *s, int64_t *ret)
+{
+    double r;
+
+    if (QEMU_NO_HARDFLOAT ||
+        !(s->float_exception_flags & float_flag_inexact)) {
+        return false;
+    }
+    if (rmode == float_round_nearest_even) {
+        r = rint(a);
+    } else if (rmode == float_round_to_zero) {
+        r = trunc(a);
+    } else {
+        return false;
+    }
+    if (unlikely(!(r >= -lim && r < lim))) {
+        return false;
+    }
+    *ret = r;
+    return true;
+}
+
 int32_t float32_to_int32_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
+    union_float32 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (scale == 0 && float32_is_zero_or_normal(a) &&
+        hard_to_int(ua.h, rmode, 0x1p31, s, &r)) {
+        return r;
+    }
     return round_to_int_and_pack(float32_unpack_canonical(a, s),
                                  rmode, scale, INT32_MIN, INT32_MAX, s);
 }
@@ -2285,6 +2436,14 @@ int32_t float32_to_int32_scalbn(float32 a, FloatRoundMode rmode, int scale,
 int64_t float32_to_int64_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
+    union_float32 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (scale == 0 && float32_is_zero_or_normal(a) &&
+        hard_to_int(ua.h, rmode, 0x1p63, s, &r)) {
+        return r;
+    }
     return round_to_int_and_pack(float32_unpack_canonical(a, s),
                                  rmode, scale, INT64_MIN, INT64_MAX, s);
 }
@@ -2299,6 +2458,14 @@ int16_t float64_to_int16_scalbn(float64 a, FloatRoundMode rmode, int scale,
 int32_t float64_to_int32_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
+    union_float64 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (scale == 0 && float64_is_zero_or_normal(a) &&
+        hard_to_int(ua.h, rmode, 0x1p31, s, &r)) {
+        return r;
+    }
     return round_to_int_and_pack(float64_unpack_canonical(a, s),
                                  rmode, scale, INT32_MIN, INT32_MAX, s);
 }
@@ -2306,6 +2473,14 @@ int32_t float64_to_int32_scalbn(float64 a, FloatRoundMode rmode, int scale,
 int64_t float64_to_int64_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
+    union_float64 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (scale == 0 && float64_is_zero_or_normal(a) &&
+        hard_to_int(ua.h, rmode, 0x1p63, s, &r)) {
+        return r;
+    }
     return round_to_int_and_pack(float64_unpack_canonical(a, s),
                                  rmode, scale, INT64_MIN, INT64_MAX, s);
 }
@@ -2813,7 +2988,17 @@ float16 int8_to_float16(int8_t a, float_status *status)
 
 float32 int64_to_float32_scalbn(int64_t a, int scale, float_status *status)
 {
-    FloatParts pa = int_to_float(a, scale, status);
+    FloatParts pa;
+
+    /* Integers of up to 24 bits convert exactly, raising nothing.  */
+    if (scale == 0 &&
+        (can_use_fpu(status) || (a >= -(1 << 24) && a <= (1 << 24)))) {
+        union_float32 ur;
+        ur.h = a;
+        return ur.s;
+    }
+
+    pa = int_to_float(a, scale, status);
     return float32_round_pack_canonical(pa, status);
 }
 
@@ -2844,7 +3029,17 @@ float32 int16_to_float32(int16_t a, float_status *status)
 
 float64 int64_to_float64_scalbn(int64_t a, int scale, float_status *status)
 {
-    FloatParts pa = int_to_float(a, scale, status);
+    FloatParts pa;
+
+    /* Integers of up to 53 bits, including every int32_t, are exact.  */
+    if (scale == 0 &&
+        (can_use_fpu(status) || (a >= -(1LL << 53) && a <= (1LL << 53)))) {
+        union_float64 ur;
+        ur.h = a;
+        return ur.s;
+    }
+
+    pa = int_to_float(a, scale, status);
     return float64_round_pack_canonical(pa, status);
 }
 
@@ -5180,7 +5375,8 @@ float32 float32_log2(float32 a, float_status *status)
 | Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 float64_to_floatx80(float64 a, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_float64_to_floatx80(float64 a, float_status *status)
 {
     bool aSign;
     int aExp;
@@ -5210,6 +5406,19 @@ floatx80 float64_to_floatx80(float64 a, float_status *status)
 
 }
 
+floatx80 float64_to_floatx80(float64 a, float_status *status)
+{
+    /* Widening conversion can never produce inexact results.  */
+    if (QEMU_HARDFLOAT_FX80 && likely(float64_is_zero_or_normal(a))) {
+        union_float64 ua;
+        union_floatx80 ur;
+        ua.s = a;
+        ur.h = ua.h;
+        return ur.s;
+    }
+    return soft_float64_to_floatx80(a, status);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the result of converting the double-precision floating-point value
 | `a' to the quadruple-precision floating-point format.  The conversion is
@@ -5595,7 +5804,8 @@ float32 floatx80_to_float32(floatx80 a, float_status *status)
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 floatx80_to_float64(floatx80 a, float_status *status)
+static float64 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_to_float64(floatx80 a, float_status *status)
 {
     bool aSign;
     int32_t aExp;
@@ -5622,6 +5832,29 @@ float64 floatx80_to_float64(floatx80 a, float_status *status)
 
 }
 
+float64 floatx80_to_float64(floatx80 a, float_status *s)
+{
+    union_floatx80 ua;
+    union_float64 ur;
+
+    if (unlikely(!QEMU_HARDFLOAT_FX80 || !can_use_fpu(s) ||
+                 !fx80_is_zon(a))) {
+        goto soft;
+    }
+
+    ua.s = a;
+    ur.h = ua.h;
+    if (unlikely(f64_is_inf(ur))) {
+        s->float_exception_flags |= float_flag_overflow;
+    } else if (unlikely(fabs(ur.h) <= DBL_MIN) && !floatx80_is_zero(a)) {
+        goto soft;
+    }
+    return ur.s;
+
+ soft:
+    return soft_floatx80_to_float64(a, s);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the result of converting the extended double-precision floating-
 | point value `a' to the quadruple-precision floating-point format.  The
@@ -5926,7 +6159,8 @@ static floatx80 subFloatx80Sigs(floatx80 a, floatx80 b, bool zSign,
 | Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 floatx80_add(floatx80 a, floatx80 b, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_add(floatx80 a, floatx80 b, float_status *status)
 {
     bool aSign, bSign;
 
@@ -5951,7 +6185,8 @@ floatx80 floatx80_add(floatx80 a, floatx80 b, float_status *status)
 | IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 floatx80_sub(floatx80 a, floatx80 b, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_sub(floatx80 a, floatx80 b, float_status *status)
 {
     bool aSign, bSign;
 
@@ -5976,7 +6211,8 @@ floatx80 floatx80_sub(floatx80 a, floatx80 b, float_status *status)
 | IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 floatx80_mul(floatx80 a, floatx80 b, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_mul(floatx80 a, floatx80 b, float_status *status)
 {
     bool aSign, bSign, zSign;
     int32_t aExp, bExp, zExp;
@@ -6038,7 +6274,8 @@ floatx80 floatx80_mul(floatx80 a, floatx80 b, float_status *status)
 | according to the IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 floatx80_div(floatx80 a, floatx80 b, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_div(floatx80 a, floatx80 b, float_status *status)
 {
     bool aSign, bSign, zSign;
     int32_t aExp, bExp, zExp;
@@ -6279,7 +6516,8 @@ floatx80 floatx80_mod(floatx80 a, floatx80 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 floatx80_sqrt(floatx80 a, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_sqrt(floatx80 a, float_status *status)
 {
     bool aSign;
     int32_t aExp, zExp;
@@ -6344,6 +6582,63 @@ floatx80 floatx80_sqrt(floatx80 a, float_status *status)
                                 0, zExp, zSig0, zSig1, status);
 }
 
+static long double hard_fx80_add(long double a, long double b)
+{
+    return a + b;
+}
+
+static long double hard_fx80_sub(long double a, long double b)
+{
+    return a - b;
+}
+
+static long double hard_fx80_mul(long double a, long double b)
+{
+    return a * b;
+}
+
+static long double hard_fx80_div(long double a, long double b)
+{
+    return a / b;
+}
+
+floatx80 QEMU_FLATTEN floatx80_add(floatx80 a, floatx80 b, float_status *s)
+{
+    return floatx80_gen2(a, b, s, hard_fx80_add, soft_floatx80_add);
+}
+
+floatx80 QEMU_FLATTEN floatx80_sub(floatx80 a, floatx80 b, float_status *s)
+{
+    return floatx80_gen2(a, b, s, hard_fx80_sub, soft_floatx80_sub);
+}
+
+floatx80 QEMU_FLATTEN floatx80_mul(floatx80 a, floatx80 b, float_status *s)
+{
+    return floatx80_gen2(a, b, s, hard_fx80_mul, soft_floatx80_mul);
+}
+
+floatx80 QEMU_FLATTEN floatx80_div(floatx80 a, floatx80 b, float_status *s)
+{
+    /* Division by zero must raise the divbyzero flag.  */
+    if (unlikely(floatx80_is_zero(b))) {
+        return soft_floatx80_div(a, b, s);
+    }
+    return floatx80_gen2(a, b, s, hard_fx80_div, soft_floatx80_div);
+}
+
+floatx80 QEMU_FLATTEN floatx80_sqrt(floatx80 xa, float_status *s)
+{
+    union_floatx80 ua, ur;
+
+    if (unlikely(!can_use_fpu_fx80(s) || !fx80_is_zon(xa) ||
+                 (floatx80_is_neg(xa) && !floatx80_is_zero(xa)))) {
+        return soft_floatx80_sqrt(xa, s);
+    }
+    ua.s = xa;
+    ur.h = sqrtl(ua.h);
+    return ur.s;
+}
+
 /*----------------------------------------------------------------------------
 | Returns the result of converting the quadruple-precision floating-point
 | value `a' to the 32-bit two's complement integer format.  The conversion
@@ -43,7 +43,7 @@
 #include "hw/boards.h"
 #endif
 
-#define MAX_PACKET_LENGTH 4096
+#define MAX_PACKET_LENGTH 16384
 
 #include "qemu/sockets.h"
 #include "sysemu/hw_accel.h"
@@ -1819,6 +1819,36 @@ static void handle_read_mem(GdbCmdContext *gdb_ctx, void *user_ctx)
     put_strbuf();
 }
 
+/*
+ * The binary read may return fewer bytes than requested; size the reply
+ * so that it still fits if every byte needs escaping.
+ */
+static void handle_read_mem_binary(GdbCmdContext *gdb_ctx, void *user_ctx)
+{
+    uint64_t len;
+
+    if (gdb_ctx->num_params != 2) {
+        put_packet("E22");
+        return;
+    }
+
+    len = MIN(gdb_ctx->params[1].val_ull, (MAX_PACKET_LENGTH - 5) / 2);
+    g_byte_array_set_size(gdbserver_state.mem_buf, len);
+
+    if (target_memory_rw_debug(gdbserver_state.g_cpu, gdb_ctx->params[0].val_ull,
+                               gdbserver_state.mem_buf->data,
+                               gdbserver_state.mem_buf->len, false)) {
+        put_packet("E14");
+        return;
+    }
+
+    g_string_assign(gdbserver_state.str_buf, "b");
+    memtox(gdbserver_state.str_buf, (char *)gdbserver_state.mem_buf->data,
+           gdbserver_state.mem_buf->len);
+    put_packet_binary(gdbserver_state.str_buf->str,
+                      gdbserver_state.str_buf->len, true);
+}
+
 static void handle_write_all_regs(GdbCmdContext *gdb_ctx, void *user_ctx)
 {
     target_ulong addr, len;
@@ -2162,6 +2192,7 @@ static void handle_query_supported(GdbCmdContext *gdb_ctx, void *user_ctx)
     CPUClass *cc;
 
     g_string_printf(gdbserver_state.str_buf, "PacketSize=%x", MAX_PACKET_LENGTH);
+    g_string_append(gdbserver_state.str_buf, ";binary-upload+");
     cc = CPU_GET_CLASS(first_cpu);
     if (cc->gdb_core_xml_file) {
         g_string_append(gdbserver_state.str_buf, ";qXfer:features:read+");
@@ -2562,6 +2593,17 @@ static int gdb_handle_packet(const char *line_buf)
             cmd_parser = &read_mem_cmd_desc;
         }
         break;
+    case 'x':
+        {
+            static const GdbCmdParseEntry read_mem_binary_cmd_desc = {
+                .handler = handle_read_mem_binary,
+                .cmd = "x",
+                .cmd_startswith = 1,
+                .schema = "L,L0"
+            };
+            cmd_parser = &read_mem_binary_cmd_desc;
+        }
+        break;
     case 'M':
         {
             static const GdbCmdParseEntry write_mem_cmd_desc = {
@@ -280,7 +280,49 @@ ERST
 
 SRST
   ``info jit``
-    Show dynamic compiler info.
+    Show dynamic compiler info.  With ``tb-stats on``, also lists the ten
+    most executed translation blocks.
+ERST
+
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-stats",
+        .args_type  = "disas:-d,max:i?,sortby:s?",
+        .params     = "[-d] [max] [exec|translations|time|exits]",
+        .help       = "show the statistics of the top max (default 10) "
+                      "translation blocks, with -d their guest code",
+        .cmd        = hmp_info_tb_stats,
+    },
+#endif
+
+SRST
+  ``info tb-stats [-d]`` [*max*] [*sortby*]
+    Show the statistics gathered with ``tb-stats on`` for the top *max*
+    (default 10) translation blocks, sorted by execution count (``exec``,
+    the default), number of translations (``translations``), total
+    translation time (``time``) or number of exits to the execution loop
+    (``exits``).  For each block, the guest pc, how often it ran, how
+    often it returned to the execution loop through one of its direct
+    jumps or because an exit was requested, how often it was translated,
+    its guest instructions and host code bytes and its average
+    translation time are shown.  ``-d`` disassembles the guest code of
+    each block, read through the current CPU's MMU.
+ERST
+
+#if defined(CONFIG_TCG)
+    {
+        .name       = "afl",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show AFL fuzz loop statistics",
+        .cmd        = hmp_info_afl,
+    },
+#endif
+
+SRST
+  ``info afl``
+    Show AFL fuzz loop statistics: test cases run, translations and the
+    average time spent in each phase of a test case.
 ERST
 
 #if defined(CONFIG_TCG)
@@ -312,7 +354,8 @@ ERST
 SRST
   ``info sync-profile [-m|-n]`` [*max*]
     Show synchronization profiling info, up to *max* entries (default: 10),
-    sorted by total wait time.
+    sorted by total wait time, followed by as many BQL profiling entries,
+    sorted by total wait and hold time.
 
     ``-m``
       sort by mean wait time
@@ -324,6 +367,24 @@ SRST
     being coalesced.
 ERST
 
+    {
+        .name       = "bql-profile",
+        .args_type  = "max:i?",
+        .params     = "[max]",
+        .help       = "show how long MMIO and PIO accesses waited for the "
+                      "global lock, for up to max memory regions "
+                      "(default: 10), sorted by total wait time",
+        .cmd        = hmp_info_bql_profile,
+    },
+
+SRST
+  ``info bql-profile`` [*max*]
+    Show, for up to *max* memory regions (default: 10), how many MMIO and
+    PIO accesses took the global lock and how long they waited for it,
+    sorted by total wait time.  Data is only gathered while sync-profile
+    is on, and is cleared by ``sync-profile reset``.
+ERST
+
     {
         .name       = "kvm",
         .args_type  = "",
@@ -337,6 +398,36 @@ SRST
     Show KVM information.
 ERST
 
+    {
+        .name       = "kvm-exits",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show KVM exit statistics of each vCPU",
+        .cmd        = hmp_info_kvm_exits,
+    },
+
+SRST
+  ``info kvm-exits``
+    Show, for each vCPU, how many KVM exits of each kind happened, the
+    time QEMU spent handling them, and which memory regions caused MMIO
+    and PIO exits.
+ERST
+
+    {
+        .name       = "kvm-irq-routes",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show KVM GSI routing table statistics",
+        .cmd        = hmp_info_kvm_irq_routes,
+    },
+
+SRST
+  ``info kvm-irq-routes``
+    Show the size of the KVM GSI routing table, how many MSI route updates
+    actually changed it, and how many commits to KVM were skipped because
+    it had not changed.
+ERST
+
     {
         .name       = "numa",
         .args_type  = "",
@@ -612,11 +612,30 @@ SRST
   This command is useful to send keys that your graphical user interface
   intercepts at low level, such as ``ctrl-alt-f1`` in X Window.
 ERST
+#if defined(CONFIG_TCG)
     {
-        .name       = "sync-profile",
+        .name       = "tb-stats",
         .args_type  = "op:s?",
         .params     = "[on|off|reset]",
-        .help       = "enable, disable or reset synchronization profiling. "
+        .help       = "enable, disable or reset translation block statistics. "
+                      "With no arguments, prints whether they are on or off.",
+        .cmd        = hmp_tb_stats,
+    },
+#endif
+
+SRST
+``tb-stats [on|off|reset]``
+  Enable, disable or reset the statistics of each TCG translation block,
+  shown by ``info tb-stats``.  Turning them on or off flushes the
+  translation cache.  With no arguments, prints whether they are on or off.
+ERST
+
+    {
+        .name       = "sync-profile",
+        .args_type  = "op:s?,period:i?",
+        .params     = "[on|off|reset|bql period]",
+        .help       = "enable, disable or reset synchronization profiling, "
+                      "or sample one in period BQL acquisitions (0: off). "
                       "With no arguments, prints whether profiling is on or off.",
         .cmd        = hmp_sync_profile,
     },
@@ -625,6 +644,15 @@ SRST
 ``sync-profile [on|off|reset]``
   Enable, disable or reset synchronization profiling. With no arguments, prints
   whether profiling is on or off.
+
+``sync-profile bql`` *period*
+  BQL profiling is separate, and always on unless disabled with
+  ``sync-profile bql 0``: one in *period* acquisitions of the BQL (default
+  64) is timed, and charged to the call site that took it or to the MMIO
+  region, timer, bottom half, fd handler or QMP command that runs with it
+  held.  Its results are shown by ``info sync-profile`` and by the
+  ``query-bql-profile`` QMP command, and are cleared by ``sync-profile
+  reset`` too.
 ERST
 
     {
@@ -1105,14 +1133,15 @@ ERST
 
     {
         .name       = "dump-guest-memory",
-        .args_type  = "paging:-p,detach:-d,windmp:-w,zlib:-z,lzo:-l,snappy:-s,filename:F,begin:l?,length:l?",
-        .params     = "[-p] [-d] [-z|-l|-s|-w] filename [begin length]",
+        .args_type  = "paging:-p,detach:-d,windmp:-w,zlib:-z,lzo:-l,snappy:-s,zstd:-Z,filename:F,begin:l?,length:l?",
+        .params     = "[-p] [-d] [-z|-l|-s|-Z|-w] filename [begin length]",
         .help       = "dump guest memory into file 'filename'.\n\t\t\t"
                       "-p: do paging to get guest's memory mapping.\n\t\t\t"
                       "-d: return immediately (do not wait for completion).\n\t\t\t"
                       "-z: dump in kdump-compressed format, with zlib compression.\n\t\t\t"
                       "-l: dump in kdump-compressed format, with lzo compression.\n\t\t\t"
                       "-s: dump in kdump-compressed format, with snappy compression.\n\t\t\t"
+                      "-Z: dump in kdump-compressed format, with zstd compression.\n\t\t\t"
                       "-w: dump in Windows crashdump format (can be used instead of ELF-dump converting),\n\t\t\t"
                       "    for Windows x64 guests with vmcoreinfo driver only.\n\t\t\t"
                       "begin: the starting physical address.\n\t\t\t"
@@ -1123,9 +1152,9 @@ ERST
 SRST
 ``dump-guest-memory [-p]`` *filename* *begin* *length*
   \ 
-``dump-guest-memory [-z|-l|-s|-w]`` *filename*
+``dump-guest-memory [-z|-l|-s|-Z|-w]`` *filename*
   Dump guest memory to *protocol*. The file can be processed with crash or
-  gdb. Without ``-z|-l|-s|-w``, the dump format is ELF.
+  gdb. Without ``-z|-l|-s|-Z|-w``, the dump format is ELF.
 
   ``-p``
     do paging to get guest's memory mapping.
@@ -1135,6 +1164,8 @@ SRST
     dump in kdump-compressed format, with lzo compression.
   ``-s``
     dump in kdump-compressed format, with snappy compression.
+  ``-Z``
+    dump in kdump-compressed format, with zstd compression.
   ``-w``
     dump in Windows crashdump format (can be used instead of ELF-dump converting),
     for Windows x64 guests with vmcoreinfo driver only
@@ -2138,75 +2138,89 @@ static int v9fs_xattr_read(V9fsState *s, V9fsPDU *pdu, V9fsFidState *fidp,
     return offset;
 }
 
+static void v9fs_free_dirents(struct V9fsDirEnt *e)
+{
+    struct V9fsDirEnt *next = NULL;
+
+    for (; e; e = next) {
+        next = e->next;
+        g_free(e->dent);
+        g_free(e->st);
+        g_free(e);
+    }
+}
+
 static int coroutine_fn v9fs_do_readdir_with_stat(V9fsPDU *pdu,
                                                   V9fsFidState *fidp,
+                                                  off_t offset,
                                                   uint32_t max_count)
 {
     V9fsPath path;
     V9fsStat v9stat;
-    int len, err = 0;
+    int len, err;
     int32_t count = 0;
-    struct stat stbuf;
-    off_t saved_dir_pos;
-    struct dirent *dent;
+    off_t saved_dir_pos = offset;
+    struct V9fsDirEnt *entries = NULL, *e;
 
-    /* save the directory position */
-    saved_dir_pos = v9fs_co_telldir(pdu, fidp);
-    if (saved_dir_pos < 0) {
-        return saved_dir_pos;
+    /*
+     * Fetch the entries, and a stat of each, with a single hop to the
+     * worker thread.  A 9P2000.u stat is always larger than the 9P2000.L
+     * dirent v9fs_co_readdir_many() budgets for, so this returns at least
+     * as many entries as fit in the reply; the directory is then set back
+     * to the first entry that was not sent.
+     */
+    err = v9fs_co_readdir_many(pdu, fidp, &entries, offset, max_count, true);
+    if (err < 0) {
+        goto out;
     }
+    err = 0;
 
-    while (1) {
-        v9fs_path_init(&path);
-
-        v9fs_readdir_lock(&fidp->fs.dir);
-
-        err = v9fs_co_readdir(pdu, fidp, &dent);
-        if (err || !dent) {
-            break;
-        }
-        err = v9fs_co_name_to_path(pdu, &fidp->path, dent->d_name, &path);
-        if (err < 0) {
+    for (e = entries; e; e = e->next) {
+        /* e->st should never be NULL, but just to be sure */
+        if (!e->st) {
+            err = -EINVAL;
             break;
         }
-        err = v9fs_co_lstat(pdu, &path, &stbuf);
+
+        v9fs_path_init(&path);
+        err = v9fs_co_name_to_path(pdu, &fidp->path, e->dent->d_name, &path);
         if (err < 0) {
+            v9fs_path_free(&path);
             break;
         }
-        err = stat_to_v9stat(pdu, &path, dent->d_name, &stbuf, &v9stat);
+        err = stat_to_v9stat(pdu, &path, e->dent->d_name, e->st, &v9stat);
+        v9fs_path_free(&path);
         if (err < 0) {
             break;
         }
         if ((count + v9stat.size + 2) > max_count) {
-            v9fs_readdir_unlock(&fidp->fs.dir);
-
-            /* Ran out of buffer. Set dir back to old position and return */
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
+            /* Ran out of buffer */
             v9fs_stat_free(&v9stat);
-            v9fs_path_free(&path);
-            return count;
+            break;
         }
 
         /* 11 = 7 + 4 (7 = start offset, 4 = space for storing count) */
         len = pdu_marshal(pdu, 11 + count, "S", &v9stat);
-
-        v9fs_readdir_unlock(&fidp->fs.dir);
-
+        v9fs_stat_free(&v9stat);
         if (len < 0) {
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_stat_free(&v9stat);
-            v9fs_path_free(&path);
-            return len;
+            err = len;
+            break;
         }
         count += len;
-        v9fs_stat_free(&v9stat);
-        v9fs_path_free(&path);
-        saved_dir_pos = dent->d_off;
+        saved_dir_pos = e->dent->d_off;
     }
 
-    v9fs_readdir_unlock(&fidp->fs.dir);
+    if (e) {
+        /* Set dir back to the first entry that was not sent */
+        if (saved_dir_pos == 0) {
+            v9fs_co_rewinddir(pdu, fidp);
+        } else {
+            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
+        }
+    }
 
-    v9fs_path_free(&path);
+out:
+    v9fs_free_dirents(entries);
     if (err < 0) {
         return err;
     }
@@ -2245,10 +2259,17 @@ static void coroutine_fn v9fs_read(void *opaque)
             err = -EOPNOTSUPP;
             goto out;
         }
-        if (off == 0) {
-            v9fs_co_rewinddir(pdu, fidp);
+        off_t dir_pos = 0;
+
+        /* Continue from where the previous T_read left the directory */
+        if (off != 0) {
+            dir_pos = v9fs_co_telldir(pdu, fidp);
+            if (dir_pos < 0) {
+                err = dir_pos;
+                goto out;
+            }
         }
-        count = v9fs_do_readdir_with_stat(pdu, fidp, max_count);
+        count = v9fs_do_readdir_with_stat(pdu, fidp, dir_pos, max_count);
         if (count < 0) {
             err = count;
             goto out;
@@ -2320,18 +2341,6 @@ size_t v9fs_readdir_response_size(V9fsString *name)
     return 24 + v9fs_string_size(name);
 }
 
-static void v9fs_free_dirents(struct V9fsDirEnt *e)
-{
-    struct V9fsDirEnt *next = NULL;
-
-    for (; e; e = next) {
-        next = e->next;
-        g_free(e->dent);
-        g_free(e->st);
-        g_free(e);
-    }
-}
-
 static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
                                         off_t offset, int32_t max_count)
 {
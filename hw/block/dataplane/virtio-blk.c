@@ -19,6 +19,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/thread.h"
 #include "qemu/error-report.h"
+#include "qemu/timer.h"
 #include "hw/virtio/virtio-access.h"
 #include "hw/virtio/virtio-blk.h"
 #include "virtio-blk.h"
@@ -26,6 +27,14 @@
 #include "hw/virtio/virtio-bus.h"
 #include "qom/object_interfaces.h"
 
+/* Completions whose notification is being held back */
+typedef struct VirtIOBlockCoalesce {
+    VirtIOBlockDataPlane *s;
+    VirtQueue *vq;
+    QEMUTimer *timer;
+    unsigned int pending;
+} VirtIOBlockCoalesce;
+
 struct VirtIOBlockDataPlane {
     bool starting;
     bool stopping;
@@ -35,6 +44,7 @@ struct VirtIOBlockDataPlane {
     QEMUBH *bh;                     /* bh for guest notification */
     unsigned long *batch_notify_vqs;
     bool batch_notifications;
+    VirtIOBlockCoalesce *coalesce;  /* per virtqueue, if coalesce_usecs */
 
     /* Note that these EventNotifiers are assigned by value.  This is
      * fine as long as you do not call event_notifier_cleanup on them
@@ -45,8 +55,8 @@ struct VirtIOBlockDataPlane {
     AioContext *ctx;
 };
 
-/* Raise an interrupt to signal guest, if necessary */
-void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
+static void virtio_blk_data_plane_notify_now(VirtIOBlockDataPlane *s,
+                                             VirtQueue *vq)
 {
     if (s->batch_notifications) {
         set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
@@ -56,6 +66,46 @@ void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
     }
 }
 
+static void virtio_blk_coalesce_timer_cb(void *opaque)
+{
+    VirtIOBlockCoalesce *c = opaque;
+
+    if (c->pending) {
+        c->pending = 0;
+        virtio_blk_data_plane_notify_now(c->s, c->vq);
+    }
+}
+
+/*
+ * Raise an interrupt to signal guest, if necessary, for @num completions.
+ *
+ * With interrupt coalescing, the notification is delayed by up to
+ * coalesce_usecs or until coalesce_max_count completions are pending.  It is
+ * never delayed when the virtqueue has no other requests in flight: the guest
+ * is then waiting for these completions and nothing else would trigger it.
+ */
+void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq,
+                                  unsigned int num)
+{
+    if (s->coalesce) {
+        VirtIOBlockCoalesce *c = &s->coalesce[virtio_get_queue_index(vq)];
+        uint32_t max_count = s->conf->coalesce_max_count;
+
+        c->pending += num;
+        if (virtqueue_get_inuse(vq) && (!max_count || c->pending < max_count)) {
+            if (!timer_pending(c->timer)) {
+                timer_mod(c->timer, qemu_clock_get_us(QEMU_CLOCK_REALTIME) +
+                                    s->conf->coalesce_usecs);
+            }
+            return;
+        }
+        c->pending = 0;
+        timer_del(c->timer);
+    }
+
+    virtio_blk_data_plane_notify_now(s, vq);
+}
+
 static void notify_guest_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
@@ -130,6 +180,20 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
+    if (conf->coalesce_usecs) {
+        unsigned i;
+
+        s->coalesce = g_new0(VirtIOBlockCoalesce, conf->num_queues);
+        for (i = 0; i < conf->num_queues; i++) {
+            s->coalesce[i].s = s;
+            s->coalesce[i].vq = virtio_get_queue(vdev, i);
+            s->coalesce[i].timer = aio_timer_new(s->ctx, QEMU_CLOCK_REALTIME,
+                                                 SCALE_US,
+                                                 virtio_blk_coalesce_timer_cb,
+                                                 &s->coalesce[i]);
+        }
+    }
+
     *dataplane = s;
 
     return true;
@@ -146,6 +210,14 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 
     vblk = VIRTIO_BLK(s->vdev);
     assert(!vblk->dataplane_started);
+    if (s->coalesce) {
+        unsigned i;
+
+        for (i = 0; i < s->conf->num_queues; i++) {
+            timer_free(s->coalesce[i].timer);
+        }
+        g_free(s->coalesce);
+    }
     g_free(s->batch_notify_vqs);
     qemu_bh_delete(s->bh);
     if (s->iothread) {
@@ -269,6 +341,22 @@ static void virtio_blk_data_plane_stop_bh(void *opaque)
     }
 }
 
+/*
+ * Deliver notifications held back by coalescing.
+ *
+ * Context: BH in IOThread
+ */
+static void virtio_blk_data_plane_flush_coalesced_bh(void *opaque)
+{
+    VirtIOBlockDataPlane *s = opaque;
+    unsigned i;
+
+    for (i = 0; i < s->conf->num_queues; i++) {
+        timer_del(s->coalesce[i].timer);
+        virtio_blk_coalesce_timer_cb(&s->coalesce[i]);
+    }
+}
+
 /* Context: QEMU global mutex held */
 void virtio_blk_data_plane_stop(VirtIODevice *vdev)
 {
@@ -299,6 +387,11 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
      * keep the BlockBackend in the iothread, that's ok */
     blk_set_aio_context(s->conf->conf.blk, qemu_get_aio_context(), NULL);
 
+    if (s->coalesce) {
+        aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_flush_coalesced_bh,
+                            s);
+    }
+
     aio_context_release(s->ctx);
 
     for (i = 0; i < nvqs; i++) {
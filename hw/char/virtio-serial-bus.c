@@ -158,6 +158,43 @@ static void discard_throttle_data(VirtIOSerialPort *port)
     }
 }
 
+/*
+ * Hand the rest of the current element to the port with a single call,
+ * directly from the guest buffers, and remember how far it got if the
+ * port got throttled.
+ */
+static void flush_elem_iov(VirtIOSerialPort *port, VirtIOSerialPortClass *vsc)
+{
+    VirtQueueElement *elem = port->elem;
+    unsigned int cnt = elem->out_num - port->iov_idx;
+    g_autofree struct iovec *iov = NULL;
+    ssize_t ret;
+
+    if (!cnt) {
+        return;
+    }
+
+    iov = g_new(struct iovec, cnt);
+    cnt = iov_copy(iov, cnt, elem->out_sg + port->iov_idx, cnt,
+                   port->iov_offset, SIZE_MAX);
+    ret = vsc->have_data_iov(port, iov, cnt);
+    if (!port->elem || !port->throttled) {
+        return;
+    }
+
+    while (ret > 0 && port->iov_idx < elem->out_num) {
+        size_t left = elem->out_sg[port->iov_idx].iov_len - port->iov_offset;
+
+        if (ret < left) {
+            port->iov_offset += ret;
+            break;
+        }
+        ret -= left;
+        port->iov_idx++;
+        port->iov_offset = 0;
+    }
+}
+
 static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
                                  VirtIODevice *vdev)
 {
@@ -181,26 +218,33 @@ static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
             port->iov_offset = 0;
         }
 
-        for (i = port->iov_idx; i < port->elem->out_num; i++) {
-            size_t buf_size;
-            ssize_t ret;
-
-            buf_size = port->elem->out_sg[i].iov_len - port->iov_offset;
-            ret = vsc->have_data(port,
-                                  port->elem->out_sg[i].iov_base
-                                  + port->iov_offset,
-                                  buf_size);
+        if (vsc->have_data_iov) {
+            flush_elem_iov(port, vsc);
             if (!port->elem) { /* bail if we got disconnected */
                 return;
             }
-            if (port->throttled) {
-                port->iov_idx = i;
-                if (ret > 0) {
-                    port->iov_offset += ret;
+        } else {
+            for (i = port->iov_idx; i < port->elem->out_num; i++) {
+                size_t buf_size;
+                ssize_t ret;
+
+                buf_size = port->elem->out_sg[i].iov_len - port->iov_offset;
+                ret = vsc->have_data(port,
+                                      port->elem->out_sg[i].iov_base
+                                      + port->iov_offset,
+                                      buf_size);
+                if (!port->elem) { /* bail if we got disconnected */
+                    return;
                 }
-                break;
+                if (port->throttled) {
+                    port->iov_idx = i;
+                    if (ret > 0) {
+                        port->iov_offset += ret;
+                    }
+                    break;
+                }
+                port->iov_offset = 0;
             }
-            port->iov_offset = 0;
         }
         if (port->throttled) {
             break;
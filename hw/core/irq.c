@@ -24,6 +24,7 @@
 #include "qemu/osdep.h"
 #include "qemu/main-loop.h"
 #include "hw/irq.h"
+#include "hw/vmstate-if.h"
 #include "qom/object.h"
 
 DECLARE_INSTANCE_CHECKER(struct IRQState, IRQ,
@@ -42,6 +43,7 @@ void qemu_set_irq(qemu_irq irq, int level)
     if (!irq)
         return;
 
+    device_snapshot_touch(irq->opaque);
     irq->handler(irq->opaque, irq->n, level);
 }
 
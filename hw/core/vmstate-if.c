@@ -9,6 +9,8 @@
 #include "qemu/osdep.h"
 #include "hw/vmstate-if.h"
 
+GHashTable *device_snapshot_touched;
+
 static const TypeInfo vmstate_if_info = {
     .name = TYPE_VMSTATE_IF,
     .parent = TYPE_INTERFACE,
@@ -22,6 +22,7 @@
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/xxhash.h"
 #include "qapi/error.h"
 #include "hw/sysbus.h"
 #include "exec/address-spaces.h"
@@ -262,6 +263,8 @@ static void vtd_reset_iotlb_locked(IntelIOMMUState *s)
 {
     assert(s->iotlb);
     g_hash_table_remove_all(s->iotlb);
+    QTAILQ_INIT(&s->iotlb_lru);
+    memset(s->pde_cache, 0, sizeof(s->pde_cache));
 }
 
 static void vtd_reset_iotlb(IntelIOMMUState *s)
@@ -304,12 +307,35 @@ static VTDIOTLBEntry *vtd_lookup_iotlb(IntelIOMMUState *s, uint16_t source_id,
                                 source_id, level);
         entry = g_hash_table_lookup(s->iotlb, &key);
         if (entry) {
-            goto out;
+            s->iotlb_hits++;
+            QTAILQ_REMOVE(&s->iotlb_lru, entry, lru);
+            QTAILQ_INSERT_TAIL(&s->iotlb_lru, entry, lru);
+            return entry;
         }
     }
 
-out:
-    return entry;
+    s->iotlb_misses++;
+    return NULL;
+}
+
+/* Must be called with IOMMU lock held; frees @entry */
+static void vtd_remove_iotlb_entry(IntelIOMMUState *s, VTDIOTLBEntry *entry)
+{
+    QTAILQ_REMOVE(&s->iotlb_lru, entry, lru);
+    g_hash_table_remove(s->iotlb, &entry->key);
+}
+
+/* Must be called with IOMMU lock held */
+static void vtd_remove_iotlb_entries(IntelIOMMUState *s, GHRFunc func,
+                                     gpointer user_data)
+{
+    VTDIOTLBEntry *entry, *next;
+
+    QTAILQ_FOREACH_SAFE(entry, &s->iotlb_lru, lru, next) {
+        if (func(&entry->key, entry, user_data)) {
+            vtd_remove_iotlb_entry(s, entry);
+        }
+    }
 }
 
 /* Must be with IOMMU lock held */
@@ -318,13 +344,19 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
                              uint8_t access_flags, uint32_t level)
 {
     VTDIOTLBEntry *entry = g_malloc(sizeof(*entry));
-    uint64_t *key = g_malloc(sizeof(*key));
+    VTDIOTLBEntry *old;
     uint64_t gfn = vtd_get_iotlb_gfn(addr, level);
 
     trace_vtd_iotlb_page_update(source_id, addr, slpte, domain_id);
-    if (g_hash_table_size(s->iotlb) >= VTD_IOTLB_MAX_SIZE) {
-        trace_vtd_iotlb_reset("iotlb exceeds size limit");
-        vtd_reset_iotlb_locked(s);
+
+    entry->key = vtd_get_iotlb_key(gfn, source_id, level);
+    old = g_hash_table_lookup(s->iotlb, &entry->key);
+    if (old) {
+        vtd_remove_iotlb_entry(s, old);
+    } else if (g_hash_table_size(s->iotlb) >= s->iotlb_size) {
+        old = QTAILQ_FIRST(&s->iotlb_lru);
+        trace_vtd_iotlb_page_evict(old->gfn, old->domain_id);
+        vtd_remove_iotlb_entry(s, old);
     }
 
     entry->gfn = gfn;
@@ -332,8 +364,21 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
     entry->slpte = slpte;
     entry->access_flags = access_flags;
     entry->mask = vtd_slpt_level_page_mask(level);
-    *key = vtd_get_iotlb_key(gfn, source_id, level);
-    g_hash_table_replace(s->iotlb, key, entry);
+    g_hash_table_insert(s->iotlb, &entry->key, entry);
+    QTAILQ_INSERT_TAIL(&s->iotlb_lru, entry, lru);
+}
+
+/* Must be called with IOMMU lock held */
+static void vtd_pde_cache_invalidate_domain(IntelIOMMUState *s,
+                                            uint16_t domain_id)
+{
+    int i;
+
+    for (i = 0; i < VTD_PDE_CACHE_SIZE; i++) {
+        if (s->pde_cache[i].domain_id == domain_id) {
+            s->pde_cache[i].level = 0;
+        }
+    }
 }
 
 /* Given the reg addr of both the message data and address, generate an
@@ -1009,19 +1054,70 @@ static VTDBus *vtd_find_as_from_bus_num(IntelIOMMUState *s, uint8_t bus_num)
     return NULL;
 }
 
+/* Return the page-walk cache slot for the @level page table of @iova */
+static VTDPDECacheEntry *vtd_pde_cache_slot(IntelIOMMUState *s,
+                                            dma_addr_t root, uint64_t iova,
+                                            uint32_t level)
+{
+    uint64_t prefix = iova >> vtd_slpt_level_shift(level + 1);
+    uint32_t h = qemu_xxhash4(root, prefix ^ ((uint64_t)level << 56));
+
+    return &s->pde_cache[h & (VTD_PDE_CACHE_SIZE - 1)];
+}
+
+/*
+ * Look up the lowest level page table of @iova in the page-walk cache.
+ * On a hit, update @addr, @level, @reads and @writes to resume the
+ * walk from there.  Must be called with IOMMU lock held.
+ */
+static void vtd_pde_cache_lookup(IntelIOMMUState *s, dma_addr_t root,
+                                 uint16_t domain_id, uint64_t iova,
+                                 bool is_write, dma_addr_t *addr,
+                                 uint32_t *level, bool *reads, bool *writes)
+{
+    VTDPDECacheEntry *pde;
+    uint32_t l;
+
+    for (l = VTD_SL_PT_LEVEL; l < *level; l++) {
+        pde = vtd_pde_cache_slot(s, root, iova, l);
+        if (pde->level == l && pde->root == root &&
+            pde->domain_id == domain_id &&
+            pde->prefix == iova >> vtd_slpt_level_shift(l + 1)) {
+            /*
+             * Let a full walk find the faulting level if the upper
+             * levels deny the access.
+             */
+            if (!(is_write ? pde->writes : pde->reads)) {
+                break;
+            }
+            s->pde_cache_hits++;
+            *addr = pde->table;
+            *level = l;
+            *reads = *reads && pde->reads;
+            *writes = *writes && pde->writes;
+            return;
+        }
+    }
+    s->pde_cache_misses++;
+}
+
 /* Given the @iova, get relevant @slptep. @slpte_level will be the last level
  * of the translation, can be used for deciding the size of large page.
+ * Must be called with IOMMU lock held.
  */
 static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
-                             uint64_t iova, bool is_write,
+                             uint16_t domain_id, uint64_t iova, bool is_write,
                              uint64_t *slptep, uint32_t *slpte_level,
                              bool *reads, bool *writes, uint8_t aw_bits)
 {
-    dma_addr_t addr = vtd_get_iova_pgtbl_base(s, ce);
-    uint32_t level = vtd_get_iova_level(s, ce);
+    dma_addr_t root = vtd_get_iova_pgtbl_base(s, ce);
+    dma_addr_t addr = root;
+    uint32_t top_level = vtd_get_iova_level(s, ce);
+    uint32_t level = top_level;
     uint32_t offset;
     uint64_t slpte;
     uint64_t access_right_check;
+    VTDPDECacheEntry *pde;
 
     if (!vtd_iova_range_check(s, iova, ce, aw_bits)) {
         error_report_once("%s: detected IOVA overflow (iova=0x%" PRIx64 ")",
@@ -1032,6 +1128,9 @@ static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
     /* FIXME: what is the Atomics request here? */
     access_right_check = is_write ? VTD_SL_W : VTD_SL_R;
 
+    vtd_pde_cache_lookup(s, root, domain_id, iova, is_write,
+                         &addr, &level, reads, writes);
+
     while (true) {
         offset = vtd_iova_level_offset(iova, level);
         slpte = vtd_get_slpte(addr, offset);
@@ -1039,7 +1138,7 @@ static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
         if (slpte == (uint64_t)-1) {
             error_report_once("%s: detected read error on DMAR slpte "
                               "(iova=0x%" PRIx64 ")", __func__, iova);
-            if (level == vtd_get_iova_level(s, ce)) {
+            if (level == top_level) {
                 /* Invalid programming of context-entry */
                 return -VTD_FR_CONTEXT_ENTRY_INV;
             } else {
@@ -1070,6 +1169,15 @@ static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
         }
         addr = vtd_get_slpte_addr(slpte, aw_bits);
         level--;
+
+        pde = vtd_pde_cache_slot(s, root, iova, level);
+        pde->root = root;
+        pde->prefix = iova >> vtd_slpt_level_shift(level + 1);
+        pde->table = addr;
+        pde->domain_id = domain_id;
+        pde->level = level;
+        pde->reads = *reads;
+        pde->writes = *writes;
     }
 }
 
@@ -1463,8 +1571,13 @@ static int vtd_sync_shadow_page_table_range(VTDAddressSpace *vtd_as,
         .as = vtd_as,
         .domain_id = vtd_get_domain_id(s, ce),
     };
+    int ret;
 
-    return vtd_page_walk(s, ce, addr, addr + size, &info);
+    /* Let notifiers coalesce the entries of the range */
+    memory_region_iommu_notify_begin(&vtd_as->iommu);
+    ret = vtd_page_walk(s, ce, addr, addr + size, &info);
+    memory_region_iommu_notify_end(&vtd_as->iommu);
+    return ret;
 }
 
 static int vtd_sync_shadow_page_table(VTDAddressSpace *vtd_as)
@@ -1683,6 +1796,7 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
     uint64_t slpte, page_mask;
     uint32_t level;
     uint16_t source_id = vtd_make_source_id(bus_num, devfn);
+    uint16_t domain_id;
     int ret_fr;
     bool is_fpd_set = false;
     bool reads = true;
@@ -1762,13 +1876,14 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
         return true;
     }
 
-    ret_fr = vtd_iova_to_slpte(s, &ce, addr, is_write, &slpte, &level,
-                               &reads, &writes, s->aw_bits);
+    domain_id = vtd_get_domain_id(s, &ce);
+    ret_fr = vtd_iova_to_slpte(s, &ce, domain_id, addr, is_write, &slpte,
+                               &level, &reads, &writes, s->aw_bits);
     VTD_PE_GET_FPD_ERR(ret_fr, is_fpd_set, s, source_id, addr, is_write);
 
     page_mask = vtd_slpt_level_page_mask(level);
     access_flags = IOMMU_ACCESS_FLAG(reads, writes);
-    vtd_update_iotlb(s, source_id, vtd_get_domain_id(s, &ce), addr, slpte,
+    vtd_update_iotlb(s, source_id, domain_id, addr, slpte,
                      access_flags, level);
 out:
     vtd_iommu_unlock(s);
@@ -1954,8 +2069,8 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
     trace_vtd_inv_desc_iotlb_domain(domain_id);
 
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_domain,
-                                &domain_id);
+    vtd_remove_iotlb_entries(s, vtd_hash_remove_by_domain, &domain_id);
+    vtd_pde_cache_invalidate_domain(s, domain_id);
     vtd_iommu_unlock(s);
 
     QLIST_FOREACH(vtd_as, &s->vtd_as_with_notifiers, next) {
@@ -2018,7 +2133,13 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
     info.addr = addr;
     info.mask = ~((1 << am) - 1);
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
+    vtd_remove_iotlb_entries(s, vtd_hash_remove_by_page, &info);
+    /*
+     * Page-selective invalidation also covers the paging-structure
+     * caches of the domain; drop them all rather than tracking which
+     * directories map the range.
+     */
+    vtd_pde_cache_invalidate_domain(s, domain_id);
     vtd_iommu_unlock(s);
     vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am);
 }
@@ -3086,6 +3207,8 @@ static Property vtd_properties[] = {
     DEFINE_PROP_BOOL("caching-mode", IntelIOMMUState, caching_mode, FALSE),
     DEFINE_PROP_BOOL("x-scalable-mode", IntelIOMMUState, scalable_mode, FALSE),
     DEFINE_PROP_BOOL("dma-drain", IntelIOMMUState, dma_drain, true),
+    DEFINE_PROP_UINT32("x-iotlb-size", IntelIOMMUState, iotlb_size,
+                       VTD_IOTLB_DEFAULT_SIZE),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3772,6 +3895,11 @@ static bool vtd_decide_config(IntelIOMMUState *s, Error **errp)
         return false;
     }
 
+    if (!s->iotlb_size) {
+        error_setg(errp, "x-iotlb-size must be at least 1");
+        return false;
+    }
+
     return true;
 }
 
@@ -3839,7 +3967,16 @@ static void vtd_realize(DeviceState *dev, Error **errp)
     sysbus_init_mmio(SYS_BUS_DEVICE(s), &s->csrmem);
     /* No corresponding destroy */
     s->iotlb = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
-                                     g_free, g_free);
+                                     NULL, g_free);
+    QTAILQ_INIT(&s->iotlb_lru);
+    object_property_add_uint64_ptr(OBJECT(s), "x-iotlb-hits",
+                                   &s->iotlb_hits, OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(OBJECT(s), "x-iotlb-misses",
+                                   &s->iotlb_misses, OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(OBJECT(s), "x-pde-cache-hits",
+                                   &s->pde_cache_hits, OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(OBJECT(s), "x-pde-cache-misses",
+                                   &s->pde_cache_misses, OBJ_PROP_FLAG_READ);
     s->vtd_as_by_busptr = g_hash_table_new_full(vtd_uint64_hash, vtd_uint64_equal,
                                               g_free, g_free);
     vtd_init(s);
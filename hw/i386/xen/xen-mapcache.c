@@ -11,6 +11,8 @@
 #include "qemu/osdep.h"
 #include "qemu/units.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qapi/error.h"
 
 #include <sys/resource.h>
 
@@ -34,12 +36,14 @@
 
 #if HOST_LONG_BITS == 32
 #  define MCACHE_BUCKET_SHIFT 16
+#  define MCACHE_MAX_BUCKET_SHIFT 24
 #  define MCACHE_MAX_SIZE     (1UL<<31) /* 2GB Cap */
 #else
 #  define MCACHE_BUCKET_SHIFT 20
+#  define MCACHE_MAX_BUCKET_SHIFT 30
 #  define MCACHE_MAX_SIZE     (1UL<<35) /* 32GB Cap */
 #endif
-#define MCACHE_BUCKET_SIZE (1UL << MCACHE_BUCKET_SHIFT)
+#define MCACHE_BUCKET_SIZE (1UL << mapcache->mcache_bucket_shift)
 
 /* This is the size of the virtual address space reserve to QEMU that will not
  * be use by MapCache.
@@ -56,6 +60,8 @@ typedef struct MapCacheEntry {
 #define XEN_MAPCACHE_ENTRY_DUMMY (1 << 0)
     uint8_t flags;
     hwaddr size;
+    /* Value of MapCache.clock when the entry was last returned */
+    uint64_t last_used;
     struct MapCacheEntry *next;
 } MapCacheEntry;
 
@@ -80,9 +86,36 @@ typedef struct MapCache {
     phys_offset_to_gaddr_t phys_offset_to_gaddr;
     QemuMutex lock;
     void *opaque;
+
+    uint64_t clock;
+    /* Statistics, reported by the xen_map_cache_evict trace event */
+    uint64_t lookups;
+    uint64_t evictions;
 } MapCache;
 
 static MapCache *mapcache;
+static unsigned int mcache_bucket_shift = MCACHE_BUCKET_SHIFT;
+
+void xen_map_cache_set_bucket_size(uint64_t size, Error **errp)
+{
+    if (mapcache) {
+        error_setg(errp, "the mapcache is already initialized");
+        return;
+    }
+    if (!is_power_of_2(size) || size < XC_PAGE_SIZE ||
+        size > (1ULL << MCACHE_MAX_BUCKET_SHIFT)) {
+        error_setg(errp, "mapcache bucket size must be a power of 2 between "
+                   "%lu and %llu", (unsigned long)XC_PAGE_SIZE,
+                   1ULL << MCACHE_MAX_BUCKET_SHIFT);
+        return;
+    }
+    mcache_bucket_shift = ctz64(size);
+}
+
+uint64_t xen_map_cache_get_bucket_size(void)
+{
+    return 1ULL << mcache_bucket_shift;
+}
 
 static inline void mapcache_lock(void)
 {
@@ -112,6 +145,7 @@ void xen_map_cache_init(phys_offset_to_gaddr_t f, void *opaque)
 
     mapcache->phys_offset_to_gaddr = f;
     mapcache->opaque = opaque;
+    mapcache->mcache_bucket_shift = mcache_bucket_shift;
     qemu_mutex_init(&mapcache->lock);
 
     QTAILQ_INIT(&mapcache->locked_entries);
@@ -140,8 +174,8 @@ void xen_map_cache_init(phys_offset_to_gaddr_t f, void *opaque)
 
     mapcache->nr_buckets =
         (((mapcache->max_mcache_size >> XC_PAGE_SHIFT) +
-          (1UL << (MCACHE_BUCKET_SHIFT - XC_PAGE_SHIFT)) - 1) >>
-         (MCACHE_BUCKET_SHIFT - XC_PAGE_SHIFT));
+          (1UL << (mapcache->mcache_bucket_shift - XC_PAGE_SHIFT)) - 1) >>
+         (mapcache->mcache_bucket_shift - XC_PAGE_SHIFT));
 
     size = mapcache->nr_buckets * sizeof (MapCacheEntry);
     size = (size + XC_PAGE_SIZE - 1) & ~(XC_PAGE_SIZE - 1);
@@ -180,7 +214,8 @@ static void xen_remap_bucket(MapCacheEntry *entry,
     entry->valid_mapping = NULL;
 
     for (i = 0; i < nb_pfn; i++) {
-        pfns[i] = (address_index << (MCACHE_BUCKET_SHIFT-XC_PAGE_SHIFT)) + i;
+        pfns[i] = (address_index <<
+                   (mapcache->mcache_bucket_shift - XC_PAGE_SHIFT)) + i;
     }
 
     /*
@@ -250,7 +285,7 @@ static uint8_t *xen_map_cache_unlocked(hwaddr phys_addr, hwaddr size,
     bool dummy = false;
 
 tryagain:
-    address_index  = phys_addr >> MCACHE_BUCKET_SHIFT;
+    address_index  = phys_addr >> mapcache->mcache_bucket_shift;
     address_offset = phys_addr & (MCACHE_BUCKET_SIZE - 1);
 
     trace_xen_map_cache(phys_addr);
@@ -286,14 +321,22 @@ tryagain:
         cache_size = MCACHE_BUCKET_SIZE;
     }
 
+    mapcache->lookups++;
     entry = &mapcache->entry[address_index % mapcache->nr_buckets];
 
-    while (entry && (lock || entry->lock) && entry->vaddr_base &&
-            (entry->paddr_index != address_index || entry->size != cache_size ||
-             !test_bits(address_offset >> XC_PAGE_SHIFT,
-                 test_bit_size >> XC_PAGE_SHIFT,
-                 entry->valid_mapping))) {
-        if (!free_entry && !entry->lock) {
+    /*
+     * Look for the mapping in the whole chain.  If it is not there, reuse
+     * an empty entry or else the least recently used unlocked one.
+     */
+    while (entry && (!entry->vaddr_base ||
+            entry->paddr_index != address_index || entry->size != cache_size ||
+            !test_bits(address_offset >> XC_PAGE_SHIFT,
+                       test_bit_size >> XC_PAGE_SHIFT,
+                       entry->valid_mapping))) {
+        if (!entry->lock &&
+            (!free_entry || !entry->vaddr_base ||
+             (free_entry->vaddr_base &&
+              entry->last_used < free_entry->last_used))) {
             free_entry = entry;
             free_pentry = pentry;
         }
@@ -303,6 +346,11 @@ tryagain:
     if (!entry && free_entry) {
         entry = free_entry;
         pentry = free_pentry;
+        if (entry->vaddr_base) {
+            mapcache->evictions++;
+            trace_xen_map_cache_evict(entry->paddr_index, address_index,
+                                      mapcache->lookups, mapcache->evictions);
+        }
     }
     if (!entry) {
         entry = g_malloc0(sizeof (MapCacheEntry));
@@ -338,6 +386,7 @@ tryagain:
     }
 
     mapcache->last_entry = entry;
+    entry->last_used = ++mapcache->clock;
     if (lock) {
         MapCacheRev *reventry = g_malloc0(sizeof(MapCacheRev));
         entry->lock++;
@@ -399,7 +448,7 @@ ram_addr_t xen_ram_addr_from_mapcache(void *ptr)
         DPRINTF("Trying to find address %p that is not in the mapcache!\n", ptr);
         raddr = 0;
     } else {
-        raddr = (reventry->paddr_index << MCACHE_BUCKET_SHIFT) +
+        raddr = (reventry->paddr_index << mapcache->mcache_bucket_shift) +
              ((unsigned long) ptr - (unsigned long) entry->vaddr_base);
     }
     mapcache_unlock();
@@ -522,7 +571,7 @@ static uint8_t *xen_replace_cache_entry_unlocked(hwaddr old_phys_addr,
     hwaddr address_index, address_offset;
     hwaddr test_bit_size, cache_size = size;
 
-    address_index  = old_phys_addr >> MCACHE_BUCKET_SHIFT;
+    address_index  = old_phys_addr >> mapcache->mcache_bucket_shift;
     address_offset = old_phys_addr & (MCACHE_BUCKET_SIZE - 1);
 
     assert(size);
@@ -547,7 +596,7 @@ static uint8_t *xen_replace_cache_entry_unlocked(hwaddr old_phys_addr,
         return NULL;
     }
 
-    address_index  = new_phys_addr >> MCACHE_BUCKET_SHIFT;
+    address_index  = new_phys_addr >> mapcache->mcache_bucket_shift;
     address_offset = new_phys_addr & (MCACHE_BUCKET_SIZE - 1);
 
     fprintf(stderr, "Replacing a dummy mapcache entry for "TARGET_FMT_plx \
@@ -505,20 +505,27 @@ static void net_tx_pkt_do_sw_csum(struct NetTxPkt *pkt)
 enum {
     NET_TX_PKT_FRAGMENT_L2_HDR_POS = 0,
     NET_TX_PKT_FRAGMENT_L3_HDR_POS,
+    NET_TX_PKT_FRAGMENT_L4_HDR_POS,
     NET_TX_PKT_FRAGMENT_HEADER_NUM
 };
 
 #define NET_MAX_FRAG_SG_LIST (64)
 
+/* A TCP header with the largest options */
+#define NET_TX_PKT_MAX_L4_HDR_LEN (60)
+
+/*
+ * Point @dst at up to @max_len bytes of the payload, starting at the
+ * position given by @src_idx and @src_offset, and advance it past them.
+ */
 static size_t net_tx_pkt_fetch_fragment(struct NetTxPkt *pkt,
-    int *src_idx, size_t *src_offset, struct iovec *dst, int *dst_idx)
+    int *src_idx, size_t *src_offset, size_t max_len,
+    struct iovec *dst, int *dst_idx)
 {
     size_t fetched = 0;
     struct iovec *src = pkt->vec;
 
-    *dst_idx = NET_TX_PKT_FRAGMENT_HEADER_NUM;
-
-    while (fetched < IP_FRAG_ALIGN_SIZE(pkt->virt_hdr.gso_size)) {
+    while (fetched < max_len) {
 
         /* no more place in fragment iov */
         if (*dst_idx == NET_MAX_FRAG_SG_LIST) {
@@ -530,10 +537,9 @@ static size_t net_tx_pkt_fetch_fragment(struct NetTxPkt *pkt,
             break;
         }
 
-
         dst[*dst_idx].iov_base = src[*src_idx].iov_base + *src_offset;
         dst[*dst_idx].iov_len = MIN(src[*src_idx].iov_len - *src_offset,
-            IP_FRAG_ALIGN_SIZE(pkt->virt_hdr.gso_size) - fetched);
+            max_len - fetched);
 
         *src_offset += dst[*dst_idx].iov_len;
         fetched += dst[*dst_idx].iov_len;
@@ -559,49 +565,141 @@ static inline void net_tx_pkt_sendv(struct NetTxPkt *pkt,
     }
 }
 
-static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
-    NetClientState *nc)
+/*
+ * Split a TCP or UDP packet into segments of gso_size bytes of payload,
+ * each with its own copy of the L4 header and its own L4 checksum; UDP
+ * segments are separate datagrams.  The L2 and L3 headers are updated
+ * in place before each segment is sent, and the payload of each segment
+ * points into the guest buffers, so the payload is not copied and each
+ * byte of it is summed once.
+ */
+static bool net_tx_pkt_do_sw_gso(struct NetTxPkt *pkt, NetClientState *nc)
 {
     struct iovec fragment[NET_MAX_FRAG_SG_LIST];
-    size_t fragment_len = 0;
-    bool more_frags = false;
-
-    /* some pointers for shorter code */
-    void *l2_iov_base, *l3_iov_base;
-    size_t l2_iov_len, l3_iov_len;
-    int src_idx =  NET_TX_PKT_PL_START_FRAG, dst_idx;
+    uint8_t gso_type = pkt->virt_hdr.gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+    struct iovec *l2 = &pkt->vec[NET_TX_PKT_L2HDR_FRAG];
+    struct iovec *l3 = &pkt->vec[NET_TX_PKT_L3HDR_FRAG];
+    uint16_t l3_proto = eth_get_l3_proto(l2, 1, l2->iov_len);
+    uint8_t l4_hdr[NET_TX_PKT_MAX_L4_HDR_LEN];
+    struct tcp_hdr *tcp = (struct tcp_hdr *)l4_hdr;
+    struct udp_hdr *udp = (struct udp_hdr *)l4_hdr;
+    size_t l4_hdr_len, csum_offset, skip;
+    int src_idx = NET_TX_PKT_PL_START_FRAG, dst_idx;
     size_t src_offset = 0;
-    size_t fragment_offset = 0;
+    size_t data_len, seg_len, offset = 0;
+    uint32_t tcp_seq = 0;
+    uint8_t tcp_flags = 0;
+    uint16_t ip_id = 0;
 
-    l2_iov_base = pkt->vec[NET_TX_PKT_L2HDR_FRAG].iov_base;
-    l2_iov_len = pkt->vec[NET_TX_PKT_L2HDR_FRAG].iov_len;
-    l3_iov_base = pkt->vec[NET_TX_PKT_L3HDR_FRAG].iov_base;
-    l3_iov_len = pkt->vec[NET_TX_PKT_L3HDR_FRAG].iov_len;
+    if (pkt->virt_hdr.hdr_len < pkt->hdr_len || !pkt->virt_hdr.gso_size) {
+        return false;
+    }
+    l4_hdr_len = pkt->virt_hdr.hdr_len - pkt->hdr_len;
+    if (l4_hdr_len > sizeof(l4_hdr) || l4_hdr_len > pkt->payload_len) {
+        return false;
+    }
 
-    /* Copy headers */
-    fragment[NET_TX_PKT_FRAGMENT_L2_HDR_POS].iov_base = l2_iov_base;
-    fragment[NET_TX_PKT_FRAGMENT_L2_HDR_POS].iov_len = l2_iov_len;
-    fragment[NET_TX_PKT_FRAGMENT_L3_HDR_POS].iov_base = l3_iov_base;
-    fragment[NET_TX_PKT_FRAGMENT_L3_HDR_POS].iov_len = l3_iov_len;
+    switch (gso_type) {
+    case VIRTIO_NET_HDR_GSO_TCPV4:
+    case VIRTIO_NET_HDR_GSO_TCPV6:
+        if (l4_hdr_len < sizeof(struct tcp_hdr)) {
+            return false;
+        }
+        csum_offset = offsetof(struct tcp_hdr, th_sum);
+        break;
+    case VIRTIO_NET_HDR_GSO_UDP:
+        if (l4_hdr_len != sizeof(struct udp_hdr)) {
+            return false;
+        }
+        csum_offset = offsetof(struct udp_hdr, uh_sum);
+        break;
+    default:
+        return false;
+    }
+
+    if (l3_proto == ETH_P_IP) {
+        ip_id = be16_to_cpu(((struct ip_header *)l3->iov_base)->ip_id);
+    } else if (l3_proto != ETH_P_IPV6) {
+        return false;
+    }
+
+    /* The L4 header is the start of the payload, keep it aside */
+    iov_to_buf(&pkt->vec[NET_TX_PKT_PL_START_FRAG], pkt->payload_frags,
+               0, l4_hdr, l4_hdr_len);
+    for (skip = l4_hdr_len; skip; ) {
+        size_t len = MIN(pkt->vec[src_idx].iov_len - src_offset, skip);
+
+        src_offset += len;
+        skip -= len;
+        if (src_offset == pkt->vec[src_idx].iov_len) {
+            src_offset = 0;
+            src_idx++;
+        }
+    }
+    data_len = pkt->payload_len - l4_hdr_len;
+
+    if (gso_type != VIRTIO_NET_HDR_GSO_UDP) {
+        tcp_seq = be32_to_cpu(tcp->th_seq);
+        tcp_flags = tcp->th_flags;
+    }
 
+    fragment[NET_TX_PKT_FRAGMENT_L2_HDR_POS] = *l2;
+    fragment[NET_TX_PKT_FRAGMENT_L3_HDR_POS] = *l3;
+    fragment[NET_TX_PKT_FRAGMENT_L4_HDR_POS].iov_base = l4_hdr;
+    fragment[NET_TX_PKT_FRAGMENT_L4_HDR_POS].iov_len = l4_hdr_len;
 
-    /* Put as much data as possible and send */
     do {
-        fragment_len = net_tx_pkt_fetch_fragment(pkt, &src_idx, &src_offset,
-            fragment, &dst_idx);
+        uint32_t csum_cntr, cso;
 
-        more_frags = (fragment_offset + fragment_len < pkt->payload_len);
+        dst_idx = NET_TX_PKT_FRAGMENT_HEADER_NUM;
+        seg_len = net_tx_pkt_fetch_fragment(pkt, &src_idx, &src_offset,
+                                            pkt->virt_hdr.gso_size,
+                                            fragment, &dst_idx);
 
-        eth_setup_ip4_fragmentation(l2_iov_base, l2_iov_len, l3_iov_base,
-            l3_iov_len, fragment_len, fragment_offset, more_frags);
+        if (l3_proto == ETH_P_IP) {
+            struct ip_header *ip = l3->iov_base;
 
-        eth_fix_ip4_checksum(l3_iov_base, l3_iov_len);
+            ip->ip_len = cpu_to_be16(l3->iov_len + l4_hdr_len + seg_len);
+            ip->ip_id = cpu_to_be16(ip_id++);
+            eth_fix_ip4_checksum(ip, l3->iov_len);
+            csum_cntr = eth_calc_ip4_pseudo_hdr_csum(ip, l4_hdr_len + seg_len,
+                                                     &cso);
+        } else {
+            struct ip6_header *ip6 = l3->iov_base;
 
-        net_tx_pkt_sendv(pkt, nc, fragment, dst_idx);
+            ip6->ip6_plen = cpu_to_be16(l3->iov_len -
+                                        sizeof(struct ip6_header) +
+                                        l4_hdr_len + seg_len);
+            csum_cntr = eth_calc_ip6_pseudo_hdr_csum(ip6, l4_hdr_len + seg_len,
+                                                     pkt->l4proto, &cso);
+        }
 
-        fragment_offset += fragment_len;
+        if (gso_type == VIRTIO_NET_HDR_GSO_UDP) {
+            udp->uh_ulen = cpu_to_be16(l4_hdr_len + seg_len);
+        } else {
+            tcp->th_seq = cpu_to_be32(tcp_seq + offset);
+            tcp->th_flags = tcp_flags;
+            /* FIN and PSH belong to the last segment, CWR to the first */
+            if (offset + seg_len < data_len) {
+                tcp->th_flags &= ~(TH_FIN | TH_PUSH);
+            }
+            if (offset) {
+                tcp->th_flags &= ~TH_CWR;
+            }
+        }
+
+        stw_he_p(l4_hdr + csum_offset, 0);
+        csum_cntr += net_checksum_add_cont(l4_hdr_len, l4_hdr, cso);
+        csum_cntr += net_checksum_add_iov(
+            &fragment[NET_TX_PKT_FRAGMENT_HEADER_NUM],
+            dst_idx - NET_TX_PKT_FRAGMENT_HEADER_NUM,
+            0, seg_len, cso + l4_hdr_len);
+        stw_be_p(l4_hdr + csum_offset, net_checksum_finish_nozero(csum_cntr));
+
+        net_tx_pkt_sendv(pkt, nc, fragment, dst_idx);
 
-    } while (fragment_len && more_frags);
+        offset += seg_len;
+    } while (seg_len && offset < data_len);
 
     return true;
 }
@@ -610,7 +708,9 @@ bool net_tx_pkt_send(struct NetTxPkt *pkt, NetClientState *nc)
 {
     assert(pkt);
 
+    /* Segments get their own checksum in net_tx_pkt_do_sw_gso() */
     if (!pkt->has_virt_hdr &&
+        pkt->virt_hdr.gso_type == VIRTIO_NET_HDR_GSO_NONE &&
         pkt->virt_hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
         net_tx_pkt_do_sw_csum(pkt);
     }
@@ -635,7 +735,7 @@ bool net_tx_pkt_send(struct NetTxPkt *pkt, NetClientState *nc)
         return true;
     }
 
-    return net_tx_pkt_do_sw_fragmentation(pkt, nc);
+    return net_tx_pkt_do_sw_gso(pkt, nc);
 }
 
 bool net_tx_pkt_send_loopback(struct NetTxPkt *pkt, NetClientState *nc)
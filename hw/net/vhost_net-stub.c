@@ -97,6 +97,11 @@ int vhost_set_vring_enable(NetClientState *nc, int enable)
     return 0;
 }
 
+VhostQueueInfoList *vhost_net_query_queues(NetClientState *nc)
+{
+    return NULL;
+}
+
 int vhost_net_set_mtu(struct vhost_net *net, uint16_t mtu)
 {
     return 0;
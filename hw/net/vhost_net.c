@@ -457,6 +457,55 @@ VHostNetState *get_vhost_net(NetClientState *nc)
     return vhost_net;
 }
 
+VhostQueueInfoList *vhost_net_query_queues(NetClientState *nc)
+{
+    VhostQueueInfoList *head = NULL, **tail = &head;
+    VHostNetState *net;
+    int i;
+
+#ifdef CONFIG_VHOST_NET_USER
+    /* Unlike get_vhost_net(), cope with a disconnected backend */
+    if (nc->info->type == NET_CLIENT_DRIVER_VHOST_USER) {
+        net = vhost_user_get_vhost_net(nc);
+    } else
+#endif
+    {
+        net = get_vhost_net(nc);
+    }
+    if (!net) {
+        return NULL;
+    }
+
+    for (i = 0; i < net->dev.nvqs; i++) {
+        struct vhost_vring_info vring;
+        VhostQueueInfoList *entry = g_new0(VhostQueueInfoList, 1);
+        VhostQueueInfo *info = g_new0(VhostQueueInfo, 1);
+
+        vhost_dev_get_vring_info(&net->dev, net->dev.vq_index + i, &vring);
+        info->queue = net->dev.vq_index + i;
+        if (vring.has_idx) {
+            info->has_avail_idx = info->has_used_idx = true;
+            info->avail_idx = vring.avail_idx;
+            info->used_idx = vring.used_idx;
+            info->has_inflight = true;
+            info->inflight = (uint16_t)(vring.avail_idx - vring.used_idx);
+        }
+        if (vring.has_stats) {
+            info->has_kicks = info->has_calls = true;
+            info->has_suppressed_calls = true;
+            info->kicks = vring.stats.kicks;
+            info->calls = vring.stats.calls;
+            info->suppressed_calls = vring.stats.suppressed_calls;
+        }
+
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return head;
+}
+
 int vhost_set_vring_enable(NetClientState *nc, int enable)
 {
     VHostNetState *net = get_vhost_net(nc);
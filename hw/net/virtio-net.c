@@ -44,6 +44,7 @@
 #include "hw/pci/pci.h"
 #include "net_rx_pkt.h"
 #include "hw/virtio/vhost.h"
+#include "monitor/monitor.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -55,6 +56,9 @@
 #define VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE 256
 
 /* for now, only allow larger queues; with virtio-1, guest can downsize */
+/* Transmitted buffers are given back to the guest in batches of this size */
+#define VIRTIO_NET_TX_PUBLISH_BATCH 32
+
 #define VIRTIO_NET_RX_QUEUE_MIN_SIZE VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE
 #define VIRTIO_NET_TX_QUEUE_MIN_SIZE VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE
 
@@ -1169,12 +1173,95 @@ static int virtio_net_handle_announce(VirtIONet *n, uint8_t cmd,
     }
 }
 
+static bool virtio_net_attach_ebpf_rss(VirtIONet *n)
+{
+    struct EBPFRSSConfig config = {};
+
+    if (!ebpf_rss_is_loaded(&n->ebpf_rss)) {
+        return false;
+    }
+
+    config.redirect = n->rss_data.redirect;
+    config.populate_hash = n->rss_data.populate_hash;
+    config.hash_types = n->rss_data.hash_types;
+    config.indirections_len = n->rss_data.indirections_len;
+    config.default_queue = n->rss_data.default_queue;
+
+    if (!ebpf_rss_set_all(&n->ebpf_rss, &config,
+                          n->rss_data.indirections_table, n->rss_data.key)) {
+        return false;
+    }
+
+    return qemu_set_steering_ebpf(qemu_get_queue(n->nic)->peer,
+                                  n->ebpf_rss.program_fd);
+}
+
+static void virtio_net_detach_ebpf_rss(VirtIONet *n)
+{
+    if (ebpf_rss_is_loaded(&n->ebpf_rss)) {
+        qemu_set_steering_ebpf(qemu_get_queue(n->nic)->peer, -1);
+    }
+}
+
+/*
+ * Steer packets in the backend with the eBPF program if possible, and in
+ * virtio_net_receive_rcu otherwise.  The program cannot populate the hash
+ * reported to the guest, so hash reports always use the software path.
+ */
+static void virtio_net_commit_rss_config(VirtIONet *n)
+{
+    if (n->rss_data.enabled) {
+        n->rss_data.enabled_software_rss = n->rss_data.populate_hash;
+        if (n->rss_data.populate_hash) {
+            virtio_net_detach_ebpf_rss(n);
+        } else if (!virtio_net_attach_ebpf_rss(n)) {
+            n->rss_data.enabled_software_rss = true;
+        }
+        trace_virtio_net_rss_steering(n->rss_data.enabled_software_rss);
+    } else {
+        virtio_net_detach_ebpf_rss(n);
+    }
+}
+
 static void virtio_net_disable_rss(VirtIONet *n)
 {
     if (n->rss_data.enabled) {
         trace_virtio_net_rss_disable();
     }
     n->rss_data.enabled = false;
+    virtio_net_commit_rss_config(n);
+}
+
+static bool virtio_net_load_ebpf_fds(VirtIONet *n, Error **errp)
+{
+    g_auto(GStrv) names = g_strsplit(n->ebpf_rss_fds, ":", 0);
+    int fds[4];
+    int i, j;
+
+    if (g_strv_length(names) != ARRAY_SIZE(fds)) {
+        error_setg(errp, "'ebpf-rss-fds' must list the program, configuration "
+                   "map, Toeplitz key map and indirection table map fds, "
+                   "separated by ':'");
+        return false;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(fds); i++) {
+        fds[i] = monitor_fd_param(monitor_cur(), names[i], errp);
+        if (fds[i] < 0) {
+            goto fail;
+        }
+    }
+
+    if (ebpf_rss_load_fds(&n->ebpf_rss, fds[0], fds[1], fds[2], fds[3],
+                          errp)) {
+        return true;
+    }
+
+fail:
+    for (j = 0; j < i; j++) {
+        close(fds[j]);
+    }
+    return false;
 }
 
 static uint16_t virtio_net_handle_rss(VirtIONet *n,
@@ -1292,6 +1379,7 @@ static uint16_t virtio_net_handle_rss(VirtIONet *n,
     trace_virtio_net_rss_enable(n->rss_data.hash_types,
                                 n->rss_data.indirections_len,
                                 temp.b);
+    virtio_net_commit_rss_config(n);
     return queues;
 error:
     trace_virtio_net_rss_error(err_msg, err_value);
@@ -1674,7 +1762,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
         return -1;
     }
 
-    if (!no_rss && n->rss_data.enabled) {
+    if (!no_rss && n->rss_data.enabled && n->rss_data.enabled_software_rss) {
         int index = virtio_net_process_rss(nc, buf, size);
         if (index >= 0) {
             NetClientState *nc2 = qemu_get_subqueue(n->nic, index);
@@ -1717,7 +1805,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             virtio_error(vdev,
                          "virtio-net receive queue contains no in buffers");
             virtqueue_detach_element(q->rx_vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_release(q->rx_vq, elem);
             return -1;
         }
 
@@ -1754,13 +1842,13 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
          * Otherwise, drop it. */
         if (!n->mergeable_rx_bufs && offset < size) {
             virtqueue_unpop(q->rx_vq, elem, total);
-            g_free(elem);
+            virtqueue_element_release(q->rx_vq, elem);
             return size;
         }
 
         /* signal other side */
         virtqueue_fill(q->rx_vq, elem, total, i++);
-        g_free(elem);
+        virtqueue_element_release(q->rx_vq, elem);
     }
 
     if (mhdr_cnt) {
@@ -1771,7 +1859,11 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    if (n->rx_batching) {
+        q->rx_notify_pending = true;
+    } else {
+        virtio_notify(vdev, q->rx_vq);
+    }
 
     return size;
 }
@@ -2389,6 +2481,36 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
     }
 }
 
+/*
+ * Receive a burst of packets from the peer and notify each queue that got
+ * some of them once, at the end.
+ */
+static int virtio_net_receive_batch(NetClientState *nc,
+                                    const struct iovec *pkts, int count)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int i, j;
+
+    n->rx_batching = true;
+    for (i = 0; i < count; i++) {
+        if (virtio_net_receive(nc, pkts[i].iov_base, pkts[i].iov_len) == 0) {
+            break;
+        }
+    }
+    n->rx_batching = false;
+
+    for (j = 0; j < n->max_queues; j++) {
+        VirtIONetQueue *q = &n->vqs[j];
+
+        if (q->rx_notify_pending) {
+            q->rx_notify_pending = false;
+            virtio_notify(vdev, q->rx_vq);
+        }
+    }
+    return i;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
@@ -2400,7 +2522,7 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
     virtio_notify(vdev, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_release(q->tx_vq, q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2408,11 +2530,30 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+static void virtio_net_tx_publish(VirtIONetQueue *q, VirtQueueElement **elems,
+                                  unsigned int num)
+{
+    static const unsigned int lens[VIRTIO_NET_TX_PUBLISH_BATCH];
+    unsigned int i;
+
+    if (!num) {
+        return;
+    }
+
+    virtqueue_push_batch(q->tx_vq, elems, lens, num);
+    virtio_notify(VIRTIO_DEVICE(q->n), q->tx_vq);
+    for (i = 0; i < num; i++) {
+        virtqueue_element_release(q->tx_vq, elems[i]);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *done[VIRTIO_NET_TX_PUBLISH_BATCH];
+    unsigned int num_done = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -2440,7 +2581,8 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         if (out_num < 1) {
             virtio_error(vdev, "virtio-net header not in first element");
             virtqueue_detach_element(q->tx_vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_release(q->tx_vq, elem);
+            virtio_net_tx_publish(q, done, num_done);
             return -EINVAL;
         }
 
@@ -2449,7 +2591,8 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 n->guest_hdr_len) {
                 virtio_error(vdev, "virtio-net header incorrect");
                 virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
+                virtqueue_element_release(q->tx_vq, elem);
+                virtio_net_tx_publish(q, done, num_done);
                 return -EINVAL;
             }
             if (n->needs_vnet_hdr_swap) {
@@ -2488,18 +2631,22 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
+            virtio_net_tx_publish(q, done, num_done);
             return -EBUSY;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        done[num_done++] = elem;
+        if (num_done == ARRAY_SIZE(done)) {
+            virtio_net_tx_publish(q, done, num_done);
+            num_done = 0;
+        }
 
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+    virtio_net_tx_publish(q, done, num_done);
     return num_packets;
 }
 
@@ -2786,6 +2933,7 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
     } else {
         trace_virtio_net_rss_disable();
     }
+    virtio_net_commit_rss_config(n);
     return 0;
 }
 
@@ -3050,6 +3198,7 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .receive_batch = virtio_net_receive_batch,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
@@ -3332,6 +3481,13 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    ebpf_rss_init(&n->ebpf_rss);
+    if (n->ebpf_rss_fds && !virtio_net_load_ebpf_fds(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
+
     n->vqs = g_malloc0(sizeof(VirtIONetQueue) * n->max_queues);
     n->curr_queues = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -3424,6 +3580,9 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     g_free(n->mac_table.macs);
     g_free(n->vlans);
 
+    virtio_net_detach_ebpf_rss(n);
+    ebpf_rss_unload(&n->ebpf_rss);
+
     if (n->failover) {
         device_listener_unregister(&n->primary_listener);
         g_free(n->primary_device_id);
@@ -3568,6 +3727,7 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_STRING("ebpf-rss-fds", VirtIONet, ebpf_rss_fds),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -23,6 +23,8 @@
 #include "migration/qemu-file-types.h"
 #include "migration/vmstate.h"
 #include "qemu/range.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu.h"
 #include "qapi/error.h"
 #include "trace.h"
 
@@ -174,12 +176,18 @@ void msix_write_config(PCIDevice *dev, uint32_t addr,
     }
 }
 
+/*
+ * The table region does not use the global lock: reads only look at the
+ * table, which msix_uninit() frees after an RCU grace period, while writes
+ * may fire or mask vectors and take the lock themselves.
+ */
 static uint64_t msix_table_mmio_read(void *opaque, hwaddr addr,
                                      unsigned size)
 {
     PCIDevice *dev = opaque;
+    uint8_t *table = qatomic_rcu_read(&dev->msix_table);
 
-    return pci_get_long(dev->msix_table + addr);
+    return table ? pci_get_long(table + addr) : 0;
 }
 
 static void msix_table_mmio_write(void *opaque, hwaddr addr,
@@ -187,11 +195,20 @@ static void msix_table_mmio_write(void *opaque, hwaddr addr,
 {
     PCIDevice *dev = opaque;
     int vector = addr / PCI_MSIX_ENTRY_SIZE;
+    bool locked = qemu_mutex_iothread_locked();
     bool was_masked;
 
-    was_masked = msix_is_masked(dev, vector);
-    pci_set_long(dev->msix_table + addr, val);
-    msix_handle_mask_update(dev, vector, was_masked);
+    if (!locked) {
+        qemu_mutex_lock_iothread();
+    }
+    if (dev->msix_table) {
+        was_masked = msix_is_masked(dev, vector);
+        pci_set_long(dev->msix_table + addr, val);
+        msix_handle_mask_update(dev, vector, was_masked);
+    }
+    if (!locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 static const MemoryRegionOps msix_table_mmio_ops = {
@@ -336,6 +353,7 @@ int msix_init(struct PCIDevice *dev, unsigned short nentries,
 
     memory_region_init_io(&dev->msix_table_mmio, OBJECT(dev), &msix_table_mmio_ops, dev,
                           "msix-table", table_size);
+    memory_region_clear_global_locking(&dev->msix_table_mmio);
     memory_region_add_subregion(table_bar, table_offset, &dev->msix_table_mmio);
     memory_region_init_io(&dev->msix_pba_mmio, OBJECT(dev), &msix_pba_mmio_ops, dev,
                           "msix-pba", pba_size);
@@ -408,8 +426,21 @@ static void msix_clear_all_vectors(PCIDevice *dev)
 }
 
 /* Clean up resources for the device. */
+typedef struct MSIXTableFree {
+    struct rcu_head rcu;
+    uint8_t *table;
+} MSIXTableFree;
+
+static void msix_table_free_rcu(MSIXTableFree *f)
+{
+    g_free(f->table);
+    g_free(f);
+}
+
 void msix_uninit(PCIDevice *dev, MemoryRegion *table_bar, MemoryRegion *pba_bar)
 {
+    MSIXTableFree *f;
+
     if (!msix_present(dev)) {
         return;
     }
@@ -421,8 +452,11 @@ void msix_uninit(PCIDevice *dev, MemoryRegion *table_bar, MemoryRegion *pba_bar)
     g_free(dev->msix_pba);
     dev->msix_pba = NULL;
     memory_region_del_subregion(table_bar, &dev->msix_table_mmio);
-    g_free(dev->msix_table);
-    dev->msix_table = NULL;
+    /* Table reads may still be in flight, see msix_table_mmio_read() */
+    f = g_new(MSIXTableFree, 1);
+    f->table = dev->msix_table;
+    qatomic_rcu_set(&dev->msix_table, NULL);
+    call_rcu(f, msix_table_free_rcu, rcu);
     g_free(dev->msix_entry_used);
     dev->msix_entry_used = NULL;
     dev->cap_present &= ~QEMU_PCI_CAP_MSIX;
@@ -61,7 +61,7 @@ void virtio_scsi_free_req(VirtIOSCSIReq *req)
 {
     qemu_iovec_destroy(&req->resp_iov);
     qemu_sglist_destroy(&req->qsgl);
-    g_free(req);
+    virtqueue_element_release(req->vq, &req->elem);
 }
 
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
@@ -578,6 +578,7 @@ void usb_packet_setup(USBPacket *p, int pid,
     p->short_not_ok = short_not_ok;
     p->int_req = int_req;
     p->combined = NULL;
+    p->sgl = NULL;
     qemu_iovec_reset(&p->iov);
     usb_packet_set_state(p, USB_PACKET_SETUP);
 }
@@ -23,6 +23,7 @@
 #include "hw/qdev-properties.h"
 #include "hw/scsi/scsi.h"
 #include "scsi/constants.h"
+#include "sysemu/dma.h"
 #include "qom/object.h"
 
 /* --------------------------------------------------------------------- */
@@ -143,6 +144,7 @@ struct UASRequest {
     SCSIRequest  *req;
     USBPacket    *data;
     bool         data_async;
+    bool         direct;      /* SCSI layer transfers to req->data->sgl */
     bool         active;
     bool         complete;
     uint32_t     buf_off;
@@ -605,12 +607,41 @@ static void usb_uas_scsi_command_complete(SCSIRequest *r,
     trace_usb_uas_scsi_complete(req->uas->dev.addr, req->tag, status, resid);
     req->complete = true;
     if (req->data) {
+        if (req->direct) {
+            req->data->actual_length =
+                req->data->iov.size - MIN(resid, req->data->iov.size);
+        }
         usb_uas_complete_data_packet(req);
     }
     usb_uas_queue_sense(req, status);
     scsi_req_unref(req->req);
 }
 
+/*
+ * If the data packet for the whole data phase was queued before the command
+ * (as Linux does with streams) and the host controller mapped it from guest
+ * memory, let the SCSI device transfer directly to that memory instead of
+ * copying through its bounce buffer.
+ */
+static QEMUSGList *usb_uas_scsi_get_sg_list(SCSIRequest *r)
+{
+    UASRequest *req = r->hba_private;
+    USBPacket *p = req->data;
+    int pid;
+
+    if (r->cmd.mode == SCSI_XFER_NONE || !p || !p->sgl) {
+        return NULL;
+    }
+    pid = r->cmd.mode == SCSI_XFER_FROM_DEV ? USB_TOKEN_IN : USB_TOKEN_OUT;
+    if (p->pid != pid || p->actual_length ||
+        p->iov.size != r->cmd.xfer || p->sgl->size != r->cmd.xfer) {
+        return NULL;
+    }
+    trace_usb_uas_scsi_direct(req->uas->dev.addr, req->tag, r->cmd.xfer);
+    req->direct = true;
+    return p->sgl;
+}
+
 static void usb_uas_scsi_request_cancelled(SCSIRequest *r)
 {
     UASRequest *req = r->hba_private;
@@ -626,6 +657,7 @@ static const struct SCSIBusInfo usb_uas_scsi_info = {
 
     .transfer_data = usb_uas_scsi_transfer_data,
     .complete = usb_uas_scsi_command_complete,
+    .get_sg_list = usb_uas_scsi_get_sg_list,
     .cancel = usb_uas_scsi_request_cancelled,
     .free_request = usb_uas_scsi_free_request,
 };
@@ -688,6 +720,10 @@ static void usb_uas_cancel_io(USBDevice *dev, USBPacket *p)
     QTAILQ_FOREACH_SAFE(req, &uas->requests, next, nreq) {
         if (req->data == p) {
             req->data = NULL;
+            if (req->direct && !req->complete) {
+                /* The SCSI layer must stop using the packet's memory */
+                scsi_req_cancel(req->req);
+            }
             return;
         }
     }
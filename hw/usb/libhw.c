@@ -48,6 +48,7 @@ int usb_packet_map(USBPacket *p, QEMUSGList *sgl)
             base += xlen;
         }
     }
+    p->sgl = sgl;
     return 0;
 
 err:
@@ -66,4 +67,5 @@ void usb_packet_unmap(USBPacket *p, QEMUSGList *sgl)
                          p->iov.iov[i].iov_len, dir,
                          p->iov.iov[i].iov_len);
     }
+    p->sgl = NULL;
 }
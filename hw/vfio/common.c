@@ -501,6 +501,193 @@ static int vfio_dma_map(VFIOContainer *container, hwaddr iova,
     return -errno;
 }
 
+/*
+ * DMA request coalescing
+ *
+ * Each memory section and each vIOMMU IOTLB entry costs one MAP_DMA or
+ * UNMAP_DMA ioctl, and a guest mapping a large buffer through a vIOMMU
+ * sends one entry per page.  Inside a batch (a memory transaction, or a
+ * burst of IOMMU notifications) requests are queued instead, and one that
+ * extends the pending request in both IOVA and host address is merged
+ * with it.  Requests are never reordered: one that cannot be merged
+ * flushes the pending request first.
+ *
+ * The type1v2 backend refuses to unmap part of a mapping, so mappings
+ * built from several requests are kept in container->dma_merged.  An
+ * unmap that cuts one of them unmaps it whole and maps back the rest.
+ */
+static bool vfio_dma_can_coalesce(VFIOContainer *container)
+{
+    /* The dirty bitmap of an unmap is indexed from a single IOTLB entry */
+    return (container->iommu_type == VFIO_TYPE1_IOMMU ||
+            container->iommu_type == VFIO_TYPE1v2_IOMMU) &&
+           !container->dirty_pages_supported;
+}
+
+static int vfio_dma_unmap_range(VFIOContainer *container,
+                                hwaddr iova, hwaddr size)
+{
+    hwaddr start = iova, end = iova + size - 1;
+    DMAMap keep[2], range;
+    DMAMap *merged;
+    int nkeep = 0;
+    int i, ret;
+
+    merged = iova_tree_find_address(container->dma_merged, start);
+    if (merged && merged->iova < start) {
+        keep[nkeep++] = (DMAMap) {
+            .iova = merged->iova,
+            .translated_addr = merged->translated_addr,
+            .size = start - merged->iova - 1,
+            .perm = merged->perm,
+        };
+        start = merged->iova;
+    }
+    merged = iova_tree_find_address(container->dma_merged, end);
+    if (merged && merged->iova + merged->size > end) {
+        keep[nkeep++] = (DMAMap) {
+            .iova = end + 1,
+            .translated_addr = merged->translated_addr +
+                               (end + 1 - merged->iova),
+            .size = merged->iova + merged->size - end - 1,
+            .perm = merged->perm,
+        };
+        end = merged->iova + merged->size;
+    }
+    range = (DMAMap) { .iova = start, .size = end - start };
+    iova_tree_remove(container->dma_merged, &range);
+
+    ret = vfio_dma_unmap(container, start, end - start + 1, NULL);
+    if (ret) {
+        return ret;
+    }
+
+    for (i = 0; i < nkeep; i++) {
+        trace_vfio_dma_remap(keep[i].iova, keep[i].size + 1);
+        if (!vfio_dma_map(container, keep[i].iova, keep[i].size + 1,
+                          (void *)(uintptr_t)keep[i].translated_addr,
+                          keep[i].perm == IOMMU_RO)) {
+            iova_tree_insert(container->dma_merged, &keep[i]);
+        }
+    }
+    return 0;
+}
+
+static void vfio_dma_map_failed(VFIOContainer *container,
+                                VFIODMAPending *p, int ret)
+{
+    Error *err = NULL;
+
+    error_setg(&err, "vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
+               "0x%"HWADDR_PRIx", %p) = %d (%s)",
+               container, p->iova, p->size, p->vaddr, ret, strerror(-ret));
+
+    /* Failures on vIOMMU entries are only reported, as before batching */
+    if (!p->mr) {
+        error_report_err(err);
+        return;
+    }
+
+    /* Same as for a RAM section in vfio_listener_region_add() */
+    if (!container->initialized) {
+        if (!container->error) {
+            error_propagate_prepend(&container->error, err, "Region %s: ",
+                                    memory_region_name(p->mr));
+        } else {
+            error_free(err);
+        }
+    } else {
+        error_report_err(err);
+        hw_error("vfio: DMA mapping failed, unable to continue");
+    }
+}
+
+static void vfio_dma_flush(VFIOContainer *container)
+{
+    VFIODMAPending *p = &container->dma_pending;
+    int ret;
+
+    switch (p->op) {
+    case VFIO_DMA_MAP:
+        trace_vfio_dma_flush("MAP", p->iova, p->size, p->count);
+        ret = vfio_dma_map(container, p->iova, p->size, p->vaddr,
+                           p->readonly);
+        if (ret) {
+            vfio_dma_map_failed(container, p, ret);
+        } else if (p->count > 1 &&
+                   container->iommu_type == VFIO_TYPE1v2_IOMMU) {
+            DMAMap map = {
+                .iova = p->iova,
+                .translated_addr = (uintptr_t)p->vaddr,
+                .size = p->size - 1,
+                .perm = p->readonly ? IOMMU_RO : IOMMU_RW,
+            };
+
+            iova_tree_insert(container->dma_merged, &map);
+        }
+        break;
+    case VFIO_DMA_UNMAP:
+        trace_vfio_dma_flush("UNMAP", p->iova, p->size, p->count);
+        ret = vfio_dma_unmap_range(container, p->iova, p->size);
+        if (ret) {
+            error_report("vfio_dma_unmap(%p, 0x%"HWADDR_PRIx", "
+                         "0x%"HWADDR_PRIx") = %d (%s)",
+                         container, p->iova, p->size, ret, strerror(-ret));
+        }
+        break;
+    case VFIO_DMA_NONE:
+        break;
+    }
+    p->op = VFIO_DMA_NONE;
+}
+
+/*
+ * Queue a request, or run it right away outside of a batch.  Only for
+ * containers where vfio_dma_can_coalesce() is true.
+ */
+static void vfio_dma_queue(VFIOContainer *container, VFIODMAOp op,
+                           MemoryRegion *mr, hwaddr iova, hwaddr size,
+                           void *vaddr, bool readonly)
+{
+    VFIODMAPending *p = &container->dma_pending;
+
+    if (p->op == op && p->mr == mr && p->iova + p->size == iova &&
+        p->size + size > p->size &&
+        (op == VFIO_DMA_UNMAP ||
+         (p->vaddr + p->size == vaddr && p->readonly == readonly))) {
+        p->size += size;
+        p->count++;
+        return;
+    }
+
+    vfio_dma_flush(container);
+    *p = (VFIODMAPending) {
+        .op = op,
+        .mr = mr,
+        .iova = iova,
+        .size = size,
+        .vaddr = vaddr,
+        .readonly = readonly,
+        .count = 1,
+    };
+    if (!container->dma_batch_depth) {
+        vfio_dma_flush(container);
+    }
+}
+
+static void vfio_dma_batch_begin(VFIOContainer *container)
+{
+    container->dma_batch_depth++;
+}
+
+static void vfio_dma_batch_end(VFIOContainer *container)
+{
+    assert(container->dma_batch_depth);
+    if (!--container->dma_batch_depth) {
+        vfio_dma_flush(container);
+    }
+}
+
 static void vfio_host_win_add(VFIOContainer *container,
                               hwaddr min_iova, hwaddr max_iova,
                               uint64_t iova_pgsizes)
@@ -630,8 +817,15 @@ static void vfio_iommu_map_notify(IOMMUNotifier *n, IOMMUTLBEntry *iotlb)
          * vfio_dma_map has set up the mapping the pages will be
          * pinned by the kernel. This makes sure that the RAM backend
          * of vaddr will always be there, even if the memory object is
-         * destroyed and its backing memory munmap-ed.
+         * destroyed and its backing memory munmap-ed.  A queued entry
+         * is mapped at the latest by vfio_iommu_map_batch(), which
+         * holds the RCU read lock for the whole batch.
          */
+        if (vfio_dma_can_coalesce(container)) {
+            vfio_dma_queue(container, VFIO_DMA_MAP, NULL, iova,
+                           iotlb->addr_mask + 1, vaddr, read_only);
+            goto out;
+        }
         ret = vfio_dma_map(container, iova,
                            iotlb->addr_mask + 1, vaddr,
                            read_only);
@@ -641,6 +835,9 @@ static void vfio_iommu_map_notify(IOMMUNotifier *n, IOMMUTLBEntry *iotlb)
                          container, iova,
                          iotlb->addr_mask + 1, vaddr, ret);
         }
+    } else if (vfio_dma_can_coalesce(container)) {
+        vfio_dma_queue(container, VFIO_DMA_UNMAP, NULL, iova,
+                       iotlb->addr_mask + 1, NULL, false);
     } else {
         ret = vfio_dma_unmap(container, iova, iotlb->addr_mask + 1, iotlb);
         if (ret) {
@@ -654,6 +851,36 @@ out:
     rcu_read_unlock();
 }
 
+static void vfio_iommu_map_batch(IOMMUNotifier *n, bool begin)
+{
+    VFIOGuestIOMMU *giommu = container_of(n, VFIOGuestIOMMU, n);
+    VFIOContainer *container = giommu->container;
+
+    if (begin) {
+        rcu_read_lock();
+        vfio_dma_batch_begin(container);
+    } else {
+        /* Don't wait for an enclosing memory transaction, see above */
+        vfio_dma_flush(container);
+        vfio_dma_batch_end(container);
+        rcu_read_unlock();
+    }
+}
+
+static void vfio_listener_begin(MemoryListener *listener)
+{
+    VFIOContainer *container = container_of(listener, VFIOContainer, listener);
+
+    vfio_dma_batch_begin(container);
+}
+
+static void vfio_listener_commit(MemoryListener *listener)
+{
+    VFIOContainer *container = container_of(listener, VFIOContainer, listener);
+
+    vfio_dma_batch_end(container);
+}
+
 static void vfio_listener_region_add(MemoryListener *listener,
                                      MemoryRegionSection *section)
 {
@@ -791,6 +1018,9 @@ static void vfio_listener_region_add(MemoryListener *listener,
                             section->offset_within_region,
                             int128_get64(llend),
                             iommu_idx);
+        if (vfio_dma_can_coalesce(container)) {
+            giommu->n.batch = vfio_iommu_map_batch;
+        }
 
         ret = memory_region_iommu_set_page_size_mask(giommu->iommu,
                                                      container->pgsizes,
@@ -835,6 +1065,14 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
+    if (vfio_dma_can_coalesce(container) &&
+        !memory_region_is_ram_device(section->mr)) {
+        vfio_dma_queue(container, VFIO_DMA_MAP, section->mr, iova,
+                       int128_get64(llsize), vaddr, section->readonly);
+        return;
+    }
+
+    vfio_dma_flush(container);
     ret = vfio_dma_map(container, iova, int128_get64(llsize),
                        vaddr, section->readonly);
     if (ret) {
@@ -952,8 +1190,19 @@ static void vfio_listener_region_del(MemoryListener *listener,
         try_unmap = !((iova & pgmask) || (int128_get64(llsize) & pgmask));
     }
 
-    if (try_unmap) {
+    if (try_unmap && vfio_dma_can_coalesce(container) &&
+        !memory_region_is_ram_device(section->mr) &&
+        !int128_eq(llsize, int128_2_64())) {
+        vfio_dma_queue(container, VFIO_DMA_UNMAP, NULL, iova,
+                       int128_get64(llsize), NULL, false);
+    } else if (try_unmap) {
+        vfio_dma_flush(container);
         if (int128_eq(llsize, int128_2_64())) {
+            DMAMap all = { .iova = 0, .size = UINT64_MAX };
+
+            /* Everything goes, including mappings made of several requests */
+            iova_tree_remove(container->dma_merged, &all);
+
             /* The unmap ioctl doesn't accept a full 64-bit span. */
             llsize = int128_rshift(llsize, 1);
             ret = vfio_dma_unmap(container, iova, int128_get64(llsize), NULL);
@@ -1134,6 +1383,8 @@ static void vfio_listerner_log_sync(MemoryListener *listener,
 }
 
 static const MemoryListener vfio_memory_listener = {
+    .begin = vfio_listener_begin,
+    .commit = vfio_listener_commit,
     .region_add = vfio_listener_region_add,
     .region_del = vfio_listener_region_del,
     .log_sync = vfio_listerner_log_sync,
@@ -1735,6 +1986,7 @@ static int vfio_connect_container(VFIOGroup *group, AddressSpace *as,
     container->fd = fd;
     container->error = NULL;
     container->dirty_pages_supported = false;
+    container->dma_merged = iova_tree_new();
     QLIST_INIT(&container->giommu_list);
     QLIST_INIT(&container->hostwin_list);
 
@@ -1869,6 +2121,7 @@ listener_release_exit:
     vfio_listener_release(container);
 
 free_container_exit:
+    iova_tree_destroy(container->dma_merged);
     g_free(container);
 
 close_fd_exit:
@@ -1917,6 +2170,7 @@ static void vfio_disconnect_container(VFIOGroup *group)
 
         trace_vfio_disconnect_container(container->fd);
         close(container->fd);
+        iova_tree_destroy(container->dma_merged);
         g_free(container);
 
         vfio_put_address_space(space);
@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include "standard-headers/linux/virtio_fs.h"
 #include "qapi/error.h"
 #include "hw/qdev-properties.h"
@@ -22,6 +23,135 @@
 #include "hw/virtio/vhost-user-fs.h"
 #include "monitor/monitor.h"
 
+/*
+ * The DAX window is a reservation of host address space.  Ranges that the
+ * daemon has not mapped are inaccessible anonymous memory; ranges it has
+ * mapped are MAP_SHARED mappings of its files, placed with MAP_FIXED.
+ */
+static int vuf_cache_reset(VHostUserFS *fs, uint64_t offset, uint64_t len)
+{
+    void *ptr = memory_region_get_ram_ptr(&fs->cache) + offset;
+
+    if (mmap(ptr, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+             -1, 0) != ptr) {
+        return -errno;
+    }
+    return 0;
+}
+
+static VHostUserFS *vuf_from_vhost_dev(struct vhost_dev *dev)
+{
+    VHostUserFS *fs;
+
+    if (!dev->vdev) {
+        return NULL;
+    }
+    fs = (VHostUserFS *)object_dynamic_cast(OBJECT(dev->vdev),
+                                             TYPE_VHOST_USER_FS);
+    if (!fs || !fs->conf.cache_size) {
+        return NULL;
+    }
+    return fs;
+}
+
+static bool vuf_cache_range_valid(VHostUserFS *fs, uint64_t offset,
+                                  uint64_t len)
+{
+    return QEMU_IS_ALIGNED(offset | len, qemu_real_host_page_size) &&
+           offset < fs->conf.cache_size &&
+           len <= fs->conf.cache_size - offset;
+}
+
+int vhost_user_fs_slave_map(struct vhost_dev *dev, VhostUserFSSlaveMsg *sm,
+                            int fd)
+{
+    VHostUserFS *fs = vuf_from_vhost_dev(dev);
+    void *cache_host;
+    int i, ret = 0;
+
+    if (!fs) {
+        error_report("%s: no DAX window to map into", __func__);
+        return -EINVAL;
+    }
+    if (fd < 0) {
+        error_report("%s: bad fd for map", __func__);
+        return -EBADF;
+    }
+
+    cache_host = memory_region_get_ram_ptr(&fs->cache);
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES; i++) {
+        int prot = 0;
+        void *ptr;
+
+        if (sm->len[i] == 0) {
+            continue;
+        }
+        if (!vuf_cache_range_valid(fs, sm->c_offset[i], sm->len[i])) {
+            error_report("%s: bad range %" PRIx64 "+%" PRIx64, __func__,
+                         sm->c_offset[i], sm->len[i]);
+            ret = -EINVAL;
+            break;
+        }
+
+        prot |= sm->flags[i] & VHOST_USER_FS_FLAG_MAP_R ? PROT_READ : 0;
+        prot |= sm->flags[i] & VHOST_USER_FS_FLAG_MAP_W ? PROT_WRITE : 0;
+        ptr = mmap(cache_host + sm->c_offset[i], sm->len[i], prot,
+                   MAP_SHARED | MAP_FIXED, fd, sm->fd_offset[i]);
+        if (ptr != cache_host + sm->c_offset[i]) {
+            ret = -errno;
+            error_report("%s: map failed: %s", __func__, strerror(errno));
+            break;
+        }
+    }
+
+    if (ret) {
+        /* Do not leave part of the request mapped */
+        while (--i >= 0) {
+            if (sm->len[i]) {
+                vuf_cache_reset(fs, sm->c_offset[i], sm->len[i]);
+            }
+        }
+    }
+    return ret;
+}
+
+int vhost_user_fs_slave_unmap(struct vhost_dev *dev, VhostUserFSSlaveMsg *sm)
+{
+    VHostUserFS *fs = vuf_from_vhost_dev(dev);
+    int i, ret = 0;
+
+    if (!fs) {
+        error_report("%s: no DAX window to unmap from", __func__);
+        return -EINVAL;
+    }
+
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES; i++) {
+        uint64_t offset = sm->c_offset[i];
+        uint64_t len = sm->len[i];
+        int r;
+
+        if (len == 0) {
+            continue;
+        }
+        if (len == VHOST_USER_FS_UNMAP_ALL) {
+            offset = 0;
+            len = fs->conf.cache_size;
+        } else if (!vuf_cache_range_valid(fs, offset, len)) {
+            error_report("%s: bad range %" PRIx64 "+%" PRIx64, __func__,
+                         offset, len);
+            ret = -EINVAL;
+            continue;
+        }
+
+        r = vuf_cache_reset(fs, offset, len);
+        if (r) {
+            error_report("%s: unmap failed: %s", __func__, strerror(-r));
+            ret = r;
+        }
+    }
+    return ret;
+}
+
 static void vuf_get_config(VirtIODevice *vdev, uint8_t *config)
 {
     VHostUserFS *fs = VHOST_USER_FS(vdev);
@@ -104,6 +234,11 @@ static void vuf_stop(VirtIODevice *vdev)
     }
 
     vhost_dev_disable_notifiers(&fs->vhost_dev, vdev);
+
+    /* The driver is gone, and so are the daemon's mappings */
+    if (fs->conf.cache_size) {
+        vuf_cache_reset(fs, 0, fs->conf.cache_size);
+    }
 }
 
 static void vuf_set_status(VirtIODevice *vdev, uint8_t status)
@@ -201,10 +336,33 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (fs->conf.cache_size &&
+        (!is_power_of_2(fs->conf.cache_size) ||
+         fs->conf.cache_size < qemu_real_host_page_size)) {
+        error_setg(errp, "cache-size property must be a power of 2 "
+                   "no smaller than the page size");
+        return;
+    }
+
     if (!vhost_user_init(&fs->vhost_user, &fs->conf.chardev, errp)) {
         return;
     }
 
+    if (fs->conf.cache_size) {
+        void *cache_ptr;
+
+        cache_ptr = mmap(NULL, fs->conf.cache_size, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (cache_ptr == MAP_FAILED) {
+            error_setg_errno(errp, errno, "Unable to reserve DAX window");
+            vhost_user_cleanup(&fs->vhost_user);
+            return;
+        }
+        memory_region_init_ram_ptr(&fs->cache, OBJECT(vdev),
+                                   "virtio-fs-cache", fs->conf.cache_size,
+                                   cache_ptr);
+    }
+
     virtio_init(vdev, "vhost-user-fs", VIRTIO_ID_FS,
                 sizeof(struct virtio_fs_config));
 
@@ -231,6 +389,9 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
 
 err_virtio:
     vhost_user_cleanup(&fs->vhost_user);
+    if (fs->conf.cache_size) {
+        munmap(memory_region_get_ram_ptr(&fs->cache), fs->conf.cache_size);
+    }
     virtio_delete_queue(fs->hiprio_vq);
     for (i = 0; i < fs->conf.num_request_queues; i++) {
         virtio_delete_queue(fs->req_vqs[i]);
@@ -262,6 +423,10 @@ static void vuf_device_unrealize(DeviceState *dev)
     virtio_cleanup(vdev);
     g_free(fs->vhost_dev.vqs);
     fs->vhost_dev.vqs = NULL;
+
+    if (fs->conf.cache_size) {
+        munmap(memory_region_get_ram_ptr(&fs->cache), fs->conf.cache_size);
+    }
 }
 
 static const VMStateDescription vuf_vmstate = {
@@ -275,6 +440,7 @@ static Property vuf_properties[] = {
     DEFINE_PROP_UINT16("num-request-queues", VHostUserFS,
                        conf.num_request_queues, 1),
     DEFINE_PROP_UINT16("queue-size", VHostUserFS, conf.queue_size, 128),
+    DEFINE_PROP_SIZE("cache-size", VHostUserFS, conf.cache_size, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
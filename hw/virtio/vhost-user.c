@@ -15,6 +15,7 @@
 #include "hw/virtio/vhost-backend.h"
 #include "hw/virtio/virtio.h"
 #include "hw/virtio/virtio-net.h"
+#include "hw/virtio/vhost-user-fs.h"
 #include "chardev/char-fe.h"
 #include "sysemu/kvm.h"
 #include "qemu/error-report.h"
@@ -79,6 +80,8 @@ enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_RESET_DEVICE = 13,
     /* Feature 14 reserved for VHOST_USER_PROTOCOL_F_INBAND_NOTIFICATIONS. */
     VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 15,
+    /* 16 is reserved for VHOST_USER_PROTOCOL_F_STATUS */
+    VHOST_USER_PROTOCOL_F_VRING_STATS = 17,
     VHOST_USER_PROTOCOL_F_MAX
 };
 
@@ -124,6 +127,8 @@ typedef enum VhostUserRequest {
     VHOST_USER_GET_MAX_MEM_SLOTS = 36,
     VHOST_USER_ADD_MEM_REG = 37,
     VHOST_USER_REM_MEM_REG = 38,
+    /* 39 and 40 are reserved for VHOST_USER_SET/GET_STATUS */
+    VHOST_USER_GET_VRING_STATS = 41,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -132,6 +137,8 @@ typedef enum VhostUserSlaveRequest {
     VHOST_USER_SLAVE_IOTLB_MSG = 1,
     VHOST_USER_SLAVE_CONFIG_CHANGE_MSG = 2,
     VHOST_USER_SLAVE_VRING_HOST_NOTIFIER_MSG = 3,
+    VHOST_USER_SLAVE_FS_MAP = 6,
+    VHOST_USER_SLAVE_FS_UNMAP = 7,
     VHOST_USER_SLAVE_MAX
 }  VhostUserSlaveRequest;
 
@@ -194,6 +201,14 @@ typedef struct VhostUserInflight {
     uint16_t queue_size;
 } VhostUserInflight;
 
+typedef struct VhostUserVringStats {
+    uint32_t index;
+    uint32_t padding;
+    uint64_t kicks;
+    uint64_t calls;
+    uint64_t suppressed_calls;
+} VhostUserVringStats;
+
 typedef struct {
     VhostUserRequest request;
 
@@ -218,6 +233,8 @@ typedef union {
         VhostUserCryptoSession session;
         VhostUserVringArea area;
         VhostUserInflight inflight;
+        VhostUserVringStats vring_stats;
+        VhostUserFSSlaveMsg fs;
 } VhostUserPayload;
 
 typedef struct VhostUserMsg {
@@ -562,12 +579,12 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
         for (j = 0; j < dev->mem->nregions; j++) {
             reg = &dev->mem->regions[j];
 
-            mr = vhost_user_get_mr_data(reg->userspace_addr, &offset, &fd);
-
             if (reg_equal(shadow_reg, reg)) {
                 matching = true;
                 found[j] = true;
                 if (track_ramblocks) {
+                    mr = vhost_user_get_mr_data(reg->userspace_addr,
+                                                &offset, &fd);
                     /*
                      * Reset postcopy client bases, region_rb, and
                      * region_rb_offset in case regions are removed.
@@ -1162,6 +1179,47 @@ static int vhost_user_get_vring_base(struct vhost_dev *dev,
     return 0;
 }
 
+static int vhost_user_get_vring_stats(struct vhost_dev *dev,
+                                      struct vhost_vring_stats *stats)
+{
+    VhostUserMsg msg = {
+        .hdr.request = VHOST_USER_GET_VRING_STATS,
+        .hdr.flags = VHOST_USER_VERSION,
+        .payload.vring_stats.index = stats->index,
+        .hdr.size = sizeof(msg.payload.vring_stats),
+    };
+
+    if (!virtio_has_feature(dev->protocol_features,
+                            VHOST_USER_PROTOCOL_F_VRING_STATS)) {
+        return -ENOTSUP;
+    }
+
+    if (vhost_user_write(dev, &msg, NULL, 0) < 0) {
+        return -1;
+    }
+
+    if (vhost_user_read(dev, &msg) < 0) {
+        return -1;
+    }
+
+    if (msg.hdr.request != VHOST_USER_GET_VRING_STATS) {
+        error_report("Received unexpected msg type. Expected %d received %d",
+                     VHOST_USER_GET_VRING_STATS, msg.hdr.request);
+        return -1;
+    }
+
+    if (msg.hdr.size != sizeof(msg.payload.vring_stats)) {
+        error_report("Received bad msg size.");
+        return -1;
+    }
+
+    stats->kicks = msg.payload.vring_stats.kicks;
+    stats->calls = msg.payload.vring_stats.calls;
+    stats->suppressed_calls = msg.payload.vring_stats.suppressed_calls;
+
+    return 0;
+}
+
 static int vhost_set_vring_file(struct vhost_dev *dev,
                                 VhostUserRequest request,
                                 struct vhost_vring_file *file)
@@ -1470,6 +1528,14 @@ static void slave_read(void *opaque)
         ret = vhost_user_slave_handle_vring_host_notifier(dev, &payload.area,
                                                           fd[0]);
         break;
+#ifdef CONFIG_VHOST_USER_FS
+    case VHOST_USER_SLAVE_FS_MAP:
+        ret = vhost_user_fs_slave_map(dev, &payload.fs, fd[0]);
+        break;
+    case VHOST_USER_SLAVE_FS_UNMAP:
+        ret = vhost_user_fs_slave_unmap(dev, &payload.fs);
+        break;
+#endif
     default:
         error_report("Received unexpected msg type: %d.", hdr.request);
         ret = -EINVAL;
@@ -2386,4 +2452,5 @@ const VhostOps user_ops = {
         .vhost_backend_mem_section_filter = vhost_user_mem_section_filter,
         .vhost_get_inflight_fd = vhost_user_get_inflight_fd,
         .vhost_set_inflight_fd = vhost_user_set_inflight_fd,
+        .vhost_get_vring_stats = vhost_user_get_vring_stats,
 };
@@ -23,6 +23,11 @@
 #include "trace.h"
 #include "qemu-common.h"
 
+#ifndef VHOST_BACKEND_F_IOTLB_PERSIST
+/* The device keeps its IOTLB mappings across a reset */
+#define VHOST_BACKEND_F_IOTLB_PERSIST 0x8
+#endif
+
 static bool vhost_vdpa_listener_skipped_section(MemoryRegionSection *section)
 {
     return (!memory_region_is_ram(section->mr) &&
@@ -86,14 +91,14 @@ static int vhost_vdpa_dma_unmap(struct vhost_vdpa *v, hwaddr iova,
     return ret;
 }
 
-static void vhost_vdpa_listener_begin(MemoryListener *listener)
+static void vhost_vdpa_iotlb_batch_begin_once(struct vhost_vdpa *v)
 {
-    struct vhost_vdpa *v = container_of(listener, struct vhost_vdpa, listener);
     struct vhost_dev *dev = v->dev;
     struct vhost_msg_v2 msg = {};
     int fd = v->device_fd;
 
-    if (!(dev->backend_cap & (0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH))) {
+    if (!(dev->backend_cap & (0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH)) ||
+        v->iotlb_batch_begin_sent) {
         return;
     }
 
@@ -104,16 +109,131 @@ static void vhost_vdpa_listener_begin(MemoryListener *listener)
         error_report("failed to write, fd=%d, errno=%d (%s)",
                      fd, errno, strerror(errno));
     }
+    v->iotlb_batch_begin_sent = true;
+}
+
+/*
+ * The kernel drops every IOTLB entry that overlaps an invalidated range,
+ * whole.  Entries made of several sections are kept in v->merged, so
+ * that the part of them outside of the range can be mapped back.
+ */
+static int vhost_vdpa_dma_unmap_range(struct vhost_vdpa *v, hwaddr iova,
+                                      hwaddr size)
+{
+    hwaddr last = iova + size - 1;
+    DMAMap keep[2], range;
+    DMAMap *merged;
+    int nkeep = 0;
+    int i, ret;
+
+    merged = iova_tree_find_address(v->merged, iova);
+    if (merged && merged->iova < iova) {
+        keep[nkeep++] = (DMAMap) {
+            .iova = merged->iova,
+            .translated_addr = merged->translated_addr,
+            .size = iova - merged->iova - 1,
+            .perm = merged->perm,
+        };
+    }
+    merged = iova_tree_find_address(v->merged, last);
+    if (merged && merged->iova + merged->size > last) {
+        keep[nkeep++] = (DMAMap) {
+            .iova = last + 1,
+            .translated_addr = merged->translated_addr +
+                               (last + 1 - merged->iova),
+            .size = merged->iova + merged->size - last - 1,
+            .perm = merged->perm,
+        };
+    }
+    range = (DMAMap) { .iova = iova, .size = size - 1 };
+    iova_tree_remove(v->merged, &range);
+
+    ret = vhost_vdpa_dma_unmap(v, iova, size);
+    if (ret) {
+        return ret;
+    }
+
+    for (i = 0; i < nkeep; i++) {
+        if (!vhost_vdpa_dma_map(v, keep[i].iova, keep[i].size + 1,
+                                (void *)(uintptr_t)keep[i].translated_addr,
+                                keep[i].perm == IOMMU_RO)) {
+            iova_tree_insert(v->merged, &keep[i]);
+        }
+    }
+    return 0;
+}
+
+static void vhost_vdpa_iotlb_flush(struct vhost_vdpa *v)
+{
+    VhostVDPAPending *p = &v->pending;
+
+    if (!p->type) {
+        return;
+    }
+
+    trace_vhost_vdpa_iotlb_flush(v, p->type, p->iova, p->size, p->count);
+    vhost_vdpa_iotlb_batch_begin_once(v);
+    if (p->type == VHOST_IOTLB_UPDATE) {
+        if (vhost_vdpa_dma_map(v, p->iova, p->size, p->vaddr, p->readonly)) {
+            error_report("vhost vdpa map fail!");
+        } else if (p->count > 1) {
+            DMAMap map = {
+                .iova = p->iova,
+                .translated_addr = (uintptr_t)p->vaddr,
+                .size = p->size - 1,
+                .perm = p->readonly ? IOMMU_RO : IOMMU_RW,
+            };
+
+            iova_tree_insert(v->merged, &map);
+        }
+    } else if (vhost_vdpa_dma_unmap_range(v, p->iova, p->size)) {
+        error_report("vhost_vdpa dma unmap error!");
+    }
+    p->type = 0;
+}
+
+/*
+ * Queue an IOTLB message until the end of the transaction, merging it
+ * with the pending one when it extends it.  The listener gets all the
+ * deletions of a transaction first, then all the additions, and both in
+ * address order, so neighbouring sections end up in one message.
+ */
+static void vhost_vdpa_iotlb_queue(struct vhost_vdpa *v, uint8_t type,
+                                   hwaddr iova, hwaddr size,
+                                   void *vaddr, bool readonly)
+{
+    VhostVDPAPending *p = &v->pending;
+
+    if (p->type == type && p->iova + p->size == iova &&
+        p->size + size > p->size &&
+        (type == VHOST_IOTLB_INVALIDATE ||
+         (p->vaddr + p->size == vaddr && p->readonly == readonly))) {
+        p->size += size;
+        p->count++;
+        return;
+    }
+
+    vhost_vdpa_iotlb_flush(v);
+    *p = (VhostVDPAPending) {
+        .type = type,
+        .iova = iova,
+        .size = size,
+        .vaddr = vaddr,
+        .readonly = readonly,
+        .count = 1,
+    };
 }
 
 static void vhost_vdpa_listener_commit(MemoryListener *listener)
 {
     struct vhost_vdpa *v = container_of(listener, struct vhost_vdpa, listener);
-    struct vhost_dev *dev = v->dev;
     struct vhost_msg_v2 msg = {};
     int fd = v->device_fd;
 
-    if (!(dev->backend_cap & (0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH))) {
+    vhost_vdpa_iotlb_flush(v);
+
+    /* Transactions that don't touch the IOTLB send nothing */
+    if (!v->iotlb_batch_begin_sent) {
         return;
     }
 
@@ -124,6 +244,7 @@ static void vhost_vdpa_listener_commit(MemoryListener *listener)
         error_report("failed to write, fd=%d, errno=%d (%s)",
                      fd, errno, strerror(errno));
     }
+    v->iotlb_batch_begin_sent = false;
 }
 
 static void vhost_vdpa_listener_region_add(MemoryListener *listener,
@@ -133,7 +254,6 @@ static void vhost_vdpa_listener_region_add(MemoryListener *listener,
     hwaddr iova;
     Int128 llend, llsize;
     void *vaddr;
-    int ret;
 
     if (vhost_vdpa_listener_skipped_section(section)) {
         return;
@@ -167,34 +287,8 @@ static void vhost_vdpa_listener_region_add(MemoryListener *listener,
 
     llsize = int128_sub(llend, int128_make64(iova));
 
-    ret = vhost_vdpa_dma_map(v, iova, int128_get64(llsize),
-                             vaddr, section->readonly);
-    if (ret) {
-        error_report("vhost vdpa map fail!");
-        if (memory_region_is_ram_device(section->mr)) {
-            /* Allow unexpected mappings not to be fatal for RAM devices */
-            error_report("map ram fail!");
-          return ;
-        }
-        goto fail;
-    }
-
-    return;
-
-fail:
-    if (memory_region_is_ram_device(section->mr)) {
-        error_report("failed to vdpa_dma_map. pci p2p may not work");
-        return;
-
-    }
-    /*
-     * On the initfn path, store the first error in the container so we
-     * can gracefully fail.  Runtime, there's not much we can do other
-     * than throw a hardware error.
-     */
-    error_report("vhost-vdpa: DMA mapping failed, unable to continue");
-    return;
-
+    vhost_vdpa_iotlb_queue(v, VHOST_IOTLB_UPDATE, iova, int128_get64(llsize),
+                           vaddr, section->readonly);
 }
 
 static void vhost_vdpa_listener_region_del(MemoryListener *listener,
@@ -203,7 +297,6 @@ static void vhost_vdpa_listener_region_del(MemoryListener *listener,
     struct vhost_vdpa *v = container_of(listener, struct vhost_vdpa, listener);
     hwaddr iova;
     Int128 llend, llsize;
-    int ret;
 
     if (vhost_vdpa_listener_skipped_section(section)) {
         return;
@@ -228,10 +321,8 @@ static void vhost_vdpa_listener_region_del(MemoryListener *listener,
 
     llsize = int128_sub(llend, int128_make64(iova));
 
-    ret = vhost_vdpa_dma_unmap(v, iova, int128_get64(llsize));
-    if (ret) {
-        error_report("vhost_vdpa dma unmap error!");
-    }
+    vhost_vdpa_iotlb_queue(v, VHOST_IOTLB_INVALIDATE, iova,
+                           int128_get64(llsize), NULL, false);
 
     memory_region_unref(section->mr);
 }
@@ -241,7 +332,6 @@ static void vhost_vdpa_listener_region_del(MemoryListener *listener,
  * depends on the addnop().
  */
 static const MemoryListener vhost_vdpa_memory_listener = {
-    .begin = vhost_vdpa_listener_begin,
     .commit = vhost_vdpa_listener_commit,
     .region_add = vhost_vdpa_listener_region_add,
     .region_del = vhost_vdpa_listener_region_del,
@@ -286,6 +376,7 @@ static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque)
     dev->backend_features = features;
     v->listener = vhost_vdpa_memory_listener;
     v->msg_type = VHOST_IOTLB_MSG_V2;
+    v->merged = iova_tree_new();
 
     vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
                                VIRTIO_CONFIG_S_DRIVER);
@@ -300,6 +391,7 @@ static int vhost_vdpa_cleanup(struct vhost_dev *dev)
     v = dev->opaque;
     trace_vhost_vdpa_cleanup(dev, v);
     memory_listener_unregister(&v->listener);
+    iova_tree_destroy(v->merged);
 
     dev->opaque = NULL;
     return 0;
@@ -353,7 +445,8 @@ static int vhost_vdpa_set_backend_cap(struct vhost_dev *dev)
 {
     uint64_t features;
     uint64_t f = 0x1ULL << VHOST_BACKEND_F_IOTLB_MSG_V2 |
-        0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH;
+        0x1ULL << VHOST_BACKEND_F_IOTLB_BATCH |
+        0x1ULL << VHOST_BACKEND_F_IOTLB_PERSIST;
     int r;
 
     if (vhost_vdpa_call(dev, VHOST_GET_BACKEND_FEATURES, &features)) {
@@ -474,7 +567,10 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
     trace_vhost_vdpa_dev_start(dev, started);
     if (started) {
         uint8_t status = 0;
-        memory_listener_register(&v->listener, &address_space_memory);
+        /* Guest RAM may still be mapped from the previous run */
+        if (!v->listener.address_space) {
+            memory_listener_register(&v->listener, &address_space_memory);
+        }
         vhost_vdpa_set_vring_ready(dev);
         vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
         vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &status);
@@ -484,7 +580,13 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
         vhost_vdpa_reset_device(dev);
         vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
                                    VIRTIO_CONFIG_S_DRIVER);
-        memory_listener_unregister(&v->listener);
+        /*
+         * If the IOTLB survives the reset, keep the listener so that the
+         * mappings stay up to date, and the next start has nothing to map.
+         */
+        if (!(dev->backend_cap & (0x1ULL << VHOST_BACKEND_F_IOTLB_PERSIST))) {
+            memory_listener_unregister(&v->listener);
+        }
 
         return 0;
     }
@@ -448,11 +448,37 @@ static void vhost_begin(MemoryListener *listener)
     dev->n_tmp_sections = 0;
 }
 
+/*
+ * Whether @reg was already in the region table @mem, at the same host
+ * address.  The tables are sorted by guest physical address.
+ */
+static bool vhost_mem_has_region(const struct vhost_memory *mem,
+                                 const struct vhost_memory_region *reg)
+{
+    int lo = 0, hi = mem->nregions;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const struct vhost_memory_region *cur = &mem->regions[mid];
+
+        if (cur->guest_phys_addr < reg->guest_phys_addr) {
+            lo = mid + 1;
+        } else if (cur->guest_phys_addr > reg->guest_phys_addr) {
+            hi = mid;
+        } else {
+            return cur->memory_size == reg->memory_size &&
+                   cur->userspace_addr == reg->userspace_addr;
+        }
+    }
+    return false;
+}
+
 static void vhost_commit(MemoryListener *listener)
 {
     struct vhost_dev *dev = container_of(listener, struct vhost_dev,
                                          memory_listener);
     MemoryRegionSection *old_sections;
+    struct vhost_memory *old_mem = NULL;
     int n_old_sections;
     uint64_t log_size;
     size_t regions_size;
@@ -490,7 +516,8 @@ static void vhost_commit(MemoryListener *listener)
     /* Rebuild the regions list from the new sections list */
     regions_size = offsetof(struct vhost_memory, regions) +
                        dev->n_mem_sections * sizeof dev->mem->regions[0];
-    dev->mem = g_realloc(dev->mem, regions_size);
+    old_mem = dev->mem;
+    dev->mem = g_malloc(regions_size);
     dev->mem->nregions = dev->n_mem_sections;
     used_memslots = dev->mem->nregions;
     for (i = 0; i < dev->n_mem_sections; i++) {
@@ -509,7 +536,23 @@ static void vhost_commit(MemoryListener *listener)
         goto out;
     }
 
+    /*
+     * Sections can change without the regions changing, for example when
+     * a ROM is toggled over RAM that vhost does not see.  Then there is
+     * nothing to tell the backend.
+     */
+    if (dev->mem->nregions == old_mem->nregions &&
+        !memcmp(dev->mem->regions, old_mem->regions,
+                dev->mem->nregions * sizeof dev->mem->regions[0])) {
+        trace_vhost_commit_regions_unchanged(dev->mem->nregions);
+        goto out;
+    }
+
     for (i = 0; i < dev->mem->nregions; i++) {
+        /* Rings in regions that did not move were checked before */
+        if (vhost_mem_has_region(old_mem, &dev->mem->regions[i])) {
+            continue;
+        }
         if (vhost_verify_ring_mappings(dev,
                        (void *)(uintptr_t)dev->mem->regions[i].userspace_addr,
                        dev->mem->regions[i].guest_phys_addr,
@@ -552,6 +595,7 @@ out:
         memory_region_unref(old_sections[n_old_sections].mr);
     }
     g_free(old_sections);
+    g_free(old_mem);
     return;
 }
 
@@ -1697,6 +1741,36 @@ int vhost_dev_get_inflight(struct vhost_dev *dev, uint16_t queue_size,
     return 0;
 }
 
+/*
+ * Kicks and calls go straight between the guest and the backend through
+ * ioeventfd and irqfd, so QEMU never sees them; only the backend can
+ * count them.  The ring indexes are read from our own mapping of the
+ * split ring.
+ */
+void vhost_dev_get_vring_info(struct vhost_dev *hdev, int n,
+                              struct vhost_vring_info *info)
+{
+    struct vhost_virtqueue *vq = hdev->vqs + n - hdev->vq_index;
+
+    assert(n >= hdev->vq_index && n < hdev->vq_index + hdev->nvqs);
+    memset(info, 0, sizeof(*info));
+
+    if (hdev->started && vq->avail && vq->used &&
+        !virtio_vdev_has_feature(hdev->vdev, VIRTIO_F_RING_PACKED)) {
+        info->has_idx = true;
+        info->avail_idx = virtio_lduw_p(hdev->vdev, vq->avail +
+                                        offsetof(struct vring_avail, idx));
+        info->used_idx = virtio_lduw_p(hdev->vdev, vq->used +
+                                       offsetof(struct vring_used, idx));
+    }
+
+    if (hdev->vhost_ops && hdev->vhost_ops->vhost_get_vring_stats) {
+        info->stats.index = hdev->vhost_ops->vhost_get_vq_index(hdev, n);
+        info->has_stats =
+            hdev->vhost_ops->vhost_get_vring_stats(hdev, &info->stats) == 0;
+    }
+}
+
 /* Host notifiers must be enabled at this point. */
 int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
 {
@@ -397,18 +397,30 @@ virtio_crypto_sym_input_data_helper(VirtIODevice *vdev,
     }
 }
 
+/*
+ * The guest is notified once per batch, by virtio_crypto_handle_dataq(),
+ * rather than once per request.
+ */
 static void virtio_crypto_req_complete(VirtIOCryptoReq *req, uint8_t status)
 {
     VirtIOCrypto *vcrypto = req->vcrypto;
     VirtIODevice *vdev = VIRTIO_DEVICE(vcrypto);
+    VirtIOCryptoQueue *q =
+        &vcrypto->vqs[virtio_crypto_vq2q(virtio_get_queue_index(req->vq))];
 
     if (req->flags == CRYPTODEV_BACKEND_ALG_SYM) {
         virtio_crypto_sym_input_data_helper(vdev, req, status,
                                             req->u.sym_op_info);
+        if (status == VIRTIO_CRYPTO_OK) {
+            q->bytes += req->u.sym_op_info->src_len;
+        }
+    }
+    q->requests++;
+    if (status != VIRTIO_CRYPTO_OK) {
+        q->errors++;
     }
     stb_p(&req->in->status, status);
     virtqueue_push(req->vq, &req->elem, req->in_len);
-    virtio_notify(vdev, req->vq);
 }
 
 static VirtIOCryptoReq *
@@ -691,7 +703,10 @@ virtio_crypto_handle_request(VirtIOCryptoReq *request)
 static void virtio_crypto_handle_dataq(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOCrypto *vcrypto = VIRTIO_CRYPTO(vdev);
+    VirtIOCryptoQueue *q =
+        &vcrypto->vqs[virtio_crypto_vq2q(virtio_get_queue_index(vq))];
     VirtIOCryptoReq *req;
+    bool completed = false;
 
     while ((req = virtio_crypto_get_request(vcrypto, vq))) {
         if (virtio_crypto_handle_request(req) < 0) {
@@ -699,6 +714,12 @@ static void virtio_crypto_handle_dataq(VirtIODevice *vdev, VirtQueue *vq)
             virtio_crypto_free_request(req);
             break;
         }
+        completed = true;
+    }
+
+    if (completed) {
+        q->notifies++;
+        virtio_notify(vdev, vq);
     }
 }
 
@@ -786,6 +807,37 @@ static void virtio_crypto_init_config(VirtIODevice *vdev)
     vcrypto->conf.max_size = vcrypto->conf.cryptodev->conf.max_size;
 }
 
+static const char * const virtio_crypto_queue_stats[] = {
+    "requests", "errors", "bytes", "notifies",
+};
+
+static void virtio_crypto_add_queue_stats(VirtIOCrypto *vcrypto, int i)
+{
+    VirtIOCryptoQueue *q = &vcrypto->vqs[i];
+    uint64_t *stats[] = { &q->requests, &q->errors, &q->bytes, &q->notifies };
+    int j;
+
+    for (j = 0; j < ARRAY_SIZE(stats); j++) {
+        g_autofree char *name =
+            g_strdup_printf("x-dataq%d-%s", i, virtio_crypto_queue_stats[j]);
+
+        object_property_add_uint64_ptr(OBJECT(vcrypto), name, stats[j],
+                                       OBJ_PROP_FLAG_READ);
+    }
+}
+
+static void virtio_crypto_del_queue_stats(VirtIOCrypto *vcrypto, int i)
+{
+    int j;
+
+    for (j = 0; j < ARRAY_SIZE(virtio_crypto_queue_stats); j++) {
+        g_autofree char *name =
+            g_strdup_printf("x-dataq%d-%s", i, virtio_crypto_queue_stats[j]);
+
+        object_property_del(OBJECT(vcrypto), name);
+    }
+}
+
 static void virtio_crypto_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -819,6 +871,7 @@ static void virtio_crypto_device_realize(DeviceState *dev, Error **errp)
         vcrypto->vqs[i].dataq_bh =
                  qemu_bh_new(virtio_crypto_dataq_bh, &vcrypto->vqs[i]);
         vcrypto->vqs[i].vcrypto = vcrypto;
+        virtio_crypto_add_queue_stats(vcrypto, i);
     }
 
     vcrypto->ctrl_vq = virtio_add_queue(vdev, 64, virtio_crypto_handle_ctrl);
@@ -845,6 +898,9 @@ static void virtio_crypto_device_unrealize(DeviceState *dev)
         q = &vcrypto->vqs[i];
         qemu_bh_delete(q->dataq_bh);
     }
+    for (i = 0; i < vcrypto->max_queues; i++) {
+        virtio_crypto_del_queue_stats(vcrypto, i);
+    }
 
     g_free(vcrypto->vqs);
     virtio_delete_queue(vcrypto->ctrl_vq);
@@ -63,6 +63,13 @@ typedef struct VirtIOIOMMUMapping {
     uint32_t flags;
 } VirtIOIOMMUMapping;
 
+/* An UNMAP notification waiting for the end of the request batch */
+typedef struct VirtIOIOMMUUnmapRange {
+    IOMMUMemoryRegion *mr;
+    uint64_t low;
+    uint64_t high;
+} VirtIOIOMMUUnmapRange;
+
 static inline uint16_t virtio_iommu_get_bdf(IOMMUDevice *dev)
 {
     return PCI_BUILD_BDF(pci_bus_num(dev->bus), dev->devfn);
@@ -170,6 +177,48 @@ static void virtio_iommu_notify_unmap(IOMMUMemoryRegion *mr, hwaddr virt_start,
     memory_region_notify_iommu(mr, 0, entry);
 }
 
+/*
+ * Queue an UNMAP notification, merging it with a pending one for an
+ * adjacent range of the same memory region.  Must be called with the
+ * mutex held.
+ */
+static void virtio_iommu_queue_unmap(VirtIOIOMMU *s, IOMMUMemoryRegion *mr,
+                                     uint64_t low, uint64_t high)
+{
+    VirtIOIOMMUUnmapRange *r;
+    VirtIOIOMMUUnmapRange new = { .mr = mr, .low = low, .high = high };
+    guint i;
+
+    for (i = 0; i < s->unmap_batch->len; i++) {
+        r = &g_array_index(s->unmap_batch, VirtIOIOMMUUnmapRange, i);
+        if (r->mr != mr) {
+            continue;
+        }
+        if (r->high != UINT64_MAX && r->high + 1 == low) {
+            r->high = high;
+            return;
+        }
+        if (high != UINT64_MAX && high + 1 == r->low) {
+            r->low = low;
+            return;
+        }
+    }
+    g_array_append_val(s->unmap_batch, new);
+}
+
+/* Send the queued UNMAP notifications.  Must be called with the mutex held. */
+static void virtio_iommu_flush_unmaps(VirtIOIOMMU *s)
+{
+    VirtIOIOMMUUnmapRange *r;
+    guint i;
+
+    for (i = 0; i < s->unmap_batch->len; i++) {
+        r = &g_array_index(s->unmap_batch, VirtIOIOMMUUnmapRange, i);
+        virtio_iommu_notify_unmap(r->mr, r->low, r->high);
+    }
+    g_array_set_size(s->unmap_batch, 0);
+}
+
 static gboolean virtio_iommu_notify_unmap_cb(gpointer key, gpointer value,
                                              gpointer data)
 {
@@ -458,8 +507,8 @@ static int virtio_iommu_unmap(VirtIOIOMMU *s,
 
         if (interval.low <= current_low && interval.high >= current_high) {
             QLIST_FOREACH(ep, &domain->endpoint_list, next) {
-                virtio_iommu_notify_unmap(ep->iommu_mr, current_low,
-                                          current_high);
+                virtio_iommu_queue_unmap(s, ep->iommu_mr, current_low,
+                                         current_high);
             }
             g_tree_remove(domain->mappings, iter_key);
             trace_virtio_iommu_unmap_done(domain_id, current_low, current_high);
@@ -570,6 +619,12 @@ static int virtio_iommu_handle_probe(VirtIOIOMMU *s,
     return ret ? ret : virtio_iommu_probe(s, &req, buf);
 }
 
+/*
+ * All the requests available on a kick are handled as one batch: UNMAP
+ * notifications of consecutive UNMAP requests are merged, and the
+ * completions are only made visible to the guest, with a single
+ * interrupt, once all the notifications have been sent.
+ */
 static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOIOMMU *s = VIRTIO_IOMMU(vdev);
@@ -578,13 +633,14 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
     size_t output_size = sizeof(tail), sz;
     VirtQueueElement *elem;
     unsigned int iov_cnt;
+    unsigned int done = 0;
     struct iovec *iov;
     void *buf = NULL;
 
     for (;;) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
         if (iov_size(elem->in_sg, elem->in_num) < sizeof(tail) ||
@@ -603,6 +659,10 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
             goto out;
         }
         qemu_mutex_lock(&s->mutex);
+        if (head.type != VIRTIO_IOMMU_T_UNMAP) {
+            /* Keep the notifications in request order */
+            virtio_iommu_flush_unmaps(s);
+        }
         switch (head.type) {
         case VIRTIO_IOMMU_T_ATTACH:
             tail.status = virtio_iommu_handle_attach(s, iov, iov_cnt);
@@ -638,10 +698,20 @@ out:
                           buf ? buf : &tail, output_size);
         assert(sz == output_size);
 
-        virtqueue_push(vq, elem, sz);
-        virtio_notify(vdev, vq);
+        virtqueue_fill(vq, elem, sz, done++);
         g_free(elem);
         g_free(buf);
+        buf = NULL;
+        output_size = sizeof(tail);
+    }
+
+    qemu_mutex_lock(&s->mutex);
+    virtio_iommu_flush_unmaps(s);
+    qemu_mutex_unlock(&s->mutex);
+
+    if (done) {
+        virtqueue_flush(vq, done);
+        virtio_notify(vdev, vq);
     }
 }
 
@@ -978,6 +1048,7 @@ static void virtio_iommu_device_realize(DeviceState *dev, Error **errp)
     virtio_add_feature(&s->features, VIRTIO_IOMMU_F_PROBE);
 
     qemu_mutex_init(&s->mutex);
+    s->unmap_batch = g_array_new(false, false, sizeof(VirtIOIOMMUUnmapRange));
 
     s->as_by_busptr = g_hash_table_new_full(NULL, NULL, NULL, g_free);
 
@@ -994,6 +1065,7 @@ static void virtio_iommu_device_unrealize(DeviceState *dev)
     VirtIOIOMMU *s = VIRTIO_IOMMU(dev);
 
     g_hash_table_destroy(s->as_by_busptr);
+    g_array_free(s->unmap_batch, true);
     if (s->domains) {
         g_tree_destroy(s->domains);
     }
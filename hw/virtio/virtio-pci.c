@@ -1136,6 +1136,25 @@ static int virtio_pci_add_mem_cap(VirtIOPCIProxy *proxy,
     return offset;
 }
 
+int virtio_pci_add_shm_cap(VirtIOPCIProxy *proxy,
+                           uint8_t bar, uint64_t offset, uint64_t length,
+                           uint8_t id)
+{
+    struct virtio_pci_cap64 cap = {
+        .cap.cap_len = sizeof cap,
+        .cap.cfg_type = VIRTIO_PCI_CAP_SHARED_MEMORY_CFG,
+    };
+
+    cap.cap.bar = bar;
+    cap.cap.id = id;
+    cap.cap.offset = cpu_to_le32(offset);
+    cap.offset_hi = cpu_to_le32(offset >> 32);
+    cap.cap.length = cpu_to_le32(length);
+    cap.length_hi = cpu_to_le32(length >> 32);
+
+    return virtio_pci_add_mem_cap(proxy, &cap.cap);
+}
+
 static uint64_t virtio_pci_common_read(void *opaque, hwaddr addr,
                                        unsigned size)
 {
@@ -1357,13 +1376,28 @@ static void virtio_pci_notify_write_pio(void *opaque, hwaddr addr,
     }
 }
 
+/*
+ * Called without the global lock.  The interrupt is only asserted while
+ * an ISR bit is set, so polling an empty ISR needs no lock at all.
+ */
 static uint64_t virtio_pci_isr_read(void *opaque, hwaddr addr,
                                     unsigned size)
 {
     VirtIOPCIProxy *proxy = opaque;
     VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
     uint64_t val = qatomic_xchg(&vdev->isr, 0);
-    pci_irq_deassert(&proxy->pci_dev);
+
+    if (val) {
+        bool locked = qemu_mutex_iothread_locked();
+
+        if (!locked) {
+            qemu_mutex_lock_iothread();
+        }
+        pci_irq_deassert(&proxy->pci_dev);
+        if (!locked) {
+            qemu_mutex_unlock_iothread();
+        }
+    }
 
     return val;
 }
@@ -1481,6 +1515,7 @@ static void virtio_pci_modern_regions_init(VirtIOPCIProxy *proxy)
                           proxy,
                           "virtio-pci-isr",
                           proxy->isr.size);
+    memory_region_clear_global_locking(&proxy->isr.mr);
 
     memory_region_init_io(&proxy->device.mr, OBJECT(proxy),
                           &device_ops,
@@ -234,6 +234,14 @@ typedef struct VirtioPCIDeviceTypeInfo {
 /* Register virtio-pci type(s).  @t must be static. */
 void virtio_pci_types_register(const VirtioPCIDeviceTypeInfo *t);
 
+/*
+ * Describe a shared memory region of the device, @length bytes at
+ * @offset in BAR @bar, with the device specific @id.
+ */
+int virtio_pci_add_shm_cap(VirtIOPCIProxy *proxy,
+                           uint8_t bar, uint64_t offset, uint64_t length,
+                           uint8_t id);
+
 /**
  * virtio_pci_optimal_num_queues:
  * @fixed_queues: number of queues that are always present
@@ -100,6 +100,10 @@ struct VirtQueue
     VRing vring;
     VirtQueueElement *used_elems;
 
+    /* Elements given back with virtqueue_element_release(), for reuse */
+    VirtQueueElement **elem_pool;
+    unsigned int elem_pool_len;
+
     /* Next head to pop */
     uint16_t last_avail_idx;
     bool last_avail_wrap_counter;
@@ -774,6 +778,11 @@ bool virtqueue_rewind(VirtQueue *vq, unsigned int num)
     return true;
 }
 
+unsigned int virtqueue_get_inuse(VirtQueue *vq)
+{
+    return vq->inuse;
+}
+
 static void virtqueue_split_fill(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len, unsigned int idx)
 {
@@ -920,6 +929,22 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int num)
+{
+    unsigned int i;
+
+    if (!num) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < num; i++) {
+        virtqueue_fill(vq, elems[i], lens[i], i);
+    }
+    virtqueue_flush(vq, num);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1389,7 +1414,42 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/*
+ * Pooled elements are allocated in steps of this size, so that one can be
+ * reused for a request with a few more descriptors than the last one.
+ */
+#define VIRTQUEUE_ELEM_ALLOC_ALIGN 512
+
+static VirtQueueElement *virtqueue_pool_get(VirtQueue *vq, size_t size)
+{
+    VirtQueueElement *elem;
+
+    if (!vq || !vq->elem_pool_len) {
+        return NULL;
+    }
+    elem = vq->elem_pool[--vq->elem_pool_len];
+    if (elem->alloc_size < size) {
+        g_free(elem);
+        return NULL;
+    }
+    return elem;
+}
+
+static void virtqueue_pool_free(VirtQueue *vq)
+{
+    while (vq->elem_pool_len) {
+        g_free(vq->elem_pool[--vq->elem_pool_len]);
+    }
+    g_free(vq->elem_pool);
+    vq->elem_pool = NULL;
+}
+
+/*
+ * Take the element from the pool of @vq when it has one large enough.
+ * @vq may be NULL, for elements that do not come from a queue.
+ */
+static void *virtqueue_alloc_element(VirtQueue *vq, size_t sz,
+                                     unsigned out_num, unsigned in_num)
 {
     VirtQueueElement *elem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
@@ -1400,7 +1460,14 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    elem = virtqueue_pool_get(vq, out_sg_end);
+    if (!elem) {
+        size_t alloc_size = QEMU_ALIGN_UP(out_sg_end,
+                                          VIRTQUEUE_ELEM_ALLOC_ALIGN);
+
+        elem = g_malloc(alloc_size);
+        elem->alloc_size = alloc_size;
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
@@ -1411,7 +1478,11 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Called within rcu_read_lock(), once the avail index has been read and
+ * shows a head at last_avail_idx.  The caller updates the avail event.
+ */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1426,14 +1497,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1448,10 +1511,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
     caches = vring_get_region_caches(vq);
@@ -1523,7 +1582,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1548,6 +1607,62 @@ err_undo_map:
     goto done;
 }
 
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    VirtQueueElement *elem;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /*
+     * Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads().
+     */
+    smp_rmb();
+
+    elem = virtqueue_split_pop_rcu(vq, sz);
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return elem;
+}
+
+/*
+ * Read the avail index once for the whole burst, and publish the avail
+ * event once at the end.
+ */
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max)
+{
+    unsigned int num = 0;
+    int avail;
+
+    RCU_READ_LOCK_GUARD();
+    if (unlikely(!vq->vring.avail)) {
+        return 0;
+    }
+
+    avail = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (avail <= 0) {
+        return 0;
+    }
+
+    while (num < MIN(avail, max)) {
+        VirtQueueElement *elem = virtqueue_split_pop_rcu(vq, sz);
+
+        if (!elem) {
+            break;
+        }
+        elems[num++] = elem;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return num;
+}
+
 static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 {
     unsigned int i, max;
@@ -1649,7 +1764,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1696,6 +1811,42 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    unsigned int num = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        num = virtqueue_split_pop_batch(vq, sz, elems, max);
+    } else {
+        /* Each packed descriptor carries its own avail flag */
+        RCU_READ_LOCK_GUARD();
+        while (num < max) {
+            void *elem = virtqueue_packed_pop(vq, sz);
+
+            if (!elem) {
+                break;
+            }
+            elems[num++] = elem;
+        }
+    }
+    trace_virtqueue_pop_batch(vq, num, max);
+    return num;
+}
+
+void virtqueue_element_release(VirtQueue *vq, VirtQueueElement *elem)
+{
+    if (vq->elem_pool && vq->elem_pool_len < vq->vring.num_default) {
+        vq->elem_pool[vq->elem_pool_len++] = elem;
+    } else {
+        g_free(elem);
+    }
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -1829,7 +1980,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2414,6 +2565,7 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].handle_aio_output = NULL;
     vdev->vq[i].used_elems = g_malloc0(sizeof(VirtQueueElement) *
                                        queue_size);
+    vdev->vq[i].elem_pool = g_new(VirtQueueElement *, queue_size);
 
     return &vdev->vq[i];
 }
@@ -2426,6 +2578,7 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_aio_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtqueue_pool_free(vq);
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -3699,6 +3852,7 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
             break;
         }
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
+        virtqueue_pool_free(&vdev->vq[i]);
     }
     g_free(vdev->vq);
 }
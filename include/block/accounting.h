@@ -27,6 +27,7 @@
 
 #include "qemu/timed-average.h"
 #include "qemu/thread.h"
+#include "qemu/stats64.h"
 #include "qapi/qapi-builtin-types.h"
 
 typedef struct BlockAcctTimedStats BlockAcctTimedStats;
@@ -78,6 +79,29 @@ typedef struct BlockLatencyHistogram {
     uint64_t *bins;
 } BlockLatencyHistogram;
 
+/*
+ * Always-on latency histogram with log-linear buckets: every power of two
+ * of nanoseconds is split into BLOCK_ACCT_LAT_SUB_BUCKETS buckets, so a
+ * bucket is at most 1/8 wider than its lower bound.  Latencies of
+ * 2^BLOCK_ACCT_LAT_MAX_BITS ns (about 18 minutes) and more all land in the
+ * last bucket.
+ *
+ * The histogram is split in shards so that threads completing requests
+ * update it without sharing cachelines or taking stats->lock; a thread
+ * always uses the same shard, allocated when it first needs it.
+ */
+#define BLOCK_ACCT_LAT_SUB_BITS     3
+#define BLOCK_ACCT_LAT_SUB_BUCKETS  (1 << BLOCK_ACCT_LAT_SUB_BITS)
+#define BLOCK_ACCT_LAT_MAX_BITS     40
+#define BLOCK_ACCT_LAT_BUCKETS \
+    ((BLOCK_ACCT_LAT_MAX_BITS - BLOCK_ACCT_LAT_SUB_BITS + 1) * \
+     BLOCK_ACCT_LAT_SUB_BUCKETS)
+#define BLOCK_ACCT_LAT_SHARDS       8
+
+typedef struct BlockAcctLatencyShard {
+    Stat64 buckets[BLOCK_MAX_IOTYPE][BLOCK_ACCT_LAT_BUCKETS];
+} BlockAcctLatencyShard;
+
 struct BlockAcctStats {
     QemuMutex lock;
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
@@ -91,6 +115,7 @@ struct BlockAcctStats {
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    BlockAcctLatencyShard *latency_shards[BLOCK_ACCT_LAT_SHARDS];
 };
 
 typedef struct BlockAcctCookie {
@@ -119,5 +144,9 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
+uint64_t block_acct_latency_percentiles(BlockAcctStats *stats,
+                                        enum BlockAcctType type,
+                                        const double *quantiles,
+                                        uint64_t *latency_ns, int n);
 
 #endif
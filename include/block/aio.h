@@ -19,6 +19,7 @@
 #endif
 #include "qemu/coroutine.h"
 #include "qemu/queue.h"
+#include "qemu/stats64.h"
 #include "qemu/event_notifier.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
@@ -121,6 +122,26 @@ struct BHListSlice {
 
 typedef QSLIST_HEAD(, AioHandler) AioHandlerSList;
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * A request on the io_uring that the AioContext uses for file descriptor
+ * monitoring, see aio_add_sqe().
+ */
+typedef struct CqeHandler CqeHandler;
+struct CqeHandler {
+    /* Prepared by the caller, except for user_data */
+    struct io_uring_sqe sqe;
+
+    /* Called from aio_poll() once the request has completed */
+    void (*cb)(CqeHandler *cqe_handler);
+
+    /* Result of the request, filled in before @cb is called */
+    int32_t res;
+
+    QSIMPLEQ_ENTRY(CqeHandler) next;
+};
+#endif
+
 struct AioContext {
     GSource source;
 
@@ -197,6 +218,10 @@ struct AioContext {
      */
     struct ThreadPool *thread_pool;
 
+    /* Parameters for thread_pool, see aio_context_set_thread_pool_params() */
+    int thread_pool_min;
+    int thread_pool_max;
+
 #ifdef CONFIG_LINUX_AIO
     /*
      * State for native Linux AIO.  Uses aio_context_acquire/release for
@@ -211,9 +236,20 @@ struct AioContext {
      */
     struct LuringState *linux_io_uring;
 
+    /* Parameters for linux_io_uring, see aio_context_set_io_uring_params() */
+    bool linux_io_uring_fixed;
+    bool linux_io_uring_sqpoll;
+    uint32_t linux_io_uring_sqpoll_idle;
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+
+    /* External AioHandlers that fired while external clients were disabled */
+    AioHandlerSList parked_list;
+
+    /* Completed aio_add_sqe() requests, dispatched by aio_poll() */
+    QSIMPLEQ_HEAD(, CqeHandler) cqe_handler_ready_list;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -232,6 +268,17 @@ struct AioContext {
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
 
+    /*
+     * Time spent busy polling without finding an event, and time spent
+     * running handlers, bottom halves and timers.  Only accounted while
+     * polling is enabled.
+     */
+    Stat64 poll_time_ns;
+    Stat64 work_time_ns;
+
+    /* Time spent blocked waiting for events, always accounted */
+    Stat64 sleep_time_ns;
+
     /*
      * List of handlers participating in userspace polling.  Protected by
      * ctx->list_lock.  Iterated and modified mostly by the event loop thread
@@ -492,6 +539,28 @@ struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Return true if this AioContext monitors file descriptors with io_uring,
+ * and therefore accepts aio_add_sqe() requests
+ */
+bool aio_has_io_uring(AioContext *ctx);
+
+/**
+ * aio_add_sqe:
+ * @ctx: the aio context, which must use io_uring
+ * @cqe_handler: the request
+ *
+ * Queue @cqe_handler->sqe on the io_uring of @ctx.  It is submitted by the
+ * next io_uring_enter(2) of the event loop, and @cqe_handler->cb is called
+ * from aio_poll() when it completes.  @cqe_handler must stay valid until
+ * then.
+ *
+ * Must be called from the home thread of @ctx, outside of aio_poll()'s wait.
+ */
+void aio_add_sqe(AioContext *ctx, CqeHandler *cqe_handler);
+#endif
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -721,10 +790,49 @@ void aio_context_use_g_source(AioContext *ctx);
  * @grow: polling time growth factor
  * @shrink: polling time shrink factor
  *
- * Poll mode can be disabled by setting poll_max_ns to 0.
+ * Poll mode can be disabled by setting poll_max_ns to 0.  Each handler
+ * learns its own polling time within @max_ns from the delay of its events,
+ * and the context polls for the longest of them.
  */
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_get_poll_stats:
+ * @ctx: the aio context
+ * @poll_ns: time spent busy polling without finding an event, in nanoseconds
+ * @work_ns: time spent processing events, in nanoseconds
+ * @sleep_ns: time spent blocked waiting for events, in nanoseconds
+ *
+ * Can be called from any thread.
+ */
+void aio_context_get_poll_stats(AioContext *ctx, uint64_t *poll_ns,
+                                uint64_t *work_ns, uint64_t *sleep_ns);
+
+/**
+ * aio_context_set_thread_pool_params:
+ * @ctx: the aio context
+ * @min: number of worker threads kept ready, even when idle
+ * @max: maximum number of worker threads
+ *
+ * Worker threads beyond @min are created on demand and exit after some
+ * time without requests.
+ */
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, Error **errp);
+
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @fixed: register files and guest RAM with the io_uring ring
+ * @sqpoll: let a kernel thread poll the submission queue
+ * @sqpoll_idle: idle time in milliseconds before the kernel thread sleeps,
+ *               0 for the kernel default
+ *
+ * Must be called before the first user of aio=io_uring sets up the ring.
+ */
+void aio_context_set_io_uring_params(AioContext *ctx, bool fixed, bool sqpoll,
+                                     uint32_t sqpoll_idle, Error **errp);
+
 #endif
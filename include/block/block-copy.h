@@ -16,6 +16,7 @@
 #define BLOCK_COPY_H
 
 #include "block/block.h"
+#include "qapi/qapi-types-block-core.h"
 #include "qemu/co-shared-resource.h"
 
 typedef void (*ProgressBytesCallbackFunc)(int64_t bytes, void *opaque);
@@ -44,4 +45,7 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
 BdrvDirtyBitmap *block_copy_dirty_bitmap(BlockCopyState *s);
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip);
 
+int64_t block_copy_batch_size(BlockCopyState *s);
+BlockCopyStats *block_copy_get_stats(BlockCopyState *s);
+
 #endif /* BLOCK_COPY_H */
@@ -824,6 +824,21 @@ struct BdrvChild {
  * inspect bdrv_append() to determine if the new fields need to be
  * copied as well.
  */
+#define BDRV_BLOCK_STATUS_CACHE_SIZE 16
+
+/*
+ * One extent of a driver's .bdrv_co_block_status() result, as returned
+ * for [offset, offset + bytes).  @map is the host offset of @offset.
+ */
+typedef struct BdrvBlockStatusCacheEntry {
+    int64_t offset;
+    int64_t bytes;
+    int64_t map;
+    BlockDriverState *file;
+    int ret;
+    bool want_zero;
+} BdrvBlockStatusCacheEntry;
+
 struct BlockDriverState {
     /* Protected by big QEMU lock or read-only after opening.  No special
      * locking needed during I/O...
@@ -979,8 +994,13 @@ struct BlockDriverState {
 
     unsigned int write_gen;               /* Current data generation */
 
-    /* Protected by reqs_lock.  */
-    CoMutex reqs_lock;
+    /*
+     * Protected by reqs_lock.  A QemuMutex rather than a CoMutex:
+     * requests may come from several AioContexts and the critical
+     * sections never yield, so contention must not turn into coroutine
+     * hand-offs between threads.
+     */
+    QemuMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
@@ -990,6 +1010,19 @@ struct BlockDriverState {
 
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
+
+    /*
+     * Recent results of the format driver's .bdrv_co_block_status(), so
+     * that walking a deep backing chain over the same range does not
+     * have to look up the metadata of every layer again.  Dropped by
+     * writes, discards and graph changes; block_status_cache_gen keeps
+     * lookups that raced with an invalidation from being inserted.
+     * Protected by block_status_cache_lock.
+     */
+    QemuMutex block_status_cache_lock;
+    BdrvBlockStatusCacheEntry block_status_cache[BDRV_BLOCK_STATUS_CACHE_SIZE];
+    unsigned int block_status_cache_next;
+    unsigned int block_status_cache_gen;
 };
 
 struct BlockBackendRootState {
@@ -1348,6 +1381,10 @@ int coroutine_fn bdrv_co_copy_range_to(BdrvChild *src, uint64_t src_offset,
 
 int refresh_total_sectors(BlockDriverState *bs, int64_t hint);
 
+void bdrv_block_status_cache_invalidate(BlockDriverState *bs,
+                                        int64_t offset, int64_t bytes);
+void bdrv_block_status_cache_clear(BlockDriverState *bs);
+
 void bdrv_set_monitor_owned(BlockDriverState *bs);
 BlockDriverState *bds_tree_init(QDict *bs_opts, Error **errp);
 
@@ -52,6 +52,12 @@ struct BlockJobDriver {
      * besides job->blk to the new AioContext.
      */
     void (*attached_aio_context)(BlockJob *job, AioContext *new_context);
+
+    /*
+     * If the callback is not NULL, it is called by block_job_query() to add
+     * driver specific information to @info.
+     */
+    void (*query)(BlockJob *job, BlockJobInfo *info);
 };
 
 /**
@@ -0,0 +1,48 @@
+/*
+ * Read cache with adaptive readahead for network protocol drivers
+ *
+ * Drivers such as curl and ssh pay a full network round trip for every
+ * read they issue.  This cache keeps recently fetched data in fixed-size
+ * chunks, grows a readahead window while the guest reads sequentially and
+ * fetches missing ranges with several requests in flight at once.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef BLOCK_READAHEAD_CACHE_H
+#define BLOCK_READAHEAD_CACHE_H
+
+#include "block/block.h"
+
+typedef struct ReadaheadCache ReadaheadCache;
+
+/*
+ * Read @bytes at @offset from the underlying image into @qiov.  May be
+ * called several times in parallel, from coroutines running in the node's
+ * AioContext.
+ */
+typedef int coroutine_fn ReadaheadCacheFetchFunc(void *opaque,
+                                                 uint64_t offset,
+                                                 uint64_t bytes,
+                                                 QEMUIOVector *qiov);
+
+/*
+ * Create a cache using at most @size bytes of memory for the read-only
+ * image of @length bytes behind @bs.  @min_readahead is the readahead
+ * window used for random access; sequential streams grow it up to a
+ * quarter of @size.
+ */
+ReadaheadCache *readahead_cache_new(BlockDriverState *bs, uint64_t length,
+                                    uint64_t size, uint64_t min_readahead,
+                                    ReadaheadCacheFetchFunc *fetch,
+                                    void *opaque);
+
+/* The node must be drained, so that no fetch is in flight.  */
+void readahead_cache_free(ReadaheadCache *c);
+
+int coroutine_fn readahead_cache_co_preadv(ReadaheadCache *c,
+                                           uint64_t offset, uint64_t bytes,
+                                           QEMUIOVector *qiov);
+
+#endif /* BLOCK_READAHEAD_CACHE_H */
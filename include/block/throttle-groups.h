@@ -49,6 +49,14 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
+    /* I/O that has already been accounted to the group on behalf of this
+     * member but not performed yet, in bytes and in operations scaled by
+     * THROTTLE_GROUP_UNIT_SCALE.  Requests that fit skip the group lock.
+     * Accessed with atomic operations.
+     */
+    int credit_bytes[2];
+    int credit_units[2];
+
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
      * throttle_state tells us if I/O limits are configured. */
@@ -220,6 +220,19 @@ int qemu_chr_fe_write(CharBackend *be, const uint8_t *buf, int len);
  */
 int qemu_chr_fe_write_all(CharBackend *be, const uint8_t *buf, int len);
 
+/**
+ * qemu_chr_fe_writev:
+ * @iov: the data
+ * @iovcnt: the number of elements in @iov
+ *
+ * Like @qemu_chr_fe_write, but gathers the data from @iov.  Back ends that
+ * support it send all of it with a single vectored write.  This function
+ * is thread-safe.
+ *
+ * Returns: the number of bytes consumed (0 if no associated Chardev)
+ */
+int qemu_chr_fe_writev(CharBackend *be, const struct iovec *iov, int iovcnt);
+
 /**
  * qemu_chr_fe_read_all:
  * @buf: the data buffer
@@ -60,4 +60,26 @@ extern const uint32_t AES_Te0[256], AES_Te1[256], AES_Te2[256],
 extern const uint32_t AES_Td0[256], AES_Td1[256], AES_Td2[256],
                       AES_Td3[256], AES_Td4[256];
 
+/*
+ * Single AES rounds on the host's AES instructions, for the helpers that
+ * emulate guest AES instructions.  They may only be called if
+ * aes_round_accel is true.  States and round keys are 16 bytes, with
+ * byte 0 first in memory as in the x86 instructions:
+ *
+ * aes_round_enc:      MixColumns(SubBytes(ShiftRows(st))) ^ rk
+ * aes_round_enclast:  SubBytes(ShiftRows(st)) ^ rk
+ * aes_round_dec:      InvMixColumns(InvSubBytes(InvShiftRows(st))) ^ rk
+ * aes_round_declast:  InvSubBytes(InvShiftRows(st)) ^ rk
+ * aes_round_mc:       MixColumns(st)
+ * aes_round_imc:      InvMixColumns(st)
+ */
+extern bool aes_round_accel;
+
+void aes_round_enc(void *d, const void *st, const void *rk);
+void aes_round_enclast(void *d, const void *st, const void *rk);
+void aes_round_dec(void *d, const void *st, const void *rk);
+void aes_round_declast(void *d, const void *st, const void *rk);
+void aes_round_mc(void *d, const void *st);
+void aes_round_imc(void *d, const void *st);
+
 #endif
@@ -235,4 +235,57 @@ int qcrypto_cipher_setiv(QCryptoCipher *cipher,
                          const uint8_t *iv, size_t niv,
                          Error **errp);
 
+/**
+ * qcrypto_cipher_encrypt_sectors:
+ * @cipher: the cipher object
+ * @in: buffer holding the plain text input data
+ * @out: buffer to fill with the cipher text output data
+ * @len: the length of @in and @out buffers
+ * @sector_size: the length of each independently encrypted sector
+ * @ivs: the initialization vectors, one per sector
+ * @niv: the length of each initialization vector
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Encrypts @len / @sector_size consecutive sectors, each with its
+ * own initialization vector taken in turn from @ivs.  This gives the
+ * same result as calling qcrypto_cipher_setiv() and
+ * qcrypto_cipher_encrypt() for every sector, but lets the backend
+ * process the whole buffer in one call.  @len must be a multiple of
+ * @sector_size.  The IV of @cipher is undefined afterwards.
+ *
+ * Returns: 0 on success, or -1 on error
+ */
+int qcrypto_cipher_encrypt_sectors(QCryptoCipher *cipher,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   size_t sector_size,
+                                   const uint8_t *ivs,
+                                   size_t niv,
+                                   Error **errp);
+
+/**
+ * qcrypto_cipher_decrypt_sectors:
+ * @cipher: the cipher object
+ * @in: buffer holding the cipher text input data
+ * @out: buffer to fill with the plain text output data
+ * @len: the length of @in and @out buffers
+ * @sector_size: the length of each independently encrypted sector
+ * @ivs: the initialization vectors, one per sector
+ * @niv: the length of each initialization vector
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * The counterpart of qcrypto_cipher_encrypt_sectors().
+ *
+ * Returns: 0 on success, or -1 on error
+ */
+int qcrypto_cipher_decrypt_sectors(QCryptoCipher *cipher,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   size_t sector_size,
+                                   const uint8_t *ivs,
+                                   size_t niv,
+                                   Error **errp);
+
 #endif /* QCRYPTO_CIPHER_H */
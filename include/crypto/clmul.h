@@ -0,0 +1,25 @@
+/*
+ * Carry-less multiplication
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef CRYPTO_CLMUL_H
+#define CRYPTO_CLMUL_H
+
+/**
+ * clmul_64:
+ * @a: first operand
+ * @b: second operand
+ * @hi: where to store the high 64 bits of the product
+ *
+ * Multiply @a and @b as polynomials over GF(2), i.e. without carries, as
+ * done by the x86 PCLMULQDQ and Arm PMULL instructions.  The host's
+ * carry-less multiply instruction is used when available.
+ *
+ * Returns: the low 64 bits of the product
+ */
+uint64_t clmul_64(uint64_t a, uint64_t b, uint64_t *hi);
+
+#endif
@@ -321,4 +321,22 @@ int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
  */
 char *qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess);
 
+/**
+ * qcrypto_tls_session_enable_ktls_tx:
+ * @sess: the TLS session object
+ * @fd: the TCP socket that carries the session
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Hand the encryption of outgoing records over to the kernel, once the
+ * handshake is complete.  From then on, payload data must be written
+ * to @fd directly, never with qcrypto_tls_session_write(); reading is
+ * still done by the session.  Only AES-GCM ciphers with TLS 1.2 or 1.3
+ * on Linux are supported.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *sess,
+                                       int fd,
+                                       Error **errp);
+
 #endif /* QCRYPTO_TLSSESSION_H */
@@ -82,6 +82,12 @@ typedef uint64_t target_ulong;
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
 
+/* and remember the last 8 guest pages larger than TARGET_PAGE_SIZE */
+#define CPU_HTLB_SIZE 8
+
+/* queue up to 16 page flushes from other cpus before flushing it all */
+#define CPU_TLB_PENDING_SIZE 16
+
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
 #else
@@ -153,19 +159,49 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+/*
+ * A guest page larger than TARGET_PAGE_SIZE, as passed to
+ * tlb_set_page_with_attrs().  The softmmu TLB only holds the pieces of
+ * TARGET_PAGE_SIZE that have been accessed; this is enough to fill in
+ * the others without going through the target's tlb_fill, and to find
+ * all of them again when the page is flushed.
+ */
+typedef struct CPUTLBHugeEntry {
+    target_ulong vaddr;         /* -1 if unused */
+    target_ulong size;
+    hwaddr paddr;
+    MemTxAttrs attrs;
+    int prot;
+} CPUTLBHugeEntry;
+
+/*
+ * A page flush requested by another cpu, not yet done.  Only the low
+ * @bits of the address are significant, TARGET_LONG_BITS for a plain
+ * tlb_flush_page.
+ */
+typedef struct CPUTLBPendingFlush {
+    target_ulong addr;
+    uint16_t idxmap;
+    uint16_t bits;
+} CPUTLBPendingFlush;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
  */
 typedef struct CPUTLBDesc {
     /*
-     * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
+     * Describe a region covering all of the large pages that have
+     * dropped out of htable while still having entries in the tlb.
+     * When any page within this region is flushed, we must flush the
+     * entire tlb.  The region is matched if
      * (addr & large_page_mask) == large_page_addr.
      */
     target_ulong large_page_addr;
     target_ulong large_page_mask;
+    /* The most recent large pages, and the next index to replace.  */
+    CPUTLBHugeEntry htable[CPU_HTLB_SIZE];
+    size_t hindex;
     /* host time (in ns) at the beginning of the time window */
     int64_t window_begin_ns;
     /* maximum number of entries observed in the window */
@@ -203,6 +239,28 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Flushes requested by other cpus, merged together and done in one
+     * go by a single queued work item.  pending_full is the set of
+     * mmu_idx to flush entirely, which also absorbs the pages once
+     * pending[] is full.  pending_queued is set while that work item
+     * is on the cpu's queue.  Protected by tlb_c.lock.
+     */
+    CPUTLBPendingFlush pending[CPU_TLB_PENDING_SIZE];
+    size_t n_pending;
+    uint16_t pending_full;
+    bool pending_queued;
+    /*
+     * Address space tagging, see tlb_switch_asid_by_mmuidx.  If asid_valid,
+     * the entries of the asid_idxmap mmu_idx belong to address space asid.
+     * banks holds the entries kept aside for other address spaces, and
+     * bank_stamp orders them by last use.  Protected by tlb_c.lock.
+     */
+    uint64_t asid;
+    bool asid_valid;
+    uint16_t asid_idxmap;
+    struct CPUTLBBank *banks;
+    uint64_t bank_stamp;
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -66,10 +66,14 @@ bool cpu_restore_state(CPUState *cpu, uintptr_t searched_pc, bool will_exit);
 
 void QEMU_NORETURN cpu_loop_exit_noexc(CPUState *cpu);
 void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
+void QEMU_NORETURN cpu_tb_tier_up(CPUState *cpu, TranslationBlock *tb);
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags,
                               int cflags);
+int tb_inflight_begin(target_ulong pc, target_ulong cs_base,
+                      uint32_t flags, uint32_t cf_mask);
+void tb_inflight_end(int slot);
 
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
 void QEMU_NORETURN cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc);
@@ -270,6 +274,23 @@ void tlb_flush_page_bits_by_mmuidx_all_cpus(CPUState *cpu, target_ulong addr,
 void tlb_flush_page_bits_by_mmuidx_all_cpus_synced
     (CPUState *cpu, target_ulong addr, uint16_t idxmap, unsigned bits);
 
+/**
+ * tlb_switch_asid_by_mmuidx:
+ * @cpu: CPU whose TLB should be switched, which must be the current one
+ * @idxmap: bitmap of MMU indexes whose entries are tagged by address space
+ * @asid: id of the address space that becomes current
+ * @flush: drop the entries that were kept for @asid
+ *
+ * Called by targets whose TLB entries are tagged with an address space
+ * id, such as the x86 PCID or the Arm ASID, when the current id changes.
+ * The entries of the address space being left are kept aside, and those
+ * kept the last time @asid was current are put back, unless @flush is
+ * true.  Only a few address spaces are remembered; any flush of the
+ * MMU indexes also applies to the entries kept aside.
+ */
+void tlb_switch_asid_by_mmuidx(CPUState *cpu, uint16_t idxmap,
+                               uint64_t asid, bool flush);
+
 /**
  * tlb_set_page_with_attrs:
  * @cpu: CPU to add this TLB entry for
@@ -373,6 +394,10 @@ tlb_flush_page_bits_by_mmuidx_all_cpus_synced(CPUState *cpu, target_ulong addr,
                                               uint16_t idxmap, unsigned bits)
 {
 }
+static inline void tlb_switch_asid_by_mmuidx(CPUState *cpu, uint16_t idxmap,
+                                             uint64_t asid, bool flush)
+{
+}
 #endif
 /**
  * probe_access:
@@ -466,6 +491,7 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_HOT         0x00100000 /* Superblock retranslation of a hot TB */
 #define CF_CLUSTER_MASK 0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 /* cflags' mask for hashing/comparison */
@@ -475,6 +501,12 @@ struct TranslationBlock {
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
 
+    /* Executions left before a superblock retranslation, see CF_HOT */
+    uint32_t hot_count;
+
+    /* Statistics of the code, or NULL; see exec/tb-stats.h */
+    struct TBStatistics *tb_stats;
+
     struct tb_tc tc;
 
     /* original tb when cflags has CF_NOCACHE */
@@ -522,6 +554,7 @@ struct TranslationBlock {
 };
 
 extern bool parallel_cpus;
+extern uint32_t tcg_hot_threshold;
 
 /* Hide the qatomic_read to make code a little easier on the eyes */
 static inline uint32_t tb_cflags(const TranslationBlock *tb)
@@ -536,6 +569,53 @@ static inline uint32_t curr_cflags(void)
          | (icount_enabled() ? CF_USE_ICOUNT : 0);
 }
 
+/*
+ * In icount mode an insn may only do I/O as the last one of a CF_LAST_IO
+ * TB.  cpu_io_recompile() records the insns that trapped for I/O, so that
+ * translation ends TBs right before them and the lookups of a TB starting
+ * at one of them use its cached single-insn CF_LAST_IO variant.  Entries
+ * evict each other on collisions, and stale ones only cost shorter TBs.
+ * icount runs all vCPUs in one thread, so no atomics are needed.
+ */
+#define TB_IO_PC_BITS 12
+#define TB_IO_PC_SIZE (1 << TB_IO_PC_BITS)
+
+extern target_ulong tb_io_pc[TB_IO_PC_SIZE];
+
+static inline unsigned int tb_io_pc_hash(target_ulong pc)
+{
+    return (pc ^ (pc >> TB_IO_PC_BITS)) & (TB_IO_PC_SIZE - 1);
+}
+
+static inline bool tb_io_pc_known(target_ulong pc)
+{
+    return tb_io_pc[tb_io_pc_hash(pc)] == pc;
+}
+
+/* cflags to look up or translate a TB at @pc with */
+static inline uint32_t tb_io_cflags(target_ulong pc, uint32_t cf_mask)
+{
+    if ((cf_mask & (CF_USE_ICOUNT | CF_COUNT_MASK)) == CF_USE_ICOUNT &&
+        tb_io_pc_known(pc)) {
+        cf_mask |= CF_LAST_IO | 1;
+    }
+    return cf_mask;
+}
+
+/*
+ * Inline target cache of indirect jumps, see
+ * tcg_gen_lookup_and_goto_ptr_cached().  Each jump site owns a slot, and
+ * empty slots point to a CF_INVALID TB so that generated code never needs
+ * to test for NULL.  All accesses must be atomic.
+ */
+#define TB_IBTC_BITS 12
+#define TB_IBTC_SIZE (1 << TB_IBTC_BITS)
+
+extern TranslationBlock *tb_ibtc[TB_IBTC_SIZE];
+
+uint32_t tb_ibtc_alloc(void);
+void tb_ibtc_clear(void);
+
 /* TranslationBlock invalidate API */
 #if defined(CONFIG_USER_ONLY)
 void tb_invalidate_phys_addr(target_ulong addr);
@@ -104,9 +104,15 @@ typedef enum {
 struct IOMMUNotifier;
 typedef void (*IOMMUNotify)(struct IOMMUNotifier *notifier,
                             IOMMUTLBEntry *data);
+typedef void (*IOMMUNotifyBatch)(struct IOMMUNotifier *notifier, bool begin);
 
 struct IOMMUNotifier {
     IOMMUNotify notify;
+    /*
+     * Optional, called around bursts of notifications, see
+     * memory_region_iommu_notify_begin()
+     */
+    IOMMUNotifyBatch batch;
     IOMMUNotifierFlag notifier_flags;
     /* Notify for address space range start <= addr <= end */
     hwaddr start;
@@ -139,12 +145,16 @@ typedef struct IOMMUNotifier IOMMUNotifier;
 /* RAM is a persistent kind memory */
 #define RAM_PMEM (1 << 5)
 
+/* RAM is write-protected with UFFDIO_WRITEPROTECT (background snapshot) */
+#define RAM_UF_WRITEPROTECT (1 << 6)
+
 static inline void iommu_notifier_init(IOMMUNotifier *n, IOMMUNotify fn,
                                        IOMMUNotifierFlag flags,
                                        hwaddr start, hwaddr end,
                                        int iommu_idx)
 {
     n->notify = fn;
+    n->batch = NULL;
     n->notifier_flags = flags;
     n->start = start;
     n->end = end;
@@ -445,6 +455,7 @@ struct MemoryRegion {
     bool nonvolatile;
     bool rom_device;
     bool flush_coalesced_mmio;
+    bool global_locking;
     uint8_t dirty_log_mask;
     bool is_iommu;
     RAMBlock *ram_block;
@@ -471,6 +482,12 @@ struct MemoryRegion {
     const char *name;
     unsigned ioeventfd_nb;
     MemoryRegionIoeventfd *ioeventfds;
+    /* Transaction that last changed this region's rendering */
+    unsigned update_gen;
+    /* Whether a FlatView rooted here is stale, valid for stale_gen */
+    unsigned stale_gen;
+    bool stale;
+    RamDiscardManager *rdm; /* Only for RAM */
 };
 
 struct IOMMUMemoryRegion {
@@ -721,6 +738,12 @@ struct MemoryListener {
     QTAILQ_ENTRY(MemoryListener) link_as;
 };
 
+/* Default cap on the bounce buffers of an #AddressSpace, in bytes */
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE 4096
+
+typedef struct BounceBuffer BounceBuffer;
+typedef struct AddressSpaceMapClient AddressSpaceMapClient;
+
 /**
  * struct AddressSpace: describes a mapping of addresses to #MemoryRegion objects
  */
@@ -737,6 +760,17 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /*
+     * Bounce buffers used by address_space_map for regions that are not
+     * directly accessible RAM, and the callers waiting for one.  Their
+     * total size is capped at max_bounce_buffer_size bytes.
+     */
+    QemuMutex bounce_lock;
+    size_t bounce_buffer_size; /* written under bounce_lock, atomic */
+    size_t max_bounce_buffer_size;
+    QLIST_HEAD(, BounceBuffer) bounce_buffers;
+    QLIST_HEAD(, AddressSpaceMapClient) map_client_list;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -800,6 +834,66 @@ static inline bool MemoryRegionSection_eq(MemoryRegionSection *a,
            a->nonvolatile == b->nonvolatile;
 }
 
+#define TYPE_RAM_DISCARD_MANAGER "qemu:ram-discard-manager"
+typedef struct RamDiscardManagerClass RamDiscardManagerClass;
+typedef struct RamDiscardManager RamDiscardManager;
+DECLARE_OBJ_CHECKERS(RamDiscardManager, RamDiscardManagerClass,
+                     RAM_DISCARD_MANAGER, TYPE_RAM_DISCARD_MANAGER);
+
+typedef int (*ReplayRamPopulate)(MemoryRegionSection *section, void *opaque);
+
+/**
+ * RamDiscardManagerClass:
+ *
+ * A #RamDiscardManager tracks which parts of a RAM #MemoryRegion are
+ * populated, for devices such as virtio-mem that discard the memory the
+ * guest must not use.  Code that walks all of guest memory from the host
+ * uses it to skip the discarded parts, instead of reading them (which can
+ * populate them again) or processing them for nothing.
+ *
+ * Discarded parts only change state under the BQL.
+ */
+struct RamDiscardManagerClass {
+    /* private */
+    InterfaceClass parent_class;
+
+    /* public */
+
+    /**
+     * @is_populated:
+     *
+     * Check whether all of @section is populated.
+     *
+     * @rdm: the #RamDiscardManager
+     * @section: the #MemoryRegionSection
+     */
+    bool (*is_populated)(const RamDiscardManager *rdm,
+                         const MemoryRegionSection *section);
+
+    /**
+     * @replay_populated:
+     *
+     * Call @replay_fn on every populated part of @section, in ascending
+     * order.  Stops at the first non-zero return value of @replay_fn and
+     * returns it.
+     *
+     * @rdm: the #RamDiscardManager
+     * @section: the #MemoryRegionSection
+     * @replay_fn: the callback
+     * @opaque: passed to @replay_fn
+     */
+    int (*replay_populated)(const RamDiscardManager *rdm,
+                            MemoryRegionSection *section,
+                            ReplayRamPopulate replay_fn, void *opaque);
+};
+
+bool ram_discard_manager_is_populated(const RamDiscardManager *rdm,
+                                      const MemoryRegionSection *section);
+int ram_discard_manager_replay_populated(const RamDiscardManager *rdm,
+                                         MemoryRegionSection *section,
+                                         ReplayRamPopulate replay_fn,
+                                         void *opaque);
+
 /**
  * memory_region_init: Initialize a memory region
  *
@@ -1345,6 +1439,26 @@ void memory_region_notify_iommu(IOMMUMemoryRegion *iommu_mr,
                                 int iommu_idx,
                                 IOMMUTLBEntry entry);
 
+/**
+ * memory_region_iommu_notify_begin: start a burst of IOMMU notifications
+ *
+ * Called by IOMMU implementations before sending several notifications
+ * at once, for example while walking their page tables after an
+ * invalidation.  Notifiers may then defer the work for each entry until
+ * the matching memory_region_iommu_notify_end(), which must come before
+ * the invalidation is reported as complete to the guest.  Bursts nest.
+ *
+ * @iommu_mr: the memory region that is going to change
+ */
+void memory_region_iommu_notify_begin(IOMMUMemoryRegion *iommu_mr);
+
+/**
+ * memory_region_iommu_notify_end: end a burst of IOMMU notifications
+ *
+ * @iommu_mr: the memory region passed to memory_region_iommu_notify_begin()
+ */
+void memory_region_iommu_notify_end(IOMMUMemoryRegion *iommu_mr);
+
 /**
  * memory_region_notify_one: notify a change in an IOMMU translation
  *                           entry to a single notifier
@@ -1501,6 +1615,32 @@ static inline bool memory_region_is_nonvolatile(MemoryRegion *mr)
     return mr->nonvolatile;
 }
 
+/**
+ * memory_region_get_ram_discard_manager: get the #RamDiscardManager for a
+ * RAM memory region
+ *
+ * Returns %NULL if the whole region is always populated.
+ *
+ * @mr: the #MemoryRegion
+ */
+static inline RamDiscardManager *
+memory_region_get_ram_discard_manager(MemoryRegion *mr)
+{
+    return mr->rdm;
+}
+
+/**
+ * memory_region_set_ram_discard_manager: set the #RamDiscardManager for a
+ * RAM memory region
+ *
+ * Only one #RamDiscardManager can be set at a time; pass %NULL to remove it.
+ *
+ * @mr: the #MemoryRegion
+ * @rdm: the #RamDiscardManager, or %NULL
+ */
+void memory_region_set_ram_discard_manager(MemoryRegion *mr,
+                                           RamDiscardManager *rdm);
+
 /**
  * memory_region_get_fd: Get a file descriptor backing a RAM memory region.
  *
@@ -1795,6 +1935,48 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_set_global_locking: Declares the access processing requires
+ *                                   QEMU's global lock.
+ *
+ * When this is invoked, accesses to the memory region will be processed while
+ * holding the global lock of QEMU. This is the default behavior of memory
+ * regions.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_set_global_locking(MemoryRegion *mr);
+
+/**
+ * memory_region_clear_global_locking: Declares that access processing does
+ *                                     not depend on the QEMU global lock.
+ *
+ * By clearing this property, accesses to the memory region will be processed
+ * outside of QEMU's global lock (unless the lock is held on when issuing the
+ * access request). In this case, the device model implementing the access
+ * handlers is responsible for synchronization of concurrency, and must take
+ * the global lock itself around anything that still needs it, such as
+ * interrupt updates.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_clear_global_locking(MemoryRegion *mr);
+
+/**
+ * memory_region_lock_for_access: Take the global lock for an access.
+ *
+ * Called by the accelerators before dispatching an MMIO or PIO access to
+ * @mr.  Takes QEMU's global lock unless it is already held, or @mr neither
+ * needs it nor has coalesced MMIO to flush.  While sync-profile is on, the
+ * time spent waiting for the lock is accounted to @mr; see
+ * memory_region_bql_profile_report().
+ *
+ * Returns true if the caller must release the lock after the access.
+ *
+ * @mr: the memory region about to be accessed.
+ */
+bool memory_region_lock_for_access(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -2047,6 +2229,10 @@ void memory_listener_unregister(MemoryListener *listener);
 
 /**
  * memory_global_dirty_log_start: begin dirty logging for all regions
+ *
+ * Migration and dirty rate measurement may both need dirty logging at
+ * the same time; it goes on until each of them called
+ * memory_global_dirty_log_stop().
  */
 void memory_global_dirty_log_start(void);
 
@@ -2057,6 +2243,20 @@ void memory_global_dirty_log_stop(void);
 
 void mtree_info(bool flatview, bool dispatch_tree, bool owner, bool disabled);
 
+/**
+ * memory_region_bql_profile_report: print the global lock profile of MMIO
+ *
+ * Print, for up to @max memory regions, how often the global lock was
+ * taken to access them and how long the accessing threads waited for it,
+ * sorted by total wait time.  Data is gathered while sync-profile is on.
+ */
+void memory_region_bql_profile_report(size_t max);
+
+/**
+ * memory_region_bql_profile_reset: clear the data gathered so far
+ */
+void memory_region_bql_profile_reset(void);
+
 /**
  * memory_region_dispatch_read: perform a read directly to the specified
  * MemoryRegion.
@@ -2388,8 +2588,8 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, hwaddr len,
  * May return %NULL and set *@plen to zero(0), if resources needed to perform
  * the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -2414,6 +2614,24 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          bool is_write, hwaddr access_len);
 
+/* address_space_register_map_client: Register a callback to retry a map
+ *
+ * Schedule @bh, once, as soon as address_space_map() on @as may succeed
+ * again after running out of bounce buffers.  This can be right away.
+ *
+ * @as: #AddressSpace the map operation failed on
+ * @bh: bottom half to schedule
+ */
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh);
+
+/* address_space_unregister_map_client: Cancel
+ * address_space_register_map_client()
+ *
+ * @as: #AddressSpace passed to address_space_register_map_client()
+ * @bh: bottom half passed to address_space_register_map_client()
+ */
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh);
+
 
 /* Internal functions, part of the implementation of address_space_read.  */
 MemTxResult address_space_read_full(AddressSpace *as, hwaddr addr,
@@ -59,6 +59,18 @@ struct RAMBlock {
      */
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
+
+    /*
+     * With mapped-ram, the pages of the block have a fixed place in the
+     * migration file, starting at @pages_offset.  @file_bmap tells which
+     * pages have been written there.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    off_t pages_offset;
+
+    /* Pages collected from the KVM dirty rings, never reset */
+    uint64_t dirty_ring_pages;
 };
 #endif
 #endif
@@ -26,6 +26,7 @@ tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
     uint32_t hash;
 
     cpu_get_tb_cpu_state(env, pc, cs_base, flags);
+    cf_mask = tb_io_cflags(*pc, cf_mask);
     hash = tb_jmp_cache_hash_func(*pc);
     tb = qatomic_rcu_read(&cpu->tb_jmp_cache[hash]);
 
@@ -0,0 +1,74 @@
+/*
+ * Translation block statistics
+ *
+ * When enabled, every translated block gets a TBStatistics entry keyed by
+ * the code it was translated from, so that the counters survive
+ * retranslations of the same code.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef EXEC_TB_STATS_H
+#define EXEC_TB_STATS_H
+
+#include "exec/exec-all.h"
+
+/* Exits to the execution loop: TB_EXIT_IDX0, TB_EXIT_IDX1 and requested */
+#define TB_STATS_EXITS 3
+
+typedef struct TBStatistics {
+    tb_page_addr_t phys_pc;
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+
+    /*
+     * Incremented by the generated code and by cpu_tb_exec, without
+     * atomics: under MTTCG a few updates may be lost.
+     */
+    uint64_t exec_count;
+    uint64_t exits[TB_STATS_EXITS];
+
+    /* Protected by the statistics table lock */
+    uint64_t translations;
+    uint64_t translate_ns;
+    /* Of the last translation */
+    uint32_t guest_insns;
+    uint32_t guest_bytes;
+    uint32_t host_bytes;
+} TBStatistics;
+
+typedef enum TBStatsSort {
+    TB_STATS_SORT_EXEC,
+    TB_STATS_SORT_TRANSLATIONS,
+    TB_STATS_SORT_TIME,
+    TB_STATS_SORT_EXITS,
+} TBStatsSort;
+
+extern bool tb_stats_enabled;
+
+/*
+ * Enabling or disabling the statistics flushes the translation cache,
+ * so that all blocks are retranslated with or without the counters.
+ */
+void tb_stats_enable(bool enable);
+void tb_stats_reset(void);
+
+TBStatistics *tb_stats_get(tb_page_addr_t phys_pc, target_ulong pc,
+                           target_ulong cs_base, uint32_t flags);
+void tb_stats_record_translation(TranslationBlock *tb, int64_t ns);
+
+static inline void tb_stats_record_exit(TranslationBlock *tb, int tb_exit)
+{
+    if (tb && tb->tb_stats) {
+        tb->tb_stats->exits[MIN(tb_exit, TB_STATS_EXITS - 1)]++;
+    }
+}
+
+/* Returns a snapshot of at most @max entries, sorted by @sort */
+GArray *tb_stats_top(TBStatsSort sort, unsigned int max);
+int tb_stats_sort_parse(const char *name);
+extern const char * const tb_stats_sort_names[];
+
+#endif
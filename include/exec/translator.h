@@ -63,6 +63,9 @@ typedef enum DisasJumpType {
  * @num_insns: Number of translated instructions (including current).
  * @max_insns: Maximum number of instructions to be translated in this TB.
  * @singlestep_enabled: "Hardware" single stepping enabled.
+ * @pc_max: End of the highest guest instruction translated before a
+ *          branch followed by translator_follow_branch().
+ * @goto_tb_used: Mask of the goto_tb slots handed out so far.
  *
  * Architecture-agnostic disassembly context.
  */
@@ -74,6 +77,8 @@ typedef struct DisasContextBase {
     int num_insns;
     int max_insns;
     bool singlestep_enabled;
+    target_ulong pc_max;
+    int goto_tb_used;
 } DisasContextBase;
 
 /**
@@ -145,6 +150,37 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
 void translator_loop_temp_check(DisasContextBase *db);
 
+/**
+ * translator_follow_branch:
+ * @db: Disassembly context.
+ * @insn_end: Address just past the branch instruction.
+ * @dest: Target of the branch.
+ *
+ * A hot TB is retranslated with CF_HOT as a superblock, which carries
+ * on through the direct branches on its path instead of ending at the
+ * first one.  Values held in TCG globals and the target's lazily
+ * computed flags then stay in host registers across the branch, and
+ * the optimizer sees the whole path at once.
+ *
+ * Returns true if the target should keep translating at @dest rather
+ * than emit a jump to it.  Only branches to the rest of the first page
+ * of the TB, at or after its start, are followed, so that the TB keeps
+ * covering a single range of guest code.
+ */
+bool translator_follow_branch(DisasContextBase *db, target_ulong insn_end,
+                              target_ulong dest);
+
+/**
+ * translator_goto_tb_slot:
+ * @db: Disassembly context.
+ * @n: Preferred goto_tb slot.
+ *
+ * Returns the goto_tb slot to chain an exit of the TB through, @n if it
+ * is still free.  A superblock can have more exits than slots; -1 means
+ * both have been used and the exit must look its destination up instead.
+ */
+int translator_goto_tb_slot(DisasContextBase *db, int n);
+
 /*
  * Translator Load Functions
  *
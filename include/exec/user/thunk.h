@@ -59,6 +59,8 @@ typedef struct {
     int size[2];
     int align[2];
     const char *name;
+    /* Same layout on host and target: conversion is a memcpy */
+    bool identity;
 } StructEntry;
 
 /* Translation table for bitmasks... */
@@ -278,12 +278,17 @@ typedef struct SavedIOTLB {
 
 struct KVMState;
 struct kvm_run;
+struct kvm_dirty_gfn;
+struct KVMExitStats;
 
 struct hax_vcpu_state;
 
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+#define TB_RAS_BITS 4
+#define TB_RAS_SIZE (1 << TB_RAS_BITS)
+
 /* work queue */
 
 /* The union type allows passing of 64 bit target pointers on 32 bit
@@ -354,6 +359,8 @@ struct qemu_work_item;
  *                        to @trace_dstate).
  * @trace_dstate: Dynamic tracing state of events for this vCPU (bitmask).
  * @plugin_mask: Plugin event bitmap. Modified only via async work.
+ * @afl_prev_loc: Previous block of the AFL edge coverage hash, updated by
+ *    the instrumentation emitted at the start of each TB.
  * @ignore_memory_transaction_failures: Cached copy of the MachineState
  *    flag of the same name: allows the board to suppress calling of the
  *    CPU do_transaction_failed hook function.
@@ -410,6 +417,13 @@ struct CPUState {
     /* Accessed in parallel; all accesses must be atomic */
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
 
+    /*
+     * Shadow return stack: tb_ibtc slots pushed by guest calls, to predict
+     * the target of the matching return.  Only accessed by generated code.
+     */
+    uint32_t tb_ras[TB_RAS_SIZE];
+    uint32_t tb_ras_top;
+
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
     int gdb_num_g_regs;
@@ -431,6 +445,16 @@ struct CPUState {
     int kvm_fd;
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
+    struct kvm_dirty_gfn *kvm_dirty_gfns;
+    uint32_t kvm_fetch_index;
+    /* Pages collected from the dirty ring of this vCPU, never reset */
+    uint64_t dirty_pages;
+    /* Userspace halt polling window and statistics, in nanoseconds */
+    int64_t kvm_halt_poll_ns;
+    uint64_t kvm_halt_poll_total_ns;
+    uint64_t kvm_halt_polls;
+    uint64_t kvm_halt_poll_hits;
+    struct KVMExitStats *kvm_exit_stats;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -440,6 +464,11 @@ struct CPUState {
 
 #ifdef CONFIG_PLUGIN
     GArray *plugin_mem_cbs;
+    /* memory trace buffer, see qemu_plugin_vcpu_mem_buf_reserve */
+    struct qemu_plugin_mem_record *plugin_mem_buf;
+    struct qemu_plugin_mem_record *plugin_mem_buf_pos;
+    size_t plugin_mem_buf_len;
+    size_t plugin_mem_buf_reserved;
     /* saved iotlb data from io_writex */
     SavedIOTLB saved_iotlb;
 #endif
@@ -450,6 +479,7 @@ struct CPUState {
     uint32_t halted;
     uint32_t can_do_io;
     int32_t exception_index;
+    uint32_t afl_prev_loc;
 
     /* shared by kvm, hax and hvf */
     bool vcpu_dirty;
@@ -458,6 +488,8 @@ struct CPUState {
      * autoconverge
      */
     bool throttle_thread_scheduled;
+    /* Throttle of this vCPU alone, on top of the global one */
+    int throttle_percentage;
 
     bool ignore_memory_transaction_failures;
 
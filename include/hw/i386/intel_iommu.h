@@ -118,13 +118,33 @@ struct VTDBus {
 };
 
 struct VTDIOTLBEntry {
+    uint64_t key;
     uint64_t gfn;
     uint16_t domain_id;
     uint64_t slpte;
     uint64_t mask;
     uint8_t access_flags;
+    QTAILQ_ENTRY(VTDIOTLBEntry) lru;    /* Least recently used first */
 };
 
+/*
+ * Cached intermediate level of a second-level page walk: @table is the
+ * page table used at @level for the IOVAs that share @prefix, starting
+ * from the page table @root.  @reads and @writes accumulate the access
+ * rights of the upper levels.
+ */
+typedef struct VTDPDECacheEntry {
+    dma_addr_t root;
+    uint64_t prefix;
+    dma_addr_t table;
+    uint16_t domain_id;
+    uint8_t level;                      /* 0 if the entry is invalid */
+    bool reads;
+    bool writes;
+} VTDPDECacheEntry;
+
+#define VTD_PDE_CACHE_SIZE  256         /* Must be a power of 2 */
+
 /* VT-d Source-ID Qualifier types */
 enum {
     VTD_SQ_FULL = 0x00,     /* Full SID verification */
@@ -251,6 +271,13 @@ struct IntelIOMMUState {
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
     GHashTable *iotlb;              /* IOTLB */
+    QTAILQ_HEAD(, VTDIOTLBEntry) iotlb_lru;
+    uint32_t iotlb_size;            /* Max number of IOTLB entries */
+    VTDPDECacheEntry pde_cache[VTD_PDE_CACHE_SIZE];
+    uint64_t iotlb_hits;
+    uint64_t iotlb_misses;
+    uint64_t pde_cache_hits;
+    uint64_t pde_cache_misses;
 
     GHashTable *vtd_as_by_busptr;   /* VTDBus objects indexed by PCIBus* reference */
     VTDBus *vtd_as_by_bus_num[VTD_PCI_BUS_MAX]; /* VTDBus objects indexed by bus number */
@@ -269,7 +296,8 @@ struct IntelIOMMUState {
 
     /*
      * Protects IOMMU states in general.  Currently it protects the
-     * per-IOMMU IOTLB cache, and context entry cache in VTDAddressSpace.
+     * per-IOMMU IOTLB and page-walk caches, and context entry cache in
+     * VTDAddressSpace.
      */
     QemuMutex iommu_lock;
 };
@@ -51,6 +51,7 @@ struct X86MachineState {
     FWCfgState *fw_cfg;
     qemu_irq *gsi;
     GMappedFile *initrd_mapped_file;
+    GMappedFile *kernel_mapped_file;
     HotplugHandler *acpi_dev;
 
     /* RAM information (sizes, addresses, configuration): */
@@ -395,6 +395,7 @@ struct USBPacket {
     bool int_req;
     int status; /* USB_RET_* status code */
     int actual_length; /* Number of bytes actually transferred */
+    QEMUSGList *sgl; /* Guest memory behind iov, if mapped by usb_packet_map */
     /* Internal use by the USB layer.  */
     USBPacketState state;
     USBCombinedPacket *combined;
@@ -22,6 +22,7 @@
 #define HW_VFIO_VFIO_COMMON_H
 
 #include "exec/memory.h"
+#include "qemu/iova-tree.h"
 #include "qemu/queue.h"
 #include "qemu/notify.h"
 #include "ui/console.h"
@@ -76,6 +77,23 @@ typedef struct VFIOAddressSpace {
 
 struct VFIOGroup;
 
+typedef enum VFIODMAOp {
+    VFIO_DMA_NONE,
+    VFIO_DMA_MAP,
+    VFIO_DMA_UNMAP,
+} VFIODMAOp;
+
+/* DMA map or unmap request waiting for the end of a batch */
+typedef struct VFIODMAPending {
+    VFIODMAOp op;
+    MemoryRegion *mr;   /* of the RAM section, NULL for vIOMMU entries */
+    hwaddr iova;
+    hwaddr size;
+    void *vaddr;
+    bool readonly;
+    unsigned count;     /* requests coalesced into this one */
+} VFIODMAPending;
+
 typedef struct VFIOContainer {
     VFIOAddressSpace *space;
     int fd; /* /dev/vfio/vfio, empowered by the attached groups */
@@ -88,6 +106,9 @@ typedef struct VFIOContainer {
     uint64_t dirty_pgsizes;
     uint64_t max_dirty_bitmap_size;
     unsigned long pgsizes;
+    unsigned dma_batch_depth;
+    VFIODMAPending dma_pending;
+    IOVATree *dma_merged; /* mappings made of several requests */
     QLIST_HEAD(, VFIOGuestIOMMU) giommu_list;
     QLIST_HEAD(, VFIOHostDMAWindow) hostwin_list;
     QLIST_HEAD(, VFIOGroup) group_list;
@@ -37,6 +37,14 @@ struct vhost_scsi_target;
 struct vhost_iotlb_msg;
 struct vhost_virtqueue;
 
+/* Notification counters of one virtqueue, as seen by the backend */
+struct vhost_vring_stats {
+    unsigned int index;
+    uint64_t kicks;
+    uint64_t calls;
+    uint64_t suppressed_calls;
+};
+
 typedef int (*vhost_backend_init)(struct vhost_dev *dev, void *opaque);
 typedef int (*vhost_backend_cleanup)(struct vhost_dev *dev);
 typedef int (*vhost_backend_memslots_limit)(struct vhost_dev *dev);
@@ -125,6 +133,9 @@ typedef int (*vhost_get_device_id_op)(struct vhost_dev *dev, uint32_t *dev_id);
 
 typedef bool (*vhost_force_iommu_op)(struct vhost_dev *dev);
 
+typedef int (*vhost_get_vring_stats_op)(struct vhost_dev *dev,
+                                        struct vhost_vring_stats *stats);
+
 typedef struct VhostOps {
     VhostBackendType backend_type;
     vhost_backend_init vhost_backend_init;
@@ -170,6 +181,7 @@ typedef struct VhostOps {
     vhost_vq_get_addr_op  vhost_vq_get_addr;
     vhost_get_device_id_op vhost_get_device_id;
     vhost_force_iommu_op vhost_force_iommu;
+    vhost_get_vring_stats_op vhost_get_vring_stats;
 } VhostOps;
 
 extern const VhostOps user_ops;
@@ -13,11 +13,25 @@
 #define HW_VIRTIO_VHOST_VDPA_H
 
 #include "hw/virtio/virtio.h"
+#include "qemu/iova-tree.h"
+
+/* IOTLB message held back until the end of the memory transaction */
+typedef struct VhostVDPAPending {
+    uint8_t type;       /* VHOST_IOTLB_UPDATE, VHOST_IOTLB_INVALIDATE or 0 */
+    hwaddr iova;
+    hwaddr size;
+    void *vaddr;
+    bool readonly;
+    unsigned count;     /* sections merged into this message */
+} VhostVDPAPending;
 
 typedef struct vhost_vdpa {
     int device_fd;
     uint32_t msg_type;
+    bool iotlb_batch_begin_sent;
     MemoryListener listener;
+    VhostVDPAPending pending;
+    IOVATree *merged;   /* mappings made of several sections */
     struct vhost_dev *dev;
 } VhostVDPA;
 
@@ -32,6 +32,16 @@ struct vhost_virtqueue {
     struct vhost_dev *dev;
 };
 
+struct vhost_vring_info {
+    /* split ring indexes, only valid while the device is started */
+    bool has_idx;
+    uint16_t avail_idx;
+    uint16_t used_idx;
+    /* notification counters, if the backend can report them */
+    bool has_stats;
+    struct vhost_vring_stats stats;
+};
+
 typedef unsigned long vhost_log_chunk_t;
 #define VHOST_LOG_PAGE 0x1000
 #define VHOST_LOG_BITS (8 * sizeof(vhost_log_chunk_t))
@@ -146,4 +156,6 @@ int vhost_dev_set_inflight(struct vhost_dev *dev,
                            struct vhost_inflight *inflight);
 int vhost_dev_get_inflight(struct vhost_dev *dev, uint16_t queue_size,
                            struct vhost_inflight *inflight);
+void vhost_dev_get_vring_info(struct vhost_dev *hdev, int n,
+                              struct vhost_vring_info *info);
 #endif
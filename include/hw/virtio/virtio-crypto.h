@@ -80,6 +80,12 @@ typedef struct VirtIOCryptoQueue {
     VirtQueue *dataq;
     QEMUBH *dataq_bh;
     struct VirtIOCrypto *vcrypto;
+
+    /* Exposed as the read-only x-dataq<N>-* properties */
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t notifies;
 } VirtIOCryptoQueue;
 
 struct VirtIOCrypto {
@@ -58,6 +58,7 @@ struct VirtIOIOMMU {
     GTree *domains;
     QemuMutex mutex;
     GTree *endpoints;
+    GArray *unmap_batch;    /* Pending UNMAP notifications, under mutex */
 };
 
 #endif
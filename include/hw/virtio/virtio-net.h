@@ -20,6 +20,7 @@
 #include "net/announce.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "ebpf/ebpf_rss.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIONet, VIRTIO_NET)
@@ -130,6 +131,7 @@ typedef struct VirtioNetRscChain {
 
 typedef struct VirtioNetRssData {
     bool    enabled;
+    bool    enabled_software_rss; /* false while the eBPF program steers */
     bool    redirect;
     bool    populate_hash;
     uint32_t hash_types;
@@ -148,6 +150,8 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* Packets were received during a batch, the guest must be notified */
+    bool rx_notify_pending;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -193,6 +197,8 @@ struct VirtIONet {
     int multiqueue;
     uint16_t max_queues;
     uint16_t curr_queues;
+    /* Within virtio_net_receive_batch(): defer rx notifications */
+    bool rx_batching;
     size_t config_size;
     char *netclient_name;
     char *netclient_type;
@@ -214,6 +220,8 @@ struct VirtIONet {
     Notifier migration_state;
     VirtioNetRssData rss_data;
     struct NetRxPkt *rx_pkt;
+    EBPFRSSContext ebpf_rss;
+    char *ebpf_rss_fds;
 };
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -80,6 +80,14 @@ struct VirtIOSerialPortClass {
      */
     ssize_t (*have_data)(VirtIOSerialPort *port, const uint8_t *buf,
                          ssize_t len);
+
+    /*
+     * Optional.  Like have_data, but with all the remaining buffers of a
+     * guest request at once, so that the app can write them out with a
+     * single vectored write.  Used instead of have_data when set.
+     */
+    ssize_t (*have_data_iov)(VirtIOSerialPort *port, const struct iovec *iov,
+                             int iovcnt);
 };
 
 /*
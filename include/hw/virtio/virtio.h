@@ -61,6 +61,8 @@ typedef struct VirtQueueElement
     hwaddr *out_addr;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    /* Size of the allocation, including the device's own fields */
+    size_t alloc_size;
 } VirtQueueElement;
 
 #define VIRTIO_QUEUE_MAX 1024
@@ -186,17 +188,39 @@ void virtio_delete_queue(VirtQueue *vq);
 
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len);
+/*
+ * Return @num elements to the guest, each with the length at the same
+ * index of @lens, with a single update of the used index.  The caller
+ * then decides once whether to notify the guest.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int num);
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len);
 void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
                      unsigned int len);
 bool virtqueue_rewind(VirtQueue *vq, unsigned int num);
+/* Number of descriptors popped and not yet pushed back */
+unsigned int virtqueue_get_inuse(VirtQueue *vq);
 void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len, unsigned int idx);
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+/*
+ * Pop up to @max elements of @sz bytes into @elems, reading the avail
+ * index of a split ring only once.  Returns the number of elements.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max);
+/*
+ * Free an element returned by virtqueue_pop() on @vq, keeping its memory
+ * for the next pop instead of going through the allocator.  Elements may
+ * also be freed with g_free(), they are then simply not reused.  Must be
+ * called from the same thread as virtqueue_pop().
+ */
+void virtqueue_element_release(VirtQueue *vq, VirtQueueElement *elem);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
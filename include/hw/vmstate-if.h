@@ -36,4 +36,18 @@ static inline char *vmstate_if_get_id(VMStateIf *vmif)
     return VMSTATE_IF_GET_CLASS(vmif)->get_id(vmif);
 }
 
+/*
+ * Devices that ran since an in-memory device snapshot was taken, keyed by
+ * the opaque their state is registered with.  NULL unless a snapshot is
+ * tracking them; see device_snapshot_load_dirty().
+ */
+extern GHashTable *device_snapshot_touched;
+
+static inline void device_snapshot_touch(void *opaque)
+{
+    if (unlikely(device_snapshot_touched) && opaque) {
+        g_hash_table_add(device_snapshot_touched, opaque);
+    }
+}
+
 #endif /* VMSTATE_IF_H */
@@ -47,6 +47,9 @@ struct QIOChannelSocket {
     socklen_t localAddrLen;
     struct sockaddr_storage remoteAddr;
     socklen_t remoteAddrLen;
+    bool zero_copy;
+    uint64_t zero_copy_queued;
+    uint64_t zero_copy_sent;
 };
 
 
@@ -260,4 +263,94 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_set_zero_copy:
+ * @ioc: the socket channel object
+ * @enabled: whether to allow zero-copy transmission
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Allow data to be sent with qio_channel_socket_writev_zero_copy().
+ * This is only supported for TCP sockets on Linux hosts.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 bool enabled,
+                                 Error **errp);
+
+
+/**
+ * qio_channel_socket_writev_zero_copy:
+ * @ioc: the socket channel object
+ * @iov: the array of memory regions to write data from
+ * @niov: the length of the @iov array
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Behaves like qio_channel_writev(), except that the kernel transmits
+ * directly from the memory in @iov instead of copying it.  Each call that
+ * writes some data increments @ioc->zero_copy_queued; the memory must not
+ * be modified or freed until @ioc->zero_copy_sent has caught up with the
+ * value it had after the call, see qio_channel_socket_zero_copy_reap().
+ *
+ * Returns: the number of bytes written, QIO_CHANNEL_ERR_BLOCK if the
+ * socket would block, or -1 on error
+ */
+ssize_t
+qio_channel_socket_writev_zero_copy(QIOChannelSocket *ioc,
+                                    const struct iovec *iov,
+                                    size_t niov,
+                                    Error **errp);
+
+
+/**
+ * qio_channel_socket_zero_copy_reap:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Process the completion notifications that the kernel has queued for
+ * zero-copy writes, updating @ioc->zero_copy_sent.  This never blocks.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_socket_zero_copy_reap(QIOChannelSocket *ioc,
+                                  Error **errp);
+
+
+/**
+ * qio_channel_socket_zero_copy_flush:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Wait until the kernel has completed all the zero-copy writes
+ * issued so far, so that the memory they used can be reused.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_socket_zero_copy_flush(QIOChannelSocket *ioc,
+                                   Error **errp);
+
+
+/**
+ * qio_channel_socket_writev_zero_copy_all:
+ * @ioc: the socket channel object
+ * @iov: the array of memory regions to write data from
+ * @niov: the length of the @iov array
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Like qio_channel_socket_writev_zero_copy(), but wait for the
+ * socket to be writable until all of @iov has been queued.  The
+ * same rules apply to the memory in @iov.
+ *
+ * Returns: 0 if all bytes were written, or -1 on error
+ */
+int
+qio_channel_socket_writev_zero_copy_all(QIOChannelSocket *ioc,
+                                        const struct iovec *iov,
+                                        size_t niov,
+                                        Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
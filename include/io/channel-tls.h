@@ -48,6 +48,7 @@ struct QIOChannelTLS {
     QIOChannel *master;
     QCryptoTLSSession *session;
     QIOChannelShutdown shutdown;
+    bool ktls_tx;
 };
 
 /**
@@ -142,4 +143,21 @@ void qio_channel_tls_handshake(QIOChannelTLS *ioc,
 QCryptoTLSSession *
 qio_channel_tls_get_session(QIOChannelTLS *ioc);
 
+/**
+ * qio_channel_tls_enable_ktls_tx:
+ * @ioc: the TLS channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Let the kernel encrypt the data written to the channel, so
+ * that it goes straight to the master channel without being
+ * copied through GNUTLS.  The handshake must be complete and
+ * the master must be a TCP socket channel.  Reading is not
+ * affected.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_tls_enable_ktls_tx(QIOChannelTLS *ioc,
+                               Error **errp);
+
 #endif /* QIO_CHANNEL_TLS_H */
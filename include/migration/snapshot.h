@@ -18,4 +18,12 @@
 int save_snapshot(const char *name, Error **errp);
 int load_snapshot(const char *name, Error **errp);
 
+typedef struct DeviceSnapshot DeviceSnapshot;
+
+DeviceSnapshot *device_snapshot_new(size_t size);
+int device_snapshot_save(DeviceSnapshot *ds);
+int device_snapshot_load(DeviceSnapshot *ds);
+int device_snapshot_load_dirty(DeviceSnapshot *ds);
+size_t device_snapshot_size(DeviceSnapshot *ds);
+
 #endif
@@ -182,6 +182,12 @@ struct VMStateDescription {
     int minimum_version_id;
     int minimum_version_id_old;
     MigrationPriority priority;
+    /*
+     * Saving and loading only touch the object itself and do not need the
+     * BQL, so that the section can be handled in a worker thread together
+     * with other such sections (capability parallel-device-state).
+     */
+    bool parallel;
     LoadStateHandler *load_state_old;
     int (*pre_load)(void *opaque);
     int (*post_load)(void *opaque, int version_id);
@@ -71,5 +71,6 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
 bool qemu_net_queue_flush(NetQueue *queue);
+bool qemu_net_queue_is_idle(NetQueue *queue);
 
 #endif /* QEMU_NET_QUEUE_H */
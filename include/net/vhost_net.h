@@ -38,6 +38,7 @@ void vhost_net_virtqueue_mask(VHostNetState *net, VirtIODevice *dev,
                               int idx, bool mask);
 int vhost_net_notify_migration_done(VHostNetState *net, char* mac_addr);
 VHostNetState *get_vhost_net(NetClientState *nc);
+VhostQueueInfoList *vhost_net_query_queues(NetClientState *nc);
 
 int vhost_set_vring_enable(NetClientState * nc, int enable);
 
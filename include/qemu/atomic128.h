@@ -13,6 +13,7 @@
 #ifndef QEMU_ATOMIC128_H
 #define QEMU_ATOMIC128_H
 
+#include "qemu/atomic.h"
 #include "qemu/int128.h"
 
 /*
@@ -79,12 +80,30 @@ static inline Int128 atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new)
 }
 # define HAVE_CMPXCHG128 1
 #else
-/* Fallback definition that must be optimized away, or error.  */
-Int128 QEMU_ERROR("unsupported atomic")
-    atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new);
+/*
+ * Fallback that serializes on a lock chosen by address, see atomic128.c.
+ * It is atomic only with respect to other calls of atomic16_cmpxchg,
+ * not to narrower stores to the same memory.
+ */
+Int128 atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new);
+extern bool atomic16_lock_enabled;
 # define HAVE_CMPXCHG128 0
 #endif /* Some definition for HAVE_CMPXCHG128 */
 
+/*
+ * Whether guest 128-bit compare-and-swap can use atomic16_cmpxchg in
+ * a parallel context, rather than stopping all other vCPUs: always with
+ * host support, and with the lock-based fallback only if it is enabled.
+ */
+static inline bool atomic16_cmpxchg_enabled(void)
+{
+#if HAVE_CMPXCHG128
+    return true;
+#else
+    return qatomic_read(&atomic16_lock_enabled);
+#endif
+}
+
 
 #if defined(CONFIG_ATOMIC128)
 static inline Int128 atomic16_read(Int128 *ptr)
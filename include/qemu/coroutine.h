@@ -70,6 +70,20 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque);
  */
 void qemu_coroutine_enter(Coroutine *coroutine);
 
+/**
+ * Grow the coroutine pools by @additional_size coroutines
+ *
+ * Devices call this when they can have many requests in flight at once, so
+ * that the coroutines of those requests are recycled instead of allocated
+ * anew each time.
+ */
+void qemu_coroutine_increase_pool_batch_size(unsigned int additional_size);
+
+/**
+ * Undo qemu_coroutine_increase_pool_batch_size()
+ */
+void qemu_coroutine_decrease_pool_batch_size(unsigned int removed_size);
+
 /**
  * Transfer control to a coroutine if it's not active (i.e. part of the call
  * stack of the running coroutine). Otherwise, do nothing.
@@ -17,6 +17,7 @@
 
 typedef struct HBitmap HBitmap;
 typedef struct HBitmapIter HBitmapIter;
+typedef struct HBitmapArea HBitmapArea;
 
 #define BITS_PER_LEVEL         (BITS_PER_LONG == 32 ? 5 : 6)
 
@@ -33,6 +34,11 @@ typedef struct HBitmapIter HBitmapIter;
  */
 #define HBITMAP_LEVELS         ((HBITMAP_LOG_MAX_SIZE / BITS_PER_LEVEL) + 1)
 
+struct HBitmapArea {
+    int64_t start;
+    int64_t count;
+};
+
 struct HBitmapIter {
     const HBitmap *hb;
 
@@ -340,6 +346,23 @@ bool hbitmap_next_dirty_area(const HBitmap *hb, int64_t start, int64_t end,
                              int64_t max_dirty_count,
                              int64_t *dirty_start, int64_t *dirty_count);
 
+/* hbitmap_next_dirty_areas:
+ * @hb: The HBitmap to operate on
+ * @start: the offset to start from
+ * @end: end of requested area
+ * @max_dirty_count: limit for the length of each area
+ * @areas: array that receives the areas that were found
+ * @nb_areas: number of elements in @areas
+ *
+ * Batched version of hbitmap_next_dirty_area: fill @areas with up to
+ * @nb_areas consecutive dirty areas within [@start, @end), in ascending
+ * order, and return how many were found.  A return value lower than
+ * @nb_areas means that the end of the range was reached.
+ */
+int hbitmap_next_dirty_areas(const HBitmap *hb, int64_t start, int64_t end,
+                             int64_t max_dirty_count,
+                             HBitmapArea *areas, int nb_areas);
+
 /**
  * hbitmap_iter_next:
  * @hbi: HBitmapIter to operate on.
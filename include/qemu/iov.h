@@ -162,6 +162,11 @@ typedef struct QEMUIOVector {
      * (qemu_iovec_init()), @size is the cumulative size of iovecs and
      * @local_iov is invalid and unused.
      *
+     * As an exception, qemu_iovec_init() with @alloc_hint of at most 1
+     * points @iov to &@local_iov until a second element is added.  This
+     * works because @size equals @local_iov.iov_len as long as there is
+     * at most one element.
+     *
      * For embedded @iov (QEMU_IOVEC_INIT_BUF() or qemu_iovec_init_buf()),
      * @iov is equal to &@local_iov, and @size is valid, as it has same
      * offset and type as @local_iov.iov_len, which is guaranteed by
@@ -65,6 +65,24 @@ static inline bool qemu_log_separate(void)
 /* LOG_STRACE is used for user-mode strace logging. */
 #define LOG_STRACE         (1 << 19)
 
+/*
+ * qemu_log_buffered() keeps the lines of each thread in a buffer of
+ * its own and writes them out in large chunks, so that vCPU threads do
+ * not contend on the log file for every line of an execution trace.
+ * Before anything else is logged, the thread's pending lines are written
+ * out so that its output stays in order.
+ */
+extern __thread bool qemu_log_buffer_pending;
+
+void qemu_log_buffer_flush(void);
+
+static inline void qemu_log_flush_pending(void)
+{
+    if (unlikely(qemu_log_buffer_pending)) {
+        qemu_log_buffer_flush();
+    }
+}
+
 /* Lock output for a series of related logs.  Since this is not needed
  * for a single qemu_log / qemu_log_mask / qemu_log_mask_and_addr, we
  * assume that qemu_loglevel_mask has already been tested, and that
@@ -74,6 +92,7 @@ static inline bool qemu_log_separate(void)
 static inline FILE *qemu_log_lock(void)
 {
     QemuLogFile *logfile;
+    qemu_log_flush_pending();
     rcu_read_lock();
     logfile = qatomic_rcu_read(&qemu_logfile);
     if (logfile) {
@@ -101,6 +120,7 @@ qemu_log_vprintf(const char *fmt, va_list va)
 {
     QemuLogFile *logfile;
 
+    qemu_log_flush_pending();
     rcu_read_lock();
     logfile = qatomic_rcu_read(&qemu_logfile);
     if (logfile) {
@@ -136,6 +156,17 @@ qemu_log_vprintf(const char *fmt, va_list va)
         }                                               \
     } while (0)
 
+/* Same as qemu_log_mask_and_addr, but through the per-thread buffer */
+#define qemu_log_mask_and_addr_buffered(MASK, ADDR, FMT, ...)   \
+    do {                                                        \
+        if (unlikely(qemu_loglevel_mask(MASK)) &&               \
+                     qemu_log_in_addr_range(ADDR)) {            \
+            qemu_log_buffered(FMT, ## __VA_ARGS__);             \
+        }                                                       \
+    } while (0)
+
+int GCC_FMT_ATTR(1, 2) qemu_log_buffered(const char *fmt, ...);
+
 /* Maintenance: */
 
 /* define log items */
@@ -393,6 +393,14 @@ void qemu_anon_ram_free(void *ptr, size_t size);
 #else
 #define QEMU_MADV_REMOVE QEMU_MADV_INVALID
 #endif
+#ifdef MADV_POPULATE_WRITE
+#define QEMU_MADV_POPULATE_WRITE MADV_POPULATE_WRITE
+#elif defined(CONFIG_LINUX)
+/* Since Linux 5.14, older headers do not know it */
+#define QEMU_MADV_POPULATE_WRITE 23
+#else
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
+#endif
 
 #elif defined(CONFIG_POSIX_MADVISE)
 
@@ -406,6 +414,7 @@ void qemu_anon_ram_free(void *ptr, size_t size);
 #define QEMU_MADV_HUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_NOHUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_REMOVE QEMU_MADV_INVALID
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
 
 #else /* no-op */
 
@@ -419,6 +428,7 @@ void qemu_anon_ram_free(void *ptr, size_t size);
 #define QEMU_MADV_HUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_NOHUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_REMOVE QEMU_MADV_INVALID
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
 
 #endif
 
@@ -614,6 +624,38 @@ void qemu_set_tty_echo(int fd, bool echo);
 void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
                      Error **errp);
 
+/**
+ * os_mem_prealloc_nodes:
+ * @fd: file descriptor backing @area, or -1
+ * @area: start of the memory to preallocate
+ * @sz: size of the memory to preallocate
+ * @max_threads: number of threads to use, at least one per host node
+ * @host_nodes: bitmap of host nodes @area is bound to, or NULL
+ * @maxnode: number of bits in @host_nodes
+ * @async: return once the threads are started
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Like os_mem_prealloc(), but the work is split between the host nodes
+ * in @host_nodes and every thread runs on the CPUs of its node.  With
+ * @async, the preallocation may still be in progress on return and
+ * os_mem_prealloc_wait() must be called before the guest runs.  Only
+ * one preallocation is in progress at a time; starting another one
+ * first waits for the previous one.
+ */
+void os_mem_prealloc_nodes(int fd, char *area, size_t sz, int max_threads,
+                           const unsigned long *host_nodes,
+                           unsigned long maxnode, bool async, Error **errp);
+
+/**
+ * os_mem_prealloc_wait:
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Wait for an asynchronous os_mem_prealloc_nodes() to complete.
+ *
+ * Returns: false if the memory could not be preallocated.
+ */
+bool os_mem_prealloc_wait(Error **errp);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
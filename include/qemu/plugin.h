@@ -26,6 +26,7 @@ enum qemu_plugin_event {
     QEMU_PLUGIN_EV_VCPU_SYSCALL_RET,
     QEMU_PLUGIN_EV_FLUSH,
     QEMU_PLUGIN_EV_ATEXIT,
+    QEMU_PLUGIN_EV_VCPU_MEM_BUF,
     QEMU_PLUGIN_EV_MAX, /* total number of plugin events we support */
 };
 
@@ -54,6 +55,7 @@ union qemu_plugin_cb_sig {
     qemu_plugin_vcpu_udata_cb_t      vcpu_udata;
     qemu_plugin_vcpu_tb_trans_cb_t   vcpu_tb_trans;
     qemu_plugin_vcpu_mem_cb_t        vcpu_mem;
+    qemu_plugin_vcpu_mem_buf_cb_t    vcpu_mem_buf;
     qemu_plugin_vcpu_syscall_cb_t    vcpu_syscall;
     qemu_plugin_vcpu_syscall_ret_cb_t vcpu_syscall_ret;
     void *generic;
@@ -68,6 +70,7 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_BUF, /* record into the memory trace buffer */
     PLUGIN_N_CB_SUBTYPES,
 };
 
@@ -88,6 +91,7 @@ struct qemu_plugin_dyn_cb {
         struct {
             enum qemu_plugin_op op;
             uint64_t imm;
+            size_t stride; /* between vCPU entries, 0 for a single one */
         } inline_insn;
     };
 };
@@ -179,6 +183,10 @@ void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret);
 
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t meminfo);
 
+void qemu_plugin_vcpu_mem_buf_flush(CPUState *cpu);
+void qemu_plugin_vcpu_mem_buf_reserve(unsigned int vcpu_index, void *udata);
+void qemu_plugin_tb_mem_buf_reserve(struct qemu_plugin_tb *tb, size_t n);
+
 void qemu_plugin_flush_cb(void);
 
 void qemu_plugin_atexit_cb(void);
@@ -233,6 +233,7 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
 
 enum qemu_plugin_op {
     QEMU_PLUGIN_INLINE_ADD_U64,
+    QEMU_PLUGIN_INLINE_STORE_U64,
 };
 
 /**
@@ -250,6 +251,27 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - per-vCPU inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @ptr: the target memory location for vCPU 0
+ * @stride: the distance in bytes between the locations of two vCPUs
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_tb_exec_inline(), but the op works on
+ * @ptr + vcpu_index * @stride, a scoreboard the plugin allocates with
+ * an entry for every vCPU (see qemu_plugin_n_max_vcpus()).  Since each
+ * vCPU only updates its own entry, counts are exact without having to
+ * use a callback.  @stride must be below 2^31.
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    void *ptr,
+    size_t stride,
+    uint64_t imm);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -279,6 +301,25 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @ptr: the target memory location for vCPU 0
+ * @stride: the distance in bytes between the locations of two vCPUs
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op on @ptr + vcpu_index * @stride every time an
+ * instruction executes.  See
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu().
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    void *ptr,
+    size_t stride,
+    uint64_t imm);
+
 /*
  * Helpers to query information about the instructions in a block
  */
@@ -351,6 +392,65 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/*
+ * Same as qemu_plugin_register_vcpu_mem_inline(), on the entry at
+ * @ptr + vcpu_index * @stride.  See
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu().
+ */
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    void *ptr,
+    size_t stride,
+    uint64_t imm);
+
+/**
+ * struct qemu_plugin_mem_record - a memory access in the trace buffer
+ * @vaddr: the virtual address of the access
+ * @info: the qemu_plugin_meminfo_t of the access
+ */
+struct qemu_plugin_mem_record {
+    uint64_t vaddr;
+    qemu_plugin_meminfo_t info;
+};
+
+typedef void
+(*qemu_plugin_vcpu_mem_buf_cb_t)(unsigned int vcpu_index,
+                                 const struct qemu_plugin_mem_record *recs,
+                                 size_t n, void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_mem_buf_cb() - register a trace buffer callback
+ * @id: plugin ID
+ * @cb: callback function
+ * @userdata: any plugin data to pass to the @cb
+ *
+ * The memory accesses of the instructions passed to
+ * qemu_plugin_register_vcpu_mem_buf() are stored inline, without a
+ * helper call, into a per-vCPU buffer.  @cb gets the records of a vCPU,
+ * oldest first, when its buffer is full, when it goes idle and when it
+ * exits.  There is only one buffer per vCPU: with several plugins using
+ * it, each of them gets the records asked for by all of them.
+ *
+ * The records are only valid for the duration of the callback, and
+ * qemu_plugin_get_hwaddr() cannot be used on them.
+ */
+void qemu_plugin_register_vcpu_mem_buf_cb(qemu_plugin_id_t id,
+                                          qemu_plugin_vcpu_mem_buf_cb_t cb,
+                                          void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_mem_buf() - trace an instruction's accesses
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @rw: monitor reads, writes or both
+ *
+ * Store a record of every access of @insn into the vCPU's trace buffer;
+ * see qemu_plugin_register_vcpu_mem_buf_cb().
+ */
+void qemu_plugin_register_vcpu_mem_buf(struct qemu_plugin_insn *insn,
+                                       enum qemu_plugin_mem_rw rw);
+
 
 
 typedef void
@@ -24,4 +24,35 @@ void qsp_enable(void);
 void qsp_disable(void);
 void qsp_reset(void);
 
+/*
+ * Sampled profiling of the BQL, see util/qsp.c.  A context tells who
+ * holds the BQL while it is active; contexts live on the stack of the
+ * thread that pushes them and must be popped in reverse order, without
+ * yielding in between.
+ */
+typedef struct QSPBQLContext QSPBQLContext;
+struct QSPBQLContext {
+    const char *kind;
+    const void *obj;
+    const char *name;
+    QSPBQLContext *prev;
+};
+
+typedef void QSPBQLIterFunc(const char *kind, const char *label,
+                            uint64_t count, uint64_t wait_ns,
+                            uint64_t hold_ns, void *opaque);
+
+void qsp_bql_context_push(QSPBQLContext *ctx, const char *kind,
+                          const void *obj, const char *name);
+void qsp_bql_context_pop(QSPBQLContext *ctx);
+
+int64_t qsp_bql_lock_begin(void);
+void qsp_bql_lock_end(int64_t t0, const char *file, int line);
+void qsp_bql_release(void);
+
+unsigned int qsp_bql_get_period(void);
+void qsp_bql_set_period(unsigned int period);
+void qsp_bql_report(size_t max);
+void qsp_bql_foreach(QSPBQLIterFunc *fn, void *opaque);
+
 #endif /* QEMU_QSP_H */
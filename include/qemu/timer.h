@@ -86,7 +86,9 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    QEMUTimer *next;            /* only used by the ptimer test stubs */
+    uint64_t seq;               /* order among timers with equal expire_time */
+    int heap_index;             /* position in the timer list while pending */
     int attributes;
     int scale;
 };
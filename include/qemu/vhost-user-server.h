@@ -16,6 +16,7 @@
 #include "io/channel-file.h"
 #include "io/net-listener.h"
 #include "qemu/error-report.h"
+#include "qemu/thread.h"
 #include "qapi/error.h"
 #include "standard-headers/linux/virtio_blk.h"
 
@@ -23,6 +24,9 @@
 typedef struct VuFdWatch {
     VuDev *vu_dev;
     int fd; /*kick fd*/
+    int queue; /* virtqueue index */
+    AioContext *ctx; /* queue AioContext, or NULL to follow VuServer->ctx */
+    bool removed; /* set by remove_watch() */
     void *pvt;
     vu_watch_cb cb;
     QTAILQ_ENTRY(VuFdWatch) next;
@@ -32,7 +36,9 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks and virtqueue kicks run in the given AioContext, unless
+ * vhost_user_server_set_queue_aio_contexts() spreads the kicks over
+ * several AioContexts.
  */
 typedef struct {
     QIONetListener *listener;
@@ -46,6 +52,19 @@ typedef struct {
     QIOChannel *ioc; /* The I/O channel with the client */
     QIOChannelSocket *sioc; /* The underlying data channel with the client */
     QTAILQ_HEAD(, VuFdWatch) vu_fd_watches;
+    QemuMutex vu_fd_watches_lock;
+
+    /*
+     * Per-virtqueue AioContexts, assigned round-robin, and one lock per
+     * virtqueue.  A virtqueue's lock is held while its kick is handled and
+     * while a request is completed on it; all of them are held while a
+     * vhost-user message is processed, since messages may change the
+     * state that the virtqueues use.
+     */
+    AioContext **queue_ctx;
+    int nb_queue_ctx;
+    QemuRecMutex *vq_locks;
+    bool vqs_locked;
 
     Coroutine *co_trip; /* coroutine for processing VhostUserMsg */
 } VuServer;
@@ -59,6 +78,11 @@ bool vhost_user_server_start(VuServer *server,
 
 void vhost_user_server_stop(VuServer *server);
 
+void vhost_user_server_set_queue_aio_contexts(VuServer *server,
+                                              AioContext **ctxs, int nb_ctxs);
+void vhost_user_server_lock_queue(VuServer *server, int idx);
+void vhost_user_server_unlock_queue(VuServer *server, int idx);
+
 void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx);
 void vhost_user_server_detach_aio_context(VuServer *server);
 
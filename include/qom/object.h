@@ -117,7 +117,12 @@ typedef void (ObjectUnparent)(Object *obj);
  */
 typedef void (ObjectFree)(void *obj);
 
-#define OBJECT_CLASS_CAST_CACHE 4
+/*
+ * Devices are commonly cast to each of their parent types and interfaces
+ * on hot paths, and the same type name can be passed from several string
+ * literals, so leave room for all of them.
+ */
+#define OBJECT_CLASS_CAST_CACHE 8
 
 /**
  * struct ObjectClass:
@@ -42,10 +42,30 @@ void cpu_throttle_init(void);
  */
 void cpu_throttle_set(int new_throttle_pct);
 
+/**
+ * cpu_throttle_vcpu_set:
+ * @cpu: The vcpu to throttle
+ * @new_throttle_pct: Percent of sleep time. Valid range is 1 to 99, or 0
+ * to stop throttling @cpu.
+ *
+ * Throttles a single vcpu, like cpu_throttle_set does for all of them.
+ * The vcpu sleeps for the highest of its own and the global percentage.
+ */
+void cpu_throttle_vcpu_set(CPUState *cpu, int new_throttle_pct);
+
+/**
+ * cpu_throttle_vcpu_get_percentage:
+ * @cpu: The vcpu to query
+ *
+ * Returns: The throttle percentage set with cpu_throttle_vcpu_set, or 0.
+ */
+int cpu_throttle_vcpu_get_percentage(CPUState *cpu);
+
 /**
  * cpu_throttle_stop:
  *
- * Stops the vcpu throttling started by cpu_throttle_set.
+ * Stops the vcpu throttling started by cpu_throttle_set and
+ * cpu_throttle_vcpu_set.
  */
 void cpu_throttle_stop(void);
 
@@ -81,6 +81,22 @@ int64_t cpu_get_ticks(void);
  */
 int64_t cpu_get_clock(void);
 
+/*
+ * Position of the VM clocks, to put time back where it was when a
+ * snapshot is restored in place.
+ */
+typedef struct CPUTimersSnapshot {
+    int64_t ticks;
+    int64_t clock;
+    int64_t icount;
+    int64_t icount_bias;
+} CPUTimersSnapshot;
+
+/* Caller must hold BQL */
+void cpu_timers_save(CPUTimersSnapshot *s);
+/* Caller must hold BQL */
+void cpu_timers_restore(const CPUTimersSnapshot *s);
+
 void qemu_timer_notify_cb(void *opaque, QEMUClockType type);
 
 /* get the VIRTUAL clock and VM elapsed ticks via the cpus accel interface */
@@ -17,6 +17,7 @@
 #include "block/aio.h"
 #include "qemu/thread.h"
 #include "qom/object.h"
+#include "qapi/qapi-builtin-types.h"
 
 #define TYPE_IOTHREAD "iothread"
 
@@ -37,6 +38,18 @@ struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* Thread pool parameters, see aio_context_set_thread_pool_params() */
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+
+    /* io_uring parameters, see aio_context_set_io_uring_params() */
+    bool io_uring_fixed;
+    bool io_uring_sqpoll;
+    uint32_t io_uring_sqpoll_idle;
+
+    /* Host CPUs the thread may run on, NULL for no restriction */
+    uint16List *cpu_affinity;
 };
 typedef struct IOThread IOThread;
 
@@ -18,11 +18,17 @@ typedef struct KVMSlot
     hwaddr start_addr;
     ram_addr_t memory_size;
     void *ram;
+    /* Offset of ram in ram_list, for the dirty ring */
+    ram_addr_t ram_start_offset;
+    /* Block that holds ram, to account the pages of the dirty ring */
+    RAMBlock *ram_block;
     int slot;
     int flags;
     int old_flags;
     /* Dirty bitmap cache for the slot */
     unsigned long *dirty_bmap;
+    /* Region of a slot whose removal waits for the listener commit */
+    MemoryRegion *del_pending;
 } KVMSlot;
 
 typedef struct KVMMemoryListener {
@@ -30,6 +36,10 @@ typedef struct KVMMemoryListener {
     /* Protects the slots and all inside them */
     QemuMutex slots_lock;
     KVMSlot *slots;
+    /* Slots registered with KVM, sorted by start_addr */
+    KVMSlot **slots_by_addr;
+    int nr_used_slots;
+    unsigned long *used_slots;
     int as_id;
 } KVMMemoryListener;
 
@@ -15,6 +15,9 @@ typedef hwaddr (*phys_offset_to_gaddr_t)(hwaddr phys_offset,
                                          ram_addr_t size);
 #ifdef CONFIG_XEN
 
+/* Must be called before xen_map_cache_init() */
+void xen_map_cache_set_bucket_size(uint64_t size, Error **errp);
+uint64_t xen_map_cache_get_bucket_size(void);
 void xen_map_cache_init(phys_offset_to_gaddr_t f,
                         void *opaque);
 uint8_t *xen_map_cache(hwaddr phys_addr, hwaddr size,
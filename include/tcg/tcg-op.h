@@ -833,6 +833,40 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_lookup_and_goto_ptr_cached() - tcg_gen_lookup_and_goto_ptr
+ * with an inline target cache
+ * @pc: Guest address of the target TB, as stored in TranslationBlock.pc
+ * @cs_base: cs_base of the target TB
+ * @flags: flags of the target TB
+ *
+ * Remember the last target of this jump site and go straight to it, without
+ * a helper call, when its lookup key matches again.  Only for jumps whose
+ * cs_base and flags are known at translation time, such as near indirect
+ * jumps: @cs_base and @flags must be what cpu_get_tb_cpu_state() returns
+ * once the jump is done.
+ */
+void tcg_gen_lookup_and_goto_ptr_cached(TCGv pc, target_ulong cs_base,
+                                        uint32_t flags);
+
+/**
+ * tcg_gen_ras_push() - push a return prediction for a guest call
+ *
+ * Give the return address of the call a cache slot, and push it on the
+ * shadow return stack for tcg_gen_lookup_and_goto_ptr_ret().
+ */
+void tcg_gen_ras_push(void);
+
+/**
+ * tcg_gen_lookup_and_goto_ptr_ret() - tcg_gen_lookup_and_goto_ptr_cached
+ * for a guest return
+ *
+ * Like tcg_gen_lookup_and_goto_ptr_cached(), but use the slot on top of the
+ * shadow return stack, that of the matching call, instead of one of its own.
+ */
+void tcg_gen_lookup_and_goto_ptr_ret(TCGv pc, target_ulong cs_base,
+                                     uint32_t flags);
+
 static inline void tcg_gen_plugin_cb_start(unsigned from, unsigned type,
                                            unsigned wr)
 {
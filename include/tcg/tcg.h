@@ -259,10 +259,19 @@ struct TCGLabel {
     unsigned has_value : 1;
     unsigned id : 14;
     unsigned refs : 16;
+    /*
+     * Set by liveness analysis if the label is the target of a backward
+     * branch; globals are then always in memory at the label.
+     */
+    unsigned back_ref : 1;
     union {
         uintptr_t value;
         tcg_insn_unit *value_ptr;
     } u;
+    /* Liveness of the globals at the label, NULL if back_ref.  */
+    uint8_t *la_state;
+    /* Register of each global on all edges seen so far, or -1.  */
+    int8_t *reg_globals;
     QSIMPLEQ_HEAD(, TCGRelocation) relocs;
     QSIMPLEQ_ENTRY(TCGLabel) next;
 };
@@ -835,7 +844,12 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_init(void);
 void tb_destroy(TranslationBlock *tb);
+void tb_jmp_cache_clear_range(void *start, void *end);
+void tb_ibtc_clear_range(void *start, void *end);
 void tcg_region_reset_all(void);
+bool tcg_region_evict(void);
+bool tcg_region_evict_wanted(void);
+bool tcg_region_evict_async(void);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -1403,9 +1417,9 @@ GEN_ATOMIC_HELPER_ALL(xchg)
  * These aren't really a "proper" helpers because TCG cannot manage Int128.
  * However, use the same format as the others, for use by the backends.
  *
- * The cmpxchg functions are only defined if HAVE_CMPXCHG128;
- * the ld/st functions are only defined if HAVE_ATOMIC128,
- * as defined by <qemu/atomic128.h>.
+ * The cmpxchg functions are always defined, but may only be used in a
+ * parallel context if atomic16_cmpxchg_enabled(); the ld/st functions
+ * are only defined if HAVE_ATOMIC128, as defined by <qemu/atomic128.h>.
  */
 Int128 helper_atomic_cmpxchgo_le_mmu(CPUArchState *env, target_ulong addr,
                                      Int128 cmpv, Int128 newv,
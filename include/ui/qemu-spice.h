@@ -29,6 +29,7 @@
 void qemu_spice_input_init(void);
 void qemu_spice_display_init(void);
 bool qemu_spice_have_display_interface(QemuConsole *con);
+bool qemu_spice_have_clients(void);
 int qemu_spice_add_display_interface(QXLInstance *qxlin, QemuConsole *con);
 int qemu_spice_migrate_info(const char *hostname, int port, int tls_port,
                             const char *subject);
@@ -97,6 +97,7 @@ struct SimpleSpiceDisplay {
 
     QXLRect dirty;
     int notify;
+    bool skipped_refresh;
 
     /*
      * All struct members below this comment can be accessed from
@@ -22,11 +22,20 @@
 #include "qapi/error.h"
 #include "qapi/qapi-visit-sockets.h"
 #include "qemu/module.h"
+#include "qemu/iov.h"
 #include "io/channel-socket.h"
 #include "io/channel-watch.h"
 #include "trace.h"
 #include "qapi/clone-visitor.h"
 
+#ifdef CONFIG_LINUX
+#include <linux/errqueue.h>
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define QEMU_MSG_ZEROCOPY
+#endif
+#endif
+
 #define SOCKET_MAX_FDS 16
 
 SocketAddress *
@@ -658,6 +667,212 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 }
 #endif /* WIN32 */
 
+
+#ifdef QEMU_MSG_ZEROCOPY
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 bool enabled,
+                                 Error **errp)
+{
+    int v = enabled;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) < 0) {
+        error_setg_errno(errp, errno, "Unable to set SO_ZEROCOPY on socket");
+        return -1;
+    }
+    ioc->zero_copy = enabled;
+    return 0;
+}
+
+
+ssize_t
+qio_channel_socket_writev_zero_copy(QIOChannelSocket *ioc,
+                                    const struct iovec *iov,
+                                    size_t niov,
+                                    Error **errp)
+{
+    ssize_t ret;
+    struct msghdr msg = { NULL, };
+
+    assert(ioc->zero_copy);
+
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = niov;
+
+ retry:
+    ret = sendmsg(ioc->fd, &msg, MSG_ZEROCOPY);
+    if (ret <= 0) {
+        if (errno == EAGAIN) {
+            return QIO_CHANNEL_ERR_BLOCK;
+        }
+        if (errno == EINTR) {
+            goto retry;
+        }
+        error_setg_errno(errp, errno,
+                         "Unable to write to socket");
+        return -1;
+    }
+
+    ioc->zero_copy_queued++;
+    return ret;
+}
+
+
+int
+qio_channel_socket_zero_copy_reap(QIOChannelSocket *ioc,
+                                  Error **errp)
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+    struct msghdr msg = { NULL, };
+    struct sock_extended_err *serr;
+    struct cmsghdr *cm;
+    ssize_t ret;
+
+    while (ioc->zero_copy_sent != ioc->zero_copy_queued) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ret = recvmsg(ioc->fd, &msg, MSG_ERRQUEUE);
+        if (ret < 0) {
+            if (errno == EAGAIN) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno,
+                             "Unable to read socket error queue");
+            return -1;
+        }
+
+        cm = CMSG_FIRSTHDR(&msg);
+        if (!cm || !((cm->cmsg_level == SOL_IP &&
+                      cm->cmsg_type == IP_RECVERR) ||
+                     (cm->cmsg_level == SOL_IPV6 &&
+                      cm->cmsg_type == IPV6_RECVERR))) {
+            error_setg(errp, "Unexpected message in socket error queue");
+            return -1;
+        }
+
+        serr = (struct sock_extended_err *)CMSG_DATA(cm);
+        if (serr->ee_errno || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            error_setg_errno(errp, serr->ee_errno,
+                             "Zero-copy write failed");
+            return -1;
+        }
+
+        /* Completions cover the inclusive range [ee_info, ee_data] */
+        ioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
+    }
+
+    return 0;
+}
+
+
+int
+qio_channel_socket_zero_copy_flush(QIOChannelSocket *ioc,
+                                   Error **errp)
+{
+    struct pollfd pfd = { .fd = ioc->fd };
+
+    trace_qio_channel_socket_zero_copy_flush(ioc, ioc->zero_copy_queued,
+                                             ioc->zero_copy_sent);
+    for (;;) {
+        if (qio_channel_socket_zero_copy_reap(ioc, errp) < 0) {
+            return -1;
+        }
+        if (ioc->zero_copy_sent == ioc->zero_copy_queued) {
+            return 0;
+        }
+
+        /* POLLERR is always reported, and means the error queue is ready */
+        pfd.revents = 0;
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno, "Unable to poll socket");
+            return -1;
+        }
+        if (pfd.revents & (POLLHUP | POLLNVAL)) {
+            error_setg(errp, "Socket closed with zero-copy writes pending");
+            return -1;
+        }
+    }
+}
+#else /* QEMU_MSG_ZEROCOPY */
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 bool enabled,
+                                 Error **errp)
+{
+    if (enabled) {
+        error_setg(errp, "Zero-copy transmission is not supported on this "
+                   "platform");
+        return -1;
+    }
+    return 0;
+}
+
+
+ssize_t
+qio_channel_socket_writev_zero_copy(QIOChannelSocket *ioc,
+                                    const struct iovec *iov,
+                                    size_t niov,
+                                    Error **errp)
+{
+    g_assert_not_reached();
+}
+
+
+int
+qio_channel_socket_zero_copy_reap(QIOChannelSocket *ioc,
+                                  Error **errp)
+{
+    return 0;
+}
+
+
+int
+qio_channel_socket_zero_copy_flush(QIOChannelSocket *ioc,
+                                   Error **errp)
+{
+    return 0;
+}
+#endif /* QEMU_MSG_ZEROCOPY */
+
+
+int
+qio_channel_socket_writev_zero_copy_all(QIOChannelSocket *ioc,
+                                        const struct iovec *iov,
+                                        size_t niov,
+                                        Error **errp)
+{
+    g_autofree struct iovec *local_iov_head = g_new(struct iovec, niov);
+    struct iovec *local_iov = local_iov_head;
+    unsigned int nlocal_iov;
+
+    nlocal_iov = iov_copy(local_iov, niov, iov, niov, 0, iov_size(iov, niov));
+
+    while (nlocal_iov > 0) {
+        ssize_t len;
+
+        len = qio_channel_socket_writev_zero_copy(ioc, local_iov, nlocal_iov,
+                                                  errp);
+        if (len == QIO_CHANNEL_ERR_BLOCK) {
+            qio_channel_wait(QIO_CHANNEL(ioc), G_IO_OUT);
+            continue;
+        }
+        if (len < 0) {
+            return -1;
+        }
+
+        iov_discard_front(&local_iov, &nlocal_iov, len);
+    }
+
+    return 0;
+}
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -22,6 +22,7 @@
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 
 
@@ -305,6 +306,10 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
     size_t i;
     ssize_t done = 0;
 
+    if (tioc->ktls_tx) {
+        return qio_channel_writev(tioc->master, iov, niov, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
@@ -330,6 +335,22 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
     return done;
 }
 
+int qio_channel_tls_enable_ktls_tx(QIOChannelTLS *ioc,
+                                   Error **errp)
+{
+    if (!object_dynamic_cast(OBJECT(ioc->master), TYPE_QIO_CHANNEL_SOCKET)) {
+        error_setg(errp, "Kernel TLS needs a socket channel");
+        return -1;
+    }
+    if (qcrypto_tls_session_enable_ktls_tx(
+            ioc->session, QIO_CHANNEL_SOCKET(ioc->master)->fd, errp) < 0) {
+        return -1;
+    }
+    ioc->ktls_tx = true;
+    trace_qio_channel_tls_enable_ktls_tx(ioc);
+    return 0;
+}
+
 static int qio_channel_tls_set_blocking(QIOChannel *ioc,
                                         bool enabled,
                                         Error **errp)
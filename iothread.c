@@ -12,14 +12,21 @@
  */
 
 #include "qemu/osdep.h"
+#ifdef CONFIG_LINUX
+#include <sched.h>
+#endif
 #include "qom/object.h"
 #include "qom/object_interfaces.h"
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
+#include "qapi/clone-visitor.h"
+#include "qapi/qapi-builtin-visit.h"
 #include "qapi/qapi-commands-misc.h"
+#include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
@@ -113,6 +120,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -146,6 +154,43 @@ static void iothread_instance_finalize(Object *obj)
         iothread->main_loop = NULL;
     }
     qemu_sem_destroy(&iothread->init_done_sem);
+    qapi_free_uint16List(iothread->cpu_affinity);
+}
+
+/* Restrict the thread to iothread->cpu_affinity, if it is running */
+static bool iothread_apply_cpu_affinity(IOThread *iothread, Error **errp)
+{
+#ifdef CONFIG_LINUX
+    cpu_set_t cpus;
+    uint16List *cpu;
+
+    if (!iothread->cpu_affinity || iothread->thread_id == -1) {
+        return true;
+    }
+
+    CPU_ZERO(&cpus);
+    for (cpu = iothread->cpu_affinity; cpu; cpu = cpu->next) {
+        if (cpu->value >= CPU_SETSIZE) {
+            error_setg(errp, "host CPU %" PRIu16 " is out of range",
+                       cpu->value);
+            return false;
+        }
+        CPU_SET(cpu->value, &cpus);
+    }
+
+    if (sched_setaffinity(iothread->thread_id, sizeof(cpus), &cpus)) {
+        error_setg_errno(errp, errno, "failed to set the CPU affinity of %s",
+                         object_get_canonical_path_component(OBJECT(iothread)));
+        return false;
+    }
+    return true;
+#else
+    if (iothread->cpu_affinity) {
+        error_setg(errp, "cpu-affinity is not supported on this host");
+        return false;
+    }
+    return true;
+#endif
 }
 
 static void iothread_init_gcontext(IOThread *iothread)
@@ -190,6 +235,29 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
+    aio_context_set_io_uring_params(iothread->ctx,
+                                    iothread->io_uring_fixed,
+                                    iothread->io_uring_sqpoll,
+                                    iothread->io_uring_sqpoll_idle,
+                                    &local_error);
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
+    aio_context_set_thread_pool_params(iothread->ctx,
+                                       iothread->thread_pool_min,
+                                       iothread->thread_pool_max,
+                                       &local_error);
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     /* This assumes we are called from a thread with useful CPU affinity for us
      * to inherit.
      */
@@ -203,28 +271,34 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
     while (iothread->thread_id == -1) {
         qemu_sem_wait(&iothread->init_done_sem);
     }
+
+    if (!iothread_apply_cpu_affinity(iothread, errp)) {
+        iothread_stop(iothread);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+    }
 }
 
 typedef struct {
     const char *name;
     ptrdiff_t offset; /* field's byte offset in IOThread struct */
-} PollParamInfo;
+} IOThreadParamInfo;
 
-static PollParamInfo poll_max_ns_info = {
+static IOThreadParamInfo poll_max_ns_info = {
     "poll-max-ns", offsetof(IOThread, poll_max_ns),
 };
-static PollParamInfo poll_grow_info = {
+static IOThreadParamInfo poll_grow_info = {
     "poll-grow", offsetof(IOThread, poll_grow),
 };
-static PollParamInfo poll_shrink_info = {
+static IOThreadParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
 
-static void iothread_get_poll_param(Object *obj, Visitor *v,
+static void iothread_get_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
 {
     IOThread *iothread = IOTHREAD(obj);
-    PollParamInfo *info = opaque;
+    IOThreadParamInfo *info = opaque;
     int64_t *field = (void *)iothread + info->offset;
 
     visit_type_int64(v, name, field, errp);
@@ -234,7 +308,7 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
 {
     IOThread *iothread = IOTHREAD(obj);
-    PollParamInfo *info = opaque;
+    IOThreadParamInfo *info = opaque;
     int64_t *field = (void *)iothread + info->offset;
     int64_t value;
 
@@ -259,23 +333,168 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static IOThreadParamInfo thread_pool_min_info = {
+    "thread-pool-min", offsetof(IOThread, thread_pool_min),
+};
+static IOThreadParamInfo thread_pool_max_info = {
+    "thread-pool-max", offsetof(IOThread, thread_pool_max),
+};
+
+static void iothread_set_thread_pool_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    int64_t old_value = *field;
+    Error *local_err = NULL;
+    int64_t value;
+
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+
+    *field = value;
+
+    if (iothread->ctx) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            *field = old_value;
+        }
+    }
+}
+
+static void iothread_update_io_uring_params(IOThread *iothread, Error **errp)
+{
+    if (iothread->ctx) {
+        aio_context_set_io_uring_params(iothread->ctx,
+                                        iothread->io_uring_fixed,
+                                        iothread->io_uring_sqpoll,
+                                        iothread->io_uring_sqpoll_idle,
+                                        errp);
+    }
+}
+
+static bool iothread_get_io_uring_fixed(Object *obj, Error **errp)
+{
+    return IOTHREAD(obj)->io_uring_fixed;
+}
+
+static void iothread_set_io_uring_fixed(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->io_uring_fixed = value;
+    iothread_update_io_uring_params(iothread, errp);
+}
+
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    return IOTHREAD(obj)->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->io_uring_sqpoll = value;
+    iothread_update_io_uring_params(iothread, errp);
+}
+
+static void iothread_get_io_uring_sqpoll_idle(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_uint32(v, name, &iothread->io_uring_sqpoll_idle, errp);
+}
+
+static void iothread_set_io_uring_sqpoll_idle(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    iothread->io_uring_sqpoll_idle = value;
+    iothread_update_io_uring_params(iothread, errp);
+}
+
+static void iothread_get_cpu_affinity(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    uint16List *list = iothread->cpu_affinity;
+
+    visit_type_uint16List(v, name, &list, errp);
+}
+
+static void iothread_set_cpu_affinity(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    uint16List *old = iothread->cpu_affinity;
+    uint16List *value = NULL;
+
+    if (!visit_type_uint16List(v, name, &value, errp)) {
+        return;
+    }
+
+    iothread->cpu_affinity = value;
+    if (!iothread_apply_cpu_affinity(iothread, errp)) {
+        iothread->cpu_affinity = old;
+        qapi_free_uint16List(value);
+        return;
+    }
+    qapi_free_uint16List(old);
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
     ucc->complete = iothread_complete;
 
     object_class_property_add(klass, "poll-max-ns", "int",
-                              iothread_get_poll_param,
+                              iothread_get_param,
                               iothread_set_poll_param,
                               NULL, &poll_max_ns_info);
     object_class_property_add(klass, "poll-grow", "int",
-                              iothread_get_poll_param,
+                              iothread_get_param,
                               iothread_set_poll_param,
                               NULL, &poll_grow_info);
     object_class_property_add(klass, "poll-shrink", "int",
-                              iothread_get_poll_param,
+                              iothread_get_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add(klass, "thread-pool-min", "int",
+                              iothread_get_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_min_info);
+    object_class_property_add(klass, "thread-pool-max", "int",
+                              iothread_get_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_max_info);
+    object_class_property_add_bool(klass, "io-uring-fixed",
+                                   iothread_get_io_uring_fixed,
+                                   iothread_set_io_uring_fixed);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll);
+    object_class_property_add(klass, "io-uring-sqpoll-idle", "uint32",
+                              iothread_get_io_uring_sqpoll_idle,
+                              iothread_set_io_uring_sqpoll_idle,
+                              NULL, NULL);
+    object_class_property_add(klass, "cpu-affinity", "uint16List",
+                              iothread_get_cpu_affinity,
+                              iothread_set_cpu_affinity,
+                              NULL, NULL);
 }
 
 static const TypeInfo iothread_info = {
@@ -314,6 +533,7 @@ static int query_one_iothread(Object *object, void *opaque)
     IOThreadInfoList *elem;
     IOThreadInfo *info;
     IOThread *iothread;
+    ThreadPool *pool;
 
     iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
     if (!iothread) {
@@ -326,6 +546,25 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    aio_context_get_poll_stats(iothread->ctx, &info->poll_time_ns,
+                               &info->work_time_ns, &info->sleep_time_ns);
+    if (iothread->cpu_affinity) {
+        info->has_cpu_affinity = true;
+        info->cpu_affinity = QAPI_CLONE(uint16List, iothread->cpu_affinity);
+    }
+
+    info->thread_pool_min = iothread->thread_pool_min;
+    info->thread_pool_max = iothread->thread_pool_max;
+    /* Created on first use.  Pairs with qatomic_store_release() */
+    pool = qatomic_load_acquire(&iothread->ctx->thread_pool);
+    if (pool) {
+        ThreadPoolStats stats;
+
+        thread_pool_get_stats(pool, &stats);
+        info->thread_pool_threads = stats.cur_threads;
+        info->thread_pool_idle_threads = stats.idle_threads;
+        info->thread_pool_queued = stats.queued;
+    }
 
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
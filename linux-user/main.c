@@ -57,6 +57,8 @@ static envlist_t *envlist;
 static const char *cpu_model;
 static const char *cpu_type;
 static const char *seed_optarg;
+/* Translation buffer size in MiB, 0 for the default */
+static unsigned long tb_size;
 unsigned long mmap_min_addr;
 unsigned long guest_base;
 bool have_guest_base;
@@ -369,6 +371,13 @@ static void handle_arg_reserved_va(const char *arg)
     }
 }
 
+static void handle_arg_tb_size(const char *arg)
+{
+    if (qemu_strtoul(arg, NULL, 0, &tb_size) < 0 || tb_size == 0) {
+        usage(EXIT_FAILURE);
+    }
+}
+
 static void handle_arg_singlestep(const char *arg)
 {
     singlestep = 1;
@@ -450,6 +459,8 @@ static const struct qemu_argument arg_table[] = {
      "logfile",     "write logs to 'logfile' (default stderr)"},
     {"p",          "QEMU_PAGESIZE",    true,  handle_arg_pagesize,
      "pagesize",   "set the host page size to 'pagesize'"},
+    {"tb-size",    "QEMU_TB_SIZE",     true,  handle_arg_tb_size,
+     "size",       "set the translation buffer size to 'size' MiB"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
@@ -703,7 +714,7 @@ int main(int argc, char **argv, char **envp)
     cpu_type = parse_cpu_option(cpu_model);
 
     /* init tcg before creating CPUs and to get qemu_host_page_size */
-    tcg_exec_init(0);
+    tcg_exec_init(tb_size * MiB);
 
     cpu = cpu_create(cpu_type);
     env = cpu->env_ptr;
@@ -415,6 +415,27 @@ static void send_bitmap_complete(QEMUFile *f, DBMSaveState *s,
     send_bitmap_header(f, s, dbms, DIRTY_BITMAP_MIG_FLAG_COMPLETE);
 }
 
+static void send_bitmap_zeroes(QEMUFile *f, DBMSaveState *s,
+                               SaveBitmapState *dbms,
+                               uint64_t start_sector, uint32_t nr_sectors)
+{
+    uint32_t flags = DIRTY_BITMAP_MIG_FLAG_BITS | DIRTY_BITMAP_MIG_FLAG_ZEROES;
+
+    trace_send_bitmap_bits(flags, start_sector, nr_sectors, 0);
+
+    send_bitmap_header(f, s, dbms, flags);
+
+    qemu_put_be64(f, start_sector);
+    qemu_put_be32(f, nr_sectors);
+
+    /*
+     * if a block is zero we need to flush here since the network
+     * bandwidth is now a lot higher than the storage device bandwidth.
+     * thus if we queue zero blocks we slow down the migration.
+     */
+    qemu_fflush(f);
+}
+
 static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
                              SaveBitmapState *dbms,
                              uint64_t start_sector, uint32_t nr_sectors)
@@ -435,8 +456,8 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
 
     if (buffer_is_zero(buf, buf_size)) {
         g_free(buf);
-        buf = NULL;
-        flags |= DIRTY_BITMAP_MIG_FLAG_ZEROES;
+        send_bitmap_zeroes(f, s, dbms, start_sector, nr_sectors);
+        return;
     }
 
     trace_send_bitmap_bits(flags, start_sector, nr_sectors, buf_size);
@@ -445,16 +466,8 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
 
     qemu_put_be64(f, start_sector);
     qemu_put_be32(f, nr_sectors);
-
-    /* if a block is zero we need to flush here since the network
-     * bandwidth is now a lot higher than the storage device bandwidth.
-     * thus if we queue zero blocks we slow down the migration. */
-    if (flags & DIRTY_BITMAP_MIG_FLAG_ZEROES) {
-        qemu_fflush(f);
-    } else {
-        qemu_put_be64(f, buf_size);
-        qemu_put_buffer(f, buf, buf_size);
-    }
+    qemu_put_be64(f, buf_size);
+    qemu_put_buffer(f, buf, buf_size);
 
     g_free(buf);
 }
@@ -664,14 +677,38 @@ fail:
     return -1;
 }
 
-/* Called with no lock taken.  */
+/*
+ * Called with no lock taken.
+ *
+ * A run of clean chunks is sent as a single zero chunk, found through the
+ * upper levels of the bitmap without serializing it.  The run ends at a
+ * chunk boundary, so that it stays aligned to the serialization
+ * granularity for the destination.
+ */
 static void bulk_phase_send_chunk(QEMUFile *f, DBMSaveState *s,
                                   SaveBitmapState *dbms)
 {
-    uint32_t nr_sectors = MIN(dbms->total_sectors - dbms->cur_sector,
-                             dbms->sectors_per_chunk);
-
-    send_bitmap_bits(f, s, dbms, dbms->cur_sector, nr_sectors);
+    uint64_t remaining = dbms->total_sectors - dbms->cur_sector;
+    uint64_t nr_sectors = MIN(remaining, dbms->sectors_per_chunk);
+    int64_t next_dirty;
+
+    next_dirty = bdrv_dirty_bitmap_next_dirty(dbms->bitmap,
+                                              dbms->cur_sector <<
+                                              BDRV_SECTOR_BITS,
+                                              remaining << BDRV_SECTOR_BITS);
+    if (next_dirty < 0 ||
+        (next_dirty >> BDRV_SECTOR_BITS) >= dbms->cur_sector + nr_sectors) {
+        uint64_t max_sectors = QEMU_ALIGN_DOWN(UINT32_MAX,
+                                               dbms->sectors_per_chunk);
+        uint64_t end = next_dirty < 0 ? dbms->total_sectors :
+            QEMU_ALIGN_DOWN(next_dirty >> BDRV_SECTOR_BITS,
+                            dbms->sectors_per_chunk);
+
+        nr_sectors = MIN(end - dbms->cur_sector, max_sectors);
+        send_bitmap_zeroes(f, s, dbms, dbms->cur_sector, nr_sectors);
+    } else {
+        send_bitmap_bits(f, s, dbms, dbms->cur_sector, nr_sectors);
+    }
 
     dbms->cur_sector += nr_sectors;
     if (dbms->cur_sector >= dbms->total_sectors) {
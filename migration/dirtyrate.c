@@ -15,14 +15,22 @@
 #include "qapi/error.h"
 #include "cpu.h"
 #include "exec/ramblock.h"
+#include "exec/memory.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/cutils.h"
+#include "qemu/main-loop.h"
+#include "sysemu/kvm.h"
 #include "qapi/qapi-commands-migration.h"
+#include "qapi/qapi-visit-migration.h"
+#include "qapi/clone-visitor.h"
 #include "ram.h"
 #include "trace.h"
 #include "dirtyrate.h"
 
 static int CalculatingState = DIRTY_RATE_STATUS_UNSTARTED;
 static struct DirtyRateStat DirtyStat;
+/* Posted by cancel-dirty-rate to stop a continuous measurement */
+static QemuSemaphore dirtyrate_cancel_sem;
 
 static int64_t set_sample_page_period(int64_t msec, int64_t initial_time)
 {
@@ -62,9 +70,13 @@ static int dirtyrate_set_state(int *state, int old_state, int new_state)
 static struct DirtyRateInfo *query_dirty_rate_info(void)
 {
     int64_t dirty_rate = DirtyStat.dirty_rate;
+    int state = qatomic_read(&CalculatingState);
     struct DirtyRateInfo *info = g_malloc0(sizeof(DirtyRateInfo));
 
-    if (qatomic_read(&CalculatingState) == DIRTY_RATE_STATUS_MEASURED) {
+    /* A continuous measurement has results after its first period */
+    if (state == DIRTY_RATE_STATUS_MEASURED ||
+        (state == DIRTY_RATE_STATUS_MEASURING && DirtyStat.continuous &&
+         dirty_rate >= 0)) {
         info->has_dirty_rate = true;
         info->dirty_rate = dirty_rate;
     }
@@ -72,20 +84,45 @@ static struct DirtyRateInfo *query_dirty_rate_info(void)
     info->status = CalculatingState;
     info->start_time = DirtyStat.start_time;
     info->calc_time = DirtyStat.calc_time;
+    info->mode = DirtyStat.mode;
+
+    if (DirtyStat.continuous && DirtyStat.avg_dirty_rate >= 0) {
+        info->has_avg_dirty_rate = true;
+        info->avg_dirty_rate = DirtyStat.avg_dirty_rate;
+    }
+    /* Updated with the BQL held, like the QMP commands run */
+    if (DirtyStat.vcpu_dirty_rate) {
+        info->has_vcpu_dirty_rate = true;
+        info->vcpu_dirty_rate = QAPI_CLONE(DirtyRateVcpuList,
+                                           DirtyStat.vcpu_dirty_rate);
+    }
+    if (DirtyStat.block_dirty_rate) {
+        info->has_block_dirty_rate = true;
+        info->block_dirty_rate = QAPI_CLONE(DirtyRateBlockList,
+                                            DirtyStat.block_dirty_rate);
+    }
 
     trace_query_dirty_rate_info(DirtyRateStatus_str(CalculatingState));
 
     return info;
 }
 
-static void init_dirtyrate_stat(int64_t start_time, int64_t calc_time)
+static void init_dirtyrate_stat(int64_t start_time,
+                                struct DirtyRateConfig *config)
 {
     DirtyStat.total_dirty_samples = 0;
     DirtyStat.total_sample_count = 0;
     DirtyStat.total_block_mem_MB = 0;
     DirtyStat.dirty_rate = -1;
     DirtyStat.start_time = start_time;
-    DirtyStat.calc_time = calc_time;
+    DirtyStat.calc_time = config->sample_period_seconds;
+    DirtyStat.mode = config->mode;
+    DirtyStat.continuous = config->continuous;
+    DirtyStat.avg_dirty_rate = -1;
+    qapi_free_DirtyRateVcpuList(DirtyStat.vcpu_dirty_rate);
+    DirtyStat.vcpu_dirty_rate = NULL;
+    qapi_free_DirtyRateBlockList(DirtyStat.block_dirty_rate);
+    DirtyStat.block_dirty_rate = NULL;
 }
 
 static void update_dirtyrate_stat(struct RamblockDirtyInfo *info)
@@ -355,12 +392,221 @@ out:
     rcu_unregister_thread();
 }
 
+static GArray *dirty_ring_count_vcpus(void)
+{
+    GArray *counts = g_array_new(false, true, sizeof(struct DirtyRingCount));
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        struct DirtyRingCount count = {
+            .cpu_index = cpu->cpu_index,
+            .pages = qatomic_read_u64(&cpu->dirty_pages),
+        };
+
+        g_array_append_val(counts, count);
+    }
+    return counts;
+}
+
+static GArray *dirty_ring_count_blocks(void)
+{
+    GArray *counts = g_array_new(false, true, sizeof(struct DirtyRingCount));
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        struct DirtyRingCount count = {
+            .cpu_index = -1,
+            .pages = qatomic_read_u64(&block->dirty_ring_pages),
+        };
+
+        pstrcpy(count.idstr, sizeof(count.idstr), qemu_ram_get_idstr(block));
+        g_array_append_val(counts, count);
+    }
+    return counts;
+}
+
+/*
+ * Pages dirtied during the period by the vCPU or RAMBlock of @count; the
+ * ones that appeared during the period are only measured from the next.
+ */
+static uint64_t dirty_ring_period_pages(GArray *prev,
+                                        struct DirtyRingCount *count)
+{
+    int i;
+
+    for (i = 0; i < prev->len; i++) {
+        struct DirtyRingCount *p = &g_array_index(prev, struct DirtyRingCount,
+                                                  i);
+
+        if (p->cpu_index == count->cpu_index &&
+            !strcmp(p->idstr, count->idstr)) {
+            return count->pages - p->pages;
+        }
+    }
+    return 0;
+}
+
+/* Dirty rate in MB/s of @pages dirtied in @msec */
+static int64_t dirty_ring_rate(uint64_t pages, int64_t msec)
+{
+    return (pages * TARGET_PAGE_SIZE * 1000 / msec) >> 20;
+}
+
+/* Fold @rate in the moving average @avg, or start it if @avg is -1 */
+static int64_t dirtyrate_avg(int64_t avg, int64_t rate)
+{
+    if (avg < 0) {
+        return rate;
+    }
+    return (avg * (DIRTYRATE_AVG_WEIGHT - 1) + rate) / DIRTYRATE_AVG_WEIGHT;
+}
+
+static int64_t find_vcpu_avg(int64_t id)
+{
+    DirtyRateVcpuList *entry;
+
+    for (entry = DirtyStat.vcpu_dirty_rate; entry; entry = entry->next) {
+        if (entry->value->id == id) {
+            return entry->value->avg_dirty_rate;
+        }
+    }
+    return -1;
+}
+
+static int64_t find_block_avg(const char *id)
+{
+    DirtyRateBlockList *entry;
+
+    for (entry = DirtyStat.block_dirty_rate; entry; entry = entry->next) {
+        if (!strcmp(entry->value->id, id)) {
+            return entry->value->avg_dirty_rate;
+        }
+    }
+    return -1;
+}
+
+/* Called with the BQL held, which protects the lists of DirtyStat */
+static void update_dirtyrate_dirty_ring(GArray *prev_vcpus, GArray *vcpus,
+                                        GArray *prev_blocks, GArray *blocks,
+                                        int64_t msec)
+{
+    DirtyRateVcpuList *vcpu_list = NULL, **vcpu_tail = &vcpu_list;
+    DirtyRateBlockList *block_list = NULL, **block_tail = &block_list;
+    uint64_t total_pages = 0;
+    int i;
+
+    for (i = 0; i < vcpus->len; i++) {
+        struct DirtyRingCount *count = &g_array_index(vcpus,
+                                                      struct DirtyRingCount,
+                                                      i);
+        uint64_t pages = dirty_ring_period_pages(prev_vcpus, count);
+        DirtyRateVcpuList *entry = g_new0(DirtyRateVcpuList, 1);
+
+        entry->value = g_new0(DirtyRateVcpu, 1);
+        entry->value->id = count->cpu_index;
+        entry->value->dirty_rate = dirty_ring_rate(pages, msec);
+        entry->value->avg_dirty_rate =
+            dirtyrate_avg(find_vcpu_avg(count->cpu_index),
+                          entry->value->dirty_rate);
+        *vcpu_tail = entry;
+        vcpu_tail = &entry->next;
+        total_pages += pages;
+    }
+
+    for (i = 0; i < blocks->len; i++) {
+        struct DirtyRingCount *count = &g_array_index(blocks,
+                                                      struct DirtyRingCount,
+                                                      i);
+        uint64_t pages = dirty_ring_period_pages(prev_blocks, count);
+        DirtyRateBlockList *entry = g_new0(DirtyRateBlockList, 1);
+
+        entry->value = g_new0(DirtyRateBlock, 1);
+        entry->value->id = g_strdup(count->idstr);
+        entry->value->dirty_rate = dirty_ring_rate(pages, msec);
+        entry->value->avg_dirty_rate =
+            dirtyrate_avg(find_block_avg(count->idstr),
+                          entry->value->dirty_rate);
+        *block_tail = entry;
+        block_tail = &entry->next;
+    }
+
+    qapi_free_DirtyRateVcpuList(DirtyStat.vcpu_dirty_rate);
+    DirtyStat.vcpu_dirty_rate = vcpu_list;
+    qapi_free_DirtyRateBlockList(DirtyStat.block_dirty_rate);
+    DirtyStat.block_dirty_rate = block_list;
+
+    DirtyStat.dirty_rate = dirty_ring_rate(total_pages, msec);
+    DirtyStat.avg_dirty_rate = dirtyrate_avg(DirtyStat.avg_dirty_rate,
+                                             DirtyStat.dirty_rate);
+    trace_dirtyrate_dirty_ring(total_pages, msec, DirtyStat.dirty_rate);
+}
+
+/*
+ * Count the pages that each vCPU pushes to its dirty ring, and that land
+ * in each RAMBlock.  The rings only get pages while dirty logging is on.
+ */
+static void calculate_dirtyrate_dirty_ring(struct DirtyRateConfig config)
+{
+    GArray *prev_vcpus, *prev_blocks, *vcpus, *blocks;
+    int64_t initial_time, current_time;
+
+    rcu_register_thread();
+
+    /* Forget a cancel that came after the last measurement ended */
+    while (!qemu_sem_timedwait(&dirtyrate_cancel_sem, 0)) {
+        /* nothing */
+    }
+
+    qemu_mutex_lock_iothread();
+    memory_global_dirty_log_start();
+    WITH_RCU_READ_LOCK_GUARD() {
+        prev_vcpus = dirty_ring_count_vcpus();
+        prev_blocks = dirty_ring_count_blocks();
+    }
+    qemu_mutex_unlock_iothread();
+    initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+
+    while (qemu_sem_timedwait(&dirtyrate_cancel_sem,
+                              config.sample_period_seconds * 1000)) {
+        qemu_mutex_lock_iothread();
+        /* Collect what the rings hold so far */
+        memory_global_dirty_log_sync();
+        WITH_RCU_READ_LOCK_GUARD() {
+            vcpus = dirty_ring_count_vcpus();
+            blocks = dirty_ring_count_blocks();
+        }
+        current_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        DirtyStat.start_time = initial_time / 1000;
+        DirtyStat.calc_time = (current_time - initial_time) / 1000;
+        update_dirtyrate_dirty_ring(prev_vcpus, vcpus, prev_blocks, blocks,
+                                    MAX(current_time - initial_time, 1));
+        qemu_mutex_unlock_iothread();
+
+        g_array_free(prev_vcpus, true);
+        g_array_free(prev_blocks, true);
+        prev_vcpus = vcpus;
+        prev_blocks = blocks;
+        initial_time = current_time;
+
+        if (!config.continuous) {
+            break;
+        }
+    }
+
+    qemu_mutex_lock_iothread();
+    memory_global_dirty_log_stop();
+    qemu_mutex_unlock_iothread();
+
+    g_array_free(prev_vcpus, true);
+    g_array_free(prev_blocks, true);
+    rcu_unregister_thread();
+}
+
 void *get_dirtyrate_thread(void *arg)
 {
     struct DirtyRateConfig config = *(struct DirtyRateConfig *)arg;
     int ret;
     int64_t start_time;
-    int64_t calc_time;
 
     ret = dirtyrate_set_state(&CalculatingState, DIRTY_RATE_STATUS_UNSTARTED,
                               DIRTY_RATE_STATUS_MEASURING);
@@ -370,10 +616,15 @@ void *get_dirtyrate_thread(void *arg)
     }
 
     start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) / 1000;
-    calc_time = config.sample_period_seconds;
-    init_dirtyrate_stat(start_time, calc_time);
+    qemu_mutex_lock_iothread();
+    init_dirtyrate_stat(start_time, &config);
+    qemu_mutex_unlock_iothread();
 
-    calculate_dirtyrate(config);
+    if (config.mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING) {
+        calculate_dirtyrate_dirty_ring(config);
+    } else {
+        calculate_dirtyrate(config);
+    }
 
     ret = dirtyrate_set_state(&CalculatingState, DIRTY_RATE_STATUS_MEASURING,
                               DIRTY_RATE_STATUS_MEASURED);
@@ -383,9 +634,13 @@ void *get_dirtyrate_thread(void *arg)
     return NULL;
 }
 
-void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
+void qmp_calc_dirty_rate(int64_t calc_time,
+                         bool has_mode, DirtyRateMeasureMode mode,
+                         bool has_continuous, bool continuous,
+                         Error **errp)
 {
     static struct DirtyRateConfig config;
+    static bool cancel_sem_initialized;
     QemuThread thread;
     int ret;
 
@@ -394,6 +649,9 @@ void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
      */
     if (qatomic_read(&CalculatingState) == DIRTY_RATE_STATUS_MEASURING) {
         error_setg(errp, "the dirty rate is already being measured.");
+        if (DirtyStat.continuous) {
+            error_append_hint(errp, "Stop it with cancel-dirty-rate.\n");
+        }
         return;
     }
 
@@ -404,6 +662,25 @@ void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
         return;
     }
 
+    if (!has_mode) {
+        mode = DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING;
+    }
+    if (mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING &&
+        !kvm_dirty_ring_enabled()) {
+        error_setg(errp, "dirty-ring mode needs the KVM dirty ring.");
+        return;
+    }
+    continuous = has_continuous && continuous;
+    if (continuous && mode != DIRTY_RATE_MEASURE_MODE_DIRTY_RING) {
+        error_setg(errp, "continuous measurement needs dirty-ring mode.");
+        return;
+    }
+
+    if (!cancel_sem_initialized) {
+        qemu_sem_init(&dirtyrate_cancel_sem, 0);
+        cancel_sem_initialized = true;
+    }
+
     /*
      * Init calculation state as unstarted.
      */
@@ -416,10 +693,22 @@ void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
 
     config.sample_period_seconds = calc_time;
     config.sample_pages_per_gigabytes = DIRTYRATE_DEFAULT_SAMPLE_PAGES;
+    config.mode = mode;
+    config.continuous = continuous;
     qemu_thread_create(&thread, "get_dirtyrate", get_dirtyrate_thread,
                        (void *)&config, QEMU_THREAD_DETACHED);
 }
 
+void qmp_cancel_dirty_rate(Error **errp)
+{
+    if (qatomic_read(&CalculatingState) != DIRTY_RATE_STATUS_MEASURING ||
+        !DirtyStat.continuous) {
+        error_setg(errp, "no continuous dirty rate measurement is running.");
+        return;
+    }
+    qemu_sem_post(&dirtyrate_cancel_sem);
+}
+
 struct DirtyRateInfo *qmp_query_dirty_rate(Error **errp)
 {
     return query_dirty_rate_info();
@@ -13,6 +13,8 @@
 #ifndef QEMU_MIGRATION_DIRTYRATE_H
 #define QEMU_MIGRATION_DIRTYRATE_H
 
+#include "qapi/qapi-types-migration.h"
+
 /*
  * Sample 512 pages per GB as default.
  * TODO: Make it configurable.
@@ -35,9 +37,26 @@
 #define MIN_FETCH_DIRTYRATE_TIME_SEC              1
 #define MAX_FETCH_DIRTYRATE_TIME_SEC              60
 
+/*
+ * Each period of a continuous measurement weighs 1/DIRTYRATE_AVG_WEIGHT
+ * in the moving averages.
+ */
+#define DIRTYRATE_AVG_WEIGHT                      4
+
 struct DirtyRateConfig {
     uint64_t sample_pages_per_gigabytes; /* sample pages per GB */
     int64_t sample_period_seconds; /* time duration between two sampling */
+    DirtyRateMeasureMode mode; /* how the dirty rate is measured */
+    bool continuous; /* measure until cancelled */
+};
+
+/*
+ * Pages collected so far from the dirty rings, for a vCPU or a RAMBlock.
+ */
+struct DirtyRingCount {
+    int64_t cpu_index; /* index of the vCPU, -1 for a RAMBlock */
+    char idstr[RAMBLOCK_INFO_MAX_LEN]; /* idstr of the RAMBlock */
+    uint64_t pages; /* pages collected from the dirty rings */
 };
 
 /*
@@ -63,6 +82,11 @@ struct DirtyRateStat {
     int64_t dirty_rate; /* dirty rate in MB/s */
     int64_t start_time; /* calculation start time in units of second */
     int64_t calc_time; /* time duration of two sampling in units of second */
+    DirtyRateMeasureMode mode; /* how the dirty rate is measured */
+    bool continuous; /* measure until cancelled */
+    int64_t avg_dirty_rate; /* moving average in MB/s, -1 if none yet */
+    DirtyRateVcpuList *vcpu_dirty_rate; /* dirty rate of each vCPU */
+    DirtyRateBlockList *block_dirty_rate; /* dirty rate of each RAMBlock */
 };
 
 void *get_dirtyrate_thread(void *arg);
@@ -0,0 +1,272 @@
+/*
+ * QEMU live migration to and from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qapi/error.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "io/channel-file.h"
+#include "channel.h"
+#include "migration.h"
+#include "file.h"
+#include "trace.h"
+
+static struct FileOutgoingArgs {
+    char *fname;
+} outgoing_args;
+
+static struct FileIncomingArgs {
+    char *fname;
+} incoming_args;
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_outgoing(filename);
+    fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY | O_TRUNC,
+                                     0600, errp);
+    if (!fioc) {
+        return;
+    }
+
+    g_free(outgoing_args.fname);
+    outgoing_args.fname = g_strdup(filename);
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-outgoing");
+    migration_channel_connect(s, QIO_CHANNEL(fioc), NULL, NULL);
+    object_unref(OBJECT(fioc));
+}
+
+static gboolean file_accept_incoming_migration(QIOChannel *ioc,
+                                               GIOCondition condition,
+                                               gpointer opaque)
+{
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+    return G_SOURCE_REMOVE;
+}
+
+void file_start_incoming_migration(const char *filename, Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_incoming(filename);
+    fioc = qio_channel_file_new_path(filename, O_RDONLY, 0, errp);
+    if (!fioc) {
+        return;
+    }
+
+    g_free(incoming_args.fname);
+    incoming_args.fname = g_strdup(filename);
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-incoming");
+    qio_channel_add_watch_full(QIO_CHANNEL(fioc), G_IO_IN,
+                               file_accept_incoming_migration,
+                               NULL, NULL,
+                               g_main_context_get_thread_default());
+}
+
+/*
+ * Open another channel on the file of the outgoing migration, for a
+ * multifd send thread.  @f is called right away.
+ */
+void file_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelFile *fioc;
+    QIOTask *task;
+    Error *err = NULL;
+
+    fioc = qio_channel_file_new_path(outgoing_args.fname, O_WRONLY, 0, &err);
+    task = qio_task_new(OBJECT(fioc), f, data, NULL);
+    if (!fioc) {
+        qio_task_set_error(task, err);
+    } else {
+        qio_channel_set_name(QIO_CHANNEL(fioc), "multifd-file-outgoing");
+    }
+    qio_task_complete(task);
+}
+
+static int file_pwrite_all(int fd, const uint8_t *buf, size_t len,
+                           off_t offset, Error **errp)
+{
+    while (len) {
+        ssize_t ret = pwrite(fd, buf, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno, "Unable to write to migration file");
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+static int file_pread_all(int fd, uint8_t *buf, size_t len, off_t offset,
+                          Error **errp)
+{
+    while (len) {
+        ssize_t ret = pread(fd, buf, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno, "Unable to read migration file");
+            return -1;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Migration file is truncated");
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+/**
+ * file_write_ramblock_iov: write pages to their place in the file
+ *
+ * With mapped-ram each page of @block has a fixed offset in the file,
+ * starting at block->pages_offset.  Pages that follow each other in the
+ * block are written with a single call, and all of them are marked in
+ * the file bitmap of the block.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @ioc: file channel of the outgoing migration
+ * @block: block that contains the pages
+ * @offset: offset of each page in the block
+ * @iov: host address and size of each page
+ * @num: number of pages
+ * @errp: pointer to an error
+ */
+int file_write_ramblock_iov(QIOChannel *ioc, RAMBlock *block,
+                            const ram_addr_t *offset, struct iovec *iov,
+                            uint32_t num, Error **errp)
+{
+    int fd = QIO_CHANNEL_FILE(ioc)->fd;
+    int page_bits = qemu_target_page_bits();
+    uint32_t i, j;
+
+    for (i = 0; i < num; i = j) {
+        size_t len = iov[i].iov_len;
+
+        for (j = i + 1; j < num && offset[j] == offset[i] + len; j++) {
+            len += iov[j].iov_len;
+        }
+        trace_file_write_ramblock(block->idstr, offset[i], len);
+        if (file_pwrite_all(fd, iov[i].iov_base, len,
+                            block->pages_offset + offset[i], errp) < 0) {
+            return -1;
+        }
+        for (; i < j; i++) {
+            set_bit_atomic(offset[i] >> page_bits, block->file_bmap);
+        }
+    }
+    return 0;
+}
+
+typedef struct FileReadThread {
+    QemuThread thread;
+    int fd;
+    RAMBlock *block;
+    const unsigned long *bitmap;
+    unsigned long start;
+    unsigned long end;
+    Error *err;
+} FileReadThread;
+
+static void *file_read_ramblock_thread(void *opaque)
+{
+    FileReadThread *t = opaque;
+    size_t page_size = qemu_target_page_size();
+    unsigned long first, last;
+
+    first = find_next_bit(t->bitmap, t->end, t->start);
+    while (first < t->end) {
+        last = find_next_zero_bit(t->bitmap, t->end, first);
+        if (file_pread_all(t->fd, t->block->host + first * page_size,
+                           (last - first) * page_size,
+                           t->block->pages_offset + first * page_size,
+                           &t->err) < 0) {
+            break;
+        }
+        first = find_next_bit(t->bitmap, t->end, last);
+    }
+    return NULL;
+}
+
+/**
+ * file_read_ramblock: load the pages of a block saved with mapped-ram
+ *
+ * Read the pages marked in @bitmap from the file of the incoming
+ * migration straight into guest memory.  The block is split in as many
+ * ranges as there are multifd channels, each read by its own thread.
+ * Pages that are not marked were zero, and are left untouched.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @block: block to load; block->pages_offset must be set
+ * @bitmap: pages present in the file
+ * @errp: pointer to an error
+ */
+int file_read_ramblock(RAMBlock *block, const unsigned long *bitmap,
+                       Error **errp)
+{
+    unsigned long num_pages = block->used_length >> qemu_target_page_bits();
+    int nthreads = migrate_multifd_channels();
+    g_autofree FileReadThread *threads = NULL;
+    unsigned long chunk;
+    QIOChannelFile *fioc;
+    int ret = 0;
+    int i;
+
+    fioc = qio_channel_file_new_path(incoming_args.fname, O_RDONLY, 0, errp);
+    if (!fioc) {
+        return -1;
+    }
+
+    trace_file_read_ramblock(block->idstr, num_pages, nthreads);
+    threads = g_new0(FileReadThread, nthreads);
+    /* Keep the ranges on bitmap word boundaries */
+    chunk = ROUND_UP(DIV_ROUND_UP(num_pages, nthreads), BITS_PER_LONG);
+    for (i = 0; i < nthreads; i++) {
+        FileReadThread *t = &threads[i];
+
+        t->fd = fioc->fd;
+        t->block = block;
+        t->bitmap = bitmap;
+        t->start = MIN(i * chunk, num_pages);
+        t->end = MIN(t->start + chunk, num_pages);
+        qemu_thread_create(&t->thread, "file-read", file_read_ramblock_thread,
+                           t, QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nthreads; i++) {
+        qemu_thread_join(&threads[i].thread);
+        if (threads[i].err) {
+            if (!ret) {
+                error_propagate(errp, threads[i].err);
+                ret = -1;
+            } else {
+                error_free(threads[i].err);
+            }
+        }
+    }
+
+    object_unref(OBJECT(fioc));
+    return ret;
+}
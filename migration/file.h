@@ -0,0 +1,26 @@
+/*
+ * QEMU live migration to and from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_FILE_H
+#define QEMU_MIGRATION_FILE_H
+
+#include "io/task.h"
+
+void file_start_incoming_migration(const char *filename, Error **errp);
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp);
+
+void file_send_channel_create(QIOTaskFunc f, void *data);
+
+int file_write_ramblock_iov(QIOChannel *ioc, RAMBlock *block,
+                            const ram_addr_t *offset, struct iovec *iov,
+                            uint32_t num, Error **errp);
+
+int file_read_ramblock(RAMBlock *block, const unsigned long *bitmap,
+                       Error **errp);
+#endif
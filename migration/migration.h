@@ -20,6 +20,7 @@
 #include "qemu/thread.h"
 #include "qemu/coroutine_int.h"
 #include "io/channel.h"
+#include "io/channel-buffer.h"
 #include "net/announce.h"
 #include "qom/object.h"
 
@@ -44,6 +45,13 @@ struct PostcopyBlocktimeContext;
  */
 #define CLEAR_BITMAP_SHIFT_MAX            31
 
+/* Channels that can carry RAM pages to the destination */
+enum {
+    RAM_CHANNEL_PRECOPY = 0,
+    RAM_CHANNEL_POSTCOPY = 1,
+    RAM_CHANNEL_MAX,
+};
+
 /* State for the incoming migration */
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
@@ -78,6 +86,8 @@ struct MigrationIncomingState {
     RAMBlock *last_rb;
     void     *postcopy_tmp_page;
     void     *postcopy_tmp_zero_page;
+    /* Temporary page of the postcopy preempt channel */
+    void     *postcopy_preempt_tmp_page;
     /* PostCopyFD's for external userfaultfds & handlers of shared memory */
     GArray   *postcopy_remote_fds;
 
@@ -121,6 +131,21 @@ struct MigrationIncomingState {
      * contains valid information.
      */
     QemuMutex page_request_mutex;
+
+    /* Channel carrying the pages requested by the fault thread */
+    QEMUFile *postcopy_qemufile_dst;
+    bool have_preempt_thread;
+    QemuThread postcopy_preempt_thread;
+    /* Set this when we want the preempt thread to quit */
+    bool postcopy_preempt_quit;
+    /*
+     * Set once userfaultfd is armed and postcopy pages can be placed, or
+     * when the incoming migration is torn down.
+     */
+    QemuEvent postcopy_listen_event;
+
+    /* Last RAMBlock received on each channel, for RAM_SAVE_FLAG_CONTINUE */
+    RAMBlock *last_recv_block[RAM_CHANNEL_MAX];
 };
 
 MigrationIncomingState *migration_incoming_get_current(void);
@@ -280,6 +305,19 @@ struct MigrationState {
      * This save hostname when out-going migration starts
      */
     char *hostname;
+
+    /* Channel for the pages requested by the destination during postcopy */
+    QEMUFile *postcopy_qemufile_src;
+    /* Set once the connection of postcopy_qemufile_src is done */
+    QemuEvent postcopy_qemufile_src_event;
+
+    /*
+     * Background snapshot: device state saved when the snapshot started,
+     * written to the stream after RAM
+     */
+    QIOChannelBuffer *bioc;
+    /* Restarts the VM from the main loop once RAM is write-protected */
+    QEMUBH *vm_start_bh;
 };
 
 void migrate_set_state(int *state, int old_state, int new_state);
@@ -310,6 +348,13 @@ bool migrate_postcopy(void);
 
 bool migrate_release_ram(void);
 bool migrate_postcopy_ram(void);
+bool migrate_postcopy_preempt(void);
+bool migrate_background_snapshot(void);
+bool migrate_parallel_device_state(void);
+bool migrate_mapped_ram(void);
+bool migrate_per_vcpu_throttle(void);
+bool migrate_tls_offload(void);
+bool migrate_zero_copy_send(void);
 bool migrate_zero_blocks(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_ignore_shared(void);
@@ -317,11 +362,13 @@ bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
+bool migrate_use_multifd_zero_page(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
 int migrate_multifd_zlib_level(void);
 int migrate_multifd_zstd_level(void);
+int migrate_device_state_threads(void);
 
 int migrate_use_xbzrle(void);
 int64_t migrate_xbzrle_cache_size(void);
@@ -0,0 +1,278 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/rcu.h"
+#include "qemu/bswap.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Pages are compressed one by one, so that a page never depends on the
+ * contents of another.  Each of them is sent as a big endian 32 bit
+ * compressed size followed by the compressed data.
+ */
+#define LZ4_PAGE_HEADER_SIZE sizeof(uint32_t)
+
+struct lz4_data {
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+/* Multifd lz4 compression */
+
+/**
+ * lz4_zbuff_len: size of the compressed buffer
+ *
+ * Returns the worst case size of a packet once compressed.
+ */
+static uint32_t lz4_zbuff_len(void)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+
+    return page_count * (LZ4_PAGE_HEADER_SIZE +
+                         LZ4_compressBound(qemu_target_page_size()));
+}
+
+/**
+ * lz4_setup: allocate the compressed buffer for a channel
+ *
+ * Returns the per channel data, or NULL on error
+ *
+ * @id: channel number
+ * @errp: pointer to an error
+ */
+static struct lz4_data *lz4_setup(uint8_t id, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->zbuff_len = lz4_zbuff_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", id);
+        return NULL;
+    }
+    return z;
+}
+
+static void lz4_cleanup(void **data)
+{
+    struct lz4_data *z = *data;
+
+    g_free(z->zbuff);
+    g_free(z);
+    *data = NULL;
+}
+
+/**
+ * lz4_send_setup: setup send side
+ *
+ * Setup each channel with lz4 compression.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    p->data = lz4_setup(p->id, errp);
+    return p->data ? 0 : -1;
+}
+
+/**
+ * lz4_send_cleanup: cleanup send side
+ *
+ * Return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    lz4_cleanup(&p->data);
+}
+
+/**
+ * lz4_send_prepare: prepare date to be able to send
+ *
+ * Create a compressed buffer with all the pages that we are going to
+ * send.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ */
+static int lz4_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    struct lz4_data *z = p->data;
+    uint32_t out_size = 0;
+    uint32_t i;
+
+    for (i = 0; i < used; i++) {
+        uint8_t *out = z->zbuff + out_size + LZ4_PAGE_HEADER_SIZE;
+        int available = z->zbuff_len - out_size - LZ4_PAGE_HEADER_SIZE;
+        int ret;
+
+        ret = LZ4_compress_default(iov[i].iov_base, (char *)out,
+                                   iov[i].iov_len, available);
+        if (ret <= 0) {
+            error_setg(errp, "multifd %d: LZ4_compress_default failed",
+                       p->id);
+            return -1;
+        }
+        stl_be_p(z->zbuff + out_size, ret);
+        out_size += LZ4_PAGE_HEADER_SIZE + ret;
+    }
+    p->next_packet_size = out_size;
+    p->flags |= MULTIFD_FLAG_LZ4;
+
+    return 0;
+}
+
+/**
+ * lz4_send_write: do the actual write of the data
+ *
+ * Do the actual write of the comprresed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int lz4_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct lz4_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+/**
+ * lz4_recv_setup: setup receive side
+ *
+ * Create the compressed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    p->data = lz4_setup(p->id, errp);
+    return p->data ? 0 : -1;
+}
+
+/**
+ * lz4_recv_cleanup: cleanup receive side
+ *
+ * Return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    lz4_cleanup(&p->data);
+}
+
+/**
+ * lz4_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, and uncompress it into the actual
+ * pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int lz4_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct lz4_data *z = p->data;
+    uint32_t pos = 0;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet size received %u is bigger "
+                   "than buffer %u", p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        uint32_t len;
+
+        if (in_size - pos < LZ4_PAGE_HEADER_SIZE) {
+            error_setg(errp, "multifd %d: packet truncated at page %u",
+                       p->id, i);
+            return -1;
+        }
+        len = ldl_be_p(z->zbuff + pos);
+        pos += LZ4_PAGE_HEADER_SIZE;
+        if (len > in_size - pos) {
+            error_setg(errp, "multifd %d: packet truncated at page %u",
+                       p->id, i);
+            return -1;
+        }
+
+        ret = LZ4_decompress_safe((const char *)z->zbuff + pos,
+                                  iov->iov_base, len, iov->iov_len);
+        if (ret != iov->iov_len) {
+            error_setg(errp, "multifd %d: LZ4_decompress_safe returned %d "
+                       "size expected %zu", p->id, ret, iov->iov_len);
+            return -1;
+        }
+        pos += len;
+    }
+    if (pos != in_size) {
+        error_setg(errp, "multifd %d: packet size received %u size used %u",
+                   p->id, in_size, pos);
+        return -1;
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_lz4_ops = {
+    .send_setup = lz4_send_setup,
+    .send_cleanup = lz4_send_cleanup,
+    .send_prepare = lz4_send_prepare,
+    .send_write = lz4_send_write,
+    .recv_setup = lz4_recv_setup,
+    .recv_cleanup = lz4_recv_cleanup,
+    .recv_pages = lz4_recv_pages
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
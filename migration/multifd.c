@@ -12,14 +12,19 @@
 
 #include "qemu/osdep.h"
 #include "qemu/rcu.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
+#include "io/channel-socket.h"
 #include "ram.h"
 #include "migration.h"
+#include "postcopy-ram.h"
 #include "socket.h"
+#include "file.h"
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
@@ -91,7 +96,9 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
 /**
  * nocomp_send_write: do the actual write of the data
  *
- * For no compression we just have to write the data.
+ * For no compression we just have to write the data.  With zero-copy
+ * send the kernel transmits straight from guest memory; completions
+ * are collected here as they come, and waited for at each sync.
  *
  * Returns 0 for success or -1 for error
  *
@@ -101,6 +108,15 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
  */
 static int nocomp_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
+    if (migrate_zero_copy_send()) {
+        QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(p->c);
+
+        if (qio_channel_socket_writev_zero_copy_all(sioc, p->pages->iov,
+                                                    used, errp) < 0) {
+            return -1;
+        }
+        return qio_channel_socket_zero_copy_reap(sioc, errp);
+    }
     return qio_channel_writev_all(p->c, p->pages->iov, used, errp);
 }
 
@@ -163,6 +179,36 @@ static MultiFDMethods multifd_nocomp_ops = {
     .recv_pages = nocomp_recv_pages
 };
 
+/* Multifd with mapped-ram: no packets, pages go to their place in the file */
+
+/**
+ * mapped_ram_send_write: do the actual write of the data
+ *
+ * Write each page at its offset in the migration file.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int mapped_ram_send_write(MultiFDSendParams *p, uint32_t used,
+                                 Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+
+    return file_write_ramblock_iov(p->c, pages->block, pages->offset,
+                                   pages->iov, used, errp);
+}
+
+/* The destination reads the file directly, it has no receive side */
+static MultiFDMethods multifd_mapped_ram_ops = {
+    .send_setup = nocomp_send_setup,
+    .send_cleanup = nocomp_send_cleanup,
+    .send_prepare = nocomp_send_prepare,
+    .send_write = mapped_ram_send_write,
+};
+
 static MultiFDMethods *multifd_ops[MULTIFD_COMPRESSION__MAX] = {
     [MULTIFD_COMPRESSION_NONE] = &multifd_nocomp_ops,
 };
@@ -173,6 +219,74 @@ void multifd_register_ops(int method, MultiFDMethods *ops)
     multifd_ops[method] = ops;
 }
 
+/*
+ * Hardware compressors (e.g. QAT or IAA) produce the same stream as the
+ * software implementation of the method, so each side of the migration
+ * decides on its own whether the device is used.
+ */
+static MultiFDMethods *multifd_accel_ops[MULTIFD_COMPRESSION__MAX];
+
+void multifd_register_accel_ops(int method, MultiFDMethods *ops)
+{
+    assert(0 < method && method < MULTIFD_COMPRESSION__MAX);
+    assert(ops->name && ops->is_available);
+    multifd_accel_ops[method] = ops;
+}
+
+static MultiFDMethods *multifd_get_ops(MultiFDCompression method)
+{
+    MultiFDMethods *ops = multifd_accel_ops[method];
+
+    if (ops && ops->is_available()) {
+        trace_multifd_accel_ops(MultiFDCompression_str(method), ops->name);
+        return ops;
+    }
+    return multifd_ops[method];
+}
+
+/* Only one source migration at a time, kept around after it finishes */
+static MultiFDSendStats *multifd_send_stats;
+static int multifd_send_stats_count;
+
+static int64_t multifd_thread_cpu_ns(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec;
+    }
+#endif
+    return get_clock();
+}
+
+MultiFDChannelStatsList *multifd_query_send_stats(void)
+{
+    MultiFDChannelStatsList *head = NULL;
+    int i;
+
+    for (i = multifd_send_stats_count - 1; i >= 0; i--) {
+        MultiFDSendStats *stats = &multifd_send_stats[i];
+        MultiFDChannelStatsList *entry = g_new0(MultiFDChannelStatsList, 1);
+        MultiFDChannelStats *info = g_new0(MultiFDChannelStats, 1);
+
+        info->id = i;
+        info->packets = stats->packets;
+        info->pages = stats->pages;
+        info->raw_bytes = stats->raw_bytes;
+        info->compressed_bytes = stats->compressed_bytes;
+        if (stats->compressed_bytes) {
+            info->compression_rate = (double)stats->raw_bytes /
+                                     stats->compressed_bytes;
+        }
+        info->compress_time = stats->prepare_time_ns / SCALE_US;
+        entry->value = info;
+        entry->next = head;
+        head = entry;
+    }
+    return head;
+}
+
 static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
 {
     MultiFDInit_t msg = {};
@@ -267,6 +381,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->pages_used = cpu_to_be32(p->pages->used);
+    packet->zero_pages = cpu_to_be32(p->pages->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -274,7 +389,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
         strncpy(packet->ramblock, p->pages->block->idstr, 256);
     }
 
-    for (i = 0; i < p->pages->used; i++) {
+    for (i = 0; i < p->pages->used + p->pages->zero_num; i++) {
         /* there are architectures where ram_addr_t is 32 bit */
         uint64_t temp = p->pages->offset[i];
 
@@ -286,6 +401,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
 {
     MultiFDPacket_t *packet = p->packet;
     uint32_t pages_max = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    size_t page_size = qemu_target_page_size();
     RAMBlock *block;
     int i;
 
@@ -335,10 +451,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->pages->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->pages->zero_num > packet->pages_alloc - p->pages->used) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d zero pages and expected maximum zero pages are %d",
+                   p->pages->zero_num, packet->pages_alloc - p->pages->used);
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->pages->used == 0) {
+    if (p->pages->used == 0 && p->pages->zero_num == 0) {
         return 0;
     }
 
@@ -351,7 +475,22 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
-    for (i = 0; i < p->pages->used; i++) {
+    if (p->flags & MULTIFD_FLAG_POSTCOPY) {
+        /* Every page is placed on its own, so it must be a host page */
+        if (qemu_ram_pagesize(block) != page_size) {
+            error_setg(errp, "multifd: postcopy pages for ram block %s "
+                       "with huge pages", block->idstr);
+            return -1;
+        }
+        if (p->postcopy_buf_pages < p->pages->allocated) {
+            qemu_vfree(p->postcopy_buf);
+            p->postcopy_buf = qemu_memalign(qemu_real_host_page_size,
+                                            p->pages->allocated * page_size);
+            p->postcopy_buf_pages = p->pages->allocated;
+        }
+    }
+
+    for (i = 0; i < p->pages->used + p->pages->zero_num; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
         if (offset > (block->used_length - qemu_target_page_size())) {
@@ -360,9 +499,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                        offset, block->max_length);
             return -1;
         }
-        p->pages->iov[i].iov_base = block->host + offset;
-        p->pages->iov[i].iov_len = qemu_target_page_size();
+        p->pages->offset[i] = offset;
+        if (i >= p->pages->used) {
+            continue;
+        }
+        if (p->flags & MULTIFD_FLAG_POSTCOPY) {
+            p->pages->iov[i].iov_base = p->postcopy_buf + i * page_size;
+        } else {
+            p->pages->iov[i].iov_base = block->host + offset;
+        }
+        p->pages->iov[i].iov_len = page_size;
     }
+    p->pages->block = block;
 
     return 0;
 }
@@ -403,6 +551,29 @@ struct {
  * false.
  */
 
+/*
+ * multifd_send_account: account what a channel has sent
+ *
+ * With zero page detection, the migration thread does not know how many
+ * of the queued pages are really sent until the channel has looked at
+ * them.  The channel thread records its traffic and the migration thread
+ * adds it to the counters the next time it picks the channel, or when it
+ * synchronizes with all channels.
+ *
+ * Called with p->mutex held.
+ */
+static void multifd_send_account(QEMUFile *f, MultiFDSendParams *p)
+{
+    qemu_file_update_transfer(f, p->unaccounted_bytes);
+    ram_counters.multifd_bytes += p->unaccounted_bytes;
+    ram_counters.transferred += p->unaccounted_bytes;
+    ram_counters.normal += p->unaccounted_normal;
+    ram_counters.duplicate += p->unaccounted_zero;
+    p->unaccounted_bytes = 0;
+    p->unaccounted_normal = 0;
+    p->unaccounted_zero = 0;
+}
+
 static int multifd_send_pages(QEMUFile *f)
 {
     int i;
@@ -444,11 +615,18 @@ static int multifd_send_pages(QEMUFile *f)
     p->packet_num = multifd_send_state->packet_num++;
     multifd_send_state->pages = p->pages;
     p->pages = pages;
-    transferred = ((uint64_t) pages->used) * qemu_target_page_size()
-                + p->packet_len;
-    qemu_file_update_transfer(f, transferred);
-    ram_counters.multifd_bytes += transferred;
-    ram_counters.transferred += transferred;
+    if (migration_in_postcopy()) {
+        p->flags |= MULTIFD_FLAG_POSTCOPY;
+    }
+    if (migrate_use_multifd_zero_page()) {
+        multifd_send_account(f, p);
+    } else {
+        transferred = ((uint64_t) pages->used) * qemu_target_page_size()
+                    + p->packet_len;
+        qemu_file_update_transfer(f, transferred);
+        ram_counters.multifd_bytes += transferred;
+        ram_counters.transferred += transferred;
+    }
     qemu_mutex_unlock(&p->mutex);
     qemu_sem_post(&p->sem);
 
@@ -571,6 +749,23 @@ void multifd_save_cleanup(void)
     multifd_send_state = NULL;
 }
 
+/*
+ * multifd_send_queued_pages: send the queued pages without waiting for a
+ * full packet
+ *
+ * Used in postcopy when the destination asks for a page that has been
+ * queued but not sent yet.
+ */
+void multifd_send_queued_pages(QEMUFile *f)
+{
+    if (!migrate_use_multifd() || !multifd_send_state->pages->used) {
+        return;
+    }
+    if (multifd_send_pages(f) < 0) {
+        error_report("%s: multifd_send_pages fail", __func__);
+    }
+}
+
 void multifd_send_sync_main(QEMUFile *f)
 {
     int i;
@@ -600,9 +795,11 @@ void multifd_send_sync_main(QEMUFile *f)
         p->packet_num = multifd_send_state->packet_num++;
         p->flags |= MULTIFD_FLAG_SYNC;
         p->pending_job++;
-        qemu_file_update_transfer(f, p->packet_len);
-        ram_counters.multifd_bytes += p->packet_len;
-        ram_counters.transferred += p->packet_len;
+        if (!migrate_use_multifd_zero_page()) {
+            qemu_file_update_transfer(f, p->packet_len);
+            ram_counters.multifd_bytes += p->packet_len;
+            ram_counters.transferred += p->packet_len;
+        }
         qemu_mutex_unlock(&p->mutex);
         qemu_sem_post(&p->sem);
     }
@@ -611,10 +808,47 @@ void multifd_send_sync_main(QEMUFile *f)
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+
+        if (migrate_use_multifd_zero_page()) {
+            qemu_mutex_lock(&p->mutex);
+            multifd_send_account(f, p);
+            qemu_mutex_unlock(&p->mutex);
+        }
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
+/*
+ * multifd_send_zero_page_detect: take zero pages out of the data
+ *
+ * Partition the pages so that the ones with data come first and are the
+ * only ones counted in pages->used; zero pages follow and are sent as
+ * offsets in the packet header only.
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    uint32_t i = 0, used = pages->used;
+
+    while (i < used) {
+        if (buffer_is_zero(pages->iov[i].iov_base, page_size)) {
+            ram_addr_t offset = pages->offset[i];
+            struct iovec iov = pages->iov[i];
+
+            used--;
+            pages->offset[i] = pages->offset[used];
+            pages->iov[i] = pages->iov[used];
+            pages->offset[used] = offset;
+            pages->iov[used] = iov;
+        } else {
+            i++;
+        }
+    }
+    pages->zero_num = pages->used - used;
+    pages->used = used;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -625,12 +859,14 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
-        ret = -1;
-        goto out;
+    if (!migrate_mapped_ram()) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
     }
-    /* initial packet */
-    p->num_packets = 1;
 
     while (true) {
         qemu_sem_wait(&p->sem);
@@ -641,33 +877,50 @@ static void *multifd_send_thread(void *opaque)
         qemu_mutex_lock(&p->mutex);
 
         if (p->pending_job) {
-            uint32_t used = p->pages->used;
+            uint32_t used, zero_num;
+            uint32_t payload = 0;
+            int64_t prepare_ns = 0;
             uint64_t packet_num = p->packet_num;
             flags = p->flags;
 
+            if (migrate_use_multifd_zero_page()) {
+                multifd_send_zero_page_detect(p);
+            }
+            used = p->pages->used;
+            zero_num = p->pages->zero_num;
+
             if (used) {
+                int64_t start = multifd_thread_cpu_ns();
+
                 ret = multifd_send_state->ops->send_prepare(p, used,
                                                             &local_err);
                 if (ret != 0) {
                     qemu_mutex_unlock(&p->mutex);
                     break;
                 }
+                prepare_ns = multifd_thread_cpu_ns() - start;
+                payload = p->next_packet_size;
+            }
+            if (p->packet) {
+                multifd_send_fill_packet(p);
             }
-            multifd_send_fill_packet(p);
             p->flags = 0;
             p->num_packets++;
             p->num_pages += used;
             p->pages->used = 0;
+            p->pages->zero_num = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
             trace_multifd_send(p->id, packet_num, used, flags,
                                p->next_packet_size);
 
-            ret = qio_channel_write_all(p->c, (void *)p->packet,
-                                        p->packet_len, &local_err);
-            if (ret != 0) {
-                break;
+            if (p->packet) {
+                ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                            p->packet_len, &local_err);
+                if (ret != 0) {
+                    break;
+                }
             }
 
             if (used) {
@@ -679,9 +932,26 @@ static void *multifd_send_thread(void *opaque)
 
             qemu_mutex_lock(&p->mutex);
             p->pending_job--;
+            p->unaccounted_bytes += p->packet_len +
+                                    (uint64_t)used * qemu_target_page_size();
+            p->unaccounted_normal += used;
+            p->unaccounted_zero += zero_num;
+            p->stats->packets++;
+            p->stats->pages += used;
+            p->stats->raw_bytes += (uint64_t)used * qemu_target_page_size();
+            p->stats->compressed_bytes += payload;
+            p->stats->prepare_time_ns += prepare_ns;
             qemu_mutex_unlock(&p->mutex);
 
             if (flags & MULTIFD_FLAG_SYNC) {
+                /* Pages of this round must not be in flight past the sync */
+                if (migrate_zero_copy_send()) {
+                    ret = qio_channel_socket_zero_copy_flush(
+                        QIO_CHANNEL_SOCKET(p->c), &local_err);
+                    if (ret != 0) {
+                        break;
+                    }
+                }
                 qemu_sem_post(&p->sem_sync);
             }
             qemu_sem_post(&multifd_send_state->channels_ready);
@@ -735,6 +1005,9 @@ static void multifd_tls_outgoing_handshake(QIOTask *task,
         trace_multifd_tls_outgoing_handshake_error(ioc, error_get_pretty(err));
     } else {
         trace_multifd_tls_outgoing_handshake_complete(ioc);
+        if (migrate_tls_offload()) {
+            migration_tls_enable_offload(QIO_CHANNEL_TLS(ioc));
+        }
     }
     multifd_channel_connect(p, ioc, err);
 }
@@ -840,6 +1113,11 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
     } else {
         p->c = QIO_CHANNEL(sioc);
         qio_channel_set_delay(p->c, false);
+        if (migrate_zero_copy_send() &&
+            qio_channel_socket_set_zero_copy(QIO_CHANNEL_SOCKET(sioc), true,
+                                             &local_err) < 0) {
+            goto cleanup;
+        }
         p->running = true;
         if (multifd_channel_connect(p, sioc, local_err)) {
             goto cleanup;
@@ -868,7 +1146,15 @@ int multifd_save_setup(Error **errp)
     multifd_send_state->pages = multifd_pages_init(page_count);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
     qatomic_set(&multifd_send_state->exiting, 0);
-    multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
+    if (migrate_mapped_ram()) {
+        multifd_send_state->ops = &multifd_mapped_ram_ops;
+    } else {
+        multifd_send_state->ops =
+            multifd_get_ops(migrate_multifd_compression());
+    }
+    g_free(multifd_send_stats);
+    multifd_send_stats = g_new0(MultiFDSendStats, thread_count);
+    multifd_send_stats_count = thread_count;
 
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
@@ -880,13 +1166,19 @@ int multifd_save_setup(Error **errp)
         p->pending_job = 0;
         p->id = i;
         p->pages = multifd_pages_init(page_count);
+        p->stats = &multifd_send_stats[i];
+        p->name = g_strdup_printf("multifdsend_%d", i);
+        p->tls_hostname = g_strdup(s->hostname);
+        if (migrate_mapped_ram()) {
+            /* Each page has its place in the file, no packet is needed */
+            file_send_channel_create(multifd_new_send_channel_async, p);
+            continue;
+        }
         p->packet_len = sizeof(MultiFDPacket_t)
                       + sizeof(uint64_t) * page_count;
         p->packet = g_malloc0(p->packet_len);
         p->packet->magic = cpu_to_be32(MULTIFD_MAGIC);
         p->packet->version = cpu_to_be32(MULTIFD_VERSION);
-        p->name = g_strdup_printf("multifdsend_%d", i);
-        p->tls_hostname = g_strdup(s->hostname);
         socket_send_channel_create(multifd_new_send_channel_async, p);
     }
 
@@ -948,13 +1240,15 @@ static void multifd_recv_terminate_threads(Error *err)
         }
         qemu_mutex_unlock(&p->mutex);
     }
+    /* Wake up the threads waiting to place postcopy pages */
+    qemu_event_set(&migration_incoming_get_current()->postcopy_listen_event);
 }
 
 int multifd_load_cleanup(Error **errp)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return 0;
     }
     multifd_recv_terminate_threads(NULL);
@@ -985,6 +1279,9 @@ int multifd_load_cleanup(Error **errp)
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
+        qemu_vfree(p->postcopy_buf);
+        p->postcopy_buf = NULL;
+        p->postcopy_buf_pages = 0;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
@@ -1000,7 +1297,7 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1023,6 +1320,62 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/*
+ * Place the pages received during postcopy.  Discarding the dirty pages
+ * and arming userfaultfd must be done first, which happens when the
+ * destination starts listening.
+ */
+static int multifd_recv_place_postcopy(MultiFDRecvParams *p, uint32_t used,
+                                       uint32_t zero_num, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    RAMBlock *block = p->pages->block;
+    PostcopyState ps;
+    uint32_t i;
+    int ret;
+
+    qemu_event_wait(&mis->postcopy_listen_event);
+    ps = postcopy_state_get();
+    if (ps != POSTCOPY_INCOMING_LISTENING && ps != POSTCOPY_INCOMING_RUNNING) {
+        error_setg(errp, "multifd: postcopy pages in postcopy state %d", ps);
+        return -1;
+    }
+
+    for (i = 0; i < used + zero_num; i++) {
+        void *host = block->host + p->pages->offset[i];
+
+        if (i < used) {
+            ret = postcopy_place_page(mis, host, p->pages->iov[i].iov_base,
+                                      block);
+        } else {
+            ret = postcopy_place_page_zero(mis, host, block);
+        }
+        if (ret) {
+            error_setg_errno(errp, -ret, "multifd: failed to place page");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Clear the pages that the sender found to be zero */
+static void multifd_recv_zero_pages(MultiFDRecvParams *p, uint32_t used,
+                                    uint32_t zero_num)
+{
+    size_t page_size = qemu_target_page_size();
+    uint32_t i;
+
+    for (i = used; i < used + zero_num; i++) {
+        uint8_t *host = p->pages->block->host + p->pages->offset[i];
+
+        /* Avoid populating memory that is still untouched */
+        if (!buffer_is_zero(host, page_size)) {
+            memset(host, 0, page_size);
+        }
+    }
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1034,6 +1387,7 @@ static void *multifd_recv_thread(void *opaque)
 
     while (true) {
         uint32_t used;
+        uint32_t zero_num;
         uint32_t flags;
 
         if (p->quit) {
@@ -1057,6 +1411,7 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         used = p->pages->used;
+        zero_num = p->pages->zero_num;
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
@@ -1073,6 +1428,15 @@ static void *multifd_recv_thread(void *opaque)
             }
         }
 
+        if (flags & MULTIFD_FLAG_POSTCOPY) {
+            ret = multifd_recv_place_postcopy(p, used, zero_num, &local_err);
+            if (ret != 0) {
+                break;
+            }
+        } else if (zero_num) {
+            multifd_recv_zero_pages(p, used, zero_num);
+        }
+
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
@@ -1099,7 +1463,8 @@ int multifd_load_setup(Error **errp)
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    /* With mapped-ram, the pages are read from the file by ram_load() */
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
@@ -1107,7 +1472,7 @@ int multifd_load_setup(Error **errp)
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
     qatomic_set(&multifd_recv_state->count, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
-    multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
+    multifd_recv_state->ops = multifd_get_ops(migrate_multifd_compression());
 
     for (i = 0; i < thread_count; i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
@@ -1141,7 +1506,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return true;
     }
 
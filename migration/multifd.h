@@ -22,6 +22,8 @@ bool multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 void multifd_send_sync_main(QEMUFile *f);
 int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
+void multifd_send_queued_pages(QEMUFile *f);
+MultiFDChannelStatsList *multifd_query_send_stats(void);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -32,6 +34,10 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_LZ4 (3 << 1)
+
+/* The destination places the pages with userfaultfd */
+#define MULTIFD_FLAG_POSTCOPY (1 << 4)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -46,7 +52,10 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /* number of zero pages, their offsets follow the ones of used pages */
+    uint32_t zero_pages;
+    uint32_t unused32[1];  /* Reserved for future use */
+    uint64_t unused64[3];  /* Reserved for future use */
     char ramblock[256];
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
@@ -56,6 +65,8 @@ typedef struct {
     uint32_t used;
     /* number of allocated pages */
     uint32_t allocated;
+    /* number of zero pages, their offsets follow the used ones */
+    uint32_t zero_num;
     /* global number of generated multifd packets */
     uint64_t packet_num;
     /* offset of each page */
@@ -65,6 +76,16 @@ typedef struct {
     RAMBlock *block;
 } MultiFDPages_t;
 
+typedef struct {
+    uint64_t packets;
+    uint64_t pages;
+    /* size of the pages before and after send_prepare() */
+    uint64_t raw_bytes;
+    uint64_t compressed_bytes;
+    /* CPU time spent in send_prepare() */
+    uint64_t prepare_time_ns;
+} MultiFDSendStats;
+
 typedef struct {
     /* this fields are not changed once the thread is created */
     /* channel number */
@@ -108,6 +129,15 @@ typedef struct {
     QemuSemaphore sem_sync;
     /* used for compression methods */
     void *data;
+    /*
+     * With zero page detection, what this channel sent and the main
+     * thread did not account yet; protected by the mutex.
+     */
+    uint64_t unaccounted_bytes;
+    uint64_t unaccounted_normal;
+    uint64_t unaccounted_zero;
+    /* what this channel did since setup; protected by the mutex */
+    MultiFDSendStats *stats;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -147,6 +177,9 @@ typedef struct {
     QemuSemaphore sem_sync;
     /* used for de-compression methods */
     void *data;
+    /* pages received during postcopy land here before being placed */
+    uint8_t *postcopy_buf;
+    uint32_t postcopy_buf_pages;
 } MultiFDRecvParams;
 
 typedef struct {
@@ -164,9 +197,14 @@ typedef struct {
     void (*recv_cleanup)(MultiFDRecvParams *p);
     /* Read all pages */
     int (*recv_pages)(MultiFDRecvParams *p, uint32_t used, Error **errp);
+    /* Accelerator backends only: name, used for tracing */
+    const char *name;
+    /* Accelerator backends only: can the device be used on this host */
+    bool (*is_available)(void);
 } MultiFDMethods;
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
+void multifd_register_accel_ops(int method, MultiFDMethods *ops);
 
 #endif
 
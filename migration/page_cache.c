@@ -33,6 +33,11 @@ struct CacheItem {
 
 struct PageCache {
     CacheItem *page_cache;
+    /*
+     * Storage for all the pages, allocated upfront so that a cache miss
+     * in the migration thread never has to call the allocator.
+     */
+    uint8_t *data;
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
@@ -80,6 +85,15 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
         return NULL;
     }
 
+    cache->data = g_try_malloc(cache->max_num_items * page_size);
+    if (!cache->data) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "cache size",
+                   "Failed to allocate page cache");
+        g_free(cache->page_cache);
+        g_free(cache);
+        return NULL;
+    }
+
     for (i = 0; i < cache->max_num_items; i++) {
         cache->page_cache[i].it_data = NULL;
         cache->page_cache[i].it_age = 0;
@@ -96,10 +110,8 @@ void cache_fini(PageCache *cache)
     g_assert(cache);
     g_assert(cache->page_cache);
 
-    for (i = 0; i < cache->max_num_items; i++) {
-        g_free(cache->page_cache[i].it_data);
-    }
-
+    g_free(cache->data);
+    cache->data = NULL;
     g_free(cache->page_cache);
     cache->page_cache = NULL;
     g_free(cache);
@@ -131,6 +143,12 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 
 bool cache_is_cached(const PageCache *cache, uint64_t addr,
                      uint64_t current_age)
+{
+    return cache_lookup(cache, addr, current_age) != NULL;
+}
+
+uint8_t *cache_lookup(const PageCache *cache, uint64_t addr,
+                      uint64_t current_age)
 {
     CacheItem *it;
 
@@ -139,9 +157,9 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
     if (it->it_addr == addr) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
-        return true;
+        return it->it_data;
     }
-    return false;
+    return NULL;
 }
 
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
@@ -158,13 +176,9 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
         /* the cache page is fresh, don't replace it */
         return -1;
     }
-    /* allocate page */
+    /* first use of this slot */
     if (!it->it_data) {
-        it->it_data = g_try_malloc(cache->page_size);
-        if (!it->it_data) {
-            trace_migration_pagecache_insert();
-            return -1;
-        }
+        it->it_data = cache->data + (it - cache->page_cache) * cache->page_size;
         cache->num_items++;
     }
 
@@ -47,6 +47,21 @@ void cache_fini(PageCache *cache);
 bool cache_is_cached(const PageCache *cache, uint64_t addr,
                      uint64_t current_age);
 
+/**
+ * cache_lookup: Get the data cached for an addr, if any
+ *
+ * Same as cache_is_cached() followed by get_cached_data(), with a
+ * single hash lookup.
+ *
+ * Returns pointer to the data cached or NULL if not cached
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ * @current_age: current bitmap generation
+ */
+uint8_t *cache_lookup(const PageCache *cache, uint64_t addr,
+                      uint64_t current_age);
+
 /**
  * get_cached_data: Get the data cached for an addr
  *
@@ -20,9 +20,11 @@
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
+#include "qemu-file-channel.h"
 #include "savevm.h"
 #include "postcopy-ram.h"
 #include "ram.h"
+#include "socket.h"
 #include "qapi/error.h"
 #include "qemu/notify.h"
 #include "qemu/rcu.h"
@@ -526,6 +528,9 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 {
     trace_postcopy_ram_incoming_cleanup_entry();
 
+    /* The preempt thread may still be placing pages */
+    postcopy_preempt_incoming_cleanup(mis);
+
     if (mis->have_fault_thread) {
         Error *local_err = NULL;
 
@@ -568,6 +573,10 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
         munmap(mis->postcopy_tmp_zero_page, mis->largest_page_size);
         mis->postcopy_tmp_zero_page = NULL;
     }
+    if (mis->postcopy_preempt_tmp_page) {
+        munmap(mis->postcopy_preempt_tmp_page, mis->largest_page_size);
+        mis->postcopy_preempt_tmp_page = NULL;
+    }
     trace_postcopy_ram_incoming_cleanup_blocktime(
             get_postcopy_total_blocktime());
 
@@ -1122,6 +1131,20 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
     }
     memset(mis->postcopy_tmp_zero_page, '\0', mis->largest_page_size);
 
+    if (migrate_postcopy_preempt()) {
+        mis->postcopy_preempt_tmp_page = mmap(NULL, mis->largest_page_size,
+                                              PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS,
+                                              -1, 0);
+        if (mis->postcopy_preempt_tmp_page == MAP_FAILED) {
+            int e = errno;
+            mis->postcopy_preempt_tmp_page = NULL;
+            error_report("%s: Failed to map postcopy_preempt_tmp_page %s",
+                         __func__, strerror(e));
+            return -e;
+        }
+    }
+
     trace_postcopy_ram_enable_notify();
 
     return 0;
@@ -1238,6 +1261,137 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
     }
 }
 
+/* ------------------------------------------------------------------------- */
+/* Write protection of guest RAM, used by background snapshots */
+
+/*
+ * uffd_wp_supported_by_host: check that the kernel can write-protect
+ * anonymous memory through userfaultfd
+ */
+bool uffd_wp_supported_by_host(void)
+{
+    uint64_t features;
+
+    if (!receive_ufd_features(&features)) {
+        return false;
+    }
+    return features & UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+}
+
+/*
+ * uffd_wp_open: create a userfaultfd ready to register write-protected
+ * ranges
+ *
+ * Returns the fd, or -1 on error
+ */
+int uffd_wp_open(Error **errp)
+{
+    struct uffdio_api api_struct = {
+        .api = UFFD_API,
+        .features = UFFD_FEATURE_PAGEFAULT_FLAG_WP,
+    };
+    int ufd;
+
+    ufd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (ufd == -1) {
+        error_setg_errno(errp, errno, "userfaultfd not available");
+        return -1;
+    }
+    if (ioctl(ufd, UFFDIO_API, &api_struct)) {
+        error_setg_errno(errp, errno, "UFFDIO_API failed");
+        close(ufd);
+        return -1;
+    }
+    return ufd;
+}
+
+/*
+ * uffd_wp_register: register [@host, @host + @length) for write-protect
+ * faults
+ *
+ * Returns 0 on success.  Fails if the kernel cannot write-protect this
+ * kind of memory (e.g. hugetlbfs or shared memory on older kernels).
+ */
+int uffd_wp_register(int ufd, void *host, size_t length, Error **errp)
+{
+    struct uffdio_register reg_struct = {
+        .range.start = (uintptr_t)host,
+        .range.len = length,
+        .mode = UFFDIO_REGISTER_MODE_WP,
+    };
+
+    if (ioctl(ufd, UFFDIO_REGISTER, &reg_struct)) {
+        error_setg_errno(errp, errno, "UFFDIO_REGISTER failed for %p", host);
+        return -1;
+    }
+    if (!(reg_struct.ioctls & ((__u64)1 << _UFFDIO_WRITEPROTECT))) {
+        error_setg(errp, "write protection is not supported for %p", host);
+        uffd_wp_unregister(ufd, host, length);
+        return -1;
+    }
+    trace_uffd_wp_register(host, length);
+    return 0;
+}
+
+void uffd_wp_unregister(int ufd, void *host, size_t length)
+{
+    struct uffdio_range range_struct = {
+        .start = (uintptr_t)host,
+        .len = length,
+    };
+
+    if (ioctl(ufd, UFFDIO_UNREGISTER, &range_struct)) {
+        error_report("%s: UFFDIO_UNREGISTER failed for %p: %s",
+                     __func__, host, strerror(errno));
+    }
+}
+
+/*
+ * uffd_wp_protect: set or clear write protection of a registered range;
+ * clearing it wakes up the threads that faulted on the range
+ */
+int uffd_wp_protect(int ufd, void *host, size_t length, bool wp)
+{
+    struct uffdio_writeprotect wp_struct = {
+        .range.start = (uintptr_t)host,
+        .range.len = length,
+        .mode = wp ? UFFDIO_WRITEPROTECT_MODE_WP : 0,
+    };
+
+    if (ioctl(ufd, UFFDIO_WRITEPROTECT, &wp_struct)) {
+        int ret = -errno;
+
+        error_report("%s: UFFDIO_WRITEPROTECT failed for %p: %s",
+                     __func__, host, strerror(errno));
+        return ret;
+    }
+    return 0;
+}
+
+/*
+ * uffd_wp_read_fault: get the address of a pending write fault, without
+ * blocking
+ *
+ * Returns the host address, or NULL if there is none
+ */
+void *uffd_wp_read_fault(int ufd)
+{
+    struct uffd_msg msg;
+    ssize_t ret;
+
+    do {
+        ret = read(ufd, &msg, sizeof(msg));
+        if (ret != sizeof(msg)) {
+            /* EAGAIN: nothing pending */
+            return NULL;
+        }
+    } while (msg.event != UFFD_EVENT_PAGEFAULT ||
+             !(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP));
+
+    trace_uffd_wp_read_fault((void *)(uintptr_t)msg.arg.pagefault.address);
+    return (void *)(uintptr_t)msg.arg.pagefault.address;
+}
+
 #else
 /* No target OS support, stubs just fail */
 void fill_destination_postcopy_migration_info(MigrationInfo *info)
@@ -1302,6 +1456,40 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
     assert(0);
     return -1;
 }
+
+bool uffd_wp_supported_by_host(void)
+{
+    return false;
+}
+
+int uffd_wp_open(Error **errp)
+{
+    error_setg(errp, "userfaultfd write protection not supported");
+    return -1;
+}
+
+int uffd_wp_register(int ufd, void *host, size_t length, Error **errp)
+{
+    assert(0);
+    return -1;
+}
+
+void uffd_wp_unregister(int ufd, void *host, size_t length)
+{
+    assert(0);
+}
+
+int uffd_wp_protect(int ufd, void *host, size_t length, bool wp)
+{
+    assert(0);
+    return -1;
+}
+
+void *uffd_wp_read_fault(int ufd)
+{
+    assert(0);
+    return NULL;
+}
 #endif
 
 /* ------------------------------------------------------------------------- */
@@ -1437,3 +1625,123 @@ void postcopy_unregister_shared_ufd(struct PostCopyFD *pcfd)
         }
     }
 }
+
+/*
+ * Postcopy preempt: the pages that the fault thread asks for travel on a
+ * channel of their own, so that they do not wait behind the background
+ * pages still queued on the main channel.
+ */
+
+static void postcopy_preempt_send_channel_new(QIOTask *task, gpointer opaque)
+{
+    MigrationState *s = opaque;
+    QIOChannel *ioc = QIO_CHANNEL(qio_task_get_source(task));
+    Error *local_err = NULL;
+
+    if (qio_task_propagate_error(task, &local_err)) {
+        warn_report("postcopy preempt channel failed to connect, requested "
+                    "pages will use the main channel: %s",
+                    error_get_pretty(local_err));
+        error_free(local_err);
+    } else if (migration_is_running(s->state)) {
+        qio_channel_set_name(ioc, "migration-postcopy-preempt");
+        qio_channel_set_delay(ioc, false);
+        s->postcopy_qemufile_src = qemu_fopen_channel_output(ioc);
+        trace_postcopy_preempt_new_channel();
+    }
+
+    object_unref(OBJECT(ioc));
+    qemu_event_set(&s->postcopy_qemufile_src_event);
+}
+
+/* Start connecting the preempt channel, on the source */
+void postcopy_preempt_setup(MigrationState *s)
+{
+    qemu_event_reset(&s->postcopy_qemufile_src_event);
+    socket_send_channel_create(postcopy_preempt_send_channel_new, s);
+}
+
+/* Wait until the preempt channel is connected or has failed to */
+void postcopy_preempt_wait_channel(MigrationState *s)
+{
+    qemu_event_wait(&s->postcopy_qemufile_src_event);
+}
+
+/* Close the preempt channel, on the source */
+void postcopy_preempt_close(MigrationState *s)
+{
+    QEMUFile *file;
+
+    qemu_mutex_lock(&s->qemu_file_lock);
+    file = s->postcopy_qemufile_src;
+    s->postcopy_qemufile_src = NULL;
+    qemu_mutex_unlock(&s->qemu_file_lock);
+
+    if (file) {
+        qemu_file_shutdown(file);
+        qemu_fclose(file);
+    }
+}
+
+static void *postcopy_preempt_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    PostcopyState ps;
+    int ret = 0;
+
+    trace_postcopy_preempt_thread_entry();
+    rcu_register_thread();
+
+    /*
+     * Pages only come here once the fault thread asked for them, which
+     * cannot happen before userfaultfd is armed; wait for it anyway, as
+     * placing a page earlier would fail.
+     */
+    qemu_event_wait(&mis->postcopy_listen_event);
+    ps = postcopy_state_get();
+    if (ps == POSTCOPY_INCOMING_LISTENING || ps == POSTCOPY_INCOMING_RUNNING) {
+        qemu_file_set_blocking(mis->postcopy_qemufile_dst, true);
+        while (!ret) {
+            WITH_RCU_READ_LOCK_GUARD() {
+                ret = ram_load_postcopy(mis->postcopy_qemufile_dst,
+                                        RAM_CHANNEL_POSTCOPY);
+            }
+        }
+        if (!qatomic_read(&mis->postcopy_preempt_quit)) {
+            error_report("%s: postcopy preempt channel failed: %s",
+                         __func__, strerror(-ret));
+        }
+    }
+
+    rcu_unregister_thread();
+    trace_postcopy_preempt_thread_exit();
+    return NULL;
+}
+
+/* Take the preempt channel, on the destination */
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file)
+{
+    trace_postcopy_preempt_new_channel();
+    mis->postcopy_qemufile_dst = file;
+    mis->postcopy_preempt_quit = false;
+    qemu_thread_create(&mis->postcopy_preempt_thread, "postcopy/preempt",
+                       postcopy_preempt_thread, mis, QEMU_THREAD_JOINABLE);
+    mis->have_preempt_thread = true;
+}
+
+/* Stop the preempt thread and close its channel, on the destination */
+void postcopy_preempt_incoming_cleanup(MigrationIncomingState *mis)
+{
+    if (mis->have_preempt_thread) {
+        qatomic_set(&mis->postcopy_preempt_quit, true);
+        qemu_file_shutdown(mis->postcopy_qemufile_dst);
+        /* In case it still waits for postcopy to start */
+        qemu_event_set(&mis->postcopy_listen_event);
+        qemu_thread_join(&mis->postcopy_preempt_thread);
+        mis->have_preempt_thread = false;
+    }
+    if (mis->postcopy_qemufile_dst) {
+        qemu_fclose(mis->postcopy_qemufile_dst);
+        mis->postcopy_qemufile_dst = NULL;
+    }
+}
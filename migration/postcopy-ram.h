@@ -179,4 +179,23 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd, uint64_t client_addr,
 int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                  uint64_t client_addr, uint64_t offset);
 
+/* Postcopy preempt channel, source side */
+void postcopy_preempt_setup(MigrationState *s);
+void postcopy_preempt_wait_channel(MigrationState *s);
+void postcopy_preempt_close(MigrationState *s);
+/* Postcopy preempt channel, destination side */
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file);
+void postcopy_preempt_incoming_cleanup(MigrationIncomingState *mis);
+
+/*
+ * Write protection of guest RAM through userfaultfd, used by background
+ * snapshots on the source side.
+ */
+bool uffd_wp_supported_by_host(void);
+int uffd_wp_open(Error **errp);
+int uffd_wp_register(int ufd, void *host, size_t length, Error **errp);
+void uffd_wp_unregister(int ufd, void *host, size_t length);
+int uffd_wp_protect(int ufd, void *host, size_t length, bool wp);
+void *uffd_wp_read_fault(int ufd);
+
 #endif
@@ -657,6 +657,65 @@ int64_t qemu_ftell(QEMUFile *f)
     return f->pos;
 }
 
+/*
+ * Get the offset in the underlying file of the next byte that will be
+ * read or written.  Unlike qemu_ftell(), which counts the bytes that went
+ * through @f, this needs a seekable transport.
+ *
+ * Returns -1 and sets an error on @f on failure.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *local_err = NULL;
+    off_t ret;
+
+    if (!f->ops->seek) {
+        qemu_file_set_error(f, -ENOTSUP);
+        return -1;
+    }
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+        if (qemu_file_get_error(f)) {
+            return -1;
+        }
+    }
+
+    ret = f->ops->seek(f->opaque, 0, SEEK_CUR, &local_err);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_err);
+        return -1;
+    }
+    /* Data read ahead is not consumed yet */
+    return ret - (f->buf_size - f->buf_index);
+}
+
+/*
+ * Move the next read or write of @f to @offset in the underlying file.
+ * Data that was read ahead is dropped, pending writes are flushed first.
+ */
+void qemu_set_offset(QEMUFile *f, off_t offset)
+{
+    Error *local_err = NULL;
+
+    if (!f->ops->seek) {
+        qemu_file_set_error(f, -ENOTSUP);
+        return;
+    }
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+    if (qemu_file_get_error(f)) {
+        return;
+    }
+
+    if (f->ops->seek(f->opaque, offset, SEEK_SET, &local_err) < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_err);
+    }
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (f->shutdown) {
@@ -88,6 +88,13 @@ void json_prop_str(QJSON *json, const char *name, const char *str)
     qstring_append_chr(json->str, '"');
 }
 
+/* Insert @raw, which must already be JSON text, as an element */
+void json_prop_raw(QJSON *json, const char *name, const char *raw)
+{
+    json_emit_element(json, name);
+    qstring_append(json->str, raw);
+}
+
 const char *qjson_get_str(QJSON *json)
 {
     return qstring_get_str(json->str);
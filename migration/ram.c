@@ -56,6 +56,8 @@
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "hw/boards.h"
+#include "file.h"
 
 /***********************************************************/
 /* ram save/restore */
@@ -76,6 +78,14 @@
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
 
+/*
+ * With mapped-ram each block is followed in the stream by a header, a
+ * bitmap of the pages present in the file and then the pages themselves,
+ * each one at a fixed offset from the start of the block.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
     return buffer_is_zero(p, size);
@@ -317,6 +327,8 @@ struct RAMState {
     int64_t time_last_bitmap_sync;
     /* bytes transferred at start_time */
     uint64_t bytes_xfer_prev;
+    /* dirty ring pages of each vCPU at start_time, by cpu_index */
+    uint64_t *vcpu_dirty_pages_prev;
     /* number of dirty pages since start_time */
     uint64_t num_dirty_pages_period;
     /* xbzrle misses since the beginning of the period */
@@ -347,6 +359,9 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* Background snapshot: userfaultfd write-protecting guest RAM */
+    bool write_tracking;
+    int uffd_wp_fd;
 };
 typedef struct RAMState RAMState;
 
@@ -403,6 +418,8 @@ struct PageSearchStatus {
     unsigned long page;
     /* Set once we wrap around */
     bool         complete_round;
+    /* The destination asked for this page during postcopy */
+    bool         postcopy_requested;
 };
 typedef struct PageSearchStatus PageSearchStatus;
 
@@ -645,6 +662,99 @@ static void mig_throttle_guest_down(uint64_t bytes_dirty_period,
     }
 }
 
+static int uint64_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * mig_throttle_vcpus: throttle the vCPUs that dirty memory too fast
+ *
+ * The bytes that can be dirtied during a period are shared among the
+ * vCPUs, what a vCPU does not use of its share going to the others.
+ * The vCPUs that dirtied more than the resulting quota are throttled
+ * so that they would have dirtied just their quota; the others have
+ * their throttle lowered.  Each throttle moves by at most
+ * cpu-throttle-increment at a time.
+ *
+ * @rs: current RAM state
+ * @bytes_dirty_threshold: bytes the guest may dirty during the period
+ */
+static void mig_throttle_vcpus(RAMState *rs, uint64_t bytes_dirty_threshold)
+{
+    MigrationState *s = migrate_get_current();
+    MachineState *ms = MACHINE(qdev_get_machine());
+    int pct_initial = s->parameters.cpu_throttle_initial;
+    int pct_increment = s->parameters.cpu_throttle_increment;
+    int pct_max = s->parameters.max_cpu_throttle;
+    unsigned int max_cpus = ms->smp.max_cpus;
+    g_autofree uint64_t *dirty = g_new0(uint64_t, max_cpus);
+    g_autofree uint64_t *sorted = g_new0(uint64_t, max_cpus);
+    uint64_t remaining = bytes_dirty_threshold;
+    uint64_t quota = UINT64_MAX;
+    bool first = !rs->vcpu_dirty_pages_prev;
+    unsigned int n = 0, i;
+    CPUState *cpu;
+
+    if (first) {
+        rs->vcpu_dirty_pages_prev = g_new0(uint64_t, max_cpus);
+    }
+    CPU_FOREACH(cpu) {
+        uint64_t pages = qatomic_read_u64(&cpu->dirty_pages);
+
+        if (cpu->cpu_index >= max_cpus) {
+            continue;
+        }
+        dirty[cpu->cpu_index] = (pages - rs->vcpu_dirty_pages_prev[
+                                 cpu->cpu_index]) * TARGET_PAGE_SIZE;
+        rs->vcpu_dirty_pages_prev[cpu->cpu_index] = pages;
+        sorted[n++] = dirty[cpu->cpu_index];
+    }
+    /* Nothing to compare with yet */
+    if (first || !n) {
+        return;
+    }
+
+    qsort(sorted, n, sizeof(*sorted), uint64_cmp);
+    for (i = 0; i < n; i++) {
+        uint64_t share = remaining / (n - i);
+
+        if (sorted[i] > share) {
+            quota = share;
+            break;
+        }
+        remaining -= sorted[i];
+    }
+
+    CPU_FOREACH(cpu) {
+        int now = cpu_throttle_vcpu_get_percentage(cpu);
+        int target = 0, pct;
+
+        if (cpu->cpu_index >= max_cpus) {
+            continue;
+        }
+        if (quota != UINT64_MAX && dirty[cpu->cpu_index]) {
+            /* The dirty rate follows the time the vCPU gets to run */
+            target = 100 - (100 - now) * ((double)quota /
+                                          dirty[cpu->cpu_index]);
+            target = MAX(target, 0);
+        }
+        if (target > now) {
+            pct = MIN(target, now + (now ? pct_increment : pct_initial));
+        } else {
+            pct = MAX(target, now - pct_increment);
+        }
+        pct = MIN(pct, pct_max);
+        if (pct != now) {
+            trace_migration_throttle_vcpu(cpu->cpu_index,
+                                          dirty[cpu->cpu_index], quota, pct);
+            cpu_throttle_vcpu_set(cpu, pct);
+        }
+    }
+}
+
 /**
  * xbzrle_cache_zero_page: insert a zero page in the XBZRLE cache
  *
@@ -692,8 +802,9 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
     int encoded_len = 0, bytes_xbzrle;
     uint8_t *prev_cached_page;
 
-    if (!cache_is_cached(XBZRLE.cache, current_addr,
-                         ram_counters.dirty_sync_count)) {
+    prev_cached_page = cache_lookup(XBZRLE.cache, current_addr,
+                                    ram_counters.dirty_sync_count);
+    if (!prev_cached_page) {
         xbzrle_counters.cache_miss++;
         if (!last_stage) {
             if (cache_insert(XBZRLE.cache, current_addr, *current_data,
@@ -720,7 +831,9 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
      * guest page is good for xbzrle encoding.
      */
     xbzrle_counters.pages++;
-    prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
+    /* the cached copy is cold; fetch it while we copy the guest page */
+    __builtin_prefetch(prev_cached_page);
+    __builtin_prefetch(prev_cached_page + TARGET_PAGE_SIZE / 2);
 
     /* save current buffer into memory */
     memcpy(XBZRLE.current_buf, *current_data, TARGET_PAGE_SIZE);
@@ -952,6 +1065,12 @@ static void migration_trigger_throttle(RAMState *rs)
      * that ram migration makes no progress. Avoid this by disabling the
      * throttling logic during the bulk phase of block migration. */
     if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+        if (migrate_per_vcpu_throttle()) {
+            /* Each vCPU on its own dirty rate, recomputed at each sync */
+            mig_throttle_vcpus(rs, bytes_dirty_threshold);
+            return;
+        }
+
         /* The following detection logic can be refined later. For now:
            Check to see if the ratio between dirtied bytes and the approx.
            amount of bytes that just got transferred since the last time
@@ -1172,7 +1291,11 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
 {
     int pages = -1;
     uint8_t *p;
-    bool send_async = true;
+    /*
+     * A background snapshot unprotects the page right after this, so the
+     * data must be copied now
+     */
+    bool send_async = !migrate_background_snapshot();
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
     ram_addr_t current_addr = block->offset + offset;
@@ -1209,7 +1332,10 @@ static int ram_save_multifd_page(RAMState *rs, RAMBlock *block,
     if (multifd_queue_page(rs->f, block, offset) < 0) {
         return -1;
     }
-    ram_counters.normal++;
+    /* Otherwise multifd accounts the page once it knows if it is zero */
+    if (!migrate_use_multifd_zero_page()) {
+        ram_counters.normal++;
+    }
 
     return 1;
 }
@@ -1434,6 +1560,192 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
     return block;
 }
 
+/*
+ * Background snapshot write tracking
+ *
+ * All of RAM is write-protected with userfaultfd when the snapshot
+ * starts.  Each host page is unprotected once it has been saved, and a
+ * vCPU that writes to a page not saved yet waits until the migration
+ * thread saves it out of order.
+ */
+
+/* read-only and ROM device memory is not written to by the guest */
+static bool ram_block_skip_write_tracking(RAMBlock *block)
+{
+    return block->mr->readonly || block->mr->rom_device;
+}
+
+/**
+ * ram_write_tracking_compatible: check that all of RAM can be
+ *   write-protected
+ *
+ * Returns true if it can
+ *
+ * @errp: pointer to an error
+ */
+bool ram_write_tracking_compatible(Error **errp)
+{
+    RAMBlock *block;
+    bool ret = false;
+    int ufd;
+
+    ufd = uffd_wp_open(errp);
+    if (ufd < 0) {
+        return false;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (ram_block_skip_write_tracking(block)) {
+            continue;
+        }
+        if (uffd_wp_register(ufd, block->host, block->max_length, errp)) {
+            error_prepend(errp, "RAM block '%s': ", block->idstr);
+            goto out;
+        }
+        uffd_wp_unregister(ufd, block->host, block->max_length);
+    }
+    ret = true;
+
+out:
+    close(ufd);
+    return ret;
+}
+
+static void ram_block_write_tracking_stop(RAMState *rs, RAMBlock *block)
+{
+    uffd_wp_protect(rs->uffd_wp_fd, block->host, block->used_length, false);
+    uffd_wp_unregister(rs->uffd_wp_fd, block->host, block->max_length);
+    block->flags &= ~RAM_UF_WRITEPROTECT;
+}
+
+/**
+ * ram_write_tracking_start: write-protect all of RAM
+ *
+ * Returns 0 for success or -1 for error
+ */
+int ram_write_tracking_start(void)
+{
+    RAMState *rs = ram_state;
+    Error *local_err = NULL;
+    RAMBlock *block;
+    int ufd;
+
+    ufd = uffd_wp_open(&local_err);
+    if (ufd < 0) {
+        error_report_err(local_err);
+        return -1;
+    }
+    rs->uffd_wp_fd = ufd;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (ram_block_skip_write_tracking(block)) {
+            continue;
+        }
+        if (uffd_wp_register(ufd, block->host, block->max_length,
+                             &local_err)) {
+            error_report_err(local_err);
+            goto fail;
+        }
+        block->flags |= RAM_UF_WRITEPROTECT;
+        if (uffd_wp_protect(ufd, block->host, block->used_length, true)) {
+            goto fail;
+        }
+        trace_ram_write_tracking_ramblock_start(block->idstr,
+                                                block->used_length);
+    }
+    rs->write_tracking = true;
+    return 0;
+
+fail:
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (block->flags & RAM_UF_WRITEPROTECT) {
+            ram_block_write_tracking_stop(rs, block);
+        }
+    }
+    close(ufd);
+    return -1;
+}
+
+/**
+ * ram_write_tracking_stop: unprotect all of RAM, waking up any vCPU
+ *   waiting on a write fault
+ *
+ * Does nothing if write tracking is not active.
+ */
+void ram_write_tracking_stop(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+
+    if (!rs || !rs->write_tracking) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (block->flags & RAM_UF_WRITEPROTECT) {
+            ram_block_write_tracking_stop(rs, block);
+        }
+    }
+    close(rs->uffd_wp_fd);
+    rs->write_tracking = false;
+}
+
+/**
+ * poll_fault_page: get a page that a vCPU is waiting for
+ *
+ * Returns the block of the page, or NULL if no write fault is pending
+ *
+ * @rs: current RAM state
+ * @offset: used to return the offset of the page within the block
+ */
+static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
+{
+    RAMBlock *block;
+    void *host;
+
+    if (!rs->write_tracking) {
+        return NULL;
+    }
+
+    while ((host = uffd_wp_read_fault(rs->uffd_wp_fd))) {
+        block = qemu_ram_block_from_host(host, false, offset);
+        if (block && (block->flags & RAM_UF_WRITEPROTECT)) {
+            *offset &= TARGET_PAGE_MASK;
+            return block;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * ram_save_release_protection: unprotect pages that have been saved
+ *
+ * The pages must already be copied into the stream, since the guest may
+ * modify them as soon as they are unprotected.
+ *
+ * @rs: current RAM state
+ * @pss: data about the state of the current dirty page scan
+ * @start_page: first page of the range, which ends before pss->page
+ */
+static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
+                                       unsigned long start_page)
+{
+    if (!rs->write_tracking || !(pss->block->flags & RAM_UF_WRITEPROTECT)) {
+        return 0;
+    }
+
+    return uffd_wp_protect(rs->uffd_wp_fd,
+                           pss->block->host + (start_page << TARGET_PAGE_BITS),
+                           (pss->page - start_page) << TARGET_PAGE_BITS,
+                           false);
+}
+
 /**
  * get_queued_page: unqueue a page from the postcopy requests
  *
@@ -1449,6 +1761,7 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
     RAMBlock  *block;
     ram_addr_t offset;
     bool dirty;
+    bool flush_multifd = false;
 
     do {
         block = unqueue_page(rs, &offset);
@@ -1466,6 +1779,8 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
             if (!dirty) {
                 trace_get_queued_page_not_dirty(block->idstr, (uint64_t)offset,
                                                 page);
+                /* It may still wait in the multifd queue */
+                flush_multifd = true;
             } else {
                 trace_get_queued_page(block->idstr, (uint64_t)offset, page);
             }
@@ -1473,6 +1788,15 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
 
     } while (block && !dirty);
 
+    if (!block) {
+        /* A background snapshot serves the vCPUs blocked on writes first */
+        block = poll_fault_page(rs, &offset);
+    }
+
+    if (flush_multifd && migration_in_postcopy()) {
+        multifd_send_queued_pages(rs->f);
+    }
+
     if (block) {
         /*
          * As soon as we start servicing pages out of order, then we have
@@ -1495,6 +1819,7 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
          * really rare.
          */
         pss->complete_round = false;
+        pss->postcopy_requested = true;
     }
 
     return !!block;
@@ -1653,16 +1978,49 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    /*
+     * Do not use multifd for:
+     * 1. Compression as the first page in the new block should be posted out
+     *    before sending the compressed page
+     * 2. In postcopy as one whole host page should be placed, unless the
+     *    host pages are target pages and the destination places them from
+     *    the multifd threads; pages it asked for have a channel of their own
+     */
+    bool use_multifd = !save_page_use_compression(rs) &&
+                       migrate_use_multifd() &&
+                       (!migration_in_postcopy() ||
+                        (migrate_postcopy_preempt() &&
+                         !pss->postcopy_requested &&
+                         qemu_ram_pagesize(block) == TARGET_PAGE_SIZE));
     int res;
 
     if (control_save_page(rs, block, offset, &res)) {
         return res;
     }
 
-    if (save_compress_page(rs, block, offset)) {
+    /*
+     * With mapped-ram zero pages are not written at all: the destination
+     * only loads the pages whose bit is set in the file bitmap.
+     */
+    if (migrate_mapped_ram()) {
+        if (is_zero_range(block->host + offset, TARGET_PAGE_SIZE)) {
+            clear_bit_atomic(offset >> TARGET_PAGE_BITS, block->file_bmap);
+            ram_counters.duplicate++;
+            return 1;
+        }
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
+    /* Requested pages are urgent, and may not go on the main channel */
+    if (!pss->postcopy_requested && save_compress_page(rs, block, offset)) {
         return 1;
     }
 
+    /* The multifd channels may look for zero pages themselves */
+    if (use_multifd && migrate_use_multifd_zero_page()) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
     res = save_zero_page(rs, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -1677,14 +2035,7 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return res;
     }
 
-    /*
-     * Do not use multifd for:
-     * 1. Compression as the first page in the new block should be posted out
-     *    before sending the compressed page
-     * 2. In postcopy as one whole host page should be placed
-     */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()
-        && !migration_in_postcopy()) {
+    if (use_multifd) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
@@ -1715,12 +2066,29 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
     int tmppages, pages = 0;
     size_t pagesize_bits =
         qemu_ram_pagesize(pss->block) >> TARGET_PAGE_BITS;
+    unsigned long start_page = pss->page;
+    QEMUFile *preempt_file = NULL;
+    QEMUFile *main_file = rs->f;
+    int ret;
 
     if (ramblock_is_ignored(pss->block)) {
         error_report("block %s should not be migrated !", pss->block->idstr);
         return 0;
     }
 
+    if (pss->postcopy_requested) {
+        preempt_file = migrate_get_current()->postcopy_qemufile_src;
+    }
+    if (preempt_file) {
+        /*
+         * Send the requested host page on the preempt channel.  Each
+         * channel has its own RAM_SAVE_FLAG_CONTINUE state, so forget the
+         * last block when switching.
+         */
+        rs->f = preempt_file;
+        rs->last_sent_block = NULL;
+    }
+
     do {
         /* Check the pages is dirty and if it is send it */
         if (!migration_bitmap_clear_dirty(rs, pss->block, pss->page)) {
@@ -1730,17 +2098,39 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
 
         tmppages = ram_save_target_page(rs, pss, last_stage);
         if (tmppages < 0) {
-            return tmppages;
+            pages = tmppages;
+            break;
         }
 
         pages += tmppages;
         pss->page++;
         /* Allow rate limiting to happen in the middle of huge pages */
-        migration_rate_limit();
+        if (!preempt_file) {
+            migration_rate_limit();
+        }
     } while ((pss->page & (pagesize_bits - 1)) &&
              offset_in_ramblock(pss->block,
                                 ((ram_addr_t)pss->page) << TARGET_PAGE_BITS));
 
+    ret = ram_save_release_protection(rs, pss, start_page);
+    if (ret < 0 && pages >= 0) {
+        pages = ret;
+    }
+
+    if (preempt_file) {
+        qemu_fflush(preempt_file);
+        rs->f = main_file;
+        rs->last_sent_block = NULL;
+        /* Let the migration thread notice a broken channel */
+        ret = qemu_file_get_error(preempt_file);
+        if (ret) {
+            qemu_file_set_error(main_file, ret);
+        }
+    }
+    if (pages < 0) {
+        return pages;
+    }
+
     /* The offset we leave with is the last one we looked at */
     pss->page--;
     return pages;
@@ -1782,6 +2172,7 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 
     do {
         again = true;
+        pss.postcopy_requested = false;
         found = get_queued_page(rs, &pss);
 
         if (!found) {
@@ -1854,6 +2245,7 @@ static void ram_state_cleanup(RAMState **rsp)
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
+        g_free((*rsp)->vcpu_dirty_pages_prev);
         g_free(*rsp);
         *rsp = NULL;
     }
@@ -1883,13 +2275,19 @@ static void ram_save_cleanup(void *opaque)
     /* caller have hold iothread lock or is in a bh, so there is
      * no writing race against the migration bitmap
      */
-    memory_global_dirty_log_stop();
+    if (migrate_background_snapshot()) {
+        ram_write_tracking_stop();
+    } else {
+        memory_global_dirty_log_stop();
+    }
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->clear_bmap);
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -2343,8 +2741,11 @@ static void ram_init_bitmaps(RAMState *rs)
 
     WITH_RCU_READ_LOCK_GUARD() {
         ram_list_init_bitmaps();
-        memory_global_dirty_log_start();
-        migration_bitmap_sync_precopy(rs);
+        /* A background snapshot saves every page once, without dirty log */
+        if (!migrate_background_snapshot()) {
+            memory_global_dirty_log_start();
+            migration_bitmap_sync_precopy(rs);
+        }
     }
     qemu_mutex_unlock_ramlist();
     qemu_mutex_unlock_iothread();
@@ -2463,6 +2864,59 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * @f: QEMUFile where to send the data
  * @opaque: RAMState pointer
  */
+/**
+ * mapped_ram_setup_ramblock: reserve the space of a block in the file
+ *
+ * Write the mapped-ram header of @block and skip over its bitmap and
+ * pages, that are filled in later.
+ *
+ * @f: QEMUFile where to send the data
+ * @block: block to lay out
+ */
+static void mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = DIV_ROUND_UP(num_pages, BITS_PER_BYTE);
+    off_t hdr_size = sizeof(uint32_t) + 3 * sizeof(uint64_t);
+
+    block->file_bmap = bitmap_new(num_pages);
+    block->bitmap_offset = qemu_get_offset(f) + hdr_size;
+    block->pages_offset = ROUND_UP(block->bitmap_offset + bitmap_size,
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    qemu_set_offset(f, block->pages_offset + block->used_length);
+}
+
+/**
+ * mapped_ram_save_bitmaps: write the file bitmap of each block
+ *
+ * Called once all the pages are in the file; the stream goes on after
+ * the last block.
+ *
+ * @f: QEMUFile where to send the data
+ */
+static void mapped_ram_save_bitmaps(QEMUFile *f)
+{
+    off_t end = qemu_get_offset(f);
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        g_autofree unsigned long *le_bitmap = bitmap_new(num_pages);
+
+        bitmap_to_le(le_bitmap, block->file_bmap, num_pages);
+        qemu_set_offset(f, block->bitmap_offset);
+        qemu_put_buffer(f, (uint8_t *)le_bitmap,
+                        DIV_ROUND_UP(num_pages, BITS_PER_BYTE));
+    }
+    qemu_set_offset(f, end);
+}
+
 static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
@@ -2495,6 +2949,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
@@ -2661,6 +3118,15 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     if (ret >= 0) {
         multifd_send_sync_main(rs->f);
+        if (migrate_mapped_ram()) {
+            WITH_RCU_READ_LOCK_GUARD() {
+                mapped_ram_save_bitmaps(f);
+            }
+            ret = qemu_file_get_error(f);
+        }
+    }
+
+    if (ret >= 0) {
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
     }
@@ -2738,12 +3204,16 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
  *
  * Returns a pointer from within the RCU-protected ram_list.
  *
+ * @mis: the incoming migration state
  * @f: QEMUFile where to read the data from
  * @flags: Page flags (mostly to see if it's a continuation of previous block)
+ * @channel: the channel @f belongs to
  */
-static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
+static inline RAMBlock *ram_block_from_stream(MigrationIncomingState *mis,
+                                              QEMUFile *f, int flags,
+                                              int channel)
 {
-    static RAMBlock *block;
+    RAMBlock *block = mis->last_recv_block[channel];
     char id[256];
     uint8_t len;
 
@@ -2760,6 +3230,7 @@ static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
     id[len] = 0;
 
     block = qemu_ram_block_by_name(id);
+    mis->last_recv_block[channel] = block;
     if (!block) {
         error_report("Can't find block %s", id);
         return NULL;
@@ -3174,19 +3645,23 @@ int ram_postcopy_incoming_init(MigrationIncomingState *mis)
  *
  * Returns 0 for success or -errno in case of error
  *
- * Called in postcopy mode by ram_load().
+ * Called in postcopy mode by ram_load(), and by the postcopy preempt
+ * thread for its own channel.
  * rcu_read_lock is taken prior to this being called.
  *
  * @f: QEMUFile where to send the data
+ * @channel: the channel @f belongs to
  */
-static int ram_load_postcopy(QEMUFile *f)
+int ram_load_postcopy(QEMUFile *f, int channel)
 {
     int flags = 0, ret = 0;
     bool place_needed = false;
     bool matches_target_page_size = false;
     MigrationIncomingState *mis = migration_incoming_get_current();
     /* Temporary page that is later 'placed' */
-    void *postcopy_host_page = mis->postcopy_tmp_page;
+    void *postcopy_host_page = channel == RAM_CHANNEL_POSTCOPY ?
+                               mis->postcopy_preempt_tmp_page :
+                               mis->postcopy_tmp_page;
     void *this_host = NULL;
     bool all_zero = true;
     int target_pages = 0;
@@ -3217,7 +3692,7 @@ static int ram_load_postcopy(QEMUFile *f)
         trace_ram_load_postcopy_loop((uint64_t)addr, flags);
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE)) {
-            block = ram_block_from_stream(f, flags);
+            block = ram_block_from_stream(mis, f, flags, channel);
 
             host = host_from_ram_block_offset(block, addr);
             if (!host) {
@@ -3309,7 +3784,9 @@ static int ram_load_postcopy(QEMUFile *f)
 
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
-            multifd_recv_sync_main();
+            if (channel == RAM_CHANNEL_PRECOPY) {
+                multifd_recv_sync_main();
+            }
             break;
         default:
             error_report("Unknown combination of migration flags: 0x%x"
@@ -3414,8 +3891,70 @@ void colo_flush_ram_cache(void)
  *
  * @f: QEMUFile where to send the data
  */
+/**
+ * parse_ramblock_mapped_ram: load a block saved with mapped-ram
+ *
+ * Returns 0 for success or negative for error
+ *
+ * @f: QEMUFile where to receive the data
+ * @block: block being loaded
+ * @length: size of the block in the stream
+ */
+static int parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                     ram_addr_t length)
+{
+    unsigned long num_pages = length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = DIV_ROUND_UP(num_pages, BITS_PER_BYTE);
+    g_autofree unsigned long *le_bitmap = NULL;
+    g_autofree unsigned long *bitmap = NULL;
+    uint64_t page_size, bitmap_offset;
+    Error *local_err = NULL;
+    uint32_t version;
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    bitmap_offset = qemu_get_be64(f);
+    block->pages_offset = qemu_get_be64(f);
+
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_report("Unsupported mapped-ram version %u for block %s",
+                     version, block->idstr);
+        return -EINVAL;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_report("Mismatched mapped-ram page size %" PRIu64
+                     " for block %s", page_size, block->idstr);
+        return -EINVAL;
+    }
+    if (bitmap_offset != qemu_get_offset(f) ||
+        block->pages_offset < bitmap_offset + bitmap_size) {
+        error_report("Invalid mapped-ram offsets for block %s",
+                     block->idstr);
+        return -EINVAL;
+    }
+
+    le_bitmap = bitmap_new(num_pages);
+    bitmap = bitmap_new(num_pages);
+    if (qemu_get_buffer(f, (uint8_t *)le_bitmap, bitmap_size) !=
+        bitmap_size) {
+        error_report("Truncated mapped-ram bitmap for block %s",
+                     block->idstr);
+        return -EINVAL;
+    }
+    bitmap_from_le(bitmap, le_bitmap, num_pages);
+
+    if (file_read_ramblock(block, bitmap, &local_err) < 0) {
+        error_report_err(local_err);
+        return -EIO;
+    }
+
+    qemu_set_offset(f, block->pages_offset + length);
+    return qemu_file_get_error(f);
+}
+
 static int ram_load_precopy(QEMUFile *f)
 {
+    MigrationIncomingState *mis = migration_incoming_get_current();
     int flags = 0, ret = 0, invalid_flags = 0, len = 0, i = 0;
     /* ADVISE is earlier, it shows the source has the postcopy capability on */
     bool postcopy_advised = postcopy_is_advised();
@@ -3454,7 +3993,8 @@ static int ram_load_precopy(QEMUFile *f)
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(f, flags);
+            RAMBlock *block = ram_block_from_stream(mis, f, flags,
+                                                    RAM_CHANNEL_PRECOPY);
 
             host = host_from_ram_block_offset(block, addr);
             /*
@@ -3543,6 +4083,9 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = parse_ramblock_mapped_ram(f, block, length);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -3631,7 +4174,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
      */
     WITH_RCU_READ_LOCK_GUARD() {
         if (postcopy_running) {
-            ret = ram_load_postcopy(f);
+            ret = ram_load_postcopy(f, RAM_CHANNEL_PRECOPY);
         } else {
             ret = ram_load_precopy(f);
         }
@@ -56,6 +56,12 @@
 
 #define RDMA_REG_CHUNK_SHIFT 20 /* 1 MB */
 
+/*
+ * Without rdma-pin-all, the source keeps at most this many chunks
+ * registered, unregistering the least recently used ones beyond it.
+ */
+#define RDMA_REG_CACHE_MAX 8192 /* 8 GB */
+
 /*
  * This is only for non-live state being migrated.
  * Instead of RDMA_WRITE messages, we use RDMA_SEND
@@ -208,6 +214,11 @@ static void network_to_caps(RDMACapabilities *cap)
  * because we're using a single IB message to transmit
  * the information. It's small anyway, so a list is overkill.
  */
+/* Position of a registered chunk in the registration LRU */
+typedef struct RDMARegCacheEntry {
+    QTAILQ_ENTRY(RDMARegCacheEntry) next;
+} RDMARegCacheEntry;
+
 typedef struct RDMALocalBlock {
     char          *block_name;
     uint8_t       *local_host_addr; /* local virtual address */
@@ -224,6 +235,7 @@ typedef struct RDMALocalBlock {
     int            nb_chunks;
     unsigned long *transit_bitmap;
     unsigned long *unregister_bitmap;
+    RDMARegCacheEntry *reg_cache;   /* LRU links of chunk registrations */
 } RDMALocalBlock;
 
 /*
@@ -391,6 +403,10 @@ typedef struct RDMAContext {
     int unregister_current, unregister_next;
     uint64_t unregistrations[RDMA_SIGNALED_SEND_MAX];
 
+    /* Chunks registered by the source, least recently used first */
+    QTAILQ_HEAD(, RDMARegCacheEntry) reg_lru;
+    int reg_lru_len;
+
     GHashTable *blockmap;
 
     /* the RDMAContext for return path */
@@ -678,12 +694,19 @@ static int rdma_delete_block(RDMAContext *rdma, RDMALocalBlock *block)
             if (!block->pmr[j]) {
                 continue;
             }
+            if (block->reg_cache &&
+                QTAILQ_IN_USE(&block->reg_cache[j], next)) {
+                QTAILQ_REMOVE(&rdma->reg_lru, &block->reg_cache[j], next);
+                rdma->reg_lru_len--;
+            }
             ibv_dereg_mr(block->pmr[j]);
             rdma->total_registrations--;
         }
         g_free(block->pmr);
         block->pmr = NULL;
     }
+    g_free(block->reg_cache);
+    block->reg_cache = NULL;
 
     if (block->mr) {
         ibv_dereg_mr(block->mr);
@@ -1183,6 +1206,58 @@ static int qemu_rdma_search_ram_block(RDMAContext *rdma,
  * Also return the keys associated with the registration needed
  * to perform the actual RDMA operation.
  */
+static void qemu_rdma_signal_unregister(RDMAContext *rdma, uint64_t index,
+                                        uint64_t chunk, uint64_t wr_id);
+
+/* Mark @chunk of @block as the most recently used registration */
+static void qemu_rdma_reg_cache_touch(RDMAContext *rdma, RDMALocalBlock *block,
+                                      int chunk)
+{
+    RDMARegCacheEntry *entry;
+
+    if (!block->reg_cache) {
+        block->reg_cache = g_new0(RDMARegCacheEntry, block->nb_chunks);
+    }
+    entry = &block->reg_cache[chunk];
+    if (QTAILQ_IN_USE(entry, next)) {
+        QTAILQ_REMOVE(&rdma->reg_lru, entry, next);
+    } else {
+        rdma->reg_lru_len++;
+    }
+    QTAILQ_INSERT_TAIL(&rdma->reg_lru, entry, next);
+}
+
+/*
+ * Queue the least recently used registrations for unregistration until
+ * the cache is back to RDMA_REG_CACHE_MAX chunks.  The unregistration
+ * itself happens in qemu_rdma_unregister_waiting().
+ */
+static void qemu_rdma_reg_cache_evict(RDMAContext *rdma)
+{
+    RDMALocalBlocks *local = &rdma->local_ram_blocks;
+    RDMARegCacheEntry *entry;
+    RDMALocalBlock *block;
+    int i;
+
+    while (rdma->reg_lru_len > RDMA_REG_CACHE_MAX &&
+           !rdma->unregistrations[rdma->unregister_next]) {
+        entry = QTAILQ_FIRST(&rdma->reg_lru);
+        for (i = 0; i < local->nb_blocks; i++) {
+            block = &local->block[i];
+            if (block->reg_cache && entry >= block->reg_cache &&
+                entry < block->reg_cache + block->nb_chunks) {
+                break;
+            }
+        }
+        assert(i < local->nb_blocks);
+
+        QTAILQ_REMOVE(&rdma->reg_lru, entry, next);
+        rdma->reg_lru_len--;
+        qemu_rdma_signal_unregister(rdma, i, entry - block->reg_cache,
+                                    RDMA_WRID_RDMA_WRITE);
+    }
+}
+
 static int qemu_rdma_register_and_get_keys(RDMAContext *rdma,
         RDMALocalBlock *block, uintptr_t host_addr,
         uint32_t *lkey, uint32_t *rkey, int chunk,
@@ -1233,6 +1308,12 @@ static int qemu_rdma_register_and_get_keys(RDMAContext *rdma,
         rdma->total_registrations++;
     }
 
+    /* Only the source decides when chunks are unregistered */
+    if (lkey && !rdma->pin_all) {
+        qemu_rdma_reg_cache_touch(rdma, block, chunk);
+        qemu_rdma_reg_cache_evict(rdma);
+    }
+
     if (lkey) {
         *lkey = block->pmr[chunk]->lkey;
     }
@@ -1292,15 +1373,15 @@ const char *print_wrid(int wrid)
 /* #define RDMA_UNREGISTRATION_EXAMPLE */
 
 /*
- * Perform a non-optimized memory unregistration after every transfer
- * for demonstration purposes, only if pin-all is not requested.
+ * Unregister the chunks queued by qemu_rdma_signal_unregister(), i.e.
+ * those evicted from the registration LRU (or all of them with
+ * RDMA_UNREGISTRATION_EXAMPLE), only if pin-all is not requested.
  *
  * Potential optimizations:
  * 1. Start a new thread to run this function continuously
         - for bit clearing
         - and for receipt of unregister messages
- * 2. Use an LRU.
- * 3. Use workload hints.
+ * 2. Use workload hints.
  */
 static int qemu_rdma_unregister_waiting(RDMAContext *rdma)
 {
@@ -1343,6 +1424,10 @@ static int qemu_rdma_unregister_waiting(RDMAContext *rdma)
 
         if (test_bit(chunk, block->transit_bitmap)) {
             trace_qemu_rdma_unregister_waiting_inflight(chunk);
+            if (block->reg_cache && block->pmr && block->pmr[chunk]) {
+                /* Keep tracking it, to be evicted again later */
+                qemu_rdma_reg_cache_touch(rdma, block, chunk);
+            }
             continue;
         }
 
@@ -2017,9 +2102,10 @@ retry:
     chunk_end = ram_chunk_end(block, chunk + chunks);
 
     if (!rdma->pin_all) {
-#ifdef RDMA_UNREGISTRATION_EXAMPLE
-        qemu_rdma_unregister_waiting(rdma);
-#endif
+        ret = qemu_rdma_unregister_waiting(rdma);
+        if (ret < 0) {
+            return ret;
+        }
     }
 
     while (test_bit(chunk, block->transit_bitmap)) {
@@ -2641,6 +2727,7 @@ static void *qemu_rdma_data_init(const char *host_port, Error **errp)
         rdma = g_new0(RDMAContext, 1);
         rdma->current_index = -1;
         rdma->current_chunk = -1;
+        QTAILQ_INIT(&rdma->reg_lru);
 
         addr = g_new(InetSocketAddress, 1);
         if (!inet_parse(addr, host_port, NULL)) {
@@ -62,6 +62,7 @@
 #include "migration/colo.h"
 #include "qemu/bitmap.h"
 #include "net/announce.h"
+#include "hw/vmstate-if.h"
 
 const unsigned int postcopy_ram_discard_version;
 
@@ -84,6 +85,7 @@ enum qemu_vm_cmd {
     MIG_CMD_ENABLE_COLO,       /* Enable COLO */
     MIG_CMD_POSTCOPY_RESUME,   /* resume postcopy on dest */
     MIG_CMD_RECV_BITMAP,       /* Request for recved bitmap on dst */
+    MIG_CMD_DEVICE_STATE,      /* Sections that can be loaded in parallel */
     MIG_CMD_MAX
 };
 
@@ -103,6 +105,7 @@ static struct mig_cmd_args {
     [MIG_CMD_POSTCOPY_RESUME]  = { .len =  0, .name = "POSTCOPY_RESUME" },
     [MIG_CMD_PACKAGED]         = { .len =  4, .name = "PACKAGED" },
     [MIG_CMD_RECV_BITMAP]      = { .len = -1, .name = "RECV_BITMAP" },
+    [MIG_CMD_DEVICE_STATE]     = { .len =  4, .name = "DEVICE_STATE" },
     [MIG_CMD_MAX]              = { .len = -1, .name = "MAX" },
 };
 
@@ -1352,21 +1355,229 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     return 0;
 }
 
-static
+/*
+ * Sections whose VMStateDescription is marked as parallel are saved and
+ * loaded by a small pool of threads, each of them taking the next job
+ * until none is left.  The state of each section goes to its own buffer.
+ */
+typedef struct DeviceStateJob {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    QJSON *vmdesc;
+    int ret;
+} DeviceStateJob;
+
+typedef struct DeviceStateJobs {
+    DeviceStateJob *jobs;
+    int count;
+    /* index of the next job to run, taken atomically */
+    int next;
+    void (*run)(DeviceStateJob *job);
+} DeviceStateJobs;
+
+static void device_state_jobs_work(DeviceStateJobs *jobs)
+{
+    int i;
+
+    while ((i = qatomic_fetch_inc(&jobs->next)) < jobs->count) {
+        jobs->run(&jobs->jobs[i]);
+    }
+}
+
+static void *device_state_jobs_thread(void *opaque)
+{
+    rcu_register_thread();
+    device_state_jobs_work(opaque);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * Run all the jobs using up to device-state-threads threads, the calling
+ * thread included.
+ */
+static void device_state_jobs_run(DeviceStateJobs *jobs)
+{
+    int nthreads = MIN(migrate_device_state_threads(), jobs->count) - 1;
+    g_autofree QemuThread *threads = NULL;
+    int i;
+
+    trace_device_state_jobs_run(jobs->count, nthreads + 1);
+    threads = g_new(QemuThread, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        qemu_thread_create(&threads[i], "devstate", device_state_jobs_thread,
+                           jobs, QEMU_THREAD_JOINABLE);
+    }
+    device_state_jobs_work(jobs);
+    for (i = 0; i < nthreads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+}
+
+static void device_state_jobs_free(DeviceStateJobs *jobs)
+{
+    int i;
+
+    for (i = 0; i < jobs->count; i++) {
+        if (jobs->jobs[i].vmdesc) {
+            qjson_destroy(jobs->jobs[i].vmdesc);
+        }
+        /* this also frees the buffer */
+        qemu_fclose(jobs->jobs[i].f);
+    }
+    g_free(jobs->jobs);
+}
+
+static void device_state_save_job(DeviceStateJob *job)
+{
+    SaveStateEntry *se = job->se;
+    QEMUFile *f = job->f;
+
+    trace_savevm_section_start(se->idstr, se->section_id);
+
+    json_prop_str(job->vmdesc, "name", se->idstr);
+    json_prop_int(job->vmdesc, "instance_id", se->instance_id);
+
+    save_section_header(f, se, QEMU_VM_SECTION_FULL);
+    job->ret = vmstate_save(f, se, job->vmdesc);
+    trace_savevm_section_end(se->idstr, se->section_id, job->ret);
+    save_section_footer(f, se);
+    qjson_finish(job->vmdesc);
+
+    /* bioc->data is read directly by the migration thread */
+    qemu_fflush(f);
+    if (!job->ret) {
+        job->ret = qemu_file_get_error(f);
+    }
+}
+
+/*
+ * Save the state of all the parallel sections that have to be sent into
+ * @jobs, in the order of savevm_state.handlers.
+ *
+ * Returns 0 on success, or the first error met by a section.
+ */
+static int qemu_savevm_parallel_sections(DeviceStateJobs *jobs)
+{
+    SaveStateEntry *se;
+    int i;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (se->vmsd && se->vmsd->parallel &&
+            vmstate_save_needed(se->vmsd, se->opaque)) {
+            jobs->count++;
+        }
+    }
+    if (!jobs->count) {
+        return 0;
+    }
+
+    jobs->jobs = g_new0(DeviceStateJob, jobs->count);
+    jobs->run = device_state_save_job;
+    i = 0;
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (se->vmsd && se->vmsd->parallel &&
+            vmstate_save_needed(se->vmsd, se->opaque)) {
+            DeviceStateJob *job = &jobs->jobs[i++];
+
+            job->se = se;
+            job->bioc = qio_channel_buffer_new(4096);
+            qio_channel_set_name(QIO_CHANNEL(job->bioc),
+                                 "migration-device-state");
+            job->f = qemu_fopen_channel_output(QIO_CHANNEL(job->bioc));
+            object_unref(OBJECT(job->bioc));
+            job->vmdesc = qjson_new();
+        }
+    }
+
+    device_state_jobs_run(jobs);
+
+    for (i = 0; i < jobs->count; i++) {
+        if (jobs->jobs[i].ret) {
+            return jobs->jobs[i].ret;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Send the @count sections saved by @jobs.  More than one section goes
+ * in a MIG_CMD_DEVICE_STATE command, so that the destination can load
+ * them in parallel too; the command is followed by the size and data of
+ * each section.
+ */
+static int qemu_savevm_send_device_state(QEMUFile *f, DeviceStateJob *jobs,
+                                         int count, QJSON *vmdesc)
+{
+    uint32_t tmp;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (jobs[i].bioc->usage > MAX_VM_CMD_PACKAGED_SIZE) {
+            error_report("%s: Unreasonably large state for %s: %zu",
+                         __func__, jobs[i].se->idstr, jobs[i].bioc->usage);
+            return -EINVAL;
+        }
+    }
+
+    if (count > 1) {
+        trace_qemu_savevm_send_device_state(count);
+        tmp = cpu_to_be32(count);
+        qemu_savevm_command_send(f, MIG_CMD_DEVICE_STATE, 4, (uint8_t *)&tmp);
+    }
+    for (i = 0; i < count; i++) {
+        if (count > 1) {
+            qemu_put_be32(f, jobs[i].bioc->usage);
+        }
+        qemu_put_buffer(f, jobs[i].bioc->data, jobs[i].bioc->usage);
+        json_prop_raw(vmdesc, NULL, qjson_get_str(jobs[i].vmdesc));
+    }
+
+    return qemu_file_get_error(f);
+}
+
 int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool in_postcopy,
                                                     bool inactivate_disks)
 {
     g_autoptr(QJSON) vmdesc = NULL;
+    DeviceStateJobs jobs = { 0 };
     int vmdesc_len;
     SaveStateEntry *se;
+    /* parallel sections saved in jobs and not sent yet */
+    int first_job = 0, next_job = 0;
     int ret;
 
+    if (migrate_parallel_device_state()) {
+        ret = qemu_savevm_parallel_sections(&jobs);
+        if (ret) {
+            goto out;
+        }
+    }
+
     vmdesc = qjson_new();
     json_prop_int(vmdesc, "page_size", qemu_target_page_size());
     json_start_array(vmdesc, "devices");
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
 
+        if (next_job < jobs.count && jobs.jobs[next_job].se == se) {
+            next_job++;
+            continue;
+        }
+        /*
+         * Sections must be loaded in the order they are saved, so only
+         * consecutive parallel sections are sent together.
+         */
+        if (first_job < next_job) {
+            ret = qemu_savevm_send_device_state(f, &jobs.jobs[first_job],
+                                                next_job - first_job, vmdesc);
+            if (ret) {
+                goto out;
+            }
+            first_job = next_job;
+        }
+
         if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
             continue;
         }
@@ -1384,14 +1595,21 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         save_section_header(f, se, QEMU_VM_SECTION_FULL);
         ret = vmstate_save(f, se, vmdesc);
         if (ret) {
-            qemu_file_set_error(f, ret);
-            return ret;
+            goto out;
         }
         trace_savevm_section_end(se->idstr, se->section_id, 0);
         save_section_footer(f, se);
 
         json_end_object(vmdesc);
     }
+    if (first_job < next_job) {
+        ret = qemu_savevm_send_device_state(f, &jobs.jobs[first_job],
+                                            next_job - first_job, vmdesc);
+        if (ret) {
+            goto out;
+        }
+    }
+    device_state_jobs_free(&jobs);
 
     if (inactivate_disks) {
         /* Inactivate before sending QEMU_VM_EOF so that the
@@ -1420,6 +1638,11 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
     }
 
     return 0;
+
+out:
+    device_state_jobs_free(&jobs);
+    qemu_file_set_error(f, ret);
+    return ret;
 }
 
 int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
@@ -1930,6 +2153,8 @@ static int loadvm_postcopy_handle_listen(MigrationIncomingState *mis)
             postcopy_ram_incoming_cleanup(mis);
             return -1;
         }
+        /* Pages from the preempt and multifd channels can be placed now */
+        qemu_event_set(&mis->postcopy_listen_event);
     }
 
     if (postcopy_notify(POSTCOPY_NOTIFY_INBOUND_LISTEN, &local_err)) {
@@ -2207,6 +2432,92 @@ static int loadvm_process_enable_colo(MigrationIncomingState *mis)
     return ret;
 }
 
+static int qemu_loadvm_section_start_full(QEMUFile *f,
+                                          MigrationIncomingState *mis);
+
+static void device_state_load_job(DeviceStateJob *job)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    uint8_t section_type;
+
+    section_type = qemu_get_byte(job->f);
+    if (section_type != QEMU_VM_SECTION_FULL) {
+        error_report("Unexpected section type %d in device state",
+                     section_type);
+        job->ret = -EINVAL;
+        return;
+    }
+    job->ret = qemu_loadvm_section_start_full(job->f, mis);
+}
+
+/**
+ * Immediately following this command are @count sections, each of them
+ * preceded by its size.  Read them all, and load them in parallel.
+ *
+ * @f: File the command was received on
+ *
+ * Returns: Negative values on error
+ *
+ */
+static int loadvm_handle_device_state(QEMUFile *f)
+{
+    DeviceStateJobs jobs = { .run = device_state_load_job };
+    SaveStateEntry *se;
+    uint32_t count, i;
+    size_t max = 0;
+    int ret = 0;
+
+    count = qemu_get_be32(f);
+    trace_loadvm_handle_device_state(count);
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        max++;
+    }
+    if (count > max) {
+        error_report("CMD_DEVICE_STATE: Too many sections: %u", count);
+        return -EINVAL;
+    }
+
+    jobs.jobs = g_new0(DeviceStateJob, count);
+    for (i = 0; i < count; i++) {
+        DeviceStateJob *job = &jobs.jobs[i];
+        size_t length = qemu_get_be32(f);
+
+        if (length > MAX_VM_CMD_PACKAGED_SIZE) {
+            error_report("Unreasonably large device state: %zu", length);
+            ret = -EINVAL;
+            goto out;
+        }
+
+        job->bioc = qio_channel_buffer_new(length);
+        qio_channel_set_name(QIO_CHANNEL(job->bioc), "migration-device-state");
+        job->f = qemu_fopen_channel_input(QIO_CHANNEL(job->bioc));
+        object_unref(OBJECT(job->bioc));
+        jobs.count++;
+
+        if (qemu_get_buffer(f, job->bioc->data, length) != length) {
+            ret = qemu_file_get_error(f) ?: -EIO;
+            error_report("CMD_DEVICE_STATE: Buffer receive fail ret=%d "
+                         "length=%zu", ret, length);
+            goto out;
+        }
+        job->bioc->usage = length;
+    }
+
+    device_state_jobs_run(&jobs);
+
+    for (i = 0; i < count; i++) {
+        if (jobs.jobs[i].ret < 0) {
+            ret = jobs.jobs[i].ret;
+            break;
+        }
+    }
+
+out:
+    device_state_jobs_free(&jobs);
+    return ret;
+}
+
 /*
  * Process an incoming 'QEMU_VM_COMMAND'
  * 0           just a normal return
@@ -2289,6 +2600,9 @@ static int loadvm_process_command(QEMUFile *f)
 
     case MIG_CMD_ENABLE_COLO:
         return loadvm_process_enable_colo(mis);
+
+    case MIG_CMD_DEVICE_STATE:
+        return loadvm_handle_device_state(f);
     }
 
     return 0;
@@ -2725,6 +3039,191 @@ int qemu_load_device_state(QEMUFile *f)
     return 0;
 }
 
+/*
+ * One device's state, pre-serialized so that it can be loaded on its own.
+ * Devices that own a memory region are only reloaded if they were touched
+ * since the snapshot; the others cannot be tracked and always are.
+ */
+typedef struct DeviceSnapshotEntry {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *in;
+    bool tracked;
+} DeviceSnapshotEntry;
+
+struct DeviceSnapshot {
+    QIOChannelBuffer *bioc;
+    QEMUFile *out;
+    QEMUFile *in;
+    GArray *entries;
+};
+
+static int device_snapshot_add_owner(Object *obj, void *opaque)
+{
+    MemoryRegion *mr = (MemoryRegion *)object_dynamic_cast(obj,
+                                                   TYPE_MEMORY_REGION);
+
+    if (mr && mr->owner) {
+        g_hash_table_add(opaque, mr->owner);
+    }
+    return 0;
+}
+
+static void device_snapshot_clear_entries(DeviceSnapshot *ds)
+{
+    int i;
+
+    for (i = 0; i < ds->entries->len; i++) {
+        qemu_fclose(g_array_index(ds->entries, DeviceSnapshotEntry, i).in);
+    }
+    g_array_set_size(ds->entries, 0);
+}
+
+/* Save each device on its own, as qemu_save_device_state() would. */
+static int device_snapshot_save_entries(DeviceSnapshot *ds)
+{
+    QIOChannelBuffer *scratch = qio_channel_buffer_new(4096);
+    QEMUFile *out = qemu_fopen_channel_output(QIO_CHANNEL(scratch));
+    GHashTable *owners = g_hash_table_new(NULL, NULL);
+    SaveStateEntry *se;
+    int ret = 0;
+
+    object_child_foreach_recursive(object_get_root(),
+                                   device_snapshot_add_owner, owners);
+    device_snapshot_clear_entries(ds);
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        DeviceSnapshotEntry e = {
+            .se = se,
+            .tracked = g_hash_table_contains(owners, se->opaque),
+        };
+
+        if (se->is_ram) {
+            continue;
+        }
+        if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
+            continue;
+        }
+        if (se->vmsd && !vmstate_save_needed(se->vmsd, se->opaque)) {
+            continue;
+        }
+
+        scratch->usage = 0;
+        qio_channel_io_seek(QIO_CHANNEL(scratch), 0, 0, NULL);
+        ret = vmstate_save(out, se, NULL);
+        qemu_fflush(out);
+        ret = ret ? ret : qemu_file_get_error(out);
+        if (ret) {
+            break;
+        }
+
+        e.bioc = qio_channel_buffer_new(scratch->usage);
+        memcpy(e.bioc->data, scratch->data, scratch->usage);
+        e.bioc->usage = scratch->usage;
+        e.in = qemu_fopen_channel_input(QIO_CHANNEL(e.bioc));
+        object_unref(OBJECT(e.bioc));
+        g_array_append_val(ds->entries, e);
+    }
+
+    qemu_fclose(out);
+    object_unref(OBJECT(scratch));
+    g_hash_table_unref(owners);
+    return ret;
+}
+
+/*
+ * In-memory copy of the non-RAM device state, in the spirit of the COLO
+ * checkpoint buffer.  The caller is responsible for guest RAM.
+ */
+DeviceSnapshot *device_snapshot_new(size_t size)
+{
+    DeviceSnapshot *ds = g_new0(DeviceSnapshot, 1);
+
+    ds->bioc = qio_channel_buffer_new(size);
+    ds->out = qemu_fopen_channel_output(QIO_CHANNEL(ds->bioc));
+    ds->in = qemu_fopen_channel_input(QIO_CHANNEL(ds->bioc));
+    object_unref(OBJECT(ds->bioc));
+    ds->entries = g_array_new(false, false, sizeof(DeviceSnapshotEntry));
+    return ds;
+}
+
+/*
+ * Called with the iothread lock held; replaces the previous contents.
+ * From here on, the devices that run are tracked for
+ * device_snapshot_load_dirty().
+ */
+int device_snapshot_save(DeviceSnapshot *ds)
+{
+    int ret;
+
+    ds->bioc->usage = 0;
+    qio_channel_io_seek(QIO_CHANNEL(ds->bioc), 0, 0, NULL);
+    ret = qemu_save_device_state(ds->out);
+    qemu_fflush(ds->out);
+    ret = ret ? ret : qemu_file_get_error(ds->out);
+    if (!ret) {
+        ret = device_snapshot_save_entries(ds);
+    }
+
+    if (!device_snapshot_touched) {
+        device_snapshot_touched = g_hash_table_new(NULL, NULL);
+    }
+    g_hash_table_remove_all(device_snapshot_touched);
+    return ret;
+}
+
+/* Called with the iothread lock held. */
+int device_snapshot_load(DeviceSnapshot *ds)
+{
+    qio_channel_io_seek(QIO_CHANNEL(ds->bioc), 0, 0, NULL);
+    if (qemu_get_be32(ds->in) != QEMU_VM_FILE_MAGIC ||
+        qemu_get_be32(ds->in) != QEMU_VM_FILE_VERSION) {
+        error_report("Device snapshot is corrupted");
+        return -EINVAL;
+    }
+    if (device_snapshot_touched) {
+        g_hash_table_remove_all(device_snapshot_touched);
+    }
+    return qemu_load_device_state(ds->in);
+}
+
+/*
+ * Like device_snapshot_load(), but skip the devices whose MMIO/PIO
+ * handlers and input lines were not used since the last save or load:
+ * their state is still the saved one.  Called with the iothread lock held.
+ */
+int device_snapshot_load_dirty(DeviceSnapshot *ds)
+{
+    int i, ret;
+
+    for (i = 0; i < ds->entries->len; i++) {
+        DeviceSnapshotEntry *e = &g_array_index(ds->entries,
+                                                DeviceSnapshotEntry, i);
+
+        if (e->tracked &&
+            !g_hash_table_contains(device_snapshot_touched, e->se->opaque)) {
+            continue;
+        }
+
+        qio_channel_io_seek(QIO_CHANNEL(e->bioc), 0, 0, NULL);
+        e->se->load_version_id = e->se->version_id;
+        ret = vmstate_load(e->in, e->se);
+        if (ret < 0) {
+            error_report("Failed to load %s state: %d", e->se->idstr, ret);
+            return ret;
+        }
+    }
+
+    g_hash_table_remove_all(device_snapshot_touched);
+    cpu_synchronize_all_post_init();
+    return 0;
+}
+
+size_t device_snapshot_size(DeviceSnapshot *ds)
+{
+    return ds->bioc->usage;
+}
+
 int save_snapshot(const char *name, Error **errp)
 {
     BlockDriverState *bs, *bs1;
@@ -119,11 +119,31 @@ static void migration_tls_outgoing_handshake(QIOTask *task,
         trace_migration_tls_outgoing_handshake_error(error_get_pretty(err));
     } else {
         trace_migration_tls_outgoing_handshake_complete();
+        if (migrate_tls_offload()) {
+            migration_tls_enable_offload(QIO_CHANNEL_TLS(ioc));
+        }
     }
     migration_channel_connect(s, ioc, NULL, err);
     object_unref(OBJECT(ioc));
 }
 
+/*
+ * Hand the encryption of outgoing data over to the kernel.  This is
+ * only an optimization: when the kernel, the cipher or the channel
+ * does not allow it, GNUTLS keeps doing the work.
+ */
+void migration_tls_enable_offload(QIOChannelTLS *tioc)
+{
+    Error *err = NULL;
+
+    if (qio_channel_tls_enable_ktls_tx(tioc, &err) < 0) {
+        trace_migration_tls_offload_error(error_get_pretty(err));
+        error_free(err);
+        return;
+    }
+    trace_migration_tls_offload_enabled(tioc);
+}
+
 QIOChannelTLS *migration_tls_client_create(MigrationState *s,
                                            QIOChannel *ioc,
                                            const char *hostname,
@@ -33,6 +33,8 @@ QIOChannelTLS *migration_tls_client_create(MigrationState *s,
                                            const char *hostname,
                                            Error **errp);
 
+void migration_tls_enable_offload(QIOChannelTLS *tioc);
+
 void migration_tls_channel_connect(MigrationState *s,
                                    QIOChannel *ioc,
                                    const char *hostname,
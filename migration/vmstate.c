@@ -16,6 +16,7 @@
 #include "savevm.h"
 #include "qemu-file.h"
 #include "qemu/bitops.h"
+#include "qemu/bswap.h"
 #include "qemu/error-report.h"
 #include "trace.h"
 #include "qjson.h"
@@ -75,6 +76,120 @@ static void vmstate_handle_alloc(void *ptr, const VMStateField *field,
     }
 }
 
+/*
+ * Arrays of plain integers are transferred in bulk through a bounce
+ * buffer, instead of calling the VMStateInfo accessors once per element.
+ * The stream format is the same: big endian elements back to back.
+ */
+#define VMSTATE_BOUNCE_SIZE 1024
+
+/* Return the element size if @field is an array of plain integers */
+static int vmstate_plain_elem_size(const VMStateField *field, int size,
+                                   int n_elems)
+{
+    static const struct {
+        const VMStateInfo *info;
+        int size;
+    } plain[] = {
+        { &vmstate_info_int8, 1 },
+        { &vmstate_info_uint8, 1 },
+        { &vmstate_info_int16, 2 },
+        { &vmstate_info_uint16, 2 },
+        { &vmstate_info_int32, 4 },
+        { &vmstate_info_uint32, 4 },
+        { &vmstate_info_int64, 8 },
+        { &vmstate_info_uint64, 8 },
+    };
+    int i;
+
+    if (n_elems <= 1 ||
+        (field->flags & (VMS_STRUCT | VMS_VSTRUCT | VMS_ARRAY_OF_POINTER))) {
+        return 0;
+    }
+    for (i = 0; i < ARRAY_SIZE(plain); i++) {
+        if (field->info == plain[i].info) {
+            return size == plain[i].size ? size : 0;
+        }
+    }
+    return 0;
+}
+
+static void vmstate_save_plain(QEMUFile *f, const uint8_t *src, int size,
+                               int n_elems)
+{
+    uint8_t buf[VMSTATE_BOUNCE_SIZE];
+    int i, n;
+
+    if (size == 1) {
+        qemu_put_buffer(f, src, n_elems);
+        return;
+    }
+    while (n_elems > 0) {
+        n = MIN(n_elems, VMSTATE_BOUNCE_SIZE / size);
+        switch (size) {
+        case 2:
+            for (i = 0; i < n; i++) {
+                stw_be_p(buf + i * 2, lduw_he_p(src + i * 2));
+            }
+            break;
+        case 4:
+            for (i = 0; i < n; i++) {
+                stl_be_p(buf + i * 4, ldl_he_p(src + i * 4));
+            }
+            break;
+        case 8:
+            for (i = 0; i < n; i++) {
+                stq_be_p(buf + i * 8, ldq_he_p(src + i * 8));
+            }
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        qemu_put_buffer(f, buf, n * size);
+        src += n * size;
+        n_elems -= n;
+    }
+}
+
+static void vmstate_load_plain(QEMUFile *f, uint8_t *dst, int size,
+                               int n_elems)
+{
+    uint8_t buf[VMSTATE_BOUNCE_SIZE];
+    int i, n;
+
+    if (size == 1) {
+        qemu_get_buffer(f, dst, n_elems);
+        return;
+    }
+    while (n_elems > 0) {
+        n = MIN(n_elems, VMSTATE_BOUNCE_SIZE / size);
+        if (qemu_get_buffer(f, buf, n * size) != n * size) {
+            return;
+        }
+        switch (size) {
+        case 2:
+            for (i = 0; i < n; i++) {
+                stw_he_p(dst + i * 2, lduw_be_p(buf + i * 2));
+            }
+            break;
+        case 4:
+            for (i = 0; i < n; i++) {
+                stl_he_p(dst + i * 4, ldl_be_p(buf + i * 4));
+            }
+            break;
+        case 8:
+            for (i = 0; i < n; i++) {
+                stq_he_p(dst + i * 8, ldq_be_p(buf + i * 8));
+            }
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        dst += n * size;
+        n_elems -= n;
+    }
+}
+
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id)
 {
@@ -123,6 +238,18 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                 first_elem = *(void **)first_elem;
                 assert(first_elem || !n_elems || !size);
             }
+            if (vmstate_plain_elem_size(field, size, n_elems)) {
+                vmstate_load_plain(f, first_elem, size, n_elems);
+                ret = qemu_file_get_error(f);
+                if (ret < 0) {
+                    error_report("Failed to load %s:%s", vmsd->name,
+                                 field->name);
+                    trace_vmstate_load_field_error(field->name, ret);
+                    return ret;
+                }
+                field++;
+                continue;
+            }
             for (i = 0; i < n_elems; i++) {
                 void *curr_elem = first_elem + size * i;
 
@@ -360,6 +487,15 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
                 first_elem = *(void **)first_elem;
                 assert(first_elem || !n_elems || !size);
             }
+            /* The description of a compressed array has its first element */
+            if (vmstate_plain_elem_size(field, size, n_elems) &&
+                (!vmdesc || vmsd_can_compress(field))) {
+                vmsd_desc_field_start(vmsd, vmdesc, field, 0, n_elems);
+                vmstate_save_plain(f, first_elem, size, n_elems);
+                vmsd_desc_field_end(vmsd, vmdesc, field, size, 0);
+                field++;
+                continue;
+            }
             for (i = 0; i < n_elems; i++) {
                 void *curr_elem = first_elem + size * i;
 
@@ -52,6 +52,7 @@
 #include "ui/console.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "exec/memory.h"
 #include "exec/ramlist.h"
 #include "hw/intc/intc.h"
 #include "hw/rdma/rdma.h"
@@ -134,6 +135,56 @@ void hmp_info_kvm(Monitor *mon, const QDict *qdict)
     qapi_free_KvmInfo(info);
 }
 
+void hmp_info_kvm_exits(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+    KvmVcpuExitStatsList *list, *cpu;
+    KvmExitReasonStatsList *exit;
+    KvmExitRegionStatsList *region;
+
+    list = qmp_query_kvm_exits(&err);
+    if (err) {
+        hmp_handle_error(mon, err);
+        return;
+    }
+
+    for (cpu = list; cpu; cpu = cpu->next) {
+        monitor_printf(mon, "CPU #%" PRId64 ":\n", cpu->value->cpu_index);
+        for (exit = cpu->value->exits; exit; exit = exit->next) {
+            monitor_printf(mon, "  %-20s %12" PRIu64 " exits %14" PRIu64
+                           " ns\n", exit->value->reason, exit->value->count,
+                           exit->value->time_ns);
+        }
+        for (region = cpu->value->regions; region; region = region->next) {
+            monitor_printf(mon, "  region %-30s mmio %12" PRIu64
+                           " pio %12" PRIu64 "\n", region->value->region,
+                           region->value->mmio, region->value->pio);
+        }
+    }
+
+    qapi_free_KvmVcpuExitStatsList(list);
+}
+
+void hmp_info_kvm_irq_routes(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+    KvmIrqRouteStats *info;
+
+    info = qmp_query_kvm_irq_routes(&err);
+    if (err) {
+        hmp_handle_error(mon, err);
+        return;
+    }
+
+    monitor_printf(mon, "routes:            %" PRIu64 "\n", info->routes);
+    monitor_printf(mon, "updates:           %" PRIu64 " (%" PRIu64
+                   " unchanged)\n", info->updates, info->updates_unchanged);
+    monitor_printf(mon, "commits:           %" PRIu64 " (%" PRIu64
+                   " skipped)\n", info->commits, info->commits_skipped);
+
+    qapi_free_KvmIrqRouteStats(info);
+}
+
 void hmp_info_status(Monitor *mon, const QDict *qdict)
 {
     StatusInfo *info;
@@ -325,11 +376,39 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->compression->compression_rate);
     }
 
+    if (info->has_multifd_channels) {
+        MultiFDChannelStatsList *chan;
+
+        for (chan = info->multifd_channels; chan; chan = chan->next) {
+            MultiFDChannelStats *stats = chan->value;
+
+            monitor_printf(mon, "multifd channel %" PRId64 ": %" PRIu64
+                           " pages, %" PRIu64 " kbytes compressed, "
+                           "compression rate %0.2f, "
+                           "compress time %" PRIu64 " us\n",
+                           stats->id, stats->pages,
+                           stats->compressed_bytes >> 10,
+                           stats->compression_rate, stats->compress_time);
+        }
+    }
+
     if (info->has_cpu_throttle_percentage) {
         monitor_printf(mon, "cpu throttle percentage: %" PRIu64 "\n",
                        info->cpu_throttle_percentage);
     }
 
+    if (info->has_vcpu_throttle_percentage) {
+        Visitor *v;
+        char *str;
+        v = string_output_visitor_new(false, &str);
+        visit_type_uint32List(v, NULL, &info->vcpu_throttle_percentage,
+                              &error_abort);
+        visit_complete(v, &str);
+        monitor_printf(mon, "vcpu throttle percentage: %s\n", str);
+        g_free(str);
+        visit_free(v);
+    }
+
     if (info->has_postcopy_blocktime) {
         monitor_printf(mon, "postcopy blocktime: %u\n",
                        info->postcopy_blocktime);
@@ -469,6 +548,9 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %s\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_COMPRESSION),
             MultiFDCompression_str(params->multifd_compression));
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_DEVICE_STATE_THREADS),
+            params->device_state_threads);
         monitor_printf(mon, "%s: %" PRIu64 " bytes\n",
             MigrationParameter_str(MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE),
             params->xbzrle_cache_size);
@@ -962,8 +1044,15 @@ void hmp_sync_profile(Monitor *mon, const QDict *qdict)
 
     if (op == NULL) {
         bool on = qsp_is_enabled();
+        unsigned int period = qsp_bql_get_period();
 
         monitor_printf(mon, "sync-profile is %s\n", on ? "on" : "off");
+        if (period) {
+            monitor_printf(mon, "BQL profiling samples 1 in %u acquisitions\n",
+                           period);
+        } else {
+            monitor_printf(mon, "BQL profiling is off\n");
+        }
         return;
     }
     if (!strcmp(op, "on")) {
@@ -972,6 +1061,15 @@ void hmp_sync_profile(Monitor *mon, const QDict *qdict)
         qsp_disable();
     } else if (!strcmp(op, "reset")) {
         qsp_reset();
+        memory_region_bql_profile_reset();
+    } else if (!strcmp(op, "bql")) {
+        int64_t period = qdict_get_try_int(qdict, "period", -1);
+
+        if (period < 0 || period > UINT_MAX) {
+            monitor_printf(mon, "sync-profile bql needs a sampling period\n");
+            return;
+        }
+        qsp_bql_set_period(period);
     } else {
         Error *err = NULL;
 
@@ -1388,6 +1486,10 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_multifd_zstd_level = true;
         visit_type_int(v, param, &p->multifd_zstd_level, &err);
         break;
+    case MIGRATION_PARAMETER_DEVICE_STATE_THREADS:
+        p->has_device_state_threads = true;
+        visit_type_int(v, param, &p->device_state_threads, &err);
+        break;
     case MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE:
         p->has_xbzrle_cache_size = true;
         if (!visit_type_size(v, param, &cache_size, &err)) {
@@ -1934,6 +2036,30 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
         monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        monitor_printf(mon, "  poll-time-ns=%" PRIu64 "\n",
+                       value->poll_time_ns);
+        monitor_printf(mon, "  work-time-ns=%" PRIu64 "\n",
+                       value->work_time_ns);
+        monitor_printf(mon, "  sleep-time-ns=%" PRIu64 "\n",
+                       value->sleep_time_ns);
+        if (value->has_cpu_affinity) {
+            uint16List *cpu;
+
+            monitor_printf(mon, "  cpu-affinity=");
+            for (cpu = value->cpu_affinity; cpu; cpu = cpu->next) {
+                monitor_printf(mon, "%" PRIu16 "%s", cpu->value,
+                               cpu->next ? "," : "\n");
+            }
+        }
+        monitor_printf(mon, "  thread-pool-min=%" PRId64 "\n",
+                       value->thread_pool_min);
+        monitor_printf(mon, "  thread-pool-max=%" PRId64 "\n",
+                       value->thread_pool_max);
+        monitor_printf(mon, "  thread-pool: threads=%" PRId64
+                       " idle=%" PRId64 " queued=%" PRId64 "\n",
+                       value->thread_pool_threads,
+                       value->thread_pool_idle_threads,
+                       value->thread_pool_queued);
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -62,6 +62,8 @@
 #endif
 #include "exec/memory.h"
 #include "exec/exec-all.h"
+#include "exec/tb-stats.h"
+#include "afl.h"
 #include "qemu/option.h"
 #include "qemu/thread.h"
 #include "block/qapi.h"
@@ -331,6 +333,31 @@ static void hmp_info_registers(Monitor *mon, const QDict *qdict)
 }
 
 #ifdef CONFIG_TCG
+static void hmp_tb_stats_print(Monitor *mon, TBStatsSort sort,
+                               unsigned int max, bool disas)
+{
+    g_autoptr(GArray) arr = tb_stats_top(sort, max);
+    CPUState *cpu = mon_get_cpu(mon);
+    guint i;
+
+    monitor_printf(mon, "%-18s %12s %10s %10s %6s %10s %12s\n",
+                   "pc", "exec", "exits", "exits-req", "trans",
+                   "insns/host", "trans-ns");
+    for (i = 0; i < arr->len; i++) {
+        TBStatistics *s = &g_array_index(arr, TBStatistics, i);
+
+        monitor_printf(mon, "0x%016" PRIx64 " %12" PRIu64 " %10" PRIu64
+                       " %10" PRIu64 " %6" PRIu64 " %4u/%-5u %12" PRIu64 "\n",
+                       (uint64_t)s->pc, s->exec_count,
+                       s->exits[0] + s->exits[1], s->exits[2],
+                       s->translations, s->guest_insns, s->host_bytes,
+                       s->translations ? s->translate_ns / s->translations : 0);
+        if (disas && cpu && s->guest_insns) {
+            monitor_disas(mon, cpu, s->pc, s->guest_insns, false);
+        }
+    }
+}
+
 static void hmp_info_jit(Monitor *mon, const QDict *qdict)
 {
     if (!tcg_enabled()) {
@@ -340,12 +367,77 @@ static void hmp_info_jit(Monitor *mon, const QDict *qdict)
 
     dump_exec_info();
     dump_drift_info();
+    if (tb_stats_enabled) {
+        monitor_printf(mon, "\nHottest TBs:\n");
+        hmp_tb_stats_print(mon, TB_STATS_SORT_EXEC, 10, false);
+    }
+}
+
+static void hmp_info_tb_stats(Monitor *mon, const QDict *qdict)
+{
+    int64_t max = qdict_get_try_int(qdict, "max", 10);
+    const char *sortby = qdict_get_try_str(qdict, "sortby");
+    int sort = TB_STATS_SORT_EXEC;
+
+    if (!tcg_enabled()) {
+        error_report("TB statistics are only available with accel=tcg");
+        return;
+    }
+    if (!tb_stats_enabled) {
+        monitor_printf(mon, "TB statistics are off, enable them with "
+                       "'tb-stats on'\n");
+        return;
+    }
+    if (sortby) {
+        sort = tb_stats_sort_parse(sortby);
+        if (sort < 0) {
+            monitor_printf(mon, "Unknown sort key '%s', use exec, "
+                           "translations, time or exits\n", sortby);
+            return;
+        }
+    }
+    if (max <= 0) {
+        monitor_printf(mon, "The number of TBs must be positive\n");
+        return;
+    }
+    hmp_tb_stats_print(mon, sort, MIN(max, UINT_MAX),
+                       qdict_get_try_bool(qdict, "disas", false));
+}
+
+static void hmp_tb_stats(Monitor *mon, const QDict *qdict)
+{
+    const char *op = qdict_get_try_str(qdict, "op");
+
+    if (!tcg_enabled()) {
+        error_report("TB statistics are only available with accel=tcg");
+        return;
+    }
+    if (op == NULL) {
+        monitor_printf(mon, "tb-stats is %s\n",
+                       tb_stats_enabled ? "on" : "off");
+    } else if (!strcmp(op, "on")) {
+        tb_stats_enable(true);
+    } else if (!strcmp(op, "off")) {
+        tb_stats_enable(false);
+    } else if (!strcmp(op, "reset")) {
+        tb_stats_reset();
+    } else {
+        Error *err = NULL;
+
+        error_setg(&err, QERR_INVALID_PARAMETER, op);
+        hmp_handle_error(mon, err);
+    }
 }
 
 static void hmp_info_opcount(Monitor *mon, const QDict *qdict)
 {
     dump_opcount_info();
 }
+
+static void hmp_info_afl(Monitor *mon, const QDict *qdict)
+{
+    afl_stats_dump(NULL);
+}
 #endif
 
 static void hmp_info_sync_profile(Monitor *mon, const QDict *qdict)
@@ -357,6 +449,14 @@ static void hmp_info_sync_profile(Monitor *mon, const QDict *qdict)
 
     sort_by = mean ? QSP_SORT_BY_AVG_WAIT_TIME : QSP_SORT_BY_TOTAL_WAIT_TIME;
     qsp_report(max, sort_by, coalesce);
+    qsp_bql_report(max);
+}
+
+static void hmp_info_bql_profile(Monitor *mon, const QDict *qdict)
+{
+    int64_t max = qdict_get_try_int(qdict, "max", 10);
+
+    memory_region_bql_profile_report(max);
 }
 
 static void hmp_info_history(Monitor *mon, const QDict *qdict)
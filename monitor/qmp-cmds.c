@@ -401,3 +401,30 @@ MemoryInfo *qmp_query_memory_size_summary(Error **errp)
 
     return mem_info;
 }
+
+static void qmp_query_bql_profile_entry(const char *kind, const char *label,
+                                        uint64_t count, uint64_t wait_ns,
+                                        uint64_t hold_ns, void *opaque)
+{
+    BqlProfileEntryList ***tail = opaque;
+    BqlProfileEntryList *elem = g_new0(BqlProfileEntryList, 1);
+    BqlProfileEntry *entry = g_new0(BqlProfileEntry, 1);
+
+    entry->kind = g_strdup(kind);
+    entry->name = g_strdup(label);
+    entry->count = count;
+    entry->wait_ns = wait_ns;
+    entry->hold_ns = hold_ns;
+    elem->value = entry;
+    **tail = elem;
+    *tail = &elem->next;
+}
+
+BqlProfileEntryList *qmp_query_bql_profile(Error **errp)
+{
+    BqlProfileEntryList *head = NULL;
+    BqlProfileEntryList **tail = &head;
+
+    qsp_bql_foreach(qmp_query_bql_profile_entry, &tail);
+    return head;
+}
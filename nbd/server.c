@@ -39,6 +39,14 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * Read payloads smaller than this are cheaper to copy than to pin, and
+ * no more than this many request buffers are kept alive waiting for
+ * zero-copy completions before falling back to copying sends.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (16 * KiB)
+#define NBD_ZERO_COPY_MAX_BUFS MAX_NBD_REQUESTS
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -83,6 +91,13 @@ struct NBDRequestData {
     bool complete;
 };
 
+/* A request buffer that zero-copy sends may still be reading from */
+typedef struct NBDZeroCopyBuf {
+    QSIMPLEQ_ENTRY(NBDZeroCopyBuf) next;
+    void *data;
+    uint64_t seq; /* free once sioc->zero_copy_sent reaches this */
+} NBDZeroCopyBuf;
+
 struct NBDExport {
     BlockExport common;
 
@@ -99,6 +114,8 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    bool zero_copy;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -141,6 +158,10 @@ struct NBDClient {
     bool structured_reply;
     NBDExportMetaContexts export_meta;
 
+    bool zero_copy; /* send read payloads with MSG_ZEROCOPY */
+    QSIMPLEQ_HEAD(, NBDZeroCopyBuf) zero_copy_bufs;
+    unsigned int nr_zero_copy_bufs;
+
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
@@ -1397,6 +1418,66 @@ void nbd_client_get(NBDClient *client)
     client->refcount++;
 }
 
+static void nbd_client_reap_zero_copy(NBDClient *client)
+{
+    NBDZeroCopyBuf *buf;
+    Error *local_err = NULL;
+
+    if (qio_channel_socket_zero_copy_reap(client->sioc, &local_err) < 0) {
+        /* Keep the buffers until the client goes away */
+        trace_nbd_zero_copy_reap_fail(error_get_pretty(local_err));
+        error_free(local_err);
+        return;
+    }
+
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_bufs)) &&
+           buf->seq <= client->sioc->zero_copy_sent) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, next);
+        client->nr_zero_copy_bufs--;
+        qemu_vfree(buf->data);
+        g_free(buf);
+    }
+}
+
+/*
+ * Free a request buffer.  While zero-copy sends are outstanding, the kernel
+ * may still be reading from it, so keep it around until their completions
+ * have been reaped.
+ */
+static void nbd_client_free_buffer(NBDClient *client, void *data)
+{
+    NBDZeroCopyBuf *buf;
+
+    if (client->zero_copy) {
+        nbd_client_reap_zero_copy(client);
+    }
+
+    if (!client->zero_copy ||
+        client->sioc->zero_copy_sent == client->sioc->zero_copy_queued) {
+        qemu_vfree(data);
+        return;
+    }
+
+    buf = g_new(NBDZeroCopyBuf, 1);
+    buf->data = data;
+    buf->seq = client->sioc->zero_copy_queued;
+    QSIMPLEQ_INSERT_TAIL(&client->zero_copy_bufs, buf, next);
+    client->nr_zero_copy_bufs++;
+}
+
+static void nbd_client_free_zero_copy_bufs(NBDClient *client)
+{
+    NBDZeroCopyBuf *buf;
+
+    /* The socket is gone, nobody cares about the data any more */
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_bufs))) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, next);
+        qemu_vfree(buf->data);
+        g_free(buf);
+    }
+    client->nr_zero_copy_bufs = 0;
+}
+
 void nbd_client_put(NBDClient *client)
 {
     if (--client->refcount == 0) {
@@ -1417,6 +1498,7 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->export_meta.bitmaps);
+        nbd_client_free_zero_copy_bufs(client);
         g_free(client);
     }
 }
@@ -1459,7 +1541,7 @@ static void nbd_request_put(NBDRequestData *req)
     NBDClient *client = req->client;
 
     if (req->data) {
-        qemu_vfree(req->data);
+        nbd_client_free_buffer(client, req->data);
     }
     g_free(req);
 
@@ -1642,6 +1724,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     blk_add_aio_context_notifier(blk, blk_aio_attached, blk_aio_detach, exp);
 
@@ -1748,6 +1831,70 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+static int coroutine_fn nbd_co_write_zero_copy(NBDClient *client,
+                                               void *data, size_t len,
+                                               Error **errp)
+{
+    struct iovec iov = { .iov_base = data, .iov_len = len };
+    ssize_t ret;
+
+    while (iov.iov_len) {
+        ret = qio_channel_socket_writev_zero_copy(client->sioc, &iov, 1, errp);
+        if (ret == QIO_CHANNEL_ERR_BLOCK) {
+            qio_channel_yield(client->ioc, G_IO_OUT);
+            continue;
+        }
+        if (ret < 0) {
+            return -EIO;
+        }
+        iov.iov_base = (uint8_t *)iov.iov_base + ret;
+        iov.iov_len -= ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Send a reply whose last @iov element is read payload from a request
+ * buffer.  With zero-copy enabled, the header is still copied but the
+ * payload is transmitted straight from the buffer; nbd_request_put()
+ * keeps the buffer alive until the kernel is done with it.
+ */
+static int coroutine_fn nbd_co_send_payload_iov(NBDClient *client,
+                                                struct iovec *iov,
+                                                unsigned niov, Error **errp)
+{
+    struct iovec *payload = &iov[niov - 1];
+    int ret;
+
+    if (!client->zero_copy || payload->iov_len < NBD_ZERO_COPY_MIN_SIZE) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    nbd_client_reap_zero_copy(client);
+    if (client->nr_zero_copy_bufs >= NBD_ZERO_COPY_MAX_BUFS) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    qio_channel_set_cork(client->ioc, true);
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp) < 0 ?
+          -EIO : 0;
+    if (ret == 0) {
+        ret = nbd_co_write_zero_copy(client, payload->iov_base,
+                                     payload->iov_len, errp);
+    }
+    qio_channel_set_cork(client->ioc, false);
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t handle)
 {
@@ -1774,7 +1921,10 @@ static int nbd_co_send_simple_reply(NBDClient *client,
                                    len);
     set_be_simple_reply(&reply, nbd_err, handle);
 
-    return nbd_co_send_iov(client, iov, len ? 2 : 1, errp);
+    if (!len) {
+        return nbd_co_send_iov(client, iov, 1, errp);
+    }
+    return nbd_co_send_payload_iov(client, iov, 2, errp);
 }
 
 static inline void set_be_chunk(NBDStructuredReplyChunk *chunk, uint16_t flags,
@@ -1823,7 +1973,7 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
                  sizeof(chunk) - sizeof(chunk.h) + size);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_payload_iov(client, iov, 2, errp);
 }
 
 static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
@@ -2578,6 +2728,7 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
     Error *local_err = NULL;
 
     qemu_co_mutex_init(&client->send_lock);
+    QSIMPLEQ_INIT(&client->zero_copy_bufs);
 
     if (nbd_negotiate(client, &local_err)) {
         if (local_err) {
@@ -2587,6 +2738,21 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    /*
+     * Zero-copy needs direct access to the socket, so it is not possible
+     * with TLS.  Sockets that don't support it simply keep copying.
+     */
+    if (client->exp->zero_copy && client->ioc == QIO_CHANNEL(client->sioc)) {
+        if (qio_channel_socket_set_zero_copy(client->sioc, true,
+                                             &local_err) < 0) {
+            trace_nbd_zero_copy_unavailable(error_get_pretty(local_err));
+            error_free(local_err);
+            local_err = NULL;
+        } else {
+            client->zero_copy = true;
+        }
+    }
+
     nbd_client_receive_next_request(client);
 }
 
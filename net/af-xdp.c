@@ -0,0 +1,405 @@
+/*
+ * AF_XDP network backend
+ *
+ * Each client owns one AF_XDP socket bound to one queue of a host network
+ * interface.  Packets are exchanged with the NIC through a UMEM area
+ * shared with the kernel, without going through the host network stack.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <net/if.h>
+#include <xdp/xsk.h>
+
+#include "net/net.h"
+#include "clients.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+
+#define AF_XDP_FRAME_SIZE       XSK_UMEM__DEFAULT_FRAME_SIZE
+#define AF_XDP_RX_BATCH         32
+
+typedef struct AFXDPState {
+    NetClientState      nc;
+
+    struct xsk_socket   *xsk;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_cons cq;
+    struct xsk_ring_prod fq;
+
+    struct xsk_umem     *umem;
+    void                *buffer;
+
+    /* UMEM frames that are free for transmission */
+    uint64_t            *pool;
+    uint32_t            n_pool;
+
+    char                ifname[IFNAMSIZ];
+    int                 ifindex;
+    bool                read_poll;
+    bool                write_poll;
+    uint32_t            outstanding_tx;
+    uint32_t            xdp_flags;
+} AFXDPState;
+
+static void af_xdp_send(void *opaque);
+static void af_xdp_writable(void *opaque);
+
+static void af_xdp_update_fd_handler(AFXDPState *s)
+{
+    qemu_set_fd_handler(xsk_socket__fd(s->xsk),
+                        s->read_poll ? af_xdp_send : NULL,
+                        s->write_poll ? af_xdp_writable : NULL,
+                        s);
+}
+
+static void af_xdp_read_poll(AFXDPState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_write_poll(AFXDPState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_poll(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->read_poll != enable || s->write_poll != enable) {
+        s->write_poll = enable;
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Give the frames of completed transmissions back to the pool.  */
+static void af_xdp_complete_tx(AFXDPState *s)
+{
+    uint32_t idx = 0;
+    uint32_t done, i;
+
+    done = xsk_ring_cons__peek(&s->cq, XSK_RING_CONS__DEFAULT_NUM_DESCS,
+                               &idx);
+    for (i = 0; i < done; i++) {
+        s->pool[s->n_pool++] = *xsk_ring_cons__comp_addr(&s->cq, idx++);
+    }
+    if (done) {
+        xsk_ring_cons__release(&s->cq, done);
+        s->outstanding_tx -= done;
+    }
+}
+
+static void af_xdp_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    af_xdp_complete_tx(s);
+
+    /* Unregister the handler, unless we are still waiting for frames.  */
+    af_xdp_write_poll(s, !s->n_pool);
+
+    /* Flush any packet the peer queued while we were full.  */
+    qemu_flush_queued_packets(&s->nc);
+}
+
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    struct xdp_desc *desc;
+    uint32_t idx;
+    void *data;
+
+    /* Drop the packet if it does not fit a frame */
+    if (size > AF_XDP_FRAME_SIZE) {
+        return size;
+    }
+
+    if (!s->n_pool) {
+        af_xdp_complete_tx(s);
+    }
+    if (!s->n_pool || !xsk_ring_prod__reserve(&s->tx, 1, &idx)) {
+        /* No free frame or TX slot, wait until the kernel returns some.  */
+        af_xdp_write_poll(s, true);
+        return 0;
+    }
+
+    desc = xsk_ring_prod__tx_desc(&s->tx, idx);
+    desc->addr = s->pool[--s->n_pool];
+    desc->len = size;
+
+    data = xsk_umem__get_data(s->buffer, desc->addr);
+    memcpy(data, buf, size);
+
+    xsk_ring_prod__submit(&s->tx, 1);
+    s->outstanding_tx++;
+
+    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
+        sendto(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+
+    return size;
+}
+
+/* Hand @n frames back to the kernel for reception.  */
+static void af_xdp_fq_refill(AFXDPState *s, const uint64_t *addrs, uint32_t n)
+{
+    uint32_t idx = 0;
+    uint32_t i;
+
+    /* The fill ring holds all the RX frames, so this cannot fail */
+    if (xsk_ring_prod__reserve(&s->fq, n, &idx) != n) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        *xsk_ring_prod__fill_addr(&s->fq, idx++) = addrs[i];
+    }
+    xsk_ring_prod__submit(&s->fq, n);
+
+    if (s->xsk && xsk_ring_prod__needs_wakeup(&s->fq)) {
+        recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+}
+
+static void af_xdp_send_completed(NetClientState *nc, ssize_t len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    af_xdp_read_poll(s, true);
+}
+
+static void af_xdp_send(void *opaque)
+{
+    AFXDPState *s = opaque;
+    struct iovec pkts[AF_XDP_RX_BATCH];
+    uint64_t addrs[AF_XDP_RX_BATCH];
+    uint32_t idx = 0;
+    uint32_t n, i;
+    int sent;
+
+    n = xsk_ring_cons__peek(&s->rx, AF_XDP_RX_BATCH, &idx);
+    if (!n) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&s->rx, idx++);
+
+        addrs[i] = desc->addr;
+        pkts[i].iov_base = xsk_umem__get_data(s->buffer, desc->addr);
+        pkts[i].iov_len = desc->len;
+    }
+
+    sent = qemu_send_packet_batch(&s->nc, pkts, n, af_xdp_send_completed);
+
+    /*
+     * Packets that were not sent right away have been copied to the queue
+     * of the peer, so all the frames can go back to the kernel.
+     */
+    xsk_ring_cons__release(&s->rx, n);
+    af_xdp_fq_refill(s, addrs, n);
+
+    if (sent < n) {
+        af_xdp_read_poll(s, false);
+    }
+}
+
+static void af_xdp_cleanup(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    if (s->xsk) {
+        af_xdp_poll(nc, false);
+    }
+
+    xsk_socket__delete(s->xsk);
+    s->xsk = NULL;
+    g_free(s->pool);
+    s->pool = NULL;
+    xsk_umem__delete(s->umem);
+    s->umem = NULL;
+    qemu_vfree(s->buffer);
+    s->buffer = NULL;
+}
+
+static int af_xdp_umem_create(AFXDPState *s, Error **errp)
+{
+    struct xsk_umem_config config = {
+        .fill_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .frame_size = AF_XDP_FRAME_SIZE,
+        .frame_headroom = 0,
+    };
+    uint64_t n_descs;
+    uint64_t size;
+    uint32_t i;
+    int ret;
+
+    /* Half of the frames are for reception, the others for transmission */
+    n_descs = XSK_RING_PROD__DEFAULT_NUM_DESCS
+              + XSK_RING_CONS__DEFAULT_NUM_DESCS;
+    size = n_descs * AF_XDP_FRAME_SIZE;
+
+    s->buffer = qemu_memalign(qemu_real_host_page_size, size);
+    memset(s->buffer, 0, size);
+
+    ret = xsk_umem__create(&s->umem, s->buffer, size,
+                           &s->fq, &s->cq, &config);
+    if (ret) {
+        qemu_vfree(s->buffer);
+        s->buffer = NULL;
+        error_setg_errno(errp, -ret, "failed to create UMEM for %s",
+                         s->ifname);
+        return -1;
+    }
+
+    s->pool = g_new(uint64_t, n_descs);
+    /* Fill the pool in reverse order, so that the first frame is used first */
+    for (i = 0; i < n_descs; i++) {
+        s->pool[i] = (n_descs - i - 1) * AF_XDP_FRAME_SIZE;
+    }
+    s->n_pool = n_descs;
+
+    /* Give half of the frames to the kernel for reception */
+    s->n_pool -= n_descs / 2;
+    af_xdp_fq_refill(s, &s->pool[s->n_pool],
+                     MIN(n_descs / 2, XSK_RING_PROD__DEFAULT_NUM_DESCS));
+
+    return 0;
+}
+
+static int af_xdp_socket_create(AFXDPState *s, const NetdevAFXDPOptions *opts,
+                                int queue_id, Error **errp)
+{
+    struct xsk_socket_config cfg = {
+        .rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .libxdp_flags = 0,
+        .bind_flags = XDP_USE_NEED_WAKEUP,
+        .xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST,
+    };
+    int ret = -EINVAL;
+
+    if (opts->has_force_copy && opts->force_copy) {
+        cfg.bind_flags |= XDP_COPY;
+    }
+
+    if (!opts->has_mode || opts->mode == AFXDP_MODE_NATIVE) {
+        /* Try zero-copy first, unless the user asked for copies */
+        if (!(cfg.bind_flags & XDP_COPY)) {
+            cfg.xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_DRV_MODE;
+            cfg.bind_flags |= XDP_ZEROCOPY;
+            ret = xsk_socket__create(&s->xsk, s->ifname, queue_id, s->umem,
+                                     &s->rx, &s->tx, &cfg);
+            cfg.bind_flags &= ~XDP_ZEROCOPY;
+        }
+        if (ret) {
+            cfg.xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_DRV_MODE;
+            ret = xsk_socket__create(&s->xsk, s->ifname, queue_id, s->umem,
+                                     &s->rx, &s->tx, &cfg);
+        }
+    }
+    if (ret && (!opts->has_mode || opts->mode == AFXDP_MODE_SKB)) {
+        /* Generic mode always copies */
+        cfg.xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_SKB_MODE;
+        cfg.bind_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+        ret = xsk_socket__create(&s->xsk, s->ifname, queue_id, s->umem,
+                                 &s->rx, &s->tx, &cfg);
+    }
+    if (ret) {
+        error_setg_errno(errp, -ret, "failed to create AF_XDP socket for "
+                         "%s queue %d", s->ifname, queue_id);
+        return -1;
+    }
+
+    s->xdp_flags = cfg.xdp_flags;
+    return 0;
+}
+
+static NetClientInfo net_af_xdp_info = {
+    .type = NET_CLIENT_DRIVER_AF_XDP,
+    .size = sizeof(AFXDPState),
+    .receive = af_xdp_receive,
+    .poll = af_xdp_poll,
+    .cleanup = af_xdp_cleanup,
+};
+
+/*
+ * The exported init function
+ *
+ * ... -netdev af-xdp,id=xdp0,ifname=eth0,queues=4
+ *
+ * Each queue of the host interface gets its own client.  They all share
+ * the netdev name, so that a multiqueue NIC with as many queues maps one
+ * of its queues to each of them.
+ */
+int net_init_af_xdp(const Netdev *netdev,
+                    const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevAFXDPOptions *opts = &netdev->u.af_xdp;
+    int64_t queues = opts->has_queues ? opts->queues : 1;
+    int64_t start_queue = opts->has_start_queue ? opts->start_queue : 0;
+    NetClientState *nc, *nc0 = NULL;
+    unsigned int ifindex;
+    int64_t i;
+
+    if (queues < 1 || queues > MAX_QUEUE_NUM) {
+        error_setg(errp, "invalid number of queues (%" PRIi64 ") for %s",
+                   queues, opts->ifname);
+        return -1;
+    }
+    if (start_queue < 0 || start_queue > INT_MAX - queues) {
+        error_setg(errp, "invalid start-queue (%" PRIi64 ") for %s",
+                   start_queue, opts->ifname);
+        return -1;
+    }
+
+    ifindex = if_nametoindex(opts->ifname);
+    if (!ifindex) {
+        error_setg_errno(errp, errno, "failed to get ifindex for %s",
+                         opts->ifname);
+        return -1;
+    }
+
+    for (i = 0; i < queues; i++) {
+        AFXDPState *s;
+
+        nc = qemu_new_net_client(&net_af_xdp_info, peer, "af-xdp", name);
+        if (!nc0) {
+            nc0 = nc;
+        }
+        s = DO_UPCAST(AFXDPState, nc, nc);
+        pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
+        s->ifindex = ifindex;
+
+        if (af_xdp_umem_create(s, errp) ||
+            af_xdp_socket_create(s, opts, start_queue + i, errp)) {
+            /* Only the first queue is deleted, its peers go with it */
+            qemu_del_net_client(nc0);
+            return -1;
+        }
+
+        snprintf(nc->info_str, sizeof(nc->info_str),
+                 "af-xdp: ifname=%s queue=%" PRIi64 "%s", s->ifname,
+                 start_queue + i,
+                 s->xdp_flags & XDP_FLAGS_SKB_MODE ? " mode=skb" : "");
+        af_xdp_read_poll(s, true);
+    }
+
+    return 0;
+}
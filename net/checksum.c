@@ -19,24 +19,249 @@
 #include "net/checksum.h"
 #include "net/eth.h"
 
-uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+/*
+ * The Internet checksum does not depend on the byte order of the words
+ * that are summed (RFC 1071), so the buffer is summed in host byte order,
+ * as wide as possible, and the result swapped at the end.  Sums are kept
+ * in 64 bits and folded to 16 bits with end-around carries, so that they
+ * only end up zero if all the data is.
+ */
+
+/* Sum the tail of a buffer, or a buffer too small to vectorize.  */
+static uint64_t net_checksum_add_tail(const uint8_t *buf, size_t len,
+                                      uint64_t sum)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
+    while (len >= 8) {
+        sum += (uint32_t)ldl_he_p(buf);
+        sum += (uint32_t)ldl_he_p(buf + 4);
+        buf += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        sum += (uint32_t)ldl_he_p(buf);
+        buf += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        sum += (uint16_t)lduw_he_p(buf);
+        buf += 2;
+        len -= 2;
+    }
+    if (len) {
+        /* The last byte is the first half of a zero padded word. */
+        uint16_t last = 0;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+        memcpy(&last, buf, 1);
+        sum += last;
     }
-    if (i < len) {
-        sum1 += (uint32_t)buf[i];
+    return sum;
+}
+
+static uint64_t net_checksum_add_int(const uint8_t *buf, size_t len)
+{
+    return net_checksum_add_tail(buf, len, 0);
+}
+
+/*
+ * The vector loops widen 16-bit words into 32-bit lanes, which could
+ * overflow after 64K additions.  Move them to 64-bit lanes every
+ * NET_CHECKSUM_BLOCK iterations of at most 8 additions per lane.
+ */
+#define NET_CHECKSUM_BLOCK 4096
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/*
+ * Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static uint64_t net_checksum_add_sse2(const uint8_t *buf, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum64 = zero;
+    uint64_t res[2];
+
+    while (len >= 64) {
+        size_t n = MIN(len / 64, NET_CHECKSUM_BLOCK);
+        __m128i sum32 = zero;
+
+        len -= n * 64;
+        do {
+            __m128i a = _mm_loadu_si128((const __m128i *)buf);
+            __m128i b = _mm_loadu_si128((const __m128i *)(buf + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *)(buf + 32));
+            __m128i d = _mm_loadu_si128((const __m128i *)(buf + 48));
+
+            sum32 = _mm_add_epi32(sum32, _mm_unpacklo_epi16(a, zero));
+            sum32 = _mm_add_epi32(sum32, _mm_unpackhi_epi16(a, zero));
+            sum32 = _mm_add_epi32(sum32, _mm_unpacklo_epi16(b, zero));
+            sum32 = _mm_add_epi32(sum32, _mm_unpackhi_epi16(b, zero));
+            sum32 = _mm_add_epi32(sum32, _mm_unpacklo_epi16(c, zero));
+            sum32 = _mm_add_epi32(sum32, _mm_unpackhi_epi16(c, zero));
+            sum32 = _mm_add_epi32(sum32, _mm_unpacklo_epi16(d, zero));
+            sum32 = _mm_add_epi32(sum32, _mm_unpackhi_epi16(d, zero));
+            buf += 64;
+        } while (--n);
+
+        sum64 = _mm_add_epi64(sum64, _mm_unpacklo_epi32(sum32, zero));
+        sum64 = _mm_add_epi64(sum64, _mm_unpackhi_epi32(sum32, zero));
+    }
+
+    _mm_storeu_si128((__m128i *)res, sum64);
+    return net_checksum_add_tail(buf, len, res[0] + res[1]);
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static uint64_t net_checksum_add_avx2(const uint8_t *buf, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum64 = zero;
+    uint64_t res[4];
+
+    while (len >= 128) {
+        size_t n = MIN(len / 128, NET_CHECKSUM_BLOCK);
+        __m256i sum32 = zero;
+
+        len -= n * 128;
+        do {
+            __m256i a = _mm256_loadu_si256((const __m256i *)buf);
+            __m256i b = _mm256_loadu_si256((const __m256i *)(buf + 32));
+            __m256i c = _mm256_loadu_si256((const __m256i *)(buf + 64));
+            __m256i d = _mm256_loadu_si256((const __m256i *)(buf + 96));
+
+            sum32 = _mm256_add_epi32(sum32, _mm256_unpacklo_epi16(a, zero));
+            sum32 = _mm256_add_epi32(sum32, _mm256_unpackhi_epi16(a, zero));
+            sum32 = _mm256_add_epi32(sum32, _mm256_unpacklo_epi16(b, zero));
+            sum32 = _mm256_add_epi32(sum32, _mm256_unpackhi_epi16(b, zero));
+            sum32 = _mm256_add_epi32(sum32, _mm256_unpacklo_epi16(c, zero));
+            sum32 = _mm256_add_epi32(sum32, _mm256_unpackhi_epi16(c, zero));
+            sum32 = _mm256_add_epi32(sum32, _mm256_unpacklo_epi16(d, zero));
+            sum32 = _mm256_add_epi32(sum32, _mm256_unpackhi_epi16(d, zero));
+            buf += 128;
+        } while (--n);
+
+        sum64 = _mm256_add_epi64(sum64, _mm256_unpacklo_epi32(sum32, zero));
+        sum64 = _mm256_add_epi64(sum64, _mm256_unpackhi_epi32(sum32, zero));
     }
 
+    _mm256_storeu_si256((__m256i *)res, sum64);
+    return net_checksum_add_tail(buf, len, res[0] + res[1] + res[2] + res[3]);
+}
+#pragma GCC pop_options
+
+#define CACHE_AVX2    1
+#define CACHE_SSE2    2
+
+static uint64_t (*net_checksum_accel)(const uint8_t *, size_t) =
+    net_checksum_add_int;
+
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+
+    if (cache & CACHE_AVX2) {
+        net_checksum_accel = net_checksum_add_avx2;
+    } else if (cache & CACHE_SSE2) {
+        net_checksum_accel = net_checksum_add_sse2;
+    }
+}
+#else
+#define net_checksum_accel net_checksum_add_sse2
+#endif /* CONFIG_AVX2_OPT */
+
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+static uint64_t net_checksum_add_neon(const uint8_t *buf, size_t len)
+{
+    uint64x2_t sum64 = vdupq_n_u64(0);
+
+    while (len >= 64) {
+        size_t n = MIN(len / 64, NET_CHECKSUM_BLOCK);
+        uint32x4_t sum32 = vdupq_n_u32(0);
+
+        len -= n * 64;
+        do {
+            /* Each pairwise add-accumulate puts two words in a lane.  */
+            sum32 = vpadalq_u16(sum32, vreinterpretq_u16_u8(vld1q_u8(buf)));
+            sum32 = vpadalq_u16(sum32,
+                                vreinterpretq_u16_u8(vld1q_u8(buf + 16)));
+            sum32 = vpadalq_u16(sum32,
+                                vreinterpretq_u16_u8(vld1q_u8(buf + 32)));
+            sum32 = vpadalq_u16(sum32,
+                                vreinterpretq_u16_u8(vld1q_u8(buf + 48)));
+            buf += 64;
+        } while (--n);
+
+        sum64 = vpadalq_u32(sum64, sum32);
+    }
+
+    return net_checksum_add_tail(buf, len, vaddvq_u64(sum64));
+}
+
+#define net_checksum_accel net_checksum_add_neon
+
+#else
+#define net_checksum_accel net_checksum_add_int
+#endif
+
+static uint16_t net_checksum_fold(uint64_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+{
+    uint16_t sum;
+
+    if (len <= 0) {
+        return 0;
+    }
+
+    /* Words in host byte order summed, now make them big endian */
+    sum = be16_to_cpu(net_checksum_fold(net_checksum_accel(buf, len)));
+
+    /* An odd @seq means that the buffer starts in the middle of a word */
     if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
+        sum = bswap16(sum);
     }
+    return sum;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -55,6 +55,16 @@ static NotifierList colo_compare_notifiers =
 #define REGULAR_PACKET_CHECK_MS 1000
 #define DEFAULT_TIME_OUT_MS 3000
 
+/*
+ * Packets of up to COMPARE_BUF_SIZE bytes, which covers a standard MTU
+ * with its vnet header, get a buffer of that size, recycled through a
+ * free list of at most COMPARE_BUF_POOL_MAX buffers.
+ */
+#define COMPARE_BUF_SIZE 2048
+#define COMPARE_BUF_POOL_MAX 1024
+
+#define ICMP_CSUM_OFFSET 2
+
 /* #define DEBUG_COLO_PACKETS */
 
 static QemuMutex colo_compare_mutex;
@@ -131,6 +141,13 @@ struct CompareState {
     /* Record the connection without repetition */
     GHashTable *connection_track_table;
 
+    /*
+     * Free packet buffers.  Only used from the compare thread, or from
+     * the main thread once the compare thread has stopped.
+     */
+    uint8_t **buf_pool;
+    unsigned int buf_pool_len;
+
     IOThread *iothread;
     GMainContext *worker_context;
     QEMUTimer *packet_check_timer;
@@ -162,6 +179,33 @@ static int compare_chr_send(CompareState *s,
                             bool notify_remote_frame,
                             bool zero_copy);
 
+static uint8_t *compare_buf_get(CompareState *s, uint32_t size)
+{
+    if (size > COMPARE_BUF_SIZE) {
+        return g_malloc(size);
+    }
+    if (s->buf_pool_len) {
+        return s->buf_pool[--s->buf_pool_len];
+    }
+    return g_malloc(COMPARE_BUF_SIZE);
+}
+
+/* @size must be the size that @buf was allocated for */
+static void compare_buf_put(CompareState *s, uint8_t *buf, uint32_t size)
+{
+    if (size > COMPARE_BUF_SIZE || s->buf_pool_len == COMPARE_BUF_POOL_MAX) {
+        g_free(buf);
+        return;
+    }
+    s->buf_pool[s->buf_pool_len++] = buf;
+}
+
+static void compare_packet_destroy(CompareState *s, Packet *pkt)
+{
+    compare_buf_put(s, pkt->data, pkt->size);
+    packet_destroy_partial(pkt, NULL);
+}
+
 static bool packet_matches_str(const char *str,
                                const uint8_t *buf,
                                uint32_t packet_len)
@@ -244,23 +288,19 @@ static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
  */
 static int packet_enqueue(CompareState *s, int mode, Connection **con)
 {
+    SocketReadState *rs = mode == PRIMARY_IN ? &s->pri_rs : &s->sec_rs;
     ConnectionKey key;
     Packet *pkt = NULL;
     Connection *conn;
+    uint8_t *data;
     int ret;
 
-    if (mode == PRIMARY_IN) {
-        pkt = packet_new(s->pri_rs.buf,
-                         s->pri_rs.packet_len,
-                         s->pri_rs.vnet_hdr_len);
-    } else {
-        pkt = packet_new(s->sec_rs.buf,
-                         s->sec_rs.packet_len,
-                         s->sec_rs.vnet_hdr_len);
-    }
+    data = compare_buf_get(s, rs->packet_len);
+    memcpy(data, rs->buf, rs->packet_len);
+    pkt = packet_new_nocopy(data, rs->packet_len, rs->vnet_hdr_len);
 
     if (parse_packet_early(pkt)) {
-        packet_destroy(pkt, NULL);
+        compare_packet_destroy(s, pkt);
         pkt = NULL;
         return -1;
     }
@@ -284,7 +324,7 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
     if (!ret) {
         trace_colo_compare_drop_packet(colo_mode[mode],
             "queue size too big, drop packet");
-        packet_destroy(pkt, NULL);
+        compare_packet_destroy(s, pkt);
         pkt = NULL;
     }
 
@@ -439,7 +479,7 @@ sec:
     }
 
     if (spkt->tcp_seq == spkt->seq_end) {
-        packet_destroy(spkt, NULL);
+        compare_packet_destroy(s, spkt);
         if (!ppkt) {
             goto pri;
         } else {
@@ -448,7 +488,7 @@ sec:
     } else {
         if (conn->compare_seq && !after(spkt->seq_end, conn->compare_seq)) {
             trace_colo_compare_main("sec: this packet has compared");
-            packet_destroy(spkt, NULL);
+            compare_packet_destroy(s, spkt);
             if (!ppkt) {
                 goto pri;
             } else {
@@ -479,12 +519,12 @@ sec:
             goto pri;
         } else if (mark == COLO_COMPARE_FREE_SECONDARY) {
             conn->compare_seq = spkt->seq_end;
-            packet_destroy(spkt, NULL);
+            compare_packet_destroy(s, spkt);
             goto sec;
         } else if (mark == (COLO_COMPARE_FREE_PRIMARY | COLO_COMPARE_FREE_SECONDARY)) {
             conn->compare_seq = ppkt->seq_end;
             colo_release_primary_pkt(s, ppkt);
-            packet_destroy(spkt, NULL);
+            compare_packet_destroy(s, spkt);
             goto pri;
         }
     } else {
@@ -501,6 +541,24 @@ sec:
 }
 
 
+/*
+ * The transport checksum of UDP and ICMP is part of the data that is
+ * compared, so packets with different checksums cannot match.  Checking
+ * it first rejects most mismatches without going through the payload.
+ */
+static bool colo_packet_csum_differs(Packet *ppkt, Packet *spkt,
+                                     unsigned int csum_offset)
+{
+    uint8_t *pcsum = ppkt->transport_header + csum_offset;
+    uint8_t *scsum = spkt->transport_header + csum_offset;
+
+    if (pcsum + sizeof(uint16_t) > (uint8_t *)ppkt->data + ppkt->size ||
+        scsum + sizeof(uint16_t) > (uint8_t *)spkt->data + spkt->size) {
+        return false;
+    }
+    return lduw_he_p(pcsum) != lduw_he_p(scsum);
+}
+
 /*
  * Called from the compare thread on the primary
  * for compare udp packet
@@ -526,7 +584,9 @@ static int colo_packet_compare_udp(Packet *spkt, Packet *ppkt)
         trace_colo_compare_main("UDP: payload size of packets are different");
         return -1;
     }
-    if (colo_compare_packet_payload(ppkt, spkt, offset, offset,
+    if (colo_packet_csum_differs(ppkt, spkt,
+                                 offsetof(struct udp_hdr, uh_sum)) ||
+        colo_compare_packet_payload(ppkt, spkt, offset, offset,
                                     ppkt->size - offset)) {
         trace_colo_compare_udp_miscompare("primary pkt size", ppkt->size);
         trace_colo_compare_udp_miscompare("Secondary pkt size", spkt->size);
@@ -565,7 +625,8 @@ static int colo_packet_compare_icmp(Packet *spkt, Packet *ppkt)
         trace_colo_compare_main("ICMP: payload size of packets are different");
         return -1;
     }
-    if (colo_compare_packet_payload(ppkt, spkt, offset, offset,
+    if (colo_packet_csum_differs(ppkt, spkt, ICMP_CSUM_OFFSET) ||
+        colo_compare_packet_payload(ppkt, spkt, offset, offset,
                                     ppkt->size - offset)) {
         trace_colo_compare_icmp_miscompare("primary pkt size",
                                            ppkt->size);
@@ -689,8 +750,11 @@ static void colo_compare_packet(CompareState *s, Connection *conn,
                  pkt, (GCompareFunc)HandlePacket);
 
         if (result) {
+            Packet *spkt = result->data;
+
             colo_release_primary_pkt(s, pkt);
-            g_queue_remove(&conn->secondary_list, result->data);
+            g_queue_remove(&conn->secondary_list, spkt);
+            compare_packet_destroy(s, spkt);
         } else {
             /*
              * If one packet arrive late, the secondary_list or
@@ -747,7 +811,7 @@ static void coroutine_fn _compare_chr_send(void *opaque)
         ret = qemu_chr_fe_write_all(sendco->chr, (uint8_t *)&len, sizeof(len));
 
         if (ret != sizeof(len)) {
-            g_free(entry->buf);
+            compare_buf_put(s, entry->buf, entry->size);
             g_slice_free(SendEntry, entry);
             goto err;
         }
@@ -764,7 +828,7 @@ static void coroutine_fn _compare_chr_send(void *opaque)
                                         sizeof(len));
 
             if (ret != sizeof(len)) {
-                g_free(entry->buf);
+                compare_buf_put(s, entry->buf, entry->size);
                 g_slice_free(SendEntry, entry);
                 goto err;
             }
@@ -775,12 +839,12 @@ static void coroutine_fn _compare_chr_send(void *opaque)
                                     entry->size);
 
         if (ret != entry->size) {
-            g_free(entry->buf);
+            compare_buf_put(s, entry->buf, entry->size);
             g_slice_free(SendEntry, entry);
             goto err;
         }
 
-        g_free(entry->buf);
+        compare_buf_put(s, entry->buf, entry->size);
         g_slice_free(SendEntry, entry);
     }
 
@@ -790,7 +854,7 @@ static void coroutine_fn _compare_chr_send(void *opaque)
 err:
     while (!g_queue_is_empty(&sendco->send_list)) {
         SendEntry *entry = g_queue_pop_tail(&sendco->send_list);
-        g_free(entry->buf);
+        compare_buf_put(s, entry->buf, entry->size);
         g_slice_free(SendEntry, entry);
     }
     sendco->ret = ret < 0 ? ret : -EIO;
@@ -826,7 +890,7 @@ static int compare_chr_send(CompareState *s,
     if (zero_copy) {
         entry->buf = buf;
     } else {
-        entry->buf = g_malloc(size);
+        entry->buf = compare_buf_get(s, size);
         memcpy(entry->buf, buf, size);
     }
     g_queue_push_head(&sendco->send_list, entry);
@@ -1331,6 +1395,7 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
     }
 
     g_queue_init(&s->conn_list);
+    s->buf_pool = g_new(uint8_t *, COMPARE_BUF_POOL_MAX);
 
     s->connection_track_table = g_hash_table_new_full(connection_key_hash,
                                                       connection_key_equal,
@@ -1369,7 +1434,7 @@ static void colo_flush_packets(void *opaque, void *user_data)
     }
     while (!g_queue_is_empty(&conn->secondary_list)) {
         pkt = g_queue_pop_head(&conn->secondary_list);
-        packet_destroy(pkt, NULL);
+        compare_packet_destroy(s, pkt);
     }
 }
 
@@ -1467,6 +1532,11 @@ static void colo_compare_finalize(Object *obj)
         g_hash_table_destroy(s->connection_track_table);
     }
 
+    while (s->buf_pool_len) {
+        g_free(s->buf_pool[--s->buf_pool_len]);
+    }
+    g_free(s->buf_pool);
+
     object_unref(OBJECT(s->iothread));
 
     g_free(s->pri_indev);
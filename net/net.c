@@ -54,6 +54,7 @@
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "net/filter.h"
+#include "net/vhost_net.h"
 #include "qapi/string-output-visitor.h"
 
 /* Net bridge is currently not supported for W32. */
@@ -502,6 +503,19 @@ void qemu_set_vnet_hdr_len(NetClientState *nc, int len)
     nc->info->set_vnet_hdr_len(nc, len);
 }
 
+/*
+ * Attaches the eBPF program @prog_fd, or detaches the current one if
+ * @prog_fd is -1, to steer received packets to the backend's queues.
+ */
+bool qemu_set_steering_ebpf(NetClientState *nc, int prog_fd)
+{
+    if (!nc || !nc->info->set_steering_ebpf) {
+        return false;
+    }
+
+    return nc->info->set_steering_ebpf(nc, prog_fd);
+}
+
 int qemu_set_vnet_le(NetClientState *nc, bool is_le)
 {
 #ifdef HOST_WORDS_BIGENDIAN
@@ -674,6 +688,48 @@ ssize_t qemu_send_packet_async(NetClientState *sender,
                                              buf, size, sent_cb);
 }
 
+/*
+ * Send @count packets, each held in a single buffer.  When nothing stands
+ * between @sender and its peer, the whole batch is handed over with one
+ * receive_batch call; otherwise, or for the packets the peer did not take,
+ * this behaves like qemu_send_packet_async() on each packet in turn.
+ *
+ * Returns the number of packets sent right away.  The others have been
+ * queued, and the caller must wait for @sent_cb before sending more.
+ */
+int qemu_send_packet_batch(NetClientState *sender, const struct iovec *pkts,
+                           int count, NetPacketSent *sent_cb)
+{
+    NetClientState *peer = sender->peer;
+    int sent = 0;
+    int i;
+
+    if (peer && !sender->link_down && !peer->link_down &&
+        peer->info->receive_batch &&
+        QTAILQ_EMPTY(&sender->filters) && QTAILQ_EMPTY(&peer->filters) &&
+        qemu_net_queue_is_idle(peer->incoming_queue) &&
+        qemu_can_send_packet(sender)) {
+        sent = peer->info->receive_batch(peer, pkts, count);
+        if (sent < count) {
+            peer->receive_disabled = 1;
+        }
+    }
+
+    for (i = sent; i < count; i++) {
+        if (qemu_send_packet_async(sender, pkts[i].iov_base, pkts[i].iov_len,
+                                   sent_cb) == 0) {
+            break;
+        }
+        sent++;
+    }
+    /* Once a packet is queued, keep the order by queueing the rest too */
+    for (i = sent + 1; i < count; i++) {
+        qemu_send_packet_async(sender, pkts[i].iov_base, pkts[i].iov_len,
+                               sent_cb);
+    }
+    return sent;
+}
+
 ssize_t qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size)
 {
     return qemu_send_packet_async(nc, buf, size, NULL);
@@ -964,6 +1020,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1052,6 +1111,9 @@ void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
@@ -1251,6 +1313,39 @@ RxFilterInfoList *qmp_query_rx_filter(bool has_name, const char *name,
     return filter_list;
 }
 
+VhostQueueInfoList *qmp_x_query_vhost_queues(const char *netdev,
+                                             Error **errp)
+{
+    NetClientState *ncs[MAX_QUEUE_NUM];
+    VhostQueueInfoList *head = NULL, **tail = &head;
+    int queues, i;
+
+    queues = qemu_find_net_clients_except(netdev, ncs,
+                                          NET_CLIENT_DRIVER_NIC,
+                                          MAX_QUEUE_NUM);
+    if (queues == 0) {
+        error_setg(errp, "invalid netdev name: %s", netdev);
+        return NULL;
+    }
+
+    for (i = 0; i < queues; i++) {
+        VhostQueueInfoList *list = vhost_net_query_queues(ncs[i]);
+
+        if (!list) {
+            continue;
+        }
+        *tail = list;
+        while (*tail) {
+            tail = &(*tail)->next;
+        }
+    }
+
+    if (!head) {
+        error_setg(errp, "netdev %s is not served by vhost", netdev);
+    }
+    return head;
+}
+
 void hmp_info_network(Monitor *mon, const QDict *qdict)
 {
     NetClientState *nc, *peer;
@@ -40,11 +40,22 @@
  * unbounded queueing.
  */
 
+/*
+ * Packets of up to NET_PACKET_POOL_SIZE bytes are allocated with room for
+ * that much data, and recycled through a free list of the queue instead
+ * of going back to the allocator, so that a receiver that stays blocked
+ * for a while does not cost a malloc/free pair per packet.  Jumbo frames
+ * are allocated with their own size and freed right away.
+ */
+#define NET_PACKET_POOL_SIZE    2048
+#define NET_PACKET_POOL_MAX     256
+
 struct NetPacket {
     QTAILQ_ENTRY(NetPacket) entry;
     NetClientState *sender;
     unsigned flags;
     int size;
+    bool pooled;
     NetPacketSent *sent_cb;
     uint8_t data[];
 };
@@ -57,6 +68,10 @@ struct NetQueue {
 
     QTAILQ_HEAD(, NetPacket) packets;
 
+    /* Free packets of NET_PACKET_POOL_SIZE bytes */
+    QTAILQ_HEAD(, NetPacket) pool;
+    uint32_t pool_len;
+
     unsigned delivering : 1;
 };
 
@@ -72,6 +87,7 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     queue->deliver = deliver;
 
     QTAILQ_INIT(&queue->packets);
+    QTAILQ_INIT(&queue->pool);
 
     queue->delivering = 0;
 
@@ -86,10 +102,45 @@ void qemu_del_net_queue(NetQueue *queue)
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         g_free(packet);
     }
+    QTAILQ_FOREACH_SAFE(packet, &queue->pool, entry, next) {
+        QTAILQ_REMOVE(&queue->pool, packet, entry);
+        g_free(packet);
+    }
 
     g_free(queue);
 }
 
+static NetPacket *qemu_net_queue_packet_new(NetQueue *queue, size_t size)
+{
+    NetPacket *packet;
+
+    if (size > NET_PACKET_POOL_SIZE) {
+        packet = g_malloc(sizeof(NetPacket) + size);
+        packet->pooled = false;
+        return packet;
+    }
+
+    packet = QTAILQ_FIRST(&queue->pool);
+    if (packet) {
+        QTAILQ_REMOVE(&queue->pool, packet, entry);
+        queue->pool_len--;
+    } else {
+        packet = g_malloc(sizeof(NetPacket) + NET_PACKET_POOL_SIZE);
+        packet->pooled = true;
+    }
+    return packet;
+}
+
+static void qemu_net_queue_packet_free(NetQueue *queue, NetPacket *packet)
+{
+    if (!packet->pooled || queue->pool_len >= NET_PACKET_POOL_MAX) {
+        g_free(packet);
+        return;
+    }
+    QTAILQ_INSERT_HEAD(&queue->pool, packet, entry);
+    queue->pool_len++;
+}
+
 static void qemu_net_queue_append(NetQueue *queue,
                                   NetClientState *sender,
                                   unsigned flags,
@@ -102,7 +153,7 @@ static void qemu_net_queue_append(NetQueue *queue,
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
         return; /* drop if queue full and no callback */
     }
-    packet = g_malloc(sizeof(NetPacket) + size);
+    packet = qemu_net_queue_packet_new(queue, size);
     packet->sender = sender;
     packet->flags = flags;
     packet->size = size;
@@ -131,7 +182,7 @@ void qemu_net_queue_append_iov(NetQueue *queue,
         max_len += iov[i].iov_len;
     }
 
-    packet = g_malloc(sizeof(NetPacket) + max_len);
+    packet = qemu_net_queue_packet_new(queue, max_len);
     packet->sender = sender;
     packet->sent_cb = sent_cb;
     packet->flags = flags;
@@ -243,11 +294,17 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
             if (packet->sent_cb) {
                 packet->sent_cb(packet->sender, 0);
             }
-            g_free(packet);
+            qemu_net_queue_packet_free(queue, packet);
         }
     }
 }
 
+/* Nothing is queued or being delivered */
+bool qemu_net_queue_is_idle(NetQueue *queue)
+{
+    return !queue->delivering && QTAILQ_EMPTY(&queue->packets);
+}
+
 bool qemu_net_queue_flush(NetQueue *queue)
 {
     if (queue->delivering)
@@ -276,7 +333,7 @@ bool qemu_net_queue_flush(NetQueue *queue)
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        qemu_net_queue_packet_free(queue, packet);
     }
     return true;
 }
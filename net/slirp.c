@@ -46,6 +46,8 @@
 #include "util.h"
 #include "migration/register.h"
 #include "migration/qemu-file-types.h"
+#include "block/aio-wait.h"
+#include "sysemu/iothread.h"
 
 static int get_str_sep(char *buf, int buf_size, const char **pp, int sep)
 {
@@ -77,14 +79,28 @@ struct slirp_config_str {
     char str[1024];
 };
 
+typedef struct SlirpState SlirpState;
+
 struct GuestFwd {
     CharBackend hd;
     struct in_addr server;
     int port;
-    Slirp *slirp;
+    SlirpState *s;
 };
 
-typedef struct SlirpState {
+typedef struct NetSlirpSource {
+    GSource source;
+    SlirpState *s;
+} NetSlirpSource;
+
+typedef struct NetSlirpTimer {
+    QEMUTimer *timer;
+    SlirpState *s;
+    SlirpTimerCb cb;
+    void *cb_opaque;
+} NetSlirpTimer;
+
+struct SlirpState {
     NetClientState nc;
     QTAILQ_ENTRY(SlirpState) entry;
     Slirp *slirp;
@@ -94,7 +110,20 @@ typedef struct SlirpState {
     gchar *smb_dir;
 #endif
     GSList *fwd;
-} SlirpState;
+
+    /*
+     * With an IOThread, slirp is polled from its GMainContext and its
+     * timers run in its AioContext, whose lock protects s->slirp and
+     * s->tx.  Packets for the peer are queued in s->tx and handed over
+     * in batches by s->tx_bh, which runs in the main loop.
+     */
+    IOThread *iothread;
+    AioContext *ctx;
+    GSource *source;
+    GArray *pollfds;
+    GArray *tx;
+    QEMUBH *tx_bh;
+};
 
 static struct slirp_config_str *slirp_configs;
 static QTAILQ_HEAD(, SlirpState) slirp_stacks =
@@ -111,19 +140,71 @@ static void slirp_smb_cleanup(SlirpState *s);
 static inline void slirp_smb_cleanup(SlirpState *s) { }
 #endif
 
+/* Number of packets to hand over to the peer in one go */
+#define NET_SLIRP_TX_BATCH 64
+
+static void net_slirp_lock(SlirpState *s)
+{
+    if (s->ctx) {
+        aio_context_acquire(s->ctx);
+    }
+}
+
+static void net_slirp_unlock(SlirpState *s)
+{
+    if (s->ctx) {
+        aio_context_release(s->ctx);
+    }
+}
+
 static ssize_t net_slirp_send_packet(const void *pkt, size_t pkt_len,
                                      void *opaque)
 {
     SlirpState *s = opaque;
+    struct iovec iov;
+
+    if (!s->ctx) {
+        return qemu_send_packet(&s->nc, pkt, pkt_len);
+    }
 
-    return qemu_send_packet(&s->nc, pkt, pkt_len);
+    /* Called with the AioContext lock held, possibly from the IOThread */
+    iov.iov_base = g_memdup(pkt, pkt_len);
+    iov.iov_len = pkt_len;
+    g_array_append_val(s->tx, iov);
+    qemu_bh_schedule(s->tx_bh);
+    return pkt_len;
+}
+
+static void net_slirp_tx_bh(void *opaque)
+{
+    SlirpState *s = opaque;
+    GArray *tx;
+    int i;
+
+    aio_context_acquire(s->ctx);
+    tx = s->tx;
+    s->tx = g_array_sized_new(false, false, sizeof(struct iovec),
+                              NET_SLIRP_TX_BATCH);
+    aio_context_release(s->ctx);
+
+    /* Packets the peer cannot take right now are copied to its queue */
+    for (i = 0; i < tx->len; i += NET_SLIRP_TX_BATCH) {
+        qemu_send_packet_batch(&s->nc, &g_array_index(tx, struct iovec, i),
+                               MIN(tx->len - i, NET_SLIRP_TX_BATCH), NULL);
+    }
+    for (i = 0; i < tx->len; i++) {
+        g_free(g_array_index(tx, struct iovec, i).iov_base);
+    }
+    g_array_free(tx, true);
 }
 
 static ssize_t net_slirp_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
 
+    net_slirp_lock(s);
     slirp_input(s->slirp, buf, size);
+    net_slirp_unlock(s);
 
     return size;
 }
@@ -142,14 +223,40 @@ static void slirp_free_fwd(gpointer data)
     g_free(data);
 }
 
+/* Runs in the IOThread, so that neither the GSource nor a timer is active */
+static void net_slirp_iothread_cleanup_bh(void *opaque)
+{
+    SlirpState *s = opaque;
+
+    g_source_destroy(s->source);
+    g_source_unref(s->source);
+    s->source = NULL;
+    slirp_cleanup(s->slirp);
+}
+
 static void net_slirp_cleanup(NetClientState *nc)
 {
     SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
+    int i;
 
     g_slist_free_full(s->fwd, slirp_free_fwd);
-    main_loop_poll_remove_notifier(&s->poll_notifier);
-    unregister_savevm(NULL, "slirp", s->slirp);
-    slirp_cleanup(s->slirp);
+    unregister_savevm(NULL, "slirp", s);
+    if (s->ctx) {
+        aio_context_acquire(s->ctx);
+        aio_wait_bh_oneshot(s->ctx, net_slirp_iothread_cleanup_bh, s);
+        aio_context_release(s->ctx);
+
+        qemu_bh_delete(s->tx_bh);
+        for (i = 0; i < s->tx->len; i++) {
+            g_free(g_array_index(s->tx, struct iovec, i).iov_base);
+        }
+        g_array_free(s->tx, true);
+        g_array_free(s->pollfds, true);
+        object_unref(OBJECT(s->iothread));
+    } else {
+        main_loop_poll_remove_notifier(&s->poll_notifier);
+        slirp_cleanup(s->slirp);
+    }
     if (s->exit_notifier.notify) {
         qemu_remove_exit_notifier(&s->exit_notifier);
     }
@@ -174,23 +281,61 @@ static int64_t net_slirp_clock_get_ns(void *opaque)
     return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
 }
 
+static void net_slirp_iothread_timer_cb(void *opaque)
+{
+    NetSlirpTimer *t = opaque;
+
+    aio_context_acquire(t->s->ctx);
+    t->cb(t->cb_opaque);
+    aio_context_release(t->s->ctx);
+}
+
 static void *net_slirp_timer_new(SlirpTimerCb cb,
                                  void *cb_opaque, void *opaque)
 {
-    return timer_new_full(NULL, QEMU_CLOCK_VIRTUAL,
-                          SCALE_MS, QEMU_TIMER_ATTR_EXTERNAL,
-                          cb, cb_opaque);
+    SlirpState *s = opaque;
+    NetSlirpTimer *t;
+
+    if (!s->ctx) {
+        return timer_new_full(NULL, QEMU_CLOCK_VIRTUAL,
+                              SCALE_MS, QEMU_TIMER_ATTR_EXTERNAL,
+                              cb, cb_opaque);
+    }
+
+    t = g_new(NetSlirpTimer, 1);
+    t->s = s;
+    t->cb = cb;
+    t->cb_opaque = cb_opaque;
+    t->timer = aio_timer_new_with_attrs(s->ctx, QEMU_CLOCK_VIRTUAL,
+                                        SCALE_MS, QEMU_TIMER_ATTR_EXTERNAL,
+                                        net_slirp_iothread_timer_cb, t);
+    return t;
 }
 
 static void net_slirp_timer_free(void *timer, void *opaque)
 {
-    timer_del(timer);
-    timer_free(timer);
+    SlirpState *s = opaque;
+    NetSlirpTimer *t = timer;
+
+    if (!s->ctx) {
+        timer_del(timer);
+        timer_free(timer);
+        return;
+    }
+
+    timer_del(t->timer);
+    timer_free(t->timer);
+    g_free(t);
 }
 
 static void net_slirp_timer_mod(void *timer, int64_t expire_timer,
                                 void *opaque)
 {
+    SlirpState *s = opaque;
+
+    if (s->ctx) {
+        timer = ((NetSlirpTimer *)timer)->timer;
+    }
     timer_mod(timer, expire_timer);
 }
 
@@ -206,7 +351,13 @@ static void net_slirp_unregister_poll_fd(int fd, void *opaque)
 
 static void net_slirp_notify(void *opaque)
 {
-    qemu_notify_event();
+    SlirpState *s = opaque;
+
+    if (s->ctx) {
+        aio_notify(s->ctx);
+    } else {
+        qemu_notify_event();
+    }
 }
 
 static const SlirpCb slirp_cb = {
@@ -306,6 +457,66 @@ static void net_slirp_poll_notify(Notifier *notifier, void *data)
     }
 }
 
+static gboolean net_slirp_source_prepare(GSource *source, gint *timeout)
+{
+    SlirpState *s = ((NetSlirpSource *)source)->s;
+    uint32_t slirp_timeout = UINT32_MAX;
+    int i;
+
+    for (i = 0; i < s->pollfds->len; i++) {
+        g_source_remove_poll(source, &g_array_index(s->pollfds, GPollFD, i));
+    }
+    g_array_set_size(s->pollfds, 0);
+
+    aio_context_acquire(s->ctx);
+    slirp_pollfds_fill(s->slirp, &slirp_timeout,
+                       net_slirp_add_poll, s->pollfds);
+    aio_context_release(s->ctx);
+
+    /* The array does not grow any more until the next prepare */
+    for (i = 0; i < s->pollfds->len; i++) {
+        g_source_add_poll(source, &g_array_index(s->pollfds, GPollFD, i));
+    }
+
+    *timeout = slirp_timeout == UINT32_MAX ? -1 : slirp_timeout;
+    return false;
+}
+
+static gboolean net_slirp_source_check(GSource *source)
+{
+    /* Like the main loop, give slirp a chance to run its fast timers */
+    return true;
+}
+
+static gboolean net_slirp_source_dispatch(GSource *source,
+                                          GSourceFunc callback,
+                                          gpointer user_data)
+{
+    SlirpState *s = ((NetSlirpSource *)source)->s;
+
+    aio_context_acquire(s->ctx);
+    slirp_pollfds_poll(s->slirp, false, net_slirp_get_revents, s->pollfds);
+    aio_context_release(s->ctx);
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs net_slirp_source_funcs = {
+    .prepare = net_slirp_source_prepare,
+    .check = net_slirp_source_check,
+    .dispatch = net_slirp_source_dispatch,
+};
+
+static void net_slirp_iothread_start(SlirpState *s, IOThread *iothread)
+{
+    object_ref(OBJECT(iothread));
+    s->iothread = iothread;
+    s->ctx = iothread_get_aio_context(iothread);
+    s->pollfds = g_array_new(false, false, sizeof(GPollFD));
+    s->tx = g_array_sized_new(false, false, sizeof(struct iovec),
+                              NET_SLIRP_TX_BATCH);
+    s->tx_bh = qemu_bh_new(net_slirp_tx_bh, s);
+}
+
 static ssize_t
 net_slirp_stream_read(void *buf, size_t size, void *opaque)
 {
@@ -329,16 +540,22 @@ net_slirp_stream_write(const void *buf, size_t size, void *opaque)
 
 static int net_slirp_state_load(QEMUFile *f, void *opaque, int version_id)
 {
-    Slirp *slirp = opaque;
+    SlirpState *s = opaque;
+    int ret;
 
-    return slirp_state_load(slirp, version_id, net_slirp_stream_read, f);
+    net_slirp_lock(s);
+    ret = slirp_state_load(s->slirp, version_id, net_slirp_stream_read, f);
+    net_slirp_unlock(s);
+    return ret;
 }
 
 static void net_slirp_state_save(QEMUFile *f, void *opaque)
 {
-    Slirp *slirp = opaque;
+    SlirpState *s = opaque;
 
-    slirp_state_save(slirp, net_slirp_stream_write, f);
+    net_slirp_lock(s);
+    slirp_state_save(s->slirp, net_slirp_stream_write, f);
+    net_slirp_unlock(s);
 }
 
 static SaveVMHandlers savevm_slirp_state = {
@@ -357,7 +574,7 @@ static int net_slirp_init(NetClientState *peer, const char *model,
                           const char *smb_export, const char *vsmbserver,
                           const char **dnssearch, const char *vdomainname,
                           const char *tftp_server_name,
-                          Error **errp)
+                          IOThread *iothread, Error **errp)
 {
     /* default settings according to historic slirp */
     struct in_addr net  = { .s_addr = htonl(0x0a000200) }; /* 10.0.2.0 */
@@ -558,6 +775,9 @@ static int net_slirp_init(NetClientState *peer, const char *model,
              restricted ? "on" : "off");
 
     s = DO_UPCAST(SlirpState, nc, nc);
+    if (iothread) {
+        net_slirp_iothread_start(s, iothread);
+    }
 
     s->slirp = slirp_init(restricted, ipv4, net, mask, host,
                           ipv6, ip6_prefix, vprefix6_len, ip6_host,
@@ -577,10 +797,17 @@ static int net_slirp_init(NetClientState *peer, const char *model,
      */
     g_assert(slirp_state_version() == 4);
     register_savevm_live("slirp", 0, slirp_state_version(),
-                         &savevm_slirp_state, s->slirp);
+                         &savevm_slirp_state, s);
 
-    s->poll_notifier.notify = net_slirp_poll_notify;
-    main_loop_poll_add_notifier(&s->poll_notifier);
+    if (s->ctx) {
+        s->source = g_source_new(&net_slirp_source_funcs,
+                                 sizeof(NetSlirpSource));
+        ((NetSlirpSource *)s->source)->s = s;
+        g_source_attach(s->source, iothread_get_g_main_context(iothread));
+    } else {
+        s->poll_notifier.notify = net_slirp_poll_notify;
+        main_loop_poll_add_notifier(&s->poll_notifier);
+    }
 
     for (config = slirp_configs; config; config = config->next) {
         if (config->flags & SLIRP_CFG_HOSTFWD) {
@@ -679,7 +906,9 @@ void hmp_hostfwd_remove(Monitor *mon, const QDict *qdict)
         goto fail_syntax;
     }
 
+    net_slirp_lock(s);
     err = slirp_remove_hostfwd(s->slirp, is_udp, host_addr, host_port);
+    net_slirp_unlock(s);
 
     monitor_printf(mon, "host forwarding rule for %s %s\n", src_str,
                    err ? "not found" : "removed");
@@ -699,6 +928,7 @@ static int slirp_hostfwd(SlirpState *s, const char *redir_str, Error **errp)
     int is_udp;
     char *end;
     const char *fail_reason = "Unknown reason";
+    int ret;
 
     p = redir_str;
     if (!p || get_str_sep(buf, sizeof(buf), &p, ':') < 0) {
@@ -748,8 +978,11 @@ static int slirp_hostfwd(SlirpState *s, const char *redir_str, Error **errp)
         goto fail_syntax;
     }
 
-    if (slirp_add_hostfwd(s->slirp, is_udp, host_addr, host_port, guest_addr,
-                          guest_port) < 0) {
+    net_slirp_lock(s);
+    ret = slirp_add_hostfwd(s->slirp, is_udp, host_addr, host_port,
+                            guest_addr, guest_port);
+    net_slirp_unlock(s);
+    if (ret < 0) {
         error_setg(errp, "Could not set up host forwarding rule '%s'",
                    redir_str);
         return -1;
@@ -814,6 +1047,7 @@ static int slirp_smb(SlirpState* s, const char *exported_dir,
     char *smb_cmdline;
     struct passwd *passwd;
     FILE *f;
+    int ret;
 
     passwd = getpwuid(geteuid());
     if (!passwd) {
@@ -889,8 +1123,13 @@ static int slirp_smb(SlirpState* s, const char *exported_dir,
              CONFIG_SMBD_COMMAND, s->smb_dir, smb_conf);
     g_free(smb_conf);
 
-    if (slirp_add_exec(s->slirp, smb_cmdline, &vserver_addr, 139) < 0 ||
-        slirp_add_exec(s->slirp, smb_cmdline, &vserver_addr, 445) < 0) {
+    net_slirp_lock(s);
+    ret = slirp_add_exec(s->slirp, smb_cmdline, &vserver_addr, 139);
+    if (ret >= 0) {
+        ret = slirp_add_exec(s->slirp, smb_cmdline, &vserver_addr, 445);
+    }
+    net_slirp_unlock(s);
+    if (ret < 0) {
         slirp_smb_cleanup(s);
         g_free(smb_cmdline);
         error_setg(errp, "Conflicting/invalid smbserver address");
@@ -905,13 +1144,21 @@ static int slirp_smb(SlirpState* s, const char *exported_dir,
 static int guestfwd_can_read(void *opaque)
 {
     struct GuestFwd *fwd = opaque;
-    return slirp_socket_can_recv(fwd->slirp, fwd->server, fwd->port);
+    int ret;
+
+    net_slirp_lock(fwd->s);
+    ret = slirp_socket_can_recv(fwd->s->slirp, fwd->server, fwd->port);
+    net_slirp_unlock(fwd->s);
+    return ret;
 }
 
 static void guestfwd_read(void *opaque, const uint8_t *buf, int size)
 {
     struct GuestFwd *fwd = opaque;
-    slirp_socket_recv(fwd->slirp, fwd->server, fwd->port, buf, size);
+
+    net_slirp_lock(fwd->s);
+    slirp_socket_recv(fwd->s->slirp, fwd->server, fwd->port, buf, size);
+    net_slirp_unlock(fwd->s);
 }
 
 static ssize_t guestfwd_write(const void *buf, size_t len, void *chr)
@@ -928,6 +1175,7 @@ static int slirp_guestfwd(SlirpState *s, const char *config_str, Error **errp)
     char buf[128];
     char *end;
     int port;
+    int ret;
 
     p = config_str;
     if (get_str_sep(buf, sizeof(buf), &p, ':') < 0) {
@@ -953,7 +1201,10 @@ static int slirp_guestfwd(SlirpState *s, const char *config_str, Error **errp)
     snprintf(buf, sizeof(buf), "guestfwd.tcp.%d", port);
 
     if (g_str_has_prefix(p, "cmd:")) {
-        if (slirp_add_exec(s->slirp, &p[4], &server, port) < 0) {
+        net_slirp_lock(s);
+        ret = slirp_add_exec(s->slirp, &p[4], &server, port);
+        net_slirp_unlock(s);
+        if (ret < 0) {
             error_setg(errp, "Conflicting/invalid host:port in guest "
                        "forwarding rule '%s'", config_str);
             return -1;
@@ -981,8 +1232,11 @@ static int slirp_guestfwd(SlirpState *s, const char *config_str, Error **errp)
             return -1;
         }
 
-        if (slirp_add_guestfwd(s->slirp, guestfwd_write, &fwd->hd,
-                               &server, port) < 0) {
+        net_slirp_lock(s);
+        ret = slirp_add_guestfwd(s->slirp, guestfwd_write, &fwd->hd,
+                                 &server, port);
+        net_slirp_unlock(s);
+        if (ret < 0) {
             error_setg(errp, "Conflicting/invalid host:port in guest "
                        "forwarding rule '%s'", config_str);
             qemu_chr_fe_deinit(&fwd->hd, true);
@@ -991,7 +1245,7 @@ static int slirp_guestfwd(SlirpState *s, const char *config_str, Error **errp)
         }
         fwd->server = server;
         fwd->port = port;
-        fwd->slirp = s->slirp;
+        fwd->s = s;
 
         qemu_chr_fe_set_handlers(&fwd->hd, guestfwd_can_read, guestfwd_read,
                                  NULL, NULL, fwd, NULL, true);
@@ -1011,7 +1265,11 @@ void hmp_info_usernet(Monitor *mon, const QDict *qdict)
     QTAILQ_FOREACH(s, &slirp_stacks, entry) {
         int id;
         bool got_hub_id = net_hub_id_for_client(&s->nc, &id) == 0;
-        char *info = slirp_connection_info(s->slirp);
+        char *info;
+
+        net_slirp_lock(s);
+        info = slirp_connection_info(s->slirp);
+        net_slirp_unlock(s);
         monitor_printf(mon, "Hub %d (%s):\n%s",
                        got_hub_id ? id : -1,
                        s->nc.name, info);
@@ -1069,10 +1327,19 @@ int net_init_slirp(const Netdev *netdev, const char *name,
     const NetdevUserOptions *user;
     const char **dnssearch;
     bool ipv4 = true, ipv6 = true;
+    IOThread *iothread = NULL;
 
     assert(netdev->type == NET_CLIENT_DRIVER_USER);
     user = &netdev->u.user;
 
+    if (user->has_iothread) {
+        iothread = iothread_by_id(user->iothread);
+        if (!iothread) {
+            error_setg(errp, "IOThread '%s' not found", user->iothread);
+            return -1;
+        }
+    }
+
     if ((user->has_ipv6 && user->ipv6 && !user->has_ipv4) ||
         (user->has_ipv4 && !user->ipv4)) {
         ipv4 = 0;
@@ -1100,7 +1367,7 @@ int net_init_slirp(const Netdev *netdev, const char *name,
                          user->bootfile, user->dhcpstart,
                          user->dns, user->ipv6_dns, user->smb,
                          user->smbserver, dnssearch, user->domainname,
-                         user->tftp_server_name, errp);
+                         user->tftp_server_name, iothread, errp);
 
     while (slirp_configs) {
         config = slirp_configs;
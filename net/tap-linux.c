@@ -219,6 +219,17 @@ int tap_fd_set_vnet_le(int fd, int is_le)
     abort();
 }
 
+int tap_fd_set_steering_ebpf(int fd, int prog_fd)
+{
+    if (ioctl(fd, TUNSETSTEERINGEBPF, &prog_fd) != 0) {
+        error_report("Issue while setting TUNSETSTEERINGEBPF: %s with fd: %d,"
+                     " prog_fd: %d.", strerror(errno), fd, prog_fd);
+        return -1;
+    }
+
+    return 0;
+}
+
 int tap_fd_set_vnet_be(int fd, int is_be)
 {
     int arg = is_be ? 1 : 0;
@@ -231,6 +231,11 @@ int tap_fd_set_vnet_le(int fd, int is_le)
     return -EINVAL;
 }
 
+int tap_fd_set_steering_ebpf(int fd, int prog_fd)
+{
+    return -1;
+}
+
 int tap_fd_set_vnet_be(int fd, int is_be)
 {
     return -EINVAL;
@@ -47,12 +47,21 @@
 
 #include "net/vhost_net.h"
 
+/*
+ * Packets read from the tap device in one go before being handed over to
+ * the peer.  The buffers are only touched as far as the packets go.
+ */
+#define TAP_RX_BATCH 16
+
+/* Packets processed per tap_send() call, see there */
+#define TAP_RX_BUDGET 50
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
-    uint8_t buf[NET_BUFSIZE];
+    uint8_t buf[TAP_RX_BATCH][NET_BUFSIZE];
     bool read_poll;
     bool write_poll;
     bool using_vnet_hdr;
@@ -184,38 +193,47 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
-    int size;
+    struct iovec pkts[TAP_RX_BATCH];
+    int size = 0;
     int packets = 0;
 
-    while (true) {
-        uint8_t *buf = s->buf;
+    /*
+     * When the host keeps receiving more packets while tap_send() is
+     * running we can hog the QEMU global mutex.  Limit the number of
+     * packets that are processed per tap_send() callback to prevent
+     * stalling the guest.
+     */
+    while (packets < TAP_RX_BUDGET) {
+        int count;
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
-        if (size <= 0) {
-            break;
-        }
+        /* A tap device returns a single packet per read() */
+        for (count = 0; count < TAP_RX_BATCH; count++) {
+            uint8_t *buf = s->buf[count];
+
+            size = tap_read_packet(s->fd, buf, NET_BUFSIZE);
+            if (size <= 0) {
+                break;
+            }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
+            if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+                buf  += s->host_vnet_hdr_len;
+                size -= s->host_vnet_hdr_len;
+            }
+            pkts[count].iov_base = buf;
+            pkts[count].iov_len = size;
+        }
+        if (!count) {
+            break;
         }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
+        if (qemu_send_packet_batch(&s->nc, pkts, count,
+                                   tap_send_completed) < count) {
             tap_read_poll(s, false);
             break;
-        } else if (size < 0) {
-            break;
         }
+        packets += count;
 
-        /*
-         * When the host keeps receiving more packets while tap_send() is
-         * running we can hog the QEMU global mutex.  Limit the number of
-         * packets that are processed per tap_send() callback to prevent
-         * stalling the guest.
-         */
-        packets++;
-        if (packets >= 50) {
+        if (size <= 0) {
             break;
         }
     }
@@ -271,6 +289,14 @@ static void tap_using_vnet_hdr(NetClientState *nc, bool using_vnet_hdr)
     s->using_vnet_hdr = using_vnet_hdr;
 }
 
+static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+    assert(nc->info->type == NET_CLIENT_DRIVER_TAP);
+
+    return tap_fd_set_steering_ebpf(s->fd, prog_fd) == 0;
+}
+
 static int tap_set_vnet_le(NetClientState *nc, bool is_le)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -361,6 +387,7 @@ static NetClientInfo net_tap_info = {
     .set_offload = tap_set_offload,
     .set_vnet_hdr_len = tap_set_vnet_hdr_len,
     .set_vnet_le = tap_set_vnet_le,
+    .set_steering_ebpf = tap_set_steering_ebpf,
     .set_vnet_be = tap_set_vnet_be,
 };
 
@@ -212,6 +212,11 @@ void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 {
     bool success;
 
+    qemu_plugin_vcpu_mem_buf_flush(cpu);
+    g_free(cpu->plugin_mem_buf);
+    cpu->plugin_mem_buf = cpu->plugin_mem_buf_pos = NULL;
+    cpu->plugin_mem_buf_len = 0;
+
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
 
     qemu_rec_mutex_lock(&plugin.lock);
@@ -266,7 +271,7 @@ static struct qemu_plugin_dyn_cb *plugin_get_dyn_cb(GArray **arr)
 void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_mem_rw rw,
                                enum qemu_plugin_op op, void *ptr,
-                               uint64_t imm)
+                               size_t stride, uint64_t imm)
 {
     struct qemu_plugin_dyn_cb *dyn_cb;
 
@@ -276,6 +281,7 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
     dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.stride = stride;
 }
 
 static inline uint32_t cb_to_tcg_flags(enum qemu_plugin_cb_flags flags)
@@ -325,6 +331,15 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->f.generic = cb;
 }
 
+void plugin_register_vcpu_mem_buf(GArray **arr, enum qemu_plugin_mem_rw rw)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->type = PLUGIN_CB_BUF;
+    dyn_cb->rw = rw;
+}
+
 void qemu_plugin_tb_trans_cb(CPUState *cpu, struct qemu_plugin_tb *tb)
 {
     struct qemu_plugin_cb *cb, *next;
@@ -376,6 +391,7 @@ void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret)
 
 void qemu_plugin_vcpu_idle_cb(CPUState *cpu)
 {
+    qemu_plugin_vcpu_mem_buf_flush(cpu);
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_IDLE);
 }
 
@@ -416,19 +432,96 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
-    uint64_t *val = cb->userp;
+    uint64_t *val = cb->userp + cpu_index * cb->inline_insn.stride;
 
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
 }
 
+/*
+ * Memory trace buffer.  Instructions with PLUGIN_CB_BUF callbacks store
+ * their records inline at plugin_mem_buf_pos, without checking for room:
+ * the TB first calls qemu_plugin_vcpu_mem_buf_reserve with the number of
+ * inline stores it contains, which flushes the buffer if needed.
+ */
+#define PLUGIN_MEM_BUF_LEN 4096
+
+void qemu_plugin_vcpu_mem_buf_flush(CPUState *cpu)
+{
+    struct qemu_plugin_cb *cb, *next;
+    enum qemu_plugin_event ev = QEMU_PLUGIN_EV_VCPU_MEM_BUF;
+    size_t n = cpu->plugin_mem_buf_pos - cpu->plugin_mem_buf;
+
+    if (!n) {
+        return;
+    }
+    QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
+        qemu_plugin_vcpu_mem_buf_cb_t func = cb->f.vcpu_mem_buf;
+
+        func(cpu->cpu_index, cpu->plugin_mem_buf, n, cb->udata);
+    }
+    cpu->plugin_mem_buf_pos = cpu->plugin_mem_buf;
+}
+
+static void plugin_mem_buf_make_room(CPUState *cpu, size_t n)
+{
+    if (unlikely(n > cpu->plugin_mem_buf_len)) {
+        /* first use, or a TB with more records than the buffer holds */
+        qemu_plugin_vcpu_mem_buf_flush(cpu);
+        cpu->plugin_mem_buf_len = MAX(n, PLUGIN_MEM_BUF_LEN);
+        cpu->plugin_mem_buf = g_renew(struct qemu_plugin_mem_record,
+                                      cpu->plugin_mem_buf,
+                                      cpu->plugin_mem_buf_len);
+        cpu->plugin_mem_buf_pos = cpu->plugin_mem_buf;
+    } else if (cpu->plugin_mem_buf_pos + n >
+               cpu->plugin_mem_buf + cpu->plugin_mem_buf_len) {
+        qemu_plugin_vcpu_mem_buf_flush(cpu);
+    }
+}
+
+/* Called at the start of a TB that stores @udata records inline */
+void qemu_plugin_vcpu_mem_buf_reserve(unsigned int vcpu_index, void *udata)
+{
+    CPUState *cpu = current_cpu;
+    size_t n = (uintptr_t)udata;
+
+    plugin_mem_buf_make_room(cpu, n);
+    cpu->plugin_mem_buf_reserved = n;
+}
+
+void qemu_plugin_tb_mem_buf_reserve(struct qemu_plugin_tb *tb, size_t n)
+{
+    plugin_register_dyn_cb__udata(&tb->cbs[PLUGIN_CB_REGULAR],
+                                  qemu_plugin_vcpu_mem_buf_reserve,
+                                  QEMU_PLUGIN_CB_NO_REGS, (void *)n);
+}
+
+/* Accesses done from helpers: keep room for the TB's inline stores */
+static void plugin_mem_buf_record(CPUState *cpu, uint64_t vaddr, uint32_t info)
+{
+    plugin_mem_buf_make_room(cpu, cpu->plugin_mem_buf_reserved + 1);
+    cpu->plugin_mem_buf_pos->vaddr = vaddr;
+    cpu->plugin_mem_buf_pos->info = info;
+    cpu->plugin_mem_buf_pos++;
+}
+
+void qemu_plugin_register_vcpu_mem_buf_cb(qemu_plugin_id_t id,
+                                          qemu_plugin_vcpu_mem_buf_cb_t cb,
+                                          void *udata)
+{
+    plugin_register_cb_udata(id, QEMU_PLUGIN_EV_VCPU_MEM_BUF, cb, udata);
+}
+
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
 {
     GArray *arr = cpu->plugin_mem_cbs;
@@ -450,7 +543,10 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
             cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
+            break;
+        case PLUGIN_CB_BUF:
+            plugin_mem_buf_record(cpu, vaddr, info);
             break;
         default:
             g_assert_not_reached();
@@ -460,6 +556,18 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
 
 void qemu_plugin_atexit_cb(void)
 {
+#ifdef CONFIG_USER_ONLY
+    /* the other threads may still be running */
+    if (current_cpu) {
+        qemu_plugin_vcpu_mem_buf_flush(current_cpu);
+    }
+#else
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        qemu_plugin_vcpu_mem_buf_flush(cpu);
+    }
+#endif
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
 }
 
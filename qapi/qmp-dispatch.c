@@ -104,10 +104,13 @@ typedef struct QmpDispatchBH {
 static void do_qmp_dispatch_bh(void *opaque)
 {
     QmpDispatchBH *data = opaque;
+    QSPBQLContext bql_ctx;
 
     assert(monitor_cur() == NULL);
     monitor_set_cur(qemu_coroutine_self(), data->cur_mon);
+    qsp_bql_context_push(&bql_ctx, "qmp", NULL, data->cmd->name);
     data->cmd->fn(data->args, data->ret, data->errp);
+    qsp_bql_context_pop(&bql_ctx);
     monitor_set_cur(qemu_coroutine_self(), NULL);
     aio_co_wake(data->co);
 }
@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include <getopt.h>
+#include <math.h>
 
 #include "qemu-common.h"
 #include "qemu-version.h"
@@ -45,9 +46,12 @@
 #include "qemu/units.h"
 #include "qom/object_interfaces.h"
 #include "sysemu/block-backend.h"
+#include "block/accounting.h"
 #include "block/block_int.h"
 #include "block/blockjob.h"
 #include "block/qapi.h"
+#include "block/thread-pool.h"
+#include "qemu/bitmap.h"
 #include "crypto/init.h"
 #include "trace/control.h"
 #include "qemu/throttle.h"
@@ -83,6 +87,10 @@ enum {
     OPTION_MERGE = 274,
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
+    OPTION_JOBS = 277,
+    OPTION_RW_MIX = 278,
+    OPTION_RANDOM = 279,
+    OPTION_ZIPF = 280,
 };
 
 typedef enum OutputFormat {
@@ -198,7 +206,7 @@ static void QEMU_NORETURN help(void)
            "Parameters to convert subcommand:\n"
            "  '--bitmaps' copies all top-level persistent bitmaps to destination\n"
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
-           "       process (defaults to 8)\n"
+           "       process (defaults to 16)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
@@ -1191,8 +1199,9 @@ static int64_t find_nonzero(const uint8_t *buf, int64_t n)
 }
 
 /*
- * Returns true iff the first sector pointed to by 'buf' contains at least
- * a non-NUL byte.
+ * Returns true iff sector 'first' of a buffer contains at least a non-NUL
+ * byte.  'zero_map' has a bit set for each sector of the buffer that only
+ * contains zeroes.
  *
  * 'pnum' is set to the number of sectors (including and immediately following
  * the first one) that are known to be in the same allocated/unallocated state.
@@ -1200,8 +1209,9 @@ static int64_t find_nonzero(const uint8_t *buf, int64_t n)
  * that the request will at least end aligned and consecutive requests will
  * also start at an aligned offset.
  */
-static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum,
-                                int64_t sector_num, int alignment)
+static int is_allocated_sectors(const unsigned long *zero_map, int first,
+                                int n, int *pnum, int64_t sector_num,
+                                int alignment)
 {
     bool is_zero;
     int i, tail;
@@ -1210,10 +1220,9 @@ static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum,
         *pnum = 0;
         return 0;
     }
-    is_zero = buffer_is_zero(buf, BDRV_SECTOR_SIZE);
+    is_zero = test_bit(first, zero_map);
     for(i = 1; i < n; i++) {
-        buf += BDRV_SECTOR_SIZE;
-        if (is_zero != buffer_is_zero(buf, BDRV_SECTOR_SIZE)) {
+        if (is_zero != test_bit(first + i, zero_map)) {
             break;
         }
     }
@@ -1243,8 +1252,8 @@ static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum,
  * up to 'min' consecutive sectors containing zeros are ignored. This avoids
  * breaking up write requests for only small sparse areas.
  */
-static int is_allocated_sectors_min(const uint8_t *buf, int n, int *pnum,
-    int min, int64_t sector_num, int alignment)
+static int is_allocated_sectors_min(const unsigned long *zero_map, int first,
+    int n, int *pnum, int min, int64_t sector_num, int alignment)
 {
     int ret;
     int num_checked, num_used;
@@ -1253,21 +1262,23 @@ static int is_allocated_sectors_min(const uint8_t *buf, int n, int *pnum,
         min = n;
     }
 
-    ret = is_allocated_sectors(buf, n, pnum, sector_num, alignment);
+    ret = is_allocated_sectors(zero_map, first, n, pnum, sector_num,
+                               alignment);
     if (!ret) {
         return ret;
     }
 
     num_used = *pnum;
-    buf += BDRV_SECTOR_SIZE * *pnum;
+    first += *pnum;
     n -= *pnum;
     sector_num += *pnum;
     num_checked = num_used;
 
     while (n > 0) {
-        ret = is_allocated_sectors(buf, n, pnum, sector_num, alignment);
+        ret = is_allocated_sectors(zero_map, first, n, pnum, sector_num,
+                                   alignment);
 
-        buf += BDRV_SECTOR_SIZE * *pnum;
+        first += *pnum;
         n -= *pnum;
         sector_num += *pnum;
         num_checked += *pnum;
@@ -1670,8 +1681,10 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 64
 #define CONVERT_THROTTLE_GROUP "img_convert"
+#define CONVERT_DEFAULT_COROUTINES 16
+#define CONVERT_BUF_SIZE (4 * MiB)
 
 typedef struct ImgConvertState {
     BlockBackend **src;
@@ -1879,11 +1892,52 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
 }
 
 
+typedef struct ConvertZeroScan {
+    const uint8_t *buf;
+    int nb_sectors;
+    unsigned long *zero_map;
+} ConvertZeroScan;
+
+static int convert_zero_scan(void *opaque)
+{
+    ConvertZeroScan *scan = opaque;
+    int i;
+
+    for (i = 0; i < scan->nb_sectors; i++) {
+        if (buffer_is_zero(scan->buf + i * BDRV_SECTOR_SIZE,
+                           BDRV_SECTOR_SIZE)) {
+            set_bit(i, scan->zero_map);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Find the sectors of @buf that only contain zeroes.  The scan runs in a
+ * worker thread so that it overlaps with the I/O of the other coroutines.
+ */
+static void coroutine_fn convert_co_scan_zeroes(const uint8_t *buf,
+                                                int nb_sectors,
+                                                unsigned long *zero_map)
+{
+    ConvertZeroScan scan = {
+        .buf = buf,
+        .nb_sectors = nb_sectors,
+        .zero_map = zero_map,
+    };
+    ThreadPool *pool = aio_get_thread_pool(qemu_get_current_aio_context());
+
+    bitmap_zero(zero_map, nb_sectors);
+    thread_pool_submit_co(pool, convert_zero_scan, &scan);
+}
+
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
+                                         const unsigned long *zero_map,
                                          enum ImgConvertBlockStatus status)
 {
     int ret;
+    int first = 0;
 
     while (nb_sectors > 0) {
         int n = nb_sectors;
@@ -1906,10 +1960,11 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * zeroed. */
             if (!s->min_sparse ||
                 (!s->compressed &&
-                 is_allocated_sectors_min(buf, n, &n, s->min_sparse,
-                                          sector_num, s->alignment)) ||
+                 is_allocated_sectors_min(zero_map, first, n, &n,
+                                          s->min_sparse, sector_num,
+                                          s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 find_next_zero_bit(zero_map, first + n, first) < first + n))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -1938,6 +1993,7 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
         sector_num += n;
         nb_sectors -= n;
         buf += n * BDRV_SECTOR_SIZE;
+        first += n;
     }
 
     return 0;
@@ -1978,6 +2034,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
     uint8_t *buf = NULL;
+    unsigned long *zero_map;
     int ret, i;
     int index = -1;
 
@@ -1991,12 +2048,14 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 
     s->running_coroutines++;
     buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
+    zero_map = bitmap_new(s->buf_sectors);
 
     while (1) {
         int n;
         int64_t sector_num;
         enum ImgConvertBlockStatus status;
         bool copy_range;
+        bool copy_range_failed = false;
 
         qemu_co_mutex_lock(&s->lock);
         if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
@@ -2027,13 +2086,16 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         }
 
 retry:
-        copy_range = s->copy_range && s->status == BLK_DATA;
+        copy_range = s->copy_range && !copy_range_failed &&
+                     s->status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
             ret = convert_co_read(s, sector_num, n, buf);
             if (ret < 0) {
                 error_report("error while reading at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
                 s->ret = ret;
+            } else if (s->min_sparse) {
+                convert_co_scan_zeroes(buf, n, zero_map);
             }
         } else if (!s->min_sparse && status == BLK_ZERO) {
             status = BLK_DATA;
@@ -2053,11 +2115,20 @@ retry:
             if (copy_range) {
                 ret = convert_co_copy_range(s, sector_num, n);
                 if (ret) {
-                    s->copy_range = false;
+                    /*
+                     * Only stop offloading if the block drivers cannot do it
+                     * at all; other failures (e.g. a range crossing file
+                     * systems) only affect this extent.
+                     */
+                    if (ret == -ENOTSUP) {
+                        s->copy_range = false;
+                    }
+                    copy_range_failed = true;
                     goto retry;
                 }
             } else {
-                ret = convert_co_write(s, sector_num, n, buf, status);
+                ret = convert_co_write(s, sector_num, n, buf, zero_map,
+                                       status);
             }
             if (ret < 0) {
                 error_report("error while writing at byte %lld: %s",
@@ -2085,6 +2156,7 @@ retry:
     }
 
     qemu_vfree(buf);
+    g_free(zero_map);
     s->co[index] = NULL;
     s->running_coroutines--;
     if (!s->running_coroutines && s->ret == -EINPROGRESS) {
@@ -2224,9 +2296,9 @@ static int img_convert(int argc, char **argv)
         /* Need at least 4k of zeros for sparse detection */
         .min_sparse         = 8,
         .copy_range         = false,
-        .buf_sectors        = IO_BUF_SIZE / BDRV_SECTOR_SIZE,
+        .buf_sectors        = CONVERT_BUF_SIZE / BDRV_SECTOR_SIZE,
         .wr_in_order        = true,
-        .num_coroutines     = 8,
+        .num_coroutines     = CONVERT_DEFAULT_COROUTINES,
     };
 
     for(;;) {
@@ -2401,6 +2473,15 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
+    /*
+     * Try copy offloading (copy_file_range, reflinks) whenever nothing
+     * requires the data to go through qemu-img.  Requests fall back to
+     * reading and writing if the block drivers cannot offload them.
+     */
+    if (!s.compressed && !explict_min_sparse && !s.salvage) {
+        s.copy_range = true;
+    }
+
     if (tgt_image_opts && !skip_create) {
         error_report("--target-image-opts requires use of -n flag");
         goto fail_getopt;
@@ -2681,7 +2762,7 @@ static int img_convert(int argc, char **argv)
         goto out;
     }
 
-    /* increase bufsectors from the default 4096 (2M) if opt_transfer
+    /* increase bufsectors from the default 8192 (4M) if opt_transfer
      * or discard_alignment of the out_bs is greater. Limit to
      * MAX_BUF_SECTORS as maximum which is currently 32768 (16MB). */
     s.buf_sectors = MIN(MAX_BUF_SECTORS,
@@ -4307,10 +4388,99 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+/*
+ * Zipfian distribution over the ranks 1..n, sampled in constant time with
+ * the rejection-inversion method of Hörmann and Derflinger.  Rank 1 is the
+ * most popular one.
+ */
+typedef struct BenchZipf {
+    double theta;
+    uint64_t n;
+    double h_integral_x1;
+    double h_integral_n;
+    double s;
+} BenchZipf;
+
+/* log1p(x) / x, extended continuously to x == 0 */
+static double bench_zipf_helper1(double x)
+{
+    if (fabs(x) > 1e-8) {
+        return log1p(x) / x;
+    }
+    return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+/* expm1(x) / x, extended continuously to x == 0 */
+static double bench_zipf_helper2(double x)
+{
+    if (fabs(x) > 1e-8) {
+        return expm1(x) / x;
+    }
+    return 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+static double bench_zipf_h(BenchZipf *z, double x)
+{
+    return exp(-z->theta * log(x));
+}
+
+static double bench_zipf_h_integral(BenchZipf *z, double x)
+{
+    double log_x = log(x);
+
+    return bench_zipf_helper2((1 - z->theta) * log_x) * log_x;
+}
+
+static double bench_zipf_h_integral_inverse(BenchZipf *z, double x)
+{
+    double t = MAX(x * (1 - z->theta), -1);
+
+    return exp(bench_zipf_helper1(t) * x);
+}
+
+static void bench_zipf_init(BenchZipf *z, double theta, uint64_t n)
+{
+    z->theta = theta;
+    z->n = n;
+    z->h_integral_x1 = bench_zipf_h_integral(z, 1.5) - 1;
+    z->h_integral_n = bench_zipf_h_integral(z, n + 0.5);
+    z->s = 2 - bench_zipf_h_integral_inverse(z, bench_zipf_h_integral(z, 2.5) -
+                                                bench_zipf_h(z, 2));
+}
+
+static uint64_t bench_zipf_next(BenchZipf *z, GRand *rand)
+{
+    for (;;) {
+        double u = z->h_integral_n +
+                   g_rand_double(rand) * (z->h_integral_x1 - z->h_integral_n);
+        double x = bench_zipf_h_integral_inverse(z, u);
+        uint64_t k = MIN(MAX(x + 0.5, 1), z->n);
+
+        if (k - x <= z->s ||
+            u >= bench_zipf_h_integral(z, k + 0.5) - bench_zipf_h(z, k)) {
+            return k;
+        }
+    }
+}
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchRequest {
+    BenchData *b;
+    QEMUIOVector qiov;
+    BlockAcctCookie acct;
+} BenchRequest;
+
+struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
     bool write;
+    /* Percentage of reads if the workload mixes reads and writes, or -1 */
+    int read_percent;
+    /* Percentage of requests at a random offset instead of the next one */
+    int random_percent;
+    BenchZipf *zipf;
+    GRand *rand;
     int bufsize;
     int step;
     int nrreq;
@@ -4318,24 +4488,93 @@ typedef struct BenchData {
     int flush_interval;
     bool drain_on_flush;
     uint8_t *buf;
-    QEMUIOVector *qiov;
+    BenchRequest *reqs;
+    BenchRequest **free_reqs;
+    int nr_free_reqs;
+    BenchRequest flush_req;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
-} BenchData;
+};
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
+    BenchRequest *req = opaque;
+
     if (ret < 0) {
         error_report("Failed flush request: %s", strerror(-ret));
         exit(EXIT_FAILURE);
     }
+    block_acct_done(blk_get_stats(req->b->blk), &req->acct);
+    g_free(req);
+}
+
+static uint64_t bench_next_offset(BenchData *b)
+{
+    uint64_t offset;
+
+    if (b->random_percent &&
+        g_rand_int_range(b->rand, 0, 100) < b->random_percent) {
+        uint64_t nr_blocks = MAX(b->image_size / b->bufsize, 1);
+        uint64_t block;
+
+        if (b->zipf) {
+            /* Spread the popular blocks over the whole image */
+            block = (bench_zipf_next(b->zipf, b->rand) - 1) *
+                    0x9e3779b97f4a7c15ULL % nr_blocks;
+        } else {
+            block = MIN(g_rand_double(b->rand) * nr_blocks, nr_blocks - 1);
+        }
+        return block * b->bufsize;
+    }
+
+    offset = b->offset;
+    b->offset += b->step;
+    b->offset %= b->image_size;
+    return offset;
+}
+
+static void bench_cb(void *opaque, int ret);
+
+static void bench_submit(BenchData *b)
+{
+    BlockAcctStats *stats = blk_get_stats(b->blk);
+
+    while (b->n > b->in_flight && b->in_flight < b->nrreq) {
+        BenchRequest *req = b->free_reqs[--b->nr_free_reqs];
+        int64_t offset = bench_next_offset(b);
+        bool write = b->write;
+        BlockAIOCB *acb;
+
+        if (b->read_percent >= 0) {
+            write = g_rand_int_range(b->rand, 0, 100) >= b->read_percent;
+        }
+
+        /* blk_aio_* might look for completed I/Os and kick bench_cb
+         * again, so make sure this operation is counted by in_flight
+         * and b->offset is ready for the next submission.
+         */
+        b->in_flight++;
+        block_acct_start(stats, &req->acct, b->bufsize,
+                         write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
+        if (write) {
+            acb = blk_aio_pwritev(b->blk, offset, &req->qiov, 0, bench_cb, req);
+        } else {
+            acb = blk_aio_preadv(b->blk, offset, &req->qiov, 0, bench_cb, req);
+        }
+        if (!acb) {
+            error_report("Failed to issue request");
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
 static void bench_cb(void *opaque, int ret)
 {
-    BenchData *b = opaque;
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+    BlockAcctStats *stats = blk_get_stats(b->blk);
     BlockAIOCB *acb;
 
     if (ret < 0) {
@@ -4343,6 +4582,8 @@ static void bench_cb(void *opaque, int ret)
         exit(EXIT_FAILURE);
     }
 
+    block_acct_done(stats, &req->acct);
+
     if (b->in_flush) {
         /* Just finished a flush with drained queue: Start next requests */
         assert(b->in_flight == 0);
@@ -4352,20 +4593,26 @@ static void bench_cb(void *opaque, int ret)
 
         b->n--;
         b->in_flight--;
+        b->free_reqs[b->nr_free_reqs++] = req;
 
         /* Time for flush? Drain queue if requested, then flush */
         if (b->flush_interval && remaining % b->flush_interval == 0) {
             if (!b->in_flight || !b->drain_on_flush) {
                 BlockCompletionFunc *cb;
+                BenchRequest *flush_req;
 
                 if (b->drain_on_flush) {
                     b->in_flush = true;
+                    flush_req = &b->flush_req;
                     cb = bench_cb;
                 } else {
+                    flush_req = g_new0(BenchRequest, 1);
+                    flush_req->b = b;
                     cb = bench_undrained_flush_cb;
                 }
 
-                acb = blk_aio_flush(b->blk, cb, b);
+                block_acct_start(stats, &flush_req->acct, 0, BLOCK_ACCT_FLUSH);
+                acb = blk_aio_flush(b->blk, cb, flush_req);
                 if (!acb) {
                     error_report("Failed to issue flush request");
                     exit(EXIT_FAILURE);
@@ -4377,31 +4624,50 @@ static void bench_cb(void *opaque, int ret)
         }
     }
 
-    while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
-        /* blk_aio_* might look for completed I/Os and kick bench_cb
-         * again, so make sure this operation is counted by in_flight
-         * and b->offset is ready for the next submission.
-         */
-        b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
-        } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
-        }
-        if (!acb) {
-            error_report("Failed to issue request");
-            exit(EXIT_FAILURE);
-        }
+    bench_submit(b);
+}
+
+static void bench_print_latency(BlockAcctStats *stats, enum BlockAcctType type,
+                                const char *name)
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t latency_ns[ARRAY_SIZE(quantiles)];
+    uint64_t ops;
+
+    ops = block_acct_latency_percentiles(stats, type, quantiles, latency_ns,
+                                         ARRAY_SIZE(quantiles));
+    if (!ops) {
+        return;
     }
+
+    printf("  %s latency (us): avg %.1f, p50 %.1f, p90 %.1f, p99 %.1f, "
+           "p99.9 %.1f\n", name,
+           (double)stats->total_time_ns[type] / stats->nr_ops[type] / SCALE_US,
+           (double)latency_ns[0] / SCALE_US, (double)latency_ns[1] / SCALE_US,
+           (double)latency_ns[2] / SCALE_US, (double)latency_ns[3] / SCALE_US);
+}
+
+static void bench_print_stats(const char *filename, BlockBackend *blk,
+                              double seconds)
+{
+    BlockAcctStats *stats = blk_get_stats(blk);
+    uint64_t reads = stats->nr_ops[BLOCK_ACCT_READ];
+    uint64_t writes = stats->nr_ops[BLOCK_ACCT_WRITE];
+    uint64_t bytes = stats->nr_bytes[BLOCK_ACCT_READ] +
+                     stats->nr_bytes[BLOCK_ACCT_WRITE];
+
+    printf("%s: %" PRIu64 " reads, %" PRIu64 " writes, %.0f IOPS, "
+           "%.2f MiB/s\n", filename, reads, writes,
+           (reads + writes) / seconds, bytes / seconds / MiB);
+    bench_print_latency(stats, BLOCK_ACCT_READ, "read");
+    bench_print_latency(stats, BLOCK_ACCT_WRITE, "write");
+    bench_print_latency(stats, BLOCK_ACCT_FLUSH, "flush");
 }
 
 static int img_bench(int argc, char **argv)
 {
     int c, ret = 0;
-    const char *fmt = NULL, *filename;
+    const char *fmt = NULL;
     bool quiet = false;
     bool image_opts = false;
     bool is_write = false;
@@ -4413,13 +4679,20 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
-    int64_t image_size;
-    BlockBackend *blk = NULL;
-    BenchData data = {};
+    int nb_jobs = 1;
+    int read_percent = -1;
+    int random_percent = -1;
+    double zipf_theta = 0;
+    BenchZipf *zipfs = NULL;
+    int nb_images = 0;
+    BlockBackend **blks = NULL;
+    BenchData *jobs = NULL;
+    int nb_all_jobs = 0;
     int flags = 0;
     bool writethrough = false;
     struct timeval t1, t2;
-    int i;
+    double seconds;
+    int i, j, k;
     bool force_share = false;
     size_t buf_size;
 
@@ -4431,6 +4704,10 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"jobs", required_argument, 0, OPTION_JOBS},
+            {"rw-mix", required_argument, 0, OPTION_RW_MIX},
+            {"random", required_argument, 0, OPTION_RANDOM},
+            {"zipf", required_argument, 0, OPTION_ZIPF},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4564,13 +4841,66 @@ static int img_bench(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_JOBS:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res < 1 ||
+                res > INT_MAX) {
+                error_report("Invalid number of jobs specified");
+                return 1;
+            }
+            nb_jobs = res;
+            break;
+        }
+        case OPTION_RW_MIX:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid read percentage specified");
+                return 1;
+            }
+            read_percent = res;
+            break;
+        }
+        case OPTION_RANDOM:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid random percentage specified");
+                return 1;
+            }
+            random_percent = res;
+            break;
+        }
+        case OPTION_ZIPF:
+            if (qemu_strtod_finite(optarg, NULL, &zipf_theta) < 0 ||
+                zipf_theta <= 0) {
+                error_report("Invalid zipf exponent specified");
+                return 1;
+            }
+            break;
         }
     }
 
-    if (optind != argc - 1) {
-        error_exit("Expecting one image file name");
+    if (optind >= argc) {
+        error_exit("Expecting at least one image file name");
+    }
+    nb_images = argc - optind;
+
+    if (read_percent >= 0) {
+        /* A mixed workload replaces -w */
+        is_write = read_percent < 100;
+        if (is_write) {
+            flags |= BDRV_O_RDWR;
+        }
+    }
+    if (zipf_theta && random_percent < 0) {
+        random_percent = 100;
     }
-    filename = argv[argc - 1];
+    random_percent = MAX(random_percent, 0);
 
     if (!is_write && flush_interval) {
         error_report("--flush-interval is only available in write tests");
@@ -4583,70 +4913,144 @@ static int img_bench(int argc, char **argv)
         goto out;
     }
 
-    blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
-                   force_share);
-    if (!blk) {
+    if (count < nb_jobs) {
+        error_report("Request count can't be smaller than the number of jobs");
         ret = -1;
         goto out;
     }
 
-    image_size = blk_getlength(blk);
-    if (image_size < 0) {
-        ret = image_size;
-        goto out;
-    }
+    blks = g_new0(BlockBackend *, nb_images);
+    zipfs = g_new0(BenchZipf, nb_images);
+    jobs = g_new0(BenchData, nb_images * nb_jobs);
+    for (i = 0; i < nb_images; i++) {
+        int64_t image_size;
 
-    data = (BenchData) {
-        .blk            = blk,
-        .image_size     = image_size,
-        .bufsize        = bufsize,
-        .step           = step ?: bufsize,
-        .nrreq          = depth,
-        .n              = count,
-        .offset         = offset,
-        .write          = is_write,
-        .flush_interval = flush_interval,
-        .drain_on_flush = drain_on_flush,
-    };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
-    }
+        blks[i] = img_open(image_opts, argv[optind + i], fmt, flags,
+                           writethrough, quiet, force_share);
+        if (!blks[i]) {
+            ret = -1;
+            goto out;
+        }
+
+        image_size = blk_getlength(blks[i]);
+        if (image_size < 0) {
+            ret = image_size;
+            goto out;
+        }
+        if (image_size == 0) {
+            error_report("Image '%s' is empty", argv[optind + i]);
+            ret = -1;
+            goto out;
+        }
 
-    buf_size = data.nrreq * data.bufsize;
-    data.buf = blk_blockalign(blk, buf_size);
-    memset(data.buf, pattern, data.nrreq * data.bufsize);
+        if (zipf_theta) {
+            bench_zipf_init(&zipfs[i], zipf_theta,
+                            MAX(image_size / bufsize, 1));
+        }
 
-    blk_register_buf(blk, data.buf, buf_size);
+        /*
+         * The jobs of an image share its request count; sequential
+         * streams start at evenly spaced offsets.
+         */
+        for (j = 0; j < nb_jobs; j++) {
+            BenchData *b = &jobs[nb_all_jobs++];
+
+            *b = (BenchData) {
+                .blk            = blks[i],
+                .image_size     = image_size,
+                .bufsize        = bufsize,
+                .step           = step ?: bufsize,
+                .nrreq          = depth,
+                .n              = count / nb_jobs + (j < count % nb_jobs),
+                .offset         = (offset + j * (image_size / nb_jobs)) %
+                                  image_size,
+                .write          = is_write,
+                .read_percent   = read_percent,
+                .random_percent = random_percent,
+                .zipf           = zipf_theta ? &zipfs[i] : NULL,
+                .rand           = g_rand_new(),
+                .flush_interval = flush_interval,
+                .drain_on_flush = drain_on_flush,
+            };
+
+            buf_size = b->nrreq * b->bufsize;
+            b->buf = blk_blockalign(blks[i], buf_size);
+            memset(b->buf, pattern, buf_size);
+            blk_register_buf(blks[i], b->buf, buf_size);
+
+            b->reqs = g_new0(BenchRequest, b->nrreq);
+            b->free_reqs = g_new(BenchRequest *, b->nrreq);
+            for (k = 0; k < b->nrreq; k++) {
+                b->reqs[k].b = b;
+                qemu_iovec_init(&b->reqs[k].qiov, 1);
+                qemu_iovec_add(&b->reqs[k].qiov,
+                               b->buf + k * b->bufsize, b->bufsize);
+                b->free_reqs[b->nr_free_reqs++] = &b->reqs[k];
+            }
+            b->flush_req.b = b;
+        }
+    }
 
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
-    for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
-                       data.buf + i * data.bufsize, data.bufsize);
+    if (read_percent >= 0) {
+        printf("Sending %d requests (%d%% reads), %zu bytes each, "
+               "%d in parallel", count, read_percent, bufsize, depth);
+    } else {
+        printf("Sending %d %s requests, %zu bytes each, %d in parallel",
+               count, is_write ? "write" : "read", bufsize, depth);
+    }
+    printf(" (starting at offset %" PRId64 ", step size %zu)\n",
+           offset, step ?: bufsize);
+    if (random_percent) {
+        printf("%d%% of requests at %s random offsets\n", random_percent,
+               zipf_theta ? "zipfian" : "uniform");
+    }
+    if (nb_images > 1 || nb_jobs > 1) {
+        printf("Running %d job%s on each of %d image%s\n",
+               nb_jobs, nb_jobs > 1 ? "s" : "",
+               nb_images, nb_images > 1 ? "s" : "");
+    }
+    if (flush_interval) {
+        printf("Sending flush every %d requests\n", flush_interval);
     }
 
     gettimeofday(&t1, NULL);
-    bench_cb(&data, 0);
+    for (i = 0; i < nb_all_jobs; i++) {
+        bench_submit(&jobs[i]);
+    }
 
-    while (data.n > 0) {
-        main_loop_wait(false);
+    for (i = 0; i < nb_all_jobs; i++) {
+        while (jobs[i].n > 0) {
+            main_loop_wait(false);
+        }
     }
     gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    seconds = (t2.tv_sec - t1.tv_sec)
+              + ((double)(t2.tv_usec - t1.tv_usec) / 1000000);
+    printf("Run completed in %3.3f seconds.\n", seconds);
+    for (i = 0; i < nb_images; i++) {
+        bench_print_stats(argv[optind + i], blks[i], seconds);
+    }
 
 out:
-    if (data.buf) {
-        blk_unregister_buf(blk, data.buf);
+    for (i = 0; i < nb_all_jobs; i++) {
+        BenchData *b = &jobs[i];
+
+        for (k = 0; k < b->nrreq; k++) {
+            qemu_iovec_destroy(&b->reqs[k].qiov);
+        }
+        g_free(b->reqs);
+        g_free(b->free_reqs);
+        g_rand_free(b->rand);
+        blk_unregister_buf(b->blk, b->buf);
+        qemu_vfree(b->buf);
     }
-    qemu_vfree(data.buf);
-    blk_unref(blk);
+    g_free(jobs);
+    g_free(zipfs);
+    for (i = 0; blks && i < nb_images; i++) {
+        blk_unref(blks[i]);
+    }
+    g_free(blks);
 
     if (ret) {
         return 1;
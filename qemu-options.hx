@@ -113,9 +113,14 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "-accel [accel=]accelerator[,prop[=value][,...]]\n"
     "                select accelerator (kvm, xen, hax, hvf, whpx or tcg; use 'help' for a list)\n"
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
+    "                mapcache-bucket-size=size (Xen guest memory mapping granularity)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
+    "                halt-poll-max-ns=n (KVM userspace halt polling, default=0)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                hot-threshold=n (TCG superblock retranslation, default=0)\n"
+    "                tb-stats=on|off (gather statistics of each TCG block, default=off)\n"
+    "                atomic128-lock=on|off (lock-based 128-bit guest atomics, default=off)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -130,6 +135,14 @@ SRST
         integrated graphics devices can be passed through to the guest
         (default=off)
 
+    ``mapcache-bucket-size=size``
+        When Xen is in use, sets the size of the chunks of guest memory
+        that QEMU maps at once to emulate devices. Larger chunks mean
+        fewer remappings for guests doing DMA all over their memory, at
+        the cost of address space. It must be a power of 2, of at most
+        1G on 64-bit hosts and 16M on 32-bit hosts (default=1M on 64-bit
+        hosts, 64K on 32-bit hosts).
+
     ``kernel-irqchip=on|off|split``
         Controls KVM in-kernel irqchip support. The default is full
         acceleration of the interrupt controllers. On x86, split irqchip
@@ -140,9 +153,37 @@ SRST
     ``kvm-shadow-mem=size``
         Defines the size of the KVM shadow MMU.
 
+    ``halt-poll-max-ns=n``
+        With the irqchip emulated in userspace, lets a halted KVM vCPU
+        poll for up to n nanoseconds for an interrupt before it goes to
+        sleep. The window adapts to the observed wakeup latency. The
+        default, 0, disables polling.
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``hot-threshold=n``
+        Makes TCG translate again a block that has been entered n times,
+        following the direct branches it takes so that the whole hot path
+        is optimized as one unit. Only the x86 and AArch64 front ends build
+        such superblocks. The default, 0, disables the second translation.
+
+    ``tb-stats=on|off``
+        Counts, for each translation block, how often it runs and exits to
+        the execution loop, and how often and how long it is translated.
+        The statistics can also be turned on and off at run time with the
+        ``tb-stats`` monitor command, and are shown by ``info tb-stats``.
+
+    ``atomic128-lock=on|off``
+        On hosts without a 128-bit compare-and-swap, 128-bit guest atomics
+        (such as CMPXCHG16B, CASP or STXP) normally run while all other
+        vCPUs are stopped. With this option they take one of a set of locks
+        chosen by address instead, which scales much better with many
+        vCPUs. The operation is then atomic only with respect to other
+        128-bit atomics: a concurrent narrower store by another vCPU to the
+        same 16 bytes may be lost. It has no effect on hosts that provide
+        the instruction.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefor taking advantage of
@@ -1125,6 +1166,24 @@ SRST
             supporting platforms, and 0 on other platforms. Setting it
             to 0 disables this feature.
 
+        ``worker-threads``
+            Maximum number of threads compressing, decompressing,
+            encrypting and decrypting clusters of this image at the same
+            time (default: 4). Each image has its own pool of threads.
+
+        ``compression-level``
+            Compression level for compressed writes: 1 to 9 for zlib
+            images, 1 to the highest level supported by the library for
+            zstd images. 0 selects the library default (default: 0).
+
+        ``alloc-reserve-size``
+            Number of bytes of clusters that each sequential writer
+            reserves at once. Allocating writes then take their clusters
+            from the reservation without updating refcounts or running
+            overlap checks again. Reserved clusters still unused after a crash
+            are leaked and can be reclaimed with ``qemu-img check -r
+            leaks`` (default: 0, which disables reservations).
+
         ``pass-discard-request``
             Whether discard requests to the qcow2 device should be
             forwarded to the data source (on/off; default: on if
@@ -1865,7 +1924,8 @@ DEF("spice", HAS_ARG, QEMU_OPTION_spice,
     "       [,image-compression=[auto_glz|auto_lz|quic|glz|lz|off]]\n"
     "       [,jpeg-wan-compression=[auto|never|always]]\n"
     "       [,zlib-glz-wan-compression=[auto|never|always]]\n"
-    "       [,streaming-video=[off|all|filter]][,disable-copy-paste]\n"
+    "       [,streaming-video=[off|all|filter]][,video-codecs=<codec>]\n"
+    "       [,disable-copy-paste]\n"
     "       [,disable-agent-file-xfer][,agent-mouse=[on|off]]\n"
     "       [,playback-compression=[on|off]][,seamless-migration=[on|off]]\n"
     "       [,gl=[on|off]][,rendernode=<file>]\n"
@@ -1944,6 +2004,13 @@ SRST
     ``streaming-video=[off|all|filter]``
         Configure video stream detection. Default is off.
 
+    ``video-codecs=<encoder>:<codec>[;<encoder>:<codec>]``
+        Provide the preferred codecs the client should use to decode
+        the video streams, in order of preference, e.g.
+        ``gstreamer:h264;gstreamer:vp8``.  The gstreamer encoders use
+        hardware encoding, e.g. through VA-API, when gstreamer provides
+        it.  Requires spice-server 0.13.2 or newer.
+
     ``agent-mouse=[on|off]``
         Enable/disable passing mouse events via vdagent. Default is on.
 
@@ -2370,8 +2437,9 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "         [,dns=addr][,ipv6-dns=addr][,dnssearch=domain][,domainname=domain]\n"
     "         [,tftp=dir][,tftp-server-name=name][,bootfile=f][,hostfwd=rule][,guestfwd=rule]"
 #ifndef _WIN32
-                                             "[,smb=dir[,smbserver=addr]]\n"
+                                             "[,smb=dir[,smbserver=addr]]"
 #endif
+    "\n         [,iothread=id]\n"
     "                configure a user mode network backend with ID 'str',\n"
     "                its DHCP server and optional services\n"
 #endif
@@ -2459,6 +2527,12 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m]\n"
+    "                attach to queues m to m+n-1 of the host network interface 'name'\n"
+    "                through AF_XDP sockets\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -2483,6 +2557,9 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
 #endif
@@ -2619,6 +2696,13 @@ SRST
         load boot files or configurations from a different server than
         the host address.
 
+    ``iothread=id``
+        Run the network stack in the IOThread with ID id instead of
+        the main loop. Packets for the guest are still handed to the
+        network card from the main loop, in batches. This keeps heavy
+        traffic through user networking from adding latency to the
+        rest of QEMU.
+
     ``bootfile=file``
         When using the user mode network stack, broadcast file as the
         BOOTP filename. In conjunction with ``tftp``, this can be used
@@ -2926,6 +3010,26 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
+``-netdev af-xdp,id=id,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m]``
+    Attach to queues m to m+n-1 of the host network interface name
+    through AF_XDP sockets, bypassing the host network stack. Packets
+    received on these queues no longer reach the host; use flow steering
+    on the NIC to direct the guest traffic to them. ``mode=native`` runs
+    the XDP program in the driver and allows zero-copy, unless
+    ``force-copy=on``; ``mode=skb`` works with any driver. With
+    ``queues=n``, connect it to a multiqueue NIC with n queues. This
+    option is only available if QEMU has been compiled with AF_XDP
+    support.
+
+    Example:
+
+    .. parsed-literal::
+
+        # steer the guest traffic to queue 4 of eth0
+        ethtool -N eth0 flow-type ether dst 52:54:00:12:34:56 action 4
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1,mac=52:54:00:12:34:56 \\
+            -netdev af-xdp,id=n1,ifname=eth0,start-queue=4
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -4098,6 +4202,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                accept incoming migration from a given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -4117,6 +4223,10 @@ SRST
     Accept incoming migration as an output from specified external
     command.
 
+``-incoming file:filename``
+    Accept incoming migration from a file written by ``migrate
+    file:filename``.
+
 ``-incoming defer``
     Wait for the URI to be specified via migrate\_incoming. The monitor
     can be used to change settings (such as migration parameters) prior
@@ -4445,6 +4555,13 @@ SRST
         from core dumps. This feature is also known as MADV\_DONTDUMP.
 
         The ``prealloc`` boolean option enables memory preallocation.
+        The work is split between the ``host-nodes`` of the backend, each
+        share being preallocated by threads running on that host node.
+
+        Setting the ``prealloc-async`` boolean option to on lets the rest
+        of the machine be created while memory is preallocated.  It only
+        has an effect when the host supports MADV\_POPULATE\_WRITE and
+        the backend is created on the command line.
 
         The ``host-nodes`` option binds the memory range to a list of
         NUMA host nodes.
@@ -5086,7 +5203,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,thread-pool-min=n,thread-pool-max=n,io-uring-fixed=on|off,io-uring-sqpoll=on|off,io-uring-sqpoll-idle=ms``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -5129,6 +5246,34 @@ SRST
         ::
 
             (qemu) qom-set /objects/iothread1 poll-max-ns 100000
+
+        Blocking work such as ``aio=threads`` I/O, fallocate or 9p
+        file system calls runs in a pool of worker threads that belongs
+        to the IOThread. Workers are created when requests are waiting
+        and exit after being idle for 10 seconds. ``thread-pool-max``
+        (default 64) limits their number, and ``thread-pool-min``
+        (default 0) keeps that many workers ready so that requests do
+        not wait for a thread to be created. Both can be changed at
+        run-time with ``qom-set``, and ``query-iothreads`` reports how
+        busy the pool is.
+
+        The ``io-uring-*`` parameters apply to drives using
+        ``aio=io_uring`` in this IOThread and must be set before the
+        first such drive is attached.
+
+        ``io-uring-fixed=on`` registers the drives' file descriptors
+        and all of guest RAM with the kernel, so that requests do not
+        have to look up the file and pin the guest pages each time.
+        Guest RAM stays pinned while the IOThread exists, which needs a
+        large enough ``RLIMIT_MEMLOCK`` and is incompatible with RAM
+        discard, e.g. by virtio-balloon.
+
+        ``io-uring-sqpoll=on`` makes a kernel thread poll for new
+        requests so that submitting them does not need a system call.
+        The thread goes to sleep after ``io-uring-sqpoll-idle``
+        milliseconds without requests (default chosen by the kernel).
+        Kernels older than Linux 5.11 require ``CAP_SYS_ADMIN`` and
+        ``io-uring-fixed=on`` for this mode.
 ERST
 
 
@@ -1326,18 +1326,18 @@ void object_class_property_iter_init(ObjectPropertyIterator *iter,
 
 ObjectProperty *object_class_property_find(ObjectClass *klass, const char *name)
 {
-    ObjectClass *parent_klass;
+    /*
+     * A name is unique along the class hierarchy, so the most derived
+     * classes, which usually define the property, can be looked at first.
+     */
+    for (; klass; klass = object_class_get_parent(klass)) {
+        ObjectProperty *prop = g_hash_table_lookup(klass->properties, name);
 
-    parent_klass = object_class_get_parent(klass);
-    if (parent_klass) {
-        ObjectProperty *prop =
-            object_class_property_find(parent_klass, name);
         if (prop) {
             return prop;
         }
     }
-
-    return g_hash_table_lookup(klass->properties, name);
+    return NULL;
 }
 
 ObjectProperty *object_class_property_find_err(ObjectClass *klass,
@@ -15,6 +15,10 @@
 #include "replay-internal.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/bswap.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -44,12 +48,164 @@ static void replay_read_error(void)
     exit(1);
 }
 
-void replay_put_byte(uint8_t byte)
+/*
+ * In record mode the log is appended to a memory buffer, which a separate
+ * thread writes to the file once it is full.  Events are only emitted with
+ * the replay mutex held, so filling the current buffer needs no locking;
+ * writer.lock only protects the queues shared with the writer thread.
+ */
+#define REPLAY_WRITE_BUFFER_SIZE    (1 * MiB)
+#define REPLAY_WRITE_BUFFERS        4
+
+typedef struct ReplayWriteBuffer {
+    size_t len;
+    QSIMPLEQ_ENTRY(ReplayWriteBuffer) next;
+    uint8_t data[REPLAY_WRITE_BUFFER_SIZE];
+} ReplayWriteBuffer;
+
+static struct {
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
+    /* Buffers waiting to be written, in log order */
+    QSIMPLEQ_HEAD(, ReplayWriteBuffer) full;
+    QSIMPLEQ_HEAD(, ReplayWriteBuffer) free;
+    bool exit;
+    /* Buffer being filled, NULL if the writer thread is not running */
+    ReplayWriteBuffer *cur;
+    /* Offset in the file of the next byte put in the log */
+    uint64_t offset;
+} writer;
+
+static void *replay_writer_thread(void *opaque)
 {
-    if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
+    ReplayWriteBuffer *buf;
+
+    qemu_mutex_lock(&writer.lock);
+    for (;;) {
+        while (QSIMPLEQ_EMPTY(&writer.full) && !writer.exit) {
+            qemu_cond_wait(&writer.cond, &writer.lock);
+        }
+        buf = QSIMPLEQ_FIRST(&writer.full);
+        if (!buf) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&writer.full, next);
+        qemu_mutex_unlock(&writer.lock);
+
+        if (fwrite(buf->data, 1, buf->len, replay_file) != buf->len) {
             replay_write_error();
         }
+
+        qemu_mutex_lock(&writer.lock);
+        QSIMPLEQ_INSERT_TAIL(&writer.free, buf, next);
+        qemu_cond_broadcast(&writer.cond);
+    }
+    qemu_mutex_unlock(&writer.lock);
+    return NULL;
+}
+
+/* Queue the current buffer for writing and wait for a free one */
+static void replay_writer_submit(void)
+{
+    qemu_mutex_lock(&writer.lock);
+    QSIMPLEQ_INSERT_TAIL(&writer.full, writer.cur, next);
+    qemu_cond_broadcast(&writer.cond);
+    while (QSIMPLEQ_EMPTY(&writer.free)) {
+        qemu_cond_wait(&writer.cond, &writer.lock);
+    }
+    writer.cur = QSIMPLEQ_FIRST(&writer.free);
+    QSIMPLEQ_REMOVE_HEAD(&writer.free, next);
+    writer.cur->len = 0;
+    qemu_mutex_unlock(&writer.lock);
+}
+
+void replay_writer_start(void)
+{
+    int i;
+
+    assert(!writer.cur);
+    qemu_mutex_init(&writer.lock);
+    qemu_cond_init(&writer.cond);
+    QSIMPLEQ_INIT(&writer.full);
+    QSIMPLEQ_INIT(&writer.free);
+    for (i = 0; i < REPLAY_WRITE_BUFFERS - 1; i++) {
+        QSIMPLEQ_INSERT_TAIL(&writer.free, g_new(ReplayWriteBuffer, 1), next);
+    }
+    writer.cur = g_new(ReplayWriteBuffer, 1);
+    writer.cur->len = 0;
+    writer.exit = false;
+    writer.offset = ftell(replay_file);
+
+    qemu_thread_create(&writer.thread, "replay-writer", replay_writer_thread,
+                       NULL, QEMU_THREAD_JOINABLE);
+}
+
+void replay_writer_stop(void)
+{
+    ReplayWriteBuffer *buf;
+
+    if (!writer.cur) {
+        return;
+    }
+
+    qemu_mutex_lock(&writer.lock);
+    if (writer.cur->len) {
+        QSIMPLEQ_INSERT_TAIL(&writer.full, writer.cur, next);
+    } else {
+        QSIMPLEQ_INSERT_TAIL(&writer.free, writer.cur, next);
+    }
+    writer.cur = NULL;
+    writer.exit = true;
+    qemu_cond_broadcast(&writer.cond);
+    qemu_mutex_unlock(&writer.lock);
+
+    qemu_thread_join(&writer.thread);
+
+    while ((buf = QSIMPLEQ_FIRST(&writer.free))) {
+        QSIMPLEQ_REMOVE_HEAD(&writer.free, next);
+        g_free(buf);
+    }
+    qemu_cond_destroy(&writer.cond);
+    qemu_mutex_destroy(&writer.lock);
+}
+
+int64_t replay_get_file_offset(void)
+{
+    if (writer.cur) {
+        return writer.offset;
+    }
+    return ftell(replay_file);
+}
+
+static void replay_write(const uint8_t *buf, size_t size)
+{
+    size_t n;
+
+    if (!writer.cur) {
+        if (fwrite(buf, 1, size, replay_file) != size) {
+            replay_write_error();
+        }
+        return;
+    }
+
+    writer.offset += size;
+    while (size) {
+        n = MIN(size, REPLAY_WRITE_BUFFER_SIZE - writer.cur->len);
+        memcpy(writer.cur->data + writer.cur->len, buf, n);
+        writer.cur->len += n;
+        buf += n;
+        size -= n;
+        if (writer.cur->len == REPLAY_WRITE_BUFFER_SIZE) {
+            replay_writer_submit();
+        }
+    }
+}
+
+void replay_put_byte(uint8_t byte)
+{
+    if (replay_file) {
+        replay_write(&byte, 1);
     }
 }
 
@@ -62,29 +218,39 @@ void replay_put_event(uint8_t event)
 
 void replay_put_word(uint16_t word)
 {
-    replay_put_byte(word >> 8);
-    replay_put_byte(word);
+    uint8_t buf[sizeof(word)];
+
+    if (replay_file) {
+        stw_be_p(buf, word);
+        replay_write(buf, sizeof(buf));
+    }
 }
 
 void replay_put_dword(uint32_t dword)
 {
-    replay_put_word(dword >> 16);
-    replay_put_word(dword);
+    uint8_t buf[sizeof(dword)];
+
+    if (replay_file) {
+        stl_be_p(buf, dword);
+        replay_write(buf, sizeof(buf));
+    }
 }
 
 void replay_put_qword(int64_t qword)
 {
-    replay_put_dword(qword >> 32);
-    replay_put_dword(qword);
+    uint8_t buf[sizeof(qword)];
+
+    if (replay_file) {
+        stq_be_p(buf, qword);
+        replay_write(buf, sizeof(buf));
+    }
 }
 
 void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
-        }
+        replay_write(buf, size);
     }
 }
 
@@ -99,6 +99,13 @@ extern uint64_t replay_break_icount;
 /* Timer for the replay breakpoint callback */
 extern QEMUTimer *replay_break_timer;
 
+/*! Starts the thread that writes the log in record mode. */
+void replay_writer_start(void);
+/*! Writes out the buffered log and stops the writer thread. */
+void replay_writer_stop(void);
+/*! Returns the position in the log of the next event. */
+int64_t replay_get_file_offset(void);
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
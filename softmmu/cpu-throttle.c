@@ -38,18 +38,41 @@ static unsigned int throttle_percentage;
 #define CPU_THROTTLE_PCT_MAX 99
 #define CPU_THROTTLE_TIMESLICE_NS 10000000
 
+/* The throttle of @cpu is the highest of its own and the global one */
+static int cpu_throttle_vcpu_effective(CPUState *cpu)
+{
+    return MAX(cpu_throttle_get_percentage(),
+               qatomic_read(&cpu->throttle_percentage));
+}
+
+static int cpu_throttle_max_percentage(void)
+{
+    CPUState *cpu;
+    int pct = cpu_throttle_get_percentage();
+
+    CPU_FOREACH(cpu) {
+        pct = MAX(pct, qatomic_read(&cpu->throttle_percentage));
+    }
+    return pct;
+}
+
 static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
 {
-    double pct;
+    double pct, max_pct;
     double throttle_ratio;
     int64_t sleeptime_ns, endtime_ns;
 
-    if (!cpu_throttle_get_percentage()) {
+    if (!cpu_throttle_vcpu_effective(cpu)) {
         return;
     }
 
-    pct = (double)cpu_throttle_get_percentage() / 100;
-    throttle_ratio = pct / (1 - pct);
+    /*
+     * The timer ticks at the pace of the most throttled vCPU, so that
+     * each vCPU sleeps for its own percentage of the tick.
+     */
+    pct = (double)cpu_throttle_vcpu_effective(cpu) / 100;
+    max_pct = (double)cpu_throttle_max_percentage() / 100;
+    throttle_ratio = pct / (1 - max_pct);
     /* Add 1ns to fix double's rounding error (like 0.9999999...) */
     sleeptime_ns = (int64_t)(throttle_ratio * CPU_THROTTLE_TIMESLICE_NS + 1);
     endtime_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + sleeptime_ns;
@@ -73,17 +96,18 @@ static void cpu_throttle_timer_tick(void *opaque)
     double pct;
 
     /* Stop the timer if needed */
-    if (!cpu_throttle_get_percentage()) {
+    if (!cpu_throttle_max_percentage()) {
         return;
     }
     CPU_FOREACH(cpu) {
-        if (!qatomic_xchg(&cpu->throttle_thread_scheduled, 1)) {
+        if (cpu_throttle_vcpu_effective(cpu) &&
+            !qatomic_xchg(&cpu->throttle_thread_scheduled, 1)) {
             async_run_on_cpu(cpu, cpu_throttle_thread,
                              RUN_ON_CPU_NULL);
         }
     }
 
-    pct = (double)cpu_throttle_get_percentage() / 100;
+    pct = (double)cpu_throttle_max_percentage() / 100;
     timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
                                    CPU_THROTTLE_TIMESLICE_NS / (1 - pct));
 }
@@ -100,9 +124,34 @@ void cpu_throttle_set(int new_throttle_pct)
                                        CPU_THROTTLE_TIMESLICE_NS);
 }
 
+void cpu_throttle_vcpu_set(CPUState *cpu, int new_throttle_pct)
+{
+    if (new_throttle_pct) {
+        new_throttle_pct = MIN(new_throttle_pct, CPU_THROTTLE_PCT_MAX);
+        new_throttle_pct = MAX(new_throttle_pct, CPU_THROTTLE_PCT_MIN);
+    }
+
+    qatomic_set(&cpu->throttle_percentage, new_throttle_pct);
+
+    if (new_throttle_pct && !timer_pending(throttle_timer)) {
+        timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
+                                           CPU_THROTTLE_TIMESLICE_NS);
+    }
+}
+
+int cpu_throttle_vcpu_get_percentage(CPUState *cpu)
+{
+    return qatomic_read(&cpu->throttle_percentage);
+}
+
 void cpu_throttle_stop(void)
 {
+    CPUState *cpu;
+
     qatomic_set(&throttle_percentage, 0);
+    CPU_FOREACH(cpu) {
+        qatomic_set(&cpu->throttle_percentage, 0);
+    }
 }
 
 bool cpu_throttle_active(void)
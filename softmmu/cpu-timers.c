@@ -138,6 +138,45 @@ void cpu_disable_ticks(void)
                          &timers_state.vm_clock_lock);
 }
 
+/*
+ * Record the current VM time.  With icount, the caller should have
+ * folded the instructions executed so far into the count first.
+ * Caller must hold BQL which serves as mutex for vm_clock_seqlock.
+ */
+void cpu_timers_save(CPUTimersSnapshot *s)
+{
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    s->ticks = cpu_get_ticks_locked();
+    s->clock = cpu_get_clock_locked();
+    s->icount = timers_state.qemu_icount;
+    s->icount_bias = timers_state.qemu_icount_bias;
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+}
+
+/*
+ * Make the VM time what cpu_timers_save() saw, going backwards if need
+ * be.  Caller must hold BQL which serves as mutex for vm_clock_seqlock.
+ */
+void cpu_timers_restore(const CPUTimersSnapshot *s)
+{
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    timers_state.cpu_ticks_offset = s->ticks;
+    timers_state.cpu_clock_offset = s->clock;
+    if (timers_state.cpu_ticks_enabled) {
+        timers_state.cpu_ticks_offset -= cpu_get_host_ticks();
+        timers_state.cpu_clock_offset -= get_clock();
+    }
+    /* Or cpu_get_ticks_locked() would take this for a host suspend */
+    timers_state.cpu_ticks_prev = s->ticks;
+    qatomic_set_i64(&timers_state.qemu_icount, s->icount);
+    qatomic_set_i64(&timers_state.qemu_icount_bias, s->icount_bias);
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+}
+
 static bool icount_state_needed(void *opaque)
 {
     return icount_enabled();
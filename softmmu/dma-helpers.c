@@ -15,6 +15,7 @@
 #include "qemu/main-loop.h"
 #include "sysemu/cpu-timers.h"
 #include "qemu/range.h"
+#include "qemu/units.h"
 
 /* #define DEBUG_IOMMU */
 
@@ -53,6 +54,19 @@ void qemu_sglist_init(QEMUSGList *qsg, DeviceState *dev, int alloc_hint,
 
 void qemu_sglist_add(QEMUSGList *qsg, dma_addr_t base, dma_addr_t len)
 {
+    ScatterGatherEntry *last = qsg->nsg ? &qsg->sg[qsg->nsg - 1] : NULL;
+
+    /*
+     * Guests often describe contiguous buffers with many small entries;
+     * merge them so that dma_blk_cb() maps them with a single lookup.
+     */
+    if (last && last->base + last->len == base &&
+        last->len + len >= last->len) {
+        last->len += len;
+        qsg->size += len;
+        return;
+    }
+
     if (qsg->nsg == qsg->nalloc) {
         qsg->nalloc = 2 * qsg->nalloc + 1;
         qsg->sg = g_realloc(qsg->sg, qsg->nalloc * sizeof(ScatterGatherEntry));
@@ -84,8 +98,14 @@ typedef struct {
     QEMUBH *bh;
     DMAIOFunc *io_func;
     void *io_func_opaque;
+    void *bounce;
+    int bounce_index;
+    dma_addr_t bounce_byte;
 } DMAAIOCB;
 
+/* Largest private bounce buffer used when guest memory cannot be mapped */
+#define DMA_BOUNCE_MAX (1 * MiB)
+
 static void dma_blk_cb(void *opaque, int ret);
 
 static void reschedule_dma(void *opaque)
@@ -102,6 +122,12 @@ static void dma_blk_unmap(DMAAIOCB *dbs)
 {
     int i;
 
+    if (dbs->bounce) {
+        qemu_vfree(dbs->bounce);
+        dbs->bounce = NULL;
+        qemu_iovec_reset(&dbs->iov);
+        return;
+    }
     for (i = 0; i < dbs->iov.niov; ++i) {
         dma_memory_unmap(dbs->sg->as, dbs->iov.iov[i].iov_base,
                          dbs->iov.iov[i].iov_len, dbs->dir,
@@ -123,6 +149,67 @@ static void dma_complete(DMAAIOCB *dbs, int ret)
     qemu_aio_unref(dbs);
 }
 
+/*
+ * Copy @len bytes between @buf and the scatter/gather list, starting at
+ * entry @index, byte @byte, and advance @index and @byte past them.  With
+ * a NULL @buf, only advance.
+ */
+static void dma_blk_bounce_rw(DMAAIOCB *dbs, uint8_t *buf, dma_addr_t len,
+                              int *index, dma_addr_t *byte, DMADirection dir)
+{
+    while (len) {
+        ScatterGatherEntry *entry = &dbs->sg->sg[*index];
+        dma_addr_t xfer = MIN(len, entry->len - *byte);
+
+        if (buf) {
+            dma_memory_rw(dbs->sg->as, entry->base + *byte, buf, xfer, dir);
+            buf += xfer;
+        }
+        len -= xfer;
+        *byte += xfer;
+        if (*byte == entry->len) {
+            *byte = 0;
+            ++*index;
+        }
+    }
+}
+
+/*
+ * None of the remaining guest memory could be mapped, because it is not
+ * RAM and the global bounce buffer is in use.  Rather than waiting on the
+ * global list of map clients, copy the data through a buffer of our own.
+ */
+static bool dma_blk_bounce(DMAAIOCB *dbs)
+{
+    dma_addr_t len = 0;
+    int i;
+
+    for (i = dbs->sg_cur_index; i < dbs->sg->nsg && len < DMA_BOUNCE_MAX;
+         i++) {
+        len += dbs->sg->sg[i].len;
+    }
+    len -= dbs->sg_cur_byte;
+    len = MIN(len, DMA_BOUNCE_MAX);
+    if (len >= dbs->align) {
+        len = QEMU_ALIGN_DOWN(len, dbs->align);
+    }
+
+    dbs->bounce = qemu_try_memalign(qemu_real_host_page_size, len);
+    if (!dbs->bounce) {
+        return false;
+    }
+
+    trace_dma_bounce(dbs, len);
+    dbs->bounce_index = dbs->sg_cur_index;
+    dbs->bounce_byte = dbs->sg_cur_byte;
+    /* Data from the device is copied out when the request completes */
+    dma_blk_bounce_rw(dbs,
+                      dbs->dir == DMA_DIRECTION_TO_DEVICE ? dbs->bounce : NULL,
+                      len, &dbs->sg_cur_index, &dbs->sg_cur_byte, dbs->dir);
+    qemu_iovec_add(&dbs->iov, dbs->bounce, len);
+    return true;
+}
+
 static void dma_blk_cb(void *opaque, int ret)
 {
     DMAAIOCB *dbs = (DMAAIOCB *)opaque;
@@ -134,6 +221,11 @@ static void dma_blk_cb(void *opaque, int ret)
     dbs->acb = NULL;
     dbs->offset += dbs->iov.size;
 
+    if (dbs->bounce && ret >= 0 && dbs->dir == DMA_DIRECTION_FROM_DEVICE) {
+        dma_blk_bounce_rw(dbs, dbs->bounce, dbs->iov.size, &dbs->bounce_index,
+                          &dbs->bounce_byte, DMA_DIRECTION_FROM_DEVICE);
+    }
+
     if (dbs->sg_cur_index == dbs->sg->nsg || ret < 0) {
         dma_complete(dbs, ret);
         return;
@@ -174,10 +266,10 @@ static void dma_blk_cb(void *opaque, int ret)
         }
     }
 
-    if (dbs->iov.size == 0) {
+    if (dbs->iov.size == 0 && !dma_blk_bounce(dbs)) {
         trace_dma_map_wait(dbs);
         dbs->bh = aio_bh_new(dbs->ctx, reschedule_dma, dbs);
-        cpu_register_map_client(dbs->bh);
+        address_space_register_map_client(dbs->sg->as, dbs->bh);
         return;
     }
 
@@ -207,7 +299,7 @@ static void dma_aio_cancel(BlockAIOCB *acb)
     }
 
     if (dbs->bh) {
-        cpu_unregister_map_client(dbs->bh);
+        address_space_unregister_map_client(dbs->sg->as, dbs->bh);
         qemu_bh_delete(dbs->bh);
         dbs->bh = NULL;
     }
@@ -250,6 +342,7 @@ BlockAIOCB *dma_blk_io(AioContext *ctx,
     dbs->io_func = io_func;
     dbs->io_func_opaque = io_func_opaque;
     dbs->bh = NULL;
+    dbs->bounce = NULL;
     qemu_iovec_init(&dbs->iov, sg->nsg);
     dma_blk_cb(dbs, 0);
     return &dbs->common;
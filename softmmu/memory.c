@@ -24,6 +24,8 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/qemu-print.h"
+#include "qemu/qsp.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 #include "trace.h"
 
@@ -35,11 +37,14 @@
 #include "sysemu/accel.h"
 #include "hw/boards.h"
 #include "migration/vmstate.h"
+#include "hw/vmstate-if.h"
 
 //#define DEBUG_UNASSIGNED
 
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
+static bool memory_region_update_partial;
+static unsigned memory_region_update_gen = 1;
 static bool ioeventfd_update_pending;
 bool global_dirty_log;
 
@@ -977,6 +982,16 @@ static void address_space_update_topology_pass(AddressSpace *as,
     }
 }
 
+/*
+ * Record that the rendering of @mr changed in the current transaction.
+ * Only the FlatViews whose tree reaches @mr are generated again.
+ */
+static void memory_region_update_mark(MemoryRegion *mr)
+{
+    mr->update_gen = memory_region_update_gen;
+    memory_region_update_partial = true;
+}
+
 static void flatviews_init(void)
 {
     static FlatView *empty_view;
@@ -997,26 +1012,76 @@ static void flatviews_init(void)
     }
 }
 
-static void flatviews_reset(void)
+/*
+ * Whether @mr, its subregions or the regions they alias were changed in
+ * transaction @gen.  The answer is cached in the region, so that each
+ * region is visited once per commit however many FlatViews share it.
+ */
+static bool memory_region_is_stale(MemoryRegion *mr, unsigned gen)
 {
-    AddressSpace *as;
+    MemoryRegion *subregion;
+    bool stale;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
+    if (mr->stale_gen == gen) {
+        return mr->stale;
     }
+    mr->stale_gen = gen;
+    mr->stale = false;
+
+    stale = mr->update_gen == gen ||
+            (mr->alias && memory_region_is_stale(mr->alias, gen));
+    QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
+        if (stale) {
+            break;
+        }
+        stale = memory_region_is_stale(subregion, gen);
+    }
+    mr->stale = stale;
+    return stale;
+}
+
+/*
+ * Render the FlatViews of all address spaces, reusing those from the
+ * previous commit unless @full or their tree changed in transaction @gen.
+ */
+static void flatviews_reset(bool full, unsigned gen)
+{
+    GHashTable *old_views = flat_views;
+    AddressSpace *as;
+
+    flat_views = NULL;
     flatviews_init();
 
     /* Render unique FVs */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
+        view = old_views ? g_hash_table_lookup(old_views, physmr) : NULL;
+        if (view && physmr && !full && !memory_region_is_stale(physmr, gen)) {
+            flatview_ref(view);
+            g_hash_table_replace(flat_views, physmr, view);
+            continue;
+        }
+
         generate_memory_topology(physmr);
     }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
+    }
+}
+
+static bool address_space_flatview_changed(AddressSpace *as)
+{
+    MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+
+    return address_space_to_flatview(as) !=
+           g_hash_table_lookup(flat_views, physmr);
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1081,27 +1146,64 @@ void memory_region_transaction_begin(void)
     ++memory_region_transaction_depth;
 }
 
+/*
+ * Only the listeners of the address spaces whose FlatView changed see
+ * the transaction; the others would get nothing but region_nop calls.
+ */
+static void address_spaces_call_listeners(GPtrArray *changed, bool commit)
+{
+    MemoryListener *listener;
+    int i;
+
+    for (i = 0; i < changed->len; i++) {
+        AddressSpace *as = g_ptr_array_index(changed, i);
+
+        QTAILQ_FOREACH(listener, &as->listeners, link_as) {
+            if (commit && listener->commit) {
+                listener->commit(listener);
+            } else if (!commit && listener->begin) {
+                listener->begin(listener);
+            }
+        }
+    }
+}
+
 void memory_region_transaction_commit(void)
 {
     AddressSpace *as;
+    int i;
 
     assert(memory_region_transaction_depth);
     assert(qemu_mutex_iothread_locked());
 
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
-        if (memory_region_update_pending) {
-            flatviews_reset();
+        if (memory_region_update_pending || memory_region_update_partial) {
+            bool full = memory_region_update_pending;
+            unsigned gen = memory_region_update_gen++;
+            GPtrArray *changed = g_ptr_array_new();
 
-            MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
+            memory_region_update_pending = false;
+            memory_region_update_partial = false;
+            flatviews_reset(full, gen);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                if (address_space_flatview_changed(as)) {
+                    g_ptr_array_add(changed, as);
+                } else if (ioeventfd_update_pending) {
+                    address_space_update_ioeventfds(as);
+                }
+            }
+
+            address_spaces_call_listeners(changed, false);
+            for (i = 0; i < changed->len; i++) {
+                as = g_ptr_array_index(changed, i);
                 address_space_set_flatview(as);
                 address_space_update_ioeventfds(as);
             }
-            memory_region_update_pending = false;
             ioeventfd_update_pending = false;
-            MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+            address_spaces_call_listeners(changed, true);
+            g_ptr_array_free(changed, true);
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -1242,6 +1344,7 @@ static void memory_region_initfn(Object *obj)
     mr->ops = &unassigned_mem_ops;
     mr->enabled = true;
     mr->romd_mode = true;
+    mr->global_locking = true;
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
@@ -1438,15 +1541,19 @@ MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
                                         MemTxAttrs attrs)
 {
     unsigned size = memop_size(op);
+    QSPBQLContext bql_ctx;
     MemTxResult r;
 
+    device_snapshot_touch(mr->owner);
     fuzz_dma_read_cb(addr, size, mr, false);
     if (!memory_region_access_valid(mr, addr, size, false, attrs)) {
         *pval = unassigned_mem_read(mr, addr, size);
         return MEMTX_DECODE_ERROR;
     }
 
+    qsp_bql_context_push(&bql_ctx, "mmio", mr, mr->name);
     r = memory_region_dispatch_read1(mr, addr, pval, size, attrs);
+    qsp_bql_context_pop(&bql_ctx);
     adjust_endianness(mr, pval, op);
     return r;
 }
@@ -1484,7 +1591,10 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
                                          MemTxAttrs attrs)
 {
     unsigned size = memop_size(op);
+    QSPBQLContext bql_ctx;
+    MemTxResult r;
 
+    device_snapshot_touch(mr->owner);
     if (!memory_region_access_valid(mr, addr, size, true, attrs)) {
         unassigned_mem_write(mr, addr, data, size);
         return MEMTX_DECODE_ERROR;
@@ -1497,20 +1607,22 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
         return MEMTX_OK;
     }
 
+    qsp_bql_context_push(&bql_ctx, "mmio", mr, mr->name);
     if (mr->ops->write) {
-        return access_with_adjusted_size(addr, &data, size,
-                                         mr->ops->impl.min_access_size,
-                                         mr->ops->impl.max_access_size,
-                                         memory_region_write_accessor, mr,
-                                         attrs);
+        r = access_with_adjusted_size(addr, &data, size,
+                                      mr->ops->impl.min_access_size,
+                                      mr->ops->impl.max_access_size,
+                                      memory_region_write_accessor, mr,
+                                      attrs);
     } else {
-        return
-            access_with_adjusted_size(addr, &data, size,
+        r = access_with_adjusted_size(addr, &data, size,
                                       mr->ops->impl.min_access_size,
                                       mr->ops->impl.max_access_size,
                                       memory_region_write_with_attrs_accessor,
                                       mr, attrs);
     }
+    qsp_bql_context_pop(&bql_ctx);
+    return r;
 }
 
 void memory_region_init_io(MemoryRegion *mr,
@@ -1732,11 +1844,14 @@ void memory_region_init_iommu(void *_iommu_mr,
     iommu_mr->iommu_notify_flags = IOMMU_NOTIFIER_NONE;
 }
 
+static void memory_region_bql_profile_forget(MemoryRegion *mr);
+
 static void memory_region_finalize(Object *obj)
 {
     MemoryRegion *mr = MEMORY_REGION(obj);
 
     assert(!mr->container);
+    memory_region_bql_profile_forget(mr);
 
     /* We know the region is not visible in any address space (it
      * does not have a container and cannot be a root either because
@@ -1805,6 +1920,34 @@ const char *memory_region_name(const MemoryRegion *mr)
     return mr->name;
 }
 
+void memory_region_set_ram_discard_manager(MemoryRegion *mr,
+                                           RamDiscardManager *rdm)
+{
+    g_assert(memory_region_is_ram(mr));
+    g_assert(!rdm || !mr->rdm);
+    mr->rdm = rdm;
+}
+
+bool ram_discard_manager_is_populated(const RamDiscardManager *rdm,
+                                      const MemoryRegionSection *section)
+{
+    RamDiscardManagerClass *rdmc = RAM_DISCARD_MANAGER_GET_CLASS(rdm);
+
+    g_assert(rdmc->is_populated);
+    return rdmc->is_populated(rdm, section);
+}
+
+int ram_discard_manager_replay_populated(const RamDiscardManager *rdm,
+                                         MemoryRegionSection *section,
+                                         ReplayRamPopulate replay_fn,
+                                         void *opaque)
+{
+    RamDiscardManagerClass *rdmc = RAM_DISCARD_MANAGER_GET_CLASS(rdm);
+
+    g_assert(rdmc->replay_populated);
+    return rdmc->replay_populated(rdm, section, replay_fn, opaque);
+}
+
 bool memory_region_is_ram_device(MemoryRegion *mr)
 {
     return mr->ram_device;
@@ -1906,10 +2049,14 @@ void memory_region_iommu_replay(IOMMUMemoryRegion *iommu_mr, IOMMUNotifier *n)
     hwaddr addr, granularity;
     IOMMUTLBEntry iotlb;
 
+    if (n->batch) {
+        n->batch(n, true);
+    }
+
     /* If the IOMMU has its own replay callback, override */
     if (imrc->replay) {
         imrc->replay(iommu_mr, n);
-        return;
+        goto out;
     }
 
     granularity = memory_region_iommu_get_min_page_size(iommu_mr);
@@ -1926,6 +2073,11 @@ void memory_region_iommu_replay(IOMMUMemoryRegion *iommu_mr, IOMMUNotifier *n)
             break;
         }
     }
+
+out:
+    if (n->batch) {
+        n->batch(n, false);
+    }
 }
 
 void memory_region_unregister_iommu_notifier(MemoryRegion *mr,
@@ -1969,6 +2121,28 @@ void memory_region_notify_one(IOMMUNotifier *notifier,
     }
 }
 
+void memory_region_iommu_notify_begin(IOMMUMemoryRegion *iommu_mr)
+{
+    IOMMUNotifier *iommu_notifier;
+
+    IOMMU_NOTIFIER_FOREACH(iommu_notifier, iommu_mr) {
+        if (iommu_notifier->batch) {
+            iommu_notifier->batch(iommu_notifier, true);
+        }
+    }
+}
+
+void memory_region_iommu_notify_end(IOMMUMemoryRegion *iommu_mr)
+{
+    IOMMUNotifier *iommu_notifier;
+
+    IOMMU_NOTIFIER_FOREACH(iommu_notifier, iommu_mr) {
+        if (iommu_notifier->batch) {
+            iommu_notifier->batch(iommu_notifier, false);
+        }
+    }
+}
+
 void memory_region_notify_iommu(IOMMUMemoryRegion *iommu_mr,
                                 int iommu_idx,
                                 IOMMUTLBEntry entry)
@@ -2034,7 +2208,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2152,7 +2328,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_mark(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2162,7 +2340,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_mark(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2172,7 +2352,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_mark(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2329,6 +2511,132 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_set_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = true;
+}
+
+void memory_region_clear_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = false;
+}
+
+typedef struct MemoryRegionBQLStats {
+    char *name;
+    uint64_t count;
+    uint64_t wait_ns;
+} MemoryRegionBQLStats;
+
+/*
+ * MemoryRegion * -> MemoryRegionBQLStats *, for regions whose accesses
+ * waited for the global lock while sync-profile was on.  qsp accounts all
+ * of these to the same call site, so this tells which devices they are.
+ * Protected by the global lock itself.
+ */
+static GHashTable *mmio_bql_stats;
+
+static void memory_region_bql_stats_free(gpointer data)
+{
+    MemoryRegionBQLStats *stats = data;
+
+    g_free(stats->name);
+    g_free(stats);
+}
+
+static void memory_region_bql_profile_add(MemoryRegion *mr, int64_t wait_ns)
+{
+    MemoryRegionBQLStats *stats;
+
+    if (!mmio_bql_stats) {
+        mmio_bql_stats = g_hash_table_new_full(NULL, NULL, NULL,
+                                               memory_region_bql_stats_free);
+    }
+
+    stats = g_hash_table_lookup(mmio_bql_stats, mr);
+    if (!stats) {
+        char *path = mr->owner ? object_get_canonical_path(mr->owner) : NULL;
+
+        stats = g_new0(MemoryRegionBQLStats, 1);
+        stats->name = g_strdup_printf("%s%s%s", path ?: "", path ? "/" : "",
+                                      memory_region_name(mr));
+        g_free(path);
+        g_hash_table_insert(mmio_bql_stats, mr, stats);
+    }
+    stats->count++;
+    stats->wait_ns += wait_ns;
+}
+
+static void memory_region_bql_profile_forget(MemoryRegion *mr)
+{
+    if (mmio_bql_stats) {
+        g_hash_table_remove(mmio_bql_stats, mr);
+    }
+}
+
+bool memory_region_lock_for_access(MemoryRegion *mr)
+{
+    int64_t t0;
+
+    if (qemu_mutex_iothread_locked() ||
+        (!mr->global_locking && !mr->flush_coalesced_mmio)) {
+        return false;
+    }
+
+    if (likely(!qsp_is_enabled())) {
+        qemu_mutex_lock_iothread();
+        return true;
+    }
+
+    t0 = get_clock();
+    qemu_mutex_lock_iothread();
+    memory_region_bql_profile_add(mr, get_clock() - t0);
+    return true;
+}
+
+static gint memory_region_bql_stats_cmp(gconstpointer a, gconstpointer b)
+{
+    const MemoryRegionBQLStats *sa = *(MemoryRegionBQLStats * const *)a;
+    const MemoryRegionBQLStats *sb = *(MemoryRegionBQLStats * const *)b;
+
+    if (sa->wait_ns != sb->wait_ns) {
+        return sa->wait_ns < sb->wait_ns ? 1 : -1;
+    }
+    return sa->count < sb->count ? 1 : sa->count > sb->count ? -1 : 0;
+}
+
+void memory_region_bql_profile_report(size_t max)
+{
+    g_autoptr(GPtrArray) arr = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer value;
+    size_t i;
+
+    if (mmio_bql_stats) {
+        g_hash_table_iter_init(&iter, mmio_bql_stats);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            g_ptr_array_add(arr, value);
+        }
+    }
+    g_ptr_array_sort(arr, memory_region_bql_stats_cmp);
+
+    qemu_printf("%-60s %12s %12s %10s\n",
+                "Memory region", "Accesses", "Wait (ms)", "Avg (us)");
+    for (i = 0; i < arr->len && i < max; i++) {
+        MemoryRegionBQLStats *stats = g_ptr_array_index(arr, i);
+
+        qemu_printf("%-60s %12" PRIu64 " %12.3f %10.2f\n",
+                    stats->name, stats->count, stats->wait_ns / 1e6,
+                    stats->wait_ns / 1e3 / stats->count);
+    }
+}
+
+void memory_region_bql_profile_reset(void)
+{
+    if (mmio_bql_stats) {
+        g_hash_table_remove_all(mmio_bql_stats);
+    }
+}
+
 static bool userspace_eventfd_warning;
 
 void memory_region_add_eventfd(MemoryRegion *mr,
@@ -2424,7 +2732,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2463,7 +2773,9 @@ void memory_region_del_subregion(MemoryRegion *mr,
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2474,7 +2786,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_mark(mr);
     memory_region_transaction_commit();
 }
 
@@ -2490,7 +2802,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_update_mark(mr);
     memory_region_transaction_commit();
 }
 
@@ -2527,7 +2839,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2640,9 +2954,15 @@ void memory_global_after_dirty_log_sync(void)
 }
 
 static VMChangeStateEntry *vmstate_change;
+/* Callers of memory_global_dirty_log_start() that did not stop yet */
+static unsigned int global_dirty_log_users;
 
 void memory_global_dirty_log_start(void)
 {
+    if (global_dirty_log_users++) {
+        return;
+    }
+
     if (vmstate_change) {
         qemu_del_vm_change_state_handler(vmstate_change);
         vmstate_change = NULL;
@@ -2685,6 +3005,10 @@ static void memory_vm_change_state_handler(void *opaque, int running,
 
 void memory_global_dirty_log_stop(void)
 {
+    if (!global_dirty_log_users || --global_dirty_log_users) {
+        return;
+    }
+
     if (!runstate_is_running()) {
         if (vmstate_change) {
             return;
@@ -2815,6 +3139,11 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
+    qemu_mutex_init(&as->bounce_lock);
+    as->bounce_buffer_size = 0;
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    QLIST_INIT(&as->bounce_buffers);
+    QLIST_INIT(&as->map_client_list);
     as->name = g_strdup(name ? name : "anonymous");
     address_space_update_topology(as);
     address_space_update_ioeventfds(as);
@@ -2823,7 +3152,9 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 static void do_address_space_destroy(AddressSpace *as)
 {
     assert(QTAILQ_EMPTY(&as->listeners));
+    assert(QLIST_EMPTY(&as->bounce_buffers));
 
+    qemu_mutex_destroy(&as->bounce_lock);
     flatview_unref(as->current_map);
     g_free(as->name);
     g_free(as->ioeventfds);
@@ -3301,10 +3632,17 @@ static const TypeInfo iommu_memory_region_info = {
     .abstract           = true,
 };
 
+static const TypeInfo ram_discard_manager_info = {
+    .parent             = TYPE_INTERFACE,
+    .name               = TYPE_RAM_DISCARD_MANAGER,
+    .class_size         = sizeof(RamDiscardManagerClass),
+};
+
 static void memory_register_types(void)
 {
     type_register_static(&memory_region_info);
     type_register_static(&iommu_memory_region_info);
+    type_register_static(&ram_discard_manager_info);
 }
 
 type_init(memory_register_types)
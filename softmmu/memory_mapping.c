@@ -194,23 +194,15 @@ typedef struct GuestPhysListener {
     MemoryListener listener;
 } GuestPhysListener;
 
-static void guest_phys_blocks_region_add(MemoryListener *listener,
-                                         MemoryRegionSection *section)
+static int guest_phys_blocks_add_section(MemoryRegionSection *section,
+                                         void *opaque)
 {
-    GuestPhysListener *g;
+    GuestPhysListener *g = opaque;
     uint64_t section_size;
     hwaddr target_start, target_end;
     uint8_t *host_addr;
     GuestPhysBlock *predecessor;
 
-    /* we only care about RAM */
-    if (!memory_region_is_ram(section->mr) ||
-        memory_region_is_ram_device(section->mr) ||
-        memory_region_is_nonvolatile(section->mr)) {
-        return;
-    }
-
-    g            = container_of(listener, GuestPhysListener, listener);
     section_size = int128_get64(section->size);
     target_start = section->offset_within_address_space;
     target_end   = target_start + section_size;
@@ -259,6 +251,30 @@ static void guest_phys_blocks_region_add(MemoryListener *listener,
             TARGET_FMT_plx ": %s (count: %u)\n", __func__, target_start,
             target_end, predecessor ? "joined" : "added", g->list->num);
 #endif
+    return 0;
+}
+
+static void guest_phys_blocks_region_add(MemoryListener *listener,
+                                         MemoryRegionSection *section)
+{
+    GuestPhysListener *g = container_of(listener, GuestPhysListener, listener);
+    RamDiscardManager *rdm;
+
+    /* we only care about RAM */
+    if (!memory_region_is_ram(section->mr) ||
+        memory_region_is_ram_device(section->mr) ||
+        memory_region_is_nonvolatile(section->mr)) {
+        return;
+    }
+
+    /* leave out the parts that are discarded, e.g. unplugged virtio-mem */
+    rdm = memory_region_get_ram_discard_manager(section->mr);
+    if (rdm) {
+        ram_discard_manager_replay_populated(rdm, section,
+                                             guest_phys_blocks_add_section, g);
+        return;
+    }
+    guest_phys_blocks_add_section(section, g);
 }
 
 void guest_phys_blocks_append(GuestPhysBlockList *list)
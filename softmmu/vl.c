@@ -2863,6 +2863,20 @@ static char *find_datadir(void)
     return get_relocated_path(CONFIG_QEMU_DATADIR);
 }
 
+/*
+ * Startup phases are timed with the host clock, so that they can be
+ * traced before the QEMU clocks are set up.
+ */
+static int64_t qemu_init_phase_start;
+
+static void qemu_init_phase_done(const char *phase)
+{
+    int64_t now = get_clock();
+
+    trace_qemu_init_phase(phase, (now - qemu_init_phase_start) / SCALE_US);
+    qemu_init_phase_start = now;
+}
+
 void qemu_init(int argc, char **argv, char **envp)
 {
     int i;
@@ -2900,6 +2914,7 @@ void qemu_init(int argc, char **argv, char **envp)
     QemuPluginList plugin_list = QTAILQ_HEAD_INITIALIZER(plugin_list);
     int mem_prealloc = 0; /* force preallocation of physical target memory */
 
+    qemu_init_phase_start = get_clock();
     os_set_line_buffering();
 
     error_init(argv[0]);
@@ -3939,6 +3954,7 @@ void qemu_init(int argc, char **argv, char **envp)
         exit(1);
     }
     trace_init_file();
+    qemu_init_phase_done("options");
 
     /* Open the logfile at this point and set the log mask if necessary.
      */
@@ -4159,6 +4175,7 @@ void qemu_init(int argc, char **argv, char **envp)
      */
     configure_blockdev(&bdo_queue, machine_class, snapshot);
     audio_init_audiodevs();
+    qemu_init_phase_done("backends");
 
     machine_opts = qemu_get_machine_opts();
     qemu_opt_foreach(machine_opts, machine_set_property, current_machine,
@@ -4172,6 +4189,7 @@ void qemu_init(int argc, char **argv, char **envp)
      * after machine_set_property().
      */
     configure_accelerators(argv[0]);
+    qemu_init_phase_done("accelerator");
 
     /*
      * Beware, QOM objects created before this point miss global and
@@ -4357,8 +4375,11 @@ void qemu_init(int argc, char **argv, char **envp)
 
     parse_numa_opts(current_machine);
 
+    qemu_init_phase_done("machine-options");
+
     /* do monitor/qmp handling at preconfig state if requested */
     qemu_main_loop();
+    qemu_init_phase_done("preconfig");
 
     if (machine_class->default_ram_id && current_machine->ram_size &&
         numa_uses_legacy_mem() && !current_machine->ram_memdev_id) {
@@ -4367,6 +4388,7 @@ void qemu_init(int argc, char **argv, char **envp)
 
     /* from here on runstate is RUN_STATE_PRELAUNCH */
     machine_run_board_init(current_machine);
+    qemu_init_phase_done("board");
 
     /*
      * TODO To drop support for deprecated bogus if=..., move
@@ -4401,6 +4423,7 @@ void qemu_init(int argc, char **argv, char **envp)
     cpu_synchronize_all_post_init();
 
     rom_reset_order_override();
+    qemu_init_phase_done("devices");
 
     /* Did we create any drives that we failed to create a device for? */
     drive_check_orphaned();
@@ -4443,6 +4466,12 @@ void qemu_init(int argc, char **argv, char **envp)
         exit(1);
     }
 
+    qemu_init_phase_done("displays");
+
+    /* Asynchronous memory backend preallocation must be done by now */
+    os_mem_prealloc_wait(&error_fatal);
+    qemu_init_phase_done("preallocation");
+
     qdev_machine_creation_done();
 
     /* TODO: once all bus devices are qdevified, this should be done
@@ -4503,6 +4532,7 @@ void qemu_init(int argc, char **argv, char **envp)
 
     accel_setup_post(current_machine);
     os_setup_post();
+    qemu_init_phase_done("reset-and-start");
 
     return;
 }
@@ -21,7 +21,13 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
     abort();
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(bool shared, bool register_fixed, bool sqpoll,
+                         uint32_t sqpoll_idle, Error **errp)
+{
+    abort();
+}
+
+void luring_unregister_fd(LuringState *s, int fd)
 {
     abort();
 }
@@ -594,6 +594,8 @@ typedef struct CPUARMState {
         ARMPredicateReg pregs[17];
         /* Scratch space for aa64 sve predicate temporary.  */
         ARMPredicateReg preg_tmp;
+        /* Scratch space for inline expansion of predicated operations.  */
+        ARMVectorReg zreg_tmp[2];
 #endif
 
         /* We store these fpcsr fields separately for convenience.  */
@@ -57,6 +57,22 @@ static void do_crypto_aese(uint64_t *rd, uint64_t *rn,
     rk.l[0] ^= st.l[0];
     rk.l[1] ^= st.l[1];
 
+    /*
+     * AESE/AESD are the last round of the x86 instructions, applied to the
+     * xored state with a zero round key.  The byte order matches, as the
+     * host is little endian whenever aes_round_accel is set.
+     */
+    if (aes_round_accel) {
+        static const uint64_t zero[2];
+
+        if (decrypt) {
+            aes_round_declast(rd, &rk, zero);
+        } else {
+            aes_round_enclast(rd, &rk, zero);
+        }
+        return;
+    }
+
     /* combine ShiftRows operation and sbox substitution */
     for (i = 0; i < 16; i++) {
         CR_ST_BYTE(st, i) = sbox[decrypt][CR_ST_BYTE(rk, shift[decrypt][i])];
@@ -216,6 +232,15 @@ static void do_crypto_aesmc(uint64_t *rd, uint64_t *rm, bool decrypt)
     union CRYPTO_STATE st = { .l = { rm[0], rm[1] } };
     int i;
 
+    if (aes_round_accel) {
+        if (decrypt) {
+            aes_round_imc(rd, &st);
+        } else {
+            aes_round_mc(rd, &st);
+        }
+        return;
+    }
+
     for (i = 0; i < 16; i += 4) {
         CR_ST_WORD(st, i >> 2) =
             mc[decrypt][CR_ST_BYTE(st, i)] ^
@@ -35,6 +35,7 @@
 #include "tcg/tcg.h"
 #include "fpu/softfloat.h"
 #include <zlib.h> /* For crc32 */
+#include "afl.h"
 
 /* C2.4.7 Multiply and divide */
 /* special cases for 0 and LLONG_MIN are mandated by the standard */
@@ -62,6 +63,13 @@ uint64_t HELPER(rbit64)(uint64_t x)
     return revbit64(x);
 }
 
+/* AFL fuzzCall, see afl-fuzzcall.c */
+uint64_t HELPER(fuzzCall)(CPUARMState *env, uint64_t code, uint64_t a0,
+                          uint64_t a1)
+{
+    return afl_fuzz_call(env, code, a0, a1);
+}
+
 void HELPER(msr_i_spsel)(CPUARMState *env, uint32_t imm)
 {
     update_spsel(env, imm);
@@ -583,7 +591,7 @@ uint64_t HELPER(paired_cmpxchg64_le_parallel)(CPUARMState *env, uint64_t addr,
     int mem_idx;
     TCGMemOpIdx oi;
 
-    assert(HAVE_CMPXCHG128);
+    assert(atomic16_cmpxchg_enabled());
 
     mem_idx = cpu_mmu_index(env, false);
     oi = make_memop_idx(MO_LEQ | MO_ALIGN_16, mem_idx);
@@ -653,7 +661,7 @@ uint64_t HELPER(paired_cmpxchg64_be_parallel)(CPUARMState *env, uint64_t addr,
     int mem_idx;
     TCGMemOpIdx oi;
 
-    assert(HAVE_CMPXCHG128);
+    assert(atomic16_cmpxchg_enabled());
 
     mem_idx = cpu_mmu_index(env, false);
     oi = make_memop_idx(MO_BEQ | MO_ALIGN_16, mem_idx);
@@ -679,7 +687,7 @@ void HELPER(casp_le_parallel)(CPUARMState *env, uint32_t rs, uint64_t addr,
     int mem_idx;
     TCGMemOpIdx oi;
 
-    assert(HAVE_CMPXCHG128);
+    assert(atomic16_cmpxchg_enabled());
 
     mem_idx = cpu_mmu_index(env, false);
     oi = make_memop_idx(MO_LEQ | MO_ALIGN_16, mem_idx);
@@ -700,7 +708,7 @@ void HELPER(casp_be_parallel)(CPUARMState *env, uint32_t rs, uint64_t addr,
     int mem_idx;
     TCGMemOpIdx oi;
 
-    assert(HAVE_CMPXCHG128);
+    assert(atomic16_cmpxchg_enabled());
 
     mem_idx = cpu_mmu_index(env, false);
     oi = make_memop_idx(MO_LEQ | MO_ALIGN_16, mem_idx);
@@ -3970,6 +3970,30 @@ static void vmsa_ttbr_write(CPUARMState *env, const ARMCPRegInfo *ri,
     if (cpreg_field_is_64bit(ri) &&
         extract64(raw_read(env, ri) ^ value, 48, 16) != 0) {
         ARMCPU *cpu = env_archcpu(env);
+
+        if (ri->fieldoffset == offsetof(CPUARMState, cp15.ttbr0_el[1]) ||
+            ri->fieldoffset == offsetof(CPUARMState, cp15.ttbr1_el[1])) {
+            uint64_t asid;
+
+            /*
+             * Only the EL1&0 stage 1 translations depend on the ASID.
+             * Tag them with the ASID fields of both TTBRs, whichever one
+             * TCR_EL1.A1 selects, so that the TLB of a recently used
+             * ASID can be reused.
+             */
+            raw_write(env, ri, value);
+            asid = extract64(env->cp15.ttbr0_el[1], 48, 16) |
+                   extract64(env->cp15.ttbr1_el[1], 48, 16) << 16;
+            tlb_switch_asid_by_mmuidx(CPU(cpu),
+                                      ARMMMUIdxBit_E10_1 |
+                                      ARMMMUIdxBit_E10_1_PAN |
+                                      ARMMMUIdxBit_E10_0 |
+                                      ARMMMUIdxBit_SE10_1 |
+                                      ARMMMUIdxBit_SE10_1_PAN |
+                                      ARMMMUIdxBit_SE10_0,
+                                      asid, false);
+            return;
+        }
         tlb_flush(CPU(cpu));
     }
     raw_write(env, ri, value);
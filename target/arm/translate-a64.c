@@ -39,6 +39,8 @@
 #include "translate-a64.h"
 #include "qemu/atomic128.h"
 
+#include "afl.h"
+
 static TCGv_i64 cpu_X[32];
 static TCGv_i64 cpu_pc;
 
@@ -414,6 +416,11 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint64_t dest)
 
     tb = s->base.tb;
     if (use_goto_tb(s, n, dest)) {
+        n = translator_goto_tb_slot(&s->base, n);
+    } else {
+        n = -1;
+    }
+    if (n >= 0) {
         tcg_gen_goto_tb(n);
         gen_a64_set_pc_im(dest);
         tcg_gen_exit_tb(tb, n);
@@ -431,6 +438,18 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint64_t dest)
     }
 }
 
+/* In a superblock, carry on translating at the target of a branch */
+static bool gen_follow_branch(DisasContext *s, uint64_t dest)
+{
+    if (s->ss_active ||
+        !translator_follow_branch(&s->base, s->base.pc_next, dest)) {
+        return false;
+    }
+    s->base.pc_next = dest;
+    s->base.is_jmp = DISAS_NEXT;
+    return true;
+}
+
 void unallocated_encoding(DisasContext *s)
 {
     /* Unallocated and reserved encodings are uncategorized */
@@ -1312,7 +1331,9 @@ static void disas_uncond_b_imm(DisasContext *s, uint32_t insn)
 
     /* B Branch / BL Branch with link */
     reset_btype(s);
-    gen_goto_tb(s, 0, addr);
+    if (!gen_follow_branch(s, addr)) {
+        gen_goto_tb(s, 0, addr);
+    }
 }
 
 /* Compare and branch (immediate)
@@ -1342,7 +1363,9 @@ static void disas_comp_b_imm(DisasContext *s, uint32_t insn)
 
     gen_goto_tb(s, 0, s->base.pc_next);
     gen_set_label(label_match);
-    gen_goto_tb(s, 1, addr);
+    if (addr > s->pc_curr || !gen_follow_branch(s, addr)) {
+        gen_goto_tb(s, 1, addr);
+    }
 }
 
 /* Test and branch (immediate)
@@ -1373,7 +1396,9 @@ static void disas_test_b_imm(DisasContext *s, uint32_t insn)
     tcg_temp_free_i64(tcg_cmp);
     gen_goto_tb(s, 0, s->base.pc_next);
     gen_set_label(label_match);
-    gen_goto_tb(s, 1, addr);
+    if (addr > s->pc_curr || !gen_follow_branch(s, addr)) {
+        gen_goto_tb(s, 1, addr);
+    }
 }
 
 /* Conditional branch (immediate)
@@ -1401,8 +1426,11 @@ static void disas_cond_b_imm(DisasContext *s, uint32_t insn)
         arm_gen_test_cc(cond, label_match);
         gen_goto_tb(s, 0, s->base.pc_next);
         gen_set_label(label_match);
-        gen_goto_tb(s, 1, addr);
-    } else {
+        /* Follow loop back edges, the taken side of the others is a guess */
+        if (addr > s->pc_curr || !gen_follow_branch(s, addr)) {
+            gen_goto_tb(s, 1, addr);
+        }
+    } else if (!gen_follow_branch(s, addr)) {
         /* 0xe and 0xf are both "always" conditions */
         gen_goto_tb(s, 0, addr);
     }
@@ -2097,8 +2125,15 @@ static void disas_exc(DisasContext *s, uint32_t insn)
          * Since QEMU doesn't implement external debug, we treat this as
          * it is required for halting debug disabled: it will UNDEF.
          * Secondly, "HLT 0xf000" is the A64 semihosting syscall instruction.
+         * Thirdly, "HLT 0x4146" is the AFL fuzzCall: x0 = call number,
+         * x1 and x2 the arguments, result in x0.
          */
-        if (semihosting_enabled() && imm16 == 0xf000) {
+        if (imm16 == 0x4146) {
+            /* startWork may snapshot the vCPU and doneWork may restore it */
+            gen_a64_set_pc_im(s->base.pc_next);
+            gen_helper_fuzzCall(cpu_reg(s, 0), cpu_env, cpu_reg(s, 0),
+                                cpu_reg(s, 1), cpu_reg(s, 2));
+        } else if (semihosting_enabled() && imm16 == 0xf000) {
 #ifndef CONFIG_USER_ONLY
             /* In system mode, don't allow userspace access to semihosting,
              * to provide some semblance of security (and for consistency
@@ -2444,7 +2479,7 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
                                        MO_64 | MO_ALIGN | s->be_data);
             tcg_gen_setcond_i64(TCG_COND_NE, tmp, tmp, cpu_exclusive_val);
         } else if (tb_cflags(s->base.tb) & CF_PARALLEL) {
-            if (!HAVE_CMPXCHG128) {
+            if (!atomic16_cmpxchg_enabled()) {
                 gen_helper_exit_atomic(cpu_env);
                 s->base.is_jmp = DISAS_NORETURN;
             } else if (s->be_data == MO_LE) {
@@ -2537,7 +2572,7 @@ static void gen_compare_and_swap_pair(DisasContext *s, int rs, int rt,
         }
         tcg_temp_free_i64(cmp);
     } else if (tb_cflags(s->base.tb) & CF_PARALLEL) {
-        if (HAVE_CMPXCHG128) {
+        if (atomic16_cmpxchg_enabled()) {
             TCGv_i32 tcg_rs = tcg_const_i32(rs);
             if (s->be_data == MO_LE) {
                 gen_helper_casp_le_parallel(cpu_env, tcg_rs,
@@ -4183,6 +4218,8 @@ static void disas_add_sub_imm(DisasContext *s, uint32_t insn)
     } else {
         TCGv_i64 tcg_imm = tcg_const_i64(imm);
         if (sub_op) {
+            afl_gen_cmplog(s->pc_curr, is_64bit ? MO_64 : MO_32,
+                           tcg_rn, tcg_imm);
             gen_sub_CC(is_64bit, tcg_result, tcg_rn, tcg_imm);
         } else {
             gen_add_CC(is_64bit, tcg_result, tcg_rn, tcg_imm);
@@ -4845,6 +4882,7 @@ static void disas_add_sub_ext_reg(DisasContext *s, uint32_t insn)
         }
     } else {
         if (sub_op) {
+            afl_gen_cmplog(s->pc_curr, sf ? MO_64 : MO_32, tcg_rn, tcg_rm);
             gen_sub_CC(sf, tcg_result, tcg_rn, tcg_rm);
         } else {
             gen_add_CC(sf, tcg_result, tcg_rn, tcg_rm);
@@ -4909,6 +4947,7 @@ static void disas_add_sub_reg(DisasContext *s, uint32_t insn)
         }
     } else {
         if (sub_op) {
+            afl_gen_cmplog(s->pc_curr, sf ? MO_64 : MO_32, tcg_rn, tcg_rm);
             gen_sub_CC(sf, tcg_result, tcg_rn, tcg_rm);
         } else {
             gen_add_CC(sf, tcg_result, tcg_rn, tcg_rm);
@@ -5184,6 +5223,7 @@ static void disas_cc(DisasContext *s, uint32_t insn)
     /* Set the flags for the new comparison.  */
     tcg_tmp = tcg_temp_new_i64();
     if (op) {
+        afl_gen_cmplog(s->pc_curr, sf ? MO_64 : MO_32, tcg_rn, tcg_y);
         gen_sub_CC(sf, tcg_tmp, tcg_rn, tcg_y);
     } else {
         gen_add_CC(sf, tcg_tmp, tcg_rn, tcg_y);
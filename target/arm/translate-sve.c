@@ -388,22 +388,87 @@ static bool trans_##NAME##_zpzz(DisasContext *s, arg_rprr_esz *a)         \
     return do_zpzz_ool(s, a, fns[a->esz]);                                \
 }
 
-DO_ZPZZ(AND, and)
-DO_ZPZZ(EOR, eor)
-DO_ZPZZ(ORR, orr)
-DO_ZPZZ(BIC, bic)
-
-DO_ZPZZ(ADD, add)
-DO_ZPZZ(SUB, sub)
-
-DO_ZPZZ(SMAX, smax)
-DO_ZPZZ(UMAX, umax)
-DO_ZPZZ(SMIN, smin)
-DO_ZPZZ(UMIN, umin)
+/*
+ * Expand predicate Pg into an all-ones/all-zeros mask per element of
+ * size ESZ, stored into a scratch vector register.  Return its offset.
+ */
+static int gen_pred_mask(DisasContext *s, int esz, int pg)
+{
+    static gen_helper_gvec_2 * const fns[4] = {
+        gen_helper_sve_expand_pred_b, gen_helper_sve_expand_pred_h,
+        gen_helper_sve_expand_pred_s, gen_helper_sve_expand_pred_d,
+    };
+    unsigned vsz = vec_full_reg_size(s);
+    int mofs = offsetof(CPUARMState, vfp.zreg_tmp[0]);
+
+    tcg_gen_gvec_2_ool(mofs, pred_full_reg_offset(s, pg),
+                       vsz, vsz, 0, fns[esz]);
+    return mofs;
+}
+
+/*
+ * Operations for which an identity element exists are expanded inline
+ * by first replacing the inactive elements of Zm with that identity:
+ * MASK_FN combines Zm with the predicate mask, and FN then computes
+ * Zd = Zn op Zm' over the whole vector.
+ */
+static bool do_zpzz_mask(DisasContext *s, arg_rprr_esz *a,
+                         GVecGen3Fn *mask_fn, GVecGen3Fn *fn)
+{
+    if (sve_access_check(s)) {
+        unsigned vsz = vec_full_reg_size(s);
+        int mofs = gen_pred_mask(s, a->esz, a->pg);
+
+        mask_fn(MO_64, mofs, vec_full_reg_offset(s, a->rm), mofs, vsz, vsz);
+        fn(a->esz, vec_full_reg_offset(s, a->rd),
+           vec_full_reg_offset(s, a->rn), mofs, vsz, vsz);
+    }
+    return true;
+}
+
+/*
+ * Other operations are computed over the whole vector into a scratch
+ * register, then merged with Zn under the predicate mask.
+ */
+static bool do_zpzz_sel(DisasContext *s, arg_rprr_esz *a, GVecGen3Fn *fn)
+{
+    if (sve_access_check(s)) {
+        unsigned vsz = vec_full_reg_size(s);
+        int tofs = offsetof(CPUARMState, vfp.zreg_tmp[1]);
+        int nofs = vec_full_reg_offset(s, a->rn);
+        int mofs;
+
+        fn(a->esz, tofs, nofs, vec_full_reg_offset(s, a->rm), vsz, vsz);
+        mofs = gen_pred_mask(s, a->esz, a->pg);
+        tcg_gen_gvec_bitsel(MO_8, vec_full_reg_offset(s, a->rd),
+                            mofs, tofs, nofs, vsz, vsz);
+    }
+    return true;
+}
+
+#define DO_ZPZZ_MASK(NAME, MASK, FN) static bool trans_##NAME##_zpzz(DisasContext *s, arg_rprr_esz *a)         {                                                                             return do_zpzz_mask(s, a, MASK, FN);                                  }
+
+/* Zm | ~mask: inactive elements become all ones, the identity for AND.  */
+DO_ZPZZ_MASK(AND, tcg_gen_gvec_orc, tcg_gen_gvec_and)
+DO_ZPZZ_MASK(EOR, tcg_gen_gvec_and, tcg_gen_gvec_xor)
+DO_ZPZZ_MASK(ORR, tcg_gen_gvec_and, tcg_gen_gvec_or)
+DO_ZPZZ_MASK(BIC, tcg_gen_gvec_and, tcg_gen_gvec_andc)
+
+DO_ZPZZ_MASK(ADD, tcg_gen_gvec_and, tcg_gen_gvec_add)
+DO_ZPZZ_MASK(SUB, tcg_gen_gvec_and, tcg_gen_gvec_sub)
+
+#undef DO_ZPZZ_MASK
+
+#define DO_ZPZZ_SEL(NAME, FN) static bool trans_##NAME##_zpzz(DisasContext *s, arg_rprr_esz *a)         {                                                                             return do_zpzz_sel(s, a, FN);                                         }
+
+DO_ZPZZ_SEL(SMAX, tcg_gen_gvec_smax)
+DO_ZPZZ_SEL(UMAX, tcg_gen_gvec_umax)
+DO_ZPZZ_SEL(SMIN, tcg_gen_gvec_smin)
+DO_ZPZZ_SEL(UMIN, tcg_gen_gvec_umin)
 DO_ZPZZ(SABD, sabd)
 DO_ZPZZ(UABD, uabd)
 
-DO_ZPZZ(MUL, mul)
+DO_ZPZZ_SEL(MUL, tcg_gen_gvec_mul)
 DO_ZPZZ(SMULH, smulh)
 DO_ZPZZ(UMULH, umulh)
 
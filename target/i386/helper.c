@@ -62,6 +62,17 @@ void cpu_sync_bndcs_hflags(CPUX86State *env)
     env->hflags2 = hflags2;
 }
 
+void cpu_sync_avx_hflag(CPUX86State *env)
+{
+    if ((env->cr[4] & CR4_OSXSAVE_MASK)
+        && (env->xcr0 & (XSTATE_SSE_MASK | XSTATE_YMM_MASK))
+            == (XSTATE_SSE_MASK | XSTATE_YMM_MASK)) {
+        env->hflags |= HF_AVX_EN_MASK;
+    } else {
+        env->hflags &= ~HF_AVX_EN_MASK;
+    }
+}
+
 static void cpu_x86_version(CPUX86State *env, int *family, int *model)
 {
     int cpuver = env->cpuid_version;
@@ -676,6 +687,29 @@ void cpu_x86_update_cr3(CPUX86State *env, target_ulong new_cr3)
     }
 }
 
+/*
+ * MOV to CR3 with CR4.PCIDE set.  The TLB entries are tagged with the
+ * PCID in bits 11:0 of CR3, so switching back to a recently used PCID
+ * finds its entries again.  Unless bit 63 is set, the entries of the new
+ * PCID are dropped.
+ */
+void cpu_x86_update_cr3_pcid(CPUX86State *env, target_ulong new_cr3)
+{
+#ifdef TARGET_X86_64
+    bool noflush = new_cr3 >> 63;
+
+    new_cr3 &= ~(1ULL << 63);
+    env->cr[3] = new_cr3;
+    qemu_log_mask(CPU_LOG_MMU,
+                  "CR3 update: CR3=" TARGET_FMT_lx " noflush=%d\n",
+                  new_cr3, noflush);
+    tlb_switch_asid_by_mmuidx(env_cpu(env), (1 << NB_MMU_MODES) - 1,
+                              new_cr3 & 0xfff, !noflush);
+#else
+    cpu_x86_update_cr3(env, new_cr3);
+#endif
+}
+
 void cpu_x86_update_cr4(CPUX86State *env, uint32_t new_cr4)
 {
     uint32_t hflags;
@@ -685,7 +719,7 @@ void cpu_x86_update_cr4(CPUX86State *env, uint32_t new_cr4)
 #endif
     if ((new_cr4 ^ env->cr[4]) &
         (CR4_PGE_MASK | CR4_PAE_MASK | CR4_PSE_MASK |
-         CR4_SMEP_MASK | CR4_SMAP_MASK | CR4_LA57_MASK)) {
+         CR4_SMEP_MASK | CR4_SMAP_MASK | CR4_LA57_MASK | CR4_PCIDE_MASK)) {
         tlb_flush(env_cpu(env));
     }
 
@@ -711,10 +745,15 @@ void cpu_x86_update_cr4(CPUX86State *env, uint32_t new_cr4)
         new_cr4 &= ~CR4_PKE_MASK;
     }
 
+    if (!(env->features[FEAT_1_ECX] & CPUID_EXT_PCID)) {
+        new_cr4 &= ~CR4_PCIDE_MASK;
+    }
+
     env->cr[4] = new_cr4;
     env->hflags = hflags;
 
     cpu_sync_bndcs_hflags(env);
+    cpu_sync_avx_hflag(env);
 }
 
 #if !defined(CONFIG_USER_ONLY)
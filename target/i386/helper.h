@@ -80,6 +80,8 @@ DEF_HELPER_2(cmpxchg8b, void, env, tl)
 DEF_HELPER_2(cmpxchg16b_unlocked, void, env, tl)
 DEF_HELPER_2(cmpxchg16b, void, env, tl)
 #endif
+DEF_HELPER_5(rep_movs, i32, env, tl, tl, int, int)
+DEF_HELPER_4(rep_stos, i32, env, tl, int, int)
 DEF_HELPER_1(single_step, void, env)
 DEF_HELPER_1(rechecking_single_step, void, env)
 DEF_HELPER_1(cpuid, void, env)
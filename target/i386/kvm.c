@@ -49,6 +49,7 @@
 #include "migration/blocker.h"
 #include "exec/memattrs.h"
 #include "trace.h"
+#include "afl.h"
 
 //#define DEBUG_KVM
 
@@ -4472,6 +4473,30 @@ static bool host_supports_vmx(void)
 
 #define VMX_INVALID_GUEST_STATE 0x80000021
 
+#ifdef CONFIG_TCG
+/*
+ * fuzzCall as a hypercall, for host kernels that forward unknown
+ * hypercalls to userspace.  The code is AFL_HYPERCALL_NR(code) in RAX,
+ * the arguments are in RDI and RSI as for the 0f 24 instruction under
+ * TCG, and the result goes back in RAX.
+ */
+static int kvm_handle_afl_hypercall(X86CPU *cpu, struct kvm_run *run)
+{
+    CPUX86State *env = &cpu->env;
+    uint64_t nr = run->hypercall.nr;
+
+    if ((nr & ~AFL_HYPERCALL_CODE_MASK) != AFL_HYPERCALL_NR(0)) {
+        fprintf(stderr, "KVM: unknown hypercall %" PRIx64 "\n", nr);
+        return -1;
+    }
+
+    cpu_synchronize_state(CPU(cpu));
+    run->hypercall.ret = afl_fuzz_call(env, nr & AFL_HYPERCALL_CODE_MASK,
+                                       env->regs[R_EDI], env->regs[R_ESI]);
+    return 0;
+}
+#endif
+
 int kvm_arch_handle_exit(CPUState *cs, struct kvm_run *run)
 {
     X86CPU *cpu = X86_CPU(cs);
@@ -4510,6 +4535,11 @@ int kvm_arch_handle_exit(CPUState *cs, struct kvm_run *run)
         }
         ret = -1;
         break;
+#ifdef CONFIG_TCG
+    case KVM_EXIT_HYPERCALL:
+        ret = kvm_handle_afl_hypercall(cpu, run);
+        break;
+#endif
     case KVM_EXIT_EXCEPTION:
         fprintf(stderr, "KVM: exception %d exit (error code 0x%x)\n",
                 run->ex.exception, run->ex.error_code);
@@ -138,7 +138,7 @@ void helper_cmpxchg16b(CPUX86State *env, target_ulong a0)
 
     if ((a0 & 0xf) != 0) {
         raise_exception_ra(env, EXCP0D_GPF, ra);
-    } else if (HAVE_CMPXCHG128) {
+    } else if (atomic16_cmpxchg_enabled()) {
         int eflags = cpu_cc_compute_all(env, CC_OP);
 
         Int128 cmpv = int128_make128(env->regs[R_EAX], env->regs[R_EDX]);
@@ -191,3 +191,155 @@ void helper_boundl(CPUX86State *env, target_ulong a0, int v)
         raise_exception_ra(env, EXCP05_BOUND, GETPC());
     }
 }
+
+/*
+ * Bulk paths for REP MOVS and REP STOS.  They copy or fill as many elements
+ * as fit in the current source and destination pages with one host memmove
+ * or memset, and advance ESI, EDI and ECX to match.  Only pages that are
+ * already backed by plain RAM in the TLB are used, so these never fault:
+ * they return 0 when not even one element could be processed that way
+ * (DF set, page not mapped yet, clean or MMIO page, watchpoint, element
+ * crossing a page...) and the translator then executes a normal single
+ * iteration, which takes the slow path and raises exceptions precisely.
+ */
+#ifndef CONFIG_USER_ONLY
+static target_ulong rep_addr_mask(int aflag)
+{
+    switch (aflag) {
+    case MO_16:
+        return 0xffff;
+    case MO_32:
+        return 0xffffffff;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Number of elements that can be accessed at @addr without crossing a page
+ * or wrapping the index register @reg
+ */
+static target_ulong rep_max_count(CPUX86State *env, target_ulong addr,
+                                  int reg, int ot, int aflag)
+{
+    target_ulong mask = rep_addr_mask(aflag);
+    target_ulong bytes = -(addr | TARGET_PAGE_MASK);
+
+    if (aflag != MO_64) {
+        bytes = MIN(bytes, mask - (env->regs[reg] & mask) + 1);
+    }
+    return bytes >> ot;
+}
+
+static void rep_add_reg(CPUX86State *env, int reg, target_ulong val,
+                        int aflag)
+{
+    switch (aflag) {
+    case MO_16:
+        env->regs[reg] = (env->regs[reg] & ~0xffff) |
+                         ((env->regs[reg] + val) & 0xffff);
+        break;
+    case MO_32:
+        env->regs[reg] = (uint32_t)(env->regs[reg] + val);
+        break;
+    default:
+        env->regs[reg] += val;
+        break;
+    }
+}
+#endif
+
+uint32_t helper_rep_movs(CPUX86State *env, target_ulong dst,
+                         target_ulong src, int ot, int aflag)
+{
+#ifdef CONFIG_USER_ONLY
+    return 0;
+#else
+    int mmu_idx = cpu_mmu_index(env, false);
+    target_ulong n;
+    uint8_t *hsrc, *hdst;
+
+    if (env->df != 1) {
+        return 0;
+    }
+    n = env->regs[R_ECX] & rep_addr_mask(aflag);
+    n = MIN(n, rep_max_count(env, src, R_ESI, ot, aflag));
+    n = MIN(n, rep_max_count(env, dst, R_EDI, ot, aflag));
+    if (n == 0) {
+        return 0;
+    }
+
+    hsrc = tlb_vaddr_to_host(env, src, MMU_DATA_LOAD, mmu_idx);
+    hdst = tlb_vaddr_to_host(env, dst, MMU_DATA_STORE, mmu_idx);
+    if (!hsrc || !hdst) {
+        return 0;
+    }
+
+    /* A forward copy onto an overlapping destination repeats the pattern */
+    if (hdst > hsrc && hdst < hsrc + (n << ot)) {
+        n = (hdst - hsrc) >> ot;
+        if (n == 0) {
+            return 0;
+        }
+    }
+
+    memmove(hdst, hsrc, n << ot);
+    rep_add_reg(env, R_ESI, n << ot, aflag);
+    rep_add_reg(env, R_EDI, n << ot, aflag);
+    rep_add_reg(env, R_ECX, -n, aflag);
+    return n;
+#endif
+}
+
+uint32_t helper_rep_stos(CPUX86State *env, target_ulong dst, int ot,
+                         int aflag)
+{
+#ifdef CONFIG_USER_ONLY
+    return 0;
+#else
+    int mmu_idx = cpu_mmu_index(env, false);
+    uint64_t val = env->regs[R_EAX];
+    uint64_t ones;
+    target_ulong n, i;
+    uint8_t *hdst;
+
+    if (env->df != 1) {
+        return 0;
+    }
+    n = env->regs[R_ECX] & rep_addr_mask(aflag);
+    n = MIN(n, rep_max_count(env, dst, R_EDI, ot, aflag));
+    if (n == 0) {
+        return 0;
+    }
+
+    hdst = tlb_vaddr_to_host(env, dst, MMU_DATA_STORE, mmu_idx);
+    if (!hdst) {
+        return 0;
+    }
+
+    /* 0x01 repeated in each byte of an element */
+    ones = UINT64_MAX / 0xff >> (64 - (8 << ot));
+    val &= ones * 0xff;
+    if (val == (val & 0xff) * ones) {
+        memset(hdst, val, n << ot);
+    } else {
+        for (i = 0; i < n; i++) {
+            switch (ot) {
+            case MO_16:
+                stw_le_p(hdst + (i << ot), val);
+                break;
+            case MO_32:
+                stl_le_p(hdst + (i << ot), val);
+                break;
+            default:
+                stq_le_p(hdst + (i << ot), val);
+                break;
+            }
+        }
+    }
+
+    rep_add_reg(env, R_EDI, n << ot, aflag);
+    rep_add_reg(env, R_ECX, -n, aflag);
+    return n;
+#endif
+}
@@ -150,7 +150,11 @@ void helper_write_crN(CPUX86State *env, int reg, target_ulong t0)
         cpu_x86_update_cr0(env, t0);
         break;
     case 3:
-        cpu_x86_update_cr3(env, t0);
+        if (env->cr[4] & CR4_PCIDE_MASK) {
+            cpu_x86_update_cr3_pcid(env, t0);
+        } else {
+            cpu_x86_update_cr3(env, t0);
+        }
         break;
     case 4:
         cpu_x86_update_cr4(env, t0);
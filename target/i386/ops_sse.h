@@ -19,6 +19,7 @@
  */
 
 #include "crypto/aes.h"
+#include "crypto/clmul.h"
 
 #if SHIFT == 0
 #define Reg MMXReg
@@ -2216,33 +2217,28 @@ target_ulong helper_crc32(uint32_t crc1, target_ulong msg, uint32_t len)
 void glue(helper_pclmulqdq, SUFFIX)(CPUX86State *env, Reg *d, Reg *s,
                                     uint32_t ctrl)
 {
-    uint64_t ah, al, b, resh, resl;
+    uint64_t a = d->Q((ctrl & 1) != 0);
+    uint64_t b = s->Q((ctrl & 16) != 0);
+    uint64_t hi;
 
-    ah = 0;
-    al = d->Q((ctrl & 1) != 0);
-    b = s->Q((ctrl & 16) != 0);
-    resh = resl = 0;
-
-    while (b) {
-        if (b & 1) {
-            resl ^= al;
-            resh ^= ah;
-        }
-        ah = (ah << 1) | (al >> 63);
-        al <<= 1;
-        b >>= 1;
-    }
-
-    d->Q(0) = resl;
-    d->Q(1) = resh;
+    d->Q(0) = clmul_64(a, b, &hi);
+    d->Q(1) = hi;
 }
 
+/*
+ * With the host's AES instructions, the XMM register layout is that of
+ * the host instructions; no translation is needed.
+ */
 void glue(helper_aesdec, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
 {
     int i;
     Reg st = *d;
     Reg rk = *s;
 
+    if (aes_round_accel) {
+        aes_round_dec(d, &st, &rk);
+        return;
+    }
     for (i = 0 ; i < 4 ; i++) {
         d->L(i) = rk.L(i) ^ bswap32(AES_Td0[st.B(AES_ishifts[4*i+0])] ^
                                     AES_Td1[st.B(AES_ishifts[4*i+1])] ^
@@ -2257,6 +2253,10 @@ void glue(helper_aesdeclast, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
     Reg st = *d;
     Reg rk = *s;
 
+    if (aes_round_accel) {
+        aes_round_declast(d, &st, &rk);
+        return;
+    }
     for (i = 0; i < 16; i++) {
         d->B(i) = rk.B(i) ^ (AES_isbox[st.B(AES_ishifts[i])]);
     }
@@ -2268,6 +2268,10 @@ void glue(helper_aesenc, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
     Reg st = *d;
     Reg rk = *s;
 
+    if (aes_round_accel) {
+        aes_round_enc(d, &st, &rk);
+        return;
+    }
     for (i = 0 ; i < 4 ; i++) {
         d->L(i) = rk.L(i) ^ bswap32(AES_Te0[st.B(AES_shifts[4*i+0])] ^
                                     AES_Te1[st.B(AES_shifts[4*i+1])] ^
@@ -2282,6 +2286,10 @@ void glue(helper_aesenclast, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
     Reg st = *d;
     Reg rk = *s;
 
+    if (aes_round_accel) {
+        aes_round_enclast(d, &st, &rk);
+        return;
+    }
     for (i = 0; i < 16; i++) {
         d->B(i) = rk.B(i) ^ (AES_sbox[st.B(AES_shifts[i])]);
     }
@@ -2293,6 +2301,10 @@ void glue(helper_aesimc, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
     int i;
     Reg tmp = *s;
 
+    if (aes_round_accel) {
+        aes_round_imc(d, &tmp);
+        return;
+    }
     for (i = 0 ; i < 4 ; i++) {
         d->L(i) = bswap32(AES_imc[tmp.B(4*i+0)][0] ^
                           AES_imc[tmp.B(4*i+1)][1] ^
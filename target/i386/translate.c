@@ -23,6 +23,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg-op.h"
+#include "tcg/tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translator.h"
 
@@ -41,6 +42,8 @@
 #define PREFIX_ADR    0x10
 #define PREFIX_VEX    0x20
 
+#define X86_MAX_INSN_LENGTH 15
+
 #ifdef TARGET_X86_64
 #define CODE64(s) ((s)->code64)
 #define REX_X(s) ((s)->rex_x)
@@ -128,6 +131,7 @@ typedef struct DisasContext {
     int cpuid_ext3_features;
     int cpuid_7_0_ebx_features;
     int cpuid_xsave_features;
+    CPUX86State *env; /* to peek at the code of successor blocks */
 
     /* TCG local temps */
     TCGv cc_srcT;
@@ -278,6 +282,98 @@ static void gen_update_cc_op(DisasContext *s)
     }
 }
 
+/* Drop the CC computation entirely, without writing anything back.  */
+static void gen_discard_cc(DisasContext *s)
+{
+    tcg_gen_discard_tl(cpu_cc_dst);
+    tcg_gen_discard_tl(cpu_cc_src);
+    tcg_gen_discard_tl(cpu_cc_src2);
+    tcg_gen_discard_tl(s->cc_srcT);
+    tcg_gen_discard_i32(cpu_cc_op);
+    s->cc_op = CC_OP_DYNAMIC;
+    s->cc_op_dirty = false;
+}
+
+/*
+ * Classify the instruction at PC for cross-block flag liveness: return 0
+ * if it overwrites all of OSZAPC without reading them and cannot fault,
+ * its length if it neither touches the flags nor can fault, or -1.
+ */
+static int cc_peek_insn(DisasContext *s, target_ulong pc)
+{
+    CPUX86State *env = s->env;
+    int b, modrm, len = 1, rex_w = 0, iz;
+
+    b = cpu_ldub_code(env, pc);
+#ifdef TARGET_X86_64
+    if (CODE64(s) && (b & 0xf0) == 0x40) {
+        rex_w = b & 8;
+        b = cpu_ldub_code(env, pc + len++);
+    }
+#endif
+    iz = CODE64(s) || s->code32 ? 4 : 2;
+
+    switch (b) {
+    case 0x04: case 0x05: case 0x0c: case 0x0d: /* add, or al/eAX, imm */
+    case 0x24: case 0x25: case 0x2c: case 0x2d: /* and, sub */
+    case 0x34: case 0x35: case 0x3c: case 0x3d: /* xor, cmp */
+    case 0xa8: case 0xa9:                       /* test */
+        return 0;
+    case 0x00 ... 0x03: case 0x08 ... 0x0b:     /* add, or reg-reg */
+    case 0x20 ... 0x23: case 0x28 ... 0x2b:     /* and, sub */
+    case 0x30 ... 0x33: case 0x38 ... 0x3b:     /* xor, cmp */
+    case 0x84: case 0x85:                       /* test */
+        modrm = cpu_ldub_code(env, pc + len);
+        return (modrm >> 6) == 3 ? 0 : -1;
+    case 0x80: case 0x81: case 0x83:            /* grp1, but not adc/sbb */
+        modrm = cpu_ldub_code(env, pc + len);
+        return (modrm >> 6) == 3 && ((modrm >> 3) & 7) != 2 &&
+               ((modrm >> 3) & 7) != 3 ? 0 : -1;
+    case 0x88 ... 0x8b:                         /* mov reg-reg */
+        modrm = cpu_ldub_code(env, pc + len);
+        return (modrm >> 6) == 3 ? len + 1 : -1;
+    case 0x90:                                  /* nop, xchg r8, rax */
+        return len;
+    case 0xb0 ... 0xb7:                         /* mov reg, imm */
+        return len + 1;
+    case 0xb8 ... 0xbf:
+        return len + (rex_w ? 8 : iz);
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Return true if the flags are dead on entry to the direct jump target
+ * EIP, because its code overwrites them before anything can read them
+ * (or take a fault).  The target must lie on a page of this block, so
+ * that modifying it also invalidates the assumption made here.  Only an
+ * interrupt taken right at the block boundary can see the stale flags.
+ */
+static bool cc_dead_at(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+    target_ulong page = pc & TARGET_PAGE_MASK;
+    int i, len;
+
+    if (page != (s->base.tb->pc & TARGET_PAGE_MASK) &&
+        page != (s->pc_start & TARGET_PAGE_MASK)) {
+        return false;
+    }
+    for (i = 0; i < 4; i++) {
+        /* Do not read past the page, even for the longest insn.  */
+        if (((pc + X86_MAX_INSN_LENGTH) & TARGET_PAGE_MASK) != page) {
+            return false;
+        }
+        len = cc_peek_insn(s, pc);
+        if (len <= 0) {
+            return len == 0;
+        }
+        pc += len;
+    }
+    return false;
+}
+
 #ifdef TARGET_X86_64
 
 #define NB_OP_SIZES 4
@@ -1046,17 +1142,32 @@ static inline void gen_jcc1_noeob(DisasContext *s, int b, TCGLabel *l1)
 
 /* Generate a conditional jump to label 'l1' according to jump opcode
    value 'b'. In the fast case, T0 is guaranted not to be used.
-   A translation block must end soon.  */
-static inline void gen_jcc1(DisasContext *s, int b, TCGLabel *l1)
+   A translation block must end soon.  If CC_DEAD, both successors
+   overwrite the flags and the CC computation can be dropped.  */
+static inline void do_gen_jcc1(DisasContext *s, int b, TCGLabel *l1,
+                               bool cc_dead)
 {
     CCPrepare cc = gen_prepare_cc(s, b, s->T0);
 
-    gen_update_cc_op(s);
     if (cc.mask != -1) {
         tcg_gen_andi_tl(s->T0, cc.reg, cc.mask);
         cc.reg = s->T0;
     }
-    set_cc_op(s, CC_OP_DYNAMIC);
+    if (cc_dead) {
+        /* The condition may be read straight from the CC globals.  */
+        if (cc.reg != s->T0) {
+            tcg_gen_mov_tl(s->T0, cc.reg);
+            cc.reg = s->T0;
+        }
+        if (cc.use_reg2 && cc.reg2 != s->tmp0) {
+            tcg_gen_mov_tl(s->tmp0, cc.reg2);
+            cc.reg2 = s->tmp0;
+        }
+        gen_discard_cc(s);
+    } else {
+        gen_update_cc_op(s);
+        set_cc_op(s, CC_OP_DYNAMIC);
+    }
     if (cc.use_reg2) {
         tcg_gen_brcond_tl(cc.cond, cc.reg, cc.reg2, l1);
     } else {
@@ -1064,6 +1175,11 @@ static inline void gen_jcc1(DisasContext *s, int b, TCGLabel *l1)
     }
 }
 
+static inline void gen_jcc1(DisasContext *s, int b, TCGLabel *l1)
+{
+    do_gen_jcc1(s, b, l1, false);
+}
+
 /* XXX: does not work with gdbstub "ice" single step - not a
    serious problem */
 static TCGLabel *gen_jz_ecx_string(DisasContext *s, target_ulong next_eip)
@@ -1176,6 +1292,86 @@ static inline void gen_repz_ ## op(DisasContext *s, MemOp ot,              \
     gen_jmp(s, cur_eip);                                                      \
 }
 
+/*
+ * REP MOVS and REP STOS first let a helper process all the elements that
+ * fit in the current pages; the single iteration is only executed when the
+ * helper could not make progress.  Each iteration must be visible when
+ * single stepping, and must count as one instruction with icount.
+ */
+static bool gen_repz_bulk_ok(DisasContext *s)
+{
+    return s->jmp_opt && !(tb_cflags(s->base.tb) & CF_USE_ICOUNT);
+}
+
+static void gen_repz_movs(DisasContext *s, MemOp ot,
+                          target_ulong cur_eip, target_ulong next_eip)
+{
+    TCGLabel *l2, *l3 = NULL;
+
+    gen_update_cc_op(s);
+    l2 = gen_jz_ecx_string(s, next_eip);
+    if (gen_repz_bulk_ok(s)) {
+        TCGv_i32 t_ot = tcg_const_i32(ot);
+        TCGv_i32 t_aflag = tcg_const_i32(s->aflag);
+
+        l3 = gen_new_label();
+        gen_string_movl_A0_ESI(s);
+        tcg_gen_mov_tl(s->T1, s->A0);
+        gen_string_movl_A0_EDI(s);
+        gen_helper_rep_movs(s->tmp2_i32, cpu_env, s->A0, s->T1,
+                            t_ot, t_aflag);
+        tcg_temp_free_i32(t_ot);
+        tcg_temp_free_i32(t_aflag);
+        tcg_gen_brcondi_i32(TCG_COND_NE, s->tmp2_i32, 0, l3);
+    }
+    gen_movs(s, ot);
+    gen_op_add_reg_im(s, s->aflag, R_ECX, -1);
+    /*
+     * a loop would cause two single step exceptions if ECX = 1
+     * before rep string_insn
+     */
+    if (s->repz_opt) {
+        gen_op_jz_ecx(s, s->aflag, l2);
+    }
+    if (l3) {
+        gen_set_label(l3);
+    }
+    gen_jmp(s, cur_eip);
+}
+
+static void gen_repz_stos(DisasContext *s, MemOp ot,
+                          target_ulong cur_eip, target_ulong next_eip)
+{
+    TCGLabel *l2, *l3 = NULL;
+
+    gen_update_cc_op(s);
+    l2 = gen_jz_ecx_string(s, next_eip);
+    if (gen_repz_bulk_ok(s)) {
+        TCGv_i32 t_ot = tcg_const_i32(ot);
+        TCGv_i32 t_aflag = tcg_const_i32(s->aflag);
+
+        l3 = gen_new_label();
+        gen_string_movl_A0_EDI(s);
+        gen_helper_rep_stos(s->tmp2_i32, cpu_env, s->A0, t_ot, t_aflag);
+        tcg_temp_free_i32(t_ot);
+        tcg_temp_free_i32(t_aflag);
+        tcg_gen_brcondi_i32(TCG_COND_NE, s->tmp2_i32, 0, l3);
+    }
+    gen_stos(s, ot);
+    gen_op_add_reg_im(s, s->aflag, R_ECX, -1);
+    /*
+     * a loop would cause two single step exceptions if ECX = 1
+     * before rep string_insn
+     */
+    if (s->repz_opt) {
+        gen_op_jz_ecx(s, s->aflag, l2);
+    }
+    if (l3) {
+        gen_set_label(l3);
+    }
+    gen_jmp(s, cur_eip);
+}
+
 #define GEN_REPZ2(op)                                                         \
 static inline void gen_repz_ ## op(DisasContext *s, MemOp ot,              \
                                    target_ulong cur_eip,                      \
@@ -1194,8 +1390,6 @@ static inline void gen_repz_ ## op(DisasContext *s, MemOp ot,              \
     gen_jmp(s, cur_eip);                                                      \
 }
 
-GEN_REPZ(movs)
-GEN_REPZ(stos)
 GEN_REPZ(lods)
 GEN_REPZ(ins)
 GEN_REPZ(outs)
@@ -1334,6 +1528,7 @@ static void gen_op(DisasContext *s1, int op, MemOp ot, int d)
                                         s1->mem_index, ot | MO_LE);
             tcg_gen_sub_tl(s1->T0, s1->cc_srcT, s1->T1);
         } else {
+            afl_gen_cmplog(s1->pc_start, ot, s1->T0, s1->T1);
             tcg_gen_mov_tl(s1->cc_srcT, s1->T0);
             tcg_gen_sub_tl(s1->T0, s1->T0, s1->T1);
             gen_op_st_rm_T0_A0(s1, ot, d);
@@ -1376,6 +1571,7 @@ static void gen_op(DisasContext *s1, int op, MemOp ot, int d)
         set_cc_op(s1, CC_OP_LOGICB + ot);
         break;
     case OP_CMPL:
+        afl_gen_cmplog(s1->pc_start, ot, s1->T0, s1->T1);
         tcg_gen_mov_tl(cpu_cc_src, s1->T1);
         tcg_gen_mov_tl(s1->cc_srcT, s1->T0);
         tcg_gen_sub_tl(cpu_cc_dst, s1->T0, s1->T1);
@@ -1889,8 +2085,6 @@ static void gen_shifti(DisasContext *s1, int op, MemOp ot, int d, int c)
     }
 }
 
-#define X86_MAX_INSN_LENGTH 15
-
 static uint64_t advance_pc(CPUX86State *env, DisasContext *s, int num_bytes)
 {
     uint64_t pc = s->pc;
@@ -2215,19 +2409,36 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
 {
     target_ulong pc = s->cs_base + eip;
 
-    if (use_goto_tb(s, pc))  {
+    if (use_goto_tb(s, pc)) {
+        tb_num = translator_goto_tb_slot(&s->base, tb_num);
+    } else {
+        tb_num = -1;
+    }
+    if (tb_num >= 0) {
         /* jump to same page: we can use a direct jump */
         tcg_gen_goto_tb(tb_num);
         gen_jmp_im(s, eip);
         tcg_gen_exit_tb(s->base.tb, tb_num);
         s->base.is_jmp = DISAS_NORETURN;
     } else {
-        /* jump to another page */
+        /* jump to another page, or out of a superblock with no slot left */
         gen_jmp_im(s, eip);
         gen_jr(s, s->tmp0);
     }
 }
 
+/* In a superblock, carry on translating at the target of a branch */
+static bool gen_follow_branch(DisasContext *s, target_ulong eip)
+{
+    if (!s->jmp_opt ||
+        !translator_follow_branch(&s->base, s->pc, s->cs_base + eip)) {
+        return false;
+    }
+    s->pc = s->cs_base + eip;
+    s->base.is_jmp = DISAS_NEXT;
+    return true;
+}
+
 static inline void gen_jcc(DisasContext *s, int b,
                            target_ulong val, target_ulong next_eip)
 {
@@ -2235,12 +2446,15 @@ static inline void gen_jcc(DisasContext *s, int b,
 
     if (s->jmp_opt) {
         l1 = gen_new_label();
-        gen_jcc1(s, b, l1);
+        do_gen_jcc1(s, b, l1, cc_dead_at(s, next_eip) && cc_dead_at(s, val));
 
         gen_goto_tb(s, 0, next_eip);
 
         gen_set_label(l1);
-        gen_goto_tb(s, 1, val);
+        /* Follow loop back edges, the taken side of the others is a guess */
+        if (val >= next_eip || !gen_follow_branch(s, val)) {
+            gen_goto_tb(s, 1, val);
+        }
     } else {
         l1 = gen_new_label();
         l2 = gen_new_label();
@@ -2561,12 +2775,22 @@ static void gen_bnd_jmp(DisasContext *s)
     }
 }
 
+/* How the end of a block goes to the next one */
+enum {
+    EOB_EXIT,       /* back to the main loop */
+    EOB_JR,         /* look the next TB up */
+    EOB_JR_NEAR,    /* same, through the inline cache of near jumps */
+    EOB_JR_RET,     /* same, predicted by the shadow return stack */
+};
+
 /* Generate an end of block. Trace exception is also generated if needed.
    If INHIBIT, set HF_INHIBIT_IRQ_MASK if it isn't already set.
    If RECHECK_TF, emit a rechecking helper for #DB, ignoring the state of
-   S->TF.  This is used by the syscall/sysret insns.  */
+   S->TF.  This is used by the syscall/sysret insns.
+   For EOB_JR_NEAR and EOB_JR_RET, DEST is the new EIP and CS is unchanged. */
 static void
-do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr)
+do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, int jr,
+                  TCGv dest)
 {
     gen_update_cc_op(s);
 
@@ -2587,7 +2811,17 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr)
         tcg_gen_exit_tb(NULL, 0);
     } else if (s->tf) {
         gen_helper_single_step(cpu_env);
-    } else if (jr) {
+    } else if (jr == EOB_JR_NEAR || jr == EOB_JR_RET) {
+        /* Only RF and the IRQ inhibit flag, updated above, have changed */
+        uint32_t flags = s->flags & ~HF_RF_MASK;
+
+        tcg_gen_addi_tl(s->tmp0, dest, s->cs_base);
+        if (jr == EOB_JR_RET) {
+            tcg_gen_lookup_and_goto_ptr_ret(s->tmp0, s->cs_base, flags);
+        } else {
+            tcg_gen_lookup_and_goto_ptr_cached(s->tmp0, s->cs_base, flags);
+        }
+    } else if (jr == EOB_JR) {
         tcg_gen_lookup_and_goto_ptr();
     } else {
         tcg_gen_exit_tb(NULL, 0);
@@ -2598,7 +2832,7 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr)
 static inline void
 gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf)
 {
-    do_gen_eob_worker(s, inhibit, recheck_tf, false);
+    do_gen_eob_worker(s, inhibit, recheck_tf, EOB_EXIT, NULL);
 }
 
 /* End of block.
@@ -2617,15 +2851,31 @@ static void gen_eob(DisasContext *s)
 /* Jump to register */
 static void gen_jr(DisasContext *s, TCGv dest)
 {
-    do_gen_eob_worker(s, false, false, true);
+    do_gen_eob_worker(s, false, false, EOB_JR, NULL);
+}
+
+/* Near jump to register, DEST being the new EIP */
+static void gen_jr_near(DisasContext *s, TCGv dest)
+{
+    do_gen_eob_worker(s, false, false, EOB_JR_NEAR, dest);
+}
+
+/* Near return to DEST, the EIP popped from the stack */
+static void gen_jr_ret(DisasContext *s, TCGv dest)
+{
+    do_gen_eob_worker(s, false, false, EOB_JR_RET, dest);
 }
 
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
 {
-    gen_update_cc_op(s);
-    set_cc_op(s, CC_OP_DYNAMIC);
+    if (s->jmp_opt && cc_dead_at(s, eip)) {
+        gen_discard_cc(s);
+    } else {
+        gen_update_cc_op(s);
+        set_cc_op(s, CC_OP_DYNAMIC);
+    }
     if (s->jmp_opt) {
         gen_goto_tb(s, tb_num, eip);
     } else {
@@ -2639,6 +2889,14 @@ static void gen_jmp(DisasContext *s, target_ulong eip)
     gen_jmp_tb(s, eip, 0);
 }
 
+/* Direct jump or call to eip, which a superblock can follow */
+static void gen_jmp_direct(DisasContext *s, target_ulong eip)
+{
+    if (!gen_follow_branch(s, eip)) {
+        gen_jmp_tb(s, eip, 0);
+    }
+}
+
 static inline void gen_ldq_env_A0(DisasContext *s, int offset)
 {
     tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, MO_LEQ);
@@ -2671,6 +2929,32 @@ static inline void gen_sto_env_A0(DisasContext *s, int offset)
     tcg_gen_qemu_st_i64(s->tmp1_i64, s->tmp0, mem_index, MO_LEQ);
 }
 
+static inline void gen_ldy_env_A0(DisasContext *s, int offset)
+{
+    int mem_index = s->mem_index;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        tcg_gen_addi_tl(s->tmp0, s->A0, i * 8);
+        tcg_gen_qemu_ld_i64(s->tmp1_i64, s->tmp0, mem_index, MO_LEQ);
+        tcg_gen_st_i64(s->tmp1_i64, cpu_env,
+                       offset + offsetof(ZMMReg, ZMM_Q(i)));
+    }
+}
+
+static inline void gen_sty_env_A0(DisasContext *s, int offset)
+{
+    int mem_index = s->mem_index;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        tcg_gen_ld_i64(s->tmp1_i64, cpu_env,
+                       offset + offsetof(ZMMReg, ZMM_Q(i)));
+        tcg_gen_addi_tl(s->tmp0, s->A0, i * 8);
+        tcg_gen_qemu_st_i64(s->tmp1_i64, s->tmp0, mem_index, MO_LEQ);
+    }
+}
+
 static inline void gen_op_movo(DisasContext *s, int d_offset, int s_offset)
 {
     tcg_gen_ld_i64(s->tmp1_i64, cpu_env, s_offset + offsetof(ZMMReg, ZMM_Q(0)));
@@ -3027,6 +3311,9 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+static bool gen_vex(CPUX86State *env, DisasContext *s, int b,
+                    target_ulong pc_start, int rex_r);
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -3038,6 +3325,10 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
     SSEFunc_0_eppt sse_fn_eppt;
     MemOp ot;
 
+    if ((s->prefix & PREFIX_VEX) && gen_vex(env, s, b, pc_start, rex_r)) {
+        return;
+    }
+
     b &= 0xff;
     if (s->prefix & PREFIX_DATA)
         b1 = 1;
@@ -4472,115 +4763,1332 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
     }
 }
 
-/* convert one instruction. s->base.is_jmp is set if the translation must
-   be stopped. Return the next pc value */
-static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
+/*
+ * VEX-encoded SSE and AVX instructions.
+ *
+ * Unlike the legacy encodings, these take their first source from
+ * VEX.vvvv and clear the destination register above the operand size.
+ * Operations that have a TCG vector equivalent are expanded with the
+ * gvec functions, so that they use the host vector unit; the others call
+ * the SSE helpers once for each 128-bit lane.
+ */
+
+/* A VEX instruction that writes a vector register clears it up to here. */
+#define VEX_MAXSZ  sizeof(ZMMReg)
+#define VEX_T0     offsetof(CPUX86State, xmm_t0)
+
+static inline int vex_reg_offset(int reg)
 {
-    CPUX86State *env = cpu->env_ptr;
-    int b, prefixes;
-    int shift;
-    MemOp ot, aflag, dflag;
-    int modrm, reg, rm, mod, op, opreg, val;
-    target_ulong next_eip, tval;
-    int rex_w, rex_r;
-    target_ulong pc_start = s->base.pc_next;
+    return offsetof(CPUX86State, xmm_regs[reg]);
+}
 
-    s->pc_start = s->pc = pc_start;
-    s->override = -1;
-#ifdef TARGET_X86_64
-    s->rex_x = 0;
-    s->rex_b = 0;
-    s->x86_64_hregs = false;
-#endif
-    s->rip_offset = 0; /* for relative ip address */
-    s->vex_l = 0;
-    s->vex_v = 0;
-    if (sigsetjmp(s->jmpbuf, 0) != 0) {
-        gen_exception(s, EXCP0D_GPF, pc_start - s->cs_base);
-        return s->pc;
+static inline bool vex_avx2_ok(DisasContext *s)
+{
+    return !s->vex_l || (s->cpuid_7_0_ebx_features & CPUID_7_0_EBX_AVX2);
+}
+
+static inline void gen_vex_ld_env_A0(DisasContext *s, int offset, int oprsz)
+{
+    if (oprsz == 32) {
+        gen_ldy_env_A0(s, offset);
+    } else {
+        gen_ldo_env_A0(s, offset);
     }
+}
 
-    prefixes = 0;
-    rex_w = -1;
-    rex_r = 0;
+static inline void gen_vex_st_env_A0(DisasContext *s, int offset, int oprsz)
+{
+    if (oprsz == 32) {
+        gen_sty_env_A0(s, offset);
+    } else {
+        gen_sto_env_A0(s, offset);
+    }
+}
 
- next_byte:
-    b = x86_ldub_code(env, s);
-    /* Collect prefixes.  */
-    switch (b) {
-    case 0xf3:
-        prefixes |= PREFIX_REPZ;
-        goto next_byte;
-    case 0xf2:
-        prefixes |= PREFIX_REPNZ;
-        goto next_byte;
-    case 0xf0:
-        prefixes |= PREFIX_LOCK;
-        goto next_byte;
-    case 0x2e:
-        s->override = R_CS;
-        goto next_byte;
-    case 0x36:
-        s->override = R_SS;
-        goto next_byte;
-    case 0x3e:
-        s->override = R_DS;
-        goto next_byte;
-    case 0x26:
-        s->override = R_ES;
-        goto next_byte;
-    case 0x64:
-        s->override = R_FS;
-        goto next_byte;
-    case 0x65:
-        s->override = R_GS;
-        goto next_byte;
-    case 0x66:
-        prefixes |= PREFIX_DATA;
-        goto next_byte;
-    case 0x67:
-        prefixes |= PREFIX_ADR;
-        goto next_byte;
-#ifdef TARGET_X86_64
-    case 0x40 ... 0x4f:
-        if (CODE64(s)) {
-            /* REX prefix */
-            rex_w = (b >> 3) & 1;
-            rex_r = (b & 0x4) << 1;
-            s->rex_x = (b & 0x2) << 2;
-            REX_B(s) = (b & 0x1) << 3;
-            /* select uniform byte register addressing */
-            s->x86_64_hregs = true;
-            goto next_byte;
-        }
+/* Clear the register at @d above the @oprsz bytes that were written. */
+static inline void gen_vex_clear_upper(int d, int oprsz)
+{
+    tcg_gen_gvec_mov(MO_64, d, d, oprsz, VEX_MAXSZ);
+}
+
+/*
+ * Return the offset of the r/m vector operand.  A memory operand is read
+ * into xmm_t0 first, @size bytes of it, as some instructions only access
+ * part of the vector.
+ */
+static int gen_vex_ld_modrm(CPUX86State *env, DisasContext *s, int modrm,
+                            int size)
+{
+    if ((modrm >> 6) == 3) {
+        return vex_reg_offset((modrm & 7) | REX_B(s));
+    }
+
+    gen_lea_modrm(env, s, modrm);
+    switch (size) {
+    case 2:
+        tcg_gen_qemu_ld_i32(s->tmp2_i32, s->A0, s->mem_index, MO_LEUW);
+        tcg_gen_st16_i32(s->tmp2_i32, cpu_env,
+                         VEX_T0 + offsetof(ZMMReg, ZMM_W(0)));
         break;
-#endif
-    case 0xc5: /* 2-byte VEX */
-    case 0xc4: /* 3-byte VEX */
-        /* VEX prefixes cannot be used except in 32-bit mode.
-           Otherwise the instruction is LES or LDS.  */
-        if (s->code32 && !s->vm86) {
-            static const int pp_prefix[4] = {
-                0, PREFIX_DATA, PREFIX_REPZ, PREFIX_REPNZ
-            };
-            int vex3, vex2 = x86_ldub_code(env, s);
+    case 4:
+        tcg_gen_qemu_ld_i32(s->tmp2_i32, s->A0, s->mem_index, MO_LEUL);
+        tcg_gen_st_i32(s->tmp2_i32, cpu_env,
+                       VEX_T0 + offsetof(ZMMReg, ZMM_L(0)));
+        break;
+    case 8:
+        gen_ldq_env_A0(s, VEX_T0 + offsetof(ZMMReg, ZMM_Q(0)));
+        break;
+    default:
+        gen_vex_ld_env_A0(s, VEX_T0, size);
+        break;
+    }
+    return VEX_T0;
+}
 
-            if (!CODE64(s) && (vex2 & 0xc0) != 0xc0) {
-                /* 4.1.4.6: In 32-bit mode, bits [7:6] must be 11b,
-                   otherwise the instruction is LES or LDS.  */
-                s->pc--; /* rewind the advance_pc() x86_ldub_code() did */
-                break;
-            }
+/* Whole vector moves: vmovups, vmovaps, vmovdqu, vmovdqa and friends. */
+static void gen_vex_mov(CPUX86State *env, DisasContext *s, int modrm,
+                        int reg, int oprsz, bool store)
+{
+    if ((modrm >> 6) == 3) {
+        int rm = vex_reg_offset((modrm & 7) | REX_B(s));
 
-            /* 4.1.1-4.1.3: No preceding lock, 66, f2, f3, or rex prefixes. */
-            if (prefixes & (PREFIX_REPZ | PREFIX_REPNZ
-                            | PREFIX_LOCK | PREFIX_DATA)) {
-                goto illegal_op;
-            }
-#ifdef TARGET_X86_64
-            if (s->x86_64_hregs) {
-                goto illegal_op;
-            }
+        if (store) {
+            tcg_gen_gvec_mov(MO_64, rm, reg, oprsz, VEX_MAXSZ);
+        } else {
+            tcg_gen_gvec_mov(MO_64, reg, rm, oprsz, VEX_MAXSZ);
+        }
+    } else {
+        gen_lea_modrm(env, s, modrm);
+        if (store) {
+            gen_vex_st_env_A0(s, reg, oprsz);
+        } else {
+            gen_vex_ld_env_A0(s, reg, oprsz);
+            gen_vex_clear_upper(reg, oprsz);
+        }
+    }
+}
+
+/*
+ * The SSE helpers work in place, d = d OP b.  For d = a OP b, copy a to
+ * the destination first, moving b out of the way if it is the
+ * destination.  Return the offset b ends up at.
+ */
+static int gen_vex_copy_src1(int d, int a, int b, int oprsz)
+{
+    if (d != a) {
+        if (b == d) {
+            int t = a == VEX_T0 ? VEX_T0 + 32 : VEX_T0;
+
+            tcg_gen_gvec_mov(MO_64, t, b, oprsz, oprsz);
+            b = t;
+        }
+        tcg_gen_gvec_mov(MO_64, d, a, oprsz, oprsz);
+    }
+    return b;
+}
+
+/*
+ * The 256-bit forms of the instructions that widen the low half of their
+ * source.  Do the upper lane first, which reads the part of the source
+ * that the lower lane would overwrite.
+ */
+static void gen_vex_widen(DisasContext *s, SSEFunc_0_epp fn, int d, int b,
+                          int half)
+{
+    tcg_gen_addi_ptr(s->ptr0, cpu_env, d + 16);
+    tcg_gen_addi_ptr(s->ptr1, cpu_env, b + half);
+    fn(cpu_env, s->ptr0, s->ptr1);
+    tcg_gen_addi_ptr(s->ptr0, cpu_env, d);
+    tcg_gen_addi_ptr(s->ptr1, cpu_env, b);
+    fn(cpu_env, s->ptr0, s->ptr1);
+}
+
+/*
+ * The 256-bit forms of the instructions that narrow their source into
+ * 128 bits.  The upper lane is converted into the unused top of xmm_t0.
+ */
+static void gen_vex_narrow(DisasContext *s, SSEFunc_0_epp fn, int d, int b)
+{
+    tcg_gen_addi_ptr(s->ptr0, cpu_env, VEX_T0 + 32);
+    tcg_gen_addi_ptr(s->ptr1, cpu_env, b + 16);
+    fn(cpu_env, s->ptr0, s->ptr1);
+    tcg_gen_addi_ptr(s->ptr0, cpu_env, d);
+    tcg_gen_addi_ptr(s->ptr1, cpu_env, b);
+    fn(cpu_env, s->ptr0, s->ptr1);
+    tcg_gen_ld_i64(s->tmp1_i64, cpu_env,
+                   VEX_T0 + 32 + offsetof(ZMMReg, ZMM_Q(0)));
+    tcg_gen_st_i64(s->tmp1_i64, cpu_env, d + offsetof(ZMMReg, ZMM_Q(1)));
+}
+
+/* vmovmskps, vmovmskpd and vpmovmskb, concatenating the lanes' masks. */
+static void gen_vex_movmsk(DisasContext *s, SSEFunc_i_ep fn, int reg, int b,
+                           int oprsz, int lane_bits)
+{
+    tcg_gen_addi_ptr(s->ptr0, cpu_env, b);
+    fn(s->tmp2_i32, cpu_env, s->ptr0);
+    if (oprsz == 32) {
+        TCGv_i32 t = tcg_temp_new_i32();
+
+        tcg_gen_addi_ptr(s->ptr0, cpu_env, b + 16);
+        fn(t, cpu_env, s->ptr0);
+        tcg_gen_deposit_i32(s->tmp2_i32, s->tmp2_i32, t,
+                            lane_bits, lane_bits);
+        tcg_temp_free_i32(t);
+    }
+    tcg_gen_extu_i32_tl(cpu_regs[reg], s->tmp2_i32);
+}
+
+typedef void GVecGen3Fn(unsigned, uint32_t, uint32_t,
+                        uint32_t, uint32_t, uint32_t);
+
+/*
+ * Expand the operations that have a TCG vector equivalent, d = a OP b,
+ * or d = OP b for vpabs.  Return false for the others.
+ */
+static bool gen_vex_gvec(int op, int d, int a, int b, int oprsz)
+{
+    GVecGen3Fn *fn;
+    TCGCond cond;
+    MemOp vece;
+
+    switch (op) {
+    case 0x154: /* vandps, vandpd */
+    case 0x1db: /* vpand */
+        fn = tcg_gen_gvec_and;
+        vece = MO_64;
+        break;
+    case 0x155: /* vandnps, vandnpd */
+    case 0x1df: /* vpandn */
+        tcg_gen_gvec_andc(MO_64, d, b, a, oprsz, VEX_MAXSZ);
+        return true;
+    case 0x156: /* vorps, vorpd */
+    case 0x1eb: /* vpor */
+        fn = tcg_gen_gvec_or;
+        vece = MO_64;
+        break;
+    case 0x157: /* vxorps, vxorpd */
+    case 0x1ef: /* vpxor */
+        fn = tcg_gen_gvec_xor;
+        vece = MO_64;
+        break;
+    case 0x1fc ... 0x1fe: /* vpaddb, vpaddw, vpaddd */
+        fn = tcg_gen_gvec_add;
+        vece = op - 0x1fc;
+        break;
+    case 0x1d4: /* vpaddq */
+        fn = tcg_gen_gvec_add;
+        vece = MO_64;
+        break;
+    case 0x1f8 ... 0x1fb: /* vpsubb, vpsubw, vpsubd, vpsubq */
+        fn = tcg_gen_gvec_sub;
+        vece = op - 0x1f8;
+        break;
+    case 0x1ec ... 0x1ed: /* vpaddsb, vpaddsw */
+        fn = tcg_gen_gvec_ssadd;
+        vece = op - 0x1ec;
+        break;
+    case 0x1dc ... 0x1dd: /* vpaddusb, vpaddusw */
+        fn = tcg_gen_gvec_usadd;
+        vece = op - 0x1dc;
+        break;
+    case 0x1e8 ... 0x1e9: /* vpsubsb, vpsubsw */
+        fn = tcg_gen_gvec_sssub;
+        vece = op - 0x1e8;
+        break;
+    case 0x1d8 ... 0x1d9: /* vpsubusb, vpsubusw */
+        fn = tcg_gen_gvec_ussub;
+        vece = op - 0x1d8;
+        break;
+    case 0x1da: /* vpminub */
+        fn = tcg_gen_gvec_umin;
+        vece = MO_8;
+        break;
+    case 0x1de: /* vpmaxub */
+        fn = tcg_gen_gvec_umax;
+        vece = MO_8;
+        break;
+    case 0x1ea: /* vpminsw */
+        fn = tcg_gen_gvec_smin;
+        vece = MO_16;
+        break;
+    case 0x1ee: /* vpmaxsw */
+        fn = tcg_gen_gvec_smax;
+        vece = MO_16;
+        break;
+    case 0x238: /* vpminsb */
+    case 0x239: /* vpminsd */
+        fn = tcg_gen_gvec_smin;
+        vece = op == 0x238 ? MO_8 : MO_32;
+        break;
+    case 0x23a: /* vpminuw */
+    case 0x23b: /* vpminud */
+        fn = tcg_gen_gvec_umin;
+        vece = op == 0x23a ? MO_16 : MO_32;
+        break;
+    case 0x23c: /* vpmaxsb */
+    case 0x23d: /* vpmaxsd */
+        fn = tcg_gen_gvec_smax;
+        vece = op == 0x23c ? MO_8 : MO_32;
+        break;
+    case 0x23e: /* vpmaxuw */
+    case 0x23f: /* vpmaxud */
+        fn = tcg_gen_gvec_umax;
+        vece = op == 0x23e ? MO_16 : MO_32;
+        break;
+    case 0x1d5: /* vpmullw */
+        fn = tcg_gen_gvec_mul;
+        vece = MO_16;
+        break;
+    case 0x240: /* vpmulld */
+        fn = tcg_gen_gvec_mul;
+        vece = MO_32;
+        break;
+    case 0x21c ... 0x21e: /* vpabsb, vpabsw, vpabsd */
+        tcg_gen_gvec_abs(op - 0x21c, d, b, oprsz, VEX_MAXSZ);
+        return true;
+    case 0x174 ... 0x176: /* vpcmpeqb, vpcmpeqw, vpcmpeqd */
+        cond = TCG_COND_EQ;
+        vece = op - 0x174;
+        goto do_cmp;
+    case 0x229: /* vpcmpeqq */
+        cond = TCG_COND_EQ;
+        vece = MO_64;
+        goto do_cmp;
+    case 0x164 ... 0x166: /* vpcmpgtb, vpcmpgtw, vpcmpgtd */
+        cond = TCG_COND_GT;
+        vece = op - 0x164;
+        goto do_cmp;
+    case 0x237: /* vpcmpgtq */
+        cond = TCG_COND_GT;
+        vece = MO_64;
+    do_cmp:
+        tcg_gen_gvec_cmp(cond, vece, d, a, b, oprsz, VEX_MAXSZ);
+        return true;
+    default:
+        return false;
+    }
+    fn(vece, d, a, b, oprsz, VEX_MAXSZ);
+    return true;
+}
+
+/*
+ * Translate an instruction without a VEX.vvvv operand through gen_sse,
+ * which decodes the ModRM byte again.  If it writes the xmm register
+ * @dst, clear the rest of that register.
+ */
+static void gen_vex_legacy(CPUX86State *env, DisasContext *s, int b,
+                           target_ulong pc_start, int rex_r, int dst)
+{
+    s->pc -= (b == 0x138 || b == 0x13a) ? 2 : 1;
+    s->prefix &= ~PREFIX_VEX;
+    gen_sse(env, s, b, pc_start, rex_r);
+    s->prefix |= PREFIX_VEX;
+    if (dst >= 0) {
+        gen_vex_clear_upper(vex_reg_offset(dst), 16);
+    }
+}
+
+/*
+ * Translate the VEX instruction with 0f-map opcode @b, or 0x138/0x13a
+ * for the 0f 38 and 0f 3a maps.  Return false, without consuming
+ * anything, for the BMI instructions that gen_sse decodes.
+ */
+static bool gen_vex(CPUX86State *env, DisasContext *s, int b,
+                    target_ulong pc_start, int rex_r)
+{
+    int b1, op, modrm, mod, reg, rm, vvvv, val, oprsz, size, n, i;
+    int d, a, bo, lane1_shift;
+    bool two_op, scalar, lane0, widen, narrow;
+    SSEFunc_0_epp sse_fn_epp = NULL;
+    SSEFunc_0_eppi sse_fn_eppi = NULL;
+    SSEFunc_0_ppi sse_fn_ppi;
+    uint32_t ext_mask;
+    MemOp ot, vece;
+    TCGv_i64 t;
+
+    if (s->prefix & PREFIX_DATA) {
+        b1 = 1;
+    } else if (s->prefix & PREFIX_REPZ) {
+        b1 = 2;
+    } else if (s->prefix & PREFIX_REPNZ) {
+        b1 = 3;
+    } else {
+        b1 = 0;
+    }
+
+    op = b;
+    if (b == 0x138 || b == 0x13a) {
+        op = x86_ldub_code(env, s);
+        if (op >= 0xf0 && (b == 0x138 || op == 0xf0)) {
+            /* BMI and BMI2 */
+            s->pc--;
+            return false;
+        }
+        op |= b == 0x138 ? 0x200 : 0x300;
+    }
+
+    if (!(s->flags & HF_AVX_EN_MASK)) {
+        goto illegal_op;
+    }
+    if (s->flags & HF_TS_MASK) {
+        gen_exception(s, EXCP07_PREX, pc_start - s->cs_base);
+        return true;
+    }
+
+    oprsz = 16 << s->vex_l;
+    if (op == 0x177) {
+        /* vzeroupper, vzeroall */
+        if (b1 || s->vex_v) {
+            goto illegal_op;
+        }
+        for (i = 0; i < (CODE64(s) ? 16 : 8); i++) {
+            if (s->vex_l) {
+                tcg_gen_gvec_dup_imm(MO_64, vex_reg_offset(i),
+                                     VEX_MAXSZ, VEX_MAXSZ, 0);
+            } else {
+                gen_vex_clear_upper(vex_reg_offset(i), 16);
+            }
+        }
+        return true;
+    }
+
+    modrm = x86_ldub_code(env, s);
+    mod = (modrm >> 6) & 3;
+    reg = ((modrm >> 3) & 7) | rex_r;
+    rm = (modrm & 7) | REX_B(s);
+    vvvv = CODE64(s) ? s->vex_v : s->vex_v & 7;
+    d = vex_reg_offset(reg);
+    a = vex_reg_offset(vvvv);
+    if (op >= 0x300) {
+        s->rip_offset = 1;
+    }
+
+    switch (op) {
+    case 0x110: /* vmovups, vmovupd, vmovss, vmovsd */
+    case 0x111:
+        if (b1 < 2) {
+            if (s->vex_v) {
+                goto illegal_op;
+            }
+            gen_vex_mov(env, s, modrm, d, oprsz, op == 0x111);
+            break;
+        }
+        size = b1 == 2 ? 4 : 8;
+        if (mod != 3) {
+            if (s->vex_v) {
+                goto illegal_op;
+            }
+            gen_lea_modrm(env, s, modrm);
+            if (op == 0x110) {
+                tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index,
+                                    size == 4 ? MO_LEUL : MO_LEQ);
+                tcg_gen_st_i64(s->tmp1_i64, cpu_env,
+                               d + offsetof(ZMMReg, ZMM_Q(0)));
+                gen_vex_clear_upper(d, 8);
+            } else if (size == 4) {
+                tcg_gen_ld_i32(s->tmp2_i32, cpu_env,
+                               d + offsetof(ZMMReg, ZMM_L(0)));
+                tcg_gen_qemu_st_i32(s->tmp2_i32, s->A0, s->mem_index,
+                                    MO_LEUL);
+            } else {
+                gen_stq_env_A0(s, d + offsetof(ZMMReg, ZMM_Q(0)));
+            }
+        } else {
+            /* The low element of one register merged into another. */
+            int dst = op == 0x110 ? d : vex_reg_offset(rm);
+            int src = op == 0x110 ? vex_reg_offset(rm) : d;
+
+            if (size == 4) {
+                tcg_gen_ld_i32(s->tmp2_i32, cpu_env,
+                               src + offsetof(ZMMReg, ZMM_L(0)));
+            } else {
+                tcg_gen_ld_i64(s->tmp1_i64, cpu_env,
+                               src + offsetof(ZMMReg, ZMM_Q(0)));
+            }
+            if (dst != a) {
+                tcg_gen_gvec_mov(MO_64, dst, a, 16, 16);
+            }
+            if (size == 4) {
+                tcg_gen_st_i32(s->tmp2_i32, cpu_env,
+                               dst + offsetof(ZMMReg, ZMM_L(0)));
+            } else {
+                tcg_gen_st_i64(s->tmp1_i64, cpu_env,
+                               dst + offsetof(ZMMReg, ZMM_Q(0)));
+            }
+            gen_vex_clear_upper(dst, 16);
+        }
+        break;
+    case 0x112: /* vmovlps, vmovlpd, vmovhlps, vmovsldup, vmovddup */
+    case 0x116: /* vmovhps, vmovhpd, vmovlhps, vmovshdup */
+        if (b1 < 2) {
+            bool hi = op == 0x116;
+
+            if (s->vex_l || (b1 == 1 && mod == 3)) {
+                goto illegal_op;
+            }
+            if (mod == 3) {
+                /* vmovhlps takes the high half of the source, vmovlhps
+                   the low half.  */
+                tcg_gen_ld_i64(s->tmp1_i64, cpu_env,
+                               vex_reg_offset(rm) + offsetof(ZMMReg,
+                                                             ZMM_Q(!hi)));
+            } else {
+                gen_lea_modrm(env, s, modrm);
+                tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index,
+                                    MO_LEQ);
+            }
+            t = tcg_temp_new_i64();
+            tcg_gen_ld_i64(t, cpu_env, a + offsetof(ZMMReg, ZMM_Q(!hi)));
+            tcg_gen_st_i64(t, cpu_env, d + offsetof(ZMMReg, ZMM_Q(!hi)));
+            tcg_gen_st_i64(s->tmp1_i64, cpu_env,
+                           d + offsetof(ZMMReg, ZMM_Q(hi)));
+            tcg_temp_free_i64(t);
+            gen_vex_clear_upper(d, 16);
+        } else if (b1 == 2) {
+            /* vmovsldup, vmovshdup */
+            if (s->vex_v) {
+                goto illegal_op;
+            }
+            bo = gen_vex_ld_modrm(env, s, modrm, oprsz);
+            for (i = 0; i < oprsz / 4; i += 2) {
+                tcg_gen_ld_i32(s->tmp2_i32, cpu_env,
+                               bo + offsetof(ZMMReg,
+                                             ZMM_L(i + (op == 0x116))));
+                tcg_gen_st_i32(s->tmp2_i32, cpu_env,
+                               d + offsetof(ZMMReg, ZMM_L(i)));
+                tcg_gen_st_i32(s->tmp2_i32, cpu_env,
+                               d + offsetof(ZMMReg, ZMM_L(i + 1)));
+            }
+            gen_vex_clear_upper(d, oprsz);
+        } else if (op == 0x112) {
+            /* vmovddup */
+            if (s->vex_v) {
+                goto illegal_op;
+            }
+            bo = gen_vex_ld_modrm(env, s, modrm, s->vex_l ? 32 : 8);
+            for (i = 0; i < oprsz / 8; i += 2) {
+                tcg_gen_ld_i64(s->tmp1_i64, cpu_env,
+                               bo + offsetof(ZMMReg, ZMM_Q(i)));
+                tcg_gen_st_i64(s->tmp1_i64, cpu_env,
+                               d + offsetof(ZMMReg, ZMM_Q(i)));
+                tcg_gen_st_i64(s->tmp1_i64, cpu_env,
+                               d + offsetof(ZMMReg, ZMM_Q(i + 1)));
+            }
+            gen_vex_clear_upper(d, oprsz);
+        } else {
+            goto illegal_op;
+        }
+        break;
+    case 0x113: /* vmovlps, vmovlpd */
+    case 0x117: /* vmovhps, vmovhpd */
+        if (b1 >= 2 || mod == 3 || s->vex_v || s->vex_l) {
+            goto illegal_op;
+        }
+        gen_lea_modrm(env, s, modrm);
+        gen_stq_env_A0(s, d + offsetof(ZMMReg, ZMM_Q(op == 0x117)));
+        break;
+    case 0x128: /* vmovaps, vmovapd */
+    case 0x129:
+        if (b1 >= 2 || s->vex_v) {
+            goto illegal_op;
+        }
+        gen_vex_mov(env, s, modrm, d, oprsz, op == 0x129);
+        break;
+    case 0x12a: /* vcvtsi2ss, vcvtsi2sd */
+        if (b1 < 2) {
+            goto illegal_op;
+        }
+        ot = mo_64_32(s->dflag);
+        gen_ldst_modrm(env, s, modrm, ot, OR_TMP0, 0);
+        if (d != a) {
+            tcg_gen_gvec_mov(MO_64, d, a, 16, 16);
+        }
+        tcg_gen_addi_ptr(s->ptr0, cpu_env, d);
+        if (ot == MO_32) {
+            SSEFunc_0_epi sse_fn_epi = sse_op_table3ai[b1 & 1];
+            tcg_gen_trunc_tl_i32(s->tmp2_i32, s->T0);
+            sse_fn_epi(cpu_env, s->ptr0, s->tmp2_i32);
+        } else {
+#ifdef TARGET_X86_64
+            SSEFunc_0_epl sse_fn_epl = sse_op_table3aq[b1 & 1];
+            sse_fn_epl(cpu_env, s->ptr0, s->T0);
+#else
+            goto illegal_op;
+#endif
+        }
+        gen_vex_clear_upper(d, 16);
+        break;
+    case 0x12b: /* vmovntps, vmovntpd */
+        if (b1 >= 2 || mod == 3 || s->vex_v) {
+            goto illegal_op;
+        }
+        gen_vex_mov(env, s, modrm, d, oprsz, true);
+        break;
+    case 0x12c: /* vcvttss2si, vcvttsd2si */
+    case 0x12d: /* vcvtss2si, vcvtsd2si */
+        if (b1 < 2 || s->vex_v) {
+            goto illegal_op;
+        }
+        gen_vex_legacy(env, s, b, pc_start, rex_r, -1);
+        break;
+    case 0x12e: /* vucomiss, vucomisd */
+    case 0x12f: /* vcomiss, vcomisd */
+        if (b1 >= 2 || s->vex_v) {
+            goto illegal_op;
+        }
+        gen_vex_legacy(env, s, b, pc_start, rex_r, -1);
+        break;
+    case 0x150: /* vmovmskps, vmovmskpd */
+        if (b1 >= 2 || mod != 3 || s->vex_v) {
+            goto illegal_op;
+        }
+        gen_vex_movmsk(s, b1 ? gen_helper_movmskpd : gen_helper_movmskps,
+                       reg, vex_reg_offset(rm), oprsz, b1 ? 2 : 4);
+        break;
+    case 0x1d7: /* vpmovmskb */
+        if (b1 != 1 || mod != 3 || s->vex_v || !vex_avx2_ok(s)) {
+            goto illegal_op;
+        }
+        gen_vex_movmsk(s, gen_helper_pmovmskb_xmm, reg, vex_reg_offset(rm),
+                       oprsz, 16);
+        break;
+    case 0x16e: /* vmovd, vmovq xmm, r/m */
+        if (b1 != 1 || s->vex_v || s->vex_l) {
+            goto illegal_op;
+        }
+        gen_vex_legacy(env, s, b, pc_start, rex_r, reg);
+        break;
+    case 0x17e:
+        if (s->vex_v || s->vex_l) {
+            goto illegal_op;
+        }
+        if (b1 == 1) {
+            /* vmovd, vmovq r/m, xmm */
+            gen_vex_legacy(env, s, b, pc_start, rex_r, -1);
+        } else if (b1 == 2) {
+            /* vmovq xmm, xmm/m64 */
+            gen_vex_legacy(env, s, b, pc_start, rex_r, reg);
+        } else {
+            goto illegal_op;
+        }
+        break;
+    case 0x1d6: /* vmovq xmm/m64, xmm */
+        if (b1 != 1 || s->vex_v || s->vex_l) {
+            goto illegal_op;
+        }
+        gen_vex_legacy(env, s, b, pc_start, rex_r, mod == 3 ? rm : -1);
+        break;
+    case 0x16f: /* vmovdqa, vmovdqu */
+    case 0x17f:
+        if (b1 == 0 || b1 == 3 || s->vex_v) {
+            goto illegal_op;
+        }
+        gen_vex_mov(env, s, modrm, d, oprsz, op == 0x17f);
+        break;
+    case 0x1e7: /* vmovntdq */
+        if (b1 != 1 || mod == 3 || s->vex_v) {
+            goto illegal_op;
+        }
+        gen_vex_mov(env, s, modrm, d, oprsz, true);
+        break;
+    case 0x1f0: /* vlddqu */
+        if (b1 != 3 || mod == 3 || s->vex_v) {
+            goto illegal_op;
+        }
+        gen_vex_mov(env, s, modrm, d, oprsz, false);
+        break;
+    case 0x22a: /* vmovntdqa */
+        if (b1 != 1 || mod == 3 || s->vex_v || !vex_avx2_ok(s)) {
+            goto illegal_op;
+        }
+        gen_vex_mov(env, s, modrm, d, oprsz, false);
+        break;
+    case 0x1c5: /* vpextrw */
+    case 0x1f7: /* vmaskmovdqu */
+        if (b1 != 1 || mod != 3 || s->vex_v || s->vex_l) {
+            goto illegal_op;
+        }
+        gen_vex_legacy(env, s, b, pc_start, rex_r, -1);
+        break;
+    case 0x314 ... 0x317: /* vpextrb, vpextrw, vpextrd/q, vextractps */
+        if (b1 != 1 || s->vex_v || s->vex_l) {
+            goto illegal_op;
+        }
+        gen_vex_legacy(env, s, b, pc_start, rex_r, -1);
+        break;
+    case 0x360 ... 0x363: /* vpcmpestrm, vpcmpestri, vpcmpistrm, vpcmpistri */
+        if (b1 != 1 || s->vex_v || s->vex_l
+            || !(s->cpuid_ext_features & CPUID_EXT_SSE42)) {
+            goto illegal_op;
+        }
+        /* the mask forms write xmm0 */
+        gen_vex_legacy(env, s, b, pc_start, rex_r, op & 1 ? -1 : 0);
+        break;
+
+    case 0x170: /* vpshufd, vpshufhw, vpshuflw */
+        if (b1 == 0 || s->vex_v || !vex_avx2_ok(s)) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bo = gen_vex_ld_modrm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        sse_fn_ppi = (SSEFunc_0_ppi)sse_op_table1[0x70][b1];
+        for (i = 0; i < oprsz; i += 16) {
+            tcg_gen_addi_ptr(s->ptr0, cpu_env, d + i);
+            tcg_gen_addi_ptr(s->ptr1, cpu_env, bo + i);
+            sse_fn_ppi(s->ptr0, s->ptr1, tcg_const_i32(val));
+        }
+        gen_vex_clear_upper(d, oprsz);
+        break;
+    case 0x304: /* vpermilps with an immediate */
+        if (b1 != 1 || s->vex_v) {
+            goto illegal_op;
+        }
+        bo = gen_vex_ld_modrm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        for (i = 0; i < oprsz; i += 16) {
+            tcg_gen_addi_ptr(s->ptr0, cpu_env, d + i);
+            tcg_gen_addi_ptr(s->ptr1, cpu_env, bo + i);
+            gen_helper_pshufd_xmm(s->ptr0, s->ptr1, tcg_const_i32(val));
+        }
+        gen_vex_clear_upper(d, oprsz);
+        break;
+    case 0x305: /* vpermilpd with an immediate */
+    case 0x300: /* vpermq */
+    case 0x301: /* vpermpd */
+        if (b1 != 1 || s->vex_v) {
+            goto illegal_op;
+        }
+        if (op != 0x305 && (!s->vex_l || !vex_avx2_ok(s))) {
+            goto illegal_op;
+        }
+        bo = gen_vex_ld_modrm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        /* Gather the result in the top of xmm_t0, bo may be its low half */
+        for (i = 0; i < oprsz / 8; i++) {
+            if (op == 0x305) {
+                n = (i & ~1) | ((val >> i) & 1);
+            } else {
+                n = (val >> (2 * i)) & 3;
+            }
+            tcg_gen_ld_i64(s->tmp1_i64, cpu_env,
+                           bo + offsetof(ZMMReg, ZMM_Q(n)));
+            tcg_gen_st_i64(s->tmp1_i64, cpu_env,
+                           VEX_T0 + 32 + offsetof(ZMMReg, ZMM_Q(i)));
+        }
+        tcg_gen_gvec_mov(MO_64, d, VEX_T0 + 32, oprsz, VEX_MAXSZ);
+        break;
+    case 0x302: /* vpblendd */
+        if (b1 != 1 || !(s->cpuid_7_0_ebx_features & CPUID_7_0_EBX_AVX2)) {
+            goto illegal_op;
+        }
+        bo = gen_vex_ld_modrm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        for (i = 0; i < oprsz / 4; i++) {
+            int src = (val >> i) & 1 ? bo : a;
+
+            if (src != d) {
+                tcg_gen_ld_i32(s->tmp2_i32, cpu_env,
+                               src + offsetof(ZMMReg, ZMM_L(i)));
+                tcg_gen_st_i32(s->tmp2_i32, cpu_env,
+                               d + offsetof(ZMMReg, ZMM_L(i)));
+            }
+        }
+        gen_vex_clear_upper(d, oprsz);
+        break;
+    case 0x306: /* vperm2f128 */
+    case 0x346: /* vperm2i128 */
+        if (b1 != 1 || !s->vex_l || (op == 0x346 && !vex_avx2_ok(s))) {
+            goto illegal_op;
+        }
+        bo = gen_vex_ld_modrm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        for (i = 0; i < 2; i++) {
+            int sel = (val >> (4 * i)) & 0xf;
+
+            if (sel & 8) {
+                tcg_gen_gvec_dup_imm(MO_64, VEX_T0 + 32 + 16 * i, 16, 16, 0);
+            } else {
+                tcg_gen_gvec_mov(MO_64, VEX_T0 + 32 + 16 * i,
+                                 (sel & 2 ? bo : a) + 16 * (sel & 1), 16, 16);
+            }
+        }
+        tcg_gen_gvec_mov(MO_64, d, VEX_T0 + 32, 32, VEX_MAXSZ);
+        break;
+    case 0x318: /* vinsertf128 */
+    case 0x338: /* vinserti128 */
+        if (b1 != 1 || !s->vex_l || (op == 0x338 && !vex_avx2_ok(s))) {
+            goto illegal_op;
+        }
+        bo = gen_vex_ld_modrm(env, s, modrm, 16);
+        val = x86_ldub_code(env, s) & 1;
+        if (bo == d && d != a) {
+            tcg_gen_gvec_mov(MO_64, VEX_T0, bo, 16, 16);
+            bo = VEX_T0;
+        }
+        if (d != a) {
+            tcg_gen_gvec_mov(MO_64, d + 16 * !val, a + 16 * !val, 16, 16);
+        }
+        tcg_gen_gvec_mov(MO_64, d + 16 * val, bo, 16, 16);
+        gen_vex_clear_upper(d, 32);
+        break;
+    case 0x319: /* vextractf128 */
+    case 0x339: /* vextracti128 */
+        if (b1 != 1 || !s->vex_l || s->vex_v
+            || (op == 0x339 && !vex_avx2_ok(s))) {
+            goto illegal_op;
+        }
+        if (mod == 3) {
+            val = x86_ldub_code(env, s) & 1;
+            tcg_gen_gvec_mov(MO_64, vex_reg_offset(rm), d + 16 * val,
+                             16, VEX_MAXSZ);
+        } else {
+            gen_lea_modrm(env, s, modrm);
+            val = x86_ldub_code(env, s) & 1;
+            gen_sto_env_A0(s, d + 16 * val);
+        }
+        break;
+    case 0x34a: /* vblendvps */
+    case 0x34b: /* vblendvpd */
+    case 0x34c: /* vpblendvb */
+        if (b1 != 1 || (op == 0x34c && !vex_avx2_ok(s))) {
+            goto illegal_op;
+        }
+        bo = gen_vex_ld_modrm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s) >> 4;
+        if (!CODE64(s)) {
+            val &= 7;
+        }
+        vece = op == 0x34a ? MO_32 : op == 0x34b ? MO_64 : MO_8;
+        /* Spread the sign bits of the mask register over their elements. */
+        tcg_gen_gvec_sari(vece, VEX_T0 + 32, vex_reg_offset(val),
+                          (8 << vece) - 1, oprsz, oprsz);
+        tcg_gen_gvec_bitsel(MO_64, d, VEX_T0 + 32, bo, a, oprsz, VEX_MAXSZ);
+        break;
+
+    case 0x1c4: /* vpinsrw */
+    case 0x320: /* vpinsrb */
+    case 0x322: /* vpinsrd, vpinsrq */
+        if (b1 != 1 || s->vex_l) {
+            goto illegal_op;
+        }
+        ot = op == 0x1c4 ? MO_16 : op == 0x320 ? MO_8 : mo_64_32(s->dflag);
+        s->rip_offset = 1;
+        if (mod == 3) {
+            tcg_gen_extu_tl_i64(s->tmp1_i64, cpu_regs[rm]);
+        } else {
+            gen_lea_modrm(env, s, modrm);
+            tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, ot | MO_LE);
+        }
+        val = x86_ldub_code(env, s);
+        if (d != a) {
+            tcg_gen_gvec_mov(MO_64, d, a, 16, 16);
+        }
+        switch (ot) {
+        case MO_8:
+            tcg_gen_st8_i64(s->tmp1_i64, cpu_env,
+                            d + offsetof(ZMMReg, ZMM_B(val & 15)));
+            break;
+        case MO_16:
+            tcg_gen_st16_i64(s->tmp1_i64, cpu_env,
+                             d + offsetof(ZMMReg, ZMM_W(val & 7)));
+            break;
+        case MO_32:
+            tcg_gen_st32_i64(s->tmp1_i64, cpu_env,
+                             d + offsetof(ZMMReg, ZMM_L(val & 3)));
+            break;
+        default:
+            tcg_gen_st_i64(s->tmp1_i64, cpu_env,
+                           d + offsetof(ZMMReg, ZMM_Q(val & 1)));
+            break;
+        }
+        gen_vex_clear_upper(d, 16);
+        break;
+    case 0x321: /* vinsertps */
+        if (b1 != 1 || s->vex_l) {
+            goto illegal_op;
+        }
+        if (mod == 3) {
+            val = x86_ldub_code(env, s);
+            tcg_gen_ld_i32(s->tmp2_i32, cpu_env,
+                           vex_reg_offset(rm) +
+                           offsetof(ZMMReg, ZMM_L((val >> 6) & 3)));
+        } else {
+            gen_lea_modrm(env, s, modrm);
+            tcg_gen_qemu_ld_i32(s->tmp2_i32, s->A0, s->mem_index, MO_LEUL);
+            val = x86_ldub_code(env, s);
+        }
+        if (d != a) {
+            tcg_gen_gvec_mov(MO_64, d, a, 16, 16);
+        }
+        tcg_gen_st_i32(s->tmp2_i32, cpu_env,
+                       d + offsetof(ZMMReg, ZMM_L((val >> 4) & 3)));
+        for (i = 0; i < 4; i++) {
+            if ((val >> i) & 1) {
+                tcg_gen_st_i32(tcg_const_i32(0 /*float32_zero*/), cpu_env,
+                               d + offsetof(ZMMReg, ZMM_L(i)));
+            }
+        }
+        gen_vex_clear_upper(d, 16);
+        break;
+
+    case 0x171 ... 0x173: /* shifts by an immediate */
+        if (b1 != 1 || mod != 3 || !vex_avx2_ok(s)) {
+            goto illegal_op;
+        }
+        val = x86_ldub_code(env, s);
+        vece = op - 0x170;
+        /* the destination is in VEX.vvvv, the source in ModRM.rm */
+        d = a;
+        bo = vex_reg_offset(rm);
+        switch (((modrm >> 3) & 7) | ((op == 0x173) << 3)) {
+        case 2: /* vpsrlw, vpsrld */
+        case 2 | 8: /* vpsrlq */
+            if (val >= (8 << vece)) {
+                tcg_gen_gvec_dup_imm(MO_64, d, oprsz, VEX_MAXSZ, 0);
+            } else {
+                tcg_gen_gvec_shri(vece, d, bo, val, oprsz, VEX_MAXSZ);
+            }
+            break;
+        case 4: /* vpsraw, vpsrad */
+            tcg_gen_gvec_sari(vece, d, bo, MIN(val, (8 << vece) - 1),
+                              oprsz, VEX_MAXSZ);
+            break;
+        case 6: /* vpsllw, vpslld */
+        case 6 | 8: /* vpsllq */
+            if (val >= (8 << vece)) {
+                tcg_gen_gvec_dup_imm(MO_64, d, oprsz, VEX_MAXSZ, 0);
+            } else {
+                tcg_gen_gvec_shli(vece, d, bo, val, oprsz, VEX_MAXSZ);
+            }
+            break;
+        case 3 | 8: /* vpsrldq */
+        case 7 | 8: /* vpslldq */
+            tcg_gen_movi_i32(s->tmp2_i32, val);
+            tcg_gen_st_i32(s->tmp2_i32, cpu_env,
+                           VEX_T0 + offsetof(ZMMReg, ZMM_L(0)));
+            tcg_gen_movi_i32(s->tmp2_i32, 0);
+            tcg_gen_st_i32(s->tmp2_i32, cpu_env,
+                           VEX_T0 + offsetof(ZMMReg, ZMM_L(1)));
+            if (d != bo) {
+                tcg_gen_gvec_mov(MO_64, d, bo, oprsz, oprsz);
+            }
+            for (i = 0; i < oprsz; i += 16) {
+                tcg_gen_addi_ptr(s->ptr0, cpu_env, d + i);
+                tcg_gen_addi_ptr(s->ptr1, cpu_env, VEX_T0);
+                if (modrm & 0x20) {
+                    gen_helper_pslldq_xmm(cpu_env, s->ptr0, s->ptr1);
+                } else {
+                    gen_helper_psrldq_xmm(cpu_env, s->ptr0, s->ptr1);
+                }
+            }
+            gen_vex_clear_upper(d, oprsz);
+            break;
+        default:
+            goto unknown_op;
+        }
+        break;
+
+    case 0x1c2: /* vcmpps, vcmppd, vcmpss, vcmpsd */
+        scalar = b1 >= 2;
+        s->rip_offset = 1;
+        bo = gen_vex_ld_modrm(env, s, modrm,
+                              scalar ? (b1 == 2 ? 4 : 8) : oprsz);
+        val = x86_ldub_code(env, s);
+        n = scalar ? 16 : oprsz;
+        switch (val) {
+        case 0 ... 7:
+            bo = gen_vex_copy_src1(d, a, bo, n);
+            break;
+        case 0x09: /* nge_us is nle with the operands swapped */
+        case 0x0a: /* ngt_us is nlt */
+        case 0x0d: /* ge_os is le */
+        case 0x0e: /* gt_os is lt */
+            if (scalar) {
+                goto unknown_op;
+            }
+            val = val == 0x09 ? 6 : val == 0x0a ? 5 : val == 0x0d ? 2 : 1;
+            bo = gen_vex_copy_src1(d, bo, a, n);
+            break;
+        default:
+            goto unknown_op;
+        }
+        sse_fn_epp = sse_op_table4[val][b1];
+        for (i = 0; i < n; i += 16) {
+            tcg_gen_addi_ptr(s->ptr0, cpu_env, d + i);
+            tcg_gen_addi_ptr(s->ptr1, cpu_env, bo + i);
+            sse_fn_epp(cpu_env, s->ptr0, s->ptr1);
+        }
+        gen_vex_clear_upper(d, n);
+        break;
+    case 0x1c6: /* vshufps, vshufpd */
+        if (b1 >= 2) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bo = gen_vex_ld_modrm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        bo = gen_vex_copy_src1(d, a, bo, oprsz);
+        sse_fn_ppi = (SSEFunc_0_ppi)sse_op_table1[0xc6][b1];
+        for (i = 0; i < oprsz; i += 16) {
+            tcg_gen_addi_ptr(s->ptr0, cpu_env, d + i);
+            tcg_gen_addi_ptr(s->ptr1, cpu_env, bo + i);
+            /* vshufpd has two selector bits per lane */
+            sse_fn_ppi(s->ptr0, s->ptr1,
+                       tcg_const_i32(b1 && i ? val >> 2 : val));
+        }
+        gen_vex_clear_upper(d, oprsz);
+        break;
+
+    case 0x217: /* vptest */
+        if (b1 != 1 || s->vex_v) {
+            goto illegal_op;
+        }
+        bo = gen_vex_ld_modrm(env, s, modrm, oprsz);
+        {
+            TCGv_i64 zf = tcg_temp_new_i64();
+            TCGv_i64 cf = tcg_temp_new_i64();
+
+            t = tcg_temp_new_i64();
+            tcg_gen_movi_i64(zf, 0);
+            tcg_gen_movi_i64(cf, 0);
+            for (i = 0; i < oprsz; i += 8) {
+                tcg_gen_ld_i64(s->tmp1_i64, cpu_env, d + i);
+                tcg_gen_ld_i64(t, cpu_env, bo + i);
+                tcg_gen_andc_i64(s->tmp1_i64, t, s->tmp1_i64);
+                tcg_gen_or_i64(cf, cf, s->tmp1_i64);
+                tcg_gen_ld_i64(s->tmp1_i64, cpu_env, d + i);
+                tcg_gen_and_i64(s->tmp1_i64, t, s->tmp1_i64);
+                tcg_gen_or_i64(zf, zf, s->tmp1_i64);
+            }
+            tcg_gen_setcondi_i64(TCG_COND_EQ, zf, zf, 0);
+            tcg_gen_setcondi_i64(TCG_COND_EQ, cf, cf, 0);
+            tcg_gen_shli_i64(zf, zf, ctz32(CC_Z));
+            tcg_gen_or_i64(zf, zf, cf);
+            tcg_gen_trunc_i64_tl(cpu_cc_src, zf);
+            tcg_temp_free_i64(t);
+            tcg_temp_free_i64(cf);
+            tcg_temp_free_i64(zf);
+        }
+        set_cc_op(s, CC_OP_EFLAGS);
+        break;
+    case 0x218: /* vbroadcastss */
+    case 0x219: /* vbroadcastsd */
+    case 0x258: /* vpbroadcastd */
+    case 0x259: /* vpbroadcastq */
+    case 0x278: /* vpbroadcastb */
+    case 0x279: /* vpbroadcastw */
+        if (b1 != 1 || s->vex_v || (op == 0x219 && !s->vex_l)) {
+            goto illegal_op;
+        }
+        if ((op >= 0x258 || mod == 3)
+            && !(s->cpuid_7_0_ebx_features & CPUID_7_0_EBX_AVX2)) {
+            goto illegal_op;
+        }
+        switch (op) {
+        case 0x278:
+            vece = MO_8;
+            break;
+        case 0x279:
+            vece = MO_16;
+            break;
+        default:
+            vece = op & 1 ? MO_64 : MO_32;
+            break;
+        }
+        if (mod == 3) {
+            tcg_gen_gvec_dup_mem(vece, d, vex_reg_offset(rm),
+                                 oprsz, VEX_MAXSZ);
+        } else {
+            gen_lea_modrm(env, s, modrm);
+            tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index,
+                                vece | MO_LE);
+            tcg_gen_gvec_dup_i64(vece, d, oprsz, VEX_MAXSZ, s->tmp1_i64);
+        }
+        break;
+    case 0x21a: /* vbroadcastf128 */
+    case 0x25a: /* vbroadcasti128 */
+        if (b1 != 1 || s->vex_v || !s->vex_l || mod == 3
+            || (op == 0x25a && !vex_avx2_ok(s))) {
+            goto illegal_op;
+        }
+        gen_lea_modrm(env, s, modrm);
+        gen_ldo_env_A0(s, d);
+        tcg_gen_gvec_mov(MO_64, d + 16, d, 16, 16);
+        gen_vex_clear_upper(d, 32);
+        break;
+
+    default:
+        /* The rest goes through the SSE helpers, one 128-bit lane at a time. */
+        two_op = false;
+        scalar = false;
+        lane0 = false;
+        widen = false;
+        narrow = false;
+        lane1_shift = 0;
+        size = oprsz;
+        switch (op) {
+        case 0x114 ... 0x115: /* vunpcklps/pd, vunpckhps/pd */
+        case 0x151 ... 0x15f:
+        case 0x17c ... 0x17d: /* vhaddps/pd, vhsubps/pd */
+        case 0x1d0: /* vaddsubps/pd */
+        case 0x1e6: /* vcvtdq2pd, vcvtpd2dq, vcvttpd2dq */
+            sse_fn_epp = sse_op_table1[op & 0xff][b1];
+            if (!sse_fn_epp) {
+                goto illegal_op;
+            }
+            if (op >= 0x151 && op <= 0x15f && op != 0x15b && b1 >= 2) {
+                scalar = true;
+                size = b1 == 2 ? 4 : 8;
+            }
+            two_op = (((op >= 0x151 && op <= 0x153) || op == 0x15a) && b1 < 2)
+                     || op == 0x15b || op == 0x1e6;
+            widen = (op == 0x15a && b1 == 0) || (op == 0x1e6 && b1 == 2);
+            narrow = (op == 0x15a && b1 == 1) || (op == 0x1e6 && b1 != 2);
+            if (widen) {
+                size = oprsz / 2;
+            }
+            break;
+        case 0x1d1 ... 0x1d3: /* vpsrlw, vpsrld, vpsrlq */
+        case 0x1e1 ... 0x1e2: /* vpsraw, vpsrad */
+        case 0x1f1 ... 0x1f3: /* vpsllw, vpslld, vpsllq */
+            /* every lane shifts by the count in the low quadword */
+            lane0 = true;
+            size = 16;
+            /* fall through */
+        case 0x160 ... 0x16d:
+        case 0x1d4 ... 0x1d5:
+        case 0x1d8 ... 0x1e0:
+        case 0x1e3 ... 0x1e5:
+        case 0x1e8 ... 0x1ef:
+        case 0x1f4 ... 0x1f6:
+        case 0x1f8 ... 0x1fe:
+            if (b1 != 1 || !vex_avx2_ok(s)) {
+                goto illegal_op;
+            }
+            sse_fn_epp = sse_op_table1[op & 0xff][b1];
+            break;
+        case 0x200 ... 0x20b:
+        case 0x21c ... 0x21e: /* vpabsb, vpabsw, vpabsd */
+        case 0x220 ... 0x225: /* vpmovsx */
+        case 0x228: /* vpmuldq */
+        case 0x229: /* vpcmpeqq */
+        case 0x22b: /* vpackusdw */
+        case 0x230 ... 0x235: /* vpmovzx */
+        case 0x237 ... 0x241:
+        case 0x2db ... 0x2df: /* vaesimc, vaesenc, ... */
+            if (b1 != 1 || !vex_avx2_ok(s)) {
+                goto illegal_op;
+            }
+            if (s->vex_l && (op == 0x241 || op >= 0x2db)) {
+                goto illegal_op;
+            }
+            sse_fn_epp = sse_op_table6[op & 0xff].op[1];
+            ext_mask = sse_op_table6[op & 0xff].ext_mask;
+            if (!(s->cpuid_ext_features & ext_mask)) {
+                goto illegal_op;
+            }
+            two_op = (op >= 0x21c && op <= 0x21e) || op == 0x241
+                     || op == 0x2db;
+            if ((op & ~0x10) >= 0x220 && (op & ~0x10) <= 0x225) {
+                /* vpmovsx, vpmovzx: 8, 4 or 2 source bytes per lane */
+                static const uint8_t pmov_bytes[] = { 8, 4, 2, 8, 4, 8 };
+
+                two_op = widen = true;
+                size = pmov_bytes[op & 7] << s->vex_l;
+            }
+            break;
+        case 0x308 ... 0x30f:
+        case 0x340 ... 0x342:
+        case 0x344:
+        case 0x3df:
+            if (b1 != 1) {
+                goto illegal_op;
+            }
+            if ((op == 0x30e || op == 0x30f || op == 0x342)
+                && !vex_avx2_ok(s)) {
+                goto illegal_op;
+            }
+            if (s->vex_l && (op == 0x341 || op == 0x344 || op == 0x3df)) {
+                goto illegal_op;
+            }
+            sse_fn_eppi = sse_op_table7[op & 0xff].op[1];
+            ext_mask = sse_op_table7[op & 0xff].ext_mask;
+            if (!(s->cpuid_ext_features & ext_mask)) {
+                goto illegal_op;
+            }
+            two_op = op == 0x308 || op == 0x309 || op == 0x3df;
+            if (op == 0x30a || op == 0x30b) {
+                scalar = true;
+                size = op == 0x30a ? 4 : 8;
+            }
+            /* the blends and vmpsadbw use other immediate bits for lane 1 */
+            switch (op) {
+            case 0x30c:
+                lane1_shift = 4;
+                break;
+            case 0x30d:
+                lane1_shift = 2;
+                break;
+            case 0x342:
+                lane1_shift = 3;
+                break;
+            }
+            break;
+        default:
+            goto unknown_op;
+        }
+        if (two_op && s->vex_v) {
+            goto illegal_op;
+        }
+
+        bo = gen_vex_ld_modrm(env, s, modrm, size);
+        val = op >= 0x300 ? x86_ldub_code(env, s) : 0;
+        n = scalar || (narrow && s->vex_l) ? 16 : oprsz;
+        if (!scalar && gen_vex_gvec(op, d, a, bo, oprsz)) {
+            break;
+        }
+        if (widen && s->vex_l) {
+            gen_vex_widen(s, sse_fn_epp, d, bo, size / 2);
+        } else if (narrow && s->vex_l) {
+            gen_vex_narrow(s, sse_fn_epp, d, bo);
+        } else {
+            if (!two_op) {
+                bo = gen_vex_copy_src1(d, a, bo, n);
+            }
+            for (i = 0; i < n; i += 16) {
+                tcg_gen_addi_ptr(s->ptr0, cpu_env, d + i);
+                tcg_gen_addi_ptr(s->ptr1, cpu_env, lane0 ? bo : bo + i);
+                if (sse_fn_eppi) {
+                    sse_fn_eppi(cpu_env, s->ptr0, s->ptr1,
+                                tcg_const_i32(i ? val >> lane1_shift : val));
+                } else {
+                    sse_fn_epp(cpu_env, s->ptr0, s->ptr1);
+                }
+            }
+        }
+        gen_vex_clear_upper(d, n);
+        break;
+    }
+    return true;
+
+ illegal_op:
+    gen_illegal_opcode(s);
+    return true;
+ unknown_op:
+    gen_unknown_opcode(env, s);
+    return true;
+}
+
+/* convert one instruction. s->base.is_jmp is set if the translation must
+   be stopped. Return the next pc value */
+static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
+{
+    CPUX86State *env = cpu->env_ptr;
+    int b, prefixes;
+    int shift;
+    MemOp ot, aflag, dflag;
+    int modrm, reg, rm, mod, op, opreg, val;
+    target_ulong next_eip, tval;
+    int rex_w, rex_r;
+    target_ulong pc_start = s->base.pc_next;
+
+    s->pc_start = s->pc = pc_start;
+    s->override = -1;
+#ifdef TARGET_X86_64
+    s->rex_x = 0;
+    s->rex_b = 0;
+    s->x86_64_hregs = false;
+#endif
+    s->rip_offset = 0; /* for relative ip address */
+    s->vex_l = 0;
+    s->vex_v = 0;
+    if (sigsetjmp(s->jmpbuf, 0) != 0) {
+        gen_exception(s, EXCP0D_GPF, pc_start - s->cs_base);
+        return s->pc;
+    }
+
+    prefixes = 0;
+    rex_w = -1;
+    rex_r = 0;
+
+ next_byte:
+    b = x86_ldub_code(env, s);
+    /* Collect prefixes.  */
+    switch (b) {
+    case 0xf3:
+        prefixes |= PREFIX_REPZ;
+        goto next_byte;
+    case 0xf2:
+        prefixes |= PREFIX_REPNZ;
+        goto next_byte;
+    case 0xf0:
+        prefixes |= PREFIX_LOCK;
+        goto next_byte;
+    case 0x2e:
+        s->override = R_CS;
+        goto next_byte;
+    case 0x36:
+        s->override = R_SS;
+        goto next_byte;
+    case 0x3e:
+        s->override = R_DS;
+        goto next_byte;
+    case 0x26:
+        s->override = R_ES;
+        goto next_byte;
+    case 0x64:
+        s->override = R_FS;
+        goto next_byte;
+    case 0x65:
+        s->override = R_GS;
+        goto next_byte;
+    case 0x66:
+        prefixes |= PREFIX_DATA;
+        goto next_byte;
+    case 0x67:
+        prefixes |= PREFIX_ADR;
+        goto next_byte;
+#ifdef TARGET_X86_64
+    case 0x40 ... 0x4f:
+        if (CODE64(s)) {
+            /* REX prefix */
+            rex_w = (b >> 3) & 1;
+            rex_r = (b & 0x4) << 1;
+            s->rex_x = (b & 0x2) << 2;
+            REX_B(s) = (b & 0x1) << 3;
+            /* select uniform byte register addressing */
+            s->x86_64_hregs = true;
+            goto next_byte;
+        }
+        break;
+#endif
+    case 0xc5: /* 2-byte VEX */
+    case 0xc4: /* 3-byte VEX */
+        /* VEX prefixes cannot be used except in 32-bit mode.
+           Otherwise the instruction is LES or LDS.  */
+        if (s->code32 && !s->vm86) {
+            static const int pp_prefix[4] = {
+                0, PREFIX_DATA, PREFIX_REPZ, PREFIX_REPNZ
+            };
+            int vex3, vex2 = x86_ldub_code(env, s);
+
+            if (!CODE64(s) && (vex2 & 0xc0) != 0xc0) {
+                /* 4.1.4.6: In 32-bit mode, bits [7:6] must be 11b,
+                   otherwise the instruction is LES or LDS.  */
+                s->pc--; /* rewind the advance_pc() x86_ldub_code() did */
+                break;
+            }
+
+            /* 4.1.1-4.1.3: No preceding lock, 66, f2, f3, or rex prefixes. */
+            if (prefixes & (PREFIX_REPZ | PREFIX_REPNZ
+                            | PREFIX_LOCK | PREFIX_DATA)) {
+                goto illegal_op;
+            }
+#ifdef TARGET_X86_64
+            if (s->x86_64_hregs) {
+                goto illegal_op;
+            }
 #endif
             rex_r = (~vex2 >> 4) & 8;
             if (b == 0xc5) {
@@ -4795,6 +6303,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         case 0: /* test */
             val = insn_get(env, s, ot);
             tcg_gen_movi_tl(s->T1, val);
+            afl_gen_cmplog(pc_start, ot, s->T0, s->T1);
             gen_op_testl_T0_T1_cc(s);
             set_cc_op(s, CC_OP_LOGICB + ot);
             break;
@@ -5056,7 +6565,8 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             gen_push_v(s, s->T1);
             gen_op_jmp_v(s->T0);
             gen_bnd_jmp(s);
-            gen_jr(s, s->T0);
+            tcg_gen_ras_push();
+            gen_jr_near(s, s->T0);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_v(s, ot, s->T1, s->A0);
@@ -5083,7 +6593,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             }
             gen_op_jmp_v(s->T0);
             gen_bnd_jmp(s);
-            gen_jr(s, s->T0);
+            gen_jr_near(s, s->T0);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_v(s, ot, s->T1, s->A0);
@@ -5118,6 +6628,10 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
 
         gen_ldst_modrm(env, s, modrm, ot, OR_TMP0, 0);
         gen_op_mov_v_reg(s, ot, s->T1, reg);
+        /* test %reg, %reg is a zero check, not worth logging */
+        if ((modrm >> 6) != 3 || ((modrm & 7) | REX_B(s)) != reg) {
+            afl_gen_cmplog(pc_start, ot, s->T0, s->T1);
+        }
         gen_op_testl_T0_T1_cc(s);
         set_cc_op(s, CC_OP_LOGICB + ot);
         break;
@@ -5129,6 +6643,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
 
         gen_op_mov_v_reg(s, ot, s->T0, OR_EAX);
         tcg_gen_movi_tl(s->T1, val);
+        afl_gen_cmplog(pc_start, ot, s->T0, s->T1);
         gen_op_testl_T0_T1_cc(s);
         set_cc_op(s, CC_OP_LOGICB + ot);
         break;
@@ -6510,7 +8025,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(s->T0);
         gen_bnd_jmp(s);
-        gen_jr(s, s->T0);
+        gen_jr_ret(s, s->T0);
         break;
     case 0xc3: /* ret */
         ot = gen_pop_T0(s);
@@ -6518,7 +8033,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(s->T0);
         gen_bnd_jmp(s);
-        gen_jr(s, s->T0);
+        gen_jr_ret(s, s->T0);
         break;
     case 0xca: /* lret im */
         val = x86_ldsw_code(env, s);
@@ -6584,7 +8099,8 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tcg_gen_movi_tl(s->T0, next_eip);
             gen_push_v(s, s->T0);
             gen_bnd_jmp(s);
-            gen_jmp(s, tval);
+            tcg_gen_ras_push();
+            gen_jmp_direct(s, tval);
         }
         break;
     case 0x9a: /* lcall im */
@@ -6614,7 +8130,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffffffff;
         }
         gen_bnd_jmp(s);
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0xea: /* ljmp im */
         {
@@ -6636,7 +8152,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
@@ -7232,6 +8748,9 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         }
         break;
     case 0x124: /* fuzzCall */
+        /* startWork may snapshot the vCPU and doneWork may restore it */
+        gen_update_cc_op(s);
+        gen_jmp_im(s, s->pc - s->cs_base);
         gen_helper_fuzzCall(cpu_regs[R_EAX], cpu_env, cpu_regs[R_EDI], cpu_regs[R_ESI], cpu_regs[R_EDX]);
         break;
 #ifdef TARGET_X86_64
@@ -8475,6 +9994,7 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
     dc->cc_op = CC_OP_DYNAMIC;
     dc->cc_op_dirty = false;
     dc->cs_base = cs_base;
+    dc->env = env;
     dc->popl_esp_hack = 0;
     /* select memory access functions */
     dc->mem_index = 0;
@@ -8646,101 +10166,8 @@ void restore_state_to_opc(CPUX86State *env, TranslationBlock *tb,
     }
 }
 
-static target_ulong startForkServer(CPUArchState *env, target_ulong enableTicks)
-{
-    // TODO: If we are in a fork server, return.
-    if(false){
-        // TODO: Do nothing now.
-    }
-
-    return -1;
-}
-
-/* copy work into ptr[0..sz].  Assumes memory range is locked. */
-static target_ulong getWork(CPUArchState *env, target_ulong ptr, target_ulong sz)
-{
-    // we can relocate from ptr to some useful function
-    // TODO:
-    FILE *fp;
-    unsigned char ch;
-    char fuzzTestFile[] = "/fuzzer/gen_input/fuzz_test";
-    printf("[+] Will open file: %s", fuzzTestFile);
-    fp = fopen(fuzzTestFile, "rb");
-    // fp = open(aflFile, "rb");
-    if(!fp)
-    {
-        perror("getWork open·File error!");
-        // exit(-1);
-        return -1;
-    }
-    target_ulong ret_sz = 0;
-    while(ret_sz < sz)
-    {
-        if(fread(&ch, 1, 1, fp) == 0)
-        {
-            break;
-        }
-        // printf("[+] ch: %c\n", ch);
-        cpu_stb_data(env, ptr, ch);
-        ret_sz++;
-        ptr++;
-    }
-    fclose(fp);
-    return ret_sz;
-}
-
-static target_ulong startWork(CPUArchState *env, target_ulong ptr)
+target_ulong helper_fuzzCall(CPUArchState *env, target_ulong code,
+                             target_ulong a0, target_ulong a1)
 {
-    target_ulong start, end;
-    target_ulong catch_pc;
-    printf("pid %d: ptr %x\n", getpid(), ptr);
-    fflush(stdout);
-    start = cpu_ldq_data(env, ptr);
-    end = cpu_ldq_data(env, ptr + sizeof(start) * 2);
-    catch_pc = cpu_ldq_data(env, ptr + sizeof(start) * 4);
-    printf("pid %d: startWork %x - %x\n", getpid(), start, end);
-    printf("pc: %x\n", catch_pc);
-    afl_start_code = catch_pc;
-    fflush(stdout);
-    if(start >= end){
-        perror(" False range: start_addr < end_addr!\n");
-        exit(0);
-    }
-    // 每次只会判断一次？
-    afl_need_start = 1;
-    return 1;
-}
-
-static target_ulong doneWork(target_ulong val)
-{
-    // TODO: 
-    start_trace = false;
-    exit(0);
-    return -1;
+    return afl_fuzz_call(env, code, a0, a1);
 }
-
-target_ulong helper_fuzzCall(CPUArchState *env, target_ulong code, target_ulong a0, target_ulong a1) {
-    switch (code)
-    {
-    case 1:
-        // printf("[+] a0: %#x\n", a0);
-        return startForkServer(env, a0);
-
-    case 2:
-        // printf("[+] a0: %#x, a1: %#x\n", a0, a1);
-        return getWork(env, a0, a1);
-
-    case 3:
-        // printf("[+] a0: %#x\n", a0);
-        return startWork(env, a0);
-
-    case 4:
-        // printf("[+] a0: %#x\n", a0);
-        return doneWork(a0);
-
-    default:
-        printf("[!] Not implement!\n");
-        break;
-    }
-    return -1;
-}
\ No newline at end of file
@@ -422,7 +422,7 @@ uint32_t helper_stqcx_le_parallel(CPUPPCState *env, target_ulong addr,
     bool success = false;
 
     /* We will have raised EXCP_ATOMIC from the translator.  */
-    assert(HAVE_CMPXCHG128);
+    assert(atomic16_cmpxchg_enabled());
 
     if (likely(addr == env->reserve_addr)) {
         Int128 oldv, cmpv, newv;
@@ -444,7 +444,7 @@ uint32_t helper_stqcx_be_parallel(CPUPPCState *env, target_ulong addr,
     bool success = false;
 
     /* We will have raised EXCP_ATOMIC from the translator.  */
-    assert(HAVE_CMPXCHG128);
+    assert(atomic16_cmpxchg_enabled());
 
     if (likely(addr == env->reserve_addr)) {
         Int128 oldv, cmpv, newv;
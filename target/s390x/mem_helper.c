@@ -1706,7 +1706,7 @@ void HELPER(cdsg_parallel)(CPUS390XState *env, uint64_t addr,
     Int128 oldv;
     bool fail;
 
-    assert(HAVE_CMPXCHG128);
+    assert(atomic16_cmpxchg_enabled());
 
     mem_idx = cpu_mmu_index(env, false);
     oi = make_memop_idx(MO_TEQ | MO_ALIGN_16, mem_idx);
@@ -1759,7 +1759,7 @@ static uint32_t do_csst(CPUS390XState *env, uint32_t r3, uint64_t a1,
 #ifdef CONFIG_ATOMIC64
         max = 3;
 #endif
-        if ((HAVE_CMPXCHG128 ? 0 : fc + 2 > max) ||
+        if ((atomic16_cmpxchg_enabled() ? 0 : fc + 2 > max) ||
             (HAVE_ATOMIC128  ? 0 : sc > max)) {
             cpu_loop_exit_atomic(env_cpu(env), ra);
         }
@@ -1842,7 +1842,7 @@ static uint32_t do_csst(CPUS390XState *env, uint32_t r3, uint64_t a1,
 
                 cpu_stq_data_ra(env, a1 + 0, int128_gethi(nv), ra);
                 cpu_stq_data_ra(env, a1 + 8, int128_getlo(nv), ra);
-            } else if (HAVE_CMPXCHG128) {
+            } else if (atomic16_cmpxchg_enabled()) {
                 TCGMemOpIdx oi = make_memop_idx(MO_TEQ | MO_ALIGN_16, mem_idx);
                 ov = helper_atomic_cmpxchgo_be_mmu(env, a1, cv, nv, oi, ra);
                 cc = !int128_eq(ov, cv);
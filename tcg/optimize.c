@@ -24,6 +24,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/range.h"
 #include "tcg/tcg-op.h"
 
 #define CASE_OP_32_64(x)                        \
@@ -594,6 +595,241 @@ static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
     return false;
 }
 
+/*
+ * Loads and stores of env fields within a basic block.
+ *
+ * Frontends keep much of the guest state in env fields that are not TCG
+ * globals, and access them with ld/st ops on cpu_env.  Each field that
+ * was loaded or stored is remembered with the temp that holds its value,
+ * until the temp is redefined or the field may have been overwritten:
+ * a later load of the field becomes a move.  A store is removed when it
+ * is fully overwritten before anything may read it.
+ *
+ * Only non-negative offsets are tracked; below env live CPUState and
+ * CPUNegativeOffsetState, which other threads update.  Any other base
+ * pointer may point into env, so a load through it may read any field
+ * and a store through it may write any field.  As for TCG globals, guest
+ * memory accesses are assumed not to modify env.  Helpers may modify it
+ * unless they have no side effects.  Both may fault or read env, so the
+ * fields must be up to date when they run.
+ */
+#define ENV_MEM_MAX 32
+
+typedef struct EnvMemVal {
+    intptr_t ofs;
+    int size;
+    TCGOpcode ld_opc;   /* load that @val is the result of */
+    TCGTemp *val;
+} EnvMemVal;
+
+typedef struct EnvMemStore {
+    intptr_t ofs;
+    int size;
+    TCGOp *op;
+} EnvMemStore;
+
+typedef struct EnvMemState {
+    TCGTemp *env;
+    int nb_vals;
+    int nb_stores;
+    EnvMemVal vals[ENV_MEM_MAX];
+    EnvMemStore stores[ENV_MEM_MAX];
+} EnvMemState;
+
+static int env_mem_size(TCGOpcode opc)
+{
+    switch (opc) {
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(st8):
+        return 1;
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(st16):
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_st_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static void env_mem_forget_val(EnvMemState *m, TCGTemp *ts)
+{
+    int i;
+
+    for (i = m->nb_vals - 1; i >= 0; i--) {
+        if (m->vals[i].val == ts) {
+            m->vals[i] = m->vals[--m->nb_vals];
+        }
+    }
+}
+
+/* The bytes at @ofs are loaded: stores to them are live. */
+static void env_mem_read(EnvMemState *m, intptr_t ofs, int size)
+{
+    int i;
+
+    for (i = m->nb_stores - 1; i >= 0; i--) {
+        if (ranges_overlap(m->stores[i].ofs, m->stores[i].size, ofs, size)) {
+            m->stores[i] = m->stores[--m->nb_stores];
+        }
+    }
+}
+
+/*
+ * The bytes at @ofs are stored by @op: remove the earlier stores that it
+ * overwrites, and forget the values that it may change.
+ */
+static void env_mem_write(TCGContext *s, EnvMemState *m, TCGOp *op,
+                          intptr_t ofs, int size)
+{
+    int i;
+
+    for (i = m->nb_stores - 1; i >= 0; i--) {
+        EnvMemStore *st = &m->stores[i];
+
+        if (st->ofs >= ofs && st->ofs + st->size <= ofs + size) {
+            tcg_op_remove(s, st->op);
+        } else if (!ranges_overlap(st->ofs, st->size, ofs, size)) {
+            continue;
+        }
+        m->stores[i] = m->stores[--m->nb_stores];
+    }
+    for (i = m->nb_vals - 1; i >= 0; i--) {
+        if (ranges_overlap(m->vals[i].ofs, m->vals[i].size, ofs, size)) {
+            m->vals[i] = m->vals[--m->nb_vals];
+        }
+    }
+    if (m->nb_stores < ENV_MEM_MAX) {
+        m->stores[m->nb_stores++] = (EnvMemStore) { ofs, size, op };
+    }
+}
+
+static void env_mem_add_val(EnvMemState *m, intptr_t ofs, int size,
+                            TCGOpcode ld_opc, TCGTemp *val)
+{
+    if (m->nb_vals < ENV_MEM_MAX) {
+        m->vals[m->nb_vals++] = (EnvMemVal) { ofs, size, ld_opc, val };
+    }
+}
+
+/*
+ * Track the env accesses of @op, after copy propagation.  Returns true
+ * if @op was a load that has been replaced by a move.
+ */
+static bool env_mem_optimize(TCGContext *s, EnvMemState *m, TCGOp *op,
+                             int nb_oargs, int nb_iargs)
+{
+    TCGOpcode opc = op->opc;
+    const TCGOpDef *def = &tcg_op_defs[opc];
+    TCGTemp *base, *dst;
+    intptr_t ofs;
+    int i, size;
+
+    if (def->flags & TCG_OPF_BB_END) {
+        m->nb_vals = 0;
+        m->nb_stores = 0;
+        return false;
+    }
+
+    switch (opc) {
+    case INDEX_op_call:
+        m->nb_stores = 0;
+        if (!(op->args[nb_oargs + nb_iargs + 1] & TCG_CALL_NO_SIDE_EFFECTS)) {
+            m->nb_vals = 0;
+        }
+        break;
+
+    case INDEX_op_qemu_ld_i32:
+    case INDEX_op_qemu_ld_i64:
+    case INDEX_op_qemu_st_i32:
+    case INDEX_op_qemu_st_i64:
+        m->nb_stores = 0;
+        break;
+
+    case INDEX_op_ld_vec:
+    case INDEX_op_dupm_vec:
+    case INDEX_op_st_vec:
+        base = arg_temp(op->args[1]);
+        ofs = op->args[2];
+        size = 8 << TCGOP_VECL(op);
+        if (base != m->env) {
+            if (opc == INDEX_op_st_vec) {
+                m->nb_vals = 0;
+            } else {
+                m->nb_stores = 0;
+            }
+        } else if (ofs >= 0) {
+            if (opc == INDEX_op_st_vec) {
+                env_mem_write(s, m, op, ofs, size);
+            } else {
+                env_mem_read(m, ofs, size);
+            }
+        }
+        break;
+
+    default:
+        size = env_mem_size(opc);
+        if (!size) {
+            break;
+        }
+        base = arg_temp(op->args[1]);
+        ofs = op->args[2];
+        if (base != m->env) {
+            if (def->nb_oargs == 0) {
+                m->nb_vals = 0;
+            } else {
+                m->nb_stores = 0;
+            }
+            break;
+        }
+        if (ofs < 0) {
+            break;
+        }
+        if (def->nb_oargs == 0) {
+            env_mem_write(s, m, op, ofs, size);
+            if (opc == INDEX_op_st_i32 || opc == INDEX_op_st_i64) {
+                env_mem_add_val(m, ofs, size, opc == INDEX_op_st_i32
+                                ? INDEX_op_ld_i32 : INDEX_op_ld_i64,
+                                arg_temp(op->args[0]));
+            }
+            return false;
+        }
+
+        dst = arg_temp(op->args[0]);
+        for (i = 0; i < m->nb_vals; i++) {
+            EnvMemVal *v = &m->vals[i];
+
+            if (v->ofs == ofs && v->size == size && v->ld_opc == opc) {
+                TCGTemp *val = v->val;
+
+                if (val != dst) {
+                    env_mem_forget_val(m, dst);
+                }
+                tcg_opt_gen_mov(s, op, temp_arg(dst), temp_arg(val));
+                return true;
+            }
+        }
+        env_mem_read(m, ofs, size);
+        env_mem_forget_val(m, dst);
+        env_mem_add_val(m, ofs, size, opc, dst);
+        return false;
+    }
+
+    for (i = 0; i < nb_oargs; i++) {
+        env_mem_forget_val(m, arg_temp(op->args[i]));
+    }
+    return false;
+}
+
 /* Propagate constants and copies, fold constant expressions. */
 void tcg_optimize(TCGContext *s)
 {
@@ -601,6 +837,7 @@ void tcg_optimize(TCGContext *s)
     TCGOp *op, *op_next, *prev_mb = NULL;
     struct tcg_temp_info *infos;
     TCGTempSet temps_used;
+    EnvMemState env_mem = { .env = tcgv_ptr_temp(cpu_env) };
 
     /* Array VALS has an element for each temp.
        If this temp holds a constant then its value is kept in VALS' element.
@@ -646,6 +883,10 @@ void tcg_optimize(TCGContext *s)
             }
         }
 
+        if (env_mem_optimize(s, &env_mem, op, nb_oargs, nb_iargs)) {
+            continue;
+        }
+
         /* For commutative operations make constant second argument */
         switch (opc) {
         CASE_OP_32_64_VEC(add):
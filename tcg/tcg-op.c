@@ -2720,6 +2720,139 @@ void tcg_gen_lookup_and_goto_ptr(void)
     }
 }
 
+/* Offset of a CPUState field from cpu_env */
+#define CPU_ENV_OFFSET(field) \
+    (-offsetof(ArchCPU, env) + offsetof(CPUState, field))
+
+static bool ibtc_enabled(void)
+{
+    return TCG_TARGET_HAS_goto_ptr && !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN);
+}
+
+/*
+ * Jump to the TB cached in the tb_ibtc slot at @slot, a local temp, if
+ * it is the one the lookup would return; otherwise look the TB up and
+ * refill the slot.
+ */
+static void gen_lookup_and_goto_ptr_slot(TCGv_ptr slot, TCGv pc,
+                                         target_ulong cs_base, uint32_t flags)
+{
+    /* The next TB is looked up with the cflags of the current context */
+    uint32_t cflags = tcg_ctx->tb_cflags &
+                      (CF_HASH_MASK & ~(CF_COUNT_MASK | CF_LAST_IO));
+    TCGLabel *hit = gen_new_label();
+    TCGv_ptr tb = tcg_temp_new_ptr();
+    TCGv_ptr ptr = tcg_temp_local_new_ptr();
+    TCGv t0 = tcg_temp_new();
+    TCGv t1 = tcg_temp_new();
+    TCGv_i32 c0 = tcg_temp_new_i32();
+    TCGv_i32 c1 = tcg_temp_new_i32();
+
+    plugin_gen_disable_mem_helpers();
+
+    /* t0 is zero iff the cached TB matches the whole lookup key */
+    tcg_gen_ld_ptr(tb, slot, 0);
+    tcg_gen_ld_tl(t0, tb, offsetof(TranslationBlock, pc));
+    tcg_gen_xor_tl(t0, t0, pc);
+    tcg_gen_ld_tl(t1, tb, offsetof(TranslationBlock, cs_base));
+    tcg_gen_xori_tl(t1, t1, cs_base);
+    tcg_gen_or_tl(t0, t0, t1);
+    tcg_gen_ld_i32(c0, tb, offsetof(TranslationBlock, flags));
+    tcg_gen_xori_i32(c0, c0, flags);
+    tcg_gen_ld_i32(c1, tb, offsetof(TranslationBlock, cflags));
+    tcg_gen_andi_i32(c1, c1, CF_HASH_MASK | CF_INVALID);
+    tcg_gen_xori_i32(c1, c1, cflags);
+    tcg_gen_or_i32(c0, c0, c1);
+    tcg_gen_extu_i32_tl(t1, c0);
+    tcg_gen_or_tl(t0, t0, t1);
+    tcg_gen_ld_ptr(ptr, tb, offsetof(TranslationBlock, tc.ptr));
+    tcg_gen_brcondi_tl(TCG_COND_EQ, t0, 0, hit);
+
+    gen_helper_lookup_tb_ptr_cached(ptr, cpu_env, slot);
+    gen_set_label(hit);
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(ptr));
+
+    tcg_temp_free_i32(c1);
+    tcg_temp_free_i32(c0);
+    tcg_temp_free(t1);
+    tcg_temp_free(t0);
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_ptr(tb);
+}
+
+void tcg_gen_lookup_and_goto_ptr_cached(TCGv pc, target_ulong cs_base,
+                                        uint32_t flags)
+{
+    if (ibtc_enabled()) {
+        TCGv_ptr slot = tcg_const_local_ptr(&tb_ibtc[tb_ibtc_alloc()]);
+
+        gen_lookup_and_goto_ptr_slot(slot, pc, cs_base, flags);
+        tcg_temp_free_ptr(slot);
+    } else {
+        tcg_gen_lookup_and_goto_ptr();
+    }
+}
+
+/* Address of entry @top of the shadow return stack, minus tb_ras */
+static TCGv_ptr gen_ras_entry(TCGv_i32 top)
+{
+    TCGv_i32 t = tcg_temp_new_i32();
+    TCGv_ptr p = tcg_temp_new_ptr();
+
+    tcg_gen_andi_i32(t, top, TB_RAS_SIZE - 1);
+    tcg_gen_muli_i32(t, t, sizeof(uint32_t));
+    tcg_gen_ext_i32_ptr(p, t);
+    tcg_gen_add_ptr(p, p, cpu_env);
+    tcg_temp_free_i32(t);
+    return p;
+}
+
+void tcg_gen_ras_push(void)
+{
+    if (ibtc_enabled()) {
+        TCGv_i32 top = tcg_temp_new_i32();
+        TCGv_i32 idx = tcg_const_i32(tb_ibtc_alloc());
+        TCGv_ptr p;
+
+        tcg_gen_ld_i32(top, cpu_env, CPU_ENV_OFFSET(tb_ras_top));
+        p = gen_ras_entry(top);
+        tcg_gen_st_i32(idx, p, CPU_ENV_OFFSET(tb_ras));
+        tcg_gen_addi_i32(top, top, 1);
+        tcg_gen_st_i32(top, cpu_env, CPU_ENV_OFFSET(tb_ras_top));
+        tcg_temp_free_ptr(p);
+        tcg_temp_free_i32(idx);
+        tcg_temp_free_i32(top);
+    }
+}
+
+void tcg_gen_lookup_and_goto_ptr_ret(TCGv pc, target_ulong cs_base,
+                                     uint32_t flags)
+{
+    if (ibtc_enabled()) {
+        TCGv_i32 top = tcg_temp_new_i32();
+        TCGv_i32 idx = tcg_temp_new_i32();
+        TCGv_ptr slot = tcg_temp_local_new_ptr();
+        TCGv_ptr p;
+
+        tcg_gen_ld_i32(top, cpu_env, CPU_ENV_OFFSET(tb_ras_top));
+        tcg_gen_subi_i32(top, top, 1);
+        tcg_gen_st_i32(top, cpu_env, CPU_ENV_OFFSET(tb_ras_top));
+        p = gen_ras_entry(top);
+        tcg_gen_ld_i32(idx, p, CPU_ENV_OFFSET(tb_ras));
+        tcg_gen_muli_i32(idx, idx, sizeof(TranslationBlock *));
+        tcg_gen_ext_i32_ptr(slot, idx);
+        tcg_gen_addi_ptr(slot, slot, (intptr_t)tb_ibtc);
+        tcg_temp_free_ptr(p);
+        tcg_temp_free_i32(idx);
+        tcg_temp_free_i32(top);
+
+        gen_lookup_and_goto_ptr_slot(slot, pc, cs_base, flags);
+        tcg_temp_free_ptr(slot);
+    } else {
+        tcg_gen_lookup_and_goto_ptr();
+    }
+}
+
 static inline MemOp tcg_canonicalize_memop(MemOp op, bool is64, bool st)
 {
     /* Trigger the asserts within as early as possible.  */
@@ -35,6 +35,7 @@
 #include "qemu/host-utils.h"
 #include "qemu/qemu-print.h"
 #include "qemu/timer.h"
+#include "qemu/rcu.h"
 
 /* Note: the long term plan is to reduce the dependencies on the QEMU
    CPU definitions. Currently they are used for qemu_ld/st
@@ -187,6 +188,13 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    size_t *full; /* full regions not in use, oldest first */
+    size_t n_full;
+    size_t *free; /* regions emptied by tcg_region_evict */
+    size_t n_free;
+    size_t gen; /* bumped by tcg_region_reset_all */
+    bool evicting; /* a region is waiting for its RCU grace period */
+    bool want_evict; /* the last spare region has been handed out */
 };
 
 static struct tcg_region_state region;
@@ -400,22 +408,24 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+static size_t tc_ptr_to_region_idx(void *p)
 {
-    size_t region_idx;
-
     if (p < region.start_aligned) {
-        region_idx = 0;
+        return 0;
     } else {
         ptrdiff_t offset = p - region.start_aligned;
 
         if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
+            return region.n - 1;
         } else {
-            region_idx = offset / region.stride;
+            return offset / region.stride;
         }
     }
-    return region_trees + region_idx * tree_size;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+{
+    return region_trees + tc_ptr_to_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -559,11 +569,18 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    if (region.current < region.n) {
+        tcg_region_assign(s, region.current);
+        region.current++;
+    } else if (region.n_free) {
+        tcg_region_assign(s, region.free[--region.n_free]);
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    /* Out of spare regions: have the next translation start an eviction */
+    if (region.current == region.n && !region.n_free && !region.evicting) {
+        qatomic_set(&region.want_evict, true);
+    }
     return false;
 }
 
@@ -576,11 +593,13 @@ static bool tcg_region_alloc(TCGContext *s)
     bool err;
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t full = tc_ptr_to_region_idx(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.full[region.n_full++] = full;
     }
     qemu_mutex_unlock(&region.lock);
     return err;
@@ -604,6 +623,12 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.n_full = 0;
+    region.n_free = 0;
+    /* Any eviction still waiting for its grace period is now moot */
+    region.gen++;
+    region.evicting = false;
+    qatomic_set(&region.want_evict, false);
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -616,6 +641,166 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+static gboolean tcg_region_tree_evict(gpointer k, gpointer v, gpointer data)
+{
+    TranslationBlock *tb = v;
+
+    if (!(tb_cflags(tb) & CF_INVALID)) {
+        tb_phys_invalidate(tb, -1);
+    }
+    tb_destroy(tb);
+    return FALSE;
+}
+
+/*
+ * Call from a safe-work context.
+ *
+ * Empty the region that filled up the longest ago: invalidate its TBs,
+ * which unlinks them from the hash table, their pages and the jumps of
+ * the TBs in other regions, and make it available to tcg_region_alloc.
+ * The TBs in all other regions stay valid and linked.
+ *
+ * Returns false if there is no full region to evict, e.g. because the
+ * buffer is a single region.
+ */
+bool tcg_region_evict(void)
+{
+    struct tcg_region_tree *rt;
+    void *start, *end;
+    size_t i;
+
+    qemu_mutex_lock(&region.lock);
+    if (!region.n_full) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+    i = region.full[0];
+    region.n_full--;
+    memmove(region.full, region.full + 1, region.n_full * sizeof(size_t));
+    tcg_region_bounds(i, &start, &end);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    region.free[region.n_free++] = i;
+    qemu_mutex_unlock(&region.lock);
+
+    rt = region_trees + i * tree_size;
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, tcg_region_tree_evict, NULL);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    tb_ibtc_clear_range(start, end);
+    return true;
+}
+
+typedef struct TCGRegionEviction {
+    struct rcu_head rcu;
+    size_t idx;
+    size_t gen;
+} TCGRegionEviction;
+
+static gboolean tcg_region_tree_collect(gpointer k, gpointer v, gpointer data)
+{
+    g_ptr_array_add(data, v);
+    return FALSE;
+}
+
+static void tcg_region_evict_rcu(TCGRegionEviction *ev)
+{
+    struct tcg_region_tree *rt = region_trees + ev->idx * tree_size;
+    void *start, *end;
+
+    qemu_mutex_lock(&region.lock);
+    /* A flush since the eviction started has already reset everything */
+    if (ev->gen == region.gen) {
+        tcg_region_bounds(ev->idx, &start, &end);
+        tb_jmp_cache_clear_range(start, end);
+        tb_ibtc_clear_range(start, end);
+
+        qemu_mutex_lock(&rt->lock);
+        g_tree_foreach(rt->tree, tcg_region_tree_traverse, NULL);
+        /* Increment the refcount first so that destroy acts as a reset */
+        g_tree_ref(rt->tree);
+        g_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+
+        region.free[region.n_free++] = ev->idx;
+        region.evicting = false;
+    }
+    qemu_mutex_unlock(&region.lock);
+    g_free(ev);
+}
+
+bool tcg_region_evict_wanted(void)
+{
+    return qatomic_read(&region.want_evict);
+}
+
+/*
+ * Like tcg_region_evict, but without stopping the other vCPUs.  The TBs
+ * of the oldest full region are invalidated right away, under the same
+ * locks as for self-modifying code; vCPUs still running one of them
+ * finish it normally.  The region is only destroyed and handed back to
+ * tcg_region_alloc after an RCU grace period, once no vCPU can be
+ * executing it or holding a pointer to one of its TBs: cpu_exec runs
+ * inside an RCU read-side critical section.
+ *
+ * Call from a vCPU, with mmap_lock held.  Returns false if no eviction
+ * was started.
+ */
+bool tcg_region_evict_async(void)
+{
+    struct tcg_region_tree *rt;
+    TCGRegionEviction *ev;
+    GPtrArray *tbs;
+    CPUState *cpu;
+    void *start, *end;
+    guint i;
+
+    qemu_mutex_lock(&region.lock);
+    qatomic_set(&region.want_evict, false);
+    if (region.evicting || !region.n_full) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+    ev = g_new(TCGRegionEviction, 1);
+    ev->idx = region.full[0];
+    ev->gen = region.gen;
+    region.n_full--;
+    memmove(region.full, region.full + 1, region.n_full * sizeof(size_t));
+    tcg_region_bounds(ev->idx, &start, &end);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    region.evicting = true;
+    qemu_mutex_unlock(&region.lock);
+
+    /*
+     * A full region gets no new TBs, so the tree can be walked without
+     * its lock held, which must not be taken before the page locks.
+     */
+    rt = region_trees + ev->idx * tree_size;
+    tbs = g_ptr_array_new();
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, tcg_region_tree_collect, tbs);
+    qemu_mutex_unlock(&rt->lock);
+    for (i = 0; i < tbs->len; i++) {
+        TranslationBlock *tb = g_ptr_array_index(tbs, i);
+
+        if (!(tb_cflags(tb) & CF_INVALID)) {
+            tb_phys_invalidate(tb, -1);
+        }
+    }
+    g_ptr_array_free(tbs, true);
+
+    call_rcu(ev, tcg_region_evict_rcu, rcu);
+
+    /* Have every vCPU leave cpu_exec so that the grace period ends soon */
+    CPU_FOREACH(cpu) {
+        cpu_exit(cpu);
+    }
+    return true;
+}
+
 #ifdef CONFIG_USER_ONLY
 static size_t tcg_n_regions(void)
 {
@@ -715,6 +900,8 @@ void tcg_region_init(void)
     /* init the region struct */
     qemu_mutex_init(&region.lock);
     region.n = n_regions;
+    region.full = g_new(size_t, n_regions);
+    region.free = g_new(size_t, n_regions);
     region.size = region_size - page_size;
     region.stride = region_size;
     region.start = buf;
@@ -2542,6 +2729,51 @@ static void la_bb_sync(TCGContext *s, int ng, int nt)
     }
 }
 
+/*
+ * liveness analysis: unconditional branch or fallthrough to @l.  The
+ * globals that are live at the label stay live, synced, so that the
+ * register allocator can keep them in registers across the edge.
+ * A label that is reached by a backward branch has not been seen yet
+ * in this backward walk; its globals are all in memory.
+ */
+static void la_branch(TCGContext *s, TCGLabel *l, int ng)
+{
+    int i;
+
+    if (!l->la_state) {
+        l->back_ref = 1;
+        return;
+    }
+    for (i = 0; i < ng; ++i) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (!(l->la_state[i] & TS_DEAD)) {
+            ts->state = TS_MEM;
+            *la_temp_pref(ts) = tcg_target_available_regs[ts->type];
+        }
+    }
+}
+
+/*
+ * liveness analysis: label: remember which direct globals are live
+ * after it, then treat the fallthrough like a branch to it.
+ */
+static void la_label(TCGContext *s, TCGLabel *l, int ng, int nt)
+{
+    int i;
+
+    if (!l->back_ref) {
+        l->la_state = tcg_malloc(ng);
+        for (i = 0; i < ng; ++i) {
+            TCGTemp *ts = &s->temps[i];
+            l->la_state[i] = (ts->fixed_reg || ts->indirect_reg
+                              ? TS_DEAD : ts->state);
+        }
+    }
+    la_bb_end(s, ng, nt);
+    la_branch(s, l, ng);
+}
+
 /* liveness analysis: sync globals back to memory and kill.  */
 static void la_global_kill(TCGContext *s, int ng)
 {
@@ -2583,6 +2815,7 @@ static void liveness_pass_1(TCGContext *s)
     int nb_globals = s->nb_globals;
     int nb_temps = s->nb_temps;
     TCGOp *op, *op_prev;
+    TCGLabel *label;
     TCGRegSet *prefs;
     int i;
 
@@ -2590,6 +2823,11 @@ static void liveness_pass_1(TCGContext *s)
     for (i = 0; i < nb_temps; ++i) {
         s->temps[i].state_ptr = prefs + i;
     }
+    QSIMPLEQ_FOREACH(label, &s->labels, next) {
+        label->back_ref = 0;
+        label->la_state = NULL;
+        label->reg_globals = NULL;
+    }
 
     /* ??? Should be redundant with the exit_tb that ends the TB.  */
     la_func_end(s, nb_globals, nb_temps);
@@ -2820,6 +3058,13 @@ static void liveness_pass_1(TCGContext *s)
                 la_func_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_COND_BRANCH) {
                 la_bb_sync(s, nb_globals, nb_temps);
+                label = arg_label(op->args[def->nb_args - 1]);
+                label->back_ref |= !label->la_state;
+            } else if (opc == INDEX_op_br) {
+                la_bb_end(s, nb_globals, nb_temps);
+                la_branch(s, arg_label(op->args[0]), nb_globals);
+            } else if (opc == INDEX_op_set_label) {
+                la_label(s, arg_label(op->args[0]), nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_BB_END) {
                 la_bb_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -3404,9 +3649,81 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
         }
     }
 
+    /* Globals live across a branch to a label are synced: release them. */
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+        if (!ts->fixed_reg && ts->val_type != TEMP_VAL_MEM) {
+            tcg_debug_assert(ts->mem_coherent);
+            temp_free_or_dead(s, ts, -1);
+        }
+    }
+
     save_globals(s, allocated_regs);
 }
 
+/*
+ * Record the registers of the globals on an edge to @l: only those that
+ * are in the same register on all edges stay in registers at the label.
+ * Liveness made sure that they are synced.
+ */
+static void tcg_reg_alloc_edge(TCGContext *s, TCGLabel *l)
+{
+    int i, n = s->nb_globals;
+
+    if (l->back_ref) {
+        return;
+    }
+    if (!l->reg_globals) {
+        l->reg_globals = tcg_malloc(n);
+        for (i = 0; i < n; i++) {
+            TCGTemp *ts = &s->temps[i];
+            l->reg_globals[i] = (!ts->fixed_reg && ts->val_type == TEMP_VAL_REG
+                                 ? ts->reg : -1);
+        }
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        TCGTemp *ts = &s->temps[i];
+        if (l->reg_globals[i] >= 0 &&
+            (ts->val_type != TEMP_VAL_REG || ts->reg != l->reg_globals[i])) {
+            l->reg_globals[i] = -1;
+        }
+    }
+}
+
+/*
+ * At a label, the fallthrough (if any) is the last edge.  Start the
+ * block with the globals that are in the same register on all edges and
+ * live at the label; everything else is in memory.
+ */
+static void tcg_reg_alloc_label(TCGContext *s, TCGOp *op)
+{
+    TCGLabel *l = arg_label(op->args[0]);
+    TCGOp *prev = QTAILQ_PREV(op, link);
+    int i;
+
+    if (prev && prev->opc != INDEX_op_br &&
+        !(tcg_op_defs[prev->opc].flags & TCG_OPF_BB_EXIT)) {
+        tcg_reg_alloc_edge(s, l);
+    }
+    tcg_reg_alloc_bb_end(s, s->reserved_regs);
+
+    if (l->back_ref || !l->reg_globals) {
+        return;
+    }
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+        int reg = l->reg_globals[i];
+
+        if (reg >= 0 && !(l->la_state[i] & TS_DEAD)) {
+            ts->val_type = TEMP_VAL_REG;
+            ts->reg = reg;
+            ts->mem_coherent = 1;
+            s->reg_to_temp[reg] = ts;
+        }
+    }
+}
+
 /*
  * At a conditional branch, we assume all temporaries are dead and
  * all globals and local temps are synced to their location.
@@ -3782,7 +4099,11 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
 
     if (def->flags & TCG_OPF_COND_BRANCH) {
         tcg_reg_alloc_cbranch(s, i_allocated_regs);
+        tcg_reg_alloc_edge(s, arg_label(op->args[def->nb_args - 1]));
     } else if (def->flags & TCG_OPF_BB_END) {
+        if (op->opc == INDEX_op_br) {
+            tcg_reg_alloc_edge(s, arg_label(op->args[0]));
+        }
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -4269,7 +4590,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
             temp_dead(s, arg_temp(op->args[0]));
             break;
         case INDEX_op_set_label:
-            tcg_reg_alloc_bb_end(s, s->reserved_regs);
+            tcg_reg_alloc_label(s, op);
             tcg_out_label(s, arg_label(op->args[0]), s->code_ptr);
             break;
         case INDEX_op_call:
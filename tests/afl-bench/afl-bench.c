@@ -0,0 +1,259 @@
+/*
+ * Host side of the AFL throughput benchmark
+ *
+ * A minimal fork server client: it launches QEMU with the AFL coverage
+ * map and test case buffer in shared memory, feeds it a deterministic
+ * stream of inputs and reports executions per second, round trip
+ * latency percentiles and, if QEMU was asked to write them, its own
+ * counters for the run.
+ *
+ * Usage: afl-bench [-n execs] [-s stats-file] -- qemu-system-... args
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+
+#define FORKSRV_FD          198
+#define MAP_SIZE            (1 << 16)
+#define MAX_INPUT           4096
+
+#define FS_OPT_ENABLED      0x80000001
+#define FS_OPT_SHDMEM_FUZZ  0x01000000
+
+#define BOOT_TIMEOUT_MS     30000
+#define EXEC_TIMEOUT_MS     2000
+
+static int ctl_fd, st_fd;
+static pid_t qemu_pid;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Read one 32-bit word from the fork server, -1 on timeout or EOF */
+static int read_word(uint32_t *val, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = st_fd, .events = POLLIN };
+    int ret;
+
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0) {
+        return -1;
+    }
+    return read(st_fd, val, 4) == 4 ? 0 : -1;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t xorshift(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+static void set_shm_env(const char *name, int id)
+{
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "%d", id);
+    setenv(name, buf, 1);
+}
+
+static void launch(char **argv)
+{
+    int ctl[2], st[2];
+
+    if (pipe(ctl) || pipe(st)) {
+        perror("pipe");
+        exit(1);
+    }
+
+    qemu_pid = fork();
+    if (qemu_pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (!qemu_pid) {
+        if (dup2(ctl[0], FORKSRV_FD) < 0 || dup2(st[1], FORKSRV_FD + 1) < 0) {
+            _exit(1);
+        }
+        close(ctl[0]);
+        close(ctl[1]);
+        close(st[0]);
+        close(st[1]);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(1);
+    }
+
+    close(ctl[0]);
+    close(st[1]);
+    ctl_fd = ctl[1];
+    st_fd = st[0];
+}
+
+/* One test case: returns the round trip time, or 0 if it timed out */
+static uint64_t run_one(uint32_t *was_killed)
+{
+    uint64_t start = now_ns();
+    uint32_t pid, status;
+
+    if (write(ctl_fd, was_killed, 4) != 4 ||
+        read_word(&pid, EXEC_TIMEOUT_MS) < 0) {
+        fprintf(stderr, "afl-bench: fork server went away\n");
+        exit(1);
+    }
+    *was_killed = 0;
+    if (read_word(&status, EXEC_TIMEOUT_MS) < 0) {
+        kill(pid, SIGKILL);
+        *was_killed = 1;
+        if (read_word(&status, EXEC_TIMEOUT_MS) < 0) {
+            fprintf(stderr, "afl-bench: fork server went away\n");
+            exit(1);
+        }
+        return 0;
+    }
+    return now_ns() - start;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: afl-bench [-n execs] [-s stats-file] -- qemu args...\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *stats_file = NULL;
+    unsigned long execs = 10000, i, timeouts = 0, edges = 0;
+    uint64_t *lat, total = 0;
+    uint32_t hello, was_killed = 0, seed = 0x4146;
+    uint8_t *map, *in;
+    int map_id, in_id, opt;
+    uint32_t j;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            execs = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            stats_file = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind >= argc || !execs) {
+        usage();
+    }
+
+    map_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | 0600);
+    in_id = shmget(IPC_PRIVATE, 4 + MAX_INPUT, IPC_CREAT | 0600);
+    if (map_id < 0 || in_id < 0) {
+        perror("shmget");
+        exit(1);
+    }
+    map = shmat(map_id, NULL, 0);
+    in = shmat(in_id, NULL, 0);
+    shmctl(map_id, IPC_RMID, NULL);
+    shmctl(in_id, IPC_RMID, NULL);
+    if (map == (void *)-1 || in == (void *)-1) {
+        perror("shmat");
+        exit(1);
+    }
+
+    set_shm_env("__AFL_SHM_ID", map_id);
+    set_shm_env("__AFL_SHM_FUZZ_ID", in_id);
+    if (stats_file) {
+        unlink(stats_file);
+        setenv("AFL_QEMU_STATS_FILE", stats_file, 1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    launch(argv + optind);
+
+    if (read_word(&hello, BOOT_TIMEOUT_MS) < 0) {
+        fprintf(stderr, "afl-bench: no fork server hello\n");
+        kill(qemu_pid, SIGKILL);
+        exit(1);
+    }
+    if ((hello & FS_OPT_ENABLED) == FS_OPT_ENABLED &&
+        (hello & FS_OPT_SHDMEM_FUZZ) && write(ctl_fd, &hello, 4) != 4) {
+        exit(1);
+    }
+
+    lat = calloc(execs, sizeof(*lat));
+    for (i = 0; i < execs; i++) {
+        uint32_t len = 16 + xorshift(&seed) % 240;
+
+        for (j = 0; j < len; j++) {
+            in[4 + j] = "AFL\0\1\2\3\4\5\6\7\xff"[xorshift(&seed) % 12];
+        }
+        memcpy(in, &len, 4);
+        memset(map, 0, MAP_SIZE);
+
+        lat[i] = run_one(&was_killed);
+        if (!lat[i]) {
+            timeouts++;
+        }
+        total += lat[i];
+        for (j = 0; j < MAP_SIZE; j++) {
+            edges += map[j] != 0;
+        }
+    }
+
+    qsort(lat, execs, sizeof(*lat), cmp_u64);
+    printf("execs:        %lu (%lu timed out)\n", execs, timeouts);
+    printf("execs/sec:    %.1f\n", execs * 1e9 / (total ? total : 1));
+    printf("latency p50:  %.1f us\n", lat[execs / 2] / 1e3);
+    printf("latency p90:  %.1f us\n", lat[execs * 9 / 10] / 1e3);
+    printf("latency p99:  %.1f us\n", lat[execs * 99 / 100] / 1e3);
+    printf("edges/exec:   %.1f\n", (double)edges / execs);
+
+    if (stats_file) {
+        char line[256];
+        FILE *f;
+
+        /* QEMU writes the file at most once a second, after a run */
+        sleep(1);
+        run_one(&was_killed);
+        f = fopen(stats_file, "r");
+        if (f) {
+            while (fgets(line, sizeof(line), f)) {
+                fputs(line, stdout);
+            }
+            fclose(f);
+        }
+    }
+
+    kill(qemu_pid, SIGTERM);
+    waitpid(qemu_pid, NULL, 0);
+    free(lat);
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Guest side of the AFL throughput benchmark
+ *
+ * A bare multiboot kernel that drives the fuzzCall interface: it starts
+ * the fork server, marks its own text as the traced range and then runs
+ * a small branchy parser over every test case it is handed.  Passing
+ * "persistent" on the kernel command line enables persistent mode.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+typedef unsigned char uint8_t;
+typedef unsigned int uint32_t;
+typedef unsigned long long uint64_t;
+
+#define FUZZ_START_FORK_SERVER  1
+#define FUZZ_GET_WORK           2
+#define FUZZ_START_WORK         3
+#define FUZZ_DONE_WORK          4
+
+#define PERSISTENT_RUNS         1000
+
+#define MB_INFO_CMDLINE         (1 << 2)
+
+extern char _text_start[], _text_end[];
+
+/* startWork argument block: start, end and catch pc, 8 bytes apart */
+static uint64_t work[6];
+static uint8_t input[4096];
+static volatile uint32_t sink;
+
+static inline uint32_t fuzz_call(uint32_t code, uint32_t a0, uint32_t a1)
+{
+    uint32_t ret;
+
+    asm volatile(".byte 0x0f, 0x24"
+                 : "=a"(ret) : "a"(code), "D"(a0), "S"(a1) : "memory");
+    return ret;
+}
+
+/* Enough input-dependent branches to give the coverage map some work */
+static uint32_t target(const uint8_t *buf, uint32_t len)
+{
+    uint32_t i, h = 0;
+
+    for (i = 0; i < len; i++) {
+        switch (buf[i] & 7) {
+        case 0:
+            h += 1;
+            break;
+        case 1:
+            h ^= buf[i];
+            break;
+        case 2:
+            h = (h << 3) | (h >> 29);
+            break;
+        case 3:
+            if (h & 1) {
+                h *= 3;
+            }
+            break;
+        case 4:
+            h -= i;
+            break;
+        default:
+            h += buf[i] * i;
+            break;
+        }
+        if (buf[i] == 'A' && i + 1 < len && buf[i + 1] == 'F') {
+            h ^= 0x12345678;
+            if (i + 2 < len && buf[i + 2] == 'L') {
+                h = ~h;
+            }
+        }
+    }
+    return h;
+}
+
+/* Each test case starts here; its address is the catch pc of startWork */
+static void __attribute__((noinline)) run(void)
+{
+    for (;;) {
+        uint32_t len = fuzz_call(FUZZ_GET_WORK, (uint32_t)input,
+                                 sizeof(input));
+
+        sink = target(input, len);
+        fuzz_call(FUZZ_DONE_WORK, 0, 0);
+    }
+}
+
+static int has_word(const char *s, const char *w)
+{
+    const char *p, *q;
+
+    for (; *s; s++) {
+        for (p = s, q = w; *q && *p == *q; p++, q++) {
+            continue;
+        }
+        if (!*q && (*p == '\0' || *p == ' ')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void bench_main(uint32_t *mbi)
+{
+    uint32_t persistent = 0;
+
+    if ((mbi[0] & MB_INFO_CMDLINE) &&
+        has_word((const char *)mbi[4], "persistent")) {
+        persistent = PERSISTENT_RUNS;
+    }
+
+    fuzz_call(FUZZ_START_FORK_SERVER, 0, persistent);
+
+    work[0] = (uint32_t)_text_start;
+    work[2] = (uint32_t)_text_end;
+    work[4] = (uint32_t)run;
+    fuzz_call(FUZZ_START_WORK, (uint32_t)work, 0);
+
+    run();
+}
@@ -0,0 +1,30 @@
+#!/usr/bin/env bash
+
+# Measure AFL fuzzing throughput with the harness in this directory, for
+# each of the ways QEMU can run the target.  Set QEMU to the system
+# emulator to test and EXECS to the number of test cases per run.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+
+QEMU=${QEMU:-"../../build/qemu-system-x86_64"}
+EXECS=${EXECS:-10000}
+
+make -s all || exit 1
+
+# run_bench NAME ENV QEMU-ARGS...
+run_bench() {
+    local name=$1 envs=$2
+    shift 2
+
+    printf "\n=== %s ===\n" "$name"
+    env $envs ./afl-bench -n "$EXECS" -s stats.txt -- \
+        $QEMU -display none -nodefaults -m 32 -kernel harness.elf "$@"
+}
+
+run_bench "fork, no chaining"  "" -d nochain
+run_bench "fork"               ""
+run_bench "fork, persistent"   "" -append persistent
+run_bench "snapshot"           "AFL_QEMU_SNAPSHOT=1"
+
+rm -f stats.txt
@@ -33,6 +33,9 @@ enum op {
     OP_FMA,
     OP_SQRT,
     OP_CMP,
+    OP_TO_INT,
+    OP_FROM_INT,
+    OP_CVT,
     OP_MAX_NR,
 };
 
@@ -44,6 +47,9 @@ static const char * const op_names[] = {
     [OP_FMA] = "mulAdd",
     [OP_SQRT] = "sqrt",
     [OP_CMP] = "cmp",
+    [OP_TO_INT] = "toInt64",
+    [OP_FROM_INT] = "fromInt64",
+    [OP_CVT] = "cvt",
     [OP_MAX_NR] = NULL,
 };
 
@@ -52,6 +58,8 @@ enum precision {
     PREC_DOUBLE,
     PREC_FLOAT32,
     PREC_FLOAT64,
+    PREC_FLOATX80,
+    PREC_FLOAT128,
     PREC_MAX_NR,
 };
 
@@ -62,6 +70,7 @@ enum rounding {
     ROUND_UP,
     ROUND_TIEAWAY,
     N_ROUND_MODES,
+    ROUND_ALL = N_ROUND_MODES,
 };
 
 static const char * const round_names[] = {
@@ -70,6 +79,7 @@ static const char * const round_names[] = {
     [ROUND_DOWN] = "down",
     [ROUND_UP] = "up",
     [ROUND_TIEAWAY] = "tieaway",
+    [ROUND_ALL] = "all",
 };
 
 enum tester {
@@ -89,6 +99,8 @@ union fp {
     double d;
     float32 f32;
     float64 f64;
+    floatx80 fx80;
+    float128 f128;
     uint64_t u64;
 };
 
@@ -120,6 +132,7 @@ static enum tester tester;
 static uint64_t n_completed_ops;
 static unsigned int duration = DEFAULT_DURATION_SECS;
 static int64_t ns_elapsed;
+static int rounding = ROUND_EVEN;
 /* disable optimizations with volatile */
 static volatile union fp res;
 
@@ -152,6 +165,8 @@ static void update_random_ops(int n_ops, enum precision prec)
             break;
         case PREC_DOUBLE:
         case PREC_FLOAT64:
+        case PREC_FLOATX80:
+        case PREC_FLOAT128:
             do {
                 r = xorshift64star(r);
             } while (!float64_is_normal(r));
@@ -163,12 +178,34 @@ static void update_random_ops(int n_ops, enum precision prec)
     }
 }
 
+/*
+ * Widen a random normal float64 to the wider formats, filling the extra
+ * fraction bits so that the operations cannot take shortcuts on them.
+ */
+static floatx80 make_random_floatx80(uint64_t r)
+{
+    uint16_t exp = extract64(r, 52, 11) - 1023 + 16383;
+
+    return make_floatx80(exp | (r >> 63) << 15,
+                         (1ULL << 63) | xorshift64star(r) >> 1);
+}
+
+static float128 make_random_float128(uint64_t r)
+{
+    uint64_t exp = extract64(r, 52, 11) - 1023 + 16383;
+
+    return make_float128((r & (1ULL << 63)) | exp << 48 | extract64(r, 4, 48),
+                         xorshift64star(r));
+}
+
 static void fill_random(union fp *ops, int n_ops, enum precision prec,
                         bool no_neg)
 {
     int i;
 
     for (i = 0; i < n_ops; i++) {
+        /* the fromInt64 operation reads the raw bits */
+        ops[i].u64 = random_ops[i];
         switch (prec) {
         case PREC_SINGLE:
         case PREC_FLOAT32:
@@ -184,6 +221,18 @@ static void fill_random(union fp *ops, int n_ops, enum precision prec,
                 ops[i].f64 = float64_chs(ops[i].f64);
             }
             break;
+        case PREC_FLOATX80:
+            ops[i].fx80 = make_random_floatx80(random_ops[i]);
+            if (no_neg && floatx80_is_neg(ops[i].fx80)) {
+                ops[i].fx80 = floatx80_chs(ops[i].fx80);
+            }
+            break;
+        case PREC_FLOAT128:
+            ops[i].f128 = make_random_float128(random_ops[i]);
+            if (no_neg && float128_is_neg(ops[i].f128)) {
+                ops[i].f128 = float128_chs(ops[i].f128);
+            }
+            break;
         default:
             g_assert_not_reached();
         }
@@ -212,6 +261,7 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float a = ops[0].f;
                 float b = ops[1].f;
                 float c = ops[2].f;
+                int64_t n = ops[0].u64;
 
                 switch (op) {
                 case OP_ADD:
@@ -235,6 +285,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_TO_INT:
+                    res.u64 = llrintf(a);
+                    break;
+                case OP_FROM_INT:
+                    res.f = n;
+                    break;
+                case OP_CVT:
+                    res.d = a;
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -247,6 +306,7 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 double a = ops[0].d;
                 double b = ops[1].d;
                 double c = ops[2].d;
+                int64_t n = ops[0].u64;
 
                 switch (op) {
                 case OP_ADD:
@@ -270,6 +330,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_TO_INT:
+                    res.u64 = llrint(a);
+                    break;
+                case OP_FROM_INT:
+                    res.d = n;
+                    break;
+                case OP_CVT:
+                    res.f = a;
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -282,6 +351,7 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float32 a = ops[0].f32;
                 float32 b = ops[1].f32;
                 float32 c = ops[2].f32;
+                int64_t n = ops[0].u64;
 
                 switch (op) {
                 case OP_ADD:
@@ -305,6 +375,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float32_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_TO_INT:
+                    res.u64 = float32_to_int64(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f32 = int64_to_float32(n, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f64 = float32_to_float64(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -317,6 +396,7 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 float64 a = ops[0].f64;
                 float64 b = ops[1].f64;
                 float64 c = ops[2].f64;
+                int64_t n = ops[0].u64;
 
                 switch (op) {
                 case OP_ADD:
@@ -340,6 +420,97 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float64_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_TO_INT:
+                    res.u64 = float64_to_int64(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f64 = int64_to_float64(n, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f32 = float64_to_float32(a, &soft_status);
+                    break;
+                default:
+                    g_assert_not_reached();
+                }
+            }
+            break;
+        case PREC_FLOATX80:
+            fill_random(ops, n_ops, prec, no_neg);
+            t0 = get_clock();
+            for (i = 0; i < OPS_PER_ITER; i++) {
+                floatx80 a = ops[0].fx80;
+                floatx80 b = ops[1].fx80;
+                int64_t n = ops[0].u64;
+
+                switch (op) {
+                case OP_ADD:
+                    res.fx80 = floatx80_add(a, b, &soft_status);
+                    break;
+                case OP_SUB:
+                    res.fx80 = floatx80_sub(a, b, &soft_status);
+                    break;
+                case OP_MUL:
+                    res.fx80 = floatx80_mul(a, b, &soft_status);
+                    break;
+                case OP_DIV:
+                    res.fx80 = floatx80_div(a, b, &soft_status);
+                    break;
+                case OP_SQRT:
+                    res.fx80 = floatx80_sqrt(a, &soft_status);
+                    break;
+                case OP_CMP:
+                    res.u64 = floatx80_compare_quiet(a, b, &soft_status);
+                    break;
+                case OP_TO_INT:
+                    res.u64 = floatx80_to_int64(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.fx80 = int64_to_floatx80(n, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f64 = floatx80_to_float64(a, &soft_status);
+                    break;
+                default:
+                    g_assert_not_reached();
+                }
+            }
+            break;
+        case PREC_FLOAT128:
+            fill_random(ops, n_ops, prec, no_neg);
+            t0 = get_clock();
+            for (i = 0; i < OPS_PER_ITER; i++) {
+                float128 a = ops[0].f128;
+                float128 b = ops[1].f128;
+                int64_t n = ops[0].u64;
+
+                switch (op) {
+                case OP_ADD:
+                    res.f128 = float128_add(a, b, &soft_status);
+                    break;
+                case OP_SUB:
+                    res.f128 = float128_sub(a, b, &soft_status);
+                    break;
+                case OP_MUL:
+                    res.f128 = float128_mul(a, b, &soft_status);
+                    break;
+                case OP_DIV:
+                    res.f128 = float128_div(a, b, &soft_status);
+                    break;
+                case OP_SQRT:
+                    res.f128 = float128_sqrt(a, &soft_status);
+                    break;
+                case OP_CMP:
+                    res.u64 = float128_compare_quiet(a, b, &soft_status);
+                    break;
+                case OP_TO_INT:
+                    res.u64 = float128_to_int64(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f128 = int64_to_float128(n, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f64 = float128_to_float64(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -371,19 +542,42 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
     GEN_BENCH(bench_ ## opname ## _float32, float32, PREC_FLOAT32, op, n_ops) \
     GEN_BENCH(bench_ ## opname ## _float64, float64, PREC_FLOAT64, op, n_ops)
 
+/* floatx80 and float128 are only benchmarked with softfloat */
+#define GEN_BENCH_EXT_TYPES(opname, op, n_ops)                          \
+    GEN_BENCH(bench_ ## opname ## _floatx80, floatx80, PREC_FLOATX80,   \
+              op, n_ops)                                                \
+    GEN_BENCH(bench_ ## opname ## _float128, float128, PREC_FLOAT128,   \
+              op, n_ops)
+
 GEN_BENCH_ALL_TYPES(add, OP_ADD, 2)
 GEN_BENCH_ALL_TYPES(sub, OP_SUB, 2)
 GEN_BENCH_ALL_TYPES(mul, OP_MUL, 2)
 GEN_BENCH_ALL_TYPES(div, OP_DIV, 2)
 GEN_BENCH_ALL_TYPES(fma, OP_FMA, 3)
 GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_ALL_TYPES(to_int, OP_TO_INT, 1)
+GEN_BENCH_ALL_TYPES(from_int, OP_FROM_INT, 1)
+GEN_BENCH_ALL_TYPES(cvt, OP_CVT, 1)
+GEN_BENCH_EXT_TYPES(add, OP_ADD, 2)
+GEN_BENCH_EXT_TYPES(sub, OP_SUB, 2)
+GEN_BENCH_EXT_TYPES(mul, OP_MUL, 2)
+GEN_BENCH_EXT_TYPES(div, OP_DIV, 2)
+GEN_BENCH_EXT_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_EXT_TYPES(to_int, OP_TO_INT, 1)
+GEN_BENCH_EXT_TYPES(from_int, OP_FROM_INT, 1)
+GEN_BENCH_EXT_TYPES(cvt, OP_CVT, 1)
+#undef GEN_BENCH_EXT_TYPES
 #undef GEN_BENCH_ALL_TYPES
 
 #define GEN_BENCH_ALL_TYPES_NO_NEG(name, op, n)                         \
     GEN_BENCH_NO_NEG(bench_ ## name ## _float, float, PREC_SINGLE, op, n) \
     GEN_BENCH_NO_NEG(bench_ ## name ## _double, double, PREC_DOUBLE, op, n) \
     GEN_BENCH_NO_NEG(bench_ ## name ## _float32, float32, PREC_FLOAT32, op, n) \
-    GEN_BENCH_NO_NEG(bench_ ## name ## _float64, float64, PREC_FLOAT64, op, n)
+    GEN_BENCH_NO_NEG(bench_ ## name ## _float64, float64, PREC_FLOAT64, op, n) \
+    GEN_BENCH_NO_NEG(bench_ ## name ## _floatx80, floatx80,             \
+                     PREC_FLOATX80, op, n)                              \
+    GEN_BENCH_NO_NEG(bench_ ## name ## _float128, float128,             \
+                     PREC_FLOAT128, op, n)
 
 GEN_BENCH_ALL_TYPES_NO_NEG(sqrt, OP_SQRT, 1)
 #undef GEN_BENCH_ALL_TYPES_NO_NEG
@@ -399,16 +593,30 @@ GEN_BENCH_ALL_TYPES_NO_NEG(sqrt, OP_SQRT, 1)
         [PREC_FLOAT64]   = bench_ ## opname ## _float64,        \
     }
 
+#define GEN_BENCH_FUNCS_EXT(opname, op)                         \
+    [op] = {                                                    \
+        [PREC_SINGLE]    = bench_ ## opname ## _float,          \
+        [PREC_DOUBLE]    = bench_ ## opname ## _double,         \
+        [PREC_FLOAT32]   = bench_ ## opname ## _float32,        \
+        [PREC_FLOAT64]   = bench_ ## opname ## _float64,        \
+        [PREC_FLOATX80]  = bench_ ## opname ## _floatx80,       \
+        [PREC_FLOAT128]  = bench_ ## opname ## _float128,       \
+    }
+
 static const bench_func_t bench_funcs[OP_MAX_NR][PREC_MAX_NR] = {
-    GEN_BENCH_FUNCS(add, OP_ADD),
-    GEN_BENCH_FUNCS(sub, OP_SUB),
-    GEN_BENCH_FUNCS(mul, OP_MUL),
-    GEN_BENCH_FUNCS(div, OP_DIV),
+    GEN_BENCH_FUNCS_EXT(add, OP_ADD),
+    GEN_BENCH_FUNCS_EXT(sub, OP_SUB),
+    GEN_BENCH_FUNCS_EXT(mul, OP_MUL),
+    GEN_BENCH_FUNCS_EXT(div, OP_DIV),
     GEN_BENCH_FUNCS(fma, OP_FMA),
-    GEN_BENCH_FUNCS(sqrt, OP_SQRT),
-    GEN_BENCH_FUNCS(cmp, OP_CMP),
+    GEN_BENCH_FUNCS_EXT(sqrt, OP_SQRT),
+    GEN_BENCH_FUNCS_EXT(cmp, OP_CMP),
+    GEN_BENCH_FUNCS_EXT(to_int, OP_TO_INT),
+    GEN_BENCH_FUNCS_EXT(from_int, OP_FROM_INT),
+    GEN_BENCH_FUNCS_EXT(cvt, OP_CVT),
 };
 
+#undef GEN_BENCH_FUNCS_EXT
 #undef GEN_BENCH_FUNCS
 
 static void run_bench(void)
@@ -416,7 +624,13 @@ static void run_bench(void)
     bench_func_t f;
 
     f = bench_funcs[operation][precision];
-    g_assert(f);
+    if (!f) {
+        fprintf(stderr, "fatal: '%s' is not supported at this precision\n",
+                op_names[operation]);
+        exit(EXIT_FAILURE);
+    }
+    n_completed_ops = 0;
+    ns_elapsed = 0;
     f();
 }
 
@@ -445,10 +659,14 @@ static void usage_complete(int argc, char *argv[])
     fprintf(stderr, " -h = show this help message.\n");
     fprintf(stderr, " -o = floating point operation (%s). Default: %s\n",
             op_list, op_names[0]);
-    fprintf(stderr, " -p = floating point precision (single, double). "
-            "Default: single\n");
-    fprintf(stderr, " -r = rounding mode (even, zero, down, up, tieaway). "
-            "Default: even\n");
+    fprintf(stderr, " -p = floating point precision (single, double, "
+            "extended, quad). Default: single\n");
+    fprintf(stderr, "      extended and quad are only supported by the "
+            "soft tester.\n");
+    fprintf(stderr, " -r = rounding mode (even, zero, down, up, tieaway, "
+            "all). Default: even\n");
+    fprintf(stderr, "      all runs the benchmark once per rounding mode "
+            "supported by the tester.\n");
     fprintf(stderr, " -t = tester (%s). Default: %s\n",
             tester_list, tester_names[0]);
     fprintf(stderr, " -z = flush inputs to zero (soft tester only). "
@@ -464,7 +682,7 @@ static int round_name_to_mode(const char *name)
 {
     int i;
 
-    for (i = 0; i < N_ROUND_MODES; i++) {
+    for (i = 0; i <= ROUND_ALL; i++) {
         if (!strcmp(round_names[i], name)) {
             return i;
         }
@@ -534,11 +752,24 @@ static void set_soft_precision(enum rounding rounding)
     soft_status.float_rounding_mode = mode;
 }
 
+static void set_rounding(enum rounding r)
+{
+    switch (tester) {
+    case TESTER_HOST:
+        set_host_precision(r);
+        break;
+    case TESTER_SOFT:
+        set_soft_precision(r);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
 static void parse_args(int argc, char *argv[])
 {
     int c;
     int val;
-    int rounding = ROUND_EVEN;
 
     for (;;) {
         c = getopt(argc, argv, "d:ho:p:r:t:zZ");
@@ -565,6 +796,10 @@ static void parse_args(int argc, char *argv[])
                 precision = PREC_SINGLE;
             } else if (!strcmp(optarg, "double")) {
                 precision = PREC_DOUBLE;
+            } else if (!strcmp(optarg, "extended")) {
+                precision = PREC_FLOATX80;
+            } else if (!strcmp(optarg, "quad")) {
+                precision = PREC_FLOAT128;
             } else {
                 fprintf(stderr, "Unsupported precision '%s'\n", optarg);
                 exit(EXIT_FAILURE);
@@ -594,13 +829,16 @@ static void parse_args(int argc, char *argv[])
         }
     }
 
-    /* set precision and rounding mode based on the tester */
+    /* set precision based on the tester */
     switch (tester) {
     case TESTER_HOST:
-        set_host_precision(rounding);
+        if (precision == PREC_FLOATX80 || precision == PREC_FLOAT128) {
+            fprintf(stderr, "fatal: extended and quad precision are only "
+                    "supported by the soft tester\n");
+            exit(EXIT_FAILURE);
+        }
         break;
     case TESTER_SOFT:
-        set_soft_precision(rounding);
         switch (precision) {
         case PREC_SINGLE:
             precision = PREC_FLOAT32;
@@ -608,6 +846,9 @@ static void parse_args(int argc, char *argv[])
         case PREC_DOUBLE:
             precision = PREC_FLOAT64;
             break;
+        case PREC_FLOATX80:
+        case PREC_FLOAT128:
+            break;
         default:
             g_assert_not_reached();
         }
@@ -624,8 +865,24 @@ static void pr_stats(void)
 
 int main(int argc, char *argv[])
 {
+    int i;
+
     parse_args(argc, argv);
-    run_bench();
-    pr_stats();
+    if (rounding != ROUND_ALL) {
+        set_rounding(rounding);
+        run_bench();
+        pr_stats();
+        return 0;
+    }
+    for (i = 0; i < N_ROUND_MODES; i++) {
+        /* the host has no tie-away rounding */
+        if (tester == TESTER_HOST && i == ROUND_TIEAWAY) {
+            continue;
+        }
+        set_rounding(i);
+        run_bench();
+        printf("%-8s ", round_names[i]);
+        pr_stats();
+    }
     return 0;
 }
@@ -19,6 +19,7 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 static uint64_t mem_count;
 static uint64_t io_count;
 static bool do_inline;
+static bool do_buffer;
 static bool do_haddr;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
@@ -49,6 +50,13 @@ static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
     }
 }
 
+static void vcpu_mem_buf(unsigned int cpu_index,
+                         const struct qemu_plugin_mem_record *recs,
+                         size_t n, void *udata)
+{
+    mem_count += n;
+}
+
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     size_t n = qemu_plugin_tb_n_insns(tb);
@@ -61,6 +69,8 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
             qemu_plugin_register_vcpu_mem_inline(insn, rw,
                                                  QEMU_PLUGIN_INLINE_ADD_U64,
                                                  &mem_count, 1);
+        } else if (do_buffer) {
+            qemu_plugin_register_vcpu_mem_buf(insn, rw);
         } else {
             qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem,
                                              QEMU_PLUGIN_CB_NO_REGS,
@@ -90,9 +100,14 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
         }
         if (!strcmp(argv[0], "inline")) {
             do_inline = true;
+        } else if (!strcmp(argv[0], "buffer")) {
+            do_buffer = true;
         }
     }
 
+    if (do_buffer) {
+        qemu_plugin_register_vcpu_mem_buf_cb(id, vcpu_mem_buf, NULL);
+    }
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
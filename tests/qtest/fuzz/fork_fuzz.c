@@ -12,8 +12,31 @@
  */
 
 #include "qemu/osdep.h"
+#include <sys/shm.h>
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/host-utils.h"
+#include "qemu/units.h"
 #include "fork_fuzz.h"
 
+/* The parts of the AFL++ fork server protocol that we speak */
+#define AFL_FORKSRV_FD          198
+#define AFL_SHM_ENV_VAR         "__AFL_SHM_ID"
+#define AFL_SHM_FUZZ_ENV_VAR    "__AFL_SHM_FUZZ_ID"
+#define AFL_FS_OPT_ENABLED      0x80000001
+#define AFL_FS_OPT_MAPSIZE      0x40000000
+#define AFL_FS_OPT_SHDMEM_FUZZ  0x01000000
+#define AFL_FS_OPT_SET_MAPSIZE(x) ((((x) - 1) << 1) & 0x00fffffe)
+
+#define AFL_MAP_SIZE_DEFAULT    (64 * KiB)
+#define AFL_MAP_SIZE_MAX        (8 * MiB)
+#define AFL_MAX_INPUT           (1 * MiB)
+
+static uint8_t *afl_area;
+static size_t afl_map_size = AFL_MAP_SIZE_DEFAULT;
+static uint32_t *afl_fuzz_len;
+static uint8_t *afl_fuzz_buf;
+
 
 void counter_shm_init(void)
 {
@@ -38,4 +61,154 @@ void counter_shm_init(void)
     free(copy);
 }
 
+bool afl_fuzz_enabled(void)
+{
+    return getenv(AFL_SHM_ENV_VAR) != NULL;
+}
+
+static void *afl_shmat(const char *env)
+{
+    void *p = shmat(atoi(getenv(env)), NULL, 0);
+
+    if (p == (void *)-1) {
+        fprintf(stderr, "Error: cannot attach %s: %s\n", env, strerror(errno));
+        exit(1);
+    }
+    return p;
+}
+
+static void afl_setup(void)
+{
+    const char *size = getenv("AFL_MAP_SIZE");
+    unsigned long sz;
+
+    /*
+     * The map only needs to be as large as the number of counters for
+     * every edge to get a byte of its own; AFL_MAP_SIZE can ask for that.
+     */
+    if (size && qemu_strtoul(size, NULL, 0, &sz) == 0 && sz > afl_map_size) {
+        afl_map_size = pow2ceil(MIN(sz, AFL_MAP_SIZE_MAX));
+    }
+    afl_area = afl_shmat(AFL_SHM_ENV_VAR);
+
+    /* Test cases in shared memory, instead of through stdin */
+    if (getenv(AFL_SHM_FUZZ_ENV_VAR)) {
+        afl_fuzz_len = afl_shmat(AFL_SHM_FUZZ_ENV_VAR);
+        afl_fuzz_buf = (uint8_t *)(afl_fuzz_len + 1);
+    }
+}
+
+/* Tell afl-fuzz that we're alive, and which options we use */
+static void afl_hello(void)
+{
+    uint32_t opts = AFL_FS_OPT_ENABLED;
+
+    if (afl_fuzz_len) {
+        opts |= AFL_FS_OPT_SHDMEM_FUZZ;
+    }
+    if (afl_map_size != AFL_MAP_SIZE_DEFAULT) {
+        opts |= AFL_FS_OPT_MAPSIZE | AFL_FS_OPT_SET_MAPSIZE(afl_map_size);
+    }
+    if (write(AFL_FORKSRV_FD + 1, &opts, 4) != 4) {
+        fprintf(stderr, "Error: afl-fuzz is not listening\n");
+        exit(1);
+    }
+    if (afl_fuzz_len && read(AFL_FORKSRV_FD, &opts, 4) != 4) {
+        exit(1);
+    }
+}
+
+/*
+ * Add the hit counts of the run to AFL's map.  The counters are laid out
+ * one per edge, so with a large enough map each edge has its own entry;
+ * otherwise they wrap around.  Most of the counters are zero, skip them
+ * eight at a time.
+ */
+static void afl_fold_counters(void)
+{
+    const uint8_t *cntrs = &__start___sancov_cntrs;
+    size_t n = &__stop___sancov_cntrs - cntrs;
+    size_t i, j;
+
+    for (i = 0; i < n; i += 8) {
+        if (i + 8 <= n && !ldq_he_p(cntrs + i)) {
+            continue;
+        }
+        for (j = i; j < MIN(i + 8, n); j++) {
+            uint8_t *p = &afl_area[j & (afl_map_size - 1)];
+
+            *p = MIN(*p + cntrs[j], UINT8_MAX);
+        }
+    }
+}
+
+static void QEMU_NORETURN afl_run_child(void (*run)(const uint8_t *data,
+                                                    size_t size))
+{
+    uint8_t *data;
+    size_t size = 0;
+    ssize_t len;
 
+    close(AFL_FORKSRV_FD);
+    close(AFL_FORKSRV_FD + 1);
+
+    if (afl_fuzz_len) {
+        data = afl_fuzz_buf;
+        size = *afl_fuzz_len;
+    } else {
+        data = g_malloc(AFL_MAX_INPUT);
+        while (size < AFL_MAX_INPUT) {
+            len = read(STDIN_FILENO, data + size, AFL_MAX_INPUT - size);
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            if (len <= 0) {
+                break;
+            }
+            size += len;
+        }
+    }
+
+    /*
+     * Only count what this test case hits.  Targets that fork themselves
+     * have made the counters shared with counter_shm_init(), so they are
+     * complete once run() returns.
+     */
+    memset(&__start___sancov_cntrs, 0,
+           &__stop___sancov_cntrs - &__start___sancov_cntrs);
+    run(data, size);
+    afl_fold_counters();
+    _Exit(0);
+}
+
+void afl_fuzz_main(void (*run)(const uint8_t *data, size_t size))
+{
+    afl_setup();
+    afl_hello();
+
+    for (;;) {
+        uint32_t was_killed;
+        int status;
+        pid_t pid;
+
+        /* afl-fuzz went away */
+        if (read(AFL_FORKSRV_FD, &was_killed, 4) != 4) {
+            exit(0);
+        }
+
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0) {
+            afl_run_child(run);
+        }
+
+        if (write(AFL_FORKSRV_FD + 1, &pid, 4) != 4 ||
+            waitpid(pid, &status, 0) < 0 ||
+            write(AFL_FORKSRV_FD + 1, &status, 4) != 4) {
+            exit(1);
+        }
+    }
+}
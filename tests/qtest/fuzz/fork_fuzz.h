@@ -16,8 +16,20 @@
 
 extern uint8_t __FUZZ_COUNTERS_START;
 extern uint8_t __FUZZ_COUNTERS_END;
+extern uint8_t __start___sancov_cntrs;
+extern uint8_t __stop___sancov_cntrs;
 
 void counter_shm_init(void);
 
+/*
+ * AFL mode: when started by afl-fuzz (__AFL_SHM_ID is set), act as an AFL
+ * fork server instead of returning to libFuzzer.  Every test case runs in
+ * a child forked from the initialized VM, and the sancov counters it hits
+ * are folded into AFL's shared coverage map.
+ */
+bool afl_fuzz_enabled(void);
+void QEMU_NORETURN afl_fuzz_main(void (*run)(const uint8_t *data,
+                                             size_t size));
+
 #endif
 
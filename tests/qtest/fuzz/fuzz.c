@@ -23,6 +23,7 @@
 #include "tests/qtest/libqos/libqtest.h"
 #include "tests/qtest/libqos/qgraph.h"
 #include "fuzz.h"
+#include "fork_fuzz.h"
 
 #define MAX_EVENT_LOOPS 10
 
@@ -151,6 +152,12 @@ int LLVMFuzzerTestOneInput(const unsigned char *Data, size_t Size)
     return 0;
 }
 
+/* Executed for each test case in AFL mode, in a freshly forked child */
+static void afl_run(const uint8_t *data, size_t size)
+{
+    fuzz_target->fuzz(fuzz_qts, data, size);
+}
+
 /* Executed once, prior to fuzzing */
 int LLVMFuzzerInitialize(int *argc, char ***argv, char ***envp)
 {
@@ -238,5 +245,17 @@ int LLVMFuzzerInitialize(int *argc, char ***argv, char ***envp)
     signal(SIGHUP, SIG_DFL);
     signal(SIGTERM, SIG_DFL);
 
+    /*
+     * Under afl-fuzz, libFuzzer's loop is never entered.  Do the
+     * pre-fuzz-initialization here, so that every forked test case
+     * starts from it.
+     */
+    if (afl_fuzz_enabled()) {
+        if (fuzz_target->pre_fuzz) {
+            fuzz_target->pre_fuzz(fuzz_qts);
+        }
+        afl_fuzz_main(afl_run);
+    }
+
     return 0;
 }
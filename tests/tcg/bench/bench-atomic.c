@@ -0,0 +1,66 @@
+/*
+ * TCG guest benchmark: atomics
+ *
+ * Atomic adds and compare-and-swap loops, first uncontended and then
+ * from several threads on the same cache line, which exercises the
+ * atomic helpers and, on hosts without the right instructions, the
+ * exclusive fallback.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "bench.h"
+
+#define N_THREADS 4
+#define N_OPS 100000
+
+static uint32_t counter32;
+static uint64_t counter64;
+static unsigned long repeat;
+
+static void do_atomics(void)
+{
+    unsigned long i;
+
+    for (i = 0; i < repeat * N_OPS; i++) {
+        uint32_t old = __atomic_load_n(&counter32, __ATOMIC_RELAXED);
+
+        __atomic_fetch_add(&counter64, 1, __ATOMIC_SEQ_CST);
+        while (!__atomic_compare_exchange_n(&counter32, &old, old + 1, false,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED)) {
+            continue;
+        }
+    }
+}
+
+static void *thread_fn(void *arg)
+{
+    do_atomics();
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[N_THREADS];
+    int i;
+
+    repeat = bench_repeat(argc, argv);
+    do_atomics();
+    for (i = 0; i < N_THREADS; i++) {
+        pthread_create(&threads[i], NULL, thread_fn, NULL);
+    }
+    for (i = 0; i < N_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (counter32 != (uint32_t)counter64 ||
+        counter64 != (N_THREADS + 1) * repeat * N_OPS) {
+        printf("atomic: mismatch\n");
+        return 1;
+    }
+    printf("atomic: %lu\n", (unsigned long)counter64);
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * TCG guest benchmark: CRC32
+ *
+ * A bit-at-a-time and a table driven CRC32 over a buffer: long chains
+ * of shifts, xors and dependent table loads.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "bench.h"
+
+#define BUF_SIZE 65536
+
+static uint8_t buf[BUF_SIZE];
+static uint32_t table[256];
+
+static uint32_t crc32_bitwise(uint32_t crc, const uint8_t *p, size_t len)
+{
+    int k;
+
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t crc32_table(uint32_t crc, const uint8_t *p, size_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n = bench_repeat(argc, argv);
+    uint32_t seed = 1, crc = 0;
+    unsigned long i;
+    int j;
+
+    for (i = 0; i < 256; i++) {
+        uint32_t c = i;
+
+        for (j = 0; j < 8; j++) {
+            c = c & 1 ? (c >> 1) ^ 0xedb88320 : c >> 1;
+        }
+        table[i] = c;
+    }
+    for (i = 0; i < BUF_SIZE; i++) {
+        buf[i] = bench_rand(&seed);
+    }
+    for (i = 0; i < n; i++) {
+        crc = crc32_bitwise(crc, buf, BUF_SIZE / 8);
+        crc = crc32_table(crc, buf, BUF_SIZE);
+    }
+    printf("crc32: %08x\n", crc);
+    return 0;
+}
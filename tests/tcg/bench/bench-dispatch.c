@@ -0,0 +1,141 @@
+/*
+ * TCG guest benchmark: interpreter dispatch
+ *
+ * A small bytecode interpreter, run once with a switch and once with a
+ * table of function pointers.  Both are dominated by indirect branches,
+ * which stress the TB lookup and chaining paths rather than the code
+ * generated for each instruction.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "bench.h"
+
+enum { OP_ADD, OP_SUB, OP_XOR, OP_SHL, OP_SHR, OP_MUL, OP_NEG, OP_SWAP, N_OPS };
+
+#define PROG_SIZE 4096
+
+static uint8_t prog[PROG_SIZE];
+
+typedef struct BenchVM {
+    uint32_t a, b;
+} BenchVM;
+
+static __attribute__((noinline)) uint32_t run_switch(BenchVM *vm)
+{
+    int pc;
+
+    for (pc = 0; pc < PROG_SIZE; pc++) {
+        uint32_t t;
+
+        switch (prog[pc]) {
+        case OP_ADD:
+            vm->a += vm->b;
+            break;
+        case OP_SUB:
+            vm->a -= vm->b;
+            break;
+        case OP_XOR:
+            vm->a ^= vm->b;
+            break;
+        case OP_SHL:
+            vm->a <<= vm->b & 7;
+            break;
+        case OP_SHR:
+            vm->a >>= vm->b & 7;
+            break;
+        case OP_MUL:
+            vm->a *= vm->b | 1;
+            break;
+        case OP_NEG:
+            vm->a = -vm->a;
+            break;
+        case OP_SWAP:
+            t = vm->a;
+            vm->a = vm->b + 1;
+            vm->b = t;
+            break;
+        }
+    }
+    return vm->a;
+}
+
+static void op_add(BenchVM *vm)
+{
+    vm->a += vm->b;
+}
+
+static void op_sub(BenchVM *vm)
+{
+    vm->a -= vm->b;
+}
+
+static void op_xor(BenchVM *vm)
+{
+    vm->a ^= vm->b;
+}
+
+static void op_shl(BenchVM *vm)
+{
+    vm->a <<= vm->b & 7;
+}
+
+static void op_shr(BenchVM *vm)
+{
+    vm->a >>= vm->b & 7;
+}
+
+static void op_mul(BenchVM *vm)
+{
+    vm->a *= vm->b | 1;
+}
+
+static void op_neg(BenchVM *vm)
+{
+    vm->a = -vm->a;
+}
+
+static void op_swap(BenchVM *vm)
+{
+    uint32_t t = vm->a;
+
+    vm->a = vm->b + 1;
+    vm->b = t;
+}
+
+static void (*const ops[N_OPS])(BenchVM *vm) = {
+    op_add, op_sub, op_xor, op_shl, op_shr, op_mul, op_neg, op_swap,
+};
+
+static __attribute__((noinline)) uint32_t run_table(BenchVM *vm)
+{
+    int pc;
+
+    for (pc = 0; pc < PROG_SIZE; pc++) {
+        ops[prog[pc]](vm);
+    }
+    return vm->a;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n = bench_repeat(argc, argv);
+    BenchVM vm1 = { 1, 2 }, vm2 = { 1, 2 };
+    uint32_t seed = 1;
+    unsigned long i;
+
+    for (i = 0; i < PROG_SIZE; i++) {
+        prog[i] = bench_rand(&seed) % N_OPS;
+    }
+    for (i = 0; i < n * 64; i++) {
+        run_switch(&vm1);
+        run_table(&vm2);
+    }
+    if (vm1.a != vm2.a || vm1.b != vm2.b) {
+        printf("dispatch: mismatch\n");
+        return 1;
+    }
+    printf("dispatch: %08x %08x\n", vm1.a, vm1.b);
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * TCG guest benchmark: floating point loops
+ *
+ * Dot products, polynomial evaluation, division and square roots in
+ * single and double precision.  On most targets every operation is a
+ * softfloat helper call, so this measures the helper call overhead as
+ * much as softfloat itself.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <math.h>
+#include "bench.h"
+
+#define N 1024
+
+static double xd[N], yd[N];
+static float xf[N], yf[N];
+
+static double __attribute__((noinline)) kernel_double(void)
+{
+    double dot = 0, poly = 0, quot = 0, root = 0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        double x = xd[i];
+
+        dot += x * yd[i];
+        poly += ((0.25 * x + 0.5) * x - 1.5) * x + 2.0;
+        quot += yd[i] / (x + 2.0);
+        root += sqrt(x + 1.0);
+    }
+    return dot + poly + quot + root;
+}
+
+static float __attribute__((noinline)) kernel_float(void)
+{
+    float dot = 0, poly = 0, quot = 0, root = 0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        float x = xf[i];
+
+        dot += x * yf[i];
+        poly += ((0.25f * x + 0.5f) * x - 1.5f) * x + 2.0f;
+        quot += yf[i] / (x + 2.0f);
+        root += sqrtf(x + 1.0f);
+    }
+    return dot + poly + quot + root;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n = bench_repeat(argc, argv);
+    double sd = 0;
+    float sf = 0;
+    uint32_t seed = 1;
+    unsigned long i;
+
+    for (i = 0; i < N; i++) {
+        xd[i] = xf[i] = (bench_rand(&seed) & 0xffff) / 65536.0;
+        yd[i] = yf[i] = (bench_rand(&seed) & 0xffff) / 65536.0;
+    }
+    for (i = 0; i < n * 16; i++) {
+        sd += kernel_double();
+        sf += kernel_float();
+    }
+    printf("fp: %.6e %.6e\n", sd, (double)sf);
+    return 0;
+}
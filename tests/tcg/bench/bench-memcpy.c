@@ -0,0 +1,66 @@
+/*
+ * TCG guest benchmark: memory copies
+ *
+ * Copies with the C library and with byte and word loops, at sizes
+ * from a few bytes to well beyond the softmmu TLB reach, to exercise
+ * the load/store fast paths of the backends.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <string.h>
+#include "bench.h"
+
+#define BUF_SIZE (1 << 20)
+
+static uint8_t src[BUF_SIZE], dst[BUF_SIZE];
+
+static void __attribute__((noinline)) copy_bytes(uint8_t *d, const uint8_t *s,
+                                                 size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        d[i] = s[i];
+    }
+}
+
+static void __attribute__((noinline)) copy_words(uint32_t *d,
+                                                 const uint32_t *s,
+                                                 size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len / 4; i++) {
+        d[i] = s[i];
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t sizes[] = { 16, 256, 4096, 65536, BUF_SIZE / 4 };
+    unsigned long n = bench_repeat(argc, argv);
+    uint32_t seed = 1, sum = 0;
+    unsigned long i;
+    size_t j, k;
+
+    for (j = 0; j < BUF_SIZE; j++) {
+        src[j] = bench_rand(&seed);
+    }
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+            size_t len = sizes[j];
+
+            for (k = 0; k + 3 * len <= BUF_SIZE; k += len * 4) {
+                memcpy(dst + k, src + k, len);
+                copy_bytes(dst + k + len, src + k, len);
+                copy_words((uint32_t *)(dst + k + 2 * len),
+                           (const uint32_t *)(src + k), len);
+            }
+            sum += dst[(i * 37 + j) % BUF_SIZE];
+        }
+    }
+    printf("memcpy: %08x\n", sum);
+    return 0;
+}
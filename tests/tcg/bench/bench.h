@@ -0,0 +1,38 @@
+/*
+ * Common helpers for the TCG guest benchmarks
+ *
+ * Every benchmark takes an optional repeat count as its only argument,
+ * so that "make check-tcg" can run it quickly as a smoke test while
+ * tcg-bench.py runs it long enough to get stable timings.  The result
+ * is printed so that the compiler cannot drop the work and so that the
+ * output can be compared between targets.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TCG_BENCH_H
+#define TCG_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+static inline unsigned long bench_repeat(int argc, char **argv)
+{
+    return argc > 1 ? atol(argv[1]) : 1;
+}
+
+/* xorshift, so that the inputs are the same on every target */
+static inline uint32_t bench_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+#
+# Run the TCG guest benchmarks and report the cost of each guest instruction
+#
+# Each benchmark is timed a few times under linux-user QEMU and the best
+# run is kept.  The number of guest instructions it executes is counted
+# in a separate run with the insn plugin, as the plugin itself slows the
+# guest down.  The result is the host time per guest instruction, which
+# only moves when the code generated by the frontend, tcg/optimize.c or
+# the backend does.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def run_timed(cmd):
+    t0 = time.perf_counter()
+    subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+    return time.perf_counter() - t0
+
+
+def count_insns(args, bench):
+    with tempfile.NamedTemporaryFile(mode='r', suffix='.pout') as log:
+        subprocess.run([args.qemu, '-plugin', args.plugin + ',arg=inline',
+                        '-d', 'plugin', '-D', log.name,
+                        bench, str(args.repeat)],
+                       check=True, stdout=subprocess.DEVNULL)
+        m = re.search(r'insns: (\d+)', log.read())
+    return int(m.group(1)) if m else None
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Measure host time per guest instruction')
+    parser.add_argument('--qemu', required=True,
+                        help='linux-user QEMU binary')
+    parser.add_argument('--plugin',
+                        help='path to libinsn.so, to count instructions')
+    parser.add_argument('--target', default='',
+                        help='target name, for the report')
+    parser.add_argument('--repeat', type=int, default=200,
+                        help='repeat count passed to each benchmark')
+    parser.add_argument('--runs', type=int, default=3,
+                        help='timed runs of each benchmark, the best is kept')
+    parser.add_argument('benchmarks', nargs='+')
+    args = parser.parse_args()
+
+    print('{:<10} {:<16} {:>10} {:>14} {:>10}'.format(
+        'target', 'benchmark', 'seconds', 'guest insns', 'ns/insn'))
+    for bench in args.benchmarks:
+        cmd = [args.qemu, bench, str(args.repeat)]
+        secs = min(run_timed(cmd) for _ in range(args.runs))
+        insns = count_insns(args, bench) if args.plugin else None
+        print('{:<10} {:<16} {:>10.3f} {:>14} {:>10}'.format(
+            args.target, os.path.basename(bench), secs,
+            insns if insns else '-',
+            '{:.3f}'.format(secs * 1e9 / insns) if insns else '-'))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -567,6 +567,40 @@ static void test_discard_back_undo(void)
     iov_free(iov, iov_cnt);
 }
 
+static void test_qiov_grow(void)
+{
+    QEMUIOVector qiov;
+    char buf[3];
+
+    /* The first element is stored inline */
+    qemu_iovec_init(&qiov, 1);
+    qemu_iovec_add(&qiov, &buf[0], 1);
+    g_assert(qiov.iov == &qiov.local_iov);
+    g_assert_cmpint(qiov.niov, ==, 1);
+    g_assert_cmpuint(qiov.size, ==, 1);
+
+    /* Further elements move the vector to the heap */
+    qemu_iovec_add(&qiov, &buf[1], 2);
+    g_assert(qiov.iov != &qiov.local_iov);
+    g_assert_cmpint(qiov.niov, ==, 2);
+    g_assert_cmpuint(qiov.size, ==, 3);
+    g_assert(qiov.iov[0].iov_base == &buf[0]);
+    g_assert_cmpuint(qiov.iov[0].iov_len, ==, 1);
+    g_assert(qiov.iov[1].iov_base == &buf[1]);
+    g_assert_cmpuint(qiov.iov[1].iov_len, ==, 2);
+    qemu_iovec_destroy(&qiov);
+
+    /* Reset keeps the inline storage usable */
+    qemu_iovec_init(&qiov, 0);
+    qemu_iovec_add(&qiov, buf, 3);
+    qemu_iovec_reset(&qiov);
+    g_assert_cmpuint(qiov.size, ==, 0);
+    qemu_iovec_add(&qiov, buf, 2);
+    g_assert(qiov.iov == &qiov.local_iov);
+    g_assert_cmpuint(qiov.size, ==, 2);
+    qemu_iovec_destroy(&qiov);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -577,5 +611,6 @@ int main(int argc, char **argv)
     g_test_add_func("/basic/iov/discard-back", test_discard_back);
     g_test_add_func("/basic/iov/discard-front-undo", test_discard_front_undo);
     g_test_add_func("/basic/iov/discard-back-undo", test_discard_back_undo);
+    g_test_add_func("/basic/iov/qiov-grow", test_qiov_grow);
     return g_test_run();
 }
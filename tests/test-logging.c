@@ -178,6 +178,27 @@ static void test_logfile_lock(gconstpointer data)
     qemu_log_unlock(logfile);
 }
 
+static void test_logfile_buffered(gconstpointer data)
+{
+    gchar const *dir = data;
+    g_autofree gchar *file_path = NULL;
+    g_autofree gchar *contents = NULL;
+
+    file_path = g_build_filename(dir, "qemu_test_log_buffered.log", NULL);
+    qemu_set_log(CPU_LOG_EXEC);
+    qemu_set_log_filename(file_path, &error_abort);
+
+    /* Lines logged by the same thread must stay in order */
+    g_assert_cmpint(qemu_log_buffered("buffered %d\n", 1), ==, 11);
+    qemu_log("unbuffered\n");
+    qemu_log_buffered("buffered %d\n", 2);
+
+    /* Closing the log writes out what every thread still holds */
+    qemu_log_close();
+    g_assert(g_file_get_contents(file_path, &contents, NULL, NULL));
+    g_assert_cmpstr(contents, ==, "buffered 1\nunbuffered\nbuffered 2\n");
+}
+
 /* Remove a directory and all its entries (non-recursive). */
 static void rmdir_full(gchar const *root)
 {
@@ -208,6 +229,8 @@ int main(int argc, char **argv)
                          tmp_path, test_logfile_write);
     g_test_add_data_func("/logging/logfile_lock_path",
                          tmp_path, test_logfile_lock);
+    g_test_add_data_func("/logging/logfile_buffered",
+                         tmp_path, test_logfile_buffered);
 
     rc = g_test_run();
     qemu_log_close();
@@ -30,6 +30,7 @@
 #include "../migration/qemu-file.h"
 #include "../migration/qemu-file-channel.h"
 #include "../migration/savevm.h"
+#include "qemu/bswap.h"
 #include "qemu/coroutine.h"
 #include "qemu/module.h"
 #include "io/channel-file.h"
@@ -332,6 +333,46 @@ static void test_simple_array(void)
                          sizeof(wire_simple_arr)));
 }
 
+#define LARGE_ARR_LEN 200
+
+typedef struct TestLargeArray {
+    uint64_t u64[LARGE_ARR_LEN];
+} TestLargeArray;
+
+static const VMStateDescription vmstate_large_arr = {
+    .name = "simple/large_array",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT64_ARRAY(u64, TestLargeArray, LARGE_ARR_LEN),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+/* Larger than the bounce buffer used to transfer arrays of integers */
+static void test_large_array(void)
+{
+    TestLargeArray obj, obj_load;
+    uint8_t wire[LARGE_ARR_LEN * 8 + 1];
+    int i;
+
+    for (i = 0; i < LARGE_ARR_LEN; i++) {
+        obj.u64[i] = 0x0102030405060708ULL * i;
+        stq_be_p(wire + i * 8, obj.u64[i]);
+    }
+    wire[LARGE_ARR_LEN * 8] = QEMU_VM_EOF;
+
+    save_vmstate(&vmstate_large_arr, &obj);
+    compare_vmstate(wire, sizeof(wire));
+
+    memset(&obj_load, 0, sizeof(obj_load));
+    FAILURE(load_vmstate_one(&vmstate_large_arr, &obj_load, 1, wire,
+                             sizeof(wire) / 2));
+    SUCCESS(load_vmstate_one(&vmstate_large_arr, &obj_load, 1, wire,
+                             sizeof(wire)));
+    SUCCESS(memcmp(&obj, &obj_load, sizeof(obj)));
+}
+
 typedef struct TestStruct {
     uint32_t a, b, c, e;
     uint64_t d, f;
@@ -1494,6 +1535,7 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/vmstate/simple/primitive", test_simple_primitive);
     g_test_add_func("/vmstate/simple/array", test_simple_array);
+    g_test_add_func("/vmstate/simple/large_array", test_large_array);
     g_test_add_func("/vmstate/versioned/load/v1", test_load_v1);
     g_test_add_func("/vmstate/versioned/load/v2", test_load_v2);
     g_test_add_func("/vmstate/field_exists/load/noskip", test_load_noskip);
@@ -60,6 +60,38 @@ static const argtype *thunk_type_next_ptr(const argtype *type_ptr)
     return thunk_type_next(type_ptr);
 }
 
+/*
+ * Returns true if values of the given type have the same representation
+ * on the host and the target, so that converting them is a plain copy.
+ */
+static bool thunk_type_identity(const argtype *type_ptr)
+{
+    switch (*type_ptr) {
+    case TYPE_CHAR:
+        return true;
+#ifndef BSWAP_NEEDED
+    case TYPE_SHORT:
+    case TYPE_INT:
+    case TYPE_LONGLONG:
+    case TYPE_ULONGLONG:
+        return true;
+    case TYPE_LONG:
+    case TYPE_ULONG:
+    case TYPE_PTRVOID:
+        return HOST_LONG_BITS == TARGET_ABI_BITS;
+    case TYPE_OLDDEVT:
+        return thunk_type_size(type_ptr, THUNK_HOST) ==
+               thunk_type_size(type_ptr, THUNK_TARGET);
+#endif
+    case TYPE_ARRAY:
+        return thunk_type_identity(type_ptr + 2);
+    case TYPE_STRUCT:
+        return struct_entries[type_ptr[1]].identity;
+    default:
+        return false;
+    }
+}
+
 void thunk_register_struct(int id, const char *name, const argtype *types)
 {
     const argtype *type_ptr;
@@ -109,6 +141,15 @@ void thunk_register_struct(int id, const char *name, const argtype *types)
                i == THUNK_HOST ? "host" : "target", offset, max_align);
 #endif
     }
+
+    se->identity = se->size[THUNK_HOST] == se->size[THUNK_TARGET];
+    type_ptr = se->field_types;
+    for (j = 0; j < nb_fields && se->identity; j++) {
+        se->identity = se->field_offsets[THUNK_HOST][j] ==
+                       se->field_offsets[THUNK_TARGET][j] &&
+                       thunk_type_identity(type_ptr);
+        type_ptr = thunk_type_next(type_ptr);
+    }
 }
 
 void thunk_register_struct_direct(int id, const char *name,
@@ -225,6 +266,11 @@ const argtype *thunk_convert(void *dst, const void *src,
             array_length = *type_ptr++;
             dst_size = thunk_type_size(type_ptr, to_host);
             src_size = thunk_type_size(type_ptr, 1 - to_host);
+            if (thunk_type_identity(type_ptr)) {
+                memcpy(dst, src, array_length * dst_size);
+                type_ptr = thunk_type_next(type_ptr);
+                break;
+            }
             d = dst;
             s = src;
             for(i = 0;i < array_length; i++) {
@@ -246,7 +292,9 @@ const argtype *thunk_convert(void *dst, const void *src,
 
             assert(*type_ptr < max_struct_entries);
             se = struct_entries + *type_ptr++;
-            if (se->convert[0] != NULL) {
+            if (se->identity) {
+                memcpy(dst, src, se->size[to_host]);
+            } else if (se->convert[0] != NULL) {
                 /* specific conversion is needed */
                 (*se->convert[to_host])(dst, src);
             } else {
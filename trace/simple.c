@@ -12,6 +12,7 @@
 #ifndef _WIN32
 #include <pthread.h>
 #endif
+#include "qemu/queue.h"
 #include "qemu/timer.h"
 #include "trace/control.h"
 #include "trace/simple.h"
@@ -49,9 +50,37 @@ enum {
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
+/*
+ * Each thread that emits trace events gets its own trace buffer, so that
+ * threads do not contend on the same buffer index and cache lines.  Space
+ * in a buffer is still claimed with an atomic operation, because an event
+ * can also be emitted from a signal handler that interrupted its thread.
+ */
+typedef struct TraceThreadBuffer {
+    uint8_t buf[TRACE_BUF_LEN];
+    volatile gint idx;          /* claimed by the owning thread */
+    unsigned int writeout_idx;  /* advanced by the writeout thread */
+    volatile gint dead;         /* the owning thread exited */
+    QLIST_ENTRY(TraceThreadBuffer) next;
+} TraceThreadBuffer;
+
+/* Protects trace_buffers; held by the writeout thread while it drains them */
+static GMutex trace_buffers_lock;
+static QLIST_HEAD(, TraceThreadBuffer) trace_buffers =
+    QLIST_HEAD_INITIALIZER(trace_buffers);
+static __thread TraceThreadBuffer *trace_thread_buf;
+
+static void trace_thread_buf_release(gpointer opaque)
+{
+    TraceThreadBuffer *tb = opaque;
+
+    /* The writeout thread frees the buffer once it is empty */
+    trace_thread_buf = NULL;
+    g_atomic_int_set(&tb->dead, 1);
+}
+
+static GPrivate trace_thread_key = G_PRIVATE_INIT(trace_thread_buf_release);
+
 static volatile gint dropped_events;
 static uint32_t trace_pid;
 static FILE *trace_fp;
@@ -76,34 +105,63 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_buffer(TraceThreadBuffer *tb, unsigned int idx,
+                             void *dataptr, size_t size);
+static unsigned int write_to_buffer(TraceThreadBuffer *tb, unsigned int idx,
+                                    void *dataptr, size_t size);
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static void clear_buffer_range(TraceThreadBuffer *tb, unsigned int idx,
+                               size_t len)
 {
     uint32_t num = 0;
     while (num < len) {
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        trace_buf[idx++] = 0;
+        tb->buf[idx++] = 0;
         num++;
     }
 }
+
+/**
+ * Peek at the next trace record of a thread's buffer
+ *
+ * @tb          Trace buffer
+ * @timestamp   Filled with the timestamp of the record
+ *
+ * Returns false if the record is not valid.
+ */
+static bool peek_trace_record(TraceThreadBuffer *tb, uint64_t *timestamp)
+{
+    unsigned int idx = tb->writeout_idx % TRACE_BUF_LEN;
+    TraceRecord record;
+
+    read_from_buffer(tb, idx, &record, sizeof(record.event));
+    if (!(record.event & TRACE_RECORD_VALID)) {
+        return false;
+    }
+
+    smp_rmb(); /* read memory barrier before accessing record */
+    read_from_buffer(tb, idx, &record, sizeof(TraceRecord));
+    *timestamp = record.timestamp_ns;
+    return true;
+}
+
 /**
- * Read a trace record from the trace buffer
+ * Read a trace record from a thread's buffer
  *
- * @idx         Trace buffer index
+ * @tb          Trace buffer
  * @record      Trace record to fill
  *
  * Returns false if the record is not valid.
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static bool get_trace_record(TraceThreadBuffer *tb, TraceRecord **recordptr)
 {
+    unsigned int idx = tb->writeout_idx % TRACE_BUF_LEN;
     uint64_t event_flag = 0;
     TraceRecord record;
     /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    read_from_buffer(tb, idx, &record, sizeof(event_flag));
 
     if (!(record.event & TRACE_RECORD_VALID)) {
         return false;
@@ -111,17 +169,19 @@ static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
 
     smp_rmb(); /* read memory barrier before accessing record */
     /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
+    read_from_buffer(tb, idx, &record, sizeof(TraceRecord));
     *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
     /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
+    read_from_buffer(tb, idx, *recordptr, record.length);
     smp_rmb(); /* memory barrier before clearing valid flag */
     (*recordptr)->event &= ~TRACE_RECORD_VALID;
     /* clear the trace buffer range for consumed record otherwise any byte
      * with its MSB set may be considered as a valid event id when the writer
      * thread crosses this range of buffer again.
      */
-    clear_buffer_range(idx, record.length);
+    clear_buffer_range(tb, idx, record.length);
+    smp_wmb(); /* clear the range before handing it back to the writer */
+    tb->writeout_idx += record.length;
     return true;
 }
 
@@ -154,14 +214,54 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
-static gpointer writeout_thread(gpointer opaque)
+/*
+ * Write out the records of all threads in timestamp order, and free the
+ * buffers of threads that have exited.  Records of different threads are
+ * merged so that trace files keep increasing timestamps.
+ */
+static void writeout_thread_buffers(void)
 {
+    TraceThreadBuffer *tb, *next_tb;
     TraceRecord *recordptr;
+    uint64_t timestamp, next_timestamp = 0;
+    size_t unused __attribute__ ((unused));
+    uint64_t type = TRACE_RECORD_TYPE_EVENT;
+
+    g_mutex_lock(&trace_buffers_lock);
+    for (;;) {
+        next_tb = NULL;
+        QLIST_FOREACH(tb, &trace_buffers, next) {
+            if (peek_trace_record(tb, &timestamp) &&
+                (!next_tb || timestamp < next_timestamp)) {
+                next_tb = tb;
+                next_timestamp = timestamp;
+            }
+        }
+        if (!next_tb || !get_trace_record(next_tb, &recordptr)) {
+            break;
+        }
+
+        unused = fwrite(&type, sizeof(type), 1, trace_fp);
+        unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
+        free(recordptr); /* don't use g_free, can deadlock when traced */
+    }
+
+    QLIST_FOREACH_SAFE(tb, &trace_buffers, next, next_tb) {
+        if (g_atomic_int_get(&tb->dead) &&
+            (unsigned int)g_atomic_int_get(&tb->idx) == tb->writeout_idx) {
+            QLIST_REMOVE(tb, next);
+            free(tb);
+        }
+    }
+    g_mutex_unlock(&trace_buffers_lock);
+}
+
+static gpointer writeout_thread(gpointer opaque)
+{
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
     int dropped_count;
     size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
@@ -183,13 +283,7 @@ static gpointer writeout_thread(gpointer opaque)
             unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
-        }
+        writeout_thread_buffers();
 
         fflush(trace_fp);
     }
@@ -198,50 +292,83 @@ static gpointer writeout_thread(gpointer opaque)
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, &val,
+                                   sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, &slen,
+                                   sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, (void *)s, slen);
+}
+
+static TraceThreadBuffer *get_thread_buffer(void)
+{
+    TraceThreadBuffer *tb = trace_thread_buf;
+
+    if (likely(tb)) {
+        return tb;
+    }
+
+    /* don't use g_malloc, can deadlock when traced */
+    tb = calloc(1, sizeof(*tb));
+    if (!tb) {
+        return NULL;
+    }
+
+    g_mutex_lock(&trace_buffers_lock);
+    QLIST_INSERT_HEAD(&trace_buffers, tb, next);
+    g_mutex_unlock(&trace_buffers_lock);
+
+    g_private_set(&trace_thread_key, tb);
+    trace_thread_buf = tb;
+    return tb;
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
+    TraceThreadBuffer *tb = get_thread_buffer();
     unsigned int idx, rec_off, old_idx, new_idx;
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
     uint64_t event_u64 = event;
     uint64_t timestamp_ns = get_clock();
 
+    if (!tb) {
+        g_atomic_int_inc(&dropped_events);
+        return -ENOMEM;
+    }
+
     do {
-        old_idx = g_atomic_int_get(&trace_idx);
+        old_idx = g_atomic_int_get(&tb->idx);
         smp_rmb();
         new_idx = old_idx + rec_len;
 
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
+        if (new_idx - tb->writeout_idx > TRACE_BUF_LEN) {
             /* Trace Buffer Full, Event dropped ! */
             g_atomic_int_inc(&dropped_events);
             return -ENOSPC;
         }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    } while (!g_atomic_int_compare_and_exchange(&tb->idx, old_idx, new_idx));
 
     idx = old_idx % TRACE_BUF_LEN;
 
     rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    rec_off = write_to_buffer(tb, rec_off, &event_u64, sizeof(event_u64));
+    rec_off = write_to_buffer(tb, rec_off, &timestamp_ns, sizeof(timestamp_ns));
+    rec_off = write_to_buffer(tb, rec_off, &rec_len, sizeof(rec_len));
+    rec_off = write_to_buffer(tb, rec_off, &trace_pid, sizeof(trace_pid));
 
+    rec->tbuf = tb;
     rec->tbuf_idx = idx;
     rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+static void read_from_buffer(TraceThreadBuffer *tb, unsigned int idx,
+                             void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
@@ -249,11 +376,12 @@ static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        data_ptr[x++] = trace_buf[idx++];
+        data_ptr[x++] = tb->buf[idx++];
     }
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+static unsigned int write_to_buffer(TraceThreadBuffer *tb, unsigned int idx,
+                                    void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
@@ -261,20 +389,21 @@ static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        trace_buf[idx++] = data_ptr[x++];
+        tb->buf[idx++] = data_ptr[x++];
     }
     return idx; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
+    TraceThreadBuffer *tb = rec->tbuf;
     TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    read_from_buffer(tb, rec->tbuf_idx, &record, sizeof(TraceRecord));
     smp_wmb(); /* write barrier before marking as valid */
     record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    write_to_buffer(tb, rec->tbuf_idx, &record, sizeof(TraceRecord));
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
+    if (((unsigned int)g_atomic_int_get(&tb->idx) - tb->writeout_idx)
         > TRACE_BUF_FLUSH_THRESHOLD) {
         flush_trace_file(false);
     }
@@ -147,7 +147,16 @@ static void egl_scanout_flush(DisplayChangeListener *dcl,
         egl_fb_blit(&edpy->blit_fb, &edpy->guest_fb, edpy->y_0_top);
     }
 
-    egl_fb_read(edpy->ds, &edpy->blit_fb);
+    /*
+     * Only the flushed rectangle changed; reading back the whole frame
+     * would stall on the GPU for every small update.  The cursor is not
+     * part of the damage, so read everything while it is drawn in.
+     */
+    if (edpy->cursor_fb.texture) {
+        egl_fb_read(edpy->ds, &edpy->blit_fb);
+    } else {
+        egl_fb_read_rect(edpy->ds, &edpy->blit_fb, x, y, w, h);
+    }
     dpy_gfx_update(edpy->dcl.con, x, y, w, h);
 }
 
@@ -110,6 +110,26 @@ void egl_fb_read(DisplaySurface *dst, egl_fb *src)
                  GL_BGRA, GL_UNSIGNED_BYTE, surface_data(dst));
 }
 
+/* Read back only the given rectangle of @src, at the same place in @dst */
+void egl_fb_read_rect(DisplaySurface *dst, egl_fb *src,
+                      int x, int y, int w, int h)
+{
+    assert(surface_format(dst) == PIXMAN_x8r8g8b8);
+
+    w = MIN(w, surface_width(dst) - x);
+    h = MIN(h, surface_height(dst) - y);
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, src->framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+    glPixelStorei(GL_PACK_ROW_LENGTH, surface_stride(dst) / 4);
+    glReadPixels(x, y, w, h, GL_BGRA, GL_UNSIGNED_BYTE,
+                 surface_data(dst) + x * 4 + y * surface_stride(dst));
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+}
+
 void egl_texture_blit(QemuGLShader *gls, egl_fb *dst, egl_fb *src, bool flip)
 {
     glBindFramebuffer(GL_FRAMEBUFFER_EXT, dst->framebuffer);
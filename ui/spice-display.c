@@ -482,6 +482,20 @@ void qemu_spice_cursor_refresh_bh(void *opaque)
 
 void qemu_spice_display_refresh(SimpleSpiceDisplay *ssd)
 {
+    /*
+     * Nobody is looking: don't make the device render and convert the
+     * guest framebuffer.  Its dirty memory log keeps accumulating, but
+     * redraw everything once a client shows up to be safe.
+     */
+    if (!qemu_spice_have_clients()) {
+        ssd->skipped_refresh = true;
+        return;
+    }
+    if (ssd->skipped_refresh) {
+        ssd->skipped_refresh = false;
+        graphic_hw_invalidate(ssd->dcl.con);
+    }
+
     graphic_hw_update(ssd->dcl.con);
 
     WITH_QEMU_LOCK_GUARD(&ssd->lock) {
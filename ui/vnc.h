@@ -247,6 +247,7 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    bool running;   /* picked up by a worker thread */
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -301,6 +301,7 @@ static void aio_free_deleted_handlers(AioContext *ctx)
 static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
 {
     bool progress = false;
+    QSPBQLContext bql_ctx;
     int revents;
 
     revents = node->pfd.revents & node->pfd.events;
@@ -326,7 +327,9 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
         (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) &&
         aio_node_check(ctx, node->is_external) &&
         node->io_read) {
+        qsp_bql_context_push(&bql_ctx, "fd", node->io_read, NULL);
         node->io_read(node->opaque);
+        qsp_bql_context_pop(&bql_ctx);
 
         /* aio_notify() does not count as progress */
         if (node->opaque != &ctx->notifier) {
@@ -337,7 +340,9 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
         (revents & (G_IO_OUT | G_IO_ERR)) &&
         aio_node_check(ctx, node->is_external) &&
         node->io_write) {
+        qsp_bql_context_push(&bql_ctx, "fd", node->io_write, NULL);
         node->io_write(node->opaque);
+        qsp_bql_context_pop(&bql_ctx);
         progress = true;
     }
 
@@ -398,6 +403,7 @@ static bool run_poll_handlers_once(AioContext *ctx,
         if (aio_node_check(ctx, node->is_external) &&
             node->io_poll(node->opaque)) {
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
+            node->poll_ready = true;
 
             /*
              * Polling was successful, exit try_poll_mode immediately
@@ -473,6 +479,7 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
 {
     bool progress;
     int64_t start_time, elapsed_time;
+    int64_t iter_start, now;
 
     assert(qemu_lockcnt_count(&ctx->list_lock) > 0);
 
@@ -488,14 +495,27 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
      */
     RCU_READ_LOCK_GUARD();
 
-    start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    start_time = now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     do {
+        iter_start = now;
         progress = run_poll_handlers_once(ctx, start_time, timeout);
-        elapsed_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_time;
+        now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        elapsed_time = now - start_time;
         max_ns = qemu_soonest_timeout(*timeout, max_ns);
         assert(!(max_ns && progress));
     } while (elapsed_time < max_ns && !ctx->fdmon_ops->need_wait(ctx));
 
+    /*
+     * Only the round that found an event did useful work, in the ->io_poll()
+     * callback that processed it.  Everything before it was spinning.
+     */
+    if (progress) {
+        stat64_add(&ctx->poll_time_ns, iter_start - start_time);
+        stat64_add(&ctx->work_time_ns, now - iter_start);
+    } else {
+        stat64_add(&ctx->poll_time_ns, elapsed_time);
+    }
+
     if (remove_idle_poll_handlers(ctx, start_time + elapsed_time)) {
         *timeout = 0;
         progress = true;
@@ -523,12 +543,19 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
  */
 static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
 {
-    int64_t max_ns;
+    AioHandler *node;
+    int64_t max_ns = 0;
 
     if (QLIST_EMPTY_RCU(&ctx->poll_aio_handlers)) {
         return false;
     }
 
+    /* Poll for as long as the handler that profits most from it wants */
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        max_ns = MAX(max_ns, node->poll_ns);
+    }
+    ctx->poll_ns = MIN(max_ns, ctx->poll_max_ns);
+
     max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         poll_set_started(ctx, true);
@@ -546,6 +573,57 @@ static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
     return false;
 }
 
+/*
+ * adjust_polling_time:
+ * @ctx: the AioContext
+ * @node: a handler that takes part in userspace polling
+ * @block_ns: how long this aio_poll() waited for an event
+ *
+ * Each handler learns its own polling time: it grows while the handler's
+ * events arrive within ctx->poll_max_ns, and shrinks when we had to wait
+ * longer than that, whichever handler ended the wait.  A handler that is
+ * idle therefore stops costing CPU time without cutting the polling time
+ * of a busy neighbour.
+ */
+static void adjust_polling_time(AioContext *ctx, AioHandler *node,
+                                int64_t block_ns)
+{
+    if (block_ns <= node->poll_ns) {
+        /* This is the sweet spot, no adjustment needed */
+    } else if (block_ns > ctx->poll_max_ns) {
+        /* We'd have to poll for too long, poll less */
+        int64_t old = node->poll_ns;
+
+        if (ctx->poll_shrink) {
+            node->poll_ns /= ctx->poll_shrink;
+        } else {
+            node->poll_ns = 0;
+        }
+
+        trace_poll_shrink(ctx, node, old, node->poll_ns);
+    } else if (node->poll_ready && node->poll_ns < ctx->poll_max_ns) {
+        /* There is room to grow, poll longer */
+        int64_t old = node->poll_ns;
+        int64_t grow = ctx->poll_grow;
+
+        if (grow == 0) {
+            grow = 2;
+        }
+
+        if (node->poll_ns) {
+            node->poll_ns *= grow;
+        } else {
+            node->poll_ns = 4000; /* start polling at 4 microseconds */
+        }
+
+        if (node->poll_ns > ctx->poll_max_ns) {
+            node->poll_ns = ctx->poll_max_ns;
+        }
+
+        trace_poll_grow(ctx, node, old, node->poll_ns);
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
@@ -554,6 +632,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     bool use_notify_me;
     int64_t timeout;
     int64_t start = 0;
+    int64_t now = 0;
 
     /*
      * There cannot be two concurrent aio_poll calls for the same AioContext (or
@@ -603,7 +682,13 @@ bool aio_poll(AioContext *ctx, bool blocking)
     /* If polling is allowed, non-blocking aio_poll does not need the
      * system call---a single round of run_poll_handlers_once suffices.
      */
-    if (timeout || ctx->fdmon_ops->need_wait(ctx)) {
+    if (timeout) {
+        int64_t sleep_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+        ret = ctx->fdmon_ops->wait(ctx, &ready_list, timeout);
+        stat64_add(&ctx->sleep_time_ns,
+                   qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - sleep_start);
+    } else if (ctx->fdmon_ops->need_wait(ctx)) {
         ret = ctx->fdmon_ops->wait(ctx, &ready_list, timeout);
     }
 
@@ -617,42 +702,18 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     /* Adjust polling time */
     if (ctx->poll_max_ns) {
-        int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
-
-        if (block_ns <= ctx->poll_ns) {
-            /* This is the sweet spot, no adjustment needed */
-        } else if (block_ns > ctx->poll_max_ns) {
-            /* We'd have to poll for too long, poll less */
-            int64_t old = ctx->poll_ns;
-
-            if (ctx->poll_shrink) {
-                ctx->poll_ns /= ctx->poll_shrink;
-            } else {
-                ctx->poll_ns = 0;
-            }
-
-            trace_poll_shrink(ctx, old, ctx->poll_ns);
-        } else if (ctx->poll_ns < ctx->poll_max_ns &&
-                   block_ns < ctx->poll_max_ns) {
-            /* There is room to grow, poll longer */
-            int64_t old = ctx->poll_ns;
-            int64_t grow = ctx->poll_grow;
+        AioHandler *node;
 
-            if (grow == 0) {
-                grow = 2;
-            }
-
-            if (ctx->poll_ns) {
-                ctx->poll_ns *= grow;
-            } else {
-                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
-            }
+        now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
-            if (ctx->poll_ns > ctx->poll_max_ns) {
-                ctx->poll_ns = ctx->poll_max_ns;
+        QLIST_FOREACH(node, &ready_list, node_ready) {
+            if (QLIST_IS_INSERTED(node, node_poll)) {
+                node->poll_ready = true;
             }
-
-            trace_poll_grow(ctx, old, ctx->poll_ns);
+        }
+        QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+            adjust_polling_time(ctx, node, now - start);
+            node->poll_ready = false;
         }
     }
 
@@ -662,12 +723,20 @@ bool aio_poll(AioContext *ctx, bool blocking)
         progress |= aio_dispatch_ready_handlers(ctx, &ready_list);
     }
 
+    /* Completed aio_add_sqe() requests, reaped by the same wait */
+    progress |= fdmon_io_uring_dispatch(ctx);
+
     aio_free_deleted_handlers(ctx);
 
     qemu_lockcnt_dec(&ctx->list_lock);
 
     progress |= timerlistgroup_run_timers(&ctx->tlg);
 
+    if (now) {
+        stat64_add(&ctx->work_time_ns,
+                   qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - now);
+    }
+
     return progress;
 }
 
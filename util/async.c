@@ -133,7 +133,11 @@ QEMUBH *aio_bh_new(AioContext *ctx, QEMUBHFunc *cb, void *opaque)
 
 void aio_bh_call(QEMUBH *bh)
 {
+    QSPBQLContext bql_ctx;
+
+    qsp_bql_context_push(&bql_ctx, "bh", bh->cb, NULL);
     bh->cb(bh->opaque);
+    qsp_bql_context_pop(&bql_ctx);
 }
 
 /* Multiple occurrences of aio_bh_poll cannot be called concurrently. */
@@ -370,7 +374,8 @@ GSource *aio_get_g_source(AioContext *ctx)
 ThreadPool *aio_get_thread_pool(AioContext *ctx)
 {
     if (!ctx->thread_pool) {
-        ctx->thread_pool = thread_pool_new(ctx);
+        /* Pairs with qatomic_load_acquire() in query_one_iothread() */
+        qatomic_store_release(&ctx->thread_pool, thread_pool_new(ctx));
     }
     return ctx->thread_pool;
 }
@@ -397,11 +402,21 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 #ifdef CONFIG_LINUX_IO_URING
 LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
 {
+    bool shared;
+
     if (ctx->linux_io_uring) {
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    /*
+     * Share the ring that monitors file descriptors, unless the options
+     * ask for a ring set up differently
+     */
+    shared = aio_has_io_uring(ctx) && !ctx->linux_io_uring_fixed &&
+             !ctx->linux_io_uring_sqpoll;
+    ctx->linux_io_uring = luring_init(shared, ctx->linux_io_uring_fixed,
+                                      ctx->linux_io_uring_sqpoll,
+                                      ctx->linux_io_uring_sqpoll_idle, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -417,6 +432,49 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
 }
 #endif
 
+void aio_context_set_io_uring_params(AioContext *ctx, bool fixed, bool sqpoll,
+                                     uint32_t sqpoll_idle, Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (ctx->linux_io_uring) {
+        error_setg(errp, "io_uring parameters cannot be changed "
+                   "once the ring is in use");
+        return;
+    }
+    ctx->linux_io_uring_fixed = fixed;
+    ctx->linux_io_uring_sqpoll = sqpoll;
+    ctx->linux_io_uring_sqpoll_idle = sqpoll_idle;
+#else
+    if (fixed || sqpoll) {
+        error_setg(errp, "io_uring support is not compiled in");
+    }
+#endif
+}
+
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, Error **errp)
+{
+    if (min > max || max <= 0 || min < 0 || max > INT_MAX) {
+        error_setg(errp, "bad thread-pool-min/thread-pool-max values");
+        return;
+    }
+
+    ctx->thread_pool_min = min;
+    ctx->thread_pool_max = max;
+
+    if (ctx->thread_pool) {
+        thread_pool_update_params(ctx->thread_pool, ctx);
+    }
+}
+
+void aio_context_get_poll_stats(AioContext *ctx, uint64_t *poll_ns,
+                                uint64_t *work_ns, uint64_t *sleep_ns)
+{
+    *poll_ns = stat64_get(&ctx->poll_time_ns);
+    *work_ns = stat64_get(&ctx->work_time_ns);
+    *sleep_ns = stat64_get(&ctx->sleep_time_ns);
+}
+
 void aio_notify(AioContext *ctx)
 {
     /*
@@ -529,6 +587,8 @@ AioContext *aio_context_new(Error **errp)
 #endif
 
     ctx->thread_pool = NULL;
+    ctx->thread_pool_min = 0;
+    ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
     qemu_rec_mutex_init(&ctx->lock);
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
 
@@ -536,6 +596,9 @@ AioContext *aio_context_new(Error **errp)
     ctx->poll_max_ns = 0;
     ctx->poll_grow = 0;
     ctx->poll_shrink = 0;
+    stat64_init(&ctx->poll_time_ns, 0);
+    stat64_init(&ctx->work_time_ns, 0);
+    stat64_init(&ctx->sleep_time_ns, 0);
 
     return ctx;
 fail:
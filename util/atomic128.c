@@ -0,0 +1,64 @@
+/*
+ * Lock-based 128-bit compare-and-swap for hosts without one
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/atomic128.h"
+#include "qemu/thread.h"
+
+#if !HAVE_CMPXCHG128
+
+/*
+ * Set by the TCG accelerator.  Guest code that runs 128-bit atomics from
+ * many vCPUs then takes one of these locks instead of stopping the world;
+ * the price is that a concurrent narrower store to the same 16 bytes,
+ * which does not take the lock, may be lost.
+ */
+bool atomic16_lock_enabled;
+
+/*
+ * Unlike for atomic64.c, the hosts that get here may well have many
+ * cores, so use enough locks for unrelated addresses not to contend.
+ */
+#define NR_LOCKS 256
+
+static struct {
+    QemuSpin lock;
+} QEMU_ALIGNED(64) lock_array[NR_LOCKS];
+
+static QemuSpin *addr_to_lock(const void *addr)
+{
+    uintptr_t idx = (uintptr_t)addr >> 4;
+
+    idx ^= (idx >> 8) ^ (idx >> 16);
+    return &lock_array[idx & (NR_LOCKS - 1)].lock;
+}
+
+Int128 atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new)
+{
+    QemuSpin *lock = addr_to_lock(ptr);
+    uint64_t *p = (uint64_t *)ptr;
+    uint64_t w[2];
+    Int128 old;
+
+    qemu_spin_lock(lock);
+    /* Order like a host compare-and-swap, which is a full barrier.  */
+    smp_mb();
+    w[0] = qatomic_read_u64(&p[0]);
+    w[1] = qatomic_read_u64(&p[1]);
+    memcpy(&old, w, sizeof(old));
+    if (int128_eq(old, cmp)) {
+        memcpy(w, &new, sizeof(new));
+        qatomic_set_u64(&p[0], w[0]);
+        qatomic_set_u64(&p[1], w[1]);
+    }
+    /* ... before and after the memory accesses of the caller.  */
+    smp_mb();
+    qemu_spin_unlock(lock);
+    return old;
+}
+
+#endif
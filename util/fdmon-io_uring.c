@@ -19,9 +19,10 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
- * I/O.  Implementing disk I/O efficiently has other requirements and should
- * use a separate io_uring so it does not make sense to unify the code.
+ * Other users can submit their own requests on the same ring with
+ * aio_add_sqe(), for example disk I/O.  Their sqes are submitted with the
+ * next io_uring_enter(2) that waits for events, and their completions are
+ * reaped by it, so a request costs no syscall of its own.
  *
  * File descriptor monitoring is implemented using the following operations:
  *
@@ -38,14 +39,21 @@
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
  * The code is structured so that sq/cq rings are only modified within
- * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
- * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
- * and/or IORING_OP_POLL_REMOVE sqes for them.
+ * fdmon_io_uring_wait() and, outside of it, by aio_add_sqe() in the
+ * AioContext's home thread.  Changes to AioHandlers are made by enqueuing
+ * them on ctx->submit_list so that fdmon_io_uring_wait() can submit
+ * IORING_OP_POLL_ADD and/or IORING_OP_POLL_REMOVE sqes for them.
+ *
+ * While external clients are disabled, external AioHandlers that fire are
+ * parked on ctx->parked_list instead of being re-armed, and are re-armed
+ * once external clients are enabled again.  The ring keeps being used in
+ * the meantime so that aio_add_sqe() requests can complete.
  */
 
 #include "qemu/osdep.h"
 #include <poll.h>
 #include "qemu/rcu_queue.h"
+#include "block/aio-wait.h"
 #include "aio-posix.h"
 
 enum {
@@ -57,6 +65,12 @@ enum {
     FDMON_IO_URING_REMOVE   = (1 << 2),
 };
 
+/*
+ * Tags the user_data of aio_add_sqe() requests.  AioHandler pointers, used
+ * as user_data by IORING_OP_POLL_ADD, never have this bit set.
+ */
+#define FDMON_IO_URING_CQE_HANDLER 1
+
 static inline int poll_events_from_pfd(int pfd_events)
 {
     return (pfd_events & G_IO_IN ? POLLIN : 0) |
@@ -75,7 +89,7 @@ static inline int pfd_events_from_poll(int poll_events)
 
 /*
  * Returns an sqe for submitting a request.  Only be called within
- * fdmon_io_uring_wait().
+ * fdmon_io_uring_wait() or by aio_add_sqe().
  */
 static struct io_uring_sqe *get_sqe(AioContext *ctx)
 {
@@ -109,7 +123,10 @@ static void enqueue(AioHandlerSList *head, AioHandler *node, unsigned flags)
     }
 }
 
-/* Dequeue an AioHandler for sq ring submission.  Called by fill_sq_ring(). */
+/*
+ * Dequeue an AioHandler for sq ring submission.  Called by fill_sq_ring()
+ * and fdmon_io_uring_destroy().
+ */
 static AioHandler *dequeue(AioHandlerSList *head, unsigned *flags)
 {
     AioHandler *node = QSLIST_FIRST(head);
@@ -118,7 +135,10 @@ static AioHandler *dequeue(AioHandlerSList *head, unsigned *flags)
         return NULL;
     }
 
-    /* Doesn't need to be atomic since fill_sq_ring() moves the list */
+    /*
+     * Doesn't need to be atomic since fill_sq_ring() moves the list, and
+     * ctx->parked_list is only used by the AioContext's home thread.
+     */
     QSLIST_REMOVE_HEAD(head, node_submitted);
 
     /*
@@ -195,16 +215,12 @@ static void add_timeout_sqe(AioContext *ctx, int64_t ns)
     io_uring_prep_timeout(sqe, &ts, 1, 0);
 }
 
-/* Add sqes from ctx->submit_list for submission */
-static void fill_sq_ring(AioContext *ctx)
+static void fill_sq_ring_from_list(AioContext *ctx, AioHandlerSList *head)
 {
-    AioHandlerSList submit_list;
     AioHandler *node;
     unsigned flags;
 
-    QSLIST_MOVE_ATOMIC(&submit_list, &ctx->submit_list);
-
-    while ((node = dequeue(&submit_list, &flags))) {
+    while ((node = dequeue(head, &flags))) {
         /* Order matters, just in case both flags were set */
         if (flags & FDMON_IO_URING_ADD) {
             add_poll_add_sqe(ctx, node);
@@ -215,15 +231,60 @@ static void fill_sq_ring(AioContext *ctx)
     }
 }
 
+/*
+ * Add sqes from ctx->submit_list for submission, and from ctx->parked_list
+ * once external clients are enabled
+ */
+static void fill_sq_ring(AioContext *ctx)
+{
+    AioHandlerSList submit_list;
+
+    QSLIST_MOVE_ATOMIC(&submit_list, &ctx->submit_list);
+    fill_sq_ring_from_list(ctx, &submit_list);
+
+    if (!qatomic_read(&ctx->external_disable_cnt)) {
+        fill_sq_ring_from_list(ctx, &ctx->parked_list);
+    }
+}
+
+/*
+ * Keep an external AioHandler that fired while external clients are
+ * disabled away from the ring, otherwise re-arming it would report the
+ * same event over and over again.  fill_sq_ring() re-arms it later.
+ */
+static void park(AioContext *ctx, AioHandler *node)
+{
+    unsigned old_flags;
+
+    old_flags = qatomic_fetch_or(&node->flags, FDMON_IO_URING_PENDING |
+                                               FDMON_IO_URING_ADD);
+
+    /* Already on ctx->submit_list if a removal raced with us */
+    if (!(old_flags & FDMON_IO_URING_PENDING)) {
+        QSLIST_INSERT_HEAD(&ctx->parked_list, node, node_submitted);
+    }
+}
+
 /* Returns true if a handler became ready */
 static bool process_cqe(AioContext *ctx,
                         AioHandlerList *ready_list,
                         struct io_uring_cqe *cqe)
 {
-    AioHandler *node = io_uring_cqe_get_data(cqe);
+    AioHandler *node;
     unsigned flags;
 
+    if (cqe->user_data & FDMON_IO_URING_CQE_HANDLER) {
+        CqeHandler *cqe_handler = (CqeHandler *)(uintptr_t)
+            (cqe->user_data & ~(uint64_t)FDMON_IO_URING_CQE_HANDLER);
+
+        /* Dispatched by fdmon_io_uring_dispatch() */
+        cqe_handler->res = cqe->res;
+        QSIMPLEQ_INSERT_TAIL(&ctx->cqe_handler_ready_list, cqe_handler, next);
+        return false;
+    }
+
     /* poll_timeout and poll_remove have a zero user_data field */
+    node = io_uring_cqe_get_data(cqe);
     if (!node) {
         return false;
     }
@@ -239,6 +300,11 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    if (!aio_node_check(ctx, node->is_external)) {
+        park(ctx, node);
+        return false;
+    }
+
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
     /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
@@ -272,9 +338,12 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
     unsigned wait_nr = 1; /* block until at least one cqe is ready */
     int ret;
 
-    /* Fall back while external clients are disabled */
-    if (qatomic_read(&ctx->external_disable_cnt)) {
-        return fdmon_poll_ops.wait(ctx, ready_list, timeout);
+    /*
+     * Don't block while completed aio_add_sqe() requests wait for dispatch,
+     * which happens when called from a nested aio_poll()
+     */
+    if (!QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list)) {
+        timeout = 0;
     }
 
     if (timeout == 0) {
@@ -311,8 +380,14 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
         return true;
     }
 
-    /* Are we falling back to fdmon-poll? */
-    return qatomic_read(&ctx->external_disable_cnt);
+    /* Are there completed aio_add_sqe() requests left to dispatch? */
+    if (!QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list)) {
+        return true;
+    }
+
+    /* Do parked AioHandlers need to be re-armed? */
+    return !QSLIST_EMPTY(&ctx->parked_list) &&
+           !qatomic_read(&ctx->external_disable_cnt);
 }
 
 static const FDMonOps fdmon_io_uring_ops = {
@@ -321,40 +396,86 @@ static const FDMonOps fdmon_io_uring_ops = {
     .need_wait = fdmon_io_uring_need_wait,
 };
 
+bool aio_has_io_uring(AioContext *ctx)
+{
+    return ctx->fdmon_ops == &fdmon_io_uring_ops;
+}
+
+void aio_add_sqe(AioContext *ctx, CqeHandler *cqe_handler)
+{
+    struct io_uring_sqe *sqe;
+
+    assert(aio_has_io_uring(ctx));
+    assert(in_aio_context_home_thread(ctx));
+
+    sqe = get_sqe(ctx);
+    *sqe = cqe_handler->sqe;
+    sqe->user_data = (uintptr_t)cqe_handler | FDMON_IO_URING_CQE_HANDLER;
+}
+
+bool fdmon_io_uring_dispatch(AioContext *ctx)
+{
+    CqeHandler *cqe_handler;
+    bool progress = false;
+
+    /* Callbacks may run a nested aio_poll(), which continues the list */
+    while ((cqe_handler = QSIMPLEQ_FIRST(&ctx->cqe_handler_ready_list))) {
+        QSIMPLEQ_REMOVE_HEAD(&ctx->cqe_handler_ready_list, next);
+        cqe_handler->cb(cqe_handler);
+        progress = true;
+    }
+
+    return progress;
+}
+
 bool fdmon_io_uring_setup(AioContext *ctx)
 {
     int ret;
 
+    QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
+
     ret = io_uring_queue_init(FDMON_IO_URING_ENTRIES, &ctx->fdmon_io_uring, 0);
     if (ret != 0) {
         return false;
     }
 
     QSLIST_INIT(&ctx->submit_list);
+    QSLIST_INIT(&ctx->parked_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
 
+/* Move handlers due to be removed onto the deleted list */
+static void destroy_list(AioContext *ctx, AioHandlerSList *head)
+{
+    AioHandler *node;
+    unsigned flags;
+
+    while ((node = dequeue(head, &flags))) {
+        qatomic_and(&node->flags, ~FDMON_IO_URING_REMOVE);
+
+        if (flags & FDMON_IO_URING_REMOVE) {
+            QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node,
+                                  node_deleted);
+        }
+    }
+}
+
+/*
+ * aio_add_sqe() requests still in flight are lost, so users must have
+ * completed them.
+ */
 void fdmon_io_uring_destroy(AioContext *ctx)
 {
     if (ctx->fdmon_ops == &fdmon_io_uring_ops) {
-        AioHandler *node;
+        AioHandlerSList submit_list;
 
+        assert(QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list));
         io_uring_queue_exit(&ctx->fdmon_io_uring);
 
-        /* Move handlers due to be removed onto the deleted list */
-        while ((node = QSLIST_FIRST_RCU(&ctx->submit_list))) {
-            unsigned flags = qatomic_fetch_and(&node->flags,
-                    ~(FDMON_IO_URING_PENDING |
-                      FDMON_IO_URING_ADD |
-                      FDMON_IO_URING_REMOVE));
-
-            if (flags & FDMON_IO_URING_REMOVE) {
-                QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node, node_deleted);
-            }
-
-            QSLIST_REMOVE_HEAD_RCU(&ctx->submit_list, node_submitted);
-        }
+        QSLIST_MOVE_ATOMIC(&submit_list, &ctx->submit_list);
+        destroy_list(ctx, &submit_list);
+        destroy_list(ctx, &ctx->parked_list);
 
         ctx->fdmon_ops = &fdmon_poll_ops;
     }
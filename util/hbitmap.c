@@ -101,6 +101,139 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/* Word-scanning kernels for the last level.  The generic versions are
+ * portable C that the compiler is free to vectorize (this is what AArch64
+ * hosts use); x86 hosts with AVX2 switch to hand-written versions at
+ * startup.
+ */
+
+/* Return the index of the first word in [@pos, @sz) that is not all ones,
+ * or @sz if there is none.
+ */
+static size_t hb_find_not_full_int(const unsigned long *p, size_t pos,
+                                   size_t sz)
+{
+    while (pos + 4 <= sz &&
+           (p[pos] & p[pos + 1] & p[pos + 2] & p[pos + 3]) == ~0UL) {
+        pos += 4;
+    }
+    while (pos < sz && p[pos] == ~0UL) {
+        pos++;
+    }
+    return pos;
+}
+
+/* Store a[i] | b[i] into dst[i] for @n words, returning the number of bits
+ * set in the result.  @dst may alias @a or @b.
+ */
+static uint64_t hb_or_count_int(unsigned long *dst, const unsigned long *a,
+                                const unsigned long *b, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        unsigned long w = a[i] | b[i];
+        dst[i] = w;
+        count += ctpopl(w);
+    }
+    return count;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+#define HB_WORDS_PER_M256 (32 / sizeof(unsigned long))
+
+static size_t hb_find_not_full_avx2(const unsigned long *p, size_t pos,
+                                    size_t sz)
+{
+    const __m256i ones = _mm256_set1_epi32(-1);
+
+    /* Test 64 bytes at a time; the tail and the exact word are left to
+     * the integer version.
+     */
+    while (pos + 2 * HB_WORDS_PER_M256 <= sz) {
+        __m256i t = _mm256_and_si256(
+            _mm256_loadu_si256((const __m256i *)(p + pos)),
+            _mm256_loadu_si256((const __m256i *)(p + pos + HB_WORDS_PER_M256)));
+        if (!_mm256_testc_si256(t, ones)) {
+            break;
+        }
+        pos += 2 * HB_WORDS_PER_M256;
+    }
+    return hb_find_not_full_int(p, pos, sz);
+}
+
+static uint64_t hb_or_count_avx2(unsigned long *dst, const unsigned long *a,
+                                 const unsigned long *b, size_t n)
+{
+    /* Nibble lookup table for vpshufb-based population count.  */
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    uint64_t sums[4];
+    size_t i;
+
+    for (i = 0; i + HB_WORDS_PER_M256 <= n; i += HB_WORDS_PER_M256) {
+        __m256i w = _mm256_or_si256(
+            _mm256_loadu_si256((const __m256i *)(a + i)),
+            _mm256_loadu_si256((const __m256i *)(b + i)));
+        __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(w, low));
+        __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(
+                                             _mm256_srli_epi16(w, 4), low));
+
+        _mm256_storeu_si256((__m256i *)(dst + i), w);
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi),
+                                                    zero));
+    }
+
+    _mm256_storeu_si256((__m256i *)sums, acc);
+    return sums[0] + sums[1] + sums[2] + sums[3] +
+           hb_or_count_int(dst + i, a + i, b + i, n - i);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+static size_t (*hb_find_not_full)(const unsigned long *, size_t, size_t) =
+    hb_find_not_full_int;
+static uint64_t (*hb_or_count)(unsigned long *, const unsigned long *,
+                               const unsigned long *, size_t) =
+    hb_or_count_int;
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) hbitmap_init_accel(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+
+    if (max < 7) {
+        return;
+    }
+
+    __cpuid(1, a, b, c, d);
+
+    /* We must check that AVX is not just available, but usable.  */
+    if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+        int bv;
+        __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+        __cpuid_count(7, 0, a, b, c, d);
+        if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+            hb_find_not_full = hb_find_not_full_avx2;
+            hb_or_count = hb_or_count_avx2;
+        }
+    }
+}
+#endif /* CONFIG_AVX2_OPT */
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -245,10 +378,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_find_not_full(last_lev, pos + 1, sz);
         if (pos >= sz) {
             return -1;
         }
@@ -301,6 +431,22 @@ bool hbitmap_next_dirty_area(const HBitmap *hb, int64_t start, int64_t end,
     return true;
 }
 
+int hbitmap_next_dirty_areas(const HBitmap *hb, int64_t start, int64_t end,
+                             int64_t max_dirty_count,
+                             HBitmapArea *areas, int nb_areas)
+{
+    int n = 0;
+
+    while (n < nb_areas &&
+           hbitmap_next_dirty_area(hb, start, end, max_dirty_count,
+                                   &areas[n].start, &areas[n].count)) {
+        start = areas[n].start + areas[n].count;
+        n++;
+    }
+
+    return n;
+}
+
 bool hbitmap_empty(const HBitmap *hb)
 {
     return hb->count == 0;
@@ -852,16 +998,20 @@ bool hbitmap_can_merge(const HBitmap *a, const HBitmap *b)
  */
 static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
 {
-    int64_t offset;
-    int64_t count;
+    HBitmapArea areas[64];
+    int64_t offset = 0;
+    int i, n;
 
-    for (offset = 0;
-         hbitmap_next_dirty_area(src, offset, src->orig_size, INT64_MAX,
-                                 &offset, &count);
-         offset += count)
-    {
-        hbitmap_set(dst, offset, count);
-    }
+    do {
+        n = hbitmap_next_dirty_areas(src, offset, src->orig_size, INT64_MAX,
+                                     areas, ARRAY_SIZE(areas));
+        for (i = 0; i < n; i++) {
+            hbitmap_set(dst, areas[i].start, areas[i].count);
+        }
+        if (n) {
+            offset = areas[n - 1].start + areas[n - 1].count;
+        }
+    } while (n == ARRAY_SIZE(areas));
 }
 
 /**
@@ -910,14 +1060,19 @@ bool hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
         }
     }
 
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    /* The last level is the bulk of the work; recompute the dirty count in
+     * the same pass.  Bits past hb->size are always clear, so counting whole
+     * words is exact.
+     */
+    i = HBITMAP_LEVELS - 1;
+    result->count = hb_or_count(result->levels[i], a->levels[i],
+                                b->levels[i], a->sizes[i]);
 
     return true;
 }
@@ -269,12 +269,39 @@ unsigned iov_copy(struct iovec *dst_iov, unsigned int dst_iov_cnt,
 
 void qemu_iovec_init(QEMUIOVector *qiov, int alloc_hint)
 {
-    qiov->iov = g_new(struct iovec, alloc_hint);
+    if (alloc_hint <= 1) {
+        /* Single-element vectors are by far the most common */
+        qiov->iov = &qiov->local_iov;
+        qiov->nalloc = 1;
+    } else {
+        qiov->iov = g_new(struct iovec, alloc_hint);
+        qiov->nalloc = alloc_hint;
+    }
     qiov->niov = 0;
-    qiov->nalloc = alloc_hint;
     qiov->size = 0;
 }
 
+/* Make room for at least @niov elements in a qemu_iovec_init() vector */
+static void qemu_iovec_reserve(QEMUIOVector *qiov, int niov)
+{
+    struct iovec *iov;
+
+    if (niov <= qiov->nalloc) {
+        return;
+    }
+
+    if (qiov->iov == &qiov->local_iov) {
+        iov = g_new(struct iovec, niov);
+        if (qiov->niov) {
+            iov[0] = qiov->local_iov;
+        }
+        qiov->iov = iov;
+    } else {
+        qiov->iov = g_renew(struct iovec, qiov->iov, niov);
+    }
+    qiov->nalloc = niov;
+}
+
 void qemu_iovec_init_external(QEMUIOVector *qiov, struct iovec *iov, int niov)
 {
     int i;
@@ -292,8 +319,7 @@ void qemu_iovec_add(QEMUIOVector *qiov, void *base, size_t len)
     assert(qiov->nalloc != -1);
 
     if (qiov->niov == qiov->nalloc) {
-        qiov->nalloc = 2 * qiov->nalloc + 1;
-        qiov->iov = g_renew(struct iovec, qiov->iov, qiov->nalloc);
+        qemu_iovec_reserve(qiov, 2 * qiov->nalloc + 1);
     }
     qiov->iov[qiov->niov].iov_base = base;
     qiov->iov[qiov->niov].iov_len = len;
@@ -497,7 +523,7 @@ void qemu_iovec_init_slice(QEMUIOVector *qiov, QEMUIOVector *source,
 
 void qemu_iovec_destroy(QEMUIOVector *qiov)
 {
-    if (qiov->nalloc != -1) {
+    if (qiov->nalloc != -1 && qiov->iov != &qiov->local_iov) {
         g_free(qiov->iov);
     }
 
@@ -552,6 +578,10 @@ ssize_t qemu_iovec_compare(QEMUIOVector *a, QEMUIOVector *b)
         uint8_t *q = (uint8_t *)b->iov[i].iov_base;
 
         assert(a->iov[i].iov_len == b->iov[i].iov_len);
+        if (!memcmp(p, q, a->iov[i].iov_len)) {
+            offset += a->iov[i].iov_len;
+            continue;
+        }
         while (len < a->iov[i].iov_len && *p++ == *q++) {
             len++;
         }
@@ -26,6 +26,9 @@
 #include "trace/control.h"
 #include "qemu/thread.h"
 #include "qemu/lockable.h"
+#include "qemu/notify.h"
+#include "qemu/queue.h"
+#include "qemu/units.h"
 
 static char *logfilename;
 static QemuMutex qemu_logfile_mutex;
@@ -34,12 +37,30 @@ int qemu_loglevel;
 static int log_append = 0;
 static GArray *debug_regions;
 
+/* Size at which a thread writes out its buffered lines */
+#define LOG_BUFFER_SIZE (64 * KiB)
+
+typedef struct QemuLogBuffer {
+    /* Only contended while flushing all buffers from another thread */
+    QemuMutex lock;
+    GString *str;
+    QLIST_ENTRY(QemuLogBuffer) next;
+} QemuLogBuffer;
+
+static QemuMutex log_buffers_lock;
+static QLIST_HEAD(, QemuLogBuffer) log_buffers =
+    QLIST_HEAD_INITIALIZER(log_buffers);
+static __thread QemuLogBuffer *thread_log_buffer;
+static __thread Notifier thread_log_buffer_exit;
+__thread bool qemu_log_buffer_pending;
+
 /* Return the number of characters emitted.  */
 int qemu_log(const char *fmt, ...)
 {
     int ret = 0;
     QemuLogFile *logfile;
 
+    qemu_log_flush_pending();
     rcu_read_lock();
     logfile = qatomic_rcu_read(&qemu_logfile);
     if (logfile) {
@@ -57,9 +78,119 @@ int qemu_log(const char *fmt, ...)
     return ret;
 }
 
+/* Called with lb->lock held */
+static void log_buffer_write(QemuLogBuffer *lb)
+{
+    QemuLogFile *logfile;
+
+    if (!lb->str->len) {
+        return;
+    }
+
+    rcu_read_lock();
+    logfile = qatomic_rcu_read(&qemu_logfile);
+    if (logfile) {
+        fwrite(lb->str->str, 1, lb->str->len, logfile->fd);
+    }
+    rcu_read_unlock();
+    g_string_truncate(lb->str, 0);
+}
+
+static void log_buffer_release(Notifier *n, void *unused)
+{
+    QemuLogBuffer *lb = thread_log_buffer;
+
+    qemu_mutex_lock(&log_buffers_lock);
+    QLIST_REMOVE(lb, next);
+    qemu_mutex_unlock(&log_buffers_lock);
+
+    log_buffer_write(lb);
+    qemu_mutex_destroy(&lb->lock);
+    g_string_free(lb->str, true);
+    g_free(lb);
+    thread_log_buffer = NULL;
+    qemu_log_buffer_pending = false;
+}
+
+static QemuLogBuffer *log_buffer_get(void)
+{
+    QemuLogBuffer *lb = thread_log_buffer;
+
+    if (!lb) {
+        lb = g_new0(QemuLogBuffer, 1);
+        qemu_mutex_init(&lb->lock);
+        lb->str = g_string_sized_new(LOG_BUFFER_SIZE);
+
+        qemu_mutex_lock(&log_buffers_lock);
+        QLIST_INSERT_HEAD(&log_buffers, lb, next);
+        qemu_mutex_unlock(&log_buffers_lock);
+
+        thread_log_buffer = lb;
+        thread_log_buffer_exit.notify = log_buffer_release;
+        qemu_thread_atexit_add(&thread_log_buffer_exit);
+    }
+    return lb;
+}
+
+/* Return the number of characters emitted.  */
+int qemu_log_buffered(const char *fmt, ...)
+{
+    QemuLogBuffer *lb = log_buffer_get();
+    gsize len;
+    va_list ap;
+
+    qemu_mutex_lock(&lb->lock);
+    len = lb->str->len;
+    va_start(ap, fmt);
+    g_string_append_vprintf(lb->str, fmt, ap);
+    va_end(ap);
+    len = lb->str->len - len;
+
+    if (lb->str->len >= LOG_BUFFER_SIZE) {
+        log_buffer_write(lb);
+        qemu_log_buffer_pending = false;
+    } else {
+        qemu_log_buffer_pending = true;
+    }
+    qemu_mutex_unlock(&lb->lock);
+    return len;
+}
+
+/* Write out the lines buffered by the current thread */
+void qemu_log_buffer_flush(void)
+{
+    QemuLogBuffer *lb = thread_log_buffer;
+
+    if (lb) {
+        qemu_mutex_lock(&lb->lock);
+        log_buffer_write(lb);
+        qemu_mutex_unlock(&lb->lock);
+    }
+    qemu_log_buffer_pending = false;
+}
+
+/*
+ * Write out the lines buffered by all threads.  Do not call this with the
+ * log file locked while other threads are logging: the owner of a buffer
+ * could be waiting for that lock in log_buffer_write().
+ */
+static void log_buffer_flush_all(void)
+{
+    QemuLogBuffer *lb;
+
+    QEMU_LOCK_GUARD(&log_buffers_lock);
+    QLIST_FOREACH(lb, &log_buffers, next) {
+        qemu_mutex_lock(&lb->lock);
+        log_buffer_write(lb);
+        qemu_mutex_unlock(&lb->lock);
+    }
+}
+
 static void __attribute__((__constructor__)) qemu_logfile_init(void)
 {
     qemu_mutex_init(&qemu_logfile_mutex);
+    qemu_mutex_init(&log_buffers_lock);
+    atexit(log_buffer_flush_all);
 }
 
 static void qemu_logfile_free(QemuLogFile *logfile)
@@ -94,6 +225,8 @@ void qemu_set_log(int log_flags)
      */
     if (qemu_loglevel && (!is_daemonized() || logfilename)) {
         need_to_open_file = true;
+    } else {
+        log_buffer_flush_all();
     }
     QEMU_LOCK_GUARD(&qemu_logfile_mutex);
     if (qemu_logfile && !need_to_open_file) {
@@ -271,6 +404,7 @@ void qemu_log_flush(void)
 {
     QemuLogFile *logfile;
 
+    qemu_log_flush_pending();
     rcu_read_lock();
     logfile = qatomic_rcu_read(&qemu_logfile);
     if (logfile) {
@@ -284,6 +418,7 @@ void qemu_log_close(void)
 {
     QemuLogFile *logfile;
 
+    log_buffer_flush_all();
     qemu_mutex_lock(&qemu_logfile_mutex);
     logfile = qemu_logfile;
 
@@ -39,9 +39,11 @@
 #include "qemu/thread.h"
 #include <libgen.h>
 #include "qemu/cutils.h"
+#include "qemu/bitops.h"
 
 #ifdef CONFIG_LINUX
 #include <sys/syscall.h>
+#include <sched.h>
 #endif
 
 #ifdef __FreeBSD__
@@ -78,12 +80,19 @@ struct MemsetThread {
     size_t hpagesize;
     QemuThread pgthread;
     sigjmp_buf env;
+#ifdef CONFIG_LINUX
+    /* CPUs of the host node this thread's pages should end up on */
+    cpu_set_t cpus;
+    bool has_cpus;
+#endif
 };
 typedef struct MemsetThread MemsetThread;
 
 static MemsetThread *memset_thread;
 static int memset_num_threads;
 static bool memset_thread_failed;
+static bool memset_use_madv_populate;
+static struct sigaction memset_oldact;
 
 static QemuMutex page_mutex;
 static QemuCond page_cond;
@@ -469,6 +478,26 @@ static void *do_touch_pages(void *arg)
     }
     qemu_mutex_unlock(&page_mutex);
 
+#ifdef CONFIG_LINUX
+    if (memset_args->has_cpus) {
+        /* Best effort, the pages are still touched if this fails */
+        sched_setaffinity(0, sizeof(memset_args->cpus), &memset_args->cpus);
+    }
+#endif
+
+    if (memset_use_madv_populate) {
+        /*
+         * Unlike touching the pages this neither raises SIGBUS nor
+         * writes to the memory, so it is safe against concurrent users.
+         */
+        if (qemu_madvise(memset_args->addr,
+                         memset_args->numpages * memset_args->hpagesize,
+                         QEMU_MADV_POPULATE_WRITE)) {
+            memset_thread_failed = true;
+        }
+        return NULL;
+    }
+
     /* unblock SIGBUS */
     sigemptyset(&set);
     sigaddset(&set, SIGBUS);
@@ -514,13 +543,56 @@ static inline int get_memset_num_threads(int smp_cpus)
     return ret;
 }
 
-static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                            int smp_cpus)
+#ifdef CONFIG_LINUX
+/* Parse /sys/devices/system/node/nodeN/cpulist, e.g. "0-3,8-11" */
+static bool get_host_node_cpus(unsigned long node, cpu_set_t *cpus)
+{
+    g_autofree char *path =
+        g_strdup_printf("/sys/devices/system/node/node%lu/cpulist", node);
+    g_autofree char *list = NULL;
+    const char *p;
+
+    CPU_ZERO(cpus);
+    if (!g_file_get_contents(path, &list, NULL, NULL)) {
+        return false;
+    }
+    for (p = list; *p && *p != '\n';) {
+        unsigned long first, last;
+
+        if (qemu_strtoul(p, &p, 10, &first) < 0) {
+            return false;
+        }
+        last = first;
+        if (*p == '-' && qemu_strtoul(p + 1, &p, 10, &last) < 0) {
+            return false;
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            CPU_SET(first, cpus);
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+#endif
+
+/*
+ * Start the threads that preallocate @numpages pages of @area.  With
+ * host nodes given, the area is split in one contiguous chunk per node
+ * and each chunk is touched by threads running on that node, so that
+ * the node-local allocation of the kernel honours the binding.
+ */
+static void touch_all_pages_start(char *area, size_t hpagesize,
+                                  size_t numpages, int max_threads,
+                                  const unsigned long *host_nodes,
+                                  unsigned long maxnode)
 {
     static gsize initialized = 0;
-    size_t numpages_per_thread, leftover;
+    unsigned long *nodes = NULL;
+    int nr_nodes = 0, threads_per_node;
     char *addr = area;
-    int i = 0;
+    int i, n;
 
     if (g_once_init_enter(&initialized)) {
         qemu_mutex_init(&page_mutex);
@@ -528,26 +600,68 @@ static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
         g_once_init_leave(&initialized, 1);
     }
 
+    if (host_nodes && maxnode) {
+        unsigned long node;
+
+        nodes = g_new(unsigned long, maxnode);
+        for (node = find_first_bit(host_nodes, maxnode); node < maxnode;
+             node = find_next_bit(host_nodes, maxnode, node + 1)) {
+            nodes[nr_nodes++] = node;
+        }
+    }
+
     memset_thread_failed = false;
     threads_created_flag = false;
-    memset_num_threads = get_memset_num_threads(smp_cpus);
+    memset_num_threads = get_memset_num_threads(max_threads);
+    threads_per_node = 1;
+    if (nr_nodes) {
+        threads_per_node = MAX(1, memset_num_threads / nr_nodes);
+        memset_num_threads = threads_per_node * nr_nodes;
+    } else {
+        nr_nodes = 1;
+        threads_per_node = memset_num_threads;
+    }
     memset_thread = g_new0(MemsetThread, memset_num_threads);
-    numpages_per_thread = numpages / memset_num_threads;
-    leftover = numpages % memset_num_threads;
-    for (i = 0; i < memset_num_threads; i++) {
-        memset_thread[i].addr = addr;
-        memset_thread[i].numpages = numpages_per_thread + (i < leftover);
-        memset_thread[i].hpagesize = hpagesize;
-        qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
-                           do_touch_pages, &memset_thread[i],
-                           QEMU_THREAD_JOINABLE);
-        addr += memset_thread[i].numpages * hpagesize;
+
+    for (n = 0; n < nr_nodes; n++) {
+        size_t node_pages = numpages / nr_nodes + (n < numpages % nr_nodes);
+        MemsetThread *threads = &memset_thread[n * threads_per_node];
+#ifdef CONFIG_LINUX
+        cpu_set_t cpus;
+        bool has_cpus = false;
+
+        CPU_ZERO(&cpus);
+        if (nodes) {
+            has_cpus = get_host_node_cpus(nodes[n], &cpus);
+        }
+#endif
+
+        for (i = 0; i < threads_per_node; i++) {
+            threads[i].addr = addr;
+            threads[i].numpages = node_pages / threads_per_node +
+                                  (i < node_pages % threads_per_node);
+            threads[i].hpagesize = hpagesize;
+#ifdef CONFIG_LINUX
+            threads[i].cpus = cpus;
+            threads[i].has_cpus = has_cpus;
+#endif
+            qemu_thread_create(&threads[i].pgthread, "touch_pages",
+                               do_touch_pages, &threads[i],
+                               QEMU_THREAD_JOINABLE);
+            addr += threads[i].numpages * hpagesize;
+        }
     }
+    g_free(nodes);
 
     qemu_mutex_lock(&page_mutex);
     threads_created_flag = true;
     qemu_cond_broadcast(&page_cond);
     qemu_mutex_unlock(&page_mutex);
+}
+
+static bool touch_all_pages_finish(void)
+{
+    int i;
 
     for (i = 0; i < memset_num_threads; i++) {
         qemu_thread_join(&memset_thread[i].pgthread);
@@ -558,39 +672,86 @@ static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
     return memset_thread_failed;
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+static bool madv_populate_write_possible(char *area, size_t pagesize)
 {
+    return !qemu_madvise(area, pagesize, QEMU_MADV_POPULATE_WRITE) ||
+           errno != EINVAL;
+}
+
+bool os_mem_prealloc_wait(Error **errp)
+{
+    bool failed;
     int ret;
-    struct sigaction act, oldact;
+
+    if (!memset_thread) {
+        return true;
+    }
+
+    failed = touch_all_pages_finish();
+    if (failed) {
+        error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
+            "pages available to allocate guest RAM");
+    }
+
+    if (!memset_use_madv_populate) {
+        ret = sigaction(SIGBUS, &memset_oldact, NULL);
+        if (ret) {
+            /* Terminate QEMU since it can't recover from error */
+            perror("os_mem_prealloc: failed to reinstall signal handler");
+            exit(1);
+        }
+    }
+    return !failed;
+}
+
+void os_mem_prealloc_nodes(int fd, char *area, size_t memory, int max_threads,
+                           const unsigned long *host_nodes,
+                           unsigned long maxnode, bool async, Error **errp)
+{
+    int ret;
+    struct sigaction act;
     size_t hpagesize = qemu_fd_getpagesize(fd);
     size_t numpages = DIV_ROUND_UP(memory, hpagesize);
 
-    memset(&act, 0, sizeof(act));
-    act.sa_handler = &sigbus_handler;
-    act.sa_flags = 0;
-
-    ret = sigaction(SIGBUS, &act, &oldact);
-    if (ret) {
-        error_setg_errno(errp, errno,
-            "os_mem_prealloc: failed to install signal handler");
+    /* Only one preallocation is in flight at a time */
+    if (!os_mem_prealloc_wait(errp)) {
         return;
     }
 
-    /* touch pages simultaneously */
-    if (touch_all_pages(area, hpagesize, numpages, smp_cpus)) {
-        error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
-            "pages available to allocate guest RAM");
+    memset_use_madv_populate = madv_populate_write_possible(area, hpagesize);
+    if (!memset_use_madv_populate) {
+        /*
+         * Touching the pages writes back what was read, which would race
+         * with anybody initializing guest RAM at the same time.
+         */
+        async = false;
+
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = &sigbus_handler;
+        act.sa_flags = 0;
+
+        ret = sigaction(SIGBUS, &act, &memset_oldact);
+        if (ret) {
+            error_setg_errno(errp, errno,
+                "os_mem_prealloc: failed to install signal handler");
+            return;
+        }
     }
 
-    ret = sigaction(SIGBUS, &oldact, NULL);
-    if (ret) {
-        /* Terminate QEMU since it can't recover from error */
-        perror("os_mem_prealloc: failed to reinstall signal handler");
-        exit(1);
+    /* touch pages simultaneously */
+    touch_all_pages_start(area, hpagesize, numpages, max_threads,
+                          host_nodes, maxnode);
+    if (!async) {
+        os_mem_prealloc_wait(errp);
     }
 }
 
+void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
+                     Error **errp)
+{
+    os_mem_prealloc_nodes(fd, area, memory, smp_cpus, NULL, 0, false, errp);
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     char *name = NULL;
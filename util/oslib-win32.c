@@ -575,6 +575,18 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 }
 
+void os_mem_prealloc_nodes(int fd, char *area, size_t memory, int max_threads,
+                           const unsigned long *host_nodes,
+                           unsigned long maxnode, bool async, Error **errp)
+{
+    os_mem_prealloc(fd, area, memory, max_threads, errp);
+}
+
+bool os_mem_prealloc_wait(Error **errp)
+{
+    return true;
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
@@ -21,9 +21,16 @@
 #include "block/aio.h"
 
 enum {
-    POOL_BATCH_SIZE = 64,
+    POOL_MIN_BATCH_SIZE = 64,
 };
 
+/*
+ * Size of the per-thread pools, and half the size of the global one.
+ * Devices that can have many requests in flight raise it with
+ * qemu_coroutine_increase_pool_batch_size().
+ */
+static unsigned int pool_batch_size = POOL_MIN_BATCH_SIZE;
+
 /** Free list to speed up creation */
 static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
 static unsigned int release_pool_size;
@@ -31,17 +38,41 @@ static __thread QSLIST_HEAD(, Coroutine) alloc_pool = QSLIST_HEAD_INITIALIZER(po
 static __thread unsigned int alloc_pool_size;
 static __thread Notifier coroutine_pool_cleanup_notifier;
 
+/* Coroutines of this thread taken from a pool or freshly allocated */
+static __thread uint64_t alloc_pool_hits;
+static __thread uint64_t alloc_pool_misses;
+
 static void coroutine_pool_cleanup(Notifier *n, void *value)
 {
     Coroutine *co;
     Coroutine *tmp;
 
+    trace_qemu_coroutine_pool_cleanup(alloc_pool_size, alloc_pool_hits,
+                                      alloc_pool_misses);
     QSLIST_FOREACH_SAFE(co, &alloc_pool, pool_next, tmp) {
         QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
         qemu_coroutine_delete(co);
     }
 }
 
+static void coroutine_pool_register_cleanup(void)
+{
+    if (!coroutine_pool_cleanup_notifier.notify) {
+        coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
+        qemu_thread_atexit_add(&coroutine_pool_cleanup_notifier);
+    }
+}
+
+void qemu_coroutine_increase_pool_batch_size(unsigned int additional_size)
+{
+    qatomic_add(&pool_batch_size, additional_size);
+}
+
+void qemu_coroutine_decrease_pool_batch_size(unsigned int removed_size)
+{
+    qatomic_sub(&pool_batch_size, removed_size);
+}
+
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
 {
     Coroutine *co = NULL;
@@ -49,12 +80,9 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
     if (CONFIG_COROUTINE_POOL) {
         co = QSLIST_FIRST(&alloc_pool);
         if (!co) {
-            if (release_pool_size > POOL_BATCH_SIZE) {
+            if (release_pool_size > qatomic_read(&pool_batch_size)) {
                 /* Slow path; a good place to register the destructor, too.  */
-                if (!coroutine_pool_cleanup_notifier.notify) {
-                    coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
-                    qemu_thread_atexit_add(&coroutine_pool_cleanup_notifier);
-                }
+                coroutine_pool_register_cleanup();
 
                 /* This is not exact; there could be a little skew between
                  * release_pool_size and the actual size of release_pool.  But
@@ -68,6 +96,12 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
         if (co) {
             QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
             alloc_pool_size--;
+            alloc_pool_hits++;
+        } else {
+            alloc_pool_misses++;
+            trace_qemu_coroutine_pool_miss(release_pool_size,
+                                           alloc_pool_hits,
+                                           alloc_pool_misses);
         }
     }
 
@@ -86,16 +120,24 @@ static void coroutine_delete(Coroutine *co)
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < POOL_BATCH_SIZE * 2) {
-            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
-            qatomic_inc(&release_pool_size);
-            return;
-        }
-        if (alloc_pool_size < POOL_BATCH_SIZE) {
+        unsigned int batch_size = qatomic_read(&pool_batch_size);
+
+        /*
+         * Keep the coroutine in this thread if possible.  Its stack was
+         * most likely touched first here, and is thus on this thread's
+         * NUMA node and still warm in its caches.
+         */
+        if (alloc_pool_size < batch_size) {
+            coroutine_pool_register_cleanup();
             QSLIST_INSERT_HEAD(&alloc_pool, co, pool_next);
             alloc_pool_size++;
             return;
         }
+        if (release_pool_size < batch_size * 2) {
+            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
+            qatomic_inc(&release_pool_size);
+            return;
+        }
     }
 
     qemu_coroutine_delete(co);
@@ -48,6 +48,12 @@
  * ht->map pointer is set, and the old map is freed once no RCU readers can see
  * it anymore.
  *
+ * Auto-resizing always doubles the map, so the entries of each old bucket go
+ * to exactly two new buckets. This lets the copy proceed one old bucket at a
+ * time, with writers free to use the rest of the map. All bucket locks are
+ * then taken only to copy again the few buckets written since, and to switch
+ * ht->map.
+ *
  * Writers check for concurrent resizes by comparing ht->map before and after
  * acquiring their bucket lock. If they don't match, a resize has occurred
  * while the bucket spinlock was being acquired.
@@ -176,6 +182,7 @@ struct qht_map {
 static void qht_do_resize_reset(struct qht *ht, struct qht_map *new,
                                 bool reset);
 static void qht_grow_maybe(struct qht *ht);
+static void qht_do_grow(struct qht *ht);
 
 #ifdef QHT_DEBUG
 
@@ -617,9 +624,7 @@ static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
     map = ht->map;
     /* another thread might have just performed the resize we were after */
     if (qht_map_needs_resize(map)) {
-        struct qht_map *new = qht_map_create(map->n_buckets * 2);
-
-        qht_do_resize(ht, new);
+        qht_do_grow(ht);
     }
     qht_unlock(ht);
 }
@@ -882,6 +887,65 @@ static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
     call_rcu(old, qht_map_destroy, rcu);
 }
 
+/* call with @b->lock held */
+static void qht_map_copy_bucket(struct qht *ht, struct qht_map *new,
+                                struct qht_bucket *b)
+{
+    const struct qht_iter iter = {
+        .f.retvoid = qht_map_copy,
+        .type = QHT_ITER_VOID,
+    };
+    struct qht_map_copy_data data = {
+        .ht = ht,
+        .new = new,
+    };
+
+    qht_bucket_iter(b, &iter, &data);
+}
+
+/*
+ * Double the size of the map.
+ * Call with ht->lock held.
+ */
+static void qht_do_grow(struct qht *ht)
+{
+    struct qht_map *old = ht->map;
+    struct qht_map *new = qht_map_create(old->n_buckets * 2);
+    unsigned *seqs = g_new(unsigned, old->n_buckets);
+    size_t i;
+
+    /* first pass: writers only wait for the bucket being copied */
+    for (i = 0; i < old->n_buckets; i++) {
+        struct qht_bucket *b = &old->buckets[i];
+
+        qemu_spin_lock(&b->lock);
+        seqs[i] = seqlock_read_begin(&b->sequence);
+        qht_map_copy_bucket(ht, new, b);
+        qemu_spin_unlock(&b->lock);
+    }
+
+    /*
+     * Second pass: with all locks held, redo the buckets written since.
+     * Old bucket i only feeds new buckets i and i + old->n_buckets.
+     */
+    qht_map_lock_buckets(old);
+    for (i = 0; i < old->n_buckets; i++) {
+        struct qht_bucket *b = &old->buckets[i];
+
+        if (seqlock_read_retry(&b->sequence, seqs[i])) {
+            qht_bucket_reset__locked(&new->buckets[i]);
+            qht_bucket_reset__locked(&new->buckets[i + old->n_buckets]);
+            qht_map_copy_bucket(ht, new, b);
+        }
+    }
+    qht_map_debug__all_locked(new);
+
+    qatomic_rcu_set(&ht->map, new);
+    qht_map_unlock_buckets(old);
+    call_rcu(old, qht_map_destroy, rcu);
+    g_free(seqs);
+}
+
 bool qht_resize(struct qht *ht, size_t n_elems)
 {
     size_t n_buckets = qht_elems_to_buckets(n_elems);
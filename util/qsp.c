@@ -785,6 +785,271 @@ void qsp_report(size_t max, enum QSPSortBy sort_by,
     report_destroy(&rep);
 }
 
+/*
+ * Sampled BQL profiling.  Unlike the rest of QSP this is always on, at a
+ * cost low enough to be left enabled: each thread times one in
+ * qsp_bql_period acquisitions of the BQL.  Until a sampled hold ends, its
+ * time is charged to the innermost context (MMIO region, timer, bottom
+ * half, fd handler, QMP command) pushed by the thread, or to the call site
+ * that took the lock when there is none.  Times and counts are multiplied
+ * by the sampling period, so that they estimate the totals.
+ *
+ * Entries are only updated by the thread that holds the BQL, so the hash
+ * table is protected by the BQL itself.
+ */
+#define QSP_BQL_DEFAULT_PERIOD 64
+
+struct QSPBQLEntry {
+    const char *kind;
+    const void *obj;
+    const char *name;
+    int line;
+    char *label;
+    uint64_t count;
+    uint64_t wait_ns;
+    uint64_t hold_ns;
+};
+typedef struct QSPBQLEntry QSPBQLEntry;
+
+static unsigned int qsp_bql_period = QSP_BQL_DEFAULT_PERIOD;
+static GHashTable *qsp_bql_ht;
+
+/* acquisitions left before the next sample */
+static __thread unsigned int qsp_bql_countdown;
+/* period of the sampled hold in progress, 0 if none */
+static __thread unsigned int qsp_bql_weight;
+/* start of the part of the hold that has not been charged yet */
+static __thread int64_t qsp_bql_t0;
+static __thread const char *qsp_bql_file;
+static __thread int qsp_bql_line;
+static __thread QSPBQLContext *qsp_bql_ctx;
+
+static guint qsp_bql_entry_hash(gconstpointer p)
+{
+    const QSPBQLEntry *e = p;
+
+    return qemu_xxhash6((uintptr_t)e->obj, (uintptr_t)e->name, e->line,
+                        g_str_hash(e->kind));
+}
+
+static gboolean qsp_bql_entry_equal(gconstpointer ap, gconstpointer bp)
+{
+    const QSPBQLEntry *a = ap;
+    const QSPBQLEntry *b = bp;
+
+    return a->obj == b->obj && a->name == b->name && a->line == b->line &&
+        !strcmp(a->kind, b->kind);
+}
+
+static void qsp_bql_entry_free(gpointer p)
+{
+    QSPBQLEntry *e = p;
+
+    g_free(e->label);
+    g_free(e);
+}
+
+static QSPBQLEntry *qsp_bql_entry_get(const char *kind, const void *obj,
+                                      const char *name, int line)
+{
+    QSPBQLEntry orig = {
+        .kind = kind,
+        .obj = obj,
+        .name = name,
+        .line = line,
+    };
+    QSPBQLEntry *e;
+
+    if (!qsp_bql_ht) {
+        qsp_bql_ht = g_hash_table_new_full(qsp_bql_entry_hash,
+                                           qsp_bql_entry_equal,
+                                           qsp_bql_entry_free, NULL);
+    }
+
+    e = g_hash_table_lookup(qsp_bql_ht, &orig);
+    if (e == NULL) {
+        e = g_memdup(&orig, sizeof(orig));
+        /* names may not outlive the object, so copy them now */
+        if (name) {
+            e->label = g_strdup(name);
+        } else if (line) {
+            QSPCallSite callsite = { .file = obj, .line = line };
+
+            qsp_init();
+            e->label = qsp_at(&callsite);
+        } else {
+            e->label = g_strdup_printf("%p", obj);
+        }
+        g_hash_table_add(qsp_bql_ht, e);
+    }
+    return e;
+}
+
+static void qsp_bql_charge(int64_t now)
+{
+    QSPBQLContext *ctx = qsp_bql_ctx;
+    QSPBQLEntry *e;
+
+    if (ctx) {
+        e = qsp_bql_entry_get(ctx->kind, ctx->obj, ctx->name, 0);
+    } else {
+        e = qsp_bql_entry_get("lock", qsp_bql_file, NULL, qsp_bql_line);
+    }
+    e->hold_ns += (now - qsp_bql_t0) * qsp_bql_weight;
+    qsp_bql_t0 = now;
+}
+
+void qsp_bql_context_push(QSPBQLContext *ctx, const char *kind,
+                          const void *obj, const char *name)
+{
+    ctx->kind = kind;
+    ctx->obj = obj;
+    ctx->name = name;
+    ctx->prev = qsp_bql_ctx;
+
+    if (unlikely(qsp_bql_weight)) {
+        QSPBQLEntry *e;
+
+        qsp_bql_charge(get_clock());
+        e = qsp_bql_entry_get(kind, obj, name, 0);
+        e->count += qsp_bql_weight;
+    }
+    qsp_bql_ctx = ctx;
+}
+
+void qsp_bql_context_pop(QSPBQLContext *ctx)
+{
+    if (unlikely(qsp_bql_weight)) {
+        qsp_bql_charge(get_clock());
+    }
+    if (qsp_bql_ctx == ctx) {
+        qsp_bql_ctx = ctx->prev;
+    }
+}
+
+/*
+ * Called before taking the BQL.  Returns the current time if this
+ * acquisition is sampled, 0 otherwise.
+ */
+int64_t qsp_bql_lock_begin(void)
+{
+    unsigned int period = qatomic_read(&qsp_bql_period);
+
+    if (!period) {
+        return 0;
+    }
+    if (qsp_bql_countdown) {
+        qsp_bql_countdown--;
+        return 0;
+    }
+    qsp_bql_countdown = period - 1;
+    qsp_bql_weight = period;
+    return get_clock();
+}
+
+/* Called with the BQL taken, if qsp_bql_lock_begin() returned nonzero */
+void qsp_bql_lock_end(int64_t t0, const char *file, int line)
+{
+    int64_t now = get_clock();
+    QSPBQLEntry *e;
+
+    e = qsp_bql_entry_get("lock", file, NULL, line);
+    e->count += qsp_bql_weight;
+    e->wait_ns += (now - t0) * qsp_bql_weight;
+    qsp_bql_file = file;
+    qsp_bql_line = line;
+    qsp_bql_t0 = now;
+}
+
+/* Called before the BQL is released */
+void qsp_bql_release(void)
+{
+    if (unlikely(qsp_bql_weight)) {
+        qsp_bql_charge(get_clock());
+        qsp_bql_weight = 0;
+    }
+}
+
+unsigned int qsp_bql_get_period(void)
+{
+    return qatomic_read(&qsp_bql_period);
+}
+
+/* A period of 0 disables BQL profiling */
+void qsp_bql_set_period(unsigned int period)
+{
+    qatomic_set(&qsp_bql_period, period);
+}
+
+static gint qsp_bql_entry_cmp(gconstpointer ap, gconstpointer bp)
+{
+    const QSPBQLEntry *a = *(QSPBQLEntry * const *)ap;
+    const QSPBQLEntry *b = *(QSPBQLEntry * const *)bp;
+    uint64_t ta = a->hold_ns + a->wait_ns;
+    uint64_t tb = b->hold_ns + b->wait_ns;
+
+    if (ta > tb) {
+        return -1;
+    } else if (ta < tb) {
+        return 1;
+    }
+    return strcmp(a->label, b->label);
+}
+
+static GPtrArray *qsp_bql_sorted(void)
+{
+    GPtrArray *arr = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer e;
+
+    if (qsp_bql_ht) {
+        g_hash_table_iter_init(&iter, qsp_bql_ht);
+        while (g_hash_table_iter_next(&iter, &e, NULL)) {
+            g_ptr_array_add(arr, e);
+        }
+    }
+    g_ptr_array_sort(arr, qsp_bql_entry_cmp);
+    return arr;
+}
+
+/* Must be called with the BQL taken */
+void qsp_bql_foreach(QSPBQLIterFunc *fn, void *opaque)
+{
+    GPtrArray *arr = qsp_bql_sorted();
+    guint i;
+
+    for (i = 0; i < arr->len; i++) {
+        const QSPBQLEntry *e = g_ptr_array_index(arr, i);
+
+        fn(e->kind, e->label, e->count, e->wait_ns, e->hold_ns, opaque);
+    }
+    g_ptr_array_free(arr, TRUE);
+}
+
+/* Must be called with the BQL taken */
+void qsp_bql_report(size_t max)
+{
+    GPtrArray *arr = qsp_bql_sorted();
+    unsigned int period = qsp_bql_get_period();
+    guint i;
+
+    if (!period) {
+        qemu_printf("BQL profiling is off\n");
+    } else {
+        qemu_printf("BQL holders, sampling 1 in %u acquisitions\n", period);
+    }
+    qemu_printf("Kind   %-46s  Wait Time (s)  Hold Time (s)         Count\n",
+                "Holder");
+    for (i = 0; i < arr->len && i < max; i++) {
+        const QSPBQLEntry *e = g_ptr_array_index(arr, i);
+
+        qemu_printf("%-5s  %-46s  %13.5f  %13.5f  %12" PRIu64 "\n",
+                    e->kind, e->label, e->wait_ns / 1e9, e->hold_ns / 1e9,
+                    e->count);
+    }
+    g_ptr_array_free(arr, TRUE);
+}
+
 static void qsp_snapshot_destroy(QSPSnapshot *snap)
 {
     qht_iter(&snap->ht, qsp_ht_delete, NULL);
@@ -810,4 +1075,8 @@ void qsp_reset(void)
     if (old) {
         call_rcu(old, qsp_snapshot_destroy, rcu);
     }
+    /* the caller holds the BQL, which protects the BQL entries */
+    if (qsp_bql_ht) {
+        g_hash_table_remove_all(qsp_bql_ht);
+    }
 }
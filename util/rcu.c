@@ -183,6 +183,9 @@ static struct rcu_head *head = &dummy, **tail = &dummy.next;
 static int rcu_call_count;
 static QemuEvent rcu_call_ready_event;
 
+/* Set when the next grace period should not wait for more callbacks.  */
+static bool rcu_call_expedited;
+
 static void enqueue(struct rcu_head *node)
 {
     struct rcu_head **old_tail;
@@ -240,13 +243,23 @@ static void *call_rcu_thread(void *opaque)
 
     for (;;) {
         int tries = 0;
-        int n = qatomic_read(&rcu_call_count);
+        int n;
+
+        /*
+         * call_rcu_expedite() is called after the callbacks are queued, so
+         * an earlier request is covered by the n read below.
+         */
+        qatomic_mb_set(&rcu_call_expedited, false);
+        n = qatomic_read(&rcu_call_count);
 
         /* Heuristically wait for a decent number of callbacks to pile up.
          * Fetch rcu_call_count now, we only must process elements that were
          * added before synchronize_rcu() starts.
          */
         while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
+            if (n > 0 && qatomic_read(&rcu_call_expedited)) {
+                break;
+            }
             g_usleep(10000);
             if (n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
@@ -293,6 +306,16 @@ void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
     qemu_event_set(&rcu_call_ready_event);
 }
 
+/*
+ * Run the callbacks queued so far after the next grace period, without
+ * waiting for RCU_CALL_MIN_SIZE of them to pile up.
+ */
+void call_rcu_expedite(void)
+{
+    qatomic_mb_set(&rcu_call_expedited, true);
+    qemu_event_set(&rcu_call_ready_event);
+}
+
 
 struct rcu_drain {
     struct rcu_head rcu;
@@ -340,6 +363,7 @@ void drain_call_rcu(void)
      */
 
     call_rcu1(&rcu_drain.rcu, drain_rcu_callback);
+    call_rcu_expedite();
     qemu_event_wait(&rcu_drain.drain_complete_event);
 
     if (locked) {
@@ -58,7 +58,6 @@ struct ThreadPool {
     QemuMutex lock;
     QemuCond worker_stopped;
     QemuSemaphore sem;
-    int max_threads;
     QEMUBH *new_thread_bh;
 
     /* The following variables are only accessed from one AioContext. */
@@ -66,13 +65,29 @@ struct ThreadPool {
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    int queued;          /* length of request_list */
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
+    int min_threads;
+    int max_threads;
     bool stopping;
 };
 
+static bool back_to_sleep(ThreadPool *pool, int ret)
+{
+    /*
+     * The semaphore timed out, we should exit the loop except when:
+     *  - There is work to do, we raced with the signal.
+     *  - The max threads threshold just changed, we raced with the signal.
+     *  - The thread pool keeps a minimum number of threads ready.
+     */
+    return ret == -1 && (!QTAILQ_EMPTY(&pool->request_list) ||
+                         pool->cur_threads > pool->max_threads ||
+                         pool->cur_threads <= pool->min_threads);
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
@@ -91,13 +106,22 @@ static void *worker_thread(void *opaque)
             ret = qemu_sem_timedwait(&pool->sem, 10000);
             qemu_mutex_lock(&pool->lock);
             pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
-        if (ret == -1 || pool->stopping) {
+        } while (back_to_sleep(pool, ret));
+        if (ret == -1 || pool->stopping ||
+            pool->cur_threads > pool->max_threads) {
             break;
         }
 
+        /*
+         * A wakeup meant for a surplus thread that has left in the
+         * meantime, or for a request that was cancelled
+         */
         req = QTAILQ_FIRST(&pool->request_list);
+        if (!req) {
+            continue;
+        }
         QTAILQ_REMOVE(&pool->request_list, req, reqs);
+        pool->queued--;
         req->state = THREAD_ACTIVE;
         qemu_mutex_unlock(&pool->lock);
 
@@ -219,6 +243,7 @@ static void thread_pool_cancel(BlockAIOCB *acb)
          */
         qemu_sem_timedwait(&pool->sem, 0) == 0) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        pool->queued--;
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
@@ -261,6 +286,7 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         spawn_thread(pool);
     }
     QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    pool->queued++;
     qemu_mutex_unlock(&pool->lock);
     qemu_sem_post(&pool->sem);
     return &req->common;
@@ -294,6 +320,33 @@ void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(pool, func, arg, NULL, NULL);
 }
 
+/*
+ * Spawn threads up to min_threads, and wake up surplus threads above
+ * max_threads so that they exit.  In between, the pool manages itself:
+ * threads are created on demand and leave after being idle for a while.
+ */
+static void thread_pool_adjust_threads(ThreadPool *pool)
+{
+    int i;
+
+    /* Runs with lock taken.  */
+    for (i = pool->cur_threads; i < pool->min_threads; i++) {
+        spawn_thread(pool);
+    }
+    for (i = pool->cur_threads; i > pool->max_threads; i--) {
+        qemu_sem_post(&pool->sem);
+    }
+}
+
+void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
+{
+    qemu_mutex_lock(&pool->lock);
+    pool->min_threads = ctx->thread_pool_min;
+    pool->max_threads = ctx->thread_pool_max;
+    thread_pool_adjust_threads(pool);
+    qemu_mutex_unlock(&pool->lock);
+}
+
 static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
 {
     if (!ctx) {
@@ -306,11 +359,12 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
     qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
     QTAILQ_INIT(&pool->request_list);
+
+    thread_pool_update_params(pool, ctx);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
@@ -320,6 +374,30 @@ ThreadPool *thread_pool_new(AioContext *ctx)
     return pool;
 }
 
+/*
+ * Change the number of worker threads the pool may run at once, for pools
+ * that are not the AioContext's own.  Surplus threads after lowering the
+ * limit exit once they are done with their current request.
+ */
+void thread_pool_set_max_threads(ThreadPool *pool, int max_threads)
+{
+    assert(max_threads > 0);
+
+    qemu_mutex_lock(&pool->lock);
+    pool->max_threads = max_threads;
+    pool->min_threads = MIN(pool->min_threads, max_threads);
+    thread_pool_adjust_threads(pool);
+    qemu_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    QEMU_LOCK_GUARD(&pool->lock);
+    stats->cur_threads = pool->cur_threads;
+    stats->idle_threads = pool->idle_threads;
+    stats->queued = pool->queued;
+}
+
 void thread_pool_free(ThreadPool *pool)
 {
     if (!pool) {
@@ -445,12 +445,14 @@ bool throttle_schedule_timer(ThrottleState *ts,
     return true;
 }
 
-/* do the accounting for this operation
+/* add @size bytes and @units operations to the buckets of one direction
  *
  * @is_write: the type of operation (read/write)
- * @size:     the size of the operation
+ * @size:     the number of bytes, may be negative to undo an accounting
+ * @units:    the number of operations, likewise
  */
-void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
+static void throttle_do_account(ThrottleState *ts, bool is_write,
+                                double size, double units)
 {
     const BucketType bucket_types_size[2][2] = {
         { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
@@ -460,14 +462,8 @@ void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
     };
-    double units = 1.0;
     unsigned i;
 
-    /* if cfg.op_size is defined and smaller than size we compute unit count */
-    if (ts->cfg.op_size && size > ts->cfg.op_size) {
-        units = (double) size / ts->cfg.op_size;
-    }
-
     for (i = 0; i < 2; i++) {
         LeakyBucket *bkt;
 
@@ -485,6 +481,48 @@ void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
     }
 }
 
+/* do the accounting for this operation
+ *
+ * @is_write: the type of operation (read/write)
+ * @size:     the size of the operation
+ */
+void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
+{
+    double units = 1.0;
+
+    /* if cfg.op_size is defined and smaller than size we compute unit count */
+    if (ts->cfg.op_size && size > ts->cfg.op_size) {
+        units = (double) size / ts->cfg.op_size;
+    }
+
+    throttle_do_account(ts, is_write, size, units);
+}
+
+/* account for I/O that has not been submitted yet, but only if that does
+ * not make the next request of this type wait
+ *
+ * NOTE: like throttle_schedule_timer() this leaks the buckets up to @now
+ *
+ * @is_write: the type of operation (read/write)
+ * @now:      the current clock timestamp
+ * @size:     the number of bytes to reserve
+ * @units:    the number of operations to reserve
+ * @ret:      true if the I/O has been accounted for
+ */
+bool throttle_reserve(ThrottleState *ts, bool is_write, int64_t now,
+                      uint64_t size, double units)
+{
+    throttle_do_leak(ts, now);
+    throttle_do_account(ts, is_write, size, units);
+
+    if (throttle_compute_wait_for(ts, is_write)) {
+        throttle_do_account(ts, is_write, -(double)size, -units);
+        return false;
+    }
+
+    return true;
+}
+
 /* return a ThrottleConfig based on the options in a ThrottleLimits
  *
  * @arg:    the ThrottleLimits object to read from
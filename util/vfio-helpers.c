@@ -193,8 +193,23 @@ void qemu_vfio_pci_unmap_bar(QEMUVFIOState *s, int index, void *bar,
  */
 int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
                            int irq_type, Error **errp)
+{
+    unsigned count = 1;
+
+    return qemu_vfio_pci_init_irqs(s, e, irq_type, &count, errp);
+}
+
+/**
+ * Enable up to *@count vectors of @irq_type and route vector 0 to @e.  The
+ * others stay unassigned until qemu_vfio_pci_set_irq() is called; they
+ * can only be routed after the fact if they were enabled here.  On return
+ * *@count holds the number of vectors actually enabled.
+ */
+int qemu_vfio_pci_init_irqs(QEMUVFIOState *s, EventNotifier *e,
+                            int irq_type, unsigned *count, Error **errp)
 {
     int r;
+    unsigned i;
     struct vfio_irq_set *irq_set;
     size_t irq_set_size;
     struct vfio_irq_info irq_info = { .argsz = sizeof(irq_info) };
@@ -208,8 +223,9 @@ int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
         error_setg(errp, "Device interrupt doesn't support eventfd");
         return -EINVAL;
     }
+    *count = MAX(MIN(*count, irq_info.count), 1);
 
-    irq_set_size = sizeof(*irq_set) + sizeof(int);
+    irq_set_size = sizeof(*irq_set) + *count * sizeof(int);
     irq_set = g_malloc0(irq_set_size);
 
     /* Get to a known IRQ state */
@@ -218,6 +234,36 @@ int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
         .flags = VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER,
         .index = irq_info.index,
         .start = 0,
+        .count = *count,
+    };
+
+    ((int *)&irq_set->data)[0] = event_notifier_get_fd(e);
+    for (i = 1; i < *count; i++) {
+        ((int *)&irq_set->data)[i] = -1;
+    }
+    r = ioctl(s->device, VFIO_DEVICE_SET_IRQS, irq_set);
+    g_free(irq_set);
+    if (r) {
+        error_setg_errno(errp, errno, "Failed to setup device interrupt");
+        return -errno;
+    }
+    return 0;
+}
+
+/* Route @vector, enabled by qemu_vfio_pci_init_irqs(), to @e */
+int qemu_vfio_pci_set_irq(QEMUVFIOState *s, EventNotifier *e,
+                          int irq_type, unsigned vector, Error **errp)
+{
+    int r;
+    struct vfio_irq_set *irq_set;
+    size_t irq_set_size = sizeof(*irq_set) + sizeof(int);
+
+    irq_set = g_malloc0(irq_set_size);
+    *irq_set = (struct vfio_irq_set) {
+        .argsz = irq_set_size,
+        .flags = VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER,
+        .index = irq_type,
+        .start = vector,
         .count = 1,
     };
 
@@ -225,7 +271,8 @@ int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
     r = ioctl(s->device, VFIO_DEVICE_SET_IRQS, irq_set);
     g_free(irq_set);
     if (r) {
-        error_setg_errno(errp, errno, "Failed to setup device interrupt");
+        error_setg_errno(errp, errno, "Failed to setup device interrupt %u",
+                         vector);
         return -errno;
     }
     return 0;
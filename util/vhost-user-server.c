@@ -51,6 +51,15 @@
  * possible by QIOChannel's support for spurious coroutine re-entry in
  * qio_channel_yield(). The coroutine will restart I/O when re-entered from the
  * new AioContext.
+ *
+ * vhost_user_server_set_queue_aio_contexts() moves the kick fds of the
+ * virtqueues out of VuServer->ctx and spreads them round-robin over a list of
+ * AioContexts, so that each virtqueue is processed in its own IOThread. These
+ * kick fds stay where they are across AioContext switches of the server.
+ * libvhost-user is not thread-safe, so every virtqueue has a lock that is
+ * held while its kick is handled and while the device completes requests on
+ * it, and vu_client_trip() takes all of them from the moment a message has
+ * been read until it has been processed.
  */
 
 static void vmsg_close_fds(VhostUserMsg *vmsg)
@@ -74,6 +83,46 @@ static void panic_cb(VuDev *vu_dev, const char *buf)
     error_report("vu_panic: %s", buf);
 }
 
+void vhost_user_server_lock_queue(VuServer *server, int idx)
+{
+    qemu_rec_mutex_lock(&server->vq_locks[idx]);
+}
+
+void vhost_user_server_unlock_queue(VuServer *server, int idx)
+{
+    qemu_rec_mutex_unlock(&server->vq_locks[idx]);
+}
+
+static void vu_lock_queues(VuServer *server)
+{
+    int i;
+
+    assert(!server->vqs_locked);
+    for (i = 0; i < server->max_queues; i++) {
+        vhost_user_server_lock_queue(server, i);
+    }
+    server->vqs_locked = true;
+}
+
+static void vu_unlock_queues(VuServer *server)
+{
+    int i;
+
+    if (!server->vqs_locked) {
+        return;
+    }
+    server->vqs_locked = false;
+    for (i = server->max_queues - 1; i >= 0; i--) {
+        vhost_user_server_unlock_queue(server, i);
+    }
+}
+
+/* Where a kick fd is monitored */
+static AioContext *vu_fd_watch_ctx(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    return vu_fd_watch->ctx ?: server->ctx;
+}
+
 static bool coroutine_fn
 vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
 {
@@ -160,6 +209,8 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    /* Keep the virtqueues still until vu_dispatch() has processed vmsg */
+    vu_lock_queues(server);
     return true;
 
 fail:
@@ -173,11 +224,18 @@ static coroutine_fn void vu_client_trip(void *opaque)
     VuServer *server = opaque;
     VuDev *vu_dev = &server->vu_dev;
 
-    while (!vu_dev->broken && vu_dispatch(vu_dev)) {
-        /* Keep running */
+    while (!vu_dev->broken) {
+        bool ok = vu_dispatch(vu_dev);
+
+        vu_unlock_queues(server);
+        if (!ok) {
+            break;
+        }
     }
 
+    vu_lock_queues(server);
     vu_deinit(vu_dev);
+    vu_unlock_queues(server);
 
     /* vu_deinit() should have called remove_watch() */
     assert(QTAILQ_EMPTY(&server->vu_fd_watches));
@@ -206,13 +264,18 @@ static void kick_handler(void *opaque)
 {
     VuFdWatch *vu_fd_watch = opaque;
     VuDev *vu_dev = vu_fd_watch->vu_dev;
+    VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+    int queue = vu_fd_watch->queue;
 
-    vu_fd_watch->cb(vu_dev, 0, vu_fd_watch->pvt);
+    vhost_user_server_lock_queue(server, queue);
+    /* The watch may have gone away while we waited for the lock */
+    if (!vu_fd_watch->removed) {
+        vu_fd_watch->cb(vu_dev, 0, vu_fd_watch->pvt);
+    }
+    vhost_user_server_unlock_queue(server, queue);
 
     /* Stop vu_client_trip() if an error occurred in vu_fd_watch->cb() */
-    if (vu_dev->broken) {
-        VuServer *server = container_of(vu_dev, VuServer, vu_dev);
-
+    if (vu_dev->broken && server->ioc) {
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
     }
 }
@@ -239,6 +302,7 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
     g_assert(fd >= 0);
     g_assert(cb);
 
+    qemu_mutex_lock(&server->vu_fd_watches_lock);
     VuFdWatch *vu_fd_watch = find_vu_fd_watch(server, fd);
 
     if (!vu_fd_watch) {
@@ -248,12 +312,19 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
 
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
-        qemu_set_nonblock(fd);
-        aio_set_fd_handler(server->ioc->ctx, fd, true, kick_handler,
-                           NULL, NULL, vu_fd_watch);
+        /* libvhost-user only watches kick fds, with the queue index as pvt */
+        vu_fd_watch->queue = (intptr_t)pvt;
+        if (server->nb_queue_ctx) {
+            vu_fd_watch->ctx = server->queue_ctx[vu_fd_watch->queue %
+                                                 server->nb_queue_ctx];
+        }
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+        qemu_set_nonblock(fd);
+        aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch), fd, true,
+                           kick_handler, NULL, NULL, vu_fd_watch);
     }
+    qemu_mutex_unlock(&server->vu_fd_watches_lock);
 }
 
 
@@ -265,15 +336,29 @@ static void remove_watch(VuDev *vu_dev, int fd)
 
     server = container_of(vu_dev, VuServer, vu_dev);
 
+    qemu_mutex_lock(&server->vu_fd_watches_lock);
     VuFdWatch *vu_fd_watch = find_vu_fd_watch(server, fd);
 
     if (!vu_fd_watch) {
+        qemu_mutex_unlock(&server->vu_fd_watches_lock);
         return;
     }
-    aio_set_fd_handler(server->ioc->ctx, fd, true, NULL, NULL, NULL, NULL);
+    aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch), fd, true,
+                       NULL, NULL, NULL, NULL);
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
-    g_free(vu_fd_watch);
+    qemu_mutex_unlock(&server->vu_fd_watches_lock);
+
+    if (vu_fd_watch->ctx) {
+        /*
+         * kick_handler() may be running in the queue's thread right now, or
+         * waiting there for the queue lock; free the watch after it returns.
+         */
+        vu_fd_watch->removed = true;
+        aio_bh_schedule_oneshot(vu_fd_watch->ctx, g_free, vu_fd_watch);
+    } else {
+        g_free(vu_fd_watch);
+    }
 }
 
 
@@ -332,10 +417,13 @@ void vhost_user_server_stop(VuServer *server)
     if (server->sioc) {
         VuFdWatch *vu_fd_watch;
 
+        qemu_mutex_lock(&server->vu_fd_watches_lock);
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
+            aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch),
+                               vu_fd_watch->fd, true,
                                NULL, NULL, NULL, vu_fd_watch);
         }
+        qemu_mutex_unlock(&server->vu_fd_watches_lock);
 
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
 
@@ -348,6 +436,36 @@ void vhost_user_server_stop(VuServer *server)
         qio_net_listener_disconnect(server->listener);
         object_unref(OBJECT(server->listener));
     }
+
+    if (server->vq_locks) {
+        int i;
+
+        for (i = 0; i < server->max_queues; i++) {
+            qemu_rec_mutex_destroy(&server->vq_locks[i]);
+        }
+        g_free(server->vq_locks);
+        server->vq_locks = NULL;
+    }
+    g_free(server->queue_ctx);
+    server->queue_ctx = NULL;
+    server->nb_queue_ctx = 0;
+    qemu_mutex_destroy(&server->vu_fd_watches_lock);
+}
+
+/*
+ * Handle the kicks of virtqueue i in @ctxs[i % @nb_ctxs] instead of in the
+ * server's AioContext.  Must be called before the first client connects.
+ * The VuDevIface handlers then run in those AioContexts and must complete
+ * requests under vhost_user_server_lock_queue().
+ */
+void vhost_user_server_set_queue_aio_contexts(VuServer *server,
+                                              AioContext **ctxs, int nb_ctxs)
+{
+    assert(!server->sioc);
+
+    g_free(server->queue_ctx);
+    server->queue_ctx = g_memdup(ctxs, nb_ctxs * sizeof(ctxs[0]));
+    server->nb_queue_ctx = nb_ctxs;
 }
 
 /*
@@ -375,10 +493,14 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
 
     qio_channel_attach_aio_context(server->ioc, ctx);
 
+    qemu_mutex_lock(&server->vu_fd_watches_lock);
     QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, true, kick_handler, NULL,
-                           NULL, vu_fd_watch);
+        if (!vu_fd_watch->ctx) {
+            aio_set_fd_handler(ctx, vu_fd_watch->fd, true, kick_handler, NULL,
+                               NULL, vu_fd_watch);
+        }
     }
+    qemu_mutex_unlock(&server->vu_fd_watches_lock);
 
     aio_co_schedule(ctx, server->co_trip);
 }
@@ -389,10 +511,14 @@ void vhost_user_server_detach_aio_context(VuServer *server)
     if (server->sioc) {
         VuFdWatch *vu_fd_watch;
 
+        qemu_mutex_lock(&server->vu_fd_watches_lock);
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
-                               NULL, NULL, NULL, vu_fd_watch);
+            if (!vu_fd_watch->ctx) {
+                aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
+                                   NULL, NULL, NULL, vu_fd_watch);
+            }
         }
+        qemu_mutex_unlock(&server->vu_fd_watches_lock);
 
         qio_channel_detach_aio_context(server->ioc);
     }
@@ -409,6 +535,7 @@ bool vhost_user_server_start(VuServer *server,
 {
     QEMUBH *bh;
     QIONetListener *listener;
+    int i;
 
     if (socket_addr->type != SOCKET_ADDRESS_TYPE_UNIX &&
         socket_addr->type != SOCKET_ADDRESS_TYPE_FD) {
@@ -432,8 +559,14 @@ bool vhost_user_server_start(VuServer *server,
         .vu_iface              = vu_iface,
         .max_queues            = max_queues,
         .ctx                   = ctx,
+        .vq_locks              = g_new(QemuRecMutex, max_queues),
     };
 
+    for (i = 0; i < max_queues; i++) {
+        qemu_rec_mutex_init(&server->vq_locks[i]);
+    }
+    qemu_mutex_init(&server->vu_fd_watches_lock);
+
     qio_net_listener_set_name(server->listener, "vhost-user-backend-listener");
 
     qio_net_listener_set_client_func(server->listener,